@@ -3,7 +3,35 @@
 #include <string.h>
 #include <stdio.h>
 #include "devices/ide.h"
+#include "devices/timer.h"
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Maximum number of sectors in a transfer built by merging
+   several requests. */
+#define BIO_MERGE_MAX (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* Timer ticks a queued request waits for each level its
+   priority is raised. */
+#define BIO_AGING_TICKS 4
+
+/* Number of latency histogram buckets.  Bucket I counts
+   requests that took between 2**I and 2**(I+1) - 1 time stamp
+   counter cycles. */
+#define LATENCY_BUCKETS 40
+
+/* Per-direction request statistics. */
+struct io_stats
+  {
+    unsigned long long requests;        /* Completed requests. */
+    int64_t ticks;                      /* Total latency in timer ticks. */
+    int64_t max_ticks;                  /* Worst latency in timer ticks. */
+    uint64_t cycles;                    /* Total latency in TSC cycles. */
+    uint64_t max_cycles;                /* Worst latency in TSC cycles. */
+    unsigned long long hist[LATENCY_BUCKETS];   /* Latency histogram. */
+  };
 
 /* A block device. */
 struct block
@@ -19,6 +47,30 @@ struct block
 
     unsigned long long read_cnt;        /* Number of sectors read. */
     unsigned long long write_cnt;       /* Number of sectors written. */
+    unsigned long long flush_cnt;       /* Number of cache flushes. */
+
+    /* Request queue. */
+    struct lock queue_lock;             /* Protects the members below. */
+    struct list queue;                  /* Pending bios, sorted by sector. */
+    bool dispatching;                   /* Is a submitter issuing bios? */
+    struct lock dispatch_lock;          /* Held by that submitter. */
+    block_sector_t head;                /* Sector after the last request. */
+    uint8_t *bounce;                    /* Buffer for merged transfers. */
+
+    /* Statistics, protected by queue_lock. */
+    struct io_stats read_stats;         /* Read requests. */
+    struct io_stats write_stats;        /* Write requests. */
+    size_t depth;                       /* Requests queued or in progress. */
+    size_t max_depth;                   /* Largest DEPTH seen. */
+    unsigned long long depth_sum;       /* Sum of DEPTH at each submit. */
+    unsigned long long seq_cnt;         /* Requests following the last. */
+    unsigned long long random_cnt;      /* Other requests. */
+    unsigned long long merge_cnt;       /* Requests merged into another. */
+    block_sector_t last_end;            /* Sector after last submission. */
+    uint64_t busy_cycles;               /* TSC cycles spent in transfers. */
+    int64_t busy_ticks;                 /* Timer ticks spent in transfers. */
+    uint64_t start_tsc;                 /* TSC at registration. */
+    int64_t start_ticks;                /* timer_ticks() at registration. */
   };
 
 /* List of all block devices. */
@@ -28,6 +80,7 @@ static struct list all_blocks = LIST_INITIALIZER (all_blocks);
 static struct block *block_by_role[BLOCK_ROLE_CNT];
 
 static struct block *list_elem_to_block (struct list_elem *);
+static void dispatch (struct block *, struct bio *);
 
 /* Returns a human-readable name for the given block device
    TYPE. */
@@ -113,6 +166,18 @@ check_sector (struct block *block, block_sector_t sector)
     }
 }
 
+/* Verifies that the CNT sectors starting at SECTOR are all
+   within BLOCK.  Panics if not. */
+static void
+check_sectors (struct block *block, block_sector_t sector, size_t cnt)
+{
+  check_sector (block, sector);
+  if (cnt > block->size - sector)
+    PANIC ("Access past end of device %s (sector=%"PRDSNu", cnt=%zu, "
+           "size=%"PRDSNu")\n", block_name (block), sector, cnt,
+           block->size);
+}
+
 /* Reads sector SECTOR from BLOCK into BUFFER, which must
    have room for BLOCK_SECTOR_SIZE bytes.
    Internally synchronizes accesses to block devices, so external
@@ -120,9 +185,7 @@ check_sector (struct block *block, block_sector_t sector)
 void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
-  check_sector (block, sector);
-  block->ops->read (block->aux, sector, buffer);
-  block->read_cnt++;
+  block_read_multiple (block, sector, 1, buffer);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -133,10 +196,354 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
 void
 block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
-  check_sector (block, sector);
-  ASSERT (block->type != BLOCK_FOREIGN);
-  block->ops->write (block->aux, sector, buffer);
-  block->write_cnt++;
+  block_write_multiple (block, sector, 1, buffer);
+}
+
+/* Reads CNT contiguous sectors starting at SECTOR from BLOCK into
+   BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE bytes.
+   Drivers that support it transfer all of the sectors with as
+   few commands as possible.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_read_multiple (struct block *block, block_sector_t sector, size_t cnt,
+                     void *buffer)
+{
+  struct bio bio;
+
+  bio_init (&bio, false, sector, cnt, buffer);
+  block_submit (block, &bio);
+}
+
+/* Writes CNT contiguous sectors starting at SECTOR to BLOCK from
+   BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes.
+   Returns after the block device has acknowledged receiving all
+   of the data.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_write_multiple (struct block *block, block_sector_t sector, size_t cnt,
+                      const void *buffer)
+{
+  struct bio bio;
+
+  bio_init (&bio, true, sector, cnt, (void *) buffer);
+  block_submit (block, &bio);
+}
+
+/* Makes every write to BLOCK that has completed durable, by
+   flushing the device's write cache if it has one.  Writes that
+   are still queued or in progress are not waited for.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_flush (struct block *block)
+{
+  if (block->ops->flush != NULL)
+    {
+      block->ops->flush (block->aux);
+      block->flush_cnt++;
+    }
+}
+
+/* Writes CNT contiguous sectors starting at SECTOR to BLOCK from
+   BUFFER, with interrupts off, bypassing the request queue and
+   the statistics, for a caller that must leave memory and the
+   rest of the kernel untouched while it writes, such as
+   snapshot_save().  Returns true if successful, false if BLOCK's
+   driver cannot write this way or the device is busy or
+   fails. */
+bool
+block_write_polled (struct block *block, block_sector_t sector, size_t cnt,
+                    const void *buffer)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  check_sectors (block, sector, cnt);
+  return (block->ops->write_polled != NULL
+          && block->ops->write_polled (block->aux, sector, cnt, buffer));
+}
+
+/* Returns the average time that writes to BLOCK have taken per
+   sector, in nanoseconds, from submission to completion, or 0 if
+   there have been none. */
+int64_t
+block_write_ns (struct block *block)
+{
+  uint64_t cycles;
+  unsigned long long cnt;
+
+  lock_acquire (&block->queue_lock);
+  cycles = block->write_stats.cycles;
+  cnt = block->write_cnt;
+  lock_release (&block->queue_lock);
+  return cnt > 0 ? timer_cycles_to_ns (cycles / cnt) : 0;
+}
+
+/* Initializes BIO as a request to read (if WRITE is false) or
+   write (if WRITE is true) the CNT sectors starting at SECTOR
+   into or from BUFFER. */
+void
+bio_init (struct bio *bio, bool write, block_sector_t sector, size_t cnt,
+          void *buffer)
+{
+  bio->write = write;
+  bio->sector = sector;
+  bio->cnt = cnt;
+  bio->buffer = buffer;
+  sema_init (&bio->done, 0);
+  bio->completed = false;
+  bio->dispatch = false;
+}
+
+/* Orders requests by first sector. */
+LIST_DEFINE_ORDERED (bio, struct bio, elem, sector)
+
+/* Queues BIO on BLOCK and waits for it to complete.
+
+   There is no dispatcher thread.  If no other thread is issuing
+   BLOCK's requests, the caller becomes the dispatcher and issues
+   queued requests, its own and others', until its own has
+   completed.  It then hands the job to the submitter of the next
+   request in priority and C-LOOK order, if any.  Meanwhile the
+   other submitters donate their priority to the dispatcher, so
+   that a low-priority dispatcher issuing a high-priority
+   thread's request is not held up by threads in between. */
+void
+block_submit (struct block *block, struct bio *bio)
+{
+  if (bio->cnt == 0)
+    return;
+  check_sectors (block, bio->sector, bio->cnt);
+  ASSERT (!bio->write || block->type != BLOCK_FOREIGN);
+
+  if (bio->write)
+    thread_current ()->usage.sectors_written += bio->cnt;
+  else
+    thread_current ()->usage.sectors_read += bio->cnt;
+
+  lock_acquire (&block->queue_lock);
+  bio->submit_ticks = timer_ticks ();
+  bio->submit_tsc = timer_cycles ();
+  bio->priority = thread_get_priority ();
+  if (bio->sector == block->last_end)
+    block->seq_cnt++;
+  else
+    block->random_cnt++;
+  block->last_end = bio->sector + bio->cnt;
+  if (++block->depth > block->max_depth)
+    block->max_depth = block->depth;
+  block->depth_sum += block->depth;
+  bio_insert_ordered (&block->queue, bio);
+  if (!block->dispatching)
+    {
+      block->dispatching = true;
+      dispatch (block, bio);
+    }
+  else
+    {
+      lock_donate (&block->dispatch_lock);
+      lock_release (&block->queue_lock);
+      sema_down (&bio->done);
+      if (!bio->completed)
+        {
+          /* Handed the dispatcher role. */
+          ASSERT (bio->dispatch);
+          lock_acquire (&block->queue_lock);
+          dispatch (block, bio);
+        }
+    }
+}
+
+/* Returns BIO's priority, aged as of tick NOW. */
+static int
+bio_priority (const struct bio *bio, int64_t now)
+{
+  int64_t priority = (bio->priority
+                      + (now - bio->submit_ticks) / BIO_AGING_TICKS);
+  return priority < PRI_MAX ? priority : PRI_MAX;
+}
+
+/* Returns the request in BLOCK's queue to serve next: of those
+   with the highest aged priority, the one that C-LOOK serves
+   first, which is the first at or after BLOCK's head, or the
+   first in the queue if none is.  The queue must not be
+   empty. */
+static struct bio *
+next_bio (struct block *block)
+{
+  int64_t now = timer_ticks ();
+  struct bio *best = NULL;
+  int best_priority = 0;
+  struct list_elem *e;
+
+  ASSERT (!list_empty (&block->queue));
+  for (e = list_begin (&block->queue); e != list_end (&block->queue);
+       e = list_next (e))
+    {
+      struct bio *bio = list_entry (e, struct bio, elem);
+      int priority = bio_priority (bio, now);
+      if (best == NULL || priority > best_priority
+          || (priority == best_priority && best->sector < block->head
+              && bio->sector >= block->head))
+        {
+          best = bio;
+          best_priority = priority;
+        }
+    }
+  return best;
+}
+
+/* Transfers CNT sectors at SECTOR between BLOCK and BUFFER. */
+static void
+issue (struct block *block, bool write, block_sector_t sector, size_t cnt,
+       uint8_t *buffer)
+{
+  size_t i;
+
+  if (write)
+    {
+      if (block->ops->write_multiple != NULL)
+        block->ops->write_multiple (block->aux, sector, cnt, buffer);
+      else
+        for (i = 0; i < cnt; i++)
+          block->ops->write (block->aux, sector + i,
+                             buffer + i * BLOCK_SECTOR_SIZE);
+      block->write_cnt += cnt;
+    }
+  else
+    {
+      if (block->ops->read_multiple != NULL)
+        block->ops->read_multiple (block->aux, sector, cnt, buffer);
+      else
+        for (i = 0; i < cnt; i++)
+          block->ops->read (block->aux, sector + i,
+                            buffer + i * BLOCK_SECTOR_SIZE);
+      block->read_cnt += cnt;
+    }
+}
+
+/* Adds a request that took TICKS timer ticks and CYCLES TSC
+   cycles to STATS. */
+static void
+record_latency (struct io_stats *stats, int64_t ticks, uint64_t cycles)
+{
+  int bucket = 0;
+
+  stats->requests++;
+  stats->ticks += ticks;
+  if (ticks > stats->max_ticks)
+    stats->max_ticks = ticks;
+  stats->cycles += cycles;
+  if (cycles > stats->max_cycles)
+    stats->max_cycles = cycles;
+  while (bucket < LATENCY_BUCKETS - 1 && cycles >> (bucket + 1) != 0)
+    bucket++;
+  stats->hist[bucket]++;
+}
+
+/* Issues BLOCK's queued requests until OWN has completed, then
+   passes the dispatcher role on.  Must be called with BLOCK's
+   queue lock held and returns with it released. */
+static void
+dispatch (struct block *block, struct bio *own)
+{
+  ASSERT (lock_held_by_current_thread (&block->queue_lock));
+  ASSERT (block->dispatching);
+
+  /* Nobody else takes DISPATCH_LOCK, so this does not wait. */
+  lock_acquire (&block->dispatch_lock);
+  while (!own->completed)
+    {
+      struct bio *first = next_bio (block);
+      struct list_elem *last = list_next (&first->elem);
+      block_sector_t end = first->sector + first->cnt;
+      size_t cnt = first->cnt;
+      struct list batch;
+      struct list_elem *e;
+      uint64_t start_tsc, end_tsc;
+      int64_t start_ticks, end_ticks;
+
+      /* Merge the requests that continue where FIRST ends. */
+      while (last != list_end (&block->queue))
+        {
+          struct bio *b = list_entry (last, struct bio, elem);
+          if (b->sector != end || b->write != first->write
+              || cnt + b->cnt > BIO_MERGE_MAX)
+            break;
+          end += b->cnt;
+          cnt += b->cnt;
+          last = list_next (last);
+        }
+
+      /* Take the batch off the queue, so that new requests can be
+         queued while it is in progress. */
+      list_init (&batch);
+      list_splice (list_end (&batch), &first->elem, last);
+      block->head = end;
+      block->merge_cnt += list_size (&batch) - 1;
+      lock_release (&block->queue_lock);
+      start_tsc = timer_cycles ();
+      start_ticks = timer_ticks ();
+
+      if (list_next (&first->elem) == list_end (&batch))
+        issue (block, first->write, first->sector, cnt, first->buffer);
+      else
+        {
+          /* Only the dispatcher uses the bounce buffer. */
+          uint8_t *p;
+
+          if (first->write)
+            for (p = block->bounce, e = list_begin (&batch);
+                 e != list_end (&batch); e = list_next (e))
+              {
+                struct bio *b = list_entry (e, struct bio, elem);
+                memcpy (p, b->buffer, b->cnt * BLOCK_SECTOR_SIZE);
+                p += b->cnt * BLOCK_SECTOR_SIZE;
+              }
+          issue (block, first->write, first->sector, cnt, block->bounce);
+          if (!first->write)
+            for (p = block->bounce, e = list_begin (&batch);
+                 e != list_end (&batch); e = list_next (e))
+              {
+                struct bio *b = list_entry (e, struct bio, elem);
+                memcpy (b->buffer, p, b->cnt * BLOCK_SECTOR_SIZE);
+                p += b->cnt * BLOCK_SECTOR_SIZE;
+              }
+        }
+
+      /* Wake up the submitters.  A bio may go out of scope as
+         soon as its semaphore is up'd, so advance first. */
+      lock_acquire (&block->queue_lock);
+      end_tsc = timer_cycles ();
+      end_ticks = timer_ticks ();
+      block->busy_cycles += end_tsc - start_tsc;
+      block->busy_ticks += end_ticks - start_ticks;
+      for (e = list_begin (&batch); e != list_end (&batch); )
+        {
+          struct bio *b = list_entry (e, struct bio, elem);
+          e = list_next (e);
+          record_latency (b->write ? &block->write_stats : &block->read_stats,
+                          end_ticks - b->submit_ticks,
+                          end_tsc - b->submit_tsc);
+          block->depth--;
+          b->completed = true;
+          if (b != own)
+            sema_up (&b->done);
+        }
+    }
+
+  /* Hand off to the submitter of the next request. */
+  lock_release (&block->dispatch_lock);
+  if (list_empty (&block->queue))
+    block->dispatching = false;
+  else
+    {
+      struct bio *next = next_bio (block);
+      next->dispatch = true;
+      sema_up (&next->done);
+    }
+  lock_release (&block->queue_lock);
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -170,12 +577,61 @@ block_print_stats (void)
     {
       struct block *block = block_by_role[i];
       if (block != NULL)
-        {
-          printf ("%s (%s): %llu reads, %llu writes\n",
-                  block->name, block_type_name (block->type),
-                  block->read_cnt, block->write_cnt);
-        }
+        block_print_device_stats (block);
+    }
+}
+
+/* Prints the latency statistics in STATS, labeled with NAME. */
+static void
+print_io_stats (const char *name, const struct io_stats *stats)
+{
+  int i;
+
+  if (stats->requests == 0)
+    return;
+  printf ("  %s latency: avg %lld ticks, %llu cycles; "
+          "max %lld ticks, %llu cycles\n",
+          name, stats->ticks / (int64_t) stats->requests,
+          stats->cycles / stats->requests,
+          stats->max_ticks, stats->max_cycles);
+  printf ("  %s cycles:", name);
+  for (i = 0; i < LATENCY_BUCKETS; i++)
+    if (stats->hist[i] != 0)
+      printf (" 2^%d:%llu", i, stats->hist[i]);
+  printf ("\n");
+}
+
+/* Prints BLOCK's transfer counts, queue and access pattern
+   statistics, busy time, and request latencies.  Does not take
+   BLOCK's queue lock, because it runs at shutdown, possibly
+   after a panic, so the numbers may be slightly inconsistent. */
+void
+block_print_device_stats (struct block *block)
+{
+  unsigned long long requests;
+  uint64_t elapsed;
+  unsigned busy_pct;
+
+  requests = block->seq_cnt + block->random_cnt;
+  elapsed = timer_cycles () - block->start_tsc;
+  busy_pct = elapsed != 0 ? block->busy_cycles * 100 / elapsed : 0;
+
+  printf ("%s (%s): %llu reads, %llu writes, %llu flushes\n",
+          block->name, block_type_name (block->type),
+          block->read_cnt, block->write_cnt, block->flush_cnt);
+  if (requests != 0)
+    {
+      unsigned long long avg_depth = block->depth_sum * 100 / requests;
+      printf ("  %llu requests (%llu sequential, %llu random, "
+              "%llu merged), queue depth avg %llu.%02llu max %zu\n",
+              requests, block->seq_cnt, block->random_cnt, block->merge_cnt,
+              avg_depth / 100, avg_depth % 100, block->max_depth);
+      printf ("  busy %lld of %lld ticks, %u%% of cycles\n",
+              block->busy_ticks, timer_elapsed (block->start_ticks),
+              busy_pct);
     }
+  print_io_stats ("read", &block->read_stats);
+  print_io_stats ("write", &block->write_stats);
 }
 
 /* Registers a new block device with the given NAME.  If
@@ -200,6 +656,25 @@ block_register (const char *name, enum block_type type,
   block->aux = aux;
   block->read_cnt = 0;
   block->write_cnt = 0;
+  block->flush_cnt = 0;
+  lock_init (&block->queue_lock);
+  list_init (&block->queue);
+  block->dispatching = false;
+  lock_init (&block->dispatch_lock);
+  block->head = 0;
+  memset (&block->read_stats, 0, sizeof block->read_stats);
+  memset (&block->write_stats, 0, sizeof block->write_stats);
+  block->depth = block->max_depth = 0;
+  block->depth_sum = 0;
+  block->seq_cnt = block->random_cnt = block->merge_cnt = 0;
+  block->last_end = 0;
+  block->busy_cycles = 0;
+  block->busy_ticks = 0;
+  block->start_tsc = timer_cycles ();
+  block->start_ticks = timer_ticks ();
+  block->bounce = malloc (BIO_MERGE_MAX * BLOCK_SECTOR_SIZE);
+  if (block->bounce == NULL)
+    PANIC ("Failed to allocate bounce buffer for block device");
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
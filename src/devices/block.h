@@ -1,8 +1,11 @@
 #ifndef DEVICES_BLOCK_H
 #define DEVICES_BLOCK_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <inttypes.h>
+#include <list.h>
+#include "threads/synch.h"
 
 /* Size of a block device sector in bytes.
    All IDE disks use this sector size, as do most USB and SCSI
@@ -53,11 +56,50 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_multiple (struct block *, block_sector_t, size_t cnt, void *);
+void block_write_multiple (struct block *, block_sector_t, size_t cnt,
+                           const void *);
+void block_flush (struct block *);
+bool block_write_polled (struct block *, block_sector_t, size_t cnt,
+                         const void *);
+int64_t block_write_ns (struct block *);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
+/* Block I/O requests.
+
+   block_read() and friends wrap their arguments in a bio and
+   pass it to block_submit(), which queues it on the device.
+   Queued requests are issued highest priority first, by the
+   priority of the thread that submitted each one, raised by one
+   level for every BIO_AGING_TICKS it has waited so that low
+   priority requests are not starved.  Requests of equal priority
+   are issued in C-LOOK order, that is, in ascending sector order
+   starting from the sector after the previous request, wrapping
+   around to the lowest queued sector.  Adjacent requests in the
+   same direction are merged into a single transfer. */
+struct bio
+  {
+    struct list_elem elem;      /* Element in the device's queue. */
+    bool write;                 /* True to write, false to read. */
+    block_sector_t sector;      /* First sector. */
+    size_t cnt;                 /* Number of sectors. */
+    void *buffer;               /* CNT * BLOCK_SECTOR_SIZE bytes. */
+    struct semaphore done;      /* Up'd on completion or hand-off. */
+    bool completed;             /* Has the transfer finished? */
+    bool dispatch;              /* Must the submitter dispatch? */
+    int64_t submit_ticks;       /* timer_ticks() when submitted. */
+    int priority;               /* Submitter's priority. */
+    uint64_t submit_tsc;        /* Time stamp counter when submitted. */
+  };
+
+void bio_init (struct bio *, bool write, block_sector_t, size_t cnt,
+               void *buffer);
+void block_submit (struct block *, struct bio *);
+
 /* Statistics. */
 void block_print_stats (void);
+void block_print_device_stats (struct block *);
 
 /* Lower-level interface to block device drivers. */
 
@@ -65,6 +107,26 @@ struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+
+    /* Optional.  Transfer CNT contiguous sectors at once.  If
+       null, the block layer calls read or write once per
+       sector instead. */
+    void (*read_multiple) (void *aux, block_sector_t, size_t cnt,
+                           void *buffer);
+    void (*write_multiple) (void *aux, block_sector_t, size_t cnt,
+                            const void *buffer);
+
+    /* Optional.  Make every write that has completed durable,
+       e.g. by flushing the device's volatile write cache.  If
+       null, completed writes are taken to be durable already. */
+    void (*flush) (void *aux);
+
+    /* Optional.  Write CNT contiguous sectors with interrupts off,
+       polling the device instead of waiting for its interrupts,
+       without taking locks or sleeping.  Returns true if
+       successful, false if the device is busy or fails. */
+    bool (*write_polled) (void *aux, block_sector_t, size_t cnt,
+                          const void *buffer);
   };
 
 struct block *block_register (const char *name, enum block_type,
@@ -9,6 +9,8 @@
 #include "threads/io.h"
 #include "threads/interrupt.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/trace.h"
 
 /* The code in this file is an interface to an ATA (IDE)
    controller.  It attempts to comply to [ATA-3]. */
@@ -34,9 +36,11 @@
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
+#define CTL_NIEN 0x02           /* Disable interrupts. */
 
 /* Device Register bits. */
 #define DEV_MBS 0xa0            /* Must be set. */
@@ -49,6 +53,14 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_MULTIPLE 0xc4          /* READ MULTIPLE. */
+#define CMD_WRITE_MULTIPLE 0xc5         /* WRITE MULTIPLE. */
+#define CMD_SET_MULTIPLE_MODE 0xc6      /* SET MULTIPLE MODE. */
+#define CMD_FLUSH_CACHE 0xe7            /* FLUSH CACHE. */
+
+/* Maximum number of sectors in a single READ or WRITE command.
+   A sector count register value of 0 means 256. */
+#define MAX_XFER_SECTORS 256
 
 /* An ATA device. */
 struct ata_disk
@@ -57,6 +69,9 @@ struct ata_disk
     struct channel *channel;    /* Channel that disk is attached to. */
     int dev_no;                 /* Device 0 or 1 for master or slave. */
     bool is_ata;                /* Is device an ATA disk? */
+    int multiple_cnt;           /* Sectors per READ/WRITE MULTIPLE data
+                                   block, or 0 if not enabled. */
+    bool flush_ok;              /* Does FLUSH CACHE work? */
   };
 
 /* An ATA channel (aka controller).
@@ -71,6 +86,7 @@ struct channel
     bool expecting_interrupt;   /* True if an interrupt is expected, false if
                                    any interrupt would be spurious. */
     struct semaphore completion_wait;   /* Up'd by interrupt handler. */
+    struct latch *probed;               /* Counted down once probed. */
 
     struct ata_disk devices[2];     /* The devices on this channel. */
   };
@@ -81,11 +97,15 @@ static struct channel channels[CHANNEL_CNT];
 
 static struct block_operations ide_operations;
 
+static void probe_channel (struct channel *);
+static thread_func probe_thread;
 static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
+static void set_multiple_mode (struct ata_disk *, int sector_cnt);
 
-static void select_sector (struct ata_disk *, block_sector_t);
+static void select_sector (struct ata_disk *, block_sector_t, size_t cnt);
+static void set_sector (struct ata_disk *, block_sector_t, size_t cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
@@ -94,6 +114,7 @@ static void wait_until_idle (const struct ata_disk *);
 static bool wait_while_busy (const struct ata_disk *);
 static void select_device (const struct ata_disk *);
 static void select_device_wait (const struct ata_disk *);
+static bool poll_status (const struct channel *, bool drq);
 
 static void interrupt_handler (struct intr_frame *);
 
@@ -101,6 +122,7 @@ static void interrupt_handler (struct intr_frame *);
 void
 ide_init (void) 
 {
+  struct latch probed;
   size_t chan_no;
 
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
@@ -124,6 +146,7 @@ ide_init (void)
           NOT_REACHED ();
         }
       lock_init (&c->lock);
+      lock_set_name (&c->lock, c->name);
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
  
@@ -136,27 +159,68 @@ ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          d->multiple_cnt = 0;
+          d->flush_ok = true;
         }
 
       /* Register interrupt handler. */
       intr_register_ext (c->irq, interrupt_handler, c->name);
+    }
 
-      /* Reset hardware. */
-      reset_channel (c);
+  /* Probe the channels at the same time, because a reset takes
+     most of a second in sleeps, and each channel has a lock of
+     its own.  This thread probes the first channel itself. */
+  latch_init (&probed, CHANNEL_CNT - 1);
+  for (chan_no = 1; chan_no < CHANNEL_CNT; chan_no++)
+    {
+      struct channel *c = &channels[chan_no];
 
-      /* Distinguish ATA hard disks from other devices. */
-      if (check_device_type (&c->devices[0]))
-        check_device_type (&c->devices[1]);
+      c->probed = &probed;
+      if (thread_create (c->name, PRI_DEFAULT, probe_thread, c)
+          == TID_ERROR)
+        probe_thread (c);
+    }
+  probe_channel (&channels[0]);
+  latch_wait (&probed);
+
+  /* Read hard disk identity information, in order, so that disks
+     are registered in the same order on every boot. */
+  for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
+    {
+      struct channel *c = &channels[chan_no];
+      int dev_no;
 
-      /* Read hard disk identity information. */
       for (dev_no = 0; dev_no < 2; dev_no++)
         if (c->devices[dev_no].is_ata)
           identify_ata_device (&c->devices[dev_no]);
     }
 }
-
+
 /* Disk detection and identification. */
 
+/* Resets channel C and finds out which of its devices are ATA
+   disks. */
+static void
+probe_channel (struct channel *c) 
+{
+  reset_channel (c);
+
+  /* Distinguish ATA hard disks from other devices. */
+  if (check_device_type (&c->devices[0]))
+    check_device_type (&c->devices[1]);
+}
+
+/* Thread function that probes channel C_ and then counts down
+   its probed latch. */
+static void
+probe_thread (void *c_) 
+{
+  struct channel *c = c_;
+
+  probe_channel (c);
+  latch_count_down (c->probed);
+}
+
 static char *descramble_ata_string (char *, int size);
 
 /* Resets an ATA channel and waits for any devices present on it
@@ -303,12 +367,38 @@ identify_ata_device (struct ata_disk *d)
       return;
     }
 
+  /* Enable READ/WRITE MULTIPLE with the largest data block the
+     device supports, given by the low byte of word 47. */
+  set_multiple_mode (d, (uint8_t) id[47 * 2]);
+
   /* Register. */
   block = block_register (d->name, BLOCK_RAW, extra_info, capacity,
                           &ide_operations, d);
   partition_scan (block);
 }
 
+/* Sends a SET MULTIPLE MODE command to disk D, so that READ
+   MULTIPLE and WRITE MULTIPLE transfer SECTOR_CNT sectors per
+   interrupt.  Sets D's multiple_cnt to SECTOR_CNT if the disk
+   accepts it, or 0 otherwise. */
+static void
+set_multiple_mode (struct ata_disk *d, int sector_cnt) 
+{
+  struct channel *c = d->channel;
+
+  d->multiple_cnt = 0;
+  if (sector_cnt <= 1)
+    return;
+
+  select_device_wait (d);
+  outb (reg_nsect (c), sector_cnt);
+  issue_pio_command (c, CMD_SET_MULTIPLE_MODE);
+  sema_down (&c->completion_wait);
+  wait_while_busy (d);
+  if ((inb (reg_status (c)) & STA_ERR) == 0)
+    d->multiple_cnt = sector_cnt;
+}
+
 /* Translates STRING, which consists of SIZE bytes in a funky
    format, into a null-terminated string in-place.  Drops
    trailing whitespace and null bytes.  Returns STRING.  */
@@ -337,63 +427,237 @@ descramble_ata_string (char *string, int size)
   return string;
 }
 
-/* Reads sector SEC_NO from disk D into BUFFER, which must have
-   room for BLOCK_SECTOR_SIZE bytes.
+/* Reads CNT sectors starting at SEC_NO from disk D into
+   BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes.  Uses READ MULTIPLE when it is enabled, taking one
+   interrupt per data block of d->multiple_cnt sectors instead of
+   one per sector.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_read (void *d_, block_sector_t sec_no, void *buffer)
+ide_read_multiple (void *d_, block_sector_t sec_no, size_t cnt, void *buffer_)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
+  uint8_t *buffer = buffer_;
+
+  trace (TRACE_IDE_READ, sec_no, cnt);
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
+  while (cnt > 0) 
+    {
+      size_t xfer_cnt = cnt < MAX_XFER_SECTORS ? cnt : MAX_XFER_SECTORS;
+      bool multiple = d->multiple_cnt > 0 && xfer_cnt > 1;
+      size_t block_cnt = multiple ? (size_t) d->multiple_cnt : 1;
+      size_t done;
+
+      select_sector (d, sec_no, xfer_cnt);
+      issue_pio_command (c, (multiple
+                             ? CMD_READ_MULTIPLE
+                             : CMD_READ_SECTOR_RETRY));
+      for (done = 0; done < xfer_cnt; ) 
+        {
+          size_t left = xfer_cnt - done;
+          size_t n = left < block_cnt ? left : block_cnt;
+          size_t i;
+
+          /* Each data block is announced by an interrupt. */
+          sema_down (&c->completion_wait);
+          if (!wait_while_busy (d))
+            PANIC ("%s: disk read failed, sector=%"PRDSNu,
+                   d->name, sec_no + done);
+          for (i = 0; i < n; i++)
+            input_sector (c, buffer + (done + i) * BLOCK_SECTOR_SIZE);
+          done += n;
+        }
+
+      sec_no += xfer_cnt;
+      buffer += xfer_cnt * BLOCK_SECTOR_SIZE;
+      cnt -= xfer_cnt;
+    }
+  lock_release (&c->lock);
+}
+
+/* Writes CNT sectors starting at SEC_NO to disk D from BUFFER,
+   which must contain CNT * BLOCK_SECTOR_SIZE bytes.  Returns
+   after the disk has acknowledged receiving the data.  Uses
+   WRITE MULTIPLE when it is enabled.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_write_multiple (void *d_, block_sector_t sec_no, size_t cnt,
+                    const void *buffer_)
+{
+  struct ata_disk *d = d_;
+  struct channel *c = d->channel;
+  const uint8_t *buffer = buffer_;
+
+  trace (TRACE_IDE_WRITE, sec_no, cnt);
+  lock_acquire (&c->lock);
+  while (cnt > 0) 
+    {
+      size_t xfer_cnt = cnt < MAX_XFER_SECTORS ? cnt : MAX_XFER_SECTORS;
+      bool multiple = d->multiple_cnt > 0 && xfer_cnt > 1;
+      size_t block_cnt = multiple ? (size_t) d->multiple_cnt : 1;
+      size_t done;
+
+      select_sector (d, sec_no, xfer_cnt);
+      issue_pio_command (c, (multiple
+                             ? CMD_WRITE_MULTIPLE
+                             : CMD_WRITE_SECTOR_RETRY));
+      for (done = 0; done < xfer_cnt; ) 
+        {
+          size_t left = xfer_cnt - done;
+          size_t n = left < block_cnt ? left : block_cnt;
+          size_t i;
+
+          /* The first data block goes out as soon as the disk
+             asserts DRQ.  The interrupt after each block asks for
+             the next one, or, after the last, reports
+             completion. */
+          if (!wait_while_busy (d))
+            PANIC ("%s: disk write failed, sector=%"PRDSNu,
+                   d->name, sec_no + done);
+          for (i = 0; i < n; i++)
+            output_sector (c, buffer + (done + i) * BLOCK_SECTOR_SIZE);
+          done += n;
+          sema_down (&c->completion_wait);
+        }
+
+      sec_no += xfer_cnt;
+      buffer += xfer_cnt * BLOCK_SECTOR_SIZE;
+      cnt -= xfer_cnt;
+    }
   lock_release (&c->lock);
 }
 
+/* Reads sector SEC_NO from disk D into BUFFER, which must have
+   room for BLOCK_SECTOR_SIZE bytes. */
+static void
+ide_read (void *d, block_sector_t sec_no, void *buffer)
+{
+  ide_read_multiple (d, sec_no, 1, buffer);
+}
+
 /* Write sector SEC_NO to disk D from BUFFER, which must contain
    BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
-   acknowledged receiving the data.
+   acknowledged receiving the data. */
+static void
+ide_write (void *d, block_sector_t sec_no, const void *buffer)
+{
+  ide_write_multiple (d, sec_no, 1, buffer);
+}
+
+/* Writes CNT sectors starting at SEC_NO to disk D from BUFFER
+   with interrupts off, polling the status register instead of
+   waiting for completion interrupts, which the disk is told not
+   to raise meanwhile.  Neither takes locks nor sleeps.  Returns
+   false if the disk fails, or if either channel is in use: a
+   transfer that was interrupted to get here is waiting for an
+   interrupt that would never come if this one went ahead. */
+static bool
+ide_write_polled (void *d_, block_sector_t sec_no, size_t cnt,
+                  const void *buffer_)
+{
+  struct ata_disk *d = d_;
+  struct channel *c = d->channel;
+  const uint8_t *buffer = buffer_;
+  bool ok = true;
+  size_t i;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (i = 0; i < CHANNEL_CNT; i++)
+    if (channels[i].lock.holder != NULL)
+      return false;
+
+  outb (reg_ctl (c), CTL_NIEN);
+  while (ok && cnt > 0)
+    {
+      size_t xfer_cnt = cnt < MAX_XFER_SECTORS ? cnt : MAX_XFER_SECTORS;
+
+      outb (reg_device (c), DEV_MBS | (d->dev_no == 1 ? DEV_DEV : 0));
+      timer_ndelay (400);
+      ok = poll_status (c, false);
+      if (!ok)
+        break;
+      set_sector (d, sec_no, xfer_cnt);
+      outb (reg_command (c), CMD_WRITE_SECTOR_RETRY);
+      for (i = 0; ok && i < xfer_cnt; i++)
+        {
+          ok = poll_status (c, true);
+          if (ok)
+            output_sector (c, buffer + i * BLOCK_SECTOR_SIZE);
+        }
+      ok = ok && poll_status (c, false);
+
+      sec_no += xfer_cnt;
+      buffer += xfer_cnt * BLOCK_SECTOR_SIZE;
+      cnt -= xfer_cnt;
+    }
+  outb (reg_ctl (c), 0);
+  return ok;
+}
+
+/* Makes the writes that disk D has acknowledged durable, by
+   having it write out its volatile write cache.  Returns once
+   the disk reports that the cache is empty.  A disk that aborts
+   the command has no cache to flush, or will not say, so it is
+   not asked again.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_write (void *d_, block_sector_t sec_no, const void *buffer)
+ide_flush (void *d_)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
+
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
+  if (d->flush_ok)
+    {
+      select_device_wait (d);
+      issue_pio_command (c, CMD_FLUSH_CACHE);
+      sema_down (&c->completion_wait);
+      wait_until_idle (d);
+      if (inb (reg_status (c)) & STA_ERR)
+        {
+          printf ("%s: FLUSH CACHE not supported\n", d->name);
+          d->flush_ok = false;
+        }
+    }
   lock_release (&c->lock);
 }
 
 static struct block_operations ide_operations =
   {
     ide_read,
-    ide_write
+    ide_write,
+    ide_read_multiple,
+    ide_write_multiple,
+    ide_flush,
+    ide_write_polled
   };
 
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and the sector count CNT to the disk's sector
+   selection registers.  (We use LBA mode.) */
+static void
+select_sector (struct ata_disk *d, block_sector_t sec_no, size_t cnt)
+{
+  select_device_wait (d);
+  set_sector (d, sec_no, cnt);
+}
+
+/* Writes SEC_NO and the sector count CNT to the sector selection
+   registers of disk D, which must be selected and ready. */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+set_sector (struct ata_disk *d, block_sector_t sec_no, size_t cnt)
 {
   struct channel *c = d->channel;
 
   ASSERT (sec_no < (1UL << 28));
-  
-  select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  ASSERT (cnt >= 1 && cnt <= MAX_XFER_SECTORS);
+
+  outb (reg_nsect (c), cnt % MAX_XFER_SECTORS);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
@@ -502,6 +766,26 @@ select_device_wait (const struct ata_disk *d)
   wait_until_idle (d);
 }
 
+/* Busy waits up to 30 seconds for channel C to clear BSY, with
+   interrupts off.  Returns true if the command so far has not
+   failed and, if DRQ is true, the disk wants data, or if DRQ is
+   false, it is idle. */
+static bool
+poll_status (const struct channel *c, bool drq)
+{
+  long i;
+
+  for (i = 0; i < 3000000; i++)
+    {
+      uint8_t status = inb (reg_alt_status (c));
+      if (!(status & STA_BSY))
+        return (!(status & STA_ERR)
+                && ((status & STA_DRQ) != 0) == drq);
+      timer_udelay (10);
+    }
+  return false;
+}
+
 /* ATA interrupt handler. */
 static void
 interrupt_handler (struct intr_frame *f) 
@@ -1,43 +1,145 @@
 #include "devices/input.h"
 #include <debug.h>
-#include "devices/intq.h"
+#include <ring.h>
+#include <stdio.h>
+#include <string.h>
 #include "devices/serial.h"
+#include "threads/interrupt.h"
+#include "threads/poll.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
 
-/* Stores keys from the keyboard and serial port. */
-static struct intq buffer;
+/* Line discipline for keys from the keyboard and serial port.
+
+   input_putc(), called by their interrupt handlers, echoes each
+   key and adds it to the line being edited.  Backspace and
+   Delete erase the last character of that line and Ctrl+U all
+   of it, right there in the interrupt handler, and a carriage
+   return is taken as a new-line.  Only when the line is ended by
+   a new-line, or fills LINE_SIZE bytes, is it released, all at
+   once, to READY, from which readers take it.  A reader waiting
+   for input is thus woken once per line, not once per key.
+
+   A finished line that does not fit into READY yet stays where
+   it is, and input_full() is true until a reader makes room.
+
+   Threads polling for input wait on POLLERS, woken along with
+   the reader whenever a line is released. */
+
+/* Longest line that is released at once.  A longer one is
+   released in pieces of this size. */
+#define LINE_SIZE 128
+
+/* Bytes released to readers but not yet read. */
+#define READY_SIZE 256
+static struct ring ready;
+static uint8_t ready_space[READY_SIZE];
+
+/* The line being edited. */
+static uint8_t line[LINE_SIZE];
+static size_t line_len;
+static bool line_done;          /* Finished, but waiting for room? */
+
+/* Readers take turns with READ_LOCK.  The one whose turn it is
+   waits in READER, if it must wait. */
+static struct lock read_lock;
+static struct thread *reader;
+static struct poll_queue pollers;
+
+static void erase (void);
+static void release_line (void);
 
 /* Initializes the input buffer. */
 void
-input_init (void) 
+input_init (void)
 {
-  intq_init (&buffer);
+  ring_init (&ready, ready_space, READY_SIZE, 1);
+  lock_init (&read_lock);
+  poll_queue_init (&pollers);
 }
 
-/* Adds a key to the input buffer.
+/* Adds a key to the line being edited.
    Interrupts must be off and the buffer must not be full. */
 void
-input_putc (uint8_t key) 
+input_putc (uint8_t key)
 {
   ASSERT (intr_get_level () == INTR_OFF);
-  ASSERT (!intq_full (&buffer));
+  ASSERT (!input_full ());
 
-  intq_putc (&buffer, key);
+  if (key == '\r')
+    key = '\n';
+  if (key == '\b' || key == 0x7f)
+    erase ();
+  else if (key == ('U' - 'A') + 1)
+    while (line_len > 0)
+      erase ();
+  else
+    {
+      putchar (key);
+      line[line_len++] = key;
+      if (key == '\n' || line_len == LINE_SIZE)
+        {
+          line_done = true;
+          release_line ();
+        }
+    }
   serial_notify ();
 }
 
-/* Retrieves a key from the input buffer.
-   If the buffer is empty, waits for a key to be pressed. */
-uint8_t
-input_getc (void) 
+/* Reads up to SIZE bytes of input into BUFFER, waiting until
+   there is at least one.  Stops after a new-line, so that each
+   call returns no more than one line.  Returns the number of
+   bytes read, which is at least 1 if SIZE is nonzero. */
+size_t
+input_read (void *buffer_, size_t size)
 {
+  uint8_t *buffer = buffer_;
   enum intr_level old_level;
-  uint8_t key;
+  size_t cnt = 0;
+
+  if (size == 0)
+    return 0;
 
+  lock_acquire (&read_lock);
   old_level = intr_disable ();
-  key = intq_getc (&buffer);
+  while (ring_empty (&ready))
+    {
+      reader = thread_current ();
+      thread_block ();
+    }
+  while (cnt < size && ring_get (&ready, &buffer[cnt]))
+    if (buffer[cnt++] == '\n')
+      break;
+  release_line ();
   serial_notify ();
   intr_set_level (old_level);
-  
+  lock_release (&read_lock);
+
+  return cnt;
+}
+
+/* Puts E on the input's poll queue and returns POLLIN if input
+   is ready to read, 0 otherwise. */
+unsigned
+input_poll (struct poll_entry *e)
+{
+  enum intr_level old_level = intr_disable ();
+  bool ready_to_read;
+
+  poll_entry_add (e, &pollers);
+  ready_to_read = !ring_empty (&ready);
+  intr_set_level (old_level);
+  return ready_to_read ? POLLIN : 0;
+}
+
+/* Retrieves a key from the input buffer.
+   If the buffer is empty, waits for a line of input. */
+uint8_t
+input_getc (void)
+{
+  uint8_t key;
+
+  input_read (&key, 1);
   return key;
 }
 
@@ -45,8 +147,45 @@ input_getc (void)
    false otherwise.
    Interrupts must be off. */
 bool
-input_full (void) 
+input_full (void)
 {
   ASSERT (intr_get_level () == INTR_OFF);
-  return intq_full (&buffer);
+  return line_done;
+}
+
+/* Erases the last character of the line being edited, if any,
+   on the screen as well. */
+static void
+erase (void)
+{
+  if (line_len > 0)
+    {
+      line_len--;
+      printf ("\b \b");
+    }
+}
+
+/* Releases the line being edited to readers if it is finished
+   and there is room for it, and then wakes the waiting reader,
+   if any.  Interrupts must be off. */
+static void
+release_line (void)
+{
+  size_t i;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (!line_done || READY_SIZE - ring_size (&ready) < line_len)
+    return;
+  for (i = 0; i < line_len; i++)
+    ring_put (&ready, &line[i]);
+  line_len = 0;
+  line_done = false;
+
+  poll_queue_wake (&pollers);
+  if (reader != NULL)
+    {
+      thread_unblock (reader);
+      reader = NULL;
+    }
 }
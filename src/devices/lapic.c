@@ -0,0 +1,307 @@
+#include "devices/lapic.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include "devices/timer.h"
+#include "threads/init.h"
+#include "threads/interrupt.h"
+#include "threads/io.h"
+#include "threads/palloc.h"
+#include "threads/pte.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Local APIC and its timer.
+
+   See [IA32-v3a] chapter 10 "Advanced Programmable Interrupt
+   Controller (APIC)".  The local APIC's registers are memory
+   mapped at a physical address far above RAM, so lapic_init()
+   maps them uncached at LAPIC_VADDR, the last page of the
+   kernel's virtual address space, which RAM never reaches
+   because Pintos uses at most 64 MB.
+
+   Pintos still takes its device interrupts through the 8259A PIC,
+   so the local APIC is set up in "virtual wire" mode, passing the
+   PIC's interrupts through on LINT0.  Its only interrupt source of
+   its own is the timer, which counts down from an initial count
+   at a fixed rate and interrupts when it reaches zero.  Its rate
+   is the bus clock divided by 16 and differs from machine to
+   machine, so lapic_timer_calibrate() measures it against the
+   time-stamp counter.
+
+   On a multiprocessor, every processor has a local APIC of its
+   own at the same address.  They interrupt each other through
+   the interrupt command register (ICR): lapic_start_ap() starts
+   an application processor and lapic_send_ipi() sends an
+   interprocessor interrupt (IPI). */
+
+#define LAPIC_VADDR ((void *) 0xfffff000)
+
+/* Register offsets. */
+#define LAPIC_TPR 0x080         /* Task priority. */
+#define LAPIC_EOI 0x0b0         /* End of interrupt. */
+#define LAPIC_SVR 0x0f0         /* Spurious interrupt vector. */
+#define LAPIC_ICR_LO 0x300      /* Interrupt command, low half. */
+#define LAPIC_ICR_HI 0x310      /* Interrupt command, high half. */
+#define LAPIC_LVT_TIMER 0x320   /* Local vector table: timer. */
+#define LAPIC_LVT_LINT0 0x350   /* Local vector table: LINT0 pin. */
+#define LAPIC_LVT_LINT1 0x360   /* Local vector table: LINT1 pin. */
+#define LAPIC_LVT_ERROR 0x370   /* Local vector table: errors. */
+#define LAPIC_TIMER_INIT 0x380  /* Timer initial count. */
+#define LAPIC_TIMER_CUR 0x390   /* Timer current count. */
+#define LAPIC_TIMER_DIV 0x3e0   /* Timer divide configuration. */
+
+#define SVR_ENABLE 0x100        /* Software enable. */
+#define LVT_MASKED 0x10000      /* Interrupt masked. */
+#define LVT_EXTINT 0x700        /* Delivery mode: ExtINT. */
+#define LVT_NMI 0x400           /* Delivery mode: NMI. */
+#define TIMER_DIV_16 0x3        /* Divide the bus clock by 16. */
+
+/* Interrupt command register bits. */
+#define ICR_INIT 0x500          /* Delivery mode: INIT. */
+#define ICR_STARTUP 0x600       /* Delivery mode: startup IPI. */
+#define ICR_PENDING 0x1000      /* Delivery status: still sending. */
+#define ICR_ASSERT 0x4000       /* Level: assert. */
+#define ICR_LEVEL 0x8000        /* Trigger mode: level. */
+#define ICR_DEST_SHIFT 24       /* Destination APIC ID, in ICR_HI. */
+
+/* CMOS shutdown code and BIOS warm reset vector, through which a
+   processor that the INIT IPI resets to the BIOS finds its way to
+   the startup code.  See the MultiProcessor Specification,
+   appendix B.4. */
+#define CMOS_SHUTDOWN 0x0f
+#define SHUTDOWN_WARM_RESET 0x0a
+#define WARM_RESET_VECTOR 0x467
+
+/* IA32_APIC_BASE model-specific register. */
+#define MSR_APIC_BASE 0x1b
+#define APIC_BASE_ENABLE 0x800  /* APIC globally enabled. */
+
+#define CPUID_APIC (1 << 9)     /* Local APIC present. */
+
+/* Nanoseconds over which lapic_timer_calibrate() counts. */
+#define CALIBRATE_NS (10 * 1000 * 1000)
+
+/* Registers, or a null pointer if there is no usable local APIC. */
+static volatile uint32_t *lapic;
+
+/* Timer counts per second, or 0 before calibration. */
+static uint64_t timer_hz;
+
+static intr_handler_func spurious_interrupt;
+
+static inline uint32_t
+lapic_read (unsigned reg)
+{
+  return lapic[reg / 4];
+}
+
+static inline void
+lapic_write (unsigned reg, uint32_t value)
+{
+  lapic[reg / 4] = value;
+}
+
+/* Maps and enables the local APIC, if the CPU has one.  Returns
+   true if successful.  Must be called after paging_init() and
+   intr_init(), and before any process is created, so that every
+   page directory copies the mapping. */
+bool
+lapic_init (void)
+{
+  uint32_t eax = 1, ebx, ecx, edx;
+  uint32_t base_lo, base_hi;
+  uint32_t *pde, *pt;
+
+  asm ("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+  if (!(edx & CPUID_APIC))
+    return false;
+  asm volatile ("rdmsr" : "=a" (base_lo), "=d" (base_hi) : "c" (MSR_APIC_BASE));
+  if (!(base_lo & APIC_BASE_ENABLE) || base_hi != 0)
+    return false;
+
+  /* Map the registers, uncached. */
+  pde = &init_page_dir[pd_no (LAPIC_VADDR)];
+  if (*pde == 0)
+    *pde = pde_create (palloc_get_page (PAL_ASSERT | PAL_ZERO));
+  ASSERT (!(*pde & PDE_PS));
+  pt = pde_get_pt (*pde);
+  pt[pt_no (LAPIC_VADDR)] = ((base_lo & PTE_ADDR) | PTE_P | PTE_W
+                             | PTE_PWT | PTE_PCD);
+  asm volatile ("invlpg (%0)" : : "r" (LAPIC_VADDR) : "memory");
+  lapic = LAPIC_VADDR;
+
+  /* Enable it in virtual wire mode, with the timer masked. */
+  lapic_write (LAPIC_SVR, SVR_ENABLE | LAPIC_SPURIOUS_VEC);
+  lapic_write (LAPIC_LVT_LINT0, LVT_EXTINT);
+  lapic_write (LAPIC_LVT_LINT1, LVT_NMI);
+  lapic_write (LAPIC_LVT_ERROR, LVT_MASKED);
+  lapic_write (LAPIC_TIMER_DIV, TIMER_DIV_16);
+  lapic_write (LAPIC_LVT_TIMER, LVT_MASKED | LAPIC_TIMER_VEC);
+  lapic_write (LAPIC_TIMER_INIT, 0);
+
+  intr_register_int (LAPIC_SPURIOUS_VEC, 0, INTR_OFF, spurious_interrupt,
+                     "LAPIC Spurious");
+  return true;
+}
+
+/* Enables the local APIC of the application processor that calls
+   it, after lapic_init() has mapped the registers.  Only the
+   bootstrap processor takes the PIC's interrupts, so LINT0 stays
+   masked. */
+void
+lapic_init_ap (void)
+{
+  ASSERT (lapic != NULL);
+
+  lapic_write (LAPIC_SVR, SVR_ENABLE | LAPIC_SPURIOUS_VEC);
+  lapic_write (LAPIC_TPR, 0);
+  lapic_write (LAPIC_LVT_LINT0, LVT_MASKED);
+  lapic_write (LAPIC_LVT_LINT1, LVT_NMI);
+  lapic_write (LAPIC_LVT_ERROR, LVT_MASKED);
+  lapic_write (LAPIC_TIMER_DIV, TIMER_DIV_16);
+  lapic_write (LAPIC_LVT_TIMER, LVT_MASKED | LAPIC_TIMER_VEC);
+  lapic_write (LAPIC_TIMER_INIT, 0);
+}
+
+/* Returns true if lapic_init() found and enabled a local APIC. */
+bool
+lapic_available (void)
+{
+  return lapic != NULL;
+}
+
+/* Acknowledges the interrupt that the local APIC delivered last. */
+void
+lapic_eoi (void)
+{
+  lapic_write (LAPIC_EOI, 0);
+}
+
+/* Waits until the local APIC has sent the last interprocessor
+   interrupt written to the ICR. */
+static void
+wait_for_icr (void)
+{
+  while (lapic_read (LAPIC_ICR_LO) & ICR_PENDING)
+    asm volatile ("pause");
+}
+
+/* Writes the ICR to send the interrupt described by LO to the
+   processor whose local APIC ID is LAPIC_ID. */
+static void
+write_icr (uint8_t lapic_id, uint32_t lo)
+{
+  wait_for_icr ();
+  lapic_write (LAPIC_ICR_HI, (uint32_t) lapic_id << ICR_DEST_SHIFT);
+  lapic_write (LAPIC_ICR_LO, lo);
+}
+
+/* Sends interrupt VEC to the processor whose local APIC ID is
+   LAPIC_ID. */
+void
+lapic_send_ipi (uint8_t lapic_id, uint8_t vec)
+{
+  enum intr_level old_level;
+
+  ASSERT (lapic != NULL);
+
+  /* An interrupt handler on this CPU that sent an IPI between
+     the two halves of the ICR would redirect this one. */
+  old_level = intr_disable ();
+  write_icr (lapic_id, vec);
+  intr_set_level (old_level);
+}
+
+/* Starts the application processor whose local APIC ID is
+   LAPIC_ID running, in real mode, the code at physical address
+   START, which must be page-aligned and below 1 MB, with the
+   INIT-SIPI-SIPI sequence of the MultiProcessor Specification,
+   appendix B.4. */
+void
+lapic_start_ap (uint8_t lapic_id, uintptr_t start)
+{
+  uint16_t *warm_reset = ptov (WARM_RESET_VECTOR);
+  int i;
+
+  ASSERT (lapic != NULL);
+  ASSERT (start % PGSIZE == 0 && start < 0x100000);
+
+  outb (0x70, CMOS_SHUTDOWN);
+  outb (0x71, SHUTDOWN_WARM_RESET);
+  warm_reset[0] = 0;
+  warm_reset[1] = start >> 4;
+
+  write_icr (lapic_id, ICR_INIT | ICR_LEVEL | ICR_ASSERT);
+  timer_udelay (200);
+  write_icr (lapic_id, ICR_INIT | ICR_LEVEL);
+  timer_mdelay (10);
+
+  for (i = 0; i < 2; i++)
+    {
+      write_icr (lapic_id, ICR_STARTUP | (start >> 12));
+      timer_udelay (200);
+    }
+  wait_for_icr ();
+}
+
+/* Measures the timer's rate against the time-stamp counter, by
+   letting it count down for CALIBRATE_NS nanoseconds with its
+   interrupt masked.  That takes only a fraction of a timer tick
+   and does not wait for the PIT, so it must follow
+   timer_calibrate(). */
+void
+lapic_timer_calibrate (void)
+{
+  uint32_t counted;
+  int64_t start, elapsed;
+
+  if (lapic == NULL)
+    return;
+
+  start = timer_ns ();
+  lapic_write (LAPIC_TIMER_INIT, UINT32_MAX);
+  while ((elapsed = timer_ns () - start) < CALIBRATE_NS)
+    barrier ();
+  counted = UINT32_MAX - lapic_read (LAPIC_TIMER_CUR);
+  lapic_write (LAPIC_TIMER_INIT, 0);
+
+  timer_hz = (uint64_t) counted * 1000000000 / elapsed;
+  printf ("Local APIC timer: %'"PRIu64" counts/s.\n", timer_hz);
+}
+
+/* Returns true if lapic_timer_oneshot() may be used. */
+bool
+lapic_timer_available (void)
+{
+  return timer_hz != 0;
+}
+
+/* Arms the timer to interrupt once, on LAPIC_TIMER_VEC, after NS
+   nanoseconds, replacing any earlier deadline.  Deadlines too far
+   away for the 32-bit counter are cut short, so the interrupt
+   handler must check whether its deadline really arrived. */
+void
+lapic_timer_oneshot (int64_t ns)
+{
+  uint64_t count;
+
+  ASSERT (lapic_timer_available ());
+
+  if (ns < 1)
+    ns = 1;
+  count = ((uint64_t) ns / 1000000000 * timer_hz
+           + (uint64_t) ns % 1000000000 * timer_hz / 1000000000);
+  if (count == 0)
+    count = 1;
+  else if (count > UINT32_MAX)
+    count = UINT32_MAX;
+  lapic_write (LAPIC_LVT_TIMER, LAPIC_TIMER_VEC);
+  lapic_write (LAPIC_TIMER_INIT, count);
+}
+
+/* A spurious interrupt must not be acknowledged. */
+static void
+spurious_interrupt (struct intr_frame *f UNUSED)
+{
+}
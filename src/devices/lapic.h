@@ -0,0 +1,25 @@
+#ifndef DEVICES_LAPIC_H
+#define DEVICES_LAPIC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Interrupt vectors delivered by the local APIC. */
+#define LAPIC_TIMER_VEC 0xf0    /* Local APIC timer. */
+#define LAPIC_TICK_VEC 0xf1     /* Timer tick, passed on by the BSP. */
+#define LAPIC_RESCHED_VEC 0xf2  /* A thread became ready here. */
+#define LAPIC_FLUSH_VEC 0xf3    /* TLB shootdown. */
+#define LAPIC_SPURIOUS_VEC 0xff /* Spurious interrupt. */
+
+bool lapic_init (void);
+void lapic_init_ap (void);
+bool lapic_available (void);
+void lapic_eoi (void);
+void lapic_send_ipi (uint8_t lapic_id, uint8_t vec);
+void lapic_start_ap (uint8_t lapic_id, uintptr_t start);
+
+void lapic_timer_calibrate (void);
+bool lapic_timer_available (void);
+void lapic_timer_oneshot (int64_t ns);
+
+#endif /* devices/lapic.h */
@@ -0,0 +1,112 @@
+#include "devices/ramdisk.h"
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* A block device kept in memory, in pages from the kernel pool.
+   Transfers are just copies, so it serves as a file system,
+   scratch or swap device that is free of the latency of an IDE
+   disk, for benchmarks and as a fast swap tier.  Its contents
+   are lost at shutdown.  It registers as a raw device, "ram0",
+   which takes a role only when named, e.g. with -filesys=ram0. */
+
+/* Sectors per page. */
+#define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* A RAM disk. */
+struct ramdisk
+  {
+    uint8_t **pages;            /* Backing pages. */
+    size_t page_cnt;            /* Number of PAGES. */
+  };
+
+static struct ramdisk ramdisk;
+static struct block_operations ramdisk_operations;
+
+/* Returns the address of sector SECTOR in RD. */
+static uint8_t *
+sector_addr (const struct ramdisk *rd, block_sector_t sector)
+{
+  ASSERT (sector / SECTORS_PER_PAGE < rd->page_cnt);
+  return (rd->pages[sector / SECTORS_PER_PAGE]
+          + sector % SECTORS_PER_PAGE * BLOCK_SECTOR_SIZE);
+}
+
+/* Creates and registers a RAM disk of KB kilobytes, rounded up
+   to a whole number of pages.  Panics if memory runs out. */
+void
+ramdisk_init (size_t kb) 
+{
+  size_t i;
+
+  if (kb == 0)
+    return;
+  ramdisk.page_cnt = DIV_ROUND_UP (kb * 1024, PGSIZE);
+  ramdisk.pages = malloc (ramdisk.page_cnt * sizeof *ramdisk.pages);
+  if (ramdisk.pages == NULL)
+    PANIC ("ram0: out of memory for page table");
+  for (i = 0; i < ramdisk.page_cnt; i++)
+    {
+      ramdisk.pages[i] = palloc_get_page (PAL_ZERO);
+      if (ramdisk.pages[i] == NULL)
+        PANIC ("ram0: out of memory after %zu of %zu pages",
+               i, ramdisk.page_cnt);
+    }
+
+  block_register ("ram0", BLOCK_RAW, "RAM disk",
+                  ramdisk.page_cnt * SECTORS_PER_PAGE,
+                  &ramdisk_operations, &ramdisk);
+}
+
+/* Reads CNT sectors starting at SECTOR from RD_ into BUFFER_. */
+static void
+ramdisk_read_multiple (void *rd_, block_sector_t sector, size_t cnt,
+                       void *buffer_) 
+{
+  struct ramdisk *rd = rd_;
+  uint8_t *buffer = buffer_;
+
+  for (; cnt > 0; cnt--, sector++, buffer += BLOCK_SECTOR_SIZE)
+    memcpy (buffer, sector_addr (rd, sector), BLOCK_SECTOR_SIZE);
+}
+
+/* Writes CNT sectors starting at SECTOR in RD_ from BUFFER_. */
+static void
+ramdisk_write_multiple (void *rd_, block_sector_t sector, size_t cnt,
+                        const void *buffer_) 
+{
+  struct ramdisk *rd = rd_;
+  const uint8_t *buffer = buffer_;
+
+  for (; cnt > 0; cnt--, sector++, buffer += BLOCK_SECTOR_SIZE)
+    memcpy (sector_addr (rd, sector), buffer, BLOCK_SECTOR_SIZE);
+}
+
+/* Reads sector SECTOR from RD_ into BUFFER. */
+static void
+ramdisk_read (void *rd_, block_sector_t sector, void *buffer) 
+{
+  ramdisk_read_multiple (rd_, sector, 1, buffer);
+}
+
+/* Writes sector SECTOR in RD_ from BUFFER. */
+static void
+ramdisk_write (void *rd_, block_sector_t sector, const void *buffer) 
+{
+  ramdisk_write_multiple (rd_, sector, 1, buffer);
+}
+
+static struct block_operations ramdisk_operations =
+  {
+    ramdisk_read,
+    ramdisk_write,
+    ramdisk_read_multiple,
+    ramdisk_write_multiple,
+    NULL,
+    NULL
+  };
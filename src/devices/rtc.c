@@ -1,6 +1,8 @@
 #include "devices/rtc.h"
+#include <debug.h>
 #include <round.h>
 #include <stdio.h>
+#include "threads/interrupt.h"
 #include "threads/io.h"
 
 /* This code is an interface to the MC146818A-compatible real
@@ -29,14 +31,21 @@
 
 /* Register A. */
 #define RTCSA_UIP	0x80	/* Set while time update in progress. */
+#define RTCSA_RATE	0x0f	/* Periodic interrupt rate select. */
 
 /* Register B. */
 #define	RTCSB_SET	0x80	/* Disables update to let time be set. */
+#define RTCSB_PIE	0x40	/* Periodic interrupt enable. */
 #define RTCSB_DM	0x04	/* 0 = BCD time format, 1 = binary format. */
 #define RTCSB_24HR	0x02    /* 0 = 12-hour format, 1 = 24-hour format. */
 
 static int bcd_to_bin (uint8_t);
 static uint8_t cmos_read (uint8_t index);
+static void cmos_write (uint8_t index, uint8_t data);
+
+/* Handler for the periodic interrupt, if it is running. */
+static intr_handler_func *periodic_handler;
+static intr_handler_func rtc_interrupt;
 
 /* Returns number of seconds since Unix epoch of January 1,
    1970. */
@@ -96,6 +105,43 @@ rtc_get_time (void)
   return time;
 }
 
+/* Starts the RTC's periodic interrupt, which calls HANDLER from
+   the interrupt each time it fires.  The rate is HZ rounded down
+   to a power of 2 between 2 and 8192.  Returns the actual rate.
+   May be called only once. */
+unsigned
+rtc_start_periodic (unsigned hz, intr_handler_func *handler) 
+{
+  enum intr_level old_level;
+  int rate;
+
+  ASSERT (periodic_handler == NULL);
+
+  /* Rate select value R gives 32768 >> (R - 1) Hz, for R in 3
+     through 15. */
+  for (rate = 3; rate < 15 && (32768u >> (rate - 1)) > hz; rate++)
+    continue;
+
+  old_level = intr_disable ();
+  periodic_handler = handler;
+  intr_register_ext (0x28, rtc_interrupt, "RTC");
+  cmos_write (RTC_REG_A, (cmos_read (RTC_REG_A) & ~RTCSA_RATE) | rate);
+  cmos_write (RTC_REG_B, cmos_read (RTC_REG_B) | RTCSB_PIE);
+  cmos_read (RTC_REG_C);
+  intr_set_level (old_level);
+
+  return 32768u >> (rate - 1);
+}
+
+/* RTC interrupt handler.  Reading register C acknowledges the
+   interrupt, without which the RTC raises no more. */
+static void
+rtc_interrupt (struct intr_frame *f) 
+{
+  cmos_read (RTC_REG_C);
+  periodic_handler (f);
+}
+
 /* Returns the integer value of the given BCD byte. */
 static int
 bcd_to_bin (uint8_t x)
@@ -111,3 +157,11 @@ cmos_read (uint8_t index)
   outb (CMOS_REG_SET, index);
   return inb (CMOS_REG_IO);
 }
+
+/* Writes DATA to the CMOS register with the given INDEX. */
+static void
+cmos_write (uint8_t index, uint8_t data)
+{
+  outb (CMOS_REG_SET, index);
+  outb (CMOS_REG_IO, data);
+}
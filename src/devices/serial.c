@@ -1,5 +1,6 @@
 #include "devices/serial.h"
 #include <debug.h>
+#include <stdio.h>
 #include "devices/input.h"
 #include "devices/intq.h"
 #include "devices/timer.h"
@@ -33,6 +34,14 @@
 #define MCR_REG (IO_BASE + 4)   /* MODEM Control Register. */
 #define LSR_REG (IO_BASE + 5)   /* Line Status Register (read-only). */
 
+/* FIFO Control Register bits. */
+#define FCR_ENABLE 0x01         /* Enable FIFOs. */
+#define FCR_CLEAR_RX 0x02       /* Clear receive FIFO. */
+#define FCR_CLEAR_TX 0x04       /* Clear transmit FIFO. */
+
+/* Interrupt Identification Register bits. */
+#define IIR_FIFO 0xc0           /* FIFOs enabled (16550A and later). */
+
 /* Interrupt Enable Register bits. */
 #define IER_RECV 0x01           /* Interrupt when data received. */
 #define IER_XMIT 0x02           /* Interrupt when transmit finishes. */
@@ -46,15 +55,43 @@
 
 /* Line Status Register. */
 #define LSR_DR 0x01             /* Data Ready: received data byte is in RBR. */
+#define LSR_OE 0x02             /* Overrun Error: a received byte was lost. */
 #define LSR_THRE 0x20           /* THR Empty. */
+
+/* Depth of the 16550A's transmit FIFO.  Once THR reports empty,
+   this many bytes can be written back to back. */
+#define TX_FIFO_SIZE 16
+
+/* Size of the transmit queue, in bytes.  Large enough to hold
+   a burst of test output, so that writers rarely wait for the
+   port. */
+#define TXQ_SIZE 1024
 
 /* Transmission mode. */
 static enum { UNINIT, POLL, QUEUE } mode;
 
 /* Data to be transmitted. */
 static struct intq txq;
+static uint8_t txq_space[TXQ_SIZE];
+
+/* Number of bytes the transmitter takes at once when THR is
+   empty: TX_FIFO_SIZE if the UART has a working FIFO, otherwise
+   1. */
+static int tx_fifo_size;
+
+/* Number of bytes that can be written to THR right now without
+   checking LSR.  Only ever an underestimate, because the UART
+   drains the FIFO on its own. */
+static int tx_room;
+
+/* Statistics. */
+static long long queue_cnt;     /* Bytes queued for the interrupt. */
+static long long poll_cnt;      /* Bytes sent by polling. */
+static long long burst_cnt;     /* Transmit interrupts that sent data. */
+static long long overrun_cnt;   /* Received bytes lost to overruns. */
 
 static void set_serial (int bps);
+static uint8_t read_lsr (void);
 static void putc_poll (uint8_t);
 static void write_ier (void);
 static intr_handler_func serial_interrupt;
@@ -68,10 +105,15 @@ init_poll (void)
 {
   ASSERT (mode == UNINIT);
   outb (IER_REG, 0);                    /* Turn off all interrupts. */
-  outb (FCR_REG, 0);                    /* Disable FIFO. */
+  outb (FCR_REG, FCR_ENABLE | FCR_CLEAR_RX | FCR_CLEAR_TX); /* FIFOs. */
   set_serial (9600);                    /* 9.6 kbps, N-8-1. */
   outb (MCR_REG, MCR_OUT2);             /* Required to enable interrupts. */
-  intq_init (&txq);
+
+  /* Older UARTs ignore FCR and have only a one-byte THR. */
+  tx_fifo_size = (inb (IIR_REG) & IIR_FIFO) == IIR_FIFO ? TX_FIFO_SIZE : 1;
+  tx_room = 0;
+
+  intq_init (&txq, txq_space, sizeof txq_space);
   mode = POLL;
 } 
 
@@ -97,32 +139,55 @@ serial_init_queue (void)
 /* Sends BYTE to the serial port. */
 void
 serial_putc (uint8_t byte) 
+{
+  serial_putbuf ((const char *) &byte, 1);
+}
+
+/* Sends the N bytes in BUFFER to the serial port.  The bytes are
+   queued for the serial interrupt to drain with interrupts
+   disabled only once, instead of once per byte. */
+void
+serial_putbuf (const char *buffer, size_t n) 
 {
   enum intr_level old_level = intr_disable ();
 
   if (mode != QUEUE)
     {
       /* If we're not set up for interrupt-driven I/O yet,
-         use dumb polling to transmit a byte. */
+         use dumb polling to transmit the bytes. */
       if (mode == UNINIT)
         init_poll ();
-      putc_poll (byte); 
+      while (n-- > 0)
+        putc_poll (*buffer++); 
     }
   else 
     {
-      /* Otherwise, queue a byte and update the interrupt enable
-         register. */
-      if (old_level == INTR_OFF && intq_full (&txq)) 
+      /* Otherwise, queue the bytes and update the interrupt
+         enable register. */
+      while (n-- > 0) 
         {
-          /* Interrupts are off and the transmit queue is full.
-             If we wanted to wait for the queue to empty,
-             we'd have to reenable interrupts.
-             That's impolite, so we'll send a character via
-             polling instead. */
-          putc_poll (intq_getc (&txq)); 
+          if (intq_full (&txq)) 
+            {
+              if (old_level == INTR_OFF) 
+                {
+                  /* Interrupts are off and the transmit queue is
+                     full.  If we wanted to wait for the queue to
+                     empty, we'd have to reenable interrupts.
+                     That's impolite, so we'll send a character
+                     via polling instead. */
+                  putc_poll (intq_getc (&txq)); 
+                }
+              else
+                {
+                  /* intq_putc() will sleep until the serial
+                     interrupt makes room, so make sure it is
+                     enabled. */
+                  write_ier ();
+                }
+            }
+          intq_putc (&txq, *buffer++); 
+          queue_cnt++;
         }
-
-      intq_putc (&txq, byte); 
       write_ier ();
     }
   
@@ -152,6 +217,15 @@ serial_notify (void)
     write_ier ();
 }
 
+/* Prints serial port statistics. */
+void
+serial_print_stats (void) 
+{
+  printf ("Serial: %d-byte FIFO, %lld bytes queued, %lld polled, "
+          "%lld bursts, %lld receive overruns\n",
+          tx_fifo_size, queue_cnt, poll_cnt, burst_cnt, overrun_cnt);
+}
+
 /* Configures the serial port for BPS bits per second. */
 static void
 set_serial (int bps)
@@ -193,16 +267,34 @@ write_ier (void)
   outb (IER_REG, ier);
 }
 
+/* Reads the Line Status Register, counting any overrun it
+   reports.  (Reading LSR clears the overrun bit.) */
+static uint8_t
+read_lsr (void) 
+{
+  uint8_t lsr = inb (LSR_REG);
+  if (lsr & LSR_OE)
+    overrun_cnt++;
+  return lsr;
+}
+
 /* Polls the serial port until it's ready,
-   and then transmits BYTE. */
+   and then transmits BYTE.  With a FIFO, the port only needs to
+   be polled once per TX_FIFO_SIZE bytes. */
 static void
 putc_poll (uint8_t byte) 
 {
   ASSERT (intr_get_level () == INTR_OFF);
 
-  while ((inb (LSR_REG) & LSR_THRE) == 0)
-    continue;
+  if (tx_room == 0) 
+    {
+      while ((read_lsr () & LSR_THRE) == 0)
+        continue;
+      tx_room = tx_fifo_size;
+    }
   outb (THR_REG, byte);
+  tx_room--;
+  poll_cnt++;
 }
 
 /* Serial interrupt handler. */
@@ -215,13 +307,21 @@ serial_interrupt (struct intr_frame *f UNUSED)
 
   /* As long as we have room to receive a byte, and the hardware
      has a byte for us, receive a byte.  */
-  while (!input_full () && (inb (LSR_REG) & LSR_DR) != 0)
+  while (!input_full () && (read_lsr () & LSR_DR) != 0)
     input_putc (inb (RBR_REG));
 
-  /* As long as we have a byte to transmit, and the hardware is
-     ready to accept a byte for transmission, transmit a byte. */
-  while (!intq_empty (&txq) && (inb (LSR_REG) & LSR_THRE) != 0) 
-    outb (THR_REG, intq_getc (&txq));
+  /* If the transmitter is empty, refill it with as many bytes as
+     its FIFO holds, without checking LSR between them. */
+  if (!intq_empty (&txq) && (read_lsr () & LSR_THRE) != 0) 
+    {
+      tx_room = tx_fifo_size;
+      while (!intq_empty (&txq) && tx_room > 0) 
+        {
+          outb (THR_REG, intq_getc (&txq));
+          tx_room--;
+        }
+      burst_cnt++;
+    }
 
   /* Update interrupt enable register based on queue status. */
   write_ier ();
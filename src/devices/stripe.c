@@ -0,0 +1,224 @@
+#include "devices/stripe.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/workqueue.h"
+
+/* A striped ("RAID-0") block device, "md0", that spreads its
+   sectors over several member devices in CHUNK-sector chunks:
+   logical chunk C is chunk C / MEMBER_CNT of member C %
+   MEMBER_CNT.  A request that spans several members is split
+   into one part per member, and the parts are transferred
+   concurrently, the first by the submitting thread and the
+   others by worker threads, so that members on different IDE
+   channels are busy at the same time.  Parts on members that
+   share a channel still take turns, on the channel's lock.
+
+   The members are named with the -stripe option.  They should
+   hold nothing else, since md0 overwrites them. */
+
+/* Most member devices. */
+#define STRIPE_MAX 4
+
+/* The striped device. */
+struct stripe
+  {
+    struct block *members[STRIPE_MAX];  /* Member devices. */
+    size_t member_cnt;                  /* Number of MEMBERS. */
+    size_t chunk;                       /* Sectors per chunk. */
+    struct workqueue wq;                /* Transfers parts. */
+  };
+
+/* One member's part of a request. */
+struct stripe_part
+  {
+    struct work work;                   /* Queued on the stripe's WQ. */
+    struct stripe *stripe;              /* Striped device. */
+    size_t member;                      /* Index of member. */
+    bool write;                         /* Write rather than read? */
+    block_sector_t sector;              /* First logical sector. */
+    size_t cnt;                         /* Number of logical sectors. */
+    uint8_t *buffer;                    /* Data for SECTOR. */
+    struct latch *done;                 /* Counted down when transferred. */
+  };
+
+static struct stripe stripe;
+static struct block_operations stripe_operations;
+static work_func part_work;
+
+/* Combines the block devices in NAMES, a comma-separated list,
+   into a striped device with CHUNK sectors per chunk, and
+   registers it.  Does nothing if NAMES is null.  Panics if a
+   member does not exist or fewer than two are named. */
+void
+stripe_init (char *names, size_t chunk) 
+{
+  block_sector_t member_size = (block_sector_t) -1;
+  char *name, *save_ptr;
+  char extra_info[64];
+  size_t i;
+
+  if (names == NULL)
+    return;
+  if (chunk == 0)
+    PANIC ("md0: chunk size must be at least 1 sector");
+
+  for (name = strtok_r (names, ",", &save_ptr); name != NULL;
+       name = strtok_r (NULL, ",", &save_ptr))
+    {
+      struct block *member = block_get_by_name (name);
+      if (member == NULL)
+        PANIC ("md0: no such block device \"%s\"", name);
+      if (stripe.member_cnt >= STRIPE_MAX)
+        PANIC ("md0: more than %d members", STRIPE_MAX);
+      for (i = 0; i < stripe.member_cnt; i++)
+        if (stripe.members[i] == member)
+          PANIC ("md0: %s named twice", name);
+      stripe.members[stripe.member_cnt++] = member;
+      if (block_size (member) < member_size)
+        member_size = block_size (member);
+    }
+  if (stripe.member_cnt < 2)
+    PANIC ("md0: need at least 2 members");
+  stripe.chunk = chunk;
+
+  workqueue_init (&stripe.wq, "stripe", stripe.member_cnt - 1, PRI_DEFAULT);
+  snprintf (extra_info, sizeof extra_info,
+            "%zu-way stripe, %zu-sector chunks", stripe.member_cnt, chunk);
+  block_register ("md0", BLOCK_RAW, extra_info,
+                  member_size / chunk * chunk * stripe.member_cnt,
+                  &stripe_operations, &stripe);
+}
+
+/* Transfers the sectors of part P that are on its member. */
+static void
+transfer_part (struct stripe_part *p)
+{
+  struct stripe *s = p->stripe;
+  struct block *member = s->members[p->member];
+  block_sector_t sector = p->sector;
+  block_sector_t end = p->sector + p->cnt;
+
+  while (sector < end)
+    {
+      block_sector_t chunk = sector / s->chunk;
+      size_t ofs = sector % s->chunk;
+      size_t run = s->chunk - ofs < end - sector ? s->chunk - ofs
+                                                 : end - sector;
+
+      if (chunk % s->member_cnt == p->member)
+        {
+          block_sector_t member_sector
+            = chunk / s->member_cnt * s->chunk + ofs;
+          uint8_t *buffer
+            = p->buffer + (sector - p->sector) * BLOCK_SECTOR_SIZE;
+
+          if (p->write)
+            block_write_multiple (member, member_sector, run, buffer);
+          else
+            block_read_multiple (member, member_sector, run, buffer);
+        }
+      sector += run;
+    }
+}
+
+/* Worker thread function for a part of a request. */
+static void
+part_work (void *p_) 
+{
+  struct stripe_part *p = p_;
+
+  transfer_part (p);
+  latch_count_down (p->done);
+}
+
+/* Transfers CNT sectors starting at SECTOR between striped
+   device S_ and BUFFER, with a part for every member that holds
+   any of them. */
+static void
+transfer (void *s_, bool write, block_sector_t sector, size_t cnt,
+          uint8_t *buffer)
+{
+  struct stripe *s = s_;
+  struct stripe_part parts[STRIPE_MAX];
+  struct latch done;
+  size_t first = sector / s->chunk % s->member_cnt;
+  size_t spanned = ((sector + cnt - 1) / s->chunk - sector / s->chunk + 1);
+  size_t part_cnt = spanned < s->member_cnt ? spanned : s->member_cnt;
+  size_t i;
+
+  latch_init (&done, part_cnt - 1);
+  for (i = 0; i < part_cnt; i++)
+    {
+      struct stripe_part *p = &parts[i];
+      p->stripe = s;
+      p->member = (first + i) % s->member_cnt;
+      p->write = write;
+      p->sector = sector;
+      p->cnt = cnt;
+      p->buffer = buffer;
+      p->done = &done;
+      if (i > 0)
+        {
+          work_init (&p->work, part_work, p);
+          work_queue (&s->wq, &p->work);
+        }
+    }
+
+  transfer_part (&parts[0]);
+  latch_wait (&done);
+}
+
+/* Reads CNT sectors starting at SECTOR from S_ into BUFFER. */
+static void
+stripe_read_multiple (void *s_, block_sector_t sector, size_t cnt,
+                      void *buffer) 
+{
+  transfer (s_, false, sector, cnt, buffer);
+}
+
+/* Writes CNT sectors starting at SECTOR to S_ from BUFFER. */
+static void
+stripe_write_multiple (void *s_, block_sector_t sector, size_t cnt,
+                       const void *buffer) 
+{
+  transfer (s_, true, sector, cnt, (uint8_t *) buffer);
+}
+
+/* Reads sector SECTOR from S_ into BUFFER. */
+static void
+stripe_read (void *s_, block_sector_t sector, void *buffer) 
+{
+  transfer (s_, false, sector, 1, buffer);
+}
+
+/* Writes sector SECTOR to S_ from BUFFER. */
+static void
+stripe_write (void *s_, block_sector_t sector, const void *buffer) 
+{
+  transfer (s_, true, sector, 1, (uint8_t *) buffer);
+}
+
+/* Flushes the write cache of every member of S_. */
+static void
+stripe_flush (void *s_) 
+{
+  struct stripe *s = s_;
+  size_t i;
+
+  for (i = 0; i < s->member_cnt; i++)
+    block_flush (s->members[i]);
+}
+
+static struct block_operations stripe_operations =
+  {
+    stripe_read,
+    stripe_write,
+    stripe_read_multiple,
+    stripe_write_multiple,
+    stripe_flush,
+    NULL
+  };
@@ -0,0 +1,11 @@
+#ifndef DEVICES_STRIPE_H
+#define DEVICES_STRIPE_H
+
+#include <stddef.h>
+
+/* Default number of sectors per stripe chunk. */
+#define STRIPE_CHUNK_DEFAULT 4
+
+void stripe_init (char *names, size_t chunk);
+
+#endif /* devices/stripe.h */
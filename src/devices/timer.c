@@ -3,10 +3,16 @@
 #include <inttypes.h>
 #include <round.h>
 #include <stdio.h>
+#include "devices/lapic.h"
 #include "devices/pit.h"
+#include "threads/cpu.h"
 #include "threads/interrupt.h"
+#include "threads/profile.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
+#ifdef USERPROG
+#include "userprog/infopage.h"
+#endif
 /* See [8254] for hardware details of the 8254 timer chip. */
 #if TIMER_FREQ < 19
 #error 8254 timer requires TIMER_FREQ >= 19
@@ -16,57 +22,147 @@
 #endif
 /* Number of timer ticks since OS booted. */
 static int64_t ticks;
-/* Number of loops per timer tick.
+
+/* Guards `ticks', which is 64 bits and so not read in one go, for
+   timer_ticks(). */
+static struct seqlock ticks_seq = SEQLOCK_INITIALIZER;
+/* Time-stamp counter cycles per second.
    Initialized by timer_calibrate(). */
-static unsigned loops_per_tick;
+static uint64_t cycles_per_sec;
+
+/* timer_cycles() when timer_init() was called. */
+static uint64_t boot_cycles;
+
+/* Number of timer ticks over which timer_calibrate() counts
+   cycles. */
+#define CALIBRATE_TICKS 5
+
+/* Nanoseconds per second. */
+#define NS_PER_SEC (1000 * 1000 * 1000)
+
+/* PIT cycles per timer tick. */
+#define TIMER_PIT_COUNT ((PIT_HZ + TIMER_FREQ / 2) / TIMER_FREQ)
+
+/* Most ticks one PIT period can cover: its counter is 16 bits. */
+#define TIMER_MAX_SKIP (65535 / TIMER_PIT_COUNT)
+
+/* If true, the idle thread stops the periodic tick while it
+   waits for the next sleeper.  Controlled by kernel command-line
+   option "-tickless". */
+bool timer_tickless;
+
+/* Time-stamp counter cycles per timer tick measured on an earlier
+   boot of the same machine, or 0 to measure them.  Controlled by
+   kernel command-line option "-lpt". */
+uint64_t timer_loops_per_tick;
+
+/* Number of ticks covered by the PIT period armed by
+   timer_idle_enter(), or 0 if the PIT is in periodic mode. */
+static int64_t skip_ticks;
+
+/* The per-tick work other than thread_tick(), deferred out of
+   the timer interrupt, and the last tick it has been done for. */
+static struct intr_work tick_work;
+static int64_t worked_ticks;
+
+/* Precise sleeps.  A sleep shorter than a tick would lose all
+   its precision to the tick, so the thread instead blocks on
+   PRECISE_SLEEPERS, soonest deadline first, until a timer
+   interrupt armed for the soonest deadline.  Given a calibrated
+   local APIC timer, that is a one-shot APIC timer interrupt.
+   Otherwise, the PIT's current tick is split in two at the
+   deadline: see pit_split_arm().  Sleeps shorter than
+   PRECISE_MIN_NS still busy-wait, because blocking and switching
+   back would take about as long. */
+#define PRECISE_MIN_NS 20000
+struct precise_sleeper
+{
+  struct list_elem elem;  /* Element in precise_sleepers. */
+  int64_t deadline;       /* timer_ns() at which to wake. */
+  struct thread *thread;  /* Sleeping thread. */
+};
+static struct list precise_sleepers;
+
+/* Orders precise sleepers by deadline. */
+LIST_DEFINE_ORDERED(deadline, struct precise_sleeper, elem, deadline)
+static long long precise_sleep_cnt; /* # of precise sleeps. */
+
+/* PIT cycles left in the current tick after the pending split
+   interrupt, or 0 if the current tick is not split. */
+static uint16_t split_rest;
 
 static intr_handler_func timer_interrupt;
-static bool too_many_loops(unsigned loops);
-static void busy_wait(int64_t loops);
+static void wait_for_tick(void);
 static void real_time_sleep(int64_t num, int32_t denom);
 static void real_time_delay(int64_t num, int32_t denom);
+static void timer_skip_end(int64_t elapsed);
+static void timer_run_ticks(void *aux);
+static bool precise_available(void);
+static void precise_sleep(int64_t ns);
+static void precise_wake(void);
+static void pit_split_arm(void);
+static intr_handler_func precise_interrupt;
 
 /* Sets up the timer to interrupt TIMER_FREQ times per second,
    and registers the corresponding interrupt. */
 void timer_init(void)
 {
-  pit_configure_channel(0, 2, TIMER_FREQ);
+  boot_cycles = timer_cycles();
+  intr_work_init(&tick_work, timer_run_ticks, NULL);
+  pit_configure_channel_count(0, 2, TIMER_PIT_COUNT);
   intr_register_ext(0x20, timer_interrupt, "8254 Timer");
+
+  list_init(&precise_sleepers);
+  if (lapic_init())
+    intr_register_lapic(LAPIC_TIMER_VEC, precise_interrupt, "LAPIC Timer");
 }
 
-/* Calibrates loops_per_tick, used to implement brief delays. */
+/* Calibrates cycles_per_sec against the PIT, by counting
+   time-stamp counter cycles across CALIBRATE_TICKS timer ticks,
+   unless timer_loops_per_tick gives the answer already.
+   cycles_per_sec is used by timer_ns() and to implement brief
+   delays. */
 void timer_calibrate(void)
 {
-  unsigned high_bit, test_bit;
+  uint64_t start;
+  int i;
 
   ASSERT(intr_get_level() == INTR_ON);
-  printf("Calibrating timer...  ");
-
-  /* Approximate loops_per_tick as the largest power-of-two
-     still less than one timer tick. */
-  loops_per_tick = 1u << 10;
-  while (!too_many_loops(loops_per_tick << 1))
+  if (timer_loops_per_tick != 0)
   {
-    loops_per_tick <<= 1;
-    ASSERT(loops_per_tick != 0);
+    cycles_per_sec = timer_loops_per_tick * TIMER_FREQ;
+    printf("Timer: %'" PRIu64 " cycles/s.\n", cycles_per_sec);
   }
+  else
+  {
+    printf("Calibrating timer...  ");
+
+    wait_for_tick();
+    start = timer_cycles();
+    for (i = 0; i < CALIBRATE_TICKS; i++)
+      wait_for_tick();
+    cycles_per_sec = ((timer_cycles() - start) * TIMER_FREQ
+                      / CALIBRATE_TICKS);
 
-  /* Refine the next 8 bits of loops_per_tick. */
-  high_bit = loops_per_tick;
-  for (test_bit = high_bit >> 1; test_bit != high_bit >> 10; test_bit >>= 1)
-    if (!too_many_loops(loops_per_tick | test_bit))
-      loops_per_tick |= test_bit;
+    printf("%'" PRIu64 " cycles/s (-lpt=%" PRIu64 ").\n",
+           cycles_per_sec, cycles_per_sec / TIMER_FREQ);
+  }
 
-  printf("%'" PRIu64 " loops/s.\n", (uint64_t)loops_per_tick * TIMER_FREQ);
+  lapic_timer_calibrate();
 }
 
 /* Returns the number of timer ticks since the OS booted. */
 int64_t
 timer_ticks(void)
 {
-  enum intr_level old_level = intr_disable();
-  int64_t t = ticks;
-  intr_set_level(old_level);
+  unsigned seq;
+  int64_t t;
+
+  do
+  {
+    seq = seqlock_read_begin(&ticks_seq);
+    t = ticks;
+  } while (seqlock_read_retry(&ticks_seq, seq));
   return t;
 }
 
@@ -78,6 +174,28 @@ timer_elapsed(int64_t then)
   return timer_ticks() - then;
 }
 
+/* Returns the number of nanoseconds since the timer was
+   initialized, or 0 before timer_calibrate() has run. */
+int64_t
+timer_ns(void)
+{
+  return timer_cycles_to_ns(timer_cycles() - boot_cycles);
+}
+
+/* Converts CYCLES time-stamp counter cycles into nanoseconds,
+   or returns 0 before timer_calibrate() has run. */
+int64_t
+timer_cycles_to_ns(uint64_t cycles)
+{
+  if (cycles_per_sec == 0)
+    return 0;
+
+  /* Convert whole seconds separately, so that the product
+     cannot overflow. */
+  return (cycles / cycles_per_sec * NS_PER_SEC
+          + cycles % cycles_per_sec * NS_PER_SEC / cycles_per_sec);
+}
+
 /* Sleeps for approximately TICKS timer ticks.  Interrupts must
    be turned on. */
 void timer_sleep(int64_t ticks)
@@ -88,14 +206,57 @@ void timer_sleep(int64_t ticks)
     return;
   }
 
+  timer_sleep_until(timer_ticks() + ticks);
+}
+
+/* Sleeps until timer tick WAKE_TICK, or returns at once if it has
+   already passed.  Unlike a loop of timer_sleep() calls, a loop
+   that advances WAKE_TICK by a fixed period does not drift by
+   the time spent between sleeps.  Interrupts must be turned on. */
+void timer_sleep_until(int64_t wake_tick)
+{
   ASSERT(intr_get_level() == INTR_ON);
 
   intr_disable();
-  // Set the thread to sleep
-  set_sleeping_thread(ticks);
+  if (wake_tick > ticks)
+    set_sleeping_thread(wake_tick);
   intr_set_level(INTR_ON);
 }
 
+/* Initializes PT to wake up every PERIOD ticks, starting PERIOD
+   ticks from now. */
+void periodic_timer_init(struct periodic_timer *pt, int64_t period)
+{
+  ASSERT(period > 0);
+
+  pt->period = period;
+  pt->next = timer_ticks() + period;
+  pt->overruns = 0;
+}
+
+/* Sleeps until PT's next wakeup and schedules the one after it.
+   If the caller has already missed one or more wakeups, returns
+   at once and skips the missed ones rather than running them
+   back to back, so the wakeups stay on PT's original cadence.
+   Returns the number of periods that have elapsed since the
+   previous wakeup: 1, unless the caller was late. */
+int64_t periodic_timer_wait(struct periodic_timer *pt)
+{
+  int64_t now = timer_ticks();
+  int64_t elapsed = 1;
+
+  if (now >= pt->next + pt->period)
+  {
+    int64_t missed = (now - pt->next) / pt->period;
+    pt->next += missed * pt->period;
+    pt->overruns += missed;
+    elapsed += missed;
+  }
+  timer_sleep_until(pt->next);
+  pt->next += pt->period;
+  return elapsed;
+}
+
 /* Sleeps for approximately MS milliseconds.  Interrupts must be
    turned on. */
 void timer_msleep(int64_t ms)
@@ -156,54 +317,138 @@ void timer_ndelay(int64_t ns)
 /* Prints timer statistics. */
 void timer_print_stats(void)
 {
-  printf("Timer: %" PRId64 " ticks\n", timer_ticks());
+  printf("Timer: %" PRId64 " ticks, %lld precise sleeps\n", timer_ticks(),
+         precise_sleep_cnt);
+}
+
+/* Called by the idle thread, with interrupts off, just before it
+   halts the CPU.  In tickless mode, stretches the PIT period so
+   that the next timer interrupt arrives at the earliest sleeper's
+   wake-up tick (at most TIMER_MAX_SKIP ticks away) instead of at
+   the next tick.  With more than one processor online, the other
+   processors need every tick, so the period is left alone. */
+void timer_idle_enter(void)
+{
+  int64_t skip;
+
+  ASSERT(intr_get_level() == INTR_OFF);
+
+  if (!timer_tickless || skip_ticks != 0 || !list_empty(&precise_sleepers) || cpu_online_cnt > 1)
+    return;
+
+  skip = get_next_wake_tick(ticks, ticks + TIMER_MAX_SKIP) - ticks;
+  if (skip < 2)
+    return;
+
+  skip_ticks = skip;
+  pit_configure_channel_count(0, 2, skip * TIMER_PIT_COUNT);
+}
+
+/* Called by the idle thread after the CPU is woken up by an
+   interrupt.  If that interrupt was not the stretched timer
+   interrupt, reads how far the PIT got, catches `ticks' up by the
+   number of whole ticks that elapsed, and goes back to the
+   periodic tick.  The partial tick in progress is lost. */
+void timer_idle_exit(void)
+{
+  enum intr_level old_level = intr_disable();
+
+  if (skip_ticks != 0)
+  {
+    int64_t total = skip_ticks * TIMER_PIT_COUNT;
+    int64_t elapsed = (total - pit_read_channel(0)) / TIMER_PIT_COUNT;
+    timer_skip_end(elapsed);
+    timer_run_ticks(NULL);
+  }
+  intr_set_level(old_level);
 }
 
 /* Timer interrupt handler. */
 static void
-timer_interrupt(struct intr_frame *args UNUSED)
+timer_interrupt(struct intr_frame *args)
 {
-  ticks++;
-
-  if (thread_mlfqs && ticks % TIMER_FREQ == 0)
+  /* The first part of a split tick has ended.  The PIT is now
+     counting down the rest of the tick; have it go back to whole
+     ticks after that. */
+  if (split_rest != 0)
   {
-    // Update ticks
-    tick_every_second();
+    split_rest = 0;
+    pit_reload_channel(0, TIMER_PIT_COUNT);
+    precise_wake();
+    return;
   }
 
+  profile_tick(args);
+
+  /* A stretched period covers SKIP_TICKS ticks, the last of
+     which is this one. */
+  if (skip_ticks != 0)
+    timer_skip_end(skip_ticks - 1);
+
+  seqlock_write_begin(&ticks_seq);
+  ticks++;
+  seqlock_write_end(&ticks_seq);
+#ifdef USERPROG
+  infopage_update(ticks);
+#endif
   thread_tick();
+  cpu_broadcast_tick();
+  intr_defer(&tick_work);
+
+  if (!lapic_timer_available())
+    precise_wake();
 }
 
-/* Returns true if LOOPS iterations waits for more than one timer
-   tick, otherwise false. */
-static bool
-too_many_loops(unsigned loops)
+/* Does the per-tick work other than thread_tick() for each tick
+   up to `ticks' that has not had it yet: the once-per-second
+   MLFQS update and waking the threads whose sleep ends at that
+   tick.  Runs as deferred work after the timer interrupt, with
+   interrupts on between ticks, or directly from
+   timer_idle_exit(). */
+static void
+timer_run_ticks(void *aux UNUSED)
 {
-  /* Wait for a timer tick. */
-  int64_t start = ticks;
-  while (ticks == start)
-    barrier();
-
-  /* Run LOOPS loops. */
-  start = ticks;
-  busy_wait(loops);
+  enum intr_level old_level = intr_disable();
 
-  /* If the tick count changed, we iterated too long. */
-  barrier();
-  return start != ticks;
+  while (worked_ticks < ticks)
+  {
+    worked_ticks++;
+    if (thread_mlfqs && worked_ticks % TIMER_FREQ == 0)
+      tick_every_second();
+    wake_sleeping_threads(worked_ticks);
+
+    /* Let pending interrupts in between ticks. */
+    intr_set_level(old_level);
+    intr_disable();
+  }
+  intr_set_level(old_level);
 }
 
-/* Iterates through a simple loop LOOPS times, for implementing
-   brief delays.
+/* Returns the PIT to periodic mode after a stretched idle period
+   and accounts for the ELAPSED ticks that passed without an
+   interrupt.  Must be called with interrupts off. */
+static void
+timer_skip_end(int64_t elapsed)
+{
+  ASSERT(intr_get_level() == INTR_OFF);
+
+  skip_ticks = 0;
+  pit_configure_channel_count(0, 2, TIMER_PIT_COUNT);
+  thread_skip_ticks(elapsed);
+  seqlock_write_begin(&ticks_seq);
+  ticks += elapsed;
+  seqlock_write_end(&ticks_seq);
+#ifdef USERPROG
+  infopage_update(ticks);
+#endif
+}
 
-   Marked NO_INLINE because code alignment can significantly
-   affect timings, so that if this function was inlined
-   differently in different places the results would be difficult
-   to predict. */
-static void NO_INLINE
-busy_wait(int64_t loops)
+/* Busy-waits until the next timer tick. */
+static void
+wait_for_tick(void)
 {
-  while (loops-- > 0)
+  int64_t start = ticks;
+  while (ticks == start)
     barrier();
 }
 
@@ -218,29 +463,149 @@ real_time_sleep(int64_t num, int32_t denom)
      1 s / TIMER_FREQ ticks
   */
   int64_t ticks = num * TIMER_FREQ / denom;
+  int64_t ns = num * NS_PER_SEC / denom;
 
   ASSERT(intr_get_level() == INTR_ON);
   if (ticks > 0)
   {
     /* We're waiting for at least one full timer tick.  Use
        timer_sleep() because it will yield the CPU to other
-       processes. */
+       processes.  It wakes us on a tick boundary, so sleep off
+       the part of a tick that is left precisely, if we can. */
+    int64_t deadline = timer_ns() + ns;
+
     timer_sleep(ticks);
+    if (!precise_available())
+      return;
+    ns = deadline - timer_ns();
   }
-  else
-  {
-    /* Otherwise, use a busy-wait loop for more accurate
-       sub-tick timing. */
+
+  /* Block until a one-shot timer interrupt if possible, or use a
+     busy-wait loop, for more accurate sub-tick timing. */
+  if (precise_available() && ns >= PRECISE_MIN_NS)
+    precise_sleep(ns);
+  else if (ticks == 0)
     real_time_delay(num, denom);
+}
+
+/* Returns true if precise sleeps are possible, that is, if the
+   local APIC timer is calibrated or, failing that, timer_ns()
+   works. */
+static bool
+precise_available(void)
+{
+  return lapic_timer_available() || cycles_per_sec != 0;
+}
+
+/* Blocks the current thread for NS nanoseconds, waking it with a
+   one-shot local APIC timer interrupt or a split PIT tick. */
+static void
+precise_sleep(int64_t ns)
+{
+  struct precise_sleeper s;
+  enum intr_level old_level;
+
+  old_level = intr_disable();
+  s.deadline = timer_ns() + ns;
+  s.thread = thread_current();
+  deadline_insert_ordered(&precise_sleepers, &s);
+  if (list_front(&precise_sleepers) == &s.elem)
+  {
+    if (lapic_timer_available())
+      lapic_timer_oneshot(ns);
+    else
+      pit_split_arm();
   }
+  precise_sleep_cnt++;
+  thread_block();
+  intr_set_level(old_level);
+}
+
+/* Local APIC timer interrupt handler. */
+static void
+precise_interrupt(struct intr_frame *args UNUSED)
+{
+  precise_wake();
+}
+
+/* Wakes the precise sleepers whose deadlines have passed and
+   arms a timer interrupt for the next one.  Called from a timer
+   interrupt. */
+static void
+precise_wake(void)
+{
+  int64_t now = timer_ns();
+
+  while (!list_empty(&precise_sleepers))
+  {
+    struct precise_sleeper *s = list_entry(list_front(&precise_sleepers),
+                                           struct precise_sleeper, elem);
+    if (s->deadline > now)
+    {
+      if (lapic_timer_available())
+        lapic_timer_oneshot(s->deadline - now);
+      else
+        pit_split_arm();
+      break;
+    }
+    list_pop_front(&precise_sleepers);
+    thread_unblock(s->thread);
+    intr_yield_on_return();
+  }
+}
+
+/* Without a local APIC timer, arranges for a PIT interrupt at the
+   soonest precise sleeper's deadline, if that falls within the
+   current tick, by splitting the tick in two: the PIT is
+   restarted to count down to the deadline, and then, by
+   reloading, the rest of the tick.  timer_interrupt() tells the
+   two apart by SPLIT_REST.  The tick boundary slips by the few
+   PIT cycles it takes to reprogram.  A deadline beyond the
+   current tick waits for the timer interrupt that ends it.  Must
+   be called with interrupts off. */
+static void
+pit_split_arm(void)
+{
+  struct precise_sleeper *s;
+  int64_t ns, cycles;
+  uint16_t rest;
+
+  ASSERT(intr_get_level() == INTR_OFF);
+
+  if (split_rest != 0 || skip_ticks != 0 || list_empty(&precise_sleepers))
+    return;
+
+  s = list_entry(list_front(&precise_sleepers), struct precise_sleeper, elem);
+  ns = s->deadline - timer_ns();
+  cycles = ns > 0 ? ns * PIT_HZ / NS_PER_SEC : 0;
+  if (cycles < 2)
+    cycles = 2;
+
+  /* Leave at least 2 cycles, the shortest legal mode-2 count,
+     for the rest of the tick. */
+  rest = pit_read_channel(0);
+  if (cycles + 2 > rest)
+    return;
+
+  pit_configure_channel_count(0, 2, cycles);
+  pit_reload_channel(0, rest - cycles);
+  split_rest = rest - cycles;
 }
 
 /* Busy-wait for approximately NUM/DENOM seconds. */
 static void
 real_time_delay(int64_t num, int32_t denom)
 {
-  /* Scale the numerator and denominator down by 1000 to avoid
-     the possibility of overflow. */
-  ASSERT(denom % 1000 == 0);
-  busy_wait(loops_per_tick * num / 1000 * TIMER_FREQ / (denom / 1000));
+  uint64_t start = timer_cycles();
+  uint64_t cycles;
+
+  if (num <= 0)
+    return;
+
+  /* Convert NUM/DENOM seconds into cycles, whole seconds
+     separately so that the product cannot overflow. */
+  cycles = (num / denom * cycles_per_sec
+            + num % denom * cycles_per_sec / denom);
+  while (timer_cycles() - start < cycles)
+    barrier();
 }
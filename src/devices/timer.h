@@ -2,19 +2,28 @@
 #define DEVICES_TIMER_H
 
 #include <round.h>
+#include <stdbool.h>
 #include <stdint.h>
 
 /* Number of timer interrupts per second. */
 #define TIMER_FREQ 100
 
+extern uint64_t timer_loops_per_tick;
+
 void timer_init(void);
 void timer_calibrate(void);
 
 int64_t timer_ticks(void);
 int64_t timer_elapsed(int64_t);
 
+/* High-resolution time, based on the CPU's time-stamp counter. */
+static inline uint64_t timer_cycles(void);
+int64_t timer_ns(void);
+int64_t timer_cycles_to_ns(uint64_t cycles);
+
 /* Sleep and yield the CPU to other threads. */
 void timer_sleep(int64_t ticks);
+void timer_sleep_until(int64_t wake_tick);
 void timer_msleep(int64_t milliseconds);
 void timer_usleep(int64_t microseconds);
 void timer_nsleep(int64_t nanoseconds);
@@ -26,4 +35,33 @@ void timer_ndelay(int64_t nanoseconds);
 
 void timer_print_stats(void);
 
+/* Drift-free periodic wakeups.  Each wait sleeps until the next
+   multiple of PERIOD ticks after the start, however long the
+   caller took since the last one. */
+struct periodic_timer
+{
+  int64_t period;    /* Ticks between wakeups. */
+  int64_t next;      /* Tick of the next wakeup. */
+  int64_t overruns;  /* Wakeups skipped because the caller was late. */
+};
+
+void periodic_timer_init(struct periodic_timer *, int64_t period);
+int64_t periodic_timer_wait(struct periodic_timer *);
+
+/* Tickless idle. */
+extern bool timer_tickless;
+void timer_idle_enter(void);
+void timer_idle_exit(void);
+
+/* Returns the CPU's time-stamp counter, which counts CPU cycles
+   since reset.  timer_cycles_to_ns() converts a count of cycles
+   into nanoseconds. */
+static inline uint64_t
+timer_cycles(void)
+{
+  uint64_t tsc;
+  asm volatile("rdtsc" : "=A"(tsc));
+  return tsc;
+}
+
 #endif /* devices/timer.h */
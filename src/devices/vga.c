@@ -23,14 +23,26 @@ static size_t cx, cy;
 
 /* Framebuffer.  See [FREEVGA] under "VGA Text Mode Operation".
    The character at (x,y) is fb[y][x][0].
-   The attribute at (x,y) is fb[y][x][1]. */
-static uint8_t (*fb)[COL_CNT][2];
+   The attribute at (x,y) is fb[y][x][1].
+
+   FB is a shadow copy of the screen in ordinary RAM.  Writes to
+   video memory are very slow under emulators, and scrolling used
+   to read it back as well, so all drawing and scrolling happens
+   in FB and flush() copies only the rows that changed out to
+   the real framebuffer, MMIO_FB, once per vga_putbuf(). */
+static uint8_t fb[ROW_CNT][COL_CNT][2];
+static uint8_t (*mmio_fb)[COL_CNT][2];
+
+/* Bit Y is set if row Y of FB differs from MMIO_FB. */
+static uint32_t dirty_rows;
 
 static void clear_row (size_t y);
 static void cls (void);
 static void newline (void);
 static void move_cursor (void);
 static void find_cursor (size_t *x, size_t *y);
+static void flush (void);
+static void putc_intr_off (int c, enum intr_level old_level);
 
 /* Initializes the VGA text display. */
 static void
@@ -40,7 +52,8 @@ init (void)
   static bool inited;
   if (!inited)
     {
-      fb = ptov (0xb8000);
+      mmio_fb = ptov (0xb8000);
+      memcpy (fb, mmio_fb, sizeof fb);
       find_cursor (&cx, &cy);
       inited = true; 
     }
@@ -50,13 +63,39 @@ init (void)
    characters in the conventional ways.  */
 void
 vga_putc (int c)
+{
+  char ch = c;
+  vga_putbuf (&ch, 1);
+}
+
+/* Writes the N characters in BUFFER to the VGA text display,
+   interpreting control characters in the conventional ways.
+   Interrupts are disabled, and the hardware cursor moved, once
+   for the whole buffer instead of once per character. */
+void
+vga_putbuf (const char *buffer, size_t n) 
 {
   /* Disable interrupts to lock out interrupt handlers
      that might write to the console. */
   enum intr_level old_level = intr_disable ();
 
   init ();
-  
+  while (n-- > 0)
+    putc_intr_off ((uint8_t) *buffer++, old_level);
+
+  /* Update the screen and the cursor position. */
+  flush ();
+  move_cursor ();
+
+  intr_set_level (old_level);
+}
+
+/* Writes C to the VGA text display, without updating the
+   hardware cursor.  Interrupts must be off; OLD_LEVEL is the
+   level to restore them to while beeping. */
+static void
+putc_intr_off (int c, enum intr_level old_level) 
+{
   switch (c) 
     {
     case '\n':
@@ -91,15 +130,11 @@ vga_putc (int c)
     default:
       fb[cy][cx][0] = c;
       fb[cy][cx][1] = GRAY_ON_BLACK;
+      dirty_rows |= 1u << cy;
       if (++cx >= COL_CNT)
         newline ();
       break;
     }
-
-  /* Update cursor position. */
-  move_cursor ();
-
-  intr_set_level (old_level);
 }
 
 /* Clears the screen and moves the cursor to the upper left. */
@@ -126,6 +161,7 @@ clear_row (size_t y)
       fb[y][x][0] = ' ';
       fb[y][x][1] = GRAY_ON_BLACK;
     }
+  dirty_rows |= 1u << y;
 }
 
 /* Advances the cursor to the first column in the next line on
@@ -141,6 +177,21 @@ newline (void)
       cy = ROW_CNT - 1;
       memmove (&fb[0], &fb[1], sizeof fb[0] * (ROW_CNT - 1));
       clear_row (ROW_CNT - 1);
+      dirty_rows = (1u << ROW_CNT) - 1;
+    }
+}
+
+/* Copies the rows of FB that have changed to the real
+   framebuffer.  Several lines of output that scroll the screen
+   several times thus cost only one copy of the screen. */
+static void
+flush (void) 
+{
+  while (dirty_rows != 0) 
+    {
+      int y = __builtin_ctz (dirty_rows);
+      memcpy (mmio_fb[y], fb[y], sizeof fb[y]);
+      dirty_rows &= dirty_rows - 1;
     }
 }
 
@@ -0,0 +1,61 @@
+/* bench-exec.c
+
+   Starts COUNT child processes, one at a time, each of which
+   exits at once, and waits for each one.  Reports how many
+   exec-and-wait round trips complete per second, and then the
+   same for spawn(), which takes the arguments already split, and
+   for fork(), which copies this process instead of loading the
+   program again.
+
+   Usage: bench-exec [COUNT] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+#include "bench.h"
+
+int
+main (int argc, char *argv[])
+{
+  int cnt;
+  int64_t start;
+  int i;
+
+  /* Child: nothing to do. */
+  if (argc > 1 && !strcmp (argv[1], "child"))
+    return 0;
+
+  cnt = argc > 1 ? atoi (argv[1]) : 20;
+  start = clock_ns ();
+  for (i = 0; i < cnt; i++)
+    {
+      pid_t pid = exec ("bench-exec child");
+      bench_check (pid != PID_ERROR, "exec");
+      bench_check (wait (pid) == 0, "wait");
+    }
+  bench_report ("exec", "exec_wait_ops_per_sec", cnt, clock_ns () - start);
+
+  start = clock_ns ();
+  for (i = 0; i < cnt; i++)
+    {
+      static char *const child_argv[] = {"bench-exec", "child", NULL};
+      pid_t pid = spawn ("bench-exec", child_argv, NULL);
+      bench_check (pid != PID_ERROR, "spawn");
+      bench_check (wait (pid) == 0, "wait");
+    }
+  bench_report ("exec", "spawn_wait_ops_per_sec", cnt, clock_ns () - start);
+
+  start = clock_ns ();
+  for (i = 0; i < cnt; i++)
+    {
+      pid_t pid = fork ();
+      if (pid == 0)
+        return 0;
+      bench_check (pid != PID_ERROR, "fork");
+      bench_check (wait (pid) == 0, "wait");
+    }
+  bench_report ("exec", "fork_wait_ops_per_sec", cnt, clock_ns () - start);
+
+  return EXIT_SUCCESS;
+}
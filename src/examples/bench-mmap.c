@@ -0,0 +1,55 @@
+/* bench-mmap.c
+
+   Maps a file of SIZE kilobytes and reads one byte from each of
+   its pages, which faults them in from the file, then writes a
+   byte to each page, then unmaps the file, which writes the
+   dirty pages back.  Reports the pages per second of each phase.
+
+   Usage: bench-mmap [SIZE] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <syscall.h>
+#include "bench.h"
+
+/* Page size. */
+#define PAGE_SIZE 4096
+
+int
+main (int argc, char *argv[])
+{
+  static const char *file_name = "bench-mmap.dat";
+  char *base = (char *) 0x10000000;
+  int size = (argc > 1 ? atoi (argv[1]) : 256) * 1024;
+  int page_cnt = size / PAGE_SIZE;
+  volatile char sum = 0;
+  mapid_t map;
+  int64_t start;
+  int fd, i;
+
+  bench_check (create (file_name, size), "create");
+  fd = open (file_name);
+  bench_check (fd >= 0, "open");
+  map = mmap (fd, base);
+  bench_check (map != MAP_FAILED, "mmap");
+
+  start = clock_ns ();
+  for (i = 0; i < page_cnt; i++)
+    sum += base[i * PAGE_SIZE];
+  bench_report ("mmap", "read_fault_pages_per_sec", page_cnt,
+                clock_ns () - start);
+
+  start = clock_ns ();
+  for (i = 0; i < page_cnt; i++)
+    base[i * PAGE_SIZE] = i;
+  bench_report ("mmap", "write_pages_per_sec", page_cnt, clock_ns () - start);
+
+  start = clock_ns ();
+  munmap (map);
+  bench_report ("mmap", "writeback_pages_per_sec", page_cnt,
+                clock_ns () - start);
+
+  close (fd);
+  bench_check (remove (file_name), "remove");
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,80 @@
+/* bench-seqio.c
+
+   Writes a file of SIZE kilobytes from start to end, then reads
+   it back, once for each given block size, and reports the
+   operations per second and kilobytes per second of each pass.
+
+   Usage: bench-seqio [SIZE [BLOCK_SIZE...]] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <syscall.h>
+#include "bench.h"
+
+/* Largest block size. */
+#define MAX_BLOCK 16384
+
+static char buf[MAX_BLOCK];
+
+static void
+run_pass (int size, int block_size)
+{
+  static const char *file_name = "bench-seqio.dat";
+  char metric[32];
+  int64_t start, ns;
+  int fd, ofs, ops;
+
+  bench_check (create (file_name, 0), "create");
+  fd = open (file_name);
+  bench_check (fd >= 0, "open");
+
+  start = clock_ns ();
+  for (ofs = ops = 0; ofs < size; ofs += block_size, ops++)
+    bench_check (write (fd, buf, block_size) == block_size, "write");
+  ns = clock_ns () - start;
+  snprintf (metric, sizeof metric, "write_%d_ops_per_sec", block_size);
+  bench_report ("seqio", metric, ops, ns);
+  snprintf (metric, sizeof metric, "write_%d_kb_per_sec", block_size);
+  bench_report ("seqio", metric, size / 1024, ns);
+
+  seek (fd, 0);
+  start = clock_ns ();
+  for (ofs = ops = 0; ofs < size; ofs += block_size, ops++)
+    bench_check (read (fd, buf, block_size) == block_size, "read");
+  ns = clock_ns () - start;
+  snprintf (metric, sizeof metric, "read_%d_ops_per_sec", block_size);
+  bench_report ("seqio", metric, ops, ns);
+  snprintf (metric, sizeof metric, "read_%d_kb_per_sec", block_size);
+  bench_report ("seqio", metric, size / 1024, ns);
+
+  close (fd);
+  bench_check (remove (file_name), "remove");
+}
+
+int
+main (int argc, char *argv[])
+{
+  static const int default_blocks[] = {512, 4096, 16384};
+  int size = (argc > 1 ? atoi (argv[1]) : 256) * 1024;
+  int i;
+
+  if (argc > 2)
+    for (i = 2; i < argc; i++)
+      {
+        int block_size = atoi (argv[i]);
+        if (block_size <= 0 || block_size > MAX_BLOCK
+            || size % block_size != 0)
+          {
+            printf ("%s: block size must divide the file size "
+                    "and be at most %d\n", argv[i], MAX_BLOCK);
+            return EXIT_FAILURE;
+          }
+        run_pass (size, block_size);
+      }
+  else
+    for (i = 0; i < (int) (sizeof default_blocks / sizeof *default_blocks);
+         i++)
+      run_pass (size, default_blocks[i]);
+
+  return EXIT_SUCCESS;
+}
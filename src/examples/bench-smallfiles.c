@@ -0,0 +1,52 @@
+/* bench-smallfiles.c
+
+   Creates COUNT empty files, opens and closes each one, then
+   removes them all, and reports the operations per second of
+   each phase.
+
+   Usage: bench-smallfiles [COUNT] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <syscall.h>
+#include "bench.h"
+
+int
+main (int argc, char *argv[])
+{
+  int cnt = argc > 1 ? atoi (argv[1]) : 50;
+  char name[16];
+  int64_t start;
+  int i;
+
+  start = clock_ns ();
+  for (i = 0; i < cnt; i++)
+    {
+      snprintf (name, sizeof name, "small%d", i);
+      bench_check (create (name, 0), "create");
+    }
+  bench_report ("smallfiles", "create_ops_per_sec", cnt, clock_ns () - start);
+
+  start = clock_ns ();
+  for (i = 0; i < cnt; i++)
+    {
+      int fd;
+
+      snprintf (name, sizeof name, "small%d", i);
+      fd = open (name);
+      bench_check (fd >= 0, "open");
+      close (fd);
+    }
+  bench_report ("smallfiles", "open_close_ops_per_sec", cnt,
+                clock_ns () - start);
+
+  start = clock_ns ();
+  for (i = 0; i < cnt; i++)
+    {
+      snprintf (name, sizeof name, "small%d", i);
+      bench_check (remove (name), "remove");
+    }
+  bench_report ("smallfiles", "remove_ops_per_sec", cnt, clock_ns () - start);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,61 @@
+/* bench-syscall.c
+
+   Times the cheapest system calls, to measure system call entry
+   and exit: batch() with no operations, and clock_ns(), which
+   copies 8 bytes out to the caller.  These enter the kernel by
+   SYSENTER where the kernel supports it, so the null call is
+   also timed through int $0x30, to show what SYSENTER saves.
+   For comparison, also times info_ticks(), which reads the
+   kernel info page without a system call.
+
+   Usage: bench-syscall [COUNT] */
+
+#include <stdio.h>
+#include <info.h>
+#include <stdlib.h>
+#include <syscall.h>
+#include <syscall-nr.h>
+#include "bench.h"
+
+/* Calls batch (NULL, 0) through int $0x30, whatever entry path
+   the C library would use. */
+static void
+null_int30 (void)
+{
+  int retval;
+  asm volatile ("pushl $0; pushl $0; pushl %[number]; int $0x30; "
+                "addl $12, %%esp"
+                : "=a" (retval) : [number] "i" (SYS_BATCH) : "memory");
+}
+
+int
+main (int argc, char *argv[])
+{
+  int cnt = argc > 1 ? atoi (argv[1]) : 100000;
+  int64_t start;
+  int i;
+
+  start = clock_ns ();
+  for (i = 0; i < cnt; i++)
+    batch (NULL, 0);
+  bench_report ("syscall", "null_ops_per_sec", cnt, clock_ns () - start);
+
+  start = clock_ns ();
+  for (i = 0; i < cnt; i++)
+    null_int30 ();
+  bench_report ("syscall", "null_int30_ops_per_sec", cnt,
+                clock_ns () - start);
+
+  start = clock_ns ();
+  for (i = 0; i < cnt; i++)
+    clock_ns ();
+  bench_report ("syscall", "clock_ops_per_sec", cnt, clock_ns () - start);
+
+  start = clock_ns ();
+  for (i = 0; i < cnt; i++)
+    info_ticks ();
+  bench_report ("syscall", "info_ticks_ops_per_sec", cnt,
+                clock_ns () - start);
+
+  return EXIT_SUCCESS;
+}
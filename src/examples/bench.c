@@ -0,0 +1,31 @@
+/* bench.c
+
+   Reporting helpers shared by the bench-* programs. */
+
+#include "bench.h"
+#include <stdio.h>
+#include <syscall.h>
+
+/* Reports that OPS operations took NS nanoseconds, as
+        BENCH <bench> <metric> <operations per second>
+   the same form that the kernel's own benchmarks use. */
+void
+bench_report (const char *bench, const char *metric,
+              long long ops, int64_t ns)
+{
+  if (ns <= 0)
+    ns = 1;
+  printf ("BENCH %s %s %lld\n", bench, metric,
+          ops * 1000000000LL / ns);
+}
+
+/* Exits with an error message naming WHAT if OK is false. */
+void
+bench_check (int ok, const char *what)
+{
+  if (!ok)
+    {
+      printf ("%s failed\n", what);
+      exit (EXIT_FAILURE);
+    }
+}
@@ -0,0 +1,10 @@
+#ifndef EXAMPLES_BENCH_H
+#define EXAMPLES_BENCH_H
+
+#include <stdint.h>
+
+void bench_report (const char *bench, const char *metric,
+                   long long ops, int64_t ns);
+void bench_check (int ok, const char *what);
+
+#endif /* examples/bench.h */
@@ -0,0 +1,219 @@
+/* replay.c
+
+   Re-issues the file system calls in TRACE, a replay trace made
+   from a kernel run with -strace by "pintos-klog --syscalls",
+   and reports the calls per second, the bytes read and written
+   per second, and the mean and longest latency of a call.  Run
+   it on a fresh file system to judge changes to the buffer
+   cache, the free map or the disk scheduler on a real workload.
+
+   Each line of the trace is one call, such as "open 2 a.txt",
+   "write 2 512" or "pread 2 100 4096", naming descriptors by the
+   numbers that the trace gave them.  Data written is zeros.
+
+   Usage: replay [TRACE] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+#include "bench.h"
+
+/* Trace descriptors that may be open at once.  The trace never
+   reuses a number, so the table is indexed modulo FD_MAX. */
+#define FD_MAX 1024
+
+/* Longest line in a trace. */
+#define LINE_MAX 128
+
+/* Largest transfer made at once.  Longer ones are split. */
+#define CHUNK_SIZE 8192
+
+/* Data that replayed calls read and write. */
+static char buffer[CHUNK_SIZE];
+
+/* The trace, a piece at a time. */
+static char trace[1024];
+
+/* Replay descriptor for each trace descriptor, or -1. */
+static int fds[FD_MAX];
+
+/* Totals. */
+static long long call_cnt, skip_cnt, fail_cnt, byte_cnt;
+static int64_t total_ns, max_ns;
+
+static void replay (char *line);
+static int transfer (const char *op, int fd, unsigned size, unsigned ofs);
+
+int
+main (int argc, char *argv[])
+{
+  const char *name = argc > 1 ? argv[1] : "trace";
+  char line[LINE_MAX + 1];
+  size_t len = 0;
+  int fd, cnt, i;
+  int64_t start;
+
+  fd = open (name);
+  bench_check (fd >= 0, "open trace");
+  for (i = 0; i < FD_MAX; i++)
+    fds[i] = -1;
+
+  /* Replay each line of the trace as it is completed. */
+  start = clock_ns ();
+  while ((cnt = read (fd, trace, sizeof trace)) > 0)
+    for (i = 0; i < cnt; i++)
+      if (trace[i] != '\n')
+        {
+          bench_check (len < LINE_MAX, "trace line too long");
+          line[len++] = trace[i];
+        }
+      else
+        {
+          line[len] = '\0';
+          if (line[0] != '#')
+            replay (line);
+          len = 0;
+        }
+  close (fd);
+
+  printf ("replay: %lld calls, %lld skipped, %lld failed, "
+          "%lld bytes in %lld ms\n", call_cnt, skip_cnt, fail_cnt,
+          byte_cnt, (long long) ((clock_ns () - start) / 1000000));
+  bench_report ("replay", "calls_per_sec", call_cnt, total_ns);
+  bench_report ("replay", "bytes_per_sec", byte_cnt, total_ns);
+  printf ("BENCH replay mean_latency_ns %lld\n",
+          call_cnt > 0 ? (long long) (total_ns / call_cnt) : 0);
+  printf ("BENCH replay max_latency_ns %lld\n", (long long) max_ns);
+  return EXIT_SUCCESS;
+}
+
+/* Returns the replay descriptor for trace descriptor NAME, or
+   -1 if it has none. */
+static int
+lookup_fd (const char *name)
+{
+  int fd = name != NULL ? atoi (name) : -1;
+  return fd >= 0 ? fds[fd % FD_MAX] : -1;
+}
+
+/* Re-issues the call in LINE, timing it. */
+static void
+replay (char *line)
+{
+  char *argv[4], *save_ptr, *p;
+  int argc = 0;
+  int64_t start, ns;
+  bool ok = true;
+  int fd;
+
+  for (p = strtok_r (line, " ", &save_ptr); p != NULL && argc < 4;
+       p = strtok_r (NULL, " ", &save_ptr))
+    argv[argc++] = p;
+  while (argc < 4)
+    argv[argc++] = NULL;
+  if (argv[0] == NULL)
+    return;
+
+  /* Calls on a descriptor need one that the trace opened. */
+  fd = -1;
+  if (strcmp (argv[0], "open") && strcmp (argv[0], "create")
+      && strcmp (argv[0], "remove") && strcmp (argv[0], "mkdir")
+      && strcmp (argv[0], "chdir") && strcmp (argv[0], "sync"))
+    {
+      fd = lookup_fd (argv[1]);
+      if (fd < 0)
+        {
+          skip_cnt++;
+          return;
+        }
+    }
+
+  start = clock_ns ();
+  if (!strcmp (argv[0], "open") && argv[2] != NULL)
+    {
+      int new_fd = open (argv[2]);
+      int trace_fd = atoi (argv[1]);
+
+      if (argv[1][0] != '-' && trace_fd >= 0)
+        {
+          fds[trace_fd % FD_MAX] = new_fd;
+          ok = new_fd >= 0;
+        }
+      else if (new_fd >= 0)
+        close (new_fd);
+    }
+  else if (!strcmp (argv[0], "create") && argv[2] != NULL)
+    ok = create (argv[2], atoi (argv[1]));
+  else if (!strcmp (argv[0], "remove") && argv[1] != NULL)
+    ok = remove (argv[1]);
+  else if (!strcmp (argv[0], "mkdir") && argv[1] != NULL)
+    ok = mkdir (argv[1]);
+  else if (!strcmp (argv[0], "chdir") && argv[1] != NULL)
+    ok = chdir (argv[1]);
+  else if (!strcmp (argv[0], "sync"))
+    sync ();
+  else if (!strcmp (argv[0], "close"))
+    {
+      close (fd);
+      fds[atoi (argv[1]) % FD_MAX] = -1;
+    }
+  else if (!strcmp (argv[0], "seek") && argv[2] != NULL)
+    seek (fd, atoi (argv[2]));
+  else if (!strcmp (argv[0], "tell"))
+    tell (fd);
+  else if (!strcmp (argv[0], "filesize"))
+    ok = filesize (fd) >= 0;
+  else if (!strcmp (argv[0], "fsync"))
+    ok = fsync (fd);
+  else if (argv[2] != NULL
+           && (!strcmp (argv[0], "read") || !strcmp (argv[0], "write")
+               || !strcmp (argv[0], "pread") || !strcmp (argv[0], "pwrite")))
+    ok = transfer (argv[0], fd, atoi (argv[2]),
+                   argv[3] != NULL ? atoi (argv[3]) : 0) >= 0;
+  else
+    {
+      skip_cnt++;
+      return;
+    }
+  ns = clock_ns () - start;
+
+  call_cnt++;
+  if (!ok)
+    fail_cnt++;
+  total_ns += ns;
+  if (ns > max_ns)
+    max_ns = ns;
+}
+
+/* Carries out OP, which is "read", "write", "pread" or "pwrite",
+   on FD for SIZE bytes, at offset OFS for the last two, in
+   pieces of at most CHUNK_SIZE bytes.  Returns the number of
+   bytes transferred, or -1 if a piece fails. */
+static int
+transfer (const char *op, int fd, unsigned size, unsigned ofs)
+{
+  unsigned done = 0;
+
+  while (done < size)
+    {
+      unsigned chunk = size - done < CHUNK_SIZE ? size - done : CHUNK_SIZE;
+      int cnt;
+
+      if (!strcmp (op, "read"))
+        cnt = read (fd, buffer, chunk);
+      else if (!strcmp (op, "write"))
+        cnt = write (fd, buffer, chunk);
+      else if (!strcmp (op, "pread"))
+        cnt = pread (fd, buffer, chunk, ofs + done);
+      else
+        cnt = pwrite (fd, buffer, chunk, ofs + done);
+      if (cnt < 0)
+        return -1;
+      byte_cnt += cnt;
+      done += cnt;
+      if ((unsigned) cnt < chunk)
+        break;
+    }
+  return done;
+}
@@ -1,10 +1,13 @@
-#include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
 #include <syscall.h>
 
 static void read_line (char line[], size_t);
-static bool backspace (char **pos, char line[]);
+static void run_pipeline (char *left, char *right);
+static pid_t spawn_redirected (char *command, int fd, int new_fd);
+
+/* How much "nice" raises the nice value of the command it runs. */
+#define NICE_INCREMENT 10
 
 int
 main (void)
@@ -12,11 +15,22 @@ main (void)
   printf ("Shell starting...\n");
   for (;;) 
     {
-      char command[80];
+      char line[80];
+      char *command = line;
+      int old_nice = nice (0);
 
       /* Read command. */
       printf ("--");
-      read_line (command, sizeof command);
+      read_line (line, sizeof line);
+
+      /* "nice COMMAND" runs COMMAND, or every program in a
+         pipeline, with a higher nice value, which the processes
+         we start inherit. */
+      if (!memcmp (command, "nice ", 5))
+        {
+          command += 5;
+          nice (NICE_INCREMENT);
+        }
       
       /* Execute command. */
       if (!strcmp (command, "exit"))
@@ -30,6 +44,12 @@ main (void)
         {
           /* Empty command. */
         }
+      else if (strchr (command, '|') != NULL)
+        {
+          char *bar = strchr (command, '|');
+          *bar = '\0';
+          run_pipeline (command, bar + 1);
+        }
       else
         {
           pid_t pid = exec (command);
@@ -38,6 +58,7 @@ main (void)
           else
             printf ("exec failed\n");
         }
+      nice (old_nice - nice (0));
     }
 
   printf ("Shell exiting.");
@@ -45,60 +66,100 @@ main (void)
 }
 
 /* Reads a line of input from the user into LINE, which has room
-   for SIZE bytes.  Handles backspace and Ctrl+U in the ways
-   expected by Unix users.  On return, LINE will always be
-   null-terminated and will not end in a new-line character. */
+   for SIZE bytes.  The kernel echoes the line and handles
+   backspace and Ctrl+U as it is typed, and returns it once it is
+   complete.  On return, LINE will always be null-terminated and
+   will not end in a new-line character.  The rest of a line too
+   long for LINE is discarded. */
 static void
 read_line (char line[], size_t size) 
 {
-  char *pos = line;
+  size_t len = 0;
+  char discard[16];
+
   for (;;)
     {
-      char c;
-      read (STDIN_FILENO, &c, 1);
+      int n = read (STDIN_FILENO, line + len, size - 1 - len);
 
-      switch (c) 
+      if (n <= 0)
+        break;
+      len += n;
+      if (line[len - 1] == '\n')
         {
-        case '\r':
-          *pos = '\0';
-          putchar ('\n');
-          return;
-
-        case '\b':
-          backspace (&pos, line);
-          break;
-
-        case ('U' - 'A') + 1:       /* Ctrl+U. */
-          while (backspace (&pos, line))
-            continue;
+          len--;
           break;
-
-        default:
-          /* Add character to line. */
-          if (pos < line + size - 1) 
-            {
-              putchar (c);
-              *pos++ = c;
-            }
+        }
+      if (len == size - 1) 
+        {
+          /* Line too long: skip to its end. */
+          do
+            n = read (STDIN_FILENO, discard, sizeof discard);
+          while (n > 0 && discard[n - 1] != '\n');
           break;
         }
     }
+  line[len] = '\0';
 }
 
-/* If *POS is past the beginning of LINE, backs up one character
-   position.  Returns true if successful, false if nothing was
-   done. */
-static bool
-backspace (char **pos, char line[]) 
+/* Runs LEFT and RIGHT at the same time, with LEFT's output
+   going through a pipe to RIGHT's input, and waits for both. */
+static void
+run_pipeline (char *left, char *right)
 {
-  if (*pos > line)
+  int fds[2];
+  pid_t left_pid, right_pid;
+
+  while (*left == ' ')
+    left++;
+  while (*right == ' ')
+    right++;
+  if (!pipe (fds))
     {
-      /* Back up cursor, overwrite character, back up
-         again. */
-      printf ("\b \b");
-      (*pos)--;
-      return true;
+      printf ("pipe failed\n");
+      return;
     }
+
+  /* Each child has its end of the pipe installed as descriptor 1
+     or 0 as it is started, leaving ours alone. */
+  left_pid = spawn_redirected (left, fds[1], STDOUT_FILENO);
+  right_pid = spawn_redirected (right, fds[0], STDIN_FILENO);
+
+  /* RIGHT sees end of file only once every write end is closed. */
+  close (fds[0]);
+  close (fds[1]);
+
+  if (left_pid != PID_ERROR)
+    printf ("\"%s\": exit code %d\n", left, wait (left_pid));
   else
-    return false;
+    printf ("\"%s\": exec failed\n", left);
+  if (right_pid != PID_ERROR)
+    printf ("\"%s\": exit code %d\n", right, wait (right_pid));
+  else
+    printf ("\"%s\": exec failed\n", right);
+}
+
+/* Starts COMMAND, with our descriptor FD as its descriptor
+   NEW_FD.  Splits COMMAND into words in place, leaving just its
+   first word, and returns the new process's id or PID_ERROR. */
+static pid_t
+spawn_redirected (char *command, int fd, int new_fd)
+{
+  char *argv[16];
+  struct spawn_action actions[2];
+  char *token, *save_ptr;
+  int argc = 0;
+
+  for (token = strtok_r (command, " ", &save_ptr);
+       token != NULL && argc < 15;
+       token = strtok_r (NULL, " ", &save_ptr))
+    argv[argc++] = token;
+  argv[argc] = NULL;
+  if (argc == 0)
+    return PID_ERROR;
+
+  actions[0].op = SPAWN_DUP2;
+  actions[0].fd = fd;
+  actions[0].new_fd = new_fd;
+  actions[1].op = SPAWN_END;
+  return spawn (argv[0], argv, actions);
 }
@@ -0,0 +1,1150 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <list.h>
+#include "devices/timer.h"
+#include "filesys/filesys.h"
+#include "filesys/journal.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/workqueue.h"
+
+/* Buffer cache.
+
+   Holds up to CACHE_SIZE sectors of the file system device.
+   Writes only dirty the cached copy; dirty sectors go to disk
+   when they are evicted, by the write-behind work that runs
+   every CACHE_FLUSH_INTERVAL ticks, or when cache_flush() is
+   called at shutdown.  Victims are chosen by the replacement
+   policy selected with "-cache", described below.  Sectors
+   passed to cache_readahead() are loaded in the background by
+   read-ahead work, so that sequential readers overlap their work
+   with disk I/O.  Both kinds of work share
+   the single worker thread of CACHE_WQ.
+
+   Each sector is cached as either metadata, such as inodes,
+   index blocks, directories, and the free map, or file data.
+   One large sequential scan would otherwise push all of the
+   metadata out, so metadata is protected: while metadata fills
+   no more than META_RESERVE entries, the policy is asked for a
+   file data victim first.  The policies are:
+
+     - "clock" (the default): second chance.  A hand sweeps the
+       entries, giving each one used since the hand last passed
+       it another pass.
+
+     - "2q": a new sector goes at the back of a FIFO, COLD, and
+       is evicted from its front while COLD holds more than
+       TWOQ_COLD_MAX entries.  Evicted sectors are remembered in
+       GHOSTS[0], and one that is read again soon after goes
+       into HOT, which is an LRU list, as does a sector used
+       again while in HOT.  A sector read just once, as in a
+       scan, never reaches HOT.
+
+     - "arc": adaptive replacement.  COLD holds sectors used
+       once recently and HOT sectors used more than once, both
+       LRU lists, and GHOSTS[0] and GHOSTS[1] remember sectors
+       recently evicted from each.  A miss on a sector in a
+       ghost list shows that its list was too short, and moves
+       the target size of COLD, ARC_TARGET, toward it.
+
+   CACHE_LOCK protects the mapping from sectors to entries: every
+   entry's SECTOR, VALID, ACCESSED, META, QUEUE, PIN_CNT,
+   EVICTING, and TXN members, and the replacement policy's
+   state.  It is never held across disk I/O.  Each entry's own
+   LOCK protects its DATA and DIRTY members and is held across
+   the disk I/O that fills or cleans the entry.  An entry with a
+   nonzero PIN_CNT is in use and cannot be evicted.
+
+   A sector written by journal_write_at() belongs to a journal
+   transaction until it commits and is held in the cache until
+   then: eviction and write-behind pass it by, so that the disk
+   never sees half of a transaction.  The journal tells the cache
+   which transactions have committed with cache_commit().
+
+   cache_sync() makes sectors durable for fsync() and sync().
+   Syncs that arrive while one is writing wait and then share the
+   next pass: its writer takes the union of their sectors, writes
+   them back in ascending order, and flushes the disk's write
+   cache once for all of them.
+
+   Writers of file data call cache_throttle() after each write.
+   Once more than DIRTY_SOFT_LIMIT sectors are dirty, it starts a
+   write-back pass early and makes the writer sleep for as long as
+   the disk, at its measured write speed, takes to write the
+   excess, so that a fast writer is slowed to the disk's pace
+   instead of filling the cache and making every reader clean a
+   victim first.  At DIRTY_HARD_LIMIT it waits for write-back to
+   catch up. */
+
+/* Ticks between write-behind passes. */
+#define CACHE_FLUSH_INTERVAL (5 * TIMER_FREQ)
+
+/* Dirty sector counts at which writers are slowed down and
+   stopped. */
+#define DIRTY_SOFT_LIMIT (CACHE_SIZE / 2)
+#define DIRTY_HARD_LIMIT (CACHE_SIZE * 3 / 4)
+
+/* Longest that cache_throttle() sleeps in proportion to the
+   excess, in nanoseconds. */
+#define THROTTLE_MAX_NS 100000000
+
+/* Entries in which metadata is protected from eviction. */
+#define META_RESERVE (CACHE_SIZE / 2)
+
+/* Most entries 2Q's COLD list may hold before it is evicted
+   from ahead of HOT, and how many of its evicted sectors 2Q
+   remembers. */
+#define TWOQ_COLD_MAX (CACHE_SIZE / 4)
+#define TWOQ_GHOST_MAX (CACHE_SIZE / 2)
+
+/* Replacement policy queue an entry is on. */
+enum cache_queue
+  {
+    QUEUE_NONE,                         /* None, as with "clock". */
+    QUEUE_COLD,                         /* COLD. */
+    QUEUE_HOT                           /* HOT. */
+  };
+
+/* A cached sector. */
+struct cache_entry
+  {
+    block_sector_t sector;              /* Cached sector. */
+    bool valid;                         /* Does this entry hold a sector? */
+    bool accessed;                      /* Used since the clock hand passed? */
+    bool meta;                          /* Cached as metadata? */
+    enum cache_queue queue;             /* Policy queue. */
+    struct list_elem queue_elem;        /* Element in QUEUE. */
+    int pin_cnt;                        /* Number of users. */
+    block_sector_t evicting;            /* Sector being written back. */
+    unsigned txn;                       /* Last journal transaction, or 0. */
+    bool dirty;                         /* Modified since read from disk? */
+    struct lock lock;                   /* Protects DATA and DIRTY. */
+    uint8_t data[BLOCK_SECTOR_SIZE];    /* Sector contents. */
+  };
+
+/* Value of EVICTING when no write-back is in progress. */
+#define NO_SECTOR ((block_sector_t) -1)
+
+static struct cache_entry cache[CACHE_SIZE];
+static struct lock cache_lock;
+static struct condition cache_unpinned; /* Signaled when a pin drops to 0. */
+static size_t clock_hand;
+static unsigned committed_txn;          /* Last committed transaction. */
+static size_t dirty_cnt;                /* Number of dirty entries. */
+static size_t used_cnt;                 /* Entries ever used. */
+static size_t meta_cnt;                 /* Entries holding metadata. */
+
+/* A replacement policy.  Every hook is called with CACHE_LOCK
+   held. */
+struct cache_policy
+  {
+    const char *name;
+
+    /* Entry E, which holds a sector, was used again.  May be
+       null. */
+    void (*hit) (struct cache_entry *e);
+
+    /* Returns an entry to evict to make room for SECTOR, one for
+       which can_evict() returns true given SPARE_META, or a null
+       pointer if there is none, and takes the entry off its
+       queue. */
+    struct cache_entry *(*choose) (block_sector_t sector, bool spare_meta);
+
+    /* Entry E, on no queue, now holds the sector it was claimed
+       for.  May be null. */
+    void (*insert) (struct cache_entry *e);
+  };
+
+static const struct cache_policy clock_policy, twoq_policy, arc_policy;
+static const struct cache_policy *policy = &clock_policy;
+
+/* Sectors recently evicted, oldest first, for 2Q and ARC. */
+struct ghost_list
+  {
+    block_sector_t sectors[CACHE_SIZE];
+    size_t cnt;
+  };
+
+static struct clist cold_queue, hot_queue;
+static struct ghost_list ghosts[2];
+static size_t arc_target;               /* Target size of COLD_QUEUE. */
+
+/* Read-ahead queue: a ring of sectors waiting to be loaded.
+   When it is full, new requests are dropped. */
+#define READAHEAD_QUEUE_SIZE 32
+static block_sector_t readahead_queue[READAHEAD_QUEUE_SIZE];
+static size_t readahead_head, readahead_cnt;
+static struct lock readahead_lock;
+
+/* Background work. */
+static struct workqueue cache_wq;
+static struct work flush_work, readahead_work, writeback_work;
+static int64_t flush_due;       /* Tick of the next write-behind pass. */
+
+/* Sync passes.  A pass numbered N covers every cache_sync() call
+   that arrived before N started. */
+static struct lock sync_lock;           /* Protects the members below. */
+static struct condition sync_done;      /* A pass finished. */
+static block_sector_t sync_sectors[CACHE_SIZE]; /* Sectors requested. */
+static size_t sync_cnt;                 /* Number of SYNC_SECTORS. */
+static bool sync_all;                   /* Every sector requested? */
+static unsigned sync_started;           /* Last pass started. */
+static unsigned sync_finished;          /* Last pass finished. */
+
+/* Statistics. */
+static unsigned long long hit_cnt, miss_cnt, writeback_cnt;
+static unsigned long long meta_hit_cnt, meta_miss_cnt;
+static unsigned long long sync_request_cnt, sync_pass_cnt;
+static unsigned long long readahead_hit_cnt, readahead_load_cnt;
+static unsigned long long readahead_drop_cnt;
+static unsigned long long direct_cnt;
+static unsigned long long throttle_cnt, throttle_ns, writeback_kick_cnt;
+
+static struct cache_entry *cache_get (block_sector_t, bool read, bool meta);
+static void cache_put (struct cache_entry *);
+static struct cache_entry *cache_evict (block_sector_t, bool meta);
+static bool cache_contains (block_sector_t);
+static bool cache_held (const struct cache_entry *);
+static void write_back (const block_sector_t[], size_t cnt);
+static int compare_sectors (const void *, const void *);
+static work_func cache_flush_work;
+static work_func cache_readahead_work;
+static work_func cache_writeback_work;
+
+/* Selects the replacement policy named NAME.  Returns false if
+   there is no such policy.  Must be called before cache_init(). */
+bool
+cache_set_policy (const char *name) 
+{
+  static const struct cache_policy *const policies[] =
+    {&clock_policy, &twoq_policy, &arc_policy};
+  size_t i;
+
+  for (i = 0; i < sizeof policies / sizeof *policies; i++)
+    if (!strcmp (name, policies[i]->name))
+      {
+        policy = policies[i];
+        return true;
+      }
+  return false;
+}
+
+/* Initializes the buffer cache and starts write-behind. */
+void
+cache_init (void) 
+{
+  size_t i;
+
+  lock_init (&cache_lock);
+  lock_set_name (&cache_lock, "cache");
+  cond_init (&cache_unpinned);
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[i];
+      e->valid = false;
+      e->pin_cnt = 0;
+      e->evicting = NO_SECTOR;
+      e->txn = 0;
+      e->dirty = false;
+      e->queue = QUEUE_NONE;
+      lock_init (&e->lock);
+    }
+  clist_init (&cold_queue);
+  clist_init (&hot_queue);
+  lock_init (&readahead_lock);
+  lock_init (&sync_lock);
+  cond_init (&sync_done);
+  workqueue_init (&cache_wq, "cache", 1, PRI_DEFAULT);
+  work_init (&flush_work, cache_flush_work, NULL);
+  work_init (&readahead_work, cache_readahead_work, NULL);
+  work_init (&writeback_work, cache_writeback_work, NULL);
+  flush_due = timer_ticks () + CACHE_FLUSH_INTERVAL;
+  work_queue_at (&cache_wq, &flush_work, flush_due);
+}
+
+/* Sets the DIRTY member of entry E, whose lock the caller must
+   hold, keeping dirty_cnt current. */
+static void
+set_dirty (struct cache_entry *e, bool dirty)
+{
+  if (e->dirty != dirty)
+    {
+      lock_acquire (&cache_lock);
+      if (dirty)
+        dirty_cnt++;
+      else
+        dirty_cnt--;
+      lock_release (&cache_lock);
+      e->dirty = dirty;
+    }
+}
+
+/* Reads sector SECTOR of the file system device into BUFFER,
+   which must have room for BLOCK_SECTOR_SIZE bytes. */
+void
+cache_read (block_sector_t sector, void *buffer) 
+{
+  cache_read_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Writes sector SECTOR of the file system device from BUFFER,
+   which must contain BLOCK_SECTOR_SIZE bytes. */
+void
+cache_write (block_sector_t sector, const void *buffer) 
+{
+  cache_write_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Reads SIZE bytes of file system metadata starting at byte
+   offset OFS within sector SECTOR into BUFFER. */
+void
+cache_read_at (block_sector_t sector, void *buffer, size_t ofs, size_t size) 
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, true, true);
+  memcpy (buffer, e->data + ofs, size);
+  cache_put (e);
+}
+
+/* Like cache_read_at(), but for file data, which does not get
+   the protection from eviction that metadata does. */
+void
+cache_read_data_at (block_sector_t sector, void *buffer,
+                    size_t ofs, size_t size) 
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, true, false);
+  memcpy (buffer, e->data + ofs, size);
+  cache_put (e);
+}
+
+/* Writes SIZE bytes of file system metadata from BUFFER starting
+   at byte offset OFS within sector SECTOR.  A write of a whole
+   sector does not read it from disk first. */
+void
+cache_write_at (block_sector_t sector, const void *buffer,
+                size_t ofs, size_t size) 
+{
+  cache_write_txn (sector, buffer, ofs, size, 0);
+}
+
+/* Like cache_write_at(), but for file data. */
+void
+cache_write_data_at (block_sector_t sector, const void *buffer,
+                     size_t ofs, size_t size) 
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, size < BLOCK_SECTOR_SIZE, false);
+  memcpy (e->data + ofs, buffer, size);
+  set_dirty (e, true);
+  cache_put (e);
+}
+
+/* Like cache_write_at(), but if TXN is nonzero, also makes the
+   sector part of journal transaction TXN, so that it stays in
+   the cache until TXN commits. */
+void
+cache_write_txn (block_sector_t sector, const void *buffer,
+                 size_t ofs, size_t size, unsigned txn)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, size < BLOCK_SECTOR_SIZE, true);
+  memcpy (e->data + ofs, buffer, size);
+  set_dirty (e, true);
+  if (txn != 0)
+    {
+      lock_acquire (&cache_lock);
+      e->txn = txn;
+      lock_release (&cache_lock);
+    }
+  cache_put (e);
+}
+
+/* Records that journal transaction TXN, and every one before it,
+   has committed, so that their sectors may be written back. */
+void
+cache_commit (unsigned txn)
+{
+  lock_acquire (&cache_lock);
+  committed_txn = txn;
+  cond_broadcast (&cache_unpinned, &cache_lock);
+  lock_release (&cache_lock);
+}
+
+/* Writes SECTOR, part of journal transaction TXN, which has been
+   logged but not yet passed to cache_commit(), to its place on
+   disk.  SNAPSHOT is its contents as of TXN.  If a later
+   transaction has changed the cached copy since, SNAPSHOT is
+   written and the cached copy stays dirty and held; otherwise
+   the cached copy is written and becomes clean. */
+void
+cache_checkpoint (block_sector_t sector, const void *snapshot, unsigned txn)
+{
+  struct cache_entry *e = NULL;
+  size_t i;
+
+  lock_acquire (&cache_lock);
+  for (i = 0; i < CACHE_SIZE; i++)
+    if (cache[i].valid && cache[i].sector == sector && cache[i].txn == txn)
+      {
+        e = &cache[i];
+        e->pin_cnt++;
+        break;
+      }
+  lock_release (&cache_lock);
+
+  if (e == NULL)
+    {
+      block_write (fs_device, sector, snapshot);
+      writeback_cnt++;
+      return;
+    }
+  lock_acquire (&e->lock);
+  if (e->dirty)
+    {
+      block_write (fs_device, e->sector, e->data);
+      set_dirty (e, false);
+      writeback_cnt++;
+    }
+  cache_put (e);
+}
+
+/* Reads CNT consecutive sectors starting at SECTOR into BUFFER,
+   which must have room for CNT * BLOCK_SECTOR_SIZE bytes.
+   Sectors in the cache are copied out of it, so that dirty data
+   is seen, but runs of sectors that are not cached are read from
+   disk straight into BUFFER without passing through the cache.
+   Suited to large reads, such as loading a page, that would
+   otherwise pay for an extra copy and push the rest of the
+   working set out of the cache. */
+void
+cache_read_direct (block_sector_t sector, size_t cnt, void *buffer_) 
+{
+  uint8_t *buffer = buffer_;
+
+  while (cnt > 0)
+    {
+      size_t run;
+
+      /* Count the uncached sectors at the front.  A sector whose
+         write-back is in progress counts as cached, because its
+         copy on disk is stale until the write-back finishes. */
+      lock_acquire (&cache_lock);
+      for (run = 0; run < cnt && !cache_contains (sector + run); run++)
+        continue;
+      lock_release (&cache_lock);
+
+      if (run > 0)
+        {
+          block_read_multiple (fs_device, sector, run, buffer);
+          direct_cnt += run;
+        }
+      else
+        {
+          cache_read (sector, buffer);
+          run = 1;
+        }
+      sector += run;
+      cnt -= run;
+      buffer += run * BLOCK_SECTOR_SIZE;
+    }
+}
+
+/* Asks the read-ahead work to load SECTOR into the cache.
+   Returns without waiting for the sector to be read.  The
+   request may be dropped if many are already pending. */
+void
+cache_readahead (block_sector_t sector) 
+{
+  lock_acquire (&readahead_lock);
+  if (readahead_cnt < READAHEAD_QUEUE_SIZE)
+    {
+      size_t tail = (readahead_head + readahead_cnt) % READAHEAD_QUEUE_SIZE;
+      readahead_queue[tail] = sector;
+      readahead_cnt++;
+    }
+  else
+    readahead_drop_cnt++;
+  lock_release (&readahead_lock);
+  work_queue (&cache_wq, &readahead_work);
+}
+
+/* Writes every dirty cached sector to disk, in ascending sector
+   order, except those of journal transactions that have not
+   committed. */
+void
+cache_flush (void) 
+{
+  block_sector_t sectors[CACHE_SIZE];
+
+  write_back (sectors, cache_list (sectors));
+}
+
+/* Stores the numbers of the cached sectors that may be written
+   back, in ascending order, into SECTORS, and returns how many
+   there are.  The cache may change as soon as this returns, so
+   the list is only a snapshot. */
+size_t
+cache_list (block_sector_t sectors[CACHE_SIZE])
+{
+  size_t cnt = 0;
+  size_t i;
+
+  lock_acquire (&cache_lock);
+  for (i = 0; i < CACHE_SIZE; i++)
+    if (cache[i].valid && !cache_held (&cache[i]))
+      sectors[cnt++] = cache[i].sector;
+  lock_release (&cache_lock);
+
+  qsort (sectors, cnt, sizeof *sectors, compare_sectors);
+  return cnt;
+}
+
+/* Makes the CNT sectors in SECTORS durable, if they are dirty in
+   the cache, or every cached sector if SECTORS is null: writes
+   them back and then flushes the disk's write cache.  Sectors of
+   journal transactions that have not committed are skipped.
+   Calls made close together are coalesced into one pass. */
+void
+cache_sync (const block_sector_t sectors[], size_t cnt)
+{
+  unsigned ticket;
+  size_t i, j;
+
+  lock_acquire (&sync_lock);
+  if (sectors == NULL)
+    sync_all = true;
+  for (i = 0; i < cnt && !sync_all; i++)
+    {
+      for (j = 0; j < sync_cnt; j++)
+        if (sync_sectors[j] == sectors[i])
+          break;
+      if (j < sync_cnt)
+        continue;
+      else if (sync_cnt < CACHE_SIZE)
+        sync_sectors[sync_cnt++] = sectors[i];
+      else
+        sync_all = true;
+    }
+  sync_request_cnt++;
+
+  /* The next pass to start will cover this call.  Whoever finds
+     no pass running starts it, with everything requested so
+     far. */
+  ticket = sync_started + 1;
+  while (sync_finished < ticket)
+    if (sync_finished == sync_started)
+      {
+        block_sector_t pass[CACHE_SIZE];
+        size_t pass_cnt = sync_cnt;
+        bool all = sync_all;
+
+        memcpy (pass, sync_sectors, sync_cnt * sizeof *pass);
+        sync_cnt = 0;
+        sync_all = false;
+        sync_started++;
+        lock_release (&sync_lock);
+
+        if (all)
+          pass_cnt = cache_list (pass);
+        else
+          qsort (pass, pass_cnt, sizeof *pass, compare_sectors);
+        write_back (pass, pass_cnt);
+        block_flush (fs_device);
+
+        lock_acquire (&sync_lock);
+        sync_finished = sync_started;
+        sync_pass_cnt++;
+        cond_broadcast (&sync_done, &sync_lock);
+      }
+    else
+      cond_wait (&sync_done, &sync_lock);
+  lock_release (&sync_lock);
+}
+
+/* Slows down the calling writer of file data if too many cached
+   sectors are dirty, as described at the top of this file.  Does
+   nothing if the caller holds a journal handle, since write-back
+   may have to wait for the handle's transaction to commit, or
+   any lock, such as a frame lock during page eviction, since
+   others might need it for write-back to make progress. */
+void
+cache_throttle (void) 
+{
+  struct thread *t = thread_current ();
+  size_t dirty;
+  int64_t start, ns;
+
+  if (t->journal_depth > 0 || !pheap_empty (&t->held_lock))
+    return;
+
+  lock_acquire (&cache_lock);
+  dirty = dirty_cnt;
+  lock_release (&cache_lock);
+  if (dirty <= DIRTY_SOFT_LIMIT)
+    return;
+
+  /* Start write-back now rather than at the next write-behind
+     pass.  If a pass is already queued or running, that will
+     do. */
+  start = timer_ns ();
+  if (work_queue (&cache_wq, &writeback_work))
+    writeback_kick_cnt++;
+
+  ns = (dirty - DIRTY_SOFT_LIMIT) * block_write_ns (fs_device);
+  if (ns > THROTTLE_MAX_NS)
+    ns = THROTTLE_MAX_NS;
+  timer_nsleep (ns);
+
+  /* Past the hard limit, wait for write-back to catch up, a tick
+     at a time. */
+  for (;;)
+    {
+      lock_acquire (&cache_lock);
+      dirty = dirty_cnt;
+      lock_release (&cache_lock);
+      if (dirty < DIRTY_HARD_LIMIT)
+        break;
+      work_queue (&cache_wq, &writeback_work);
+      timer_sleep (1);
+    }
+
+  throttle_cnt++;
+  throttle_ns += timer_ns () - start;
+}
+
+/* Returns HITS as a percentage of HITS plus MISSES, or 0. */
+static unsigned
+hit_rate (unsigned long long hits, unsigned long long misses) 
+{
+  return hits + misses > 0 ? hits * 100 / (hits + misses) : 0;
+}
+
+/* Prints buffer cache statistics. */
+void
+cache_print_stats (void) 
+{
+  printf ("Cache: %llu hits, %llu misses, %llu write-backs\n",
+          hit_cnt, miss_cnt, writeback_cnt);
+  printf ("Cache: %s replacement, hit rate %u%% for metadata, "
+          "%u%% for data\n", policy->name,
+          hit_rate (meta_hit_cnt, meta_miss_cnt),
+          hit_rate (hit_cnt - meta_hit_cnt, miss_cnt - meta_miss_cnt));
+  printf ("Cache: read-ahead %llu loaded, %llu already cached, "
+          "%llu dropped\n",
+          readahead_load_cnt, readahead_hit_cnt, readahead_drop_cnt);
+  printf ("Cache: %llu sectors read directly\n", direct_cnt);
+  printf ("Cache: %llu syncs in %llu passes\n",
+          sync_request_cnt, sync_pass_cnt);
+  printf ("Cache: %llu writers throttled for %llu ms, "
+          "%llu early write-backs\n",
+          throttle_cnt, throttle_ns / 1000000, writeback_kick_cnt);
+}
+
+/* Returns the locked and pinned cache entry for SECTOR, loading
+   it into the cache if necessary.  If READ is false, the caller
+   is going to overwrite the whole sector, so a newly loaded
+   entry's data is not read from disk.  META says whether the
+   sector is metadata.  The caller must release the entry with
+   cache_put(). */
+static struct cache_entry *
+cache_get (block_sector_t sector, bool read, bool meta) 
+{
+  struct cache_entry *e;
+  block_sector_t old_sector;
+  bool old_dirty;
+  size_t i;
+
+  lock_acquire (&cache_lock);
+ retry:
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      e = &cache[i];
+      if (e->valid && e->sector == sector)
+        {
+          /* Hit.  Wait for any load in progress to finish by
+             acquiring the entry's lock. */
+          e->pin_cnt++;
+          e->accessed = true;
+          if (policy->hit != NULL)
+            policy->hit (e);
+          hit_cnt++;
+          if (meta)
+            meta_hit_cnt++;
+          lock_release (&cache_lock);
+          lock_acquire (&e->lock);
+          return e;
+        }
+      if (e->evicting == sector)
+        {
+          /* SECTOR is still being written back from this entry.
+             Reading it from disk now could return stale data, so
+             wait for the write-back and look again. */
+          lock_release (&cache_lock);
+          lock_acquire (&e->lock);
+          lock_release (&e->lock);
+          lock_acquire (&cache_lock);
+          goto retry;
+        }
+    }
+
+  /* Miss.  Claim a victim entry.  No one else holds its lock,
+     because it is unpinned, so acquiring the lock here cannot
+     block while CACHE_LOCK is held. */
+  e = cache_evict (sector, meta);
+  miss_cnt++;
+  if (meta)
+    meta_miss_cnt++;
+  lock_acquire (&e->lock);
+  old_sector = e->sector;
+  old_dirty = e->valid && e->dirty;
+  if (old_dirty)
+    e->evicting = old_sector;
+  if (e->valid && e->meta)
+    meta_cnt--;
+  if (meta)
+    meta_cnt++;
+  e->sector = sector;
+  e->valid = true;
+  e->accessed = true;
+  e->meta = meta;
+  e->pin_cnt = 1;
+  e->txn = 0;
+  if (policy->insert != NULL)
+    policy->insert (e);
+  lock_release (&cache_lock);
+
+  /* Do the disk I/O with only the entry locked. */
+  if (old_dirty)
+    {
+      block_write (fs_device, old_sector, e->data);
+      writeback_cnt++;
+    }
+  set_dirty (e, false);
+  if (read)
+    block_read (fs_device, sector, e->data);
+
+  if (old_dirty)
+    {
+      lock_acquire (&cache_lock);
+      e->evicting = NO_SECTOR;
+      lock_release (&cache_lock);
+    }
+  return e;
+}
+
+/* Unlocks and unpins entry E, obtained from cache_get(). */
+static void
+cache_put (struct cache_entry *e) 
+{
+  lock_release (&e->lock);
+
+  lock_acquire (&cache_lock);
+  ASSERT (e->pin_cnt > 0);
+  if (--e->pin_cnt == 0)
+    cond_signal (&cache_unpinned, &cache_lock);
+  lock_release (&cache_lock);
+}
+
+/* Returns true if entry E may be reused: it is unpinned, not
+   being written back, and not held for an uncommitted journal
+   transaction, and, if SPARE_META is true, does not hold
+   metadata.  CACHE_LOCK must be held. */
+static bool
+can_evict (const struct cache_entry *e, bool spare_meta) 
+{
+  return (e->pin_cnt == 0 && e->evicting == NO_SECTOR && !cache_held (e)
+          && !(spare_meta && e->meta));
+}
+
+/* Chooses an entry to reuse for SECTOR, metadata if META is
+   true, waiting for one to become unpinned if necessary.
+   CACHE_LOCK must be held. */
+static struct cache_entry *
+cache_evict (block_sector_t sector, bool meta) 
+{
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+
+  if (used_cnt < CACHE_SIZE)
+    return &cache[used_cnt++];
+
+  for (;;)
+    {
+      /* Metadata evicts metadata only once it has its reserve. */
+      bool spare_meta = meta ? meta_cnt < META_RESERVE
+                             : meta_cnt <= META_RESERVE;
+      struct cache_entry *e = policy->choose (sector, spare_meta);
+      if (e == NULL && spare_meta)
+        e = policy->choose (sector, false);
+      if (e != NULL)
+        return e;
+      cond_wait (&cache_unpinned, &cache_lock);
+    }
+}
+
+/* Clock policy. */
+
+static struct cache_entry *
+clock_choose (block_sector_t sector UNUSED, bool spare_meta) 
+{
+  size_t scanned;
+
+  /* Two full sweeps: the first may only clear accessed bits. */
+  for (scanned = 0; scanned < 2 * CACHE_SIZE; scanned++)
+    {
+      struct cache_entry *e = &cache[clock_hand];
+      clock_hand = (clock_hand + 1) % CACHE_SIZE;
+
+      if (!can_evict (e, spare_meta))
+        continue;
+      if (!e->accessed)
+        return e;
+      e->accessed = false;
+    }
+  return NULL;
+}
+
+static const struct cache_policy clock_policy =
+  {"clock", NULL, clock_choose, NULL};
+
+/* Helpers for 2Q and ARC. */
+
+/* Returns the index of SECTOR in G, or -1 if it is not there. */
+static int
+ghost_find (const struct ghost_list *g, block_sector_t sector) 
+{
+  size_t i;
+
+  for (i = 0; i < g->cnt; i++)
+    if (g->sectors[i] == sector)
+      return i;
+  return -1;
+}
+
+/* Removes the sector at index IDX from G. */
+static void
+ghost_remove (struct ghost_list *g, size_t idx) 
+{
+  ASSERT (idx < g->cnt);
+  g->cnt--;
+  memmove (g->sectors + idx, g->sectors + idx + 1,
+           (g->cnt - idx) * sizeof *g->sectors);
+}
+
+/* Adds SECTOR to G as its newest sector, forgetting the oldest
+   if G already holds MAX. */
+static void
+ghost_push (struct ghost_list *g, block_sector_t sector, size_t max) 
+{
+  if (g->cnt >= max)
+    ghost_remove (g, 0);
+  g->sectors[g->cnt++] = sector;
+}
+
+/* Puts E at the back of queue Q. */
+static void
+queue_push (struct cache_entry *e, enum cache_queue q) 
+{
+  e->queue = q;
+  clist_push_back (q == QUEUE_HOT ? &hot_queue : &cold_queue, &e->queue_elem);
+}
+
+/* Removes and returns the entry nearest the front of queue Q
+   that can_evict() allows given SPARE_META, and remembers its
+   sector in ghost list G, or returns a null pointer. */
+static struct cache_entry *
+queue_take (enum cache_queue q, bool spare_meta, struct ghost_list *g,
+            size_t ghost_max) 
+{
+  struct clist *queue = q == QUEUE_HOT ? &hot_queue : &cold_queue;
+  struct list *list = &queue->list;
+  struct list_elem *elem;
+
+  for (elem = list_begin (list); elem != list_end (list);
+       elem = list_next (elem))
+    {
+      struct cache_entry *e = list_entry (elem, struct cache_entry,
+                                          queue_elem);
+      if (can_evict (e, spare_meta))
+        {
+          clist_remove (queue, elem);
+          e->queue = QUEUE_NONE;
+          if (g != NULL)
+            ghost_push (g, e->sector, ghost_max);
+          return e;
+        }
+    }
+  return NULL;
+}
+
+/* Moves E, which is in HOT or COLD, to the back of HOT. */
+static void
+move_to_hot (struct cache_entry *e) 
+{
+  clist_remove (e->queue == QUEUE_HOT ? &hot_queue : &cold_queue,
+                &e->queue_elem);
+  queue_push (e, QUEUE_HOT);
+}
+
+/* 2Q policy.  GHOSTS[0] is A1out. */
+
+static void
+twoq_hit (struct cache_entry *e) 
+{
+  if (e->queue == QUEUE_HOT)
+    move_to_hot (e);
+}
+
+static struct cache_entry *
+twoq_choose (block_sector_t sector UNUSED, bool spare_meta) 
+{
+  struct cache_entry *e = NULL;
+
+  if (clist_size (&cold_queue) > TWOQ_COLD_MAX || clist_empty (&hot_queue))
+    e = queue_take (QUEUE_COLD, spare_meta, &ghosts[0], TWOQ_GHOST_MAX);
+  if (e == NULL)
+    e = queue_take (QUEUE_HOT, spare_meta, NULL, 0);
+  if (e == NULL)
+    e = queue_take (QUEUE_COLD, spare_meta, &ghosts[0], TWOQ_GHOST_MAX);
+  return e;
+}
+
+static void
+twoq_insert (struct cache_entry *e) 
+{
+  int idx = ghost_find (&ghosts[0], e->sector);
+
+  if (idx >= 0)
+    {
+      ghost_remove (&ghosts[0], idx);
+      queue_push (e, QUEUE_HOT);
+    }
+  else
+    queue_push (e, QUEUE_COLD);
+}
+
+static const struct cache_policy twoq_policy =
+  {"2q", twoq_hit, twoq_choose, twoq_insert};
+
+/* ARC policy.  COLD and HOT are T1 and T2, GHOSTS[0] and
+   GHOSTS[1] are B1 and B2, and ARC_TARGET is p, in the terms of
+   Megiddo and Modha's paper. */
+
+static void
+arc_hit (struct cache_entry *e) 
+{
+  if (e->queue != QUEUE_NONE)
+    move_to_hot (e);
+}
+
+static struct cache_entry *
+arc_choose (block_sector_t sector, bool spare_meta) 
+{
+  size_t cold_cnt = clist_size (&cold_queue);
+  struct cache_entry *e = NULL;
+
+  if (cold_cnt > 0
+      && (cold_cnt > arc_target
+          || (cold_cnt == arc_target && ghost_find (&ghosts[1], sector) >= 0)))
+    e = queue_take (QUEUE_COLD, spare_meta, &ghosts[0], CACHE_SIZE);
+  if (e == NULL)
+    e = queue_take (QUEUE_HOT, spare_meta, &ghosts[1], CACHE_SIZE);
+  if (e == NULL)
+    e = queue_take (QUEUE_COLD, spare_meta, &ghosts[0], CACHE_SIZE);
+  return e;
+}
+
+static void
+arc_insert (struct cache_entry *e) 
+{
+  struct ghost_list *b1 = &ghosts[0], *b2 = &ghosts[1];
+  int idx;
+
+  if ((idx = ghost_find (b1, e->sector)) >= 0)
+    {
+      /* COLD was too short: lengthen it. */
+      size_t delta = b2->cnt > b1->cnt ? b2->cnt / b1->cnt : 1;
+      arc_target = (arc_target + delta < CACHE_SIZE
+                    ? arc_target + delta : CACHE_SIZE);
+      ghost_remove (b1, idx);
+      queue_push (e, QUEUE_HOT);
+    }
+  else if ((idx = ghost_find (b2, e->sector)) >= 0)
+    {
+      /* HOT was too short: shorten COLD. */
+      size_t delta = b1->cnt > b2->cnt ? b1->cnt / b2->cnt : 1;
+      arc_target = arc_target > delta ? arc_target - delta : 0;
+      ghost_remove (b2, idx);
+      queue_push (e, QUEUE_HOT);
+    }
+  else
+    {
+      /* Keep COLD and B1 within the cache size, and all four
+         lists within twice that. */
+      if (clist_size (&cold_queue) + b1->cnt >= CACHE_SIZE && b1->cnt > 0)
+        ghost_remove (b1, 0);
+      else if (clist_size (&cold_queue) + clist_size (&hot_queue)
+               + b1->cnt + b2->cnt >= 2 * CACHE_SIZE && b2->cnt > 0)
+        ghost_remove (b2, 0);
+      queue_push (e, QUEUE_COLD);
+    }
+}
+
+static const struct cache_policy arc_policy =
+  {"arc", arc_hit, arc_choose, arc_insert};
+
+/* Write-behind work.  Periodically commits the running journal
+   transaction and writes dirty sectors to disk, so that a crash
+   loses at most CACHE_FLUSH_INTERVAL ticks of writes.  Requeues
+   itself for the next pass, CACHE_FLUSH_INTERVAL ticks after
+   this one was due, skipping any passes it has fallen behind. */
+static void
+cache_flush_work (void *aux UNUSED) 
+{
+  int64_t now;
+
+  journal_commit ();
+  cache_flush ();
+
+  now = timer_ticks ();
+  flush_due += CACHE_FLUSH_INTERVAL;
+  if (flush_due <= now)
+    flush_due += (now - flush_due) / CACHE_FLUSH_INTERVAL * CACHE_FLUSH_INTERVAL
+                 + CACHE_FLUSH_INTERVAL;
+  work_queue_at (&cache_wq, &flush_work, flush_due);
+}
+
+/* Early write-back work, queued by cache_throttle().  Commits
+   the running journal transaction, so that its sectors may be
+   written back too, and writes back every dirty sector. */
+static void
+cache_writeback_work (void *aux UNUSED) 
+{
+  journal_commit ();
+  cache_flush ();
+}
+
+/* Returns true if SECTOR is cached, being loaded, or being
+   written back.  CACHE_LOCK must be held. */
+static bool
+cache_contains (block_sector_t sector) 
+{
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+
+  for (i = 0; i < CACHE_SIZE; i++)
+    if ((cache[i].valid && cache[i].sector == sector)
+        || cache[i].evicting == sector)
+      return true;
+  return false;
+}
+
+/* Returns true if entry E belongs to a journal transaction that
+   has not committed, so that it must not be written back.
+   CACHE_LOCK must be held. */
+static bool
+cache_held (const struct cache_entry *e)
+{
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+
+  return e->txn > committed_txn;
+}
+
+/* Writes back those of the CNT sectors in SECTORS, which should
+   be in ascending order, that are cached and dirty, except those
+   of journal transactions that have not committed. */
+static void
+write_back (const block_sector_t sectors[], size_t cnt)
+{
+  size_t i, j;
+
+  for (i = 0; i < cnt; i++)
+    {
+      struct cache_entry *e = NULL;
+
+      lock_acquire (&cache_lock);
+      for (j = 0; j < CACHE_SIZE; j++)
+        if (cache[j].valid && cache[j].sector == sectors[i]
+            && !cache_held (&cache[j]))
+          {
+            e = &cache[j];
+            e->pin_cnt++;
+            break;
+          }
+      lock_release (&cache_lock);
+      if (e == NULL)
+        continue;
+
+      lock_acquire (&e->lock);
+      if (e->dirty)
+        {
+          block_write (fs_device, e->sector, e->data);
+          set_dirty (e, false);
+          writeback_cnt++;
+        }
+      cache_put (e);
+    }
+}
+
+/* Orders sector numbers for qsort(). */
+static int
+compare_sectors (const void *a_, const void *b_)
+{
+  const block_sector_t *a = a_;
+  const block_sector_t *b = b_;
+
+  return *a < *b ? -1 : *a > *b;
+}
+
+/* Read-ahead work.  Loads the sectors queued by
+   cache_readahead() one at a time, until none is left.  A reader
+   that wants a sector while it is being loaded waits on the
+   entry's lock rather than issuing a second read. */
+static void
+cache_readahead_work (void *aux UNUSED) 
+{
+  for (;;)
+    {
+      block_sector_t sector;
+      bool cached;
+
+      lock_acquire (&readahead_lock);
+      if (readahead_cnt == 0)
+        {
+          lock_release (&readahead_lock);
+          return;
+        }
+      sector = readahead_queue[readahead_head];
+      readahead_head = (readahead_head + 1) % READAHEAD_QUEUE_SIZE;
+      readahead_cnt--;
+      lock_release (&readahead_lock);
+
+      lock_acquire (&cache_lock);
+      cached = cache_contains (sector);
+      lock_release (&cache_lock);
+      if (cached)
+        readahead_hit_cnt++;
+      else
+        {
+          readahead_load_cnt++;
+          cache_put (cache_get (sector, true, false));
+        }
+    }
+}
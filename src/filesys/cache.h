@@ -0,0 +1,32 @@
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/block.h"
+
+/* Number of sectors in the buffer cache. */
+#define CACHE_SIZE 64
+
+bool cache_set_policy (const char *name);
+void cache_init (void);
+void cache_read (block_sector_t, void *);
+void cache_write (block_sector_t, const void *);
+void cache_read_at (block_sector_t, void *, size_t ofs, size_t size);
+void cache_write_at (block_sector_t, const void *, size_t ofs, size_t size);
+void cache_read_data_at (block_sector_t, void *, size_t ofs, size_t size);
+void cache_write_data_at (block_sector_t, const void *,
+                          size_t ofs, size_t size);
+void cache_write_txn (block_sector_t, const void *, size_t ofs, size_t size,
+                      unsigned txn);
+void cache_commit (unsigned txn);
+void cache_checkpoint (block_sector_t, const void *snapshot, unsigned txn);
+void cache_read_direct (block_sector_t, size_t cnt, void *);
+void cache_readahead (block_sector_t);
+void cache_flush (void);
+size_t cache_list (block_sector_t sectors[CACHE_SIZE]);
+void cache_sync (const block_sector_t sectors[], size_t cnt);
+void cache_throttle (void);
+void cache_print_stats (void);
+
+#endif /* filesys/cache.h */
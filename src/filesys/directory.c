@@ -1,16 +1,62 @@
 #include "filesys/directory.h"
 #include <stdio.h>
 #include <string.h>
+#include <hash.h>
 #include <list.h>
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "filesys/procfs.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
 
 /* A directory. */
 struct dir 
   {
     struct inode *inode;                /* Backing store. */
     off_t pos;                          /* Current position. */
+    struct dir_index *index;            /* Shared state. */
+  };
+
+/* State of a directory shared by all of the `struct dir's open
+   on the directory's inode: its lock and an in-memory index of
+   its entries.  Built when the directory is first opened and kept
+   current by dir_add() and dir_remove().  When the last opener
+   closes it, it stays in memory until CLOSED_INDEXES_MAX more
+   recently closed indexes push it out, so that opening a file in
+   a directory that no one holds open, as every open of a file in
+   the root directory does, finds the name in memory instead of
+   reading the whole directory.  Because an index holds every
+   entry, a name that it lacks is known not to exist without
+   reading the disk either.  A directory whose index could not be
+   built for lack of memory is searched linearly instead.
+
+   LOCK is held for reading by lookups, which may run in
+   parallel, and for writing by changes to the directory, so that
+   a lookup never sees a half-finished dir_add() or dir_remove()
+   and two creators cannot both add the same name.  It does not
+   cover access to the files in the directory, which have their
+   own inode locks. */
+struct dir_index
+  {
+    struct list_elem elem;              /* In open_ or closed_indexes. */
+    block_sector_t sector;              /* Directory's inode sector. */
+    int open_cnt;                       /* Number of openers. */
+    struct rwlock lock;                 /* Protects the members below. */
+    bool indexed;                       /* Is NAMES usable? */
+    struct hash names;                  /* index_entry's by name. */
+    off_t free_ofs;                     /* No free slot before here. */
+  };
+
+/* An entry in a directory index. */
+struct index_entry
+  {
+    struct hash_elem elem;              /* Element in dir_index's names. */
+    char name[NAME_MAX + 1];            /* Null terminated file name. */
+    block_sector_t inode_sector;        /* Sector number of header. */
+    off_t ofs;                          /* Offset of entry in directory. */
   };
 
 /* A single directory entry. */
@@ -21,11 +67,68 @@ struct dir_entry
     bool in_use;                        /* In use or free? */
   };
 
+/* Number of directory entries to read at once when scanning a
+   directory, so that a scan costs one inode_read_at() per sector
+   rather than one per entry. */
+#define ENTRY_BATCH (BLOCK_SECTOR_SIZE / sizeof (struct dir_entry))
+
+/* Reads up to ENTRY_BATCH directory entries from INODE, starting
+   at byte offset OFS, into ENTRIES.  Returns the number of whole
+   entries read, which is 0 only at end of file. */
+static size_t
+read_entries (struct inode *inode, off_t ofs,
+              struct dir_entry entries[ENTRY_BATCH])
+{
+  off_t size = ENTRY_BATCH * sizeof *entries;
+  return inode_read_at (inode, entries, size, ofs) / sizeof *entries;
+}
+
+/* Cache of `struct dir's. */
+static struct kmem_cache *dir_cache;
+
+/* Cache of `struct index_entry's. */
+static struct kmem_cache *index_entry_cache;
+
+/* Indexes of open directories, and of recently closed ones in
+   least- to most-recently closed order. */
+static struct list open_indexes;
+static struct clist closed_indexes;
+static struct lock open_indexes_lock;
+
+/* Number of closed directories' indexes kept in memory. */
+#define CLOSED_INDEXES_MAX 8
+
+/* Frees closed indexes when memory runs low. */
+static struct shrinker closed_shrinker;
+static shrink_func shrink_closed_indexes;
+
+static struct dir_index *index_open (struct inode *);
+static void index_close (struct dir_index *);
+static void index_forget (block_sector_t);
+static void index_free (struct dir_index *);
+
+/* Initializes the directory module. */
+void
+dir_init (void) 
+{
+  list_init (&open_indexes);
+  clist_init (&closed_indexes);
+  lock_init (&open_indexes_lock);
+  dir_cache = kmem_cache_create ("dir", sizeof (struct dir), NULL);
+  index_entry_cache = kmem_cache_create ("dir-index",
+                                         sizeof (struct index_entry), NULL);
+  if (dir_cache == NULL || index_entry_cache == NULL)
+    PANIC ("can't create directory cache");
+  palloc_register_shrinker (&closed_shrinker, "closed directories",
+                            shrink_closed_indexes);
+}
+
 /* Creates a directory with space for ENTRY_CNT entries in the
    given SECTOR.  Returns true if successful, false on failure. */
 bool
 dir_create (block_sector_t sector, size_t entry_cnt)
 {
+  index_forget (sector);
   return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
 }
 
@@ -34,19 +137,21 @@ dir_create (block_sector_t sector, size_t entry_cnt)
 struct dir *
 dir_open (struct inode *inode) 
 {
-  struct dir *dir = calloc (1, sizeof *dir);
+  struct dir *dir = kmem_cache_alloc (dir_cache);
   if (inode != NULL && dir != NULL)
     {
+      inode_set_metadata (inode);
       dir->inode = inode;
       dir->pos = 0;
-      return dir;
-    }
-  else
-    {
-      inode_close (inode);
-      free (dir);
-      return NULL; 
+      dir->index = index_open (inode);
+      if (dir->index != NULL)
+        return dir;
     }
+
+  /* Failure. */
+  inode_close (inode);
+  kmem_cache_free (dir_cache, dir);
+  return NULL; 
 }
 
 /* Opens the root directory and returns a directory for it.
@@ -71,8 +176,9 @@ dir_close (struct dir *dir)
 {
   if (dir != NULL)
     {
+      index_close (dir->index);
       inode_close (dir->inode);
-      free (dir);
+      kmem_cache_free (dir_cache, dir);
     }
 }
 
@@ -83,31 +189,265 @@ dir_get_inode (struct dir *dir)
   return dir->inode;
 }
 
+/* Returns a hash value for index_entry E. */
+static unsigned
+index_entry_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_string (hash_entry (e, struct index_entry, elem)->name);
+}
+
+/* Returns true if index_entry A's name precedes B's. */
+static bool
+index_entry_less (const struct hash_elem *a, const struct hash_elem *b,
+                  void *aux UNUSED)
+{
+  return strcmp (hash_entry (a, struct index_entry, elem)->name,
+                 hash_entry (b, struct index_entry, elem)->name) < 0;
+}
+
+/* Frees index_entry E. */
+static void
+index_entry_free (struct hash_elem *e, void *aux UNUSED)
+{
+  kmem_cache_free (index_entry_cache,
+                   hash_entry (e, struct index_entry, elem));
+}
+
+/* Adds an entry for NAME at offset OFS, referring to
+   INODE_SECTOR, to INDEX.  Returns false if out of memory. */
+static bool
+index_insert (struct dir_index *index, const char *name,
+              block_sector_t inode_sector, off_t ofs)
+{
+  struct index_entry *ie = kmem_cache_alloc (index_entry_cache);
+  if (ie == NULL)
+    return false;
+  strlcpy (ie->name, name, sizeof ie->name);
+  ie->inode_sector = inode_sector;
+  ie->ofs = ofs;
+  hash_insert (&index->names, &ie->elem);
+  return true;
+}
+
+/* Returns INDEX's entry for NAME, or a null pointer if there is
+   none. */
+static struct index_entry *
+index_find (struct dir_index *index, const char *name)
+{
+  struct index_entry key;
+  struct hash_elem *e;
+
+  if (strlen (name) > NAME_MAX)
+    return NULL;
+  strlcpy (key.name, name, sizeof key.name);
+  e = hash_find (&index->names, &key.elem);
+  return e != NULL ? hash_entry (e, struct index_entry, elem) : NULL;
+}
+
+/* Returns the shared state for directory INODE, reading the
+   directory to build its index if it has no other openers.
+   Returns a null pointer if memory is short. */
+static struct dir_index *
+index_open (struct inode *inode)
+{
+  block_sector_t sector = inode_get_inumber (inode);
+  struct dir_index *index;
+  struct dir_entry entries[ENTRY_BATCH];
+  struct list_elem *le;
+  size_t cnt, i;
+  off_t ofs;
+
+  lock_acquire (&open_indexes_lock);
+  for (le = list_begin (&open_indexes); le != list_end (&open_indexes);
+       le = list_next (le))
+    {
+      index = list_entry (le, struct dir_index, elem);
+      if (index->sector == sector)
+        {
+          index->open_cnt++;
+          lock_release (&open_indexes_lock);
+          return index;
+        }
+    }
+  for (le = list_begin (&closed_indexes.list);
+       le != list_end (&closed_indexes.list);
+       le = list_next (le))
+    {
+      index = list_entry (le, struct dir_index, elem);
+      if (index->sector == sector)
+        {
+          clist_remove (&closed_indexes, &index->elem);
+          list_push_back (&open_indexes, &index->elem);
+          index->open_cnt = 1;
+          lock_release (&open_indexes_lock);
+          return index;
+        }
+    }
+
+  index = malloc (sizeof *index);
+  if (index == NULL)
+    {
+      lock_release (&open_indexes_lock);
+      return NULL;
+    }
+  index->sector = sector;
+  index->open_cnt = 1;
+  rw_init (&index->lock);
+  index->indexed = hash_init (&index->names, index_entry_hash,
+                              index_entry_less, NULL);
+  index->free_ofs = -1;
+  if (!index->indexed)
+    goto no_index;
+
+  for (ofs = 0; (cnt = read_entries (inode, ofs, entries)) > 0; )
+    for (i = 0; i < cnt; i++, ofs += sizeof *entries)
+      {
+        struct dir_entry *e = &entries[i];
+        if (!e->in_use)
+          {
+            if (index->free_ofs == -1)
+              index->free_ofs = ofs;
+          }
+        else if (!index_insert (index, e->name, e->inode_sector, ofs))
+          {
+            hash_destroy (&index->names, index_entry_free);
+            index->indexed = false;
+            goto no_index;
+          }
+      }
+  if (index->free_ofs == -1)
+    index->free_ofs = ofs;
+
+ done:
+  list_push_back (&open_indexes, &index->elem);
+  lock_release (&open_indexes_lock);
+  return index;
+
+ no_index:
+  index->free_ofs = 0;
+  goto done;
+}
+
+/* Releases a reference to INDEX.  If it was the last, keeps
+   INDEX among the recently closed ones, freeing the least
+   recently closed if there are too many.  INDEX may be a null
+   pointer. */
+static void
+index_close (struct dir_index *index)
+{
+  if (index == NULL)
+    return;
+
+  lock_acquire (&open_indexes_lock);
+  if (--index->open_cnt == 0)
+    {
+      list_remove (&index->elem);
+      clist_push_back (&closed_indexes, &index->elem);
+      if (clist_size (&closed_indexes) > CLOSED_INDEXES_MAX)
+        index_free (list_entry (clist_pop_front (&closed_indexes),
+                                struct dir_index, elem));
+    }
+  lock_release (&open_indexes_lock);
+}
+
+/* Frees any closed index kept for the directory in SECTOR, which
+   is about to be reused for a new directory. */
+static void
+index_forget (block_sector_t sector)
+{
+  struct list_elem *le;
+
+  lock_acquire (&open_indexes_lock);
+  for (le = list_begin (&closed_indexes.list);
+       le != list_end (&closed_indexes.list);
+       le = list_next (le))
+    {
+      struct dir_index *index = list_entry (le, struct dir_index, elem);
+      if (index->sector == sector)
+        {
+          clist_remove (&closed_indexes, &index->elem);
+          index_free (index);
+          break;
+        }
+    }
+  lock_release (&open_indexes_lock);
+}
+
+/* Frees closed indexes, least recently closed first, until
+   PAGE_CNT pages of index entries have been freed or no closed
+   indexes are left.  Returns the number of pages freed, not
+   counting the indexes' hash tables, which come from malloc(). */
+static size_t
+shrink_closed_indexes (size_t page_cnt)
+{
+  size_t freed = 0;
+
+  if (lock_held_by_current_thread (&open_indexes_lock)
+      || !lock_try_acquire (&open_indexes_lock))
+    return 0;
+  while (freed < page_cnt && !clist_empty (&closed_indexes))
+    {
+      index_free (list_entry (clist_pop_front (&closed_indexes),
+                              struct dir_index, elem));
+      freed += kmem_cache_shrink (index_entry_cache);
+    }
+  lock_release (&open_indexes_lock);
+
+  return freed;
+}
+
+/* Frees INDEX, which must not be on any list. */
+static void
+index_free (struct dir_index *index)
+{
+  if (index->indexed)
+    hash_destroy (&index->names, index_entry_free);
+  free (index);
+}
+
 /* Searches DIR for a file with the given NAME.
    If successful, returns true, sets *EP to the directory entry
    if EP is non-null, and sets *OFSP to the byte offset of the
    directory entry if OFSP is non-null.
-   otherwise, returns false and ignores EP and OFSP. */
+   otherwise, returns false and ignores EP and OFSP.
+   DIR's lock must be held for reading or writing. */
 static bool
 lookup (const struct dir *dir, const char *name,
         struct dir_entry *ep, off_t *ofsp) 
 {
-  struct dir_entry e;
-  size_t ofs;
+  struct dir_entry entries[ENTRY_BATCH];
+  size_t cnt, i;
+  off_t ofs;
   
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (e.in_use && !strcmp (name, e.name)) 
-      {
-        if (ep != NULL)
-          *ep = e;
-        if (ofsp != NULL)
-          *ofsp = ofs;
-        return true;
-      }
+  if (dir->index->indexed)
+    {
+      struct index_entry *ie = index_find (dir->index, name);
+      if (ie == NULL)
+        return false;
+      if (ep != NULL)
+        {
+          ep->inode_sector = ie->inode_sector;
+          strlcpy (ep->name, ie->name, sizeof ep->name);
+          ep->in_use = true;
+        }
+      if (ofsp != NULL)
+        *ofsp = ie->ofs;
+      return true;
+    }
+
+  for (ofs = 0; (cnt = read_entries (dir->inode, ofs, entries)) > 0; )
+    for (i = 0; i < cnt; i++, ofs += sizeof *entries)
+      if (entries[i].in_use && !strcmp (name, entries[i].name)) 
+        {
+          if (ep != NULL)
+            *ep = entries[i];
+          if (ofsp != NULL)
+            *ofsp = ofs;
+          return true;
+        }
   return false;
 }
 
@@ -124,10 +464,14 @@ dir_lookup (const struct dir *dir, const char *name,
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  /* Open the inode before releasing the lock, so that a
+     concurrent dir_remove() cannot free it in between. */
+  rw_read_acquire (&dir->index->lock);
   if (lookup (dir, name, &e, NULL))
     *inode = inode_open (e.inode_sector);
   else
     *inode = NULL;
+  rw_read_release (&dir->index->lock);
 
   return *inode != NULL;
 }
@@ -141,7 +485,9 @@ dir_lookup (const struct dir *dir, const char *name,
 bool
 dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 {
+  struct dir_entry entries[ENTRY_BATCH];
   struct dir_entry e;
+  size_t cnt, i;
   off_t ofs;
   bool success = false;
 
@@ -152,29 +498,50 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   if (*name == '\0' || strlen (name) > NAME_MAX)
     return false;
 
-  /* Check that NAME is not in use. */
+  /* Check that NAME is not in use.  The journal handle comes
+     first, since starting one may wait for a commit. */
+  journal_begin ();
+  rw_write_acquire (&dir->index->lock);
   if (lookup (dir, name, NULL, NULL))
     goto done;
 
   /* Set OFS to offset of free slot.
      If there are no free slots, then it will be set to the
-     current end-of-file.
+     current end-of-file.  The index knows that there are no free
+     slots before its free_ofs, so the search can start there.
      
      inode_read_at() will only return a short read at end of file.
      Otherwise, we'd need to verify that we didn't get a short
      read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (!e.in_use)
-      break;
+  ofs = dir->index->free_ofs;
+  while ((cnt = read_entries (dir->inode, ofs, entries)) > 0)
+    {
+      for (i = 0; i < cnt && entries[i].in_use; i++)
+        ofs += sizeof e;
+      if (i < cnt)
+        break;
+    }
 
   /* Write slot. */
   e.in_use = true;
   strlcpy (e.name, name, sizeof e.name);
   e.inode_sector = inode_sector;
+  if (dir->index->indexed
+      && !index_insert (dir->index, name, inode_sector, ofs))
+    goto done;
   success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  if (success)
+    dir->index->free_ofs = ofs + sizeof e;
+  else if (dir->index->indexed)
+    {
+      struct index_entry *ie = index_find (dir->index, name);
+      hash_delete (&dir->index->names, &ie->elem);
+      index_entry_free (&ie->elem, NULL);
+    }
 
  done:
+  rw_write_release (&dir->index->lock);
+  journal_end ();
   return success;
 }
 
@@ -193,6 +560,8 @@ dir_remove (struct dir *dir, const char *name)
   ASSERT (name != NULL);
 
   /* Find directory entry. */
+  journal_begin ();
+  rw_write_acquire (&dir->index->lock);
   if (!lookup (dir, name, &e, &ofs))
     goto done;
 
@@ -206,15 +575,49 @@ dir_remove (struct dir *dir, const char *name)
   if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
     goto done;
 
+  /* Drop it from the index. */
+  if (dir->index->indexed)
+    {
+      struct index_entry *ie = index_find (dir->index, name);
+      hash_delete (&dir->index->names, &ie->elem);
+      index_entry_free (&ie->elem, NULL);
+    }
+  if (ofs < dir->index->free_ofs)
+    dir->index->free_ofs = ofs;
+
   /* Remove inode. */
   inode_remove (inode);
   success = true;
 
  done:
+  rw_write_release (&dir->index->lock);
   inode_close (inode);
+  journal_end ();
   return success;
 }
 
+/* Reads the next entry in use in DIR into *EP, advancing DIR's
+   position past it.  Returns true if successful, false if the
+   directory contains no more entries. */
+static bool
+next_entry (struct dir *dir, struct dir_entry *ep)
+{
+  struct dir_entry entries[ENTRY_BATCH];
+  size_t cnt, i;
+
+  while ((cnt = read_entries (dir->inode, dir->pos, entries)) > 0) 
+    for (i = 0; i < cnt; i++)
+      {
+        dir->pos += sizeof *entries;
+        if (entries[i].in_use)
+          {
+            *ep = entries[i];
+            return true;
+          } 
+      }
+  return false;
+}
+
 /* Reads the next directory entry in DIR and stores the name in
    NAME.  Returns true if successful, false if the directory
    contains no more entries. */
@@ -223,14 +626,55 @@ dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
   struct dir_entry e;
 
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
+  if (procfs_is_root (dir->inode))
+    return procfs_readdir (&dir->pos, name);
+  if (!next_entry (dir, &e))
+    return false;
+  strlcpy (name, e.name, NAME_MAX + 1);
+  return true;
+}
+
+/* Reads the next directory entry in DIR, as dir_readdir() does,
+   and also opens the entry's inode in *INODE, or sets it to a
+   null pointer if the inode cannot be opened.  The caller must
+   close *INODE. */
+bool
+dir_readdir_inode (struct dir *dir, char name[NAME_MAX + 1],
+                   struct inode **inode)
+{
+  struct dir_entry e;
+  bool found;
+
+  if (procfs_is_root (dir->inode))
     {
-      dir->pos += sizeof e;
-      if (e.in_use)
-        {
-          strlcpy (name, e.name, NAME_MAX + 1);
-          return true;
-        } 
+      found = procfs_readdir (&dir->pos, name);
+      *inode = found ? procfs_open (name) : NULL;
+      return found;
     }
-  return false;
+
+  /* Open the inode before releasing the lock, as in
+     dir_lookup(). */
+  rw_read_acquire (&dir->index->lock);
+  found = next_entry (dir, &e);
+  *inode = found ? inode_open (e.inode_sector) : NULL;
+  rw_read_release (&dir->index->lock);
+
+  if (found)
+    strlcpy (name, e.name, NAME_MAX + 1);
+  return found;
+}
+
+/* Returns DIR's position, as a byte offset from its start. */
+off_t
+dir_tell (const struct dir *dir)
+{
+  return dir->pos;
+}
+
+/* Sets DIR's position to POS bytes from its start, which should
+   be a position returned by dir_tell(). */
+void
+dir_seek (struct dir *dir, off_t pos)
+{
+  dir->pos = pos;
 }
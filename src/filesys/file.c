@@ -1,7 +1,9 @@
 #include "filesys/file.h"
 #include <debug.h>
 #include "filesys/inode.h"
-#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/slab.h"
+#include "threads/vaddr.h"
 
 /* An open file. */
 struct file 
@@ -11,13 +13,25 @@ struct file
     bool deny_write;            /* Has file_deny_write() been called? */
   };
 
+/* Cache of `struct file's. */
+static struct kmem_cache *file_cache;
+
+/* Initializes the file module. */
+void
+file_init (void) 
+{
+  file_cache = kmem_cache_create ("file", sizeof (struct file), NULL);
+  if (file_cache == NULL)
+    PANIC ("can't create file cache");
+}
+
 /* Opens a file for the given INODE, of which it takes ownership,
    and returns the new file.  Returns a null pointer if an
    allocation fails or if INODE is null. */
 struct file *
 file_open (struct inode *inode) 
 {
-  struct file *file = calloc (1, sizeof *file);
+  struct file *file = kmem_cache_alloc (file_cache);
   if (inode != NULL && file != NULL)
     {
       file->inode = inode;
@@ -28,7 +42,7 @@ file_open (struct inode *inode)
   else
     {
       inode_close (inode);
-      free (file);
+      kmem_cache_free (file_cache, file);
       return NULL; 
     }
 }
@@ -49,7 +63,7 @@ file_close (struct file *file)
     {
       file_allow_write (file);
       inode_close (file->inode);
-      free (file); 
+      kmem_cache_free (file_cache, file); 
     }
 }
 
@@ -113,6 +127,60 @@ file_write_at (struct file *file, const void *buffer, off_t size,
   return inode_write_at (file->inode, buffer, size, file_ofs);
 }
 
+/* Copies up to SIZE bytes from SRC, starting at its current
+   position, to DST at its current position, a page at a time
+   through a kernel buffer, so the data never passes through user
+   memory.  Returns the number of bytes copied, which may be less
+   than SIZE if end of SRC is reached, DST cannot be extended, or
+   memory is exhausted.  Advances both positions by the number of
+   bytes copied. */
+off_t
+file_copy (struct file *dst, struct file *src, off_t size)
+{
+  off_t bytes_copied = 0;
+  void *buffer;
+
+  ASSERT (size >= 0);
+
+  buffer = palloc_get_page (0);
+  if (buffer == NULL)
+    return 0;
+  while (size > 0)
+    {
+      off_t chunk = size < PGSIZE ? size : PGSIZE;
+      off_t bytes_read = file_read (src, buffer, chunk);
+      off_t bytes_written = file_write (dst, buffer, bytes_read);
+
+      bytes_copied += bytes_written;
+      if (bytes_written < chunk)
+        {
+          /* Leave SRC just past what was copied. */
+          src->pos -= bytes_read - bytes_written;
+          break;
+        }
+      size -= chunk;
+    }
+  palloc_free_page (buffer);
+  return bytes_copied;
+}
+
+/* Reserves disk space for SIZE bytes of FILE starting at offset
+   START, extending FILE if it is shorter, without writing them.
+   The reserved bytes read as zeros.  Returns true if successful,
+   false if writes to FILE are denied or the disk is full. */
+bool
+file_allocate (struct file *file, off_t start, off_t size)
+{
+  return inode_allocate (file->inode, start, size);
+}
+
+/* Makes the data and metadata written to FILE durable. */
+void
+file_sync (struct file *file)
+{
+  inode_sync (file->inode);
+}
+
 /* Prevents write operations on FILE's underlying inode
    until file_allow_write() is called or FILE is closed. */
 void
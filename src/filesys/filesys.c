@@ -2,18 +2,45 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
+#include "filesys/journal.h"
+#include "filesys/procfs.h"
+#include "threads/synch.h"
 
 /* Partition that contains the file system. */
 struct block *fs_device;
 
+/* tmpfs.  The directory named TMPFS_NAME, beside the root
+   directory, and the files in it are memory inodes, so that
+   temporary files cost no I/O.  They are lost at shutdown.  A
+   name of the form "tmp/FILE" or "/tmp/FILE" is in tmpfs; any
+   other name is in the root directory. */
+#define TMPFS_NAME "tmp"
+static struct inode *tmpfs_root;
+
+/* procfs, the read-only directory named PROCFS_NAME, also beside
+   the root directory.  See procfs.c. */
+#define PROCFS_NAME "proc"
+
+/* The file system is mounted the first time it is used, not at
+   boot, so that a run that never touches it does not wait for
+   the cache, the journal replay or the free map.  MOUNTED is set
+   only once mounting is complete, so that it can be tested
+   without MOUNT_LOCK. */
+static struct lock mount_lock;
+static bool mounted;
+static bool format_on_mount;
+
+static void mount (void);
 static void do_format (void);
 
 /* Initializes the file system module.
-   If FORMAT is true, reformats the file system. */
+   If FORMAT is true, reformats the file system when it is
+   mounted. */
 void
 filesys_init (bool format) 
 {
@@ -21,13 +48,121 @@ filesys_init (bool format)
   if (fs_device == NULL)
     PANIC ("No file system device found, can't initialize file system.");
 
+  lock_init (&mount_lock);
+  format_on_mount = format;
+}
+
+/* Mounts the file system, if that is not yet done.  Every entry
+   point into the file system calls this first. */
+void
+filesys_mount (void) 
+{
+  if (mounted)
+    return;
+  lock_acquire (&mount_lock);
+  if (!mounted)
+    {
+      mount ();
+      barrier ();
+      mounted = true;
+    }
+  lock_release (&mount_lock);
+}
+
+/* Mounts the file system, formatting it first if requested. */
+static void
+mount (void) 
+{
+  cache_init ();
   inode_init ();
+  dir_init ();
+  file_init ();
   free_map_init ();
+  journal_init (format_on_mount);
 
-  if (format) 
+  if (format_on_mount) 
     do_format ();
 
   free_map_open ();
+
+  tmpfs_root = inode_create_memory ();
+  if (tmpfs_root == NULL)
+    PANIC ("tmpfs creation failed");
+  procfs_init ();
+}
+
+/* Returns true if NAME names the directory DIR, beside the root
+   directory, itself. */
+static bool
+is_subdir_name (const char *name, const char *dir)
+{
+  size_t len = strlen (dir);
+
+  if (*name == '/')
+    name++;
+  return (!memcmp (name, dir, len)
+          && (name[len] == '\0' || !strcmp (name + len, "/")));
+}
+
+/* If NAME names a file in the directory DIR, beside the root
+   directory, returns the file's name within DIR, otherwise a
+   null pointer. */
+static const char *
+subdir_base (const char *name, const char *dir)
+{
+  const char *p = name + (*name == '/');
+  size_t len = strlen (dir);
+
+  if (strlen (p) > len && !memcmp (p, dir, len) && p[len] == '/')
+    return p + len + 1;
+  return NULL;
+}
+
+/* Returns true if NAME names the tmpfs directory itself. */
+static bool
+is_tmpfs_name (const char *name)
+{
+  return is_subdir_name (name, TMPFS_NAME);
+}
+
+/* Returns true if NAME names the procfs directory or a file in
+   it. */
+static bool
+is_procfs_name (const char *name)
+{
+  return (is_subdir_name (name, PROCFS_NAME)
+          || subdir_base (name, PROCFS_NAME) != NULL);
+}
+
+/* Opens and returns the directory that the file named NAME is
+   in, the tmpfs directory or the root directory, and points
+   *BASE to the file's name within it.  Returns a null pointer on
+   failure. */
+static struct dir *
+open_parent (const char *name, const char **base)
+{
+  *base = subdir_base (name, TMPFS_NAME);
+  if (*base != NULL)
+    return dir_open (inode_reopen (tmpfs_root));
+  *base = name;
+  return dir_open_root ();
+}
+
+/* Creates a memory inode of INITIAL_SIZE bytes, entered as NAME
+   in DIR.  Returns true if successful, false otherwise. */
+static bool
+create_memory (struct dir *dir, const char *name, off_t initial_size)
+{
+  struct inode *inode = inode_create_memory ();
+  bool success;
+
+  success = (inode != NULL
+             && inode_allocate (inode, 0, initial_size)
+             && dir_add (dir, name, inode_get_inumber (inode)));
+  if (!success && inode != NULL)
+    inode_remove (inode);
+  inode_close (inode);
+  return success;
 }
 
 /* Shuts down the file system module, writing any unwritten data
@@ -35,25 +170,47 @@ filesys_init (bool format)
 void
 filesys_done (void) 
 {
+  if (!mounted)
+    return;
+  journal_done ();
   free_map_close ();
+  cache_flush ();
+  block_flush (fs_device);
 }
 
 /* Creates a file named NAME with the given INITIAL_SIZE.
    Returns true if successful, false otherwise.
    Fails if a file named NAME already exists,
-   or if internal memory allocation fails. */
+   or if internal memory allocation fails.
+   The inode goes in its directory's block group, if possible.
+   Creating the inode and adding it to the directory form one
+   journal transaction.  A file in tmpfs gets a memory inode. */
 bool
 filesys_create (const char *name, off_t initial_size) 
 {
   block_sector_t inode_sector = 0;
-  struct dir *dir = dir_open_root ();
-  bool success = (dir != NULL
-                  && free_map_allocate (1, &inode_sector)
-                  && inode_create (inode_sector, initial_size)
-                  && dir_add (dir, name, inode_sector));
+  const char *base;
+  struct dir *dir;
+  bool success;
+
+  filesys_mount ();
+  if (is_tmpfs_name (name) || is_procfs_name (name))
+    return false;
+  journal_begin ();
+  dir = open_parent (name, &base);
+  if (dir != NULL && dir_get_inode (dir) == tmpfs_root)
+    success = create_memory (dir, base, initial_size);
+  else
+    success = (dir != NULL
+               && free_map_allocate_near (
+                    1, inode_get_inumber (dir_get_inode (dir)),
+                    &inode_sector)
+               && inode_create (inode_sector, initial_size)
+               && dir_add (dir, base, inode_sector));
   if (!success && inode_sector != 0) 
     free_map_release (inode_sector, 1);
   dir_close (dir);
+  journal_end ();
 
   return success;
 }
@@ -62,20 +219,107 @@ filesys_create (const char *name, off_t initial_size)
    Returns the new file if successful or a null pointer
    otherwise.
    Fails if no file named NAME exists,
-   or if an internal memory allocation fails. */
+   or if an internal memory allocation fails.
+   A file in procfs is rendered afresh, and cannot be written. */
 struct file *
 filesys_open (const char *name)
 {
-  struct dir *dir = dir_open_root ();
+  const char *base;
+  struct dir *dir;
   struct inode *inode = NULL;
 
+  filesys_mount ();
+  base = subdir_base (name, PROCFS_NAME);
+  if (base != NULL)
+    return file_open (procfs_open (base));
+  dir = open_parent (name, &base);
   if (dir != NULL)
-    dir_lookup (dir, name, &inode);
+    dir_lookup (dir, base, &inode);
   dir_close (dir);
 
   return file_open (inode);
 }
 
+/* Returns true if NAME names the root directory, the only
+   directory, rather than a file in it. */
+static bool
+is_root_name (const char *name)
+{
+  return !strcmp (name, "/") || !strcmp (name, ".");
+}
+
+/* Opens the directory with the given NAME, which must be "/" or
+   "." for the root directory or name the tmpfs or procfs
+   directory, since there are no others.  Returns the new
+   directory if successful or a null pointer otherwise. */
+struct dir *
+filesys_open_dir (const char *name)
+{
+  filesys_mount ();
+  if (is_root_name (name))
+    return dir_open_root ();
+  else if (is_tmpfs_name (name))
+    return dir_open (inode_reopen (tmpfs_root));
+  else if (is_subdir_name (name, PROCFS_NAME))
+    return dir_open (procfs_open_root ());
+  else
+    return NULL;
+}
+
+/* Stores what there is to know about INODE in *ST. */
+void
+filesys_stat_inode (struct inode *inode, struct filesys_stat *st)
+{
+  st->inumber = inode_get_inumber (inode);
+  st->size = inode_length (inode);
+  st->is_dir = (st->inumber == ROOT_DIR_SECTOR || inode == tmpfs_root
+               || procfs_is_root (inode));
+}
+
+/* Stores what there is to know about the file or directory with
+   the given NAME in *ST, without opening a file for it.  Returns
+   true if successful, false if no such file exists. */
+bool
+filesys_stat (const char *name, struct filesys_stat *st)
+{
+  const char *base;
+  struct dir *dir;
+  struct inode *inode;
+  bool found = false;
+
+  filesys_mount ();
+  if (is_tmpfs_name (name))
+    {
+      filesys_stat_inode (tmpfs_root, st);
+      return true;
+    }
+  if (is_procfs_name (name))
+    {
+      base = subdir_base (name, PROCFS_NAME);
+      inode = base != NULL ? procfs_open (base) : procfs_open_root ();
+      if (inode == NULL)
+        return false;
+      filesys_stat_inode (inode, st);
+      inode_close (inode);
+      return true;
+    }
+
+  dir = open_parent (name, &base);
+  if (dir != NULL && is_root_name (name))
+    {
+      filesys_stat_inode (dir_get_inode (dir), st);
+      found = true;
+    }
+  else if (dir != NULL && dir_lookup (dir, base, &inode))
+    {
+      filesys_stat_inode (inode, st);
+      inode_close (inode);
+      found = true;
+    }
+  dir_close (dir);
+  return found;
+}
+
 /* Deletes the file named NAME.
    Returns true if successful, false on failure.
    Fails if no file named NAME exists,
@@ -83,13 +327,33 @@ filesys_open (const char *name)
 bool
 filesys_remove (const char *name) 
 {
-  struct dir *dir = dir_open_root ();
-  bool success = dir != NULL && dir_remove (dir, name);
+  const char *base;
+  struct dir *dir;
+  bool success;
+
+  filesys_mount ();
+  if (is_tmpfs_name (name) || is_procfs_name (name))
+    return false;
+  journal_begin ();
+  dir = open_parent (name, &base);
+  success = dir != NULL && dir_remove (dir, base);
   dir_close (dir); 
+  journal_end ();
 
   return success;
 }
 
+/* Makes everything written to the file system so far durable:
+   commits the journal, which writes back all file data first,
+   and then writes back whatever is still dirty. */
+void
+filesys_sync (void) 
+{
+  filesys_mount ();
+  journal_commit ();
+  cache_sync (NULL, 0);
+}
+
 /* Formats the file system. */
 static void
 do_format (void)
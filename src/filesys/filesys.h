@@ -2,19 +2,38 @@
 #define FILESYS_FILESYS_H
 
 #include <stdbool.h>
+#include "devices/block.h"
 #include "filesys/off_t.h"
 
 /* Sectors of system file inodes. */
 #define FREE_MAP_SECTOR 0       /* Free map file inode sector. */
 #define ROOT_DIR_SECTOR 1       /* Root directory file inode sector. */
 
+/* First of the JOURNAL_SECTORS sectors of the journal. */
+#define JOURNAL_SECTOR 2
+
 /* Block device that contains the file system. */
 extern struct block *fs_device;
 
+struct inode;
+
+/* What filesys_stat() reports about a file. */
+struct filesys_stat
+  {
+    block_sector_t inumber;     /* Inode sector. */
+    off_t size;                 /* Length in bytes. */
+    bool is_dir;                /* Directory? */
+  };
+
 void filesys_init (bool format);
+void filesys_mount (void);
 void filesys_done (void);
 bool filesys_create (const char *name, off_t initial_size);
 struct file *filesys_open (const char *name);
 bool filesys_remove (const char *name);
+void filesys_sync (void);
+struct dir *filesys_open_dir (const char *name);
+bool filesys_stat (const char *name, struct filesys_stat *);
+void filesys_stat_inode (struct inode *, struct filesys_stat *);
 
 #endif /* filesys/filesys.h */
@@ -1,42 +1,356 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <list.h>
+#include <round.h>
+#include <stdint.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* The free map is divided into regions of the sectors whose bits
+   share one sector of the free map file.  Each region has a
+   summary of its free sectors, so that scans can skip regions
+   that cannot hold a request without looking at their bits, and
+   a dirty bit, so that only modified sectors of the free map
+   file are written back.
+
+   The summaries are also kept in the free map file, after the
+   bitmap.  Mounting reads only the summaries; a region's bits
+   are read, through the buffer cache, the first time an
+   allocation or release needs them.  So mounting does not read
+   the whole bitmap, and an allocation goes straight to a region
+   whose summary says it can hold the request.
+
+   Sectors released by removing a file are not freed at once.
+   Until the journal transaction that removed the file commits,
+   a crash would bring the file back, so its sectors must not be
+   reused yet.  free_map_defer() queues them instead, and each
+   commit frees the queued sectors of the transactions that it
+   made durable with free_map_apply(), merging adjacent runs, so
+   that removing many files updates the bitmap once per run
+   rather than once per release.  A crash before the frees reach
+   the free map file leaks the sectors, which is safe.
+
+   Regions also serve as block groups, in the manner of FFS:
+   free_map_allocate_near() looks first in the region of a
+   related sector, so that a file's inode lands near its
+   directory and its data near its inode. */
+#define REGION_BITS (BLOCK_SECTOR_SIZE * 8)
+
+/* Summary of one region's free sectors.  FREE_CNT is exact.  The
+   other members are upper bounds, which allocations leave alone
+   and failed scans tighten; releasing sectors makes a region
+   "stale" until summarize() recomputes them exactly. */
+struct region_summary
+  {
+    uint16_t free_cnt;                  /* Free sectors. */
+    uint16_t longest;                   /* Longest run of free sectors. */
+    uint16_t head;                      /* Free sectors at the start. */
+    uint16_t tail;                      /* Free sectors at the end. */
+  };
+
+/* Start of the summaries in the free map file. */
+struct summary_header
+  {
+    uint32_t magic;                     /* SUMMARY_MAGIC. */
+    uint32_t region_cnt;                /* Number of summaries that follow. */
+  };
+
+#define SUMMARY_MAGIC 0x46534d59
+
+/* Sectors waiting for a journal transaction to commit before
+   they are freed. */
+struct deferred_release
+  {
+    struct list_elem elem;              /* Element in deferred list. */
+    block_sector_t sector;              /* First sector. */
+    size_t cnt;                         /* Number of sectors. */
+    unsigned txn;                       /* Transaction that released them. */
+  };
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
+static struct lock free_map_lock;    /* Protects everything here. */
+
+static size_t region_cnt;            /* Number of regions. */
+static struct region_summary *summaries; /* Summary of each region. */
+static struct bitmap *loaded_regions; /* Regions whose bits are read. */
+static struct bitmap *stale_regions; /* Regions needing summarize(). */
+static struct bitmap *dirty_regions; /* Regions not yet written back. */
+static size_t summary_ofs;           /* Offset of summaries in file. */
+static size_t next_fit;              /* Where the next scan starts. */
+static struct list deferred;         /* Deferred releases, oldest first. */
 
-/* Initializes the free map. */
+static void summarize (size_t region);
+static void load (size_t start, size_t cnt);
+static void mark (block_sector_t, size_t cnt, bool used);
+
+/* Initializes the free map, with every sector free but those of
+   the system files. */
 void
 free_map_init (void) 
 {
   free_map = bitmap_create (block_size (fs_device));
   if (free_map == NULL)
     PANIC ("bitmap creation failed--file system device is too large");
-  bitmap_mark (free_map, FREE_MAP_SECTOR);
-  bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  lock_init (&free_map_lock);
+  lock_set_name (&free_map_lock, "free map");
+  list_init (&deferred);
+
+  region_cnt = DIV_ROUND_UP (bitmap_size (free_map), REGION_BITS);
+  summaries = calloc (region_cnt, sizeof *summaries);
+  loaded_regions = bitmap_create (region_cnt);
+  stale_regions = bitmap_create (region_cnt);
+  dirty_regions = bitmap_create (region_cnt);
+  if (summaries == NULL || loaded_regions == NULL || stale_regions == NULL
+      || dirty_regions == NULL)
+    PANIC ("free map region allocation failed");
+  summary_ofs = ROUND_UP (bitmap_file_size (free_map), BLOCK_SECTOR_SIZE);
+  bitmap_set_all (loaded_regions, true);
+  bitmap_set_all (stale_regions, true);
+
+  mark (FREE_MAP_SECTOR, 1, true);
+  mark (ROOT_DIR_SECTOR, 1, true);
+  mark (JOURNAL_SECTOR, JOURNAL_SECTORS, true);
+}
+
+/* Returns the first sector of REGION. */
+static size_t
+region_start (size_t region)
+{
+  return region * REGION_BITS;
+}
+
+/* Returns the sector after the last one in REGION. */
+static size_t
+region_end (size_t region)
+{
+  size_t end = (region + 1) * REGION_BITS;
+  return end < bitmap_size (free_map) ? end : bitmap_size (free_map);
+}
+
+/* Returns REGION's summary, recomputing it first if it is
+   stale. */
+static struct region_summary *
+get_summary (size_t region)
+{
+  if (bitmap_test (stale_regions, region))
+    summarize (region);
+  return &summaries[region];
+}
+
+/* Recomputes REGION's summary exactly from its bits, which must
+   have been loaded. */
+static void
+summarize (size_t region)
+{
+  struct region_summary *s = &summaries[region];
+  size_t start = region_start (region);
+  size_t end = region_end (region);
+  size_t run = 0;
+  size_t i;
+
+  ASSERT (bitmap_test (loaded_regions, region));
+
+  s->free_cnt = s->longest = s->head = 0;
+  for (i = start; i < end; i++)
+    if (!bitmap_test (free_map, i))
+      {
+        s->free_cnt++;
+        if (++run > s->longest)
+          s->longest = run;
+        if (run == i - start + 1)
+          s->head = run;
+      }
+    else
+      run = 0;
+  s->tail = run;
+  bitmap_reset (stale_regions, region);
+}
+
+/* Reads the bits of the regions that overlap the CNT sectors
+   starting at START from the free map file, if they have not
+   been read yet. */
+static void
+load (size_t start, size_t cnt)
+{
+  size_t region;
+
+  if (cnt == 0)
+    return;
+  for (region = start / REGION_BITS; region_start (region) < start + cnt;
+       region++)
+    if (!bitmap_test (loaded_regions, region))
+      {
+        if (!bitmap_read_partial (free_map, free_map_file,
+                                  region * BLOCK_SECTOR_SIZE,
+                                  BLOCK_SECTOR_SIZE))
+          PANIC ("can't read free map");
+        bitmap_mark (loaded_regions, region);
+      }
+}
+
+/* Marks the CNT sectors starting at SECTOR as used (if USED is
+   true) or free (if USED is false), which they must not already
+   be, and updates the region summaries and dirty bits to match.
+   Using sectors only shrinks the runs that the summaries bound,
+   but freeing them may grow the runs, so it makes the regions
+   stale. */
+static void
+mark (block_sector_t sector, size_t cnt, bool used)
+{
+  size_t end = sector + cnt;
+  size_t i;
+
+  load (sector, cnt);
+  ASSERT (!bitmap_contains (free_map, sector, cnt, used));
+  bitmap_set_multiple (free_map, sector, cnt, used);
+  for (i = sector; i < end; )
+    {
+      size_t region = i / REGION_BITS;
+      size_t n = (end < region_end (region) ? end : region_end (region)) - i;
+
+      if (used)
+        summaries[region].free_cnt -= n;
+      else
+        {
+          summaries[region].free_cnt += n;
+          bitmap_mark (stale_regions, region);
+        }
+      bitmap_mark (dirty_regions, region);
+      i += n;
+    }
+}
+
+/* Returns the first sector at or after START, and before END,
+   that begins a run of CNT free sectors, or BITMAP_ERROR if there
+   is none. */
+static size_t
+scan_bits (size_t start, size_t end, size_t cnt)
+{
+  size_t i;
+
+  load (start, end - start);
+  for (i = start; i + cnt <= end; i++)
+    if (!bitmap_contains (free_map, i, cnt, true))
+      return i;
+  return BITMAP_ERROR;
+}
+
+/* Returns true if the summaries allow a run of CNT free sectors
+   that starts in the tail of REGION and continues into the
+   regions that follow. */
+static bool
+crossing_fits (size_t region, size_t cnt)
+{
+  size_t room = get_summary (region)->tail;
+  size_t r;
+
+  for (r = region + 1; room < cnt && r < region_cnt; r++)
+    {
+      const struct region_summary *s = get_summary (r);
+      room += s->head;
+      if (s->head < region_end (r) - region_start (r))
+        break;
+    }
+  return room >= cnt;
+}
+
+/* Returns the first sector at or after START that begins a run of
+   CNT free sectors ending at or before END, or BITMAP_ERROR if
+   there is none.  Reads only the regions whose summaries allow
+   such a run. */
+static size_t
+scan (size_t start, size_t end, size_t cnt)
+{
+  size_t i = start;
+
+  while (i + cnt <= end)
+    {
+      size_t region = i / REGION_BITS;
+      size_t r_end = region_end (region);
+      struct region_summary *s = get_summary (region);
+
+      /* A run within the region. */
+      if (s->longest >= cnt && i + cnt <= r_end)
+        {
+          size_t limit = r_end < end ? r_end : end;
+          size_t sector = scan_bits (i, limit, cnt);
+
+          if (sector != BITMAP_ERROR)
+            return sector;
+          if (i == region_start (region) && limit == r_end)
+            s->longest = cnt - 1;
+        }
+
+      /* A run that crosses into the next region must begin in the
+         free sectors at the end of this one. */
+      if (s->tail > 0 && r_end < end && crossing_fits (region, cnt))
+        {
+          size_t sector = r_end;
+
+          load (region_start (region), r_end - region_start (region));
+          while (sector > i && !bitmap_test (free_map, sector - 1))
+            sector--;
+          if (sector > i || sector == region_start (region))
+            s->tail = r_end - sector;
+          if (sector < r_end && sector + cnt <= end)
+            {
+              load (sector, cnt);
+              if (!bitmap_contains (free_map, sector, cnt, true))
+                return sector;
+            }
+        }
+
+      i = r_end;
+    }
+  return BITMAP_ERROR;
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
    the first into *SECTORP.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available.
+
+   Scans start where the previous allocation ended, so that
+   sectors allocated one after another tend to be adjacent on
+   disk.  The change is recorded only in memory; it reaches the
+   free map file when free_map_flush() runs. */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  return free_map_allocate_near (cnt, BITMAP_ERROR, sectorp);
+}
+
+/* Like free_map_allocate(), but first tries to place the CNT
+   sectors at or after GOAL within GOAL's region, falling back to
+   the usual scan if they do not fit there.  GOAL may be
+   BITMAP_ERROR for no preference. */
+bool
+free_map_allocate_near (size_t cnt, block_sector_t goal,
+                        block_sector_t *sectorp)
+{
+  size_t bit_cnt = bitmap_size (free_map);
+  size_t sector = BITMAP_ERROR;
+
+  lock_acquire (&free_map_lock);
+  if (goal < bit_cnt)
+    sector = scan (goal, region_end (goal / REGION_BITS), cnt);
+  if (sector == BITMAP_ERROR)
+    sector = scan (next_fit, bit_cnt, cnt);
+  if (sector == BITMAP_ERROR && next_fit > 0)
+    sector = scan (0, bit_cnt, cnt);
+  if (sector != BITMAP_ERROR)
     {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
+      mark (sector, cnt, true);
+      next_fit = sector + cnt < bitmap_size (free_map) ? sector + cnt : 0;
+      *sectorp = sector;
     }
-  if (sector != BITMAP_ERROR)
-    *sectorp = sector;
+  lock_release (&free_map_lock);
   return sector != BITMAP_ERROR;
 }
 
@@ -44,42 +358,213 @@ free_map_allocate (size_t cnt, block_sector_t *sectorp)
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  lock_acquire (&free_map_lock);
+  load (sector, cnt);
   ASSERT (bitmap_all (free_map, sector, cnt));
-  bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  mark (sector, cnt, false);
+  lock_release (&free_map_lock);
 }
 
-/* Opens the free map file and reads it from disk. */
+/* Queues the CNT sectors starting at SECTOR to be made available
+   for use once the running journal transaction commits.  The
+   caller must hold a journal handle.  If memory is short, the
+   sectors are released right away instead. */
+void
+free_map_defer (block_sector_t sector, size_t cnt)
+{
+  unsigned txn = journal_txn ();
+  struct deferred_release *d;
+
+  lock_acquire (&free_map_lock);
+  if (!list_empty (&deferred))
+    {
+      d = list_entry (list_back (&deferred), struct deferred_release, elem);
+      if (d->txn == txn && d->sector + d->cnt == sector)
+        {
+          d->cnt += cnt;
+          lock_release (&free_map_lock);
+          return;
+        }
+    }
+  d = malloc (sizeof *d);
+  if (d != NULL)
+    {
+      d->sector = sector;
+      d->cnt = cnt;
+      d->txn = txn;
+      list_push_back (&deferred, &d->elem);
+    }
+  lock_release (&free_map_lock);
+
+  if (d == NULL)
+    free_map_release (sector, cnt);
+}
+
+/* Orders deferred releases by first sector. */
+LIST_DEFINE_ORDERED (deferred, struct deferred_release, elem, sector)
+
+/* Frees the sectors queued by free_map_defer() in journal
+   transaction TXN or earlier, which must have committed.
+   Adjacent runs are merged and freed together. */
+void
+free_map_apply (unsigned txn)
+{
+  struct list ready;
+
+  list_init (&ready);
+  lock_acquire (&free_map_lock);
+
+  /* Transactions commit in order, and a later one cannot start
+     releasing until every handle of an earlier one has ended, so
+     the queue is in transaction order. */
+  while (!list_empty (&deferred)
+         && list_entry (list_front (&deferred),
+                        struct deferred_release, elem)->txn <= txn)
+    list_push_back (&ready, list_pop_front (&deferred));
+  deferred_sort (&ready);
+
+  while (!list_empty (&ready))
+    {
+      struct deferred_release *d
+        = list_entry (list_pop_front (&ready), struct deferred_release, elem);
+
+      while (!list_empty (&ready))
+        {
+          struct deferred_release *next
+            = list_entry (list_front (&ready), struct deferred_release, elem);
+          if (next->sector != d->sector + d->cnt)
+            break;
+          d->cnt += next->cnt;
+          list_pop_front (&ready);
+          free (next);
+        }
+      mark (d->sector, d->cnt, false);
+      free (d);
+    }
+  lock_release (&free_map_lock);
+}
+
+/* Writes the sectors of the free map file whose bits have
+   changed since they were last written, with their regions'
+   summaries.  The free map file is fully allocated when it is
+   created, so writing it never calls back into
+   free_map_allocate().  Its data is metadata, so the sectors
+   written join the running journal transaction; each commit
+   calls this to fold in the changes made so far. */
+void
+free_map_flush (void) 
+{
+  size_t region;
+
+  lock_acquire (&free_map_lock);
+  if (free_map_file != NULL)
+    for (region = 0; region < region_cnt; region++)
+      if (bitmap_test (dirty_regions, region))
+        {
+          const struct region_summary *s = get_summary (region);
+          off_t ofs = (summary_ofs + sizeof (struct summary_header)
+                       + region * sizeof *s);
+
+          if (!bitmap_write_partial (free_map, free_map_file,
+                                     region * BLOCK_SECTOR_SIZE,
+                                     BLOCK_SECTOR_SIZE)
+              || file_write_at (free_map_file, s, sizeof *s, ofs)
+                 != sizeof *s)
+            PANIC ("can't write free map");
+          bitmap_reset (dirty_regions, region);
+        }
+  lock_release (&free_map_lock);
+}
+
+/* Reads the region summaries from the free map file into memory.
+   Returns true if successful, false if the file has none or they
+   are for a different number of regions. */
+static bool
+read_summaries (void)
+{
+  struct summary_header h;
+  off_t size = region_cnt * sizeof *summaries;
+
+  return (file_read_at (free_map_file, &h, sizeof h, summary_ofs) == sizeof h
+          && h.magic == SUMMARY_MAGIC && h.region_cnt == region_cnt
+          && file_read_at (free_map_file, summaries, size,
+                           summary_ofs + sizeof h) == size);
+}
+
+/* Computes every region's summary and writes them all to the
+   free map file, extending the file if necessary.  Returns true
+   if successful, false otherwise. */
+static bool
+write_summaries (void)
+{
+  struct summary_header h;
+  off_t size = region_cnt * sizeof *summaries;
+  size_t region;
+
+  for (region = 0; region < region_cnt; region++)
+    get_summary (region);
+  h.magic = SUMMARY_MAGIC;
+  h.region_cnt = region_cnt;
+  return (file_write_at (free_map_file, &h, sizeof h, summary_ofs) == sizeof h
+          && file_write_at (free_map_file, summaries, size,
+                            summary_ofs + sizeof h) == size);
+}
+
+/* Opens the free map file and reads its region summaries.  The
+   bits are read later, a region at a time, as they are needed.
+   A free map file without summaries is read whole instead, and
+   given summaries. */
 void
 free_map_open (void) 
 {
   free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC ("can't open free map");
-  if (!bitmap_read (free_map, free_map_file))
-    PANIC ("can't read free map");
+  inode_set_metadata (file_get_inode (free_map_file));
+
+  bitmap_set_all (dirty_regions, false);
+  if (read_summaries ())
+    {
+      bitmap_set_all (loaded_regions, false);
+      bitmap_set_all (stale_regions, false);
+    }
+  else
+    {
+      if (!bitmap_read (free_map, free_map_file))
+        PANIC ("can't read free map");
+      bitmap_set_all (loaded_regions, true);
+      bitmap_set_all (stale_regions, true);
+      if (!write_summaries ())
+        PANIC ("can't write free map");
+    }
 }
 
 /* Writes the free map to disk and closes the free map file. */
 void
 free_map_close (void) 
 {
+  free_map_flush ();
   file_close (free_map_file);
+  free_map_file = NULL;
 }
 
-/* Creates a new free map file on disk and writes the free map to
-   it. */
+/* Creates a new free map file on disk and writes the free map and
+   its region summaries to it. */
 void
 free_map_create (void) 
 {
   /* Create inode. */
-  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map)))
+  if (!inode_create (FREE_MAP_SECTOR,
+                     summary_ofs + sizeof (struct summary_header)
+                     + region_cnt * sizeof *summaries))
     PANIC ("free map creation failed");
 
-  /* Write bitmap to file. */
+  /* Write bitmap and summaries to file. */
   free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC ("can't open free map");
-  if (!bitmap_write (free_map, free_map_file))
+  inode_set_metadata (file_get_inode (free_map_file));
+  if (!bitmap_write (free_map, free_map_file) || !write_summaries ())
     PANIC ("can't write free map");
+  bitmap_set_all (dirty_regions, false);
 }
@@ -1,15 +1,64 @@
 #include "filesys/fsutil.h"
 #include <debug.h>
+#include <round.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ustar.h>
+#include "devices/timer.h"
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "filesys/inode.h"
 #include "threads/malloc.h"
 #include "threads/palloc.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
+#include "threads/workqueue.h"
+
+/* Size of the buffer that extract and append move data through,
+   in pages and in sectors.  Each block device request moves up
+   to XFER_SECTORS sectors, well within what one IDE command can
+   transfer. */
+#define XFER_PAGES 16
+#define XFER_SECTORS (XFER_PAGES * PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* Sequential reader of the scratch device for extract, which
+   reads ahead XFER_SECTORS at a time, across ustar headers and
+   file data alike. */
+struct scratch_reader
+  {
+    struct block *block;        /* Device read. */
+    block_sector_t sector;      /* Sector at POS. */
+    uint8_t *buffer;            /* XFER_SECTORS sectors. */
+    size_t pos;                 /* First unconsumed sector in BUFFER. */
+    size_t cnt;                 /* Sectors in BUFFER. */
+  };
+
+/* Returns the next sectors from R, at least one and at most
+   MAX_CNT, storing their number in *CNT, and consumes them.
+   Panics at the end of the device. */
+static const void *
+scratch_read (struct scratch_reader *r, size_t max_cnt, size_t *cnt)
+{
+  const uint8_t *data;
+
+  if (r->pos == r->cnt)
+    {
+      block_sector_t left = block_size (r->block) - r->sector;
+      if (left == 0)
+        PANIC ("ustar archive runs past the end of the scratch device");
+      r->pos = 0;
+      r->cnt = left < XFER_SECTORS ? left : XFER_SECTORS;
+      block_read_multiple (r->block, r->sector, r->cnt, r->buffer);
+    }
+
+  *cnt = r->cnt - r->pos < max_cnt ? r->cnt - r->pos : max_cnt;
+  data = r->buffer + r->pos * BLOCK_SECTOR_SIZE;
+  r->pos += *cnt;
+  r->sector += *cnt;
+  return data;
+}
 
 /* List files in the root directory. */
 void
@@ -19,6 +68,7 @@ fsutil_ls (char **argv UNUSED)
   char name[NAME_MAX + 1];
   
   printf ("Files in the root directory:\n");
+  filesys_mount ();
   dir = dir_open_root ();
   if (dir == NULL)
     PANIC ("root dir open failed");
@@ -74,19 +124,21 @@ fsutil_extract (char **argv UNUSED)
 {
   static block_sector_t sector = 0;
 
-  struct block *src;
-  void *header, *data;
+  struct scratch_reader src;
+  void *header;
 
   /* Allocate buffers. */
   header = malloc (BLOCK_SECTOR_SIZE);
-  data = malloc (BLOCK_SECTOR_SIZE);
-  if (header == NULL || data == NULL)
+  src.buffer = palloc_get_multiple (0, XFER_PAGES);
+  if (header == NULL || src.buffer == NULL)
     PANIC ("couldn't allocate buffers");
 
   /* Open source block device. */
-  src = block_get_role (BLOCK_SCRATCH);
-  if (src == NULL)
+  src.block = block_get_role (BLOCK_SCRATCH);
+  if (src.block == NULL)
     PANIC ("couldn't open scratch device");
+  src.sector = sector;
+  src.pos = src.cnt = 0;
 
   printf ("Extracting ustar archive from scratch device "
           "into file system...\n");
@@ -96,13 +148,16 @@ fsutil_extract (char **argv UNUSED)
       const char *file_name;
       const char *error;
       enum ustar_type type;
+      size_t cnt;
       int size;
 
-      /* Read and parse ustar header. */
-      block_read (src, sector++, header);
+      /* Read and parse ustar header.  It is copied out of the
+         read-ahead buffer, since FILE_NAME points into it. */
+      memcpy (header, scratch_read (&src, 1, &cnt), BLOCK_SECTOR_SIZE);
       error = ustar_parse_header (header, &file_name, &type, &size);
       if (error != NULL)
-        PANIC ("bad ustar header in sector %"PRDSNu" (%s)", sector - 1, error);
+        PANIC ("bad ustar header in sector %"PRDSNu" (%s)",
+               src.sector - 1, error);
 
       if (type == USTAR_EOF)
         {
@@ -117,20 +172,25 @@ fsutil_extract (char **argv UNUSED)
 
           printf ("Putting '%s' into the file system...\n", file_name);
 
-          /* Create destination file. */
+          /* Create destination file.  Creating it at its full
+             size reserves all of its sectors up front, as one
+             contiguous run if the free map has one, so the
+             writes below need not allocate. */
           if (!filesys_create (file_name, size))
             PANIC ("%s: create failed", file_name);
           dst = filesys_open (file_name);
           if (dst == NULL)
             PANIC ("%s: open failed", file_name);
 
-          /* Do copy. */
+          /* Do copy, straight out of the read-ahead buffer. */
           while (size > 0)
             {
-              int chunk_size = (size > BLOCK_SECTOR_SIZE
-                                ? BLOCK_SECTOR_SIZE
+              const void *data
+                = scratch_read (&src, DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE),
+                                &cnt);
+              int chunk_size = (size > (int) (cnt * BLOCK_SECTOR_SIZE)
+                                ? (int) (cnt * BLOCK_SECTOR_SIZE)
                                 : size);
-              block_read (src, sector++, data);
               if (file_write (dst, data, chunk_size) != chunk_size)
                 PANIC ("%s: write failed with %d bytes unwritten",
                        file_name, size);
@@ -148,10 +208,11 @@ fsutil_extract (char **argv UNUSED)
      end-of-archive marker. */
   printf ("Erasing ustar archive...\n");
   memset (header, 0, BLOCK_SECTOR_SIZE);
-  block_write (src, 0, header);
-  block_write (src, 1, header);
+  block_write (src.block, 0, header);
+  block_write (src.block, 1, header);
+  sector = src.sector;
 
-  free (data);
+  palloc_free_multiple (src.buffer, XFER_PAGES);
   free (header);
 }
 
@@ -173,11 +234,12 @@ fsutil_append (char **argv)
   struct file *src;
   struct block *dst;
   off_t size;
+  size_t header_cnt;
 
   printf ("Appending '%s' to ustar archive on scratch device...\n", file_name);
 
   /* Allocate buffer. */
-  buffer = malloc (BLOCK_SECTOR_SIZE);
+  buffer = palloc_get_multiple (0, XFER_PAGES);
   if (buffer == NULL)
     PANIC ("couldn't allocate buffer");
 
@@ -192,23 +254,32 @@ fsutil_append (char **argv)
   if (dst == NULL)
     PANIC ("couldn't open scratch device");
   
-  /* Write ustar header to first sector. */
+  /* Build ustar header in first sector of buffer. */
   if (!ustar_make_header (file_name, USTAR_REGULAR, size, buffer))
     PANIC ("%s: name too long for ustar format", file_name);
-  block_write (dst, sector++, buffer);
+  header_cnt = 1;
 
-  /* Do copy. */
-  while (size > 0) 
+  /* Do copy.  The header goes out in the same request as the
+     first chunk of data. */
+  do
     {
-      int chunk_size = size > BLOCK_SECTOR_SIZE ? BLOCK_SECTOR_SIZE : size;
-      if (sector >= block_size (dst))
+      void *data = buffer + header_cnt * BLOCK_SECTOR_SIZE;
+      off_t room = (XFER_SECTORS - header_cnt) * BLOCK_SECTOR_SIZE;
+      int chunk_size = size > room ? room : size;
+      size_t sector_cnt = (header_cnt
+                           + DIV_ROUND_UP (chunk_size, BLOCK_SECTOR_SIZE));
+      if (sector_cnt > block_size (dst) - sector)
         PANIC ("%s: out of space on scratch device", file_name);
-      if (file_read (src, buffer, chunk_size) != chunk_size)
+      if (file_read (src, data, chunk_size) != chunk_size)
         PANIC ("%s: read failed with %"PROTd" bytes unread", file_name, size);
-      memset (buffer + chunk_size, 0, BLOCK_SECTOR_SIZE - chunk_size);
-      block_write (dst, sector++, buffer);
+      memset (data + chunk_size, 0,
+              (sector_cnt - header_cnt) * BLOCK_SECTOR_SIZE - chunk_size);
+      block_write_multiple (dst, sector, sector_cnt, buffer);
+      sector += sector_cnt;
       size -= chunk_size;
+      header_cnt = 0;
     }
+  while (size > 0);
 
   /* Write ustar end-of-archive marker, which is two consecutive
      sectors full of zeros.  Don't advance our position past
@@ -219,5 +290,127 @@ fsutil_append (char **argv)
 
   /* Finish up. */
   file_close (src);
-  free (buffer);
+  palloc_free_multiple (buffer, XFER_PAGES);
+}
+
+/* What a defragmentation pass found. */
+struct defrag_stats
+  {
+    size_t file_cnt;            /* Files with data sectors. */
+    size_t before_cnt;          /* Their fragments before the pass. */
+    size_t after_cnt;           /* Their fragments after the pass. */
+    size_t moved_cnt;           /* Files moved. */
+  };
+
+/* Ticks between passes of the background defragmenter. */
+#define DEFRAG_INTERVAL (30 * TIMER_FREQ)
+
+static struct workqueue defrag_wq;
+static struct work defrag_work;
+
+/* Defragments every file in the root directory, accumulating
+   what it finds in *STATS and, if VERBOSE, printing each file
+   that it moves.  Files may be open, even in use, meanwhile. */
+static void
+defrag_pass (struct defrag_stats *stats, bool verbose)
+{
+  struct dir *dir;
+  struct inode *inode;
+  char name[NAME_MAX + 1];
+
+  memset (stats, 0, sizeof *stats);
+  filesys_mount ();
+  dir = dir_open_root ();
+  if (dir == NULL)
+    PANIC ("root dir open failed");
+  while (dir_readdir_inode (dir, name, &inode))
+    {
+      size_t before, after;
+
+      if (inode == NULL)
+        continue;
+      before = after = inode_fragments (inode);
+      if (before > 0)
+        {
+          if (inode_defrag (inode))
+            {
+              after = inode_fragments (inode);
+              stats->moved_cnt++;
+              if (verbose)
+                printf ("%s: %zu fragments -> %zu\n", name, before, after);
+            }
+          stats->file_cnt++;
+          stats->before_cnt += before;
+          stats->after_cnt += after;
+        }
+      inode_close (inode);
+    }
+  dir_close (dir);
+}
+
+/* Returns the fragmentation score for FRAGMENT_CNT fragments in
+   FILE_CNT files: the percentage of fragments beyond the first
+   of each file.  0 means every file is contiguous. */
+static unsigned
+defrag_score (size_t file_cnt, size_t fragment_cnt)
+{
+  return (fragment_cnt > 0
+          ? (fragment_cnt - file_cnt) * 100 / fragment_cnt : 0);
+}
+
+/* Moves each fragmented file in the root directory into one
+   contiguous run of sectors, and reports the fragmentation
+   score before and after. */
+void
+fsutil_defrag (char **argv UNUSED) 
+{
+  struct defrag_stats stats;
+
+  printf ("Defragmenting the file system...\n");
+  defrag_pass (&stats, true);
+  printf ("Moved %zu of %zu files: %zu fragments -> %zu, "
+          "fragmentation score %u%% -> %u%%.\n",
+          stats.moved_cnt, stats.file_cnt,
+          stats.before_cnt, stats.after_cnt,
+          defrag_score (stats.file_cnt, stats.before_cnt),
+          defrag_score (stats.file_cnt, stats.after_cnt));
+}
+
+/* Runs a quiet defragmentation pass and requeues itself for the
+   next one. */
+static void
+defrag_work_func (void *aux UNUSED) 
+{
+  struct defrag_stats stats;
+
+  defrag_pass (&stats, false);
+  work_queue_delayed (&defrag_wq, &defrag_work, DEFRAG_INTERVAL);
+}
+
+/* Starts a background defragmenter that makes a pass over the
+   root directory every DEFRAG_INTERVAL ticks.  Its worker has
+   the lowest priority, so it runs only when nothing else
+   wants the CPU. */
+void
+fsutil_defragd (char **argv UNUSED) 
+{
+  static bool started;
+
+  if (started)
+    return;
+  started = true;
+  printf ("Starting background defragmentation...\n");
+  workqueue_init (&defrag_wq, "defrag", 1, PRI_MIN);
+  work_init (&defrag_work, defrag_work_func, NULL);
+  work_queue_delayed (&defrag_wq, &defrag_work, DEFRAG_INTERVAL);
+}
+
+/* Prints I/O statistics for every block device. */
+void
+fsutil_iostat (char **argv UNUSED) 
+{
+  struct block *block;
+
+  for (block = block_first (); block != NULL; block = block_next (block))
+    block_print_device_stats (block);
 }
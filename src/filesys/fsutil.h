@@ -6,5 +6,8 @@ void fsutil_cat (char **argv);
 void fsutil_rm (char **argv);
 void fsutil_extract (char **argv);
 void fsutil_append (char **argv);
+void fsutil_iostat (char **argv);
+void fsutil_defrag (char **argv);
+void fsutil_defragd (char **argv);
 
 #endif /* filesys/fsutil.h */
@@ -1,25 +1,111 @@
 #include "filesys/inode.h"
+#include <hash.h>
 #include <list.h>
 #include <debug.h>
 #include <round.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* Number of extents stored in an inode. */
+#define INODE_EXTENTS 16
+
+/* Number of direct sector pointers stored in an inode. */
+#define DIRECT_BLOCKS 74
+
+/* Number of sector pointers in an indirect block. */
+#define PTRS_PER_BLOCK (BLOCK_SECTOR_SIZE / sizeof (block_sector_t))
+
+/* A run of sectors that is contiguous both within a file and on
+   disk.  The sectors of an unwritten extent are reserved for the
+   file but have never been written, so they read as zeros
+   without being read from disk, and they need not be zeroed when
+   they are allocated. */
+struct extent
+  {
+    uint32_t file_sector;               /* Index of first sector in file. */
+    block_sector_t start;               /* First sector on disk. */
+    uint16_t length;                    /* Number of sectors. */
+    uint16_t flags;                     /* EXTENT_UNWRITTEN or 0. */
+  };
+
+/* extent flag: sectors have never been written. */
+#define EXTENT_UNWRITTEN 0x1
+
+/* Most sectors in one extent. */
+#define EXTENT_MAX UINT16_MAX
+
+/* Most bytes of data that an inode can hold inline: all but its
+   first three words. */
+#define INLINE_MAX ((off_t) (BLOCK_SECTOR_SIZE - 3 * sizeof (uint32_t)))
+
 /* On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+
+   A file's data sectors are found in one of two ways.  The
+   sectors allocated by inode_create() are described by up to
+   INODE_EXTENTS extents, which keep them contiguous on disk for
+   sequential access and make lookup a short binary search.
+   Sectors added later, by writes past the end of the file or
+   into holes, and any that did not fit in the extents, are
+   found through a classic block map: DIRECT_BLOCKS direct
+   pointers, then one indirect and one doubly indirect block,
+   indexed by file sector.  A null pointer in the block map is a
+   hole, which reads as zeros and is allocated when first
+   written.
+
+   A file of at most INLINE_MAX bytes has no data sectors at all.
+   Its data is kept in the inode, in place of the extents and the
+   block map, so that reading the inode reads the data too.  The
+   first write that would take it past INLINE_MAX bytes moves the
+   data out to a sector of its own. */
 struct inode_disk
   {
-    block_sector_t start;               /* First data sector. */
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[125];               /* Not used. */
+    uint32_t flags;                     /* INODE_INLINE or 0. */
+    union
+      {
+        uint8_t inline_data[INLINE_MAX]; /* Inline data. */
+        struct
+          {
+            uint32_t extent_cnt;        /* Number of extents in use. */
+            struct extent extents[INODE_EXTENTS];       /* Extents. */
+            block_sector_t direct[DIRECT_BLOCKS];       /* Direct blocks. */
+            block_sector_t indirect;    /* Indirect block. */
+            block_sector_t doubly_indirect; /* Doubly indirect block. */
+          };
+      };
   };
 
+/* inode_disk flag: data is stored inline. */
+#define INODE_INLINE 0x1
+
+/* Sector 0 holds the free map, so it never appears in a block
+   map and can mark a hole. */
+#define NO_SECTOR 0
+
+/* Number of file sectors that the block map can address. */
+#define MAX_FILE_SECTORS \
+  (DIRECT_BLOCKS + PTRS_PER_BLOCK + PTRS_PER_BLOCK * PTRS_PER_BLOCK)
+
+/* Most bytes that inode_write_at() and inode_allocate() write or
+   allocate under one journal handle, when the caller holds none.
+   A piece reaches at most three indirect blocks, so, with the
+   inode, it logs fewer sectors than a handle's credits. */
+#define WRITE_PIECE ((off_t) (PTRS_PER_BLOCK * BLOCK_SECTOR_SIZE))
+
 /* Returns the number of sectors to allocate for an inode SIZE
    bytes long. */
 static inline size_t
@@ -28,45 +114,549 @@ bytes_to_sectors (off_t size)
   return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
 }
 
-/* In-memory inode. */
+/* In-memory inode.  Only the parts of the on-disk inode that
+   nearly every access needs are kept here; the extents, block
+   map and inline data are read from the inode's sector, through
+   the buffer cache, when a lookup needs them, and modified in a
+   temporary copy of the whole inode_disk by writers holding
+   ACCESS for writing. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
+    /* Protected by inode_table_lock. */
+    struct hash_elem hash_elem;         /* Element in inode_table. */
+    struct list_elem closed_elem;       /* Element in closed_inodes. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
+    bool metadata;                      /* Is its data journaled? */
+    bool memory;                        /* Memory inode? */
+
+    /* Protected by ACCESS, held for reading or writing as noted. */
+    struct rwlock access;               /* Controls access to data. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
-    struct inode_disk data;             /* Inode content. */
+    off_t length;                       /* File size in bytes. */
+    uint32_t flags;                     /* INODE_INLINE or 0. */
+    uint32_t extent_cnt;                /* Number of extents in use. */
+    unsigned version;                   /* Changes on every write. */
+    unsigned txn;                       /* Journal transaction of the last
+                                           change to the block map. */
+    uint8_t **pages;                    /* Memory inode: data pages. */
+    size_t page_cnt;                    /* Memory inode: size of PAGES. */
+
+    /* Read-ahead state.  Updated by readers holding ACCESS only
+       for reading; a lost update just misjudges the access pattern. */
+    off_t seq_ofs;                      /* Offset a sequential read continues. */
+    off_t ra_ofs;                       /* End of data queued for read-ahead. */
+    int ra_window;                      /* Sectors to read ahead, 0 if random. */
   };
 
+/* Upper bound on an inode's read-ahead window, in sectors. */
+#define READAHEAD_MAX 16
+
+/* Returns the sector one past the end of extent E within its
+   file. */
+static inline uint32_t
+extent_end (const struct extent *e)
+{
+  return e->file_sector + e->length;
+}
+
+/* Returns the device sector that holds file sector IDX, which
+   extent E must cover. */
+static inline block_sector_t
+extent_sector (const struct extent *e, uint32_t idx)
+{
+  return e->start + (idx - e->file_sector);
+}
+
+/* Searches the CNT EXTENTS, which are sorted by file sector,
+   for file sector IDX.  Returns the index of the extent that
+   covers it, or -1 if none does. */
+static int
+search_extents (const struct extent extents[], size_t cnt, uint32_t idx)
+{
+  size_t lo = 0, hi = cnt;
+
+  /* Find the last extent that starts at or before IDX. */
+  while (lo < hi)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+      if (extents[mid].file_sector <= idx)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  return lo > 0 && idx < extent_end (&extents[lo - 1]) ? (int) lo - 1 : -1;
+}
+
+/* All zeros, for initializing newly allocated sectors. */
+static const char zeros[BLOCK_SECTOR_SIZE];
+
+/* Returns the sector that *POINTER refers to.  If *POINTER is
+   null and ALLOCATE is true, allocates a zeroed sector, stores
+   it in *POINTER, and sets *CHANGED to true.  Returns -1 if
+   *POINTER is null and ALLOCATE is false, or if allocation
+   fails. */
+static block_sector_t
+resolve (block_sector_t *pointer, bool allocate, bool *changed)
+{
+  if (*pointer == NO_SECTOR)
+    {
+      if (!allocate || !free_map_allocate (1, pointer))
+        return -1;
+      cache_write (*pointer, zeros);
+      *changed = true;
+    }
+  return *pointer;
+}
+
+/* Like resolve(), for the IDX'th pointer in indirect block
+   BLOCK. */
+static block_sector_t
+resolve_indirect (block_sector_t block, size_t idx, bool allocate)
+{
+  block_sector_t pointer;
+  bool changed = false;
+
+  ASSERT (idx < PTRS_PER_BLOCK);
+  cache_read_at (block, &pointer, idx * sizeof pointer, sizeof pointer);
+  if (resolve (&pointer, allocate, &changed) == (block_sector_t) -1)
+    return -1;
+  if (changed)
+    journal_write_at (block, &pointer, idx * sizeof pointer, sizeof pointer);
+  return pointer;
+}
+
+/* Returns the device sector that holds file sector IDX of DISK.
+   If the sector is a hole and ALLOCATE is true, allocates it,
+   and any indirect blocks needed to reach it, as zeroed sectors,
+   setting *CHANGED to true if DISK itself was modified.  Returns
+   -1 if the sector is a hole and ALLOCATE is false, if IDX is
+   too large for the block map, or if allocation fails.  A sector
+   in an unwritten extent is returned like any other, so a caller
+   about to write it must first make it written with
+   write_extents(). */
+static block_sector_t
+data_sector (struct inode_disk *disk, uint32_t idx, bool allocate,
+             bool *changed)
+{
+  int i = search_extents (disk->extents, disk->extent_cnt, idx);
+  block_sector_t sector;
+
+  if (i >= 0)
+    return extent_sector (&disk->extents[i], idx);
+
+  if (idx < DIRECT_BLOCKS)
+    return resolve (&disk->direct[idx], allocate, changed);
+  idx -= DIRECT_BLOCKS;
+
+  if (idx < PTRS_PER_BLOCK)
+    {
+      sector = resolve (&disk->indirect, allocate, changed);
+      if (sector == (block_sector_t) -1)
+        return -1;
+      return resolve_indirect (sector, idx, allocate);
+    }
+  idx -= PTRS_PER_BLOCK;
+
+  if (idx < PTRS_PER_BLOCK * PTRS_PER_BLOCK)
+    {
+      sector = resolve (&disk->doubly_indirect, allocate, changed);
+      if (sector == (block_sector_t) -1)
+        return -1;
+      sector = resolve_indirect (sector, idx / PTRS_PER_BLOCK, allocate);
+      if (sector == (block_sector_t) -1)
+        return -1;
+      return resolve_indirect (sector, idx % PTRS_PER_BLOCK, allocate);
+    }
+  return -1;
+}
+
+/* Reads SIZE bytes of INODE's on-disk inode, starting at byte
+   offset OFS, into DST. */
+static void
+read_disk (const struct inode *inode, void *dst, size_t ofs, size_t size)
+{
+  cache_read_at (inode->sector, dst, ofs, size);
+}
+
+/* Reads the block map pointer at byte offset OFS within INODE's
+   on-disk inode. */
+static block_sector_t
+read_pointer (const struct inode *inode, size_t ofs)
+{
+  block_sector_t pointer;
+
+  read_disk (inode, &pointer, ofs, sizeof pointer);
+  return pointer != NO_SECTOR ? pointer : (block_sector_t) -1;
+}
+
+/* Like data_sector() without allocation, for file sector IDX of
+   INODE, reading only the parts of its on-disk inode that the
+   lookup needs.  A sector in an unwritten extent is treated as a
+   hole, since it reads as zeros. */
+static block_sector_t
+find_sector (const struct inode *inode, uint32_t idx)
+{
+  block_sector_t sector;
+
+  if (inode->extent_cnt > 0)
+    {
+      struct extent extents[INODE_EXTENTS];
+      int i;
+
+      read_disk (inode, extents, offsetof (struct inode_disk, extents),
+                 inode->extent_cnt * sizeof *extents);
+      i = search_extents (extents, inode->extent_cnt, idx);
+      if (i >= 0)
+        return (extents[i].flags & EXTENT_UNWRITTEN
+                ? (block_sector_t) -1 : extent_sector (&extents[i], idx));
+    }
+
+  if (idx < DIRECT_BLOCKS)
+    return read_pointer (inode, (offsetof (struct inode_disk, direct)
+                                 + idx * sizeof (block_sector_t)));
+  idx -= DIRECT_BLOCKS;
+
+  if (idx < PTRS_PER_BLOCK)
+    {
+      sector = read_pointer (inode, offsetof (struct inode_disk, indirect));
+      if (sector == (block_sector_t) -1)
+        return -1;
+      return resolve_indirect (sector, idx, false);
+    }
+  idx -= PTRS_PER_BLOCK;
+
+  if (idx < PTRS_PER_BLOCK * PTRS_PER_BLOCK)
+    {
+      sector = read_pointer (inode,
+                             offsetof (struct inode_disk, doubly_indirect));
+      if (sector == (block_sector_t) -1)
+        return -1;
+      sector = resolve_indirect (sector, idx / PTRS_PER_BLOCK, false);
+      if (sector == (block_sector_t) -1)
+        return -1;
+      return resolve_indirect (sector, idx % PTRS_PER_BLOCK, false);
+    }
+  return -1;
+}
+
 /* Returns the block device sector that contains byte offset POS
    within INODE.
    Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
+   POS, either because POS is past the end of the file or because
+   it falls in a hole. */
 static block_sector_t
 byte_to_sector (const struct inode *inode, off_t pos) 
 {
   ASSERT (inode != NULL);
-  if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
-  else
+  if (pos >= inode->length || (inode->flags & INODE_INLINE))
     return -1;
+  return find_sector (inode, pos / BLOCK_SECTOR_SIZE);
+}
+
+/* Allocates sectors for file sectors FIRST through END - 1 of
+   DISK, none of which may have a sector yet, and none of which
+   may precede the end of DISK's last extent.  Takes the largest
+   runs that the free map can supply and records them as
+   unwritten extents, extending the last extent when a run
+   continues it, so that they read as zeros without being zeroed.
+   If the extents run out, the remaining sectors go in the block
+   map one by one, zeroed.  Any sectors allocated are a prefix of
+   the range.  The first run is placed at or after GOAL, in its block
+   group, if it fits there, or just after the last extent if there
+   is one, and each later run just after the one before.  Returns
+   true if successful.  On failure, the sectors allocated so far
+   are left in DISK. */
+static bool
+allocate_sectors (struct inode_disk *disk, uint32_t first, uint32_t end,
+                  block_sector_t goal)
+{
+  uint32_t file_sector = first;
+  bool changed;
+
+  ASSERT (disk->extent_cnt == 0
+          || extent_end (&disk->extents[disk->extent_cnt - 1]) <= first);
+
+  while (file_sector < end && disk->extent_cnt < INODE_EXTENTS)
+    {
+      size_t run = end - file_sector;
+      struct extent *last = (disk->extent_cnt > 0
+                             ? &disk->extents[disk->extent_cnt - 1]
+                             : NULL);
+      block_sector_t start;
+
+      if (run > EXTENT_MAX)
+        run = EXTENT_MAX;
+      if (last != NULL)
+        goal = last->start + last->length;
+      while (!free_map_allocate_near (run, goal, &start))
+        if ((run /= 2) == 0)
+          return false;
+
+      if (last != NULL && last->start + last->length == start
+          && extent_end (last) == file_sector
+          && (last->flags & EXTENT_UNWRITTEN)
+          && last->length + run <= EXTENT_MAX)
+        last->length += run;
+      else
+        {
+          struct extent e = { file_sector, start, run, EXTENT_UNWRITTEN };
+          disk->extents[disk->extent_cnt++] = e;
+        }
+      file_sector += run;
+    }
+
+  for (; file_sector < end; file_sector++)
+    if (data_sector (disk, file_sector, true, &changed) == (block_sector_t) -1)
+      return false;
+  return true;
+}
+
+/* Returns the end of the prefix of file sectors FIRST through
+   END - 1 of DISK that have sectors, assuming that they do form a
+   prefix, as after a failed allocate_sectors(). */
+static uint32_t
+allocated_end (struct inode_disk *disk, uint32_t first, uint32_t end)
+{
+  bool changed;
+
+  while (first < end
+         && data_sector (disk, first, false, &changed) != (block_sector_t) -1)
+    first++;
+  return first;
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Merges extent I of DISK with extent I + 1 if they are alike
+   and contiguous within the file and on disk.  Returns true if
+   they were merged. */
+static bool
+merge_extents (struct inode_disk *disk, size_t i)
+{
+  struct extent *a = &disk->extents[i];
+  struct extent *b = a + 1;
+
+  if (i + 1 >= disk->extent_cnt
+      || a->flags != b->flags
+      || extent_end (a) != b->file_sector
+      || a->start + a->length != b->start
+      || a->length + b->length > EXTENT_MAX)
+    return false;
+  a->length += b->length;
+  memmove (b, b + 1, (disk->extent_cnt - i - 2) * sizeof *b);
+  disk->extent_cnt--;
+  return true;
+}
+
+/* Splits extent I of DISK in two at file sector IDX, which must
+   lie strictly inside it.  DISK must have room for another
+   extent. */
+static void
+split_extent (struct inode_disk *disk, size_t i, uint32_t idx)
+{
+  struct extent *e = &disk->extents[i];
+
+  ASSERT (disk->extent_cnt < INODE_EXTENTS);
+  ASSERT (e->file_sector < idx && idx < extent_end (e));
+
+  memmove (e + 1, e, (disk->extent_cnt - i) * sizeof *e);
+  disk->extent_cnt++;
+  e[1].file_sector = idx;
+  e[1].start = extent_sector (e, idx);
+  e[1].length = extent_end (e) - idx;
+  e[0].length = idx - e->file_sector;
+}
+
+/* Returns true if a write of SIZE bytes at OFFSET covers all of
+   file sector IDX. */
+static bool
+covers_sector (off_t offset, off_t size, uint32_t idx)
+{
+  off_t start = (off_t) idx * BLOCK_SECTOR_SIZE;
+  return offset <= start && start + BLOCK_SECTOR_SIZE <= offset + size;
+}
+
+/* Prepares DISK for a write of SIZE bytes at OFFSET by making
+   the parts of unwritten extents that the write touches into
+   ordinary, written extents.  Sectors that the write covers only
+   in part are zeroed first, so that the rest of them reads as
+   zeros.  If DISK has no room to split an extent, the whole
+   extent becomes written, at the cost of zeroing all of it that
+   the write does not cover.  Returns true if DISK changed. */
+static bool
+write_extents (struct inode_disk *disk, off_t offset, off_t size)
+{
+  uint32_t first = offset / BLOCK_SECTOR_SIZE;
+  uint32_t end = DIV_ROUND_UP (offset + size, BLOCK_SECTOR_SIZE);
+  bool changed = false;
+  size_t i;
+
+  for (i = 0; i < disk->extent_cnt; i++)
+    {
+      struct extent *e = &disk->extents[i];
+      uint32_t lo, hi, idx;
+      size_t splits;
+
+      if (!(e->flags & EXTENT_UNWRITTEN)
+          || extent_end (e) <= first || end <= e->file_sector)
+        continue;
+
+      /* Written part of E is [LO, HI). */
+      lo = e->file_sector > first ? e->file_sector : first;
+      hi = extent_end (e) < end ? extent_end (e) : end;
+      splits = (lo > e->file_sector) + (hi < extent_end (e));
+      if (disk->extent_cnt + splits > INODE_EXTENTS)
+        {
+          lo = e->file_sector;
+          hi = extent_end (e);
+        }
+      for (idx = lo; idx < hi; idx++)
+        if (!covers_sector (offset, size, idx))
+          cache_write (extent_sector (e, idx), zeros);
+
+      if (lo > e->file_sector)
+        split_extent (disk, i++, lo);
+      if (hi < extent_end (&disk->extents[i]))
+        split_extent (disk, i, hi);
+      disk->extents[i].flags &= ~EXTENT_UNWRITTEN;
+      merge_extents (disk, i);
+      if (i > 0 && merge_extents (disk, i - 1))
+        i--;
+      changed = true;
+    }
+  return changed;
+}
+
+/* Releases the CNT sectors starting at SECTOR to the free map,
+   right away or, if DEFERRED, once the running journal
+   transaction commits. */
+static void
+release (block_sector_t sector, size_t cnt, bool deferred)
+{
+  if (deferred)
+    free_map_defer (sector, cnt);
+  else
+    free_map_release (sector, cnt);
+}
+
+/* Releases the sectors that indirect block BLOCK points to,
+   recursing LEVELS further levels of indirection, and then BLOCK
+   itself, as release() does. */
+static void
+release_indirect (block_sector_t block, int levels, bool deferred)
+{
+  block_sector_t pointers[PTRS_PER_BLOCK];
+  size_t i;
+
+  cache_read (block, pointers);
+  for (i = 0; i < PTRS_PER_BLOCK; i++)
+    if (pointers[i] != NO_SECTOR)
+      {
+        if (levels > 0)
+          release_indirect (pointers[i], levels - 1, deferred);
+        else
+          release (pointers[i], 1, deferred);
+      }
+  release (block, 1, deferred);
+}
+
+/* Releases all of DISK's data sectors and indirect blocks to the
+   free map, as release() does.  Sectors that committed metadata
+   may still refer to must be DEFERRED; those allocated by the
+   running operation need not be. */
+static void
+release_sectors (struct inode_disk *disk, bool deferred)
+{
+  size_t i;
+
+  if (disk->flags & INODE_INLINE)
+    return;
+  for (i = 0; i < disk->extent_cnt; i++)
+    release (disk->extents[i].start, disk->extents[i].length, deferred);
+  for (i = 0; i < DIRECT_BLOCKS; i++)
+    if (disk->direct[i] != NO_SECTOR)
+      release (disk->direct[i], 1, deferred);
+  if (disk->indirect != NO_SECTOR)
+    release_indirect (disk->indirect, 0, deferred);
+  if (disk->doubly_indirect != NO_SECTOR)
+    release_indirect (disk->doubly_indirect, 1, deferred);
+  memset (disk->extents, 0, sizeof disk->extents);
+  memset (disk->direct, 0, sizeof disk->direct);
+  disk->extent_cnt = 0;
+  disk->indirect = disk->doubly_indirect = NO_SECTOR;
+}
+
+/* Table of in-memory inodes, keyed by sector, so that opening a
+   single inode twice returns the same `struct inode'.  Besides
+   open inodes, it holds up to CLOSED_INODES_MAX recently closed
+   ones, kept on closed_inodes in least- to most-recently closed
+   order, so that reopening them does not read the disk. */
+static struct hash inode_table;
+static struct clist closed_inodes;
+static struct lock inode_table_lock;
+
+/* Number of closed inodes kept in memory. */
+#define CLOSED_INODES_MAX 16
+
+/* Version for an inode read from disk: greater than that of any
+   inode freed from memory, so that an inode's versions over time
+   never repeat, even if it leaves memory in between.  Protected
+   by inode_table_lock. */
+static unsigned next_version;
+
+/* Inode number for the next memory inode.  Protected by
+   inode_table_lock. */
+static block_sector_t next_memory_inumber = INODE_MEMORY_BASE;
+
+/* Cache of `struct inode's. */
+static struct kmem_cache *inode_cache;
+
+/* Frees closed inodes when memory runs low. */
+static struct shrinker closed_shrinker;
+static shrink_func shrink_closed_inodes;
+
+/* Copy of a removed inode's on-disk inode, for releasing its
+   sectors, and the lock that protects it. */
+static struct inode_disk release_disk;
+static struct lock release_lock;
+
+/* Returns a hash value for the inode in hash element E. */
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_u32 (hash_entry (e, struct inode, hash_elem)->sector);
+}
+
+/* Returns true if inode A's sector precedes inode B's. */
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return (hash_entry (a, struct inode, hash_elem)->sector
+          < hash_entry (b, struct inode, hash_elem)->sector);
+}
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  if (!hash_init (&inode_table, inode_hash, inode_less, NULL))
+    PANIC ("can't create inode table");
+  clist_init (&closed_inodes);
+  lock_init (&inode_table_lock);
+  lock_set_name (&inode_table_lock, "inode table");
+  lock_init (&release_lock);
+  inode_cache = kmem_cache_create ("inode", sizeof (struct inode), NULL);
+  if (inode_cache == NULL)
+    PANIC ("can't create inode cache");
+  palloc_register_shrinker (&closed_shrinker, "closed inodes",
+                            shrink_closed_inodes);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
    writes the new inode to sector SECTOR on the file system
-   device.
+   device.  The data is placed right after SECTOR if there is
+   room.
    Returns true if successful.
    Returns false if memory or disk allocation fails. */
 bool
@@ -81,63 +671,257 @@ inode_create (block_sector_t sector, off_t length)
      one sector in size, and you should fix that. */
   ASSERT (sizeof *disk_inode == BLOCK_SECTOR_SIZE);
 
+  journal_begin ();
   disk_inode = calloc (1, sizeof *disk_inode);
   if (disk_inode != NULL)
     {
       size_t sectors = bytes_to_sectors (length);
       disk_inode->length = length;
       disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &disk_inode->start)) 
+      if (length <= INLINE_MAX)
         {
-          block_write (fs_device, sector, disk_inode);
-          if (sectors > 0) 
-            {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
-              
-              for (i = 0; i < sectors; i++) 
-                block_write (fs_device, disk_inode->start + i, zeros);
-            }
+          disk_inode->flags = INODE_INLINE;
+          journal_write (sector, disk_inode);
+          success = true;
+        }
+      else if (sectors <= MAX_FILE_SECTORS
+               && allocate_sectors (disk_inode, 0, sectors, sector + 1)) 
+        {
+          journal_write (sector, disk_inode);
           success = true; 
         } 
+      else
+        release_sectors (disk_inode, false);
       free (disk_inode);
     }
+  journal_end ();
+  return success;
+}
+
+/* Initializes the members of INODE, for inode number SECTOR,
+   that do not come from its on-disk inode, with INODE open
+   once. */
+static void
+init_inode (struct inode *inode, block_sector_t sector)
+{
+  inode->sector = sector;
+  inode->open_cnt = 1;
+  inode->removed = false;
+  inode->metadata = false;
+  inode->memory = false;
+  rw_init (&inode->access);
+  inode->deny_write_cnt = 0;
+  inode->version = next_version;
+  inode->txn = 0;
+  inode->pages = NULL;
+  inode->page_cnt = 0;
+  inode->seq_ofs = 0;
+  inode->ra_ofs = 0;
+  inode->ra_window = 0;
+}
+
+/* Creates an empty memory inode and returns it, open once, or a
+   null pointer if memory allocation fails.
+
+   A memory inode has no on-disk inode and no sectors.  Its data
+   is kept in pages from the kernel pool, each allocated when
+   first written, so that a hole reads as zeros, and it is lost
+   at shutdown.  Its inode number, at or above INODE_MEMORY_BASE,
+   names no sector: inode_open() finds the inode in memory, where
+   it stays even while closed, until it is removed and closed by
+   its last opener. */
+struct inode *
+inode_create_memory (void)
+{
+  struct inode *inode = kmem_cache_alloc (inode_cache);
+
+  if (inode == NULL)
+    return NULL;
+  lock_acquire (&inode_table_lock);
+  ASSERT (next_memory_inumber != 0);
+  init_inode (inode, next_memory_inumber++);
+  inode->memory = true;
+  inode->length = 0;
+  inode->flags = 0;
+  inode->extent_cnt = 0;
+  hash_insert (&inode_table, &inode->hash_elem);
+  lock_release (&inode_table_lock);
+  return inode;
+}
+
+/* Makes page PAGE of memory inode INODE, which must be held
+   for writing, exist.  Returns true if successful, false if
+   memory runs out. */
+static bool
+memory_page (struct inode *inode, size_t page)
+{
+  if (page >= inode->page_cnt)
+    {
+      size_t new_cnt = inode->page_cnt * 2 > page ? inode->page_cnt * 2
+                                                  : page + 1;
+      uint8_t **pages = realloc (inode->pages, new_cnt * sizeof *pages);
+      if (pages == NULL)
+        return false;
+      memset (pages + inode->page_cnt, 0,
+              (new_cnt - inode->page_cnt) * sizeof *pages);
+      inode->pages = pages;
+      inode->page_cnt = new_cnt;
+    }
+  if (inode->pages[page] == NULL)
+    inode->pages[page] = palloc_get_page (PAL_ZERO);
+  return inode->pages[page] != NULL;
+}
+
+/* Frees the pages of memory inode INODE. */
+static void
+free_memory_pages (struct inode *inode)
+{
+  size_t i;
+
+  for (i = 0; i < inode->page_cnt; i++)
+    palloc_free_page (inode->pages[i]);
+  free (inode->pages);
+  inode->pages = NULL;
+  inode->page_cnt = 0;
+}
+
+/* inode_read_at() for a memory inode. */
+static off_t
+memory_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
+{
+  uint8_t *buffer = buffer_;
+  off_t bytes_read = 0;
+
+  rw_read_acquire (&inode->access);
+  while (size > 0)
+    {
+      size_t page = offset / PGSIZE;
+      int page_ofs = offset % PGSIZE;
+      off_t inode_left = inode->length - offset;
+      int page_left = PGSIZE - page_ofs;
+      int min_left = inode_left < page_left ? inode_left : page_left;
+      int chunk_size = size < min_left ? size : min_left;
+      if (chunk_size <= 0)
+        break;
+
+      if (page < inode->page_cnt && inode->pages[page] != NULL)
+        memcpy (buffer + bytes_read, inode->pages[page] + page_ofs,
+                chunk_size);
+      else
+        memset (buffer + bytes_read, 0, chunk_size);
+
+      size -= chunk_size;
+      offset += chunk_size;
+      bytes_read += chunk_size;
+    }
+  rw_read_release (&inode->access);
+  return bytes_read;
+}
+
+/* inode_write_at() for a memory inode.  Every write holds
+   ACCESS for writing, since it may grow the page array. */
+static off_t
+memory_write_at (struct inode *inode, const void *buffer_, off_t size,
+                 off_t offset)
+{
+  const uint8_t *buffer = buffer_;
+  off_t bytes_written = 0;
+
+  rw_write_acquire (&inode->access);
+  while (size > 0 && inode->deny_write_cnt == 0)
+    {
+      size_t page = offset / PGSIZE;
+      int page_ofs = offset % PGSIZE;
+      int page_left = PGSIZE - page_ofs;
+      int chunk_size = size < page_left ? size : page_left;
+      if (!memory_page (inode, page))
+        break;
+
+      memcpy (inode->pages[page] + page_ofs, buffer + bytes_written,
+              chunk_size);
+
+      size -= chunk_size;
+      offset += chunk_size;
+      bytes_written += chunk_size;
+    }
+  if (offset > inode->length)
+    inode->length = offset;
+  if (bytes_written > 0)
+    inode->version++;
+  rw_write_release (&inode->access);
+  return bytes_written;
+}
+
+/* inode_allocate() for a memory inode: allocates the pages for
+   bytes OFFSET through OFFSET + SIZE - 1, so that writing them
+   cannot run out of memory. */
+static bool
+memory_allocate (struct inode *inode, off_t offset, off_t size)
+{
+  off_t end = offset + size;
+  bool success;
+  size_t page;
+
+  rw_write_acquire (&inode->access);
+  success = inode->deny_write_cnt == 0;
+  for (page = offset / PGSIZE;
+       success && page < (size_t) DIV_ROUND_UP (end, PGSIZE); page++)
+    success = memory_page (inode, page);
+  if (success && end > inode->length)
+    inode->length = end;
+  rw_write_release (&inode->access);
   return success;
 }
 
 /* Reads an inode from SECTOR
    and returns a `struct inode' that contains it.
-   Returns a null pointer if memory allocation fails. */
+   Returns a null pointer if memory allocation fails, or if
+   SECTOR is the inode number of a memory inode that no longer
+   exists. */
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
+  struct inode key;
+  struct hash_elem *e;
   struct inode *inode;
 
-  /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  lock_acquire (&inode_table_lock);
+
+  /* Check whether this inode is already in memory. */
+  key.sector = sector;
+  e = hash_find (&inode_table, &key.hash_elem);
+  if (e != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
-        {
-          inode_reopen (inode);
-          return inode; 
-        }
+      inode = hash_entry (e, struct inode, hash_elem);
+      if (inode->open_cnt++ == 0 && !inode->memory)
+        clist_remove (&closed_inodes, &inode->closed_elem);
+      lock_release (&inode_table_lock);
+      return inode; 
     }
 
   /* Allocate memory. */
-  inode = malloc (sizeof *inode);
+  inode = (sector < INODE_MEMORY_BASE ? kmem_cache_alloc (inode_cache)
+           : NULL);
   if (inode == NULL)
-    return NULL;
+    {
+      lock_release (&inode_table_lock);
+      return NULL;
+    }
 
-  /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
-  inode->sector = sector;
-  inode->open_cnt = 1;
-  inode->deny_write_cnt = 0;
-  inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  /* Initialize.  The table lock is held across the read, so that
+     no one else can find the inode before its data is valid. */
+  init_inode (inode, sector);
+  read_disk (inode, &inode->length, offsetof (struct inode_disk, length),
+             sizeof inode->length);
+  read_disk (inode, &inode->flags, offsetof (struct inode_disk, flags),
+             sizeof inode->flags);
+  inode->extent_cnt = 0;
+  if (!(inode->flags & INODE_INLINE))
+    read_disk (inode, &inode->extent_cnt,
+               offsetof (struct inode_disk, extent_cnt),
+               sizeof inode->extent_cnt);
+  hash_insert (&inode_table, &inode->hash_elem);
+  lock_release (&inode_table_lock);
   return inode;
 }
 
@@ -146,7 +930,12 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&inode_table_lock);
+      ASSERT (inode->open_cnt > 0);
+      inode->open_cnt++;
+      lock_release (&inode_table_lock);
+    }
   return inode;
 }
 
@@ -157,34 +946,115 @@ inode_get_inumber (const struct inode *inode)
   return inode->sector;
 }
 
+/* Returns INODE's version, which changes whenever INODE is
+   written.  Together with INODE's inode number, a version
+   identifies INODE's data as of some moment, so that data
+   derived from the file can be cached until the file changes. */
+unsigned
+inode_get_version (const struct inode *inode)
+{
+  return inode->version;
+}
+
 /* Closes INODE and writes it to disk.
-   If this was the last reference to INODE, frees its memory.
-   If INODE was also a removed inode, frees its blocks. */
+   If this was the last reference to INODE and INODE was removed,
+   frees its memory and its blocks.  Otherwise, a closed INODE
+   stays in memory until CLOSED_INODES_MAX more recently closed
+   inodes push it out. */
 void
 inode_close (struct inode *inode) 
 {
+  struct inode *victim = NULL;
+
   /* Ignore null pointer. */
   if (inode == NULL)
     return;
 
-  /* Release resources if this was the last opener. */
+  lock_acquire (&inode_table_lock);
   if (--inode->open_cnt == 0)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
- 
-      /* Deallocate blocks if removed. */
-      if (inode->removed) 
+      if (inode->removed)
         {
-          free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length)); 
+          hash_delete (&inode_table, &inode->hash_elem);
+          victim = inode;
         }
+      else if (!inode->memory)
+        {
+          clist_push_back (&closed_inodes, &inode->closed_elem);
+          if (clist_size (&closed_inodes) > CLOSED_INODES_MAX)
+            {
+              victim = list_entry (clist_pop_front (&closed_inodes),
+                                   struct inode, closed_elem);
+              hash_delete (&inode_table, &victim->hash_elem);
+            }
+        }
+    }
+  if (victim != NULL && victim->version >= next_version)
+    next_version = victim->version + 1;
+  lock_release (&inode_table_lock);
 
-      free (inode); 
+  /* Release resources outside the table lock. */
+  if (victim != NULL)
+    {
+      /* Deallocate blocks if removed.  The inode's own sector
+         goes last, so that no one can reuse it while we read it.
+         The removal may not have committed yet, so the sectors
+         are queued until it has. */
+      if (victim->memory)
+        free_memory_pages (victim);
+      else if (victim->removed) 
+        {
+          journal_begin ();
+          lock_acquire (&release_lock);
+          cache_read (victim->sector, &release_disk);
+          release_sectors (&release_disk, true);
+          lock_release (&release_lock);
+          free_map_defer (victim->sector, 1);
+          journal_end ();
+        }
+
+      kmem_cache_free (inode_cache, victim); 
     }
 }
 
+/* Frees closed inodes, least recently closed first, until
+   PAGE_CNT pages of the inode cache have been freed or no closed
+   inodes are left.  Returns the number of pages freed.  Only
+   their memory is freed: a closed inode that was not removed has
+   nothing left to write. */
+static size_t
+shrink_closed_inodes (size_t page_cnt)
+{
+  size_t freed = 0;
+
+  if (lock_held_by_current_thread (&inode_table_lock)
+      || !lock_try_acquire (&inode_table_lock))
+    return 0;
+  while (freed < page_cnt && !clist_empty (&closed_inodes))
+    {
+      struct inode *victim = list_entry (clist_pop_front (&closed_inodes),
+                                         struct inode, closed_elem);
+      hash_delete (&inode_table, &victim->hash_elem);
+      if (victim->version >= next_version)
+        next_version = victim->version + 1;
+      kmem_cache_free (inode_cache, victim);
+      freed += kmem_cache_shrink (inode_cache);
+    }
+  lock_release (&inode_table_lock);
+
+  return freed;
+}
+
+/* Marks INODE's data as file system metadata, such as a
+   directory's entries, so that writes to it are journaled along
+   with its block map. */
+void
+inode_set_metadata (struct inode *inode)
+{
+  ASSERT (inode != NULL);
+  inode->metadata = true;
+}
+
 /* Marks INODE to be deleted when it is closed by the last caller who
    has it open. */
 void
@@ -194,6 +1064,60 @@ inode_remove (struct inode *inode)
   inode->removed = true;
 }
 
+/* Called after a sequential read of INODE that ended at OFFSET.
+   Grows INODE's read-ahead window and queues the sectors in it
+   that have not already been queued, so that the next reads find
+   them in the cache. */
+static void
+readahead (struct inode *inode, off_t offset) 
+{
+  off_t start, end, pos;
+
+  if (inode->ra_window == 0)
+    {
+      inode->ra_window = 1;
+      inode->ra_ofs = 0;
+    }
+  else if (inode->ra_window < READAHEAD_MAX)
+    inode->ra_window *= 2;
+
+  start = ROUND_UP (offset, BLOCK_SECTOR_SIZE);
+  if (start < inode->ra_ofs)
+    start = inode->ra_ofs;
+  end = offset + inode->ra_window * BLOCK_SECTOR_SIZE;
+  if (end > inode_length (inode))
+    end = inode_length (inode);
+
+  for (pos = start; pos < end; pos += BLOCK_SECTOR_SIZE)
+    {
+      block_sector_t sector = byte_to_sector (inode, pos);
+      if (sector != (block_sector_t) -1)
+        cache_readahead (sector);
+    }
+  if (end > inode->ra_ofs)
+    inode->ra_ofs = end;
+}
+
+/* Reads of at least this many bytes that start on a sector
+   boundary bypass the buffer cache where they can. */
+#define DIRECT_READ_MIN PGSIZE
+
+/* Returns the number of sectors, up to CNT, that are stored
+   contiguously on disk starting at file sector SECTOR_IDX of
+   INODE, whose first sector is at disk sector SECTOR. */
+static size_t
+contiguous_sectors (const struct inode *inode, size_t sector_idx,
+                    block_sector_t sector, size_t cnt)
+{
+  size_t n;
+
+  for (n = 1; n < cnt; n++)
+    if (byte_to_sector (inode, (sector_idx + n) * BLOCK_SECTOR_SIZE)
+        != sector + n)
+      break;
+  return n;
+}
+
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
    Returns the number of bytes actually read, which may be less
    than SIZE if an error occurs or end of file is reached. */
@@ -202,8 +1126,29 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
+  bool sequential;
+
+  if (inode->memory)
+    return memory_read_at (inode, buffer_, size, offset);
 
+  /* Read access keeps writers from changing the block map or
+     length under us, while other readers proceed in parallel. */
+  rw_read_acquire (&inode->access);
+  if (inode->flags & INODE_INLINE)
+    {
+      off_t inode_left = inode_length (inode) - offset;
+
+      bytes_read = size < inode_left ? size : inode_left;
+      if (bytes_read > 0)
+        read_disk (inode, buffer,
+                   offsetof (struct inode_disk, inline_data) + offset,
+                   bytes_read);
+      else
+        bytes_read = 0;
+      rw_read_release (&inode->access);
+      return bytes_read;
+    }
+  sequential = offset == inode->seq_ofs;
   while (size > 0) 
     {
       /* Disk sector to read, starting byte offset within sector. */
@@ -220,23 +1165,29 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+      if (sector_idx != (block_sector_t) -1 && sector_ofs == 0
+          && size >= DIRECT_READ_MIN && inode_left >= DIRECT_READ_MIN)
         {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
+          /* A large aligned read goes from disk straight into
+             BUFFER, as many physically contiguous sectors at a
+             time as possible. */
+          off_t max_left = size < inode_left ? size : inode_left;
+          size_t cnt = contiguous_sectors (inode, offset / BLOCK_SECTOR_SIZE,
+                                           sector_idx,
+                                           max_left / BLOCK_SECTOR_SIZE);
+          cache_read_direct (sector_idx, cnt, buffer + bytes_read);
+          chunk_size = cnt * BLOCK_SECTOR_SIZE;
         }
-      else 
+      else if (sector_idx != (block_sector_t) -1 && inode->metadata)
+        cache_read_at (sector_idx, buffer + bytes_read, sector_ofs,
+                       chunk_size);
+      else if (sector_idx != (block_sector_t) -1)
+        cache_read_data_at (sector_idx, buffer + bytes_read, sector_ofs,
+                            chunk_size);
+      else
         {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
+          /* A hole reads as zeros without touching the disk. */
+          memset (buffer + bytes_read, 0, chunk_size);
         }
       
       /* Advance. */
@@ -244,77 +1195,590 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
+
+  if (sequential)
+    readahead (inode, offset);
+  else
+    inode->ra_window = 0;
+  inode->seq_ofs = offset;
+  rw_read_release (&inode->access);
 
   return bytes_read;
 }
 
-/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
-   Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
-off_t
-inode_write_at (struct inode *inode, const void *buffer_, off_t size,
-                off_t offset) 
+/* Returns true if INODE's bytes OFFSET through OFFSET + SIZE - 1
+   are all within the file and in allocated sectors. */
+static bool
+range_allocated (const struct inode *inode, off_t offset, off_t size)
+{
+  off_t pos;
+
+  if (offset + size > inode_length (inode))
+    return false;
+  for (pos = ROUND_DOWN (offset, BLOCK_SECTOR_SIZE); pos < offset + size;
+       pos += BLOCK_SECTOR_SIZE)
+    if (byte_to_sector (inode, pos) == (block_sector_t) -1)
+      return false;
+  return true;
+}
+
+/* Moves the inline data of DISK, the inode in SECTOR, out to a
+   data sector of its own, preferably near SECTOR, so that the
+   file may grow past INLINE_MAX bytes.  Returns true if
+   successful, false if the disk is full, in which case DISK is
+   unchanged. */
+static bool
+move_inline_data (struct inode_disk *disk, block_sector_t sector)
+{
+  uint8_t data[BLOCK_SECTOR_SIZE];
+  bool changed;
+
+  ASSERT (disk->flags & INODE_INLINE);
+
+  memcpy (data, disk->inline_data, disk->length);
+  memset (data + disk->length, 0, sizeof data - disk->length);
+  memset (disk->inline_data, 0, INLINE_MAX);
+  disk->flags &= ~INODE_INLINE;
+  if (disk->length == 0)
+    return true;
+
+  if (!allocate_sectors (disk, 0, 1, sector + 1))
+    {
+      release_sectors (disk, false);
+      memcpy (disk->inline_data, data, INLINE_MAX);
+      disk->flags |= INODE_INLINE;
+      return false;
+    }
+  write_extents (disk, 0, BLOCK_SECTOR_SIZE);
+  cache_write (data_sector (disk, 0, false, &changed), data);
+  return true;
+}
+
+/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET,
+   as one file system operation.  Returns the number of bytes
+   actually written. */
+static off_t
+write_piece (struct inode *inode, const uint8_t *buffer, off_t size,
+             off_t offset)
 {
-  const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
+  struct inode_disk *disk = NULL;
+  bool changed = false;
+  bool exclusive = false;
 
+  /* A write within already allocated sectors changes only file
+     data, which the buffer cache serializes per sector, so it
+     needs ACCESS only for reading.  A write that fills a hole or
+     extends the file changes the block map and length, so it
+     holds ACCESS for writing for its whole duration: two writers
+     cannot allocate the same hole, and readers see the new
+     length only after the data is in place.  A writer that may
+     change metadata holds a journal handle, started before ACCESS
+     is acquired, since starting one may wait for a commit. */
+  if (inode->metadata)
+    journal_begin ();
+  rw_read_acquire (&inode->access);
+  if (!inode->deny_write_cnt && !range_allocated (inode, offset, size))
+    {
+      rw_read_release (&inode->access);
+      if (!inode->metadata)
+        journal_begin ();
+      rw_write_acquire (&inode->access);
+      exclusive = true;
+    }
   if (inode->deny_write_cnt)
-    return 0;
+    goto done;
+
+  /* A writer that may change the on-disk inode works on a copy
+     of it, written back below if anything changed. */
+  if (exclusive)
+    {
+      disk = malloc (sizeof *disk);
+      if (disk == NULL)
+        goto done;
+      cache_read (inode->sector, disk);
+    }
+
+  /* Inline data changes only the inode, which range_allocated()
+     never finds allocated, so ACCESS is held for writing unless
+     there is nothing to write. */
+  if (exclusive && (inode->flags & INODE_INLINE))
+    {
+      if (offset + size <= INLINE_MAX)
+        {
+          memcpy (disk->inline_data + offset, buffer, size);
+          bytes_written = size;
+          offset += size;
+          size = 0;
+          changed = true;
+        }
+      else if (move_inline_data (disk, inode->sector))
+        changed = true;
+      else
+        goto done;
+    }
+
+  /* No sector past the end of the file has been allocated, since
+     only writes allocate and they extend the file.  Allocate all
+     of those that this write needs at once, as a run that
+     continues the last extent if the free map allows, instead of
+     one at a time in the block map, so that a file grown by
+     sequential writes stays contiguous. */
+  if (exclusive && size > 0)
+    {
+      uint32_t first = offset / BLOCK_SECTOR_SIZE;
+      uint32_t end = DIV_ROUND_UP (offset + size, BLOCK_SECTOR_SIZE);
+
+      if (first < bytes_to_sectors (disk->length))
+        first = bytes_to_sectors (disk->length);
+      if (end > MAX_FILE_SECTORS)
+        end = MAX_FILE_SECTORS;
+      if (first < end)
+        {
+          allocate_sectors (disk, first, end, inode->sector + 1);
+          changed = true;
+        }
+      if (write_extents (disk, offset, size))
+        changed = true;
+    }
 
   while (size > 0) 
     {
       /* Sector to write, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      block_sector_t sector_idx
+        = (exclusive
+           ? data_sector (disk, offset / BLOCK_SECTOR_SIZE, true, &changed)
+           : find_sector (inode, offset / BLOCK_SECTOR_SIZE));
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
+      /* Number of bytes to actually write into this sector. */
       int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-      int min_left = inode_left < sector_left ? inode_left : sector_left;
+      int chunk_size = size < sector_left ? size : sector_left;
+      if (sector_idx == (block_sector_t) -1)
+        break;
 
-      /* Number of bytes to actually write into this sector. */
-      int chunk_size = size < min_left ? size : min_left;
-      if (chunk_size <= 0)
+      /* The cache reads the sector first unless the chunk
+         covers all of it. */
+      if (inode->metadata)
+        journal_write_at (sector_idx, buffer + bytes_written,
+                          sector_ofs, chunk_size);
+      else
+        cache_write_data_at (sector_idx, buffer + bytes_written,
+                             sector_ofs, chunk_size);
+
+      /* Advance. */
+      size -= chunk_size;
+      offset += chunk_size;
+      bytes_written += chunk_size;
+    }
+
+  /* Extend the file only after its new data is in place. */
+  if (exclusive && offset > disk->length)
+    {
+      disk->length = offset;
+      changed = true;
+    }
+  if (changed)
+    {
+      journal_write (inode->sector, disk);
+      inode->length = disk->length;
+      inode->flags = disk->flags;
+      inode->extent_cnt = (disk->flags & INODE_INLINE ? 0
+                           : disk->extent_cnt);
+      inode->txn = journal_txn ();
+    }
+
+  /* Two writers holding ACCESS for reading may each bump the
+     version from the same old value, but it changes either way. */
+  if (bytes_written > 0)
+    inode->version++;
+
+ done:
+  free (disk);
+  if (exclusive)
+    rw_write_release (&inode->access);
+  else
+    rw_read_release (&inode->access);
+  if (exclusive || inode->metadata)
+    journal_end ();
+
+  /* File data, unlike metadata, may be written faster than the
+     disk can take it. */
+  if (bytes_written > 0 && !inode->metadata)
+    cache_throttle ();
+  return bytes_written;
+}
+
+/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
+   Returns the number of bytes actually written, which may be
+   less than SIZE if the disk fills up or the file reaches its
+   maximum size.  Writing past end of file extends it.  Sectors
+   are allocated only as they are written, so skipping ahead
+   leaves a hole rather than allocating and zeroing the gap.
+
+   A long write to a file's data could log more block map
+   sectors than one journal handle may, so unless the caller
+   holds a handle, it is made in pieces of WRITE_PIECE bytes,
+   each a file system operation of its own.  A crash may then
+   leave a prefix of the write in place. */
+off_t
+inode_write_at (struct inode *inode, const void *buffer_, off_t size,
+                off_t offset) 
+{
+  const uint8_t *buffer = buffer_;
+  off_t bytes_written = 0;
+
+  if (inode->memory)
+    return memory_write_at (inode, buffer_, size, offset);
+  if (inode->metadata || thread_current ()->journal_depth > 0)
+    return write_piece (inode, buffer, size, offset);
+
+  while (bytes_written < size)
+    {
+      off_t piece = (size - bytes_written < WRITE_PIECE
+                     ? size - bytes_written : WRITE_PIECE);
+      off_t cnt = write_piece (inode, buffer + bytes_written, piece,
+                               offset + bytes_written);
+
+      bytes_written += cnt;
+      if (cnt < piece)
         break;
+    }
+  return bytes_written;
+}
+
+/* Extends INODE to END bytes, if it is shorter, as one file
+   system operation, as inode_allocate() does. */
+static bool
+allocate_to (struct inode *inode, off_t end)
+{
+  struct inode_disk *disk;
+  bool success = false;
+
+  journal_begin ();
+  rw_write_acquire (&inode->access);
+  if (end <= inode->length || inode->deny_write_cnt)
+    {
+      success = inode->deny_write_cnt == 0;
+      rw_write_release (&inode->access);
+      journal_end ();
+      return success;
+    }
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+  disk = malloc (sizeof *disk);
+  if (disk != NULL)
+    {
+      cache_read (inode->sector, disk);
+      if ((disk->flags & INODE_INLINE) && end <= INLINE_MAX)
         {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
+          disk->length = end;
+          success = true;
         }
-      else 
+      else if (!(disk->flags & INODE_INLINE)
+               || move_inline_data (disk, inode->sector))
         {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
+          uint32_t first = bytes_to_sectors (disk->length);
+          uint32_t last = bytes_to_sectors (end);
+
+          if (last <= (uint32_t) MAX_FILE_SECTORS
+              && allocate_sectors (disk, first, last, inode->sector + 1))
             {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
+              disk->length = end;
+              success = true;
             }
-
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            block_read (fs_device, sector_idx, bounce);
           else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
+            {
+              off_t reserved = ((off_t) allocated_end (disk, first, last)
+                                * BLOCK_SECTOR_SIZE);
+              if (reserved > disk->length)
+                disk->length = reserved < end ? reserved : end;
+            }
         }
 
-      /* Advance. */
-      size -= chunk_size;
-      offset += chunk_size;
-      bytes_written += chunk_size;
+      journal_write (inode->sector, disk);
+      inode->length = disk->length;
+      inode->flags = disk->flags;
+      inode->extent_cnt = (disk->flags & INODE_INLINE ? 0
+                           : disk->extent_cnt);
+      inode->txn = journal_txn ();
+      inode->version++;
+      free (disk);
     }
-  free (bounce);
+  rw_write_release (&inode->access);
+  journal_end ();
+  return success;
+}
 
-  return bytes_written;
+/* Reserves disk space for INODE's bytes OFFSET through OFFSET +
+   SIZE - 1, extending the file to OFFSET + SIZE bytes if it is
+   shorter.  The sectors past the old end of file are reserved as
+   unwritten extents, which read as zeros without ever being
+   written.  Holes before the old end of file are left alone:
+   they read as zeros already.  Returns true if successful, false
+   if writes to INODE are denied or the disk fills up, in which
+   case the file is extended over whatever sectors were reserved.
+   Like a long write, a long extension is made in pieces unless
+   the caller holds a journal handle. */
+bool
+inode_allocate (struct inode *inode, off_t offset, off_t size)
+{
+  off_t end = offset + size;
+
+  ASSERT (offset >= 0 && size >= 0);
+
+  if (inode->memory)
+    return memory_allocate (inode, offset, size);
+  if (thread_current ()->journal_depth == 0)
+    while (end - inode->length > WRITE_PIECE)
+      if (!allocate_to (inode, inode->length + WRITE_PIECE))
+        return false;
+  return allocate_to (inode, end);
+}
+
+/* Returns the number of runs of physically contiguous sectors
+   that INODE's data occupies, not counting holes.  The caller
+   must hold INODE's ACCESS. */
+static size_t
+count_fragments (const struct inode *inode)
+{
+  uint32_t sector_cnt = bytes_to_sectors (inode->length);
+  block_sector_t prev = -1;
+  size_t cnt = 0;
+  uint32_t idx;
+
+  if (inode->flags & INODE_INLINE)
+    return 0;
+  for (idx = 0; idx < sector_cnt; idx++)
+    {
+      block_sector_t sector = find_sector (inode, idx);
+      if (sector != (block_sector_t) -1
+          && (prev == (block_sector_t) -1 || sector != prev + 1))
+        cnt++;
+      prev = sector;
+    }
+  return cnt;
+}
+
+/* Returns the number of runs of physically contiguous sectors
+   that INODE's data occupies.  An inline or empty file has
+   none, a contiguous one has one. */
+size_t
+inode_fragments (struct inode *inode)
+{
+  size_t cnt;
+
+  if (inode->memory)
+    return 0;
+  rw_read_acquire (&inode->access);
+  cnt = count_fragments (inode);
+  rw_read_release (&inode->access);
+  return cnt;
+}
+
+/* Number of sectors inode_defrag() copies at a time. */
+#define DEFRAG_XFER (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* Moves INODE's data into a single run of newly allocated
+   sectors, if it occupies more than one and the free map has a
+   run large enough.  Returns true if the data was moved.
+
+   The data is copied through the buffer cache, so that dirty
+   sectors are seen, reading a physically contiguous stretch at
+   a time.  Holes are filled with zeros.  Then one journaled
+   write of the inode replaces its block map by a single extent,
+   so that after a crash the file has either its old sectors or
+   its new ones, and the old sectors are freed only once that
+   write commits.  ACCESS is held for writing throughout, so
+   readers and writers of an open INODE just wait.  Files that
+   deny writes, such as running executables, and metadata, whose
+   data is journaled, are left alone.  The data does not change,
+   so neither does the inode's version. */
+bool
+inode_defrag (struct inode *inode)
+{
+  struct inode_disk *disk = NULL;
+  uint8_t *buffer = NULL;
+  uint32_t sector_cnt, idx;
+  block_sector_t start;
+  bool success = false;
+
+  journal_begin ();
+  rw_write_acquire (&inode->access);
+  sector_cnt = bytes_to_sectors (inode->length);
+  if (inode->deny_write_cnt > 0 || inode->metadata || inode->memory
+      || (inode->flags & INODE_INLINE) || sector_cnt > EXTENT_MAX
+      || count_fragments (inode) <= 1)
+    goto done;
+
+  disk = malloc (sizeof *disk);
+  buffer = malloc (DEFRAG_XFER * BLOCK_SECTOR_SIZE);
+  if (disk == NULL || buffer == NULL
+      || !free_map_allocate_near (sector_cnt, inode->sector + 1, &start))
+    goto done;
+
+  for (idx = 0; idx < sector_cnt; )
+    {
+      block_sector_t sector = find_sector (inode, idx);
+      size_t cnt, i;
+
+      if (sector != (block_sector_t) -1)
+        {
+          cnt = contiguous_sectors (inode, idx, sector,
+                                    (sector_cnt - idx < DEFRAG_XFER
+                                     ? sector_cnt - idx : DEFRAG_XFER));
+          cache_read_direct (sector, cnt, buffer);
+        }
+      else
+        {
+          cnt = 1;
+          memset (buffer, 0, BLOCK_SECTOR_SIZE);
+        }
+      for (i = 0; i < cnt; i++)
+        cache_write_data_at (start + idx + i, buffer + i * BLOCK_SECTOR_SIZE,
+                             0, BLOCK_SECTOR_SIZE);
+      idx += cnt;
+    }
+
+  cache_read (inode->sector, disk);
+  release_sectors (disk, true);
+  disk->extents[0].file_sector = 0;
+  disk->extents[0].start = start;
+  disk->extents[0].length = sector_cnt;
+  disk->extents[0].flags = 0;
+  disk->extent_cnt = 1;
+  journal_write (inode->sector, disk);
+  inode->extent_cnt = 1;
+  inode->txn = journal_txn ();
+  success = true;
+
+ done:
+  free (buffer);
+  free (disk);
+  rw_write_release (&inode->access);
+  journal_end ();
+  return success;
+}
+
+/* If SECTOR is among the CNT sectors in SECTORS, which must be
+   in ascending order, sets the corresponding element of KEEP. */
+static void
+keep_sector (block_sector_t sector, const block_sector_t sectors[],
+             size_t cnt, bool keep[])
+{
+  size_t lo = 0, hi = cnt;
+
+  while (lo < hi)
+    {
+      size_t mid = (lo + hi) / 2;
+      if (sectors[mid] < sector)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  if (lo < cnt && sectors[lo] == sector)
+    keep[lo] = true;
+}
+
+/* Like keep_sector() for indirect block BLOCK, the sectors that
+   it points to, and, recursing LEVELS further levels of
+   indirection, the sectors that those point to.  POINTERS must
+   have room for LEVELS + 1 blocks of pointers. */
+static void
+keep_indirect (block_sector_t block, int levels, block_sector_t *pointers,
+               const block_sector_t sectors[], size_t cnt, bool keep[])
+{
+  block_sector_t *p = pointers + levels * PTRS_PER_BLOCK;
+  size_t i;
+
+  keep_sector (block, sectors, cnt, keep);
+  cache_read (block, p);
+  for (i = 0; i < PTRS_PER_BLOCK; i++)
+    if (p[i] != NO_SECTOR)
+      {
+        if (levels > 0)
+          keep_indirect (p[i], levels - 1, pointers, sectors, cnt, keep);
+        else
+          keep_sector (p[i], sectors, cnt, keep);
+      }
+}
+
+/* Keeps those of the CNT sectors in SECTORS, which must be in
+   ascending order, that hold INODE's data or block map, moving
+   them to the front, and returns how many there are.  ACCESS
+   must be held. */
+static size_t
+own_sectors (const struct inode *inode, block_sector_t sectors[], size_t cnt)
+{
+  bool keep[CACHE_SIZE];
+  struct inode_disk *disk;
+  block_sector_t *pointers;
+  size_t kept = 0;
+  size_t i, j;
+
+  ASSERT (cnt <= CACHE_SIZE);
+
+  memset (keep, 0, sizeof keep);
+  keep_sector (inode->sector, sectors, cnt, keep);
+
+  disk = malloc (sizeof *disk);
+  pointers = malloc (2 * BLOCK_SECTOR_SIZE);
+  if (disk == NULL || pointers == NULL)
+    {
+      /* Keep them all: syncing too much is harmless. */
+      free (disk);
+      free (pointers);
+      return cnt;
+    }
+
+  cache_read (inode->sector, disk);
+  if (!(disk->flags & INODE_INLINE))
+    {
+      for (i = 0; i < disk->extent_cnt; i++)
+        for (j = 0; j < cnt; j++)
+          if (sectors[j] >= disk->extents[i].start
+              && sectors[j] - disk->extents[i].start
+                 < disk->extents[i].length)
+            keep[j] = true;
+      for (i = 0; i < DIRECT_BLOCKS; i++)
+        if (disk->direct[i] != NO_SECTOR)
+          keep_sector (disk->direct[i], sectors, cnt, keep);
+      if (disk->indirect != NO_SECTOR)
+        keep_indirect (disk->indirect, 0, pointers, sectors, cnt, keep);
+      if (disk->doubly_indirect != NO_SECTOR)
+        keep_indirect (disk->doubly_indirect, 1, pointers,
+                       sectors, cnt, keep);
+    }
+  free (disk);
+  free (pointers);
+
+  for (i = 0; i < cnt; i++)
+    if (keep[i])
+      sectors[kept++] = sectors[i];
+  return kept;
+}
+
+/* Makes INODE's data and metadata durable.  If its block map
+   changed in a journal transaction that has not committed, the
+   commit does all the work, since it writes back all file data
+   first.  Otherwise only INODE's own dirty sectors are written
+   back.  Either way, concurrent syncs share the disk writes and
+   the flush of the disk's write cache. */
+void
+inode_sync (struct inode *inode)
+{
+  block_sector_t sectors[CACHE_SIZE];
+  size_t cnt;
+  unsigned txn;
+
+  if (inode->memory)
+    return;
+  rw_read_acquire (&inode->access);
+  txn = inode->metadata ? (unsigned) -1 : inode->txn;
+  cnt = own_sectors (inode, sectors, cache_list (sectors));
+  rw_read_release (&inode->access);
+
+  if (!journal_sync (txn))
+    cache_sync (sectors, cnt);
 }
 
 /* Disables writes to INODE.
@@ -322,8 +1786,10 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 void
 inode_deny_write (struct inode *inode) 
 {
+  rw_write_acquire (&inode->access);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  rw_write_release (&inode->access);
 }
 
 /* Re-enables writes to INODE.
@@ -332,14 +1798,16 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode) 
 {
+  rw_write_acquire (&inode->access);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  rw_write_release (&inode->access);
 }
 
 /* Returns the length, in bytes, of INODE's data. */
 off_t
 inode_length (const struct inode *inode)
 {
-  return inode->data.length;
+  return inode->length;
 }
@@ -2,20 +2,32 @@
 #define FILESYS_INODE_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include "filesys/off_t.h"
 #include "devices/block.h"
 
 struct bitmap;
 
+/* Inode numbers at or above this one belong to memory inodes,
+   which have no sectors.  No file system device is this large. */
+#define INODE_MEMORY_BASE 0x40000000
+
 void inode_init (void);
 bool inode_create (block_sector_t, off_t);
+struct inode *inode_create_memory (void);
 struct inode *inode_open (block_sector_t);
 struct inode *inode_reopen (struct inode *);
 block_sector_t inode_get_inumber (const struct inode *);
+unsigned inode_get_version (const struct inode *);
 void inode_close (struct inode *);
+void inode_set_metadata (struct inode *);
 void inode_remove (struct inode *);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
+bool inode_allocate (struct inode *, off_t offset, off_t size);
+size_t inode_fragments (struct inode *);
+bool inode_defrag (struct inode *);
+void inode_sync (struct inode *);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 off_t inode_length (const struct inode *);
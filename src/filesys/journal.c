@@ -0,0 +1,514 @@
+#include "filesys/journal.h"
+#include <debug.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/cache.h"
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/workqueue.h"
+
+/* Metadata journal.
+
+   Changes to file system metadata (inodes, indirect blocks,
+   directory contents and the free map) are grouped into
+   transactions, which reach their places on disk only after
+   they have been written, whole, to a journal in a fixed region
+   of the disk.  After a crash, journal_init() replays the last
+   transaction if it was committed, so that every transaction
+   either happened completely or not at all.  File data is not
+   journaled, but it is written before the metadata that refers
+   to it is committed ("ordered" mode), so committed metadata
+   never points to stale data.
+
+   Code that changes metadata brackets the change in
+   journal_begin() and journal_end(), which may nest, and writes
+   each metadata sector with journal_write() or
+   journal_write_at() in between.  These join the running
+   transaction, which holds the sectors logged since the last
+   commit.  The buffer cache holds those sectors until their
+   transaction commits.
+
+   A commit closes the running transaction by waiting for its
+   handles to end, keeping new ones waiting meanwhile, folds in
+   the free map, and copies its sectors.  Then it opens the next
+   transaction and, while new handles proceed, writes the copies
+   to the journal followed by a commit record, writes them to
+   their homes, and finally marks the journal empty.  Commits run
+   periodically from the buffer cache's write-behind work, and
+   from JOURNAL_WQ when a transaction fills up, so that the
+   changes of many operations share one sequential journal write
+   ("group commit").
+
+   journal_begin() reserves HANDLE_CREDITS sectors of the running
+   transaction for each handle, its credits, and each sector that
+   the handle adds to the transaction uses one up.  A handle that
+   has used up its credits takes another from room that no handle
+   has reserved, if there is any.  Otherwise it commits and
+   continues: it leaves the running transaction, which can then
+   commit without it, and joins the next one with fresh credits,
+   so that its operation is split over two transactions but every
+   sector that it logs is still journaled.  Moving on waits for
+   the other handles to end, so an operation that may run out of
+   credits must not hold, while it logs, a lock that a thread
+   with a handle might wait for.  Operations that could log
+   without bound under such locks, such as long writes, are split
+   by their callers instead, each piece with a handle of its own
+   (see inode.c).
+
+   The free map is written by the commit itself, which may use
+   whatever room in the transaction the handles left.  Only a
+   free map sector that does not fit even then is written to the
+   cache without the journal's protection, counted in the
+   statistics. */
+
+/* Sectors that one handle may add to its transaction. */
+#define HANDLE_CREDITS 6
+
+/* Sectors kept free in every transaction for the free map. */
+#define FREE_MAP_CREDITS 4
+
+/* Journal header, in the first sector of the journal. */
+struct journal_header
+  {
+    uint32_t magic;                     /* HEADER_MAGIC. */
+    uint32_t seq;                       /* Transaction number. */
+    uint32_t cnt;                       /* Sectors logged, 0 if empty. */
+    block_sector_t home[JOURNAL_TXN_MAX]; /* Where each one belongs. */
+    uint8_t unused[BLOCK_SECTOR_SIZE - 3 * sizeof (uint32_t)
+                   - JOURNAL_TXN_MAX * sizeof (block_sector_t)];
+  };
+
+/* Commit record, in the sector after the last logged one. */
+struct journal_commit
+  {
+    uint32_t magic;                     /* COMMIT_MAGIC. */
+    uint32_t seq;                       /* Same as in the header. */
+    uint32_t checksum;                  /* Of header and logged sectors. */
+    uint8_t unused[BLOCK_SECTOR_SIZE - 3 * sizeof (uint32_t)];
+  };
+
+#define HEADER_MAGIC 0x4a524e4c
+#define COMMIT_MAGIC 0x434d4954
+
+/* The running transaction. */
+static struct lock journal_lock;        /* Protects the members below. */
+static struct condition journal_changed; /* A handle ended or TXN opened. */
+static uint32_t running_seq;            /* Its number. */
+static block_sector_t running_sectors[JOURNAL_TXN_MAX]; /* Logged. */
+static size_t running_cnt;              /* Number of RUNNING_SECTORS. */
+static int handle_cnt;                  /* Handles open on it. */
+static int reserved_cnt;                /* Credits they have not used. */
+static bool closing;                    /* Being closed by a commit? */
+static uint32_t committed_seq;          /* Last transaction committed. */
+
+/* Commits, one at a time.  The header and copies of the logged
+   sectors are laid out in LOG_BUF as they are in the journal. */
+static struct lock commit_lock;
+static uint8_t log_buf[(JOURNAL_TXN_MAX + 1) * BLOCK_SECTOR_SIZE];
+static struct journal_commit commit_record;
+static struct thread *committer;        /* Thread flushing the free map. */
+
+/* Commits requested by journal_begin(). */
+static struct workqueue journal_wq;
+static struct work commit_work;
+
+/* Statistics. */
+static unsigned long long commit_cnt, logged_cnt, restart_cnt, overflow_cnt;
+
+static uint32_t replay (void);
+static void write_empty (uint32_t seq);
+static uint32_t checksum (size_t cnt);
+static bool has_room (int credits);
+static bool take_credit (struct thread *);
+static void restart (struct thread *);
+static work_func journal_commit_work;
+
+/* Initializes the journal.  If FORMAT is false, first replays
+   the transaction left in the journal, if it was committed. */
+void
+journal_init (bool format)
+{
+  uint32_t seq;
+
+  ASSERT (sizeof (struct journal_header) == BLOCK_SECTOR_SIZE);
+  ASSERT (sizeof (struct journal_commit) == BLOCK_SECTOR_SIZE);
+
+  lock_init (&journal_lock);
+  lock_set_name (&journal_lock, "journal");
+  cond_init (&journal_changed);
+  lock_init (&commit_lock);
+  workqueue_init (&journal_wq, "journal", 1, PRI_DEFAULT);
+  work_init (&commit_work, journal_commit_work, NULL);
+
+  seq = format ? 0 : replay ();
+  write_empty (seq);
+  cache_commit (seq);
+  committed_seq = seq;
+  running_seq = seq + 1;
+}
+
+/* Commits the running transaction, for shutdown.  Committing
+   frees the sectors that it released, so a second commit writes
+   those changes to the free map. */
+void
+journal_done (void)
+{
+  journal_commit ();
+  journal_commit ();
+}
+
+/* Starts a handle on the running transaction, waiting for a
+   commit first if the transaction is being closed or lacks room
+   for another handle's credits.  Handles nest: a thread that
+   already holds one just goes one level deeper, without waiting.
+   Must be called before acquiring any lock that a thread holding
+   a handle might wait for. */
+void
+journal_begin (void)
+{
+  struct thread *t = thread_current ();
+
+  if (t->journal_depth++ > 0)
+    return;
+
+  lock_acquire (&journal_lock);
+  while (closing || !has_room (HANDLE_CREDITS))
+    {
+      work_queue (&journal_wq, &commit_work);
+      cond_wait (&journal_changed, &journal_lock);
+    }
+  handle_cnt++;
+  reserved_cnt += HANDLE_CREDITS;
+  t->journal_credits = HANDLE_CREDITS;
+  lock_release (&journal_lock);
+}
+
+/* Ends a handle started with journal_begin(). */
+void
+journal_end (void)
+{
+  struct thread *t = thread_current ();
+
+  ASSERT (t->journal_depth > 0);
+  if (--t->journal_depth > 0)
+    return;
+
+  lock_acquire (&journal_lock);
+  reserved_cnt -= t->journal_credits;
+  t->journal_credits = 0;
+  if (--handle_cnt == 0)
+    cond_broadcast (&journal_changed, &journal_lock);
+  lock_release (&journal_lock);
+}
+
+/* Returns the number of the transaction that the calling
+   thread's handle belongs to, for journal_sync(). */
+unsigned
+journal_txn (void)
+{
+  ASSERT (thread_current ()->journal_depth > 0);
+
+  /* The transaction cannot close while we hold the handle,
+     although the handle may move on to the next one. */
+  return running_seq;
+}
+
+/* Makes transaction TXN durable, committing the running
+   transaction if TXN has not committed yet.  Returns true if
+   this call committed a transaction, which also makes all file
+   data written so far durable, false if there was nothing to
+   commit.  The caller must not hold a handle. */
+bool
+journal_sync (unsigned txn)
+{
+  bool committed;
+
+  lock_acquire (&journal_lock);
+  committed = txn <= committed_seq;
+  lock_release (&journal_lock);
+  return !committed && journal_commit ();
+}
+
+/* Writes metadata sector SECTOR from BUFFER, which must contain
+   BLOCK_SECTOR_SIZE bytes, as part of the running
+   transaction. */
+void
+journal_write (block_sector_t sector, const void *buffer)
+{
+  journal_write_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Writes SIZE bytes from BUFFER at byte offset OFS within
+   metadata sector SECTOR, as part of the running transaction.
+   The caller must hold a handle.  Logging a sector that the
+   transaction does not have yet takes one of the handle's
+   credits, moving the handle on to the next transaction if it
+   has none left and no more can be had. */
+void
+journal_write_at (block_sector_t sector, const void *buffer,
+                  size_t ofs, size_t size)
+{
+  struct thread *t = thread_current ();
+  unsigned txn = 0;
+  size_t i;
+
+  ASSERT (t->journal_depth > 0);
+
+  lock_acquire (&journal_lock);
+  for (;;)
+    {
+      for (i = 0; i < running_cnt; i++)
+        if (running_sectors[i] == sector)
+          break;
+      if (i == running_cnt && take_credit (t))
+        running_sectors[running_cnt++] = sector;
+      if (i < running_cnt)
+        {
+          txn = running_seq;
+          break;
+        }
+      if (t == committer)
+        {
+          overflow_cnt++;
+          break;
+        }
+      restart (t);
+    }
+  lock_release (&journal_lock);
+
+  cache_write_txn (sector, buffer, ofs, size, txn);
+}
+
+/* Commits the running transaction, if it logged anything, and
+   writes it to its home on disk, returning once it is durable.
+   Returns true if there was anything to commit.  The caller must
+   not hold a handle. */
+bool
+journal_commit (void)
+{
+  struct journal_header *h = (struct journal_header *) log_buf;
+  struct thread *t = thread_current ();
+  uint32_t seq;
+  size_t cnt, i;
+
+  ASSERT (t->journal_depth == 0);
+
+  lock_acquire (&commit_lock);
+
+  /* Close the running transaction. */
+  lock_acquire (&journal_lock);
+  closing = true;
+  while (handle_cnt > 0)
+    cond_wait (&journal_changed, &journal_lock);
+  lock_release (&journal_lock);
+
+  /* The free map records its changes only in memory, so write
+     them into the transaction while no handle can make more. */
+  t->journal_depth = 1;
+  committer = t;
+  free_map_flush ();
+  committer = NULL;
+  t->journal_depth = 0;
+
+  /* Copy the logged sectors, then open the next transaction. */
+  lock_acquire (&journal_lock);
+  seq = running_seq;
+  cnt = running_cnt;
+  for (i = 0; i < cnt; i++)
+    {
+      h->home[i] = running_sectors[i];
+      cache_read (h->home[i], log_buf + (i + 1) * BLOCK_SECTOR_SIZE);
+    }
+  lock_release (&journal_lock);
+
+  /* A transaction that logged nothing has nothing to wait for, so
+     the sectors it released may be freed now, before it reopens
+     for new handles. */
+  if (cnt == 0)
+    free_map_apply (seq);
+
+  lock_acquire (&journal_lock);
+  if (cnt > 0)
+    {
+      running_seq++;
+      running_cnt = 0;
+    }
+  closing = false;
+  cond_broadcast (&journal_changed, &journal_lock);
+  lock_release (&journal_lock);
+
+  if (cnt > 0)
+    {
+      /* Data first, so that committed metadata never points to
+         data that is not on disk. */
+      cache_flush ();
+
+      /* Log the transaction and commit it.  The disk may reorder
+         writes in its cache, so flush it between the steps that
+         must reach the platters in order. */
+      h->magic = HEADER_MAGIC;
+      h->seq = seq;
+      h->cnt = cnt;
+      block_write_multiple (fs_device, JOURNAL_SECTOR, cnt + 1, log_buf);
+      block_flush (fs_device);
+      commit_record.magic = COMMIT_MAGIC;
+      commit_record.seq = seq;
+      commit_record.checksum = checksum (cnt);
+      block_write (fs_device, JOURNAL_SECTOR + cnt + 1, &commit_record);
+      block_flush (fs_device);
+
+      lock_acquire (&journal_lock);
+      committed_seq = seq;
+      lock_release (&journal_lock);
+      free_map_apply (seq);
+
+      /* Write the sectors home, after which the journal is no
+         longer needed. */
+      for (i = 0; i < cnt; i++)
+        cache_checkpoint (h->home[i], log_buf + (i + 1) * BLOCK_SECTOR_SIZE,
+                          seq);
+      cache_commit (seq);
+      block_flush (fs_device);
+      write_empty (seq);
+
+      commit_cnt++;
+      logged_cnt += cnt;
+    }
+  lock_release (&commit_lock);
+  return cnt > 0;
+}
+
+/* Prints journal statistics. */
+void
+journal_print_stats (void)
+{
+  printf ("Journal: %llu commits, %llu sectors logged, %llu restarts, "
+          "%llu overflowed\n",
+          commit_cnt, logged_cnt, restart_cnt, overflow_cnt);
+}
+
+/* Replays the transaction in the journal, if there is one and
+   its commit record is intact.  Returns the number of the last
+   transaction written to the journal, or 0 if the journal has
+   never been used. */
+static uint32_t
+replay (void)
+{
+  struct journal_header *h = (struct journal_header *) log_buf;
+  size_t i;
+
+  block_read (fs_device, JOURNAL_SECTOR, h);
+  if (h->magic != HEADER_MAGIC)
+    return 0;
+  if (h->cnt == 0 || h->cnt > JOURNAL_TXN_MAX)
+    return h->seq;
+
+  block_read_multiple (fs_device, JOURNAL_SECTOR + 1, h->cnt,
+                       log_buf + BLOCK_SECTOR_SIZE);
+  block_read (fs_device, JOURNAL_SECTOR + h->cnt + 1, &commit_record);
+  if (commit_record.magic == COMMIT_MAGIC && commit_record.seq == h->seq
+      && commit_record.checksum == checksum (h->cnt))
+    {
+      printf ("journal: replaying transaction %u (%u sectors)\n",
+              (unsigned) h->seq, (unsigned) h->cnt);
+      for (i = 0; i < h->cnt; i++)
+        block_write (fs_device, h->home[i],
+                     log_buf + (i + 1) * BLOCK_SECTOR_SIZE);
+    }
+  return h->seq;
+}
+
+/* Marks the journal empty, keeping SEQ as the number of the last
+   transaction, so that the next one is numbered after it. */
+static void
+write_empty (uint32_t seq)
+{
+  struct journal_header *h = (struct journal_header *) log_buf;
+
+  memset (h, 0, sizeof *h);
+  h->magic = HEADER_MAGIC;
+  h->seq = seq;
+  block_write (fs_device, JOURNAL_SECTOR, h);
+}
+
+/* Returns a checksum of the header and the CNT logged sectors in
+   LOG_BUF. */
+static uint32_t
+checksum (size_t cnt)
+{
+  const uint32_t *p = (const uint32_t *) log_buf;
+  const uint32_t *end = p + (cnt + 1) * BLOCK_SECTOR_SIZE / sizeof *p;
+  uint32_t sum = 0;
+
+  for (; p < end; p++)
+    sum = sum * 31 + *p;
+  return sum;
+}
+
+/* Returns true if the running transaction has room for CREDITS
+   more sectors besides those that its open handles have reserved
+   and those kept for the free map.  JOURNAL_LOCK must be held. */
+static bool
+has_room (int credits)
+{
+  ASSERT (lock_held_by_current_thread (&journal_lock));
+
+  return (running_cnt + reserved_cnt + credits + FREE_MAP_CREDITS
+          <= JOURNAL_TXN_MAX);
+}
+
+/* Takes a credit for T to log one more sector in the running
+   transaction, from T's handle or else from room that no handle
+   has reserved.  The commit flushing the free map may use all of
+   the room left.  Returns false if there is none.  JOURNAL_LOCK
+   must be held. */
+static bool
+take_credit (struct thread *t)
+{
+  ASSERT (lock_held_by_current_thread (&journal_lock));
+
+  if (t == committer)
+    return running_cnt < JOURNAL_TXN_MAX;
+  if (t->journal_credits > 0)
+    {
+      t->journal_credits--;
+      reserved_cnt--;
+      return true;
+    }
+  return has_room (1);
+}
+
+/* Moves T's handle, which has run out of credits, from the
+   running transaction to the next one, letting the running one
+   commit without waiting for T's operation to end.  JOURNAL_LOCK
+   must be held. */
+static void
+restart (struct thread *t)
+{
+  uint32_t seq = running_seq;
+
+  ASSERT (lock_held_by_current_thread (&journal_lock));
+  ASSERT (t->journal_credits == 0);
+
+  restart_cnt++;
+  if (--handle_cnt == 0)
+    cond_broadcast (&journal_changed, &journal_lock);
+  while (running_seq == seq || closing || !has_room (HANDLE_CREDITS))
+    {
+      work_queue (&journal_wq, &commit_work);
+      cond_wait (&journal_changed, &journal_lock);
+    }
+  handle_cnt++;
+  reserved_cnt += HANDLE_CREDITS;
+  t->journal_credits = HANDLE_CREDITS;
+}
+
+/* Commit work, queued by handles waiting for room. */
+static void
+journal_commit_work (void *aux UNUSED)
+{
+  journal_commit ();
+}
@@ -0,0 +1,29 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/block.h"
+
+/* Most metadata sectors that one transaction can log. */
+#define JOURNAL_TXN_MAX 24
+
+/* Number of sectors reserved for the journal, starting at
+   JOURNAL_SECTOR: a header, the logged sectors, and a commit
+   record. */
+#define JOURNAL_SECTORS (JOURNAL_TXN_MAX + 2)
+
+void journal_init (bool format);
+void journal_done (void);
+
+void journal_begin (void);
+void journal_end (void);
+void journal_write (block_sector_t, const void *);
+void journal_write_at (block_sector_t, const void *, size_t ofs, size_t size);
+
+unsigned journal_txn (void);
+bool journal_sync (unsigned txn);
+bool journal_commit (void);
+void journal_print_stats (void);
+
+#endif /* filesys/journal.h */
@@ -0,0 +1,350 @@
+#include "filesys/procfs.h"
+#include <console.h>
+#include <ctype.h>
+#include <debug.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "devices/block.h"
+#include "devices/timer.h"
+#include "filesys/cache.h"
+#include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#ifdef USERPROG
+#include "userprog/exception.h"
+#include "userprog/exec-cache.h"
+#endif
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/swap.h"
+#endif
+
+/* procfs.  The directory named "proc", beside the root
+   directory, holds read-only files that report the kernel's
+   statistics as they are at the moment each file is opened,
+   without waiting for the report at shutdown: one file per
+   group of statistics, and one per thread, named by its tid.
+
+   Nothing is stored.  Opening a file renders it, by capturing
+   the console output of the same *_print_stats() functions that
+   print the shutdown report, into a memory inode that is already
+   removed, so that it goes away when it is closed.  The
+   directory is an empty memory inode that dir_readdir() asks
+   procfs_readdir() to list. */
+
+/* Most lock statistics that "lockstat" reports. */
+#define LOCKSTAT_TOP 10
+
+/* Most bytes that a file renders to. */
+#define RENDER_PAGES 4
+
+/* A file with statistics. */
+struct procfs_file
+  {
+    const char *name;           /* File name. */
+    void (*render) (void);      /* Prints its contents. */
+  };
+
+static void render_sched (void);
+static void render_meminfo (void);
+static void render_iostat (void);
+static void render_lockstat (void);
+#ifdef USERPROG
+static void render_faults (void);
+#endif
+static bool render_thread (tid_t);
+
+static const struct procfs_file files[] =
+  {
+    {"sched", render_sched},
+    {"meminfo", render_meminfo},
+    {"iostat", render_iostat},
+    {"lockstat", render_lockstat},
+#ifdef USERPROG
+    {"faults", render_faults},
+#endif
+  };
+#define FILE_CNT (sizeof files / sizeof *files)
+
+/* The directory. */
+static struct inode *root;
+
+/* Serializes rendering, since only one thread may capture the
+   console at a time. */
+static struct lock render_lock;
+
+/* Creates the procfs directory.  Called when the file system is
+   mounted. */
+void
+procfs_init (void)
+{
+  root = inode_create_memory ();
+  if (root == NULL)
+    PANIC ("procfs creation failed");
+  lock_init (&render_lock);
+}
+
+/* Returns true if INODE is the procfs directory. */
+bool
+procfs_is_root (const struct inode *inode)
+{
+  return inode != NULL && inode == root;
+}
+
+/* Returns a new reference to the procfs directory's inode. */
+struct inode *
+procfs_open_root (void)
+{
+  return inode_reopen (root);
+}
+
+/* Returns the tid that NAME spells in decimal, or TID_ERROR if it
+   is not a number. */
+static tid_t
+parse_tid (const char *name)
+{
+  const char *p;
+
+  if (*name == '\0' || strlen (name) > 9)
+    return TID_ERROR;
+  for (p = name; *p != '\0'; p++)
+    if (!isdigit (*p))
+      return TID_ERROR;
+  return atoi (name);
+}
+
+/* Renders the procfs file NAME and returns a memory inode
+   holding its contents, or a null pointer if there is no such
+   file or memory is short.  The inode does not accept writes
+   and is freed when it is closed. */
+struct inode *
+procfs_open (const char *name)
+{
+  const struct procfs_file *f;
+  tid_t tid = TID_ERROR;
+  struct inode *inode;
+  char *buf;
+  size_t len;
+  bool found = true;
+
+  for (f = files; f < files + FILE_CNT; f++)
+    if (!strcmp (name, f->name))
+      break;
+  if (f == files + FILE_CNT)
+    {
+      f = NULL;
+      tid = parse_tid (name);
+      if (tid == TID_ERROR)
+        return NULL;
+    }
+
+  buf = palloc_get_multiple (0, RENDER_PAGES);
+  if (buf == NULL)
+    return NULL;
+  lock_acquire (&render_lock);
+  console_capture_start (buf, RENDER_PAGES * PGSIZE);
+  if (f != NULL)
+    f->render ();
+  else
+    found = render_thread (tid);
+  len = console_capture_stop ();
+  lock_release (&render_lock);
+
+  inode = found ? inode_create_memory () : NULL;
+  if (inode != NULL)
+    {
+      inode_remove (inode);
+      if (inode_write_at (inode, buf, len, 0) != (off_t) len)
+        {
+          inode_close (inode);
+          inode = NULL;
+        }
+      else
+        inode_deny_write (inode);
+    }
+  palloc_free_multiple (buf, RENDER_PAGES);
+  return inode;
+}
+
+/* Finds the Nth thread, for nth_thread(). */
+struct nth_thread
+  {
+    size_t n;                   /* Threads still to skip. */
+    tid_t tid;                  /* The Nth thread's tid, once found. */
+  };
+
+static void
+nth_thread_visit (struct thread *t, void *nth_)
+{
+  struct nth_thread *nth = nth_;
+
+  if (nth->n-- == 0)
+    nth->tid = t->tid;
+}
+
+/* Returns the tid of the Nth thread alive, counting from 0, or
+   TID_ERROR if there are no more than N. */
+static tid_t
+nth_thread (size_t n)
+{
+  struct nth_thread nth = {n, TID_ERROR};
+  enum intr_level old_level = intr_disable ();
+
+  thread_foreach (nth_thread_visit, &nth);
+  intr_set_level (old_level);
+  return nth.tid;
+}
+
+/* Stores the name of the procfs file at position *POS in NAME
+   and advances *POS.  The files with statistics come first, then
+   one per thread.  Returns false at the end of the directory. */
+bool
+procfs_readdir (off_t *pos, char name[NAME_MAX + 1])
+{
+  tid_t tid;
+
+  if (*pos < 0)
+    return false;
+  if ((size_t) *pos < FILE_CNT)
+    strlcpy (name, files[*pos].name, NAME_MAX + 1);
+  else
+    {
+      tid = nth_thread (*pos - FILE_CNT);
+      if (tid == TID_ERROR)
+        return false;
+      snprintf (name, NAME_MAX + 1, "%d", tid);
+    }
+  ++*pos;
+  return true;
+}
+
+/* Files with statistics. */
+
+static void
+render_sched (void)
+{
+  timer_print_stats ();
+  thread_print_stats ();
+  intr_print_stats ();
+}
+
+static void
+render_meminfo (void)
+{
+  palloc_print_stats ();
+  malloc_print_stats ();
+  kmem_cache_print_stats ();
+#ifdef VM
+  frame_print_stats ();
+  swap_print_stats ();
+#endif
+}
+
+static void
+render_iostat (void)
+{
+  block_print_stats ();
+  cache_print_stats ();
+  journal_print_stats ();
+}
+
+static void
+render_lockstat (void)
+{
+  lock_print_stats (LOCKSTAT_TOP);
+}
+
+#ifdef USERPROG
+static void
+render_faults (void)
+{
+  exception_print_stats ();
+  exec_cache_print_stats ();
+}
+#endif
+
+/* Per-thread files. */
+
+/* What render_thread() reports about a thread, copied with
+   interrupts off so that it can be printed with them on. */
+struct thread_info
+  {
+    tid_t tid;
+    char name[16];
+    enum thread_status status;
+    int priority;
+    int nice;
+    fixed_point recent_cpu;
+    struct thread_sched_stats stats;
+    struct thread_usage usage;
+    bool user;                  /* Part of a user process? */
+  };
+
+static void
+get_thread_info (struct thread *t, struct thread_info *info)
+{
+  info->tid = t->tid;
+  strlcpy (info->name, t->name, sizeof info->name);
+  info->status = t->status;
+  info->priority = t->priority;
+  info->nice = t->nice;
+  info->recent_cpu = t->recent_cpu;
+  info->stats = t->stats;
+  info->usage = t->usage;
+#ifdef USERPROG
+  info->user = t->process != NULL;
+#else
+  info->user = false;
+#endif
+}
+
+/* Prints the status of the thread with the given TID.  Returns
+   false if there is no such thread. */
+static bool
+render_thread (tid_t tid)
+{
+  static const char *status_names[] =
+    {"running", "ready", "blocked", "dying"};
+  struct thread_info info;
+  enum intr_level old_level;
+  struct thread *t;
+
+  old_level = intr_disable ();
+  t = thread_lookup (tid);
+  if (t != NULL)
+    get_thread_info (t, &info);
+  intr_set_level (old_level);
+  if (t == NULL)
+    return false;
+
+  printf ("Name: %s\n", info.name);
+  printf ("Tid: %d\n", info.tid);
+  printf ("State: %s\n", status_names[info.status]);
+  printf ("User process: %s\n", info.user ? "yes" : "no");
+  printf ("Priority: %d\n", info.priority);
+  printf ("Nice: %d\n", info.nice);
+  printf ("Recent CPU: %d\n",
+          fp_round (fp_mul_int (info.recent_cpu, 100)));
+  printf ("Switches: %u (%u voluntary, %u involuntary)\n",
+          info.stats.switches, info.stats.voluntary,
+          info.stats.involuntary);
+  printf ("Donations: %u\n", info.stats.donations);
+  printf ("Ready ticks: %"PRId64" (longest wait %"PRId64")\n",
+          info.stats.ready_ticks, info.stats.max_latency);
+  printf ("User time: %"PRId64" us\n",
+          timer_cycles_to_ns (info.usage.user_cycles) / 1000);
+  printf ("Kernel time: %"PRId64" us\n",
+          timer_cycles_to_ns (info.usage.kernel_cycles) / 1000);
+  printf ("Page faults: %u\n", info.usage.faults);
+  printf ("Sectors: %u read, %u written\n",
+          info.usage.sectors_read, info.usage.sectors_written);
+  return true;
+}
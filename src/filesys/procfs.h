@@ -0,0 +1,16 @@
+#ifndef FILESYS_PROCFS_H
+#define FILESYS_PROCFS_H
+
+#include <stdbool.h>
+#include "filesys/directory.h"
+#include "filesys/off_t.h"
+
+struct inode;
+
+void procfs_init (void);
+bool procfs_is_root (const struct inode *);
+struct inode *procfs_open_root (void);
+struct inode *procfs_open (const char *name);
+bool procfs_readdir (off_t *pos, char name[NAME_MAX + 1]);
+
+#endif /* filesys/procfs.h */
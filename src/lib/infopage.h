@@ -0,0 +1,51 @@
+#ifndef __LIB_INFOPAGE_H
+#define __LIB_INFOPAGE_H
+
+#ifndef __ASSEMBLER__
+#include <stdint.h>
+#endif
+
+/* Info pages: pages that the kernel maps read-only into every
+   user process, so that user programs can read some kernel state
+   without a system call.  They sit just below the usual load
+   address of user programs, 0x08048000.
+
+   The kernel info page, at INFO_PAGE_ADDR, is a single page
+   shared by every process.  The timer interrupt updates it on
+   every tick.  The process info page, just above it, is the
+   process's own and does not change. */
+#define INFO_PAGE_BASE 0x08046000
+#define PROCESS_INFO_PAGE_BASE 0x08047000
+
+/* Offset of struct kernel_info's SYSENTER member, for assembly
+   code. */
+#define KERNEL_INFO_SYSENTER 0
+
+#ifndef __ASSEMBLER__
+#define INFO_PAGE_ADDR ((void *) INFO_PAGE_BASE)
+#define PROCESS_INFO_PAGE_ADDR ((void *) PROCESS_INFO_PAGE_BASE)
+
+/* The kernel info page.
+
+   The kernel may update the page between any two of a reader's
+   instructions, and TICKS takes two to read.  So SEQ is odd
+   while an update is in progress and changes with every update:
+   a reader takes a snapshot between two reads of SEQ, and tries
+   again if SEQ was odd or changed. */
+struct kernel_info
+  {
+    uint32_t sysenter;          /* Nonzero: system calls may use SYSENTER. */
+    uint32_t seq;               /* Update sequence number. */
+    int64_t ticks;              /* Timer ticks since boot. */
+    int load_avg;               /* MLFQS load average, times 100. */
+    int timer_freq;             /* Timer ticks per second. */
+  };
+
+/* The process info page. */
+struct process_info
+  {
+    int pid;                    /* Process id, as returned by exec(). */
+  };
+#endif /* __ASSEMBLER__ */
+
+#endif /* lib/infopage.h */
@@ -69,6 +69,58 @@ last_mask (const struct bitmap *b)
   return last_bits ? ((elem_type) 1 << last_bits) - 1 : (elem_type) -1;
 }
 
+/* Returns the bits of element E that are set to VALUE, that is,
+   E itself if VALUE is true and its complement otherwise. */
+static inline elem_type
+match_bits (elem_type e, bool value) 
+{
+  return value ? e : ~e;
+}
+
+/* Returns the number of 1-bits in X.  The kernel is not linked
+   with libgcc, so __builtin_popcount() is not available; this is
+   the usual parallel "sideways addition". */
+static inline size_t
+popcount (elem_type x) 
+{
+  const elem_type ones = (elem_type) -1;
+
+  x = x - ((x >> 1) & (ones / 3));
+  x = (x & (ones / 15 * 3)) + ((x >> 2) & (ones / 15 * 3));
+  x = (x + (x >> 4)) & (ones / 255 * 15);
+  return (elem_type) (x * (ones / 255)) >> (sizeof x - 1) * CHAR_BIT;
+}
+
+/* Returns the index of the first bit in B at or after START and
+   before END that is set to VALUE, or END if there is none.
+   Examines an element at a time, so that runs of bits not set to
+   VALUE are skipped quickly. */
+static size_t
+find_bit (const struct bitmap *b, size_t start, size_t end, bool value) 
+{
+  size_t idx, bit;
+  elem_type bits;
+
+  ASSERT (end <= b->bit_cnt);
+  if (start >= end)
+    return end;
+
+  /* Ignore bits before START in its element. */
+  idx = elem_idx (start);
+  bits = match_bits (b->bits[idx], value) & ~(bit_mask (start) - 1);
+  while (bits == 0) 
+    {
+      if (++idx * ELEM_BITS >= end)
+        return end;
+      bits = match_bits (b->bits[idx], value);
+    }
+
+  /* Bits past END, including any unused bits in the last
+     element, don't count. */
+  bit = idx * ELEM_BITS + __builtin_ctzl (bits);
+  return bit < end ? bit : end;
+}
+
 /* Creation and destruction. */
 
 /* Creates and returns a pointer to a newly allocated bitmap with room for
@@ -238,10 +290,26 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
+  /* Count an element, or the part of one in the range, at a
+     time. */
   value_cnt = 0;
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      value_cnt++;
+  for (i = start; i < start + cnt; ) 
+    {
+      size_t ofs = i % ELEM_BITS;
+      size_t n = ELEM_BITS - ofs;
+      elem_type bits;
+      size_t ones;
+
+      if (n > start + cnt - i)
+        n = start + cnt - i;
+      bits = b->bits[elem_idx (i)] >> ofs;
+      if (n < ELEM_BITS)
+        bits &= ((elem_type) 1 << n) - 1;
+
+      ones = popcount (bits);
+      value_cnt += value ? ones : n - ones;
+      i += n;
+    }
   return value_cnt;
 }
 
@@ -250,16 +318,11 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
-  
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      return true;
-  return false;
+  return find_bit (b, start, start + cnt, value) < start + cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -291,20 +354,32 @@ bitmap_all (const struct bitmap *b, size_t start, size_t cnt)
 /* Finds and returns the starting index of the first group of CNT
    consecutive bits in B at or after START that are all set to
    VALUE.
-   If there is no such group, returns BITMAP_ERROR. */
+   If there is no such group, returns BITMAP_ERROR.
+
+   Works a run at a time rather than a bit at a time: finds the
+   next bit set to VALUE, then the next bit after it that is not,
+   and starts over from there if the run between them is too
+   short.  Each bit is examined at most twice, and whole elements
+   are skipped at once. */
 size_t
 bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
 
-  if (cnt <= b->bit_cnt) 
+  if (cnt == 0)
+    return start;
+  while (cnt <= b->bit_cnt - start) 
     {
-      size_t last = b->bit_cnt - cnt;
-      size_t i;
-      for (i = start; i <= last; i++)
-        if (!bitmap_contains (b, i, cnt, !value))
-          return i; 
+      size_t run_start = find_bit (b, start, b->bit_cnt - cnt + 1, value);
+      size_t run_end;
+
+      if (run_start > b->bit_cnt - cnt)
+        break;
+      run_end = find_bit (b, run_start, run_start + cnt, !value);
+      if (run_end - run_start >= cnt)
+        return run_start;
+      start = run_end;
     }
   return BITMAP_ERROR;
 }
@@ -350,6 +425,28 @@ bitmap_read (struct bitmap *b, struct file *file)
   return success;
 }
 
+/* Reads SIZE bytes of B's file representation, starting at byte
+   offset OFS, from the same offset in FILE.  The range is clipped
+   to the size of B.  Returns true if successful, false
+   otherwise. */
+bool
+bitmap_read_partial (struct bitmap *b, struct file *file,
+                     size_t ofs, size_t size)
+{
+  size_t total = byte_cnt (b->bit_cnt);
+  bool success;
+
+  if (ofs >= total)
+    return true;
+  if (size > total - ofs)
+    size = total - ofs;
+  success = (file_read_at (file, (uint8_t *) b->bits + ofs, size, ofs)
+             == (off_t) size);
+  if (ofs + size == total)
+    b->bits[elem_cnt (b->bit_cnt) - 1] &= last_mask (b);
+  return success;
+}
+
 /* Writes B to FILE.  Return true if successful, false
    otherwise. */
 bool
@@ -358,6 +455,24 @@ bitmap_write (const struct bitmap *b, struct file *file)
   off_t size = byte_cnt (b->bit_cnt);
   return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Writes SIZE bytes of B's file representation, starting at byte
+   offset OFS, to the same offset in FILE.  The range is clipped
+   to the size of B.  Returns true if successful, false
+   otherwise. */
+bool
+bitmap_write_partial (const struct bitmap *b, struct file *file,
+                      size_t ofs, size_t size)
+{
+  size_t total = byte_cnt (b->bit_cnt);
+
+  if (ofs >= total)
+    return true;
+  if (size > total - ofs)
+    size = total - ofs;
+  return (file_write_at (file, (const uint8_t *) b->bits + ofs, size, ofs)
+          == (off_t) size);
+}
 #endif /* FILESYS */
 
 /* Debugging. */
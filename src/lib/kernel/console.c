@@ -1,14 +1,16 @@
 #include <console.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <string.h>
 #include "devices/serial.h"
 #include "devices/vga.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 
 static void vprintf_helper (char, void *);
-static void putchar_have_lock (uint8_t c);
+static void putbuf_have_lock (const char *, size_t);
 
 /* The console lock.
    Both the vga and serial layers do their own locking, so it's
@@ -59,11 +61,44 @@ static int console_lock_depth;
 /* Number of characters written to console. */
 static int64_t write_cnt;
 
+/* Output being captured, by console_capture_start(), from
+   CAPTURE_THREAD, or null.  The capture goes into the
+   CAPTURE_SIZE bytes at CAPTURE_BUF, of which CAPTURE_LEN are
+   in use so far. */
+static struct thread *capture_thread;
+static char *capture_buf;
+static size_t capture_size, capture_len;
+
+/* Size of vprintf()'s staging buffer.  Long enough for almost any
+   line of output. */
+#define STAGE_SIZE 128
+
+/* vprintf() output waiting to be written to the console.
+
+   vprintf() formats into a buffer on the caller's stack, without
+   the console lock, and writes the buffer to the devices in one
+   go at the end of each line, or when the buffer fills up.  The
+   serial and VGA layers then disable interrupts once per chunk
+   instead of once per character.  Most printf() calls produce a
+   single line and so take the console lock only for the moment
+   it takes to queue that line.  A call whose output spans more
+   than one chunk keeps the lock from its first chunk to its
+   last, so that, as before, the output of one printf() call is
+   never mixed with another's. */
+struct stage 
+  {
+    char buf[STAGE_SIZE];       /* Characters not yet written. */
+    size_t len;                 /* Number of characters in BUF. */
+    int char_cnt;               /* Total characters formatted. */
+    bool locked;                /* Have we taken the console lock? */
+  };
+
 /* Enable console locking. */
 void
 console_init (void) 
 {
   lock_init (&console_lock);
+  lock_set_name (&console_lock, "console");
   use_console_lock = true;
 }
 
@@ -109,6 +144,42 @@ release_console (void)
     }
 }
 
+/* Sends the console output of the current thread, from now
+   until console_capture_stop(), into the SIZE bytes of BUFFER
+   instead of the console, for rendering the output of functions
+   that print their report, such as the *_print_stats()
+   functions, into a file.  Output beyond SIZE bytes is dropped.
+   Output from other threads and from interrupt handlers still
+   goes to the console.  Only one thread may capture at a time. */
+void
+console_capture_start (char *buffer, size_t size) 
+{
+  ASSERT (!intr_context ());
+
+  acquire_console ();
+  ASSERT (capture_thread == NULL);
+  capture_buf = buffer;
+  capture_size = size;
+  capture_len = 0;
+  capture_thread = thread_current ();
+  release_console ();
+}
+
+/* Ends the current thread's console capture and returns the
+   number of bytes captured. */
+size_t
+console_capture_stop (void) 
+{
+  size_t len;
+
+  acquire_console ();
+  ASSERT (capture_thread == thread_current ());
+  capture_thread = NULL;
+  len = capture_len;
+  release_console ();
+  return len;
+}
+
 /* Returns true if the current thread has the console lock,
    false otherwise. */
 static bool
@@ -125,13 +196,41 @@ console_locked_by_current_thread (void)
 int
 vprintf (const char *format, va_list args) 
 {
-  int char_cnt = 0;
+  struct stage stage;
+  va_list copy;
+  int len;
 
-  acquire_console ();
-  __vprintf (format, args, vprintf_helper, &char_cnt);
-  release_console ();
+  /* Usually the whole output fits in the staging buffer, so for
+     speed format it there with vsnprintf(), which writes straight
+     into the buffer, and write it out in one go. */
+  va_copy (copy, args);
+  len = vsnprintf (stage.buf, sizeof stage.buf, format, copy);
+  va_end (copy);
+  if (len < STAGE_SIZE) 
+    {
+      acquire_console ();
+      putbuf_have_lock (stage.buf, len);
+      release_console ();
+      return len;
+    }
+
+  /* Otherwise, format it again, a chunk at a time. */
+  stage.len = 0;
+  stage.char_cnt = 0;
+  stage.locked = false;
+  __vprintf (format, args, vprintf_helper, &stage);
 
-  return char_cnt;
+  if (stage.len > 0) 
+    {
+      if (!stage.locked)
+        acquire_console ();
+      putbuf_have_lock (stage.buf, stage.len);
+      stage.locked = true;
+    }
+  if (stage.locked)
+    release_console ();
+
+  return stage.char_cnt;
 }
 
 /* Writes string S to the console, followed by a new-line
@@ -140,9 +239,8 @@ int
 puts (const char *s) 
 {
   acquire_console ();
-  while (*s != '\0')
-    putchar_have_lock (*s++);
-  putchar_have_lock ('\n');
+  putbuf_have_lock (s, strlen (s));
+  putbuf_have_lock ("\n", 1);
   release_console ();
 
   return 0;
@@ -153,8 +251,7 @@ void
 putbuf (const char *buffer, size_t n) 
 {
   acquire_console ();
-  while (n-- > 0)
-    putchar_have_lock (*buffer++);
+  putbuf_have_lock (buffer, n);
   release_console ();
 }
 
@@ -162,30 +259,55 @@ putbuf (const char *buffer, size_t n)
 int
 putchar (int c) 
 {
+  char ch = c;
+
   acquire_console ();
-  putchar_have_lock (c);
+  putbuf_have_lock (&ch, 1);
   release_console ();
   
   return c;
 }
 
-/* Helper function for vprintf(). */
+/* Helper function for vprintf().  Adds C to the staging buffer
+   in STAGE_ and writes out the buffer at the end of a line or
+   when it is full.  The console lock, once taken, is kept until
+   vprintf() is done. */
 static void
-vprintf_helper (char c, void *char_cnt_) 
+vprintf_helper (char c, void *stage_) 
 {
-  int *char_cnt = char_cnt_;
-  (*char_cnt)++;
-  putchar_have_lock (c);
+  struct stage *stage = stage_;
+
+  stage->char_cnt++;
+  stage->buf[stage->len++] = c;
+  if (c == '\n' || stage->len >= STAGE_SIZE) 
+    {
+      if (!stage->locked) 
+        {
+          acquire_console ();
+          stage->locked = true;
+        }
+      putbuf_have_lock (stage->buf, stage->len);
+      stage->len = 0;
+    }
 }
 
-/* Writes C to the vga display and serial port.
-   The caller has already acquired the console lock if
-   appropriate. */
+/* Writes the N characters in BUFFER to the vga display and
+   serial port.  The caller has already acquired the console lock
+   if appropriate. */
 static void
-putchar_have_lock (uint8_t c) 
+putbuf_have_lock (const char *buffer, size_t n) 
 {
   ASSERT (console_locked_by_current_thread ());
-  write_cnt++;
-  serial_putc (c);
-  vga_putc (c);
+  if (capture_thread != NULL && !intr_context ()
+      && thread_current () == capture_thread)
+    {
+      size_t cnt = n < capture_size - capture_len
+                   ? n : capture_size - capture_len;
+      memcpy (capture_buf + capture_len, buffer, cnt);
+      capture_len += cnt;
+      return;
+    }
+  write_cnt += n;
+  serial_putbuf (buffer, n);
+  vga_putbuf (buffer, n);
 }
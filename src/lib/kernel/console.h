@@ -1,8 +1,12 @@
 #ifndef __LIB_KERNEL_CONSOLE_H
 #define __LIB_KERNEL_CONSOLE_H
 
+#include <stddef.h>
+
 void console_init (void);
 void console_panic (void);
 void console_print_stats (void);
+void console_capture_start (char *buffer, size_t size);
+size_t console_capture_stop (void);
 
 #endif /* lib/kernel/console.h */
@@ -7,6 +7,7 @@
 #include <string.h>
 #include "threads/init.h"
 #include "threads/interrupt.h"
+#include "threads/klog.h"
 #include "threads/thread.h"
 #include "threads/switch.h"
 #include "threads/vaddr.h"
@@ -36,6 +37,9 @@ debug_panic (const char *file, int line, const char *function,
       va_end (args);
 
       debug_backtrace ();
+
+      klog (KLOG_PANIC, line, (uintptr_t) __builtin_return_address (0));
+      klog_panic ();
     }
   else if (level == 2)
     printf ("Kernel PANIC recursion at %s:%d in %s().\n",
@@ -93,10 +97,10 @@ print_stacktrace(struct thread *t, void *aux UNUSED)
       /* Skip threads if they have been added to the all threads
          list, but have never been scheduled.
          We can identify because their `stack' member either points 
-         at the top of their kernel stack page, or the 
+         at the top of their kernel stack, or the 
          switch_threads_frame's 'eip' member points at switch_entry.
          See also threads.c. */
-      if (t->stack == (uint8_t *)t + PGSIZE || saved_frame->eip == switch_entry)
+      if (t->stack == t->stack_top || saved_frame->eip == switch_entry)
         {
           printf (" thread was never scheduled.\n");
           return;
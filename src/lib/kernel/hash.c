@@ -6,6 +6,7 @@
    See hash.h for basic information. */
 
 #include "hash.h"
+#include <string.h>
 #include "../debug.h"
 #include "threads/malloc.h"
 
@@ -31,6 +32,7 @@ hash_init (struct hash *h,
   h->hash = hash;
   h->less = less;
   h->aux = aux;
+  h->fixed = false;
 
   if (h->buckets != NULL) 
     {
@@ -41,6 +43,27 @@ hash_init (struct hash *h,
     return false;
 }
 
+/* Initializes hash table H like hash_init(), but with the
+   BUCKET_CNT lists in BUCKETS, a power of 2, as its buckets for
+   good.  Such a table never calls malloc() or free(), so it may
+   be changed with interrupts off, but it gets slower once it
+   holds many more than BUCKET_CNT elements. */
+void
+hash_init_fixed (struct hash *h, struct list *buckets, size_t bucket_cnt,
+                 hash_hash_func *hash, hash_less_func *less, void *aux)
+{
+  ASSERT (bucket_cnt > 0 && (bucket_cnt & (bucket_cnt - 1)) == 0);
+
+  h->elem_cnt = 0;
+  h->bucket_cnt = bucket_cnt;
+  h->buckets = buckets;
+  h->hash = hash;
+  h->less = less;
+  h->aux = aux;
+  h->fixed = true;
+  hash_clear (h, NULL);
+}
+
 /* Removes all the elements from H.
    
    If DESTRUCTOR is non-null, then it is called for each element
@@ -88,7 +111,8 @@ hash_destroy (struct hash *h, hash_action_func *destructor)
 {
   if (destructor != NULL)
     hash_clear (h, destructor);
-  free (h->buckets);
+  if (!h->fixed)
+    free (h->buckets);
 }
 
 /* Inserts NEW into hash table H and returns a null pointer, if
@@ -257,48 +281,119 @@ hash_empty (struct hash *h)
   return h->elem_cnt == 0;
 }
 
-/* Fowler-Noll-Vo hash constants, for 32-bit word sizes. */
-#define FNV_32_PRIME 16777619u
-#define FNV_32_BASIS 2166136261u
+/* The hash functions below are MurmurHash3's 32-bit variant, by
+   Austin Appleby, which is in the public domain.  It takes its
+   input a 32-bit word at a time, instead of a byte at a time
+   like the Fowler-Noll-Vo hash that Pintos used before, and ends
+   with a finalizer that mixes every input bit into every output
+   bit, so that the low bits used to pick a bucket are as good as
+   the high ones even for keys that differ only in their high
+   bits, such as sector numbers or page addresses. */
+#define MURMUR_C1 0xcc9e2d51u
+#define MURMUR_C2 0x1b873593u
+
+/* Returns X rotated left by N bits, 0 < N < 32. */
+static inline uint32_t
+rotl32 (uint32_t x, int n)
+{
+  return (x << n) | (x >> (32 - n));
+}
+
+/* Returns input word K scrambled for mixing into a hash. */
+static inline uint32_t
+murmur_scramble (uint32_t k)
+{
+  return rotl32 (k * MURMUR_C1, 15) * MURMUR_C2;
+}
+
+/* Returns hash H with input word K mixed in. */
+static inline uint32_t
+murmur_step (uint32_t h, uint32_t k)
+{
+  return rotl32 (h ^ murmur_scramble (k), 13) * 5 + 0xe6546b64;
+}
+
+/* Returns H with its bits mixed thoroughly: MurmurHash3's
+   finalizer.  It is a bijection. */
+static inline uint32_t
+murmur_finish (uint32_t h)
+{
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35u;
+  h ^= h >> 16;
+  return h;
+}
 
 /* Returns a hash of the SIZE bytes in BUF. */
 unsigned
 hash_bytes (const void *buf_, size_t size)
 {
-  /* Fowler-Noll-Vo 32-bit hash, for bytes. */
   const unsigned char *buf = buf_;
-  unsigned hash;
+  size_t words = size / sizeof (uint32_t);
+  uint32_t hash = 0;
+  uint32_t k;
 
-  ASSERT (buf != NULL);
+  ASSERT (buf != NULL || size == 0);
 
-  hash = FNV_32_BASIS;
-  while (size-- > 0)
-    hash = (hash * FNV_32_PRIME) ^ *buf++;
+  /* The 80x86 allows loads from any address, so BUF need not be
+     word-aligned, and the hash does not depend on whether it
+     is. */
+  for (; words > 0; words--, buf += sizeof (uint32_t))
+    hash = murmur_step (hash, *(const uint32_t *) buf);
 
-  return hash;
+  /* Up to 3 remaining bytes, little-endian. */
+  k = 0;
+  switch (size % sizeof (uint32_t))
+    {
+    case 3:
+      k |= (uint32_t) buf[2] << 16;
+      /* Fall through. */
+    case 2:
+      k |= (uint32_t) buf[1] << 8;
+      /* Fall through. */
+    case 1:
+      k |= buf[0];
+      hash ^= murmur_scramble (k);
+    }
+
+  return murmur_finish (hash ^ size);
 } 
 
-/* Returns a hash of string S. */
+/* Returns a hash of string S, the same as hash_bytes() of its
+   characters without the null terminator. */
 unsigned
-hash_string (const char *s_) 
+hash_string (const char *s) 
 {
-  const unsigned char *s = (const unsigned char *) s_;
-  unsigned hash;
-
   ASSERT (s != NULL);
 
-  hash = FNV_32_BASIS;
-  while (*s != '\0')
-    hash = (hash * FNV_32_PRIME) ^ *s++;
-
-  return hash;
+  return hash_bytes (s, strlen (s));
 }
 
 /* Returns a hash of integer I. */
 unsigned
 hash_int (int i) 
 {
-  return hash_bytes (&i, sizeof i);
+  return hash_u32 (i);
+}
+
+/* Returns a hash of X.  Unlike hash_bytes() of X's 4 bytes, this
+   is just MurmurHash3's finalizer, which is cheap enough to use
+   for every lookup in a table keyed by a number. */
+unsigned
+hash_u32 (uint32_t x)
+{
+  return murmur_finish (x);
+}
+
+/* Returns a hash of pointer P, for tables keyed by address.  The
+   low bits of P, often all zero because of alignment, are mixed
+   with the rest, so they do not crowd P into a few buckets. */
+unsigned
+hash_ptr (const void *p)
+{
+  return hash_u32 ((uintptr_t) p);
 }
 
 /* Returns the bucket in H that E belongs in. */
@@ -356,6 +451,8 @@ rehash (struct hash *h)
   size_t i;
 
   ASSERT (h != NULL);
+  if (h->fixed)
+    return;
 
   /* Save old bucket info for later use. */
   old_buckets = h->buckets;
@@ -288,7 +288,8 @@ list_back(struct list *list)
 }
 
 /* Returns the number of elements in LIST.
-   Runs in O(n) in the number of elements. */
+   Runs in O(n) in the number of elements.  See struct clist for
+   a list that keeps count. */
 size_t
 list_size(struct list *list)
 {
@@ -526,3 +527,81 @@ list_min(struct list *list, list_less_func *less, void *aux)
   }
   return min;
 }
+
+/* Initializes counted list CLIST as an empty list. */
+void
+clist_init(struct clist *clist)
+{
+  list_init(&clist->list);
+  clist->cnt = 0;
+}
+
+/* Inserts ELEM just before BEFORE, which must be an element of
+   CLIST or its tail, and counts it. */
+void
+clist_insert(struct clist *clist, struct list_elem *before,
+             struct list_elem *elem)
+{
+  list_insert(before, elem);
+  clist->cnt++;
+}
+
+/* Inserts ELEM at the beginning of CLIST, so that it becomes the
+   front in CLIST. */
+void
+clist_push_front(struct clist *clist, struct list_elem *elem)
+{
+  clist_insert(clist, list_begin(&clist->list), elem);
+}
+
+/* Inserts ELEM at the end of CLIST, so that it becomes the back
+   in CLIST. */
+void
+clist_push_back(struct clist *clist, struct list_elem *elem)
+{
+  clist_insert(clist, list_end(&clist->list), elem);
+}
+
+/* Removes ELEM, which must be in CLIST, and returns the element
+   that followed it, as list_remove() does. */
+struct list_elem *
+clist_remove(struct clist *clist, struct list_elem *elem)
+{
+  ASSERT(clist->cnt > 0);
+  clist->cnt--;
+  return list_remove(elem);
+}
+
+/* Removes the front element from CLIST and returns it.
+   Undefined behavior if CLIST is empty before removal. */
+struct list_elem *
+clist_pop_front(struct clist *clist)
+{
+  struct list_elem *front = list_front(&clist->list);
+  clist_remove(clist, front);
+  return front;
+}
+
+/* Removes the back element from CLIST and returns it.
+   Undefined behavior if CLIST is empty before removal. */
+struct list_elem *
+clist_pop_back(struct clist *clist)
+{
+  struct list_elem *back = list_back(&clist->list);
+  clist_remove(clist, back);
+  return back;
+}
+
+/* Returns the number of elements in CLIST, in constant time. */
+size_t
+clist_size(const struct clist *clist)
+{
+  return clist->cnt;
+}
+
+/* Returns true if CLIST is empty, false otherwise. */
+bool
+clist_empty(const struct clist *clist)
+{
+  return clist->cnt == 0;
+}
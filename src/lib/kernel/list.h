@@ -183,4 +183,149 @@ struct list_elem *list_max(struct list *, list_less_func *, void *aux);
 struct list_elem *list_max_donate(struct list *, list_less_func *, void *aux);
 struct list_elem *list_min(struct list *, list_less_func *, void *aux);
 
+/* Ordered lists specialized to one element type.
+
+   The functions above compare elements by calling a
+   list_less_func through a pointer.  For a list whose elements
+   are all of type TYPE, linked through list_elem member MEMBER and
+   ordered by the scalar member KEY, smallest first,
+
+       LIST_DEFINE_ORDERED (NAME, TYPE, MEMBER, KEY)
+
+   defines these functions, which compare KEYs directly instead:
+
+       void NAME_insert_ordered (struct list *, TYPE *);
+       TYPE *NAME_min (struct list *);
+       TYPE *NAME_max (struct list *);
+       void NAME_sort (struct list *);
+
+   NAME_insert_ordered() and NAME_sort() order elements as
+   list_insert_ordered() and list_sort() would with a comparison
+   of KEYs by `<': an element goes after others with an equal
+   key, and sorting is stable.  NAME_min() and NAME_max() return
+   the first element with the smallest or largest key, without
+   removing it, or a null pointer if the list is empty.  For
+   example, given
+
+       struct sleeper { struct list_elem elem; int64_t wake; };
+       LIST_DEFINE_ORDERED (sleeper, struct sleeper, elem, wake)
+
+   sleeper_insert_ordered (&sleepers, s) keeps SLEEPERS in order
+   of wake time. */
+#define LIST_ORDERED_KEY(E, TYPE, MEMBER, KEY) \
+  (list_entry(E, TYPE, MEMBER)->KEY)
+
+#define LIST_DEFINE_ORDERED(NAME, TYPE, MEMBER, KEY)                       \
+  static inline void                                                       \
+  NAME##_insert_ordered(struct list *list, TYPE *x)                        \
+  {                                                                        \
+    struct list_elem *e = list->head.next;                                 \
+                                                                           \
+    while (e != &list->tail                                                \
+           && !(x->KEY < LIST_ORDERED_KEY(e, TYPE, MEMBER, KEY)))          \
+      e = e->next;                                                         \
+    list_insert(e, &x->MEMBER);                                            \
+  }                                                                        \
+                                                                           \
+  static inline TYPE *                                                     \
+  NAME##_min(struct list *list)                                            \
+  {                                                                        \
+    struct list_elem *min = list->head.next, *e;                           \
+                                                                           \
+    if (min == &list->tail)                                                \
+      return NULL;                                                         \
+    for (e = min->next; e != &list->tail; e = e->next)                     \
+      if (LIST_ORDERED_KEY(e, TYPE, MEMBER, KEY)                           \
+          < LIST_ORDERED_KEY(min, TYPE, MEMBER, KEY))                      \
+        min = e;                                                           \
+    return list_entry(min, TYPE, MEMBER);                                  \
+  }                                                                        \
+                                                                           \
+  static inline TYPE *                                                     \
+  NAME##_max(struct list *list)                                            \
+  {                                                                        \
+    struct list_elem *max = list->head.next, *e;                           \
+                                                                           \
+    if (max == &list->tail)                                                \
+      return NULL;                                                         \
+    for (e = max->next; e != &list->tail; e = e->next)                     \
+      if (LIST_ORDERED_KEY(max, TYPE, MEMBER, KEY)                         \
+          < LIST_ORDERED_KEY(e, TYPE, MEMBER, KEY))                        \
+        max = e;                                                           \
+    return list_entry(max, TYPE, MEMBER);                                  \
+  }                                                                        \
+                                                                           \
+  /* The natural merge sort of list_sort(). */                             \
+  static inline void                                                       \
+  NAME##_sort(struct list *list)                                           \
+  {                                                                        \
+    size_t run_cnt;                                                        \
+                                                                           \
+    do                                                                     \
+    {                                                                      \
+      struct list_elem *a0, *a1b0, *b1;                                    \
+                                                                           \
+      run_cnt = 0;                                                         \
+      for (a0 = list->head.next; a0 != &list->tail; a0 = b1)               \
+      {                                                                    \
+        run_cnt++;                                                         \
+        for (a1b0 = a0->next;                                              \
+             a1b0 != &list->tail                                           \
+             && !(LIST_ORDERED_KEY(a1b0, TYPE, MEMBER, KEY)                \
+                  < LIST_ORDERED_KEY(a1b0->prev, TYPE, MEMBER, KEY));      \
+             a1b0 = a1b0->next)                                            \
+          continue;                                                        \
+        if (a1b0 == &list->tail)                                           \
+          break;                                                           \
+        for (b1 = a1b0->next;                                              \
+             b1 != &list->tail                                             \
+             && !(LIST_ORDERED_KEY(b1, TYPE, MEMBER, KEY)                  \
+                  < LIST_ORDERED_KEY(b1->prev, TYPE, MEMBER, KEY));        \
+             b1 = b1->next)                                                \
+          continue;                                                        \
+        while (a0 != a1b0 && a1b0 != b1)                                   \
+          if (!(LIST_ORDERED_KEY(a1b0, TYPE, MEMBER, KEY)                  \
+                < LIST_ORDERED_KEY(a0, TYPE, MEMBER, KEY)))                \
+            a0 = a0->next;                                                 \
+          else                                                             \
+          {                                                                \
+            a1b0 = a1b0->next;                                             \
+            list_splice(a0, a1b0->prev, a1b0);                             \
+          }                                                                \
+      }                                                                    \
+    } while (run_cnt > 1);                                                 \
+  }
+
+/* Counted list.
+
+   A struct clist is a list that also keeps count of its
+   elements, so that clist_size() runs in constant time, for
+   lists whose length is wanted often: queues whose depth steers a
+   policy, or is reported in statistics.  Elements must be added
+   and removed only with the clist_*() functions, which take the
+   list as well as the element.  Anything else, such as
+   iteration, uses the list_*() functions on the embedded LIST. */
+struct clist
+{
+  struct list list; /* Elements. */
+  size_t cnt;       /* Number of elements. */
+};
+
+/* Initializes counted list NAME, like LIST_INITIALIZER. */
+#define CLIST_INITIALIZER(NAME)      \
+  {                                  \
+    LIST_INITIALIZER((NAME).list), 0 \
+  }
+
+void clist_init(struct clist *);
+void clist_insert(struct clist *, struct list_elem *before,
+                  struct list_elem *);
+void clist_push_front(struct clist *, struct list_elem *);
+void clist_push_back(struct clist *, struct list_elem *);
+struct list_elem *clist_remove(struct clist *, struct list_elem *);
+struct list_elem *clist_pop_front(struct clist *);
+struct list_elem *clist_pop_back(struct clist *);
+size_t clist_size(const struct clist *);
+bool clist_empty(const struct clist *);
+
 #endif /* lib/kernel/list.h */
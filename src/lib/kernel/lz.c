@@ -0,0 +1,193 @@
+/* LZ77 compression.
+
+   See lz.h for basic information and the encoding. */
+
+#include "lz.h"
+#include <string.h>
+#include "../debug.h"
+
+/* Shortest copy worth encoding. */
+#define MIN_MATCH 4
+
+/* Returns the 4 bytes at P as a 32-bit number. */
+static inline uint32_t
+read32 (const uint8_t *p) 
+{
+  uint32_t x;
+  memcpy (&x, p, sizeof x);
+  return x;
+}
+
+/* Returns the hash table slot for the 4 bytes at P. */
+static inline size_t
+hash_pos (const uint8_t *p) 
+{
+  return (read32 (p) * 2654435761u) >> (32 - LZ_TABLE_BITS);
+}
+
+/* Returns the number of bytes needed to extend a length of LEN
+   beyond what a token holds. */
+static inline size_t
+ext_size (size_t len) 
+{
+  return len >= 15 ? (len - 15) / 255 + 1 : 0;
+}
+
+/* Writes the extension bytes of length LEN at *OP, advancing *OP. */
+static void
+put_ext (uint8_t **op, size_t len) 
+{
+  if (len < 15)
+    return;
+  for (len -= 15; len >= 255; len -= 255)
+    *(*op)++ = 255;
+  *(*op)++ = len;
+}
+
+/* Appends to *OP, which may not pass END, a sequence of the
+   LIT_CNT literals at LIT followed, if MATCH_LEN is nonzero, by a
+   copy of MATCH_LEN bytes from DISTANCE bytes back.  Returns
+   false if the sequence does not fit. */
+static bool
+put_sequence (uint8_t **op, uint8_t *end, const uint8_t *lit,
+              size_t lit_cnt, size_t distance, size_t match_len) 
+{
+  size_t code = match_len > 0 ? match_len - MIN_MATCH : 0;
+  size_t need = 1 + ext_size (lit_cnt) + lit_cnt;
+  uint8_t *p = *op;
+
+  if (match_len > 0)
+    need += 2 + ext_size (code);
+  if (need > (size_t) (end - p))
+    return false;
+
+  *p++ = ((lit_cnt < 15 ? lit_cnt : 15) << 4) | (code < 15 ? code : 15);
+  put_ext (&p, lit_cnt);
+  memcpy (p, lit, lit_cnt);
+  p += lit_cnt;
+  if (match_len > 0)
+    {
+      *p++ = distance & 0xff;
+      *p++ = distance >> 8;
+      put_ext (&p, code);
+    }
+  *op = p;
+  return true;
+}
+
+/* Compresses the SRC_SIZE bytes at SRC, at most LZ_INPUT_MAX, into
+   the DST_SIZE bytes at DST, using TABLE, whose contents need not
+   be initialized, to find repeats.  Returns the compressed size,
+   or 0 if it would exceed DST_SIZE. */
+size_t
+lz_compress (const void *src_, size_t src_size, void *dst_,
+             size_t dst_size, uint16_t table[LZ_TABLE_SIZE]) 
+{
+  const uint8_t *src = src_;
+  const uint8_t *end = src + src_size;
+  const uint8_t *ip = src;
+  const uint8_t *anchor = src;
+  uint8_t *dst = dst_;
+  uint8_t *op = dst;
+
+  ASSERT (src_size <= LZ_INPUT_MAX);
+
+  /* Stale entries are harmless: every candidate is checked. */
+  memset (table, 0, LZ_TABLE_SIZE * sizeof *table);
+  while (end - ip >= MIN_MATCH)
+    {
+      size_t h = hash_pos (ip);
+      const uint8_t *ref = src + table[h];
+      size_t len;
+
+      table[h] = ip - src;
+      if (ref >= ip || read32 (ref) != read32 (ip))
+        {
+          ip++;
+          continue;
+        }
+
+      for (len = MIN_MATCH; ip + len < end && ref[len] == ip[len]; len++)
+        continue;
+      if (!put_sequence (&op, dst + dst_size, anchor, ip - anchor,
+                         ip - ref, len))
+        return 0;
+      ip += len;
+      anchor = ip;
+    }
+
+  if (!put_sequence (&op, dst + dst_size, anchor, end - anchor, 0, 0))
+    return 0;
+  return op - dst;
+}
+
+/* Reads an extended length from *IP, which may not pass END, and
+   adds it to *LEN.  Returns false if the input ends first. */
+static bool
+get_ext (const uint8_t **ip, const uint8_t *end, size_t *len) 
+{
+  uint8_t b;
+
+  if (*len < 15)
+    return true;
+  do
+    {
+      if (*ip >= end)
+        return false;
+      b = *(*ip)++;
+      *len += b;
+    }
+  while (b == 255);
+  return true;
+}
+
+/* Decompresses the SRC_SIZE bytes at SRC, which lz_compress()
+   produced, into the DST_SIZE bytes at DST.  Returns true if
+   successful, false if the data is corrupt or does not expand to
+   exactly DST_SIZE bytes. */
+bool
+lz_decompress (const void *src_, size_t src_size, void *dst_,
+               size_t dst_size) 
+{
+  const uint8_t *ip = src_;
+  const uint8_t *iend = ip + src_size;
+  uint8_t *dst = dst_;
+  uint8_t *op = dst;
+  uint8_t *oend = dst + dst_size;
+
+  while (ip < iend)
+    {
+      uint8_t token = *ip++;
+      size_t lit_cnt = token >> 4;
+      size_t len = token & 15;
+      size_t distance;
+      const uint8_t *ref;
+
+      if (!get_ext (&ip, iend, &lit_cnt)
+          || lit_cnt > (size_t) (iend - ip)
+          || lit_cnt > (size_t) (oend - op))
+        return false;
+      memcpy (op, ip, lit_cnt);
+      op += lit_cnt;
+      ip += lit_cnt;
+      if (ip == iend)
+        break;
+
+      if (iend - ip < 2)
+        return false;
+      distance = ip[0] | (ip[1] << 8);
+      ip += 2;
+      if (!get_ext (&ip, iend, &len))
+        return false;
+      len += MIN_MATCH;
+      if (distance == 0 || distance > (size_t) (op - dst)
+          || len > (size_t) (oend - op))
+        return false;
+
+      /* The copy may overlap its own output, so go a byte at a
+         time. */
+      for (ref = op - distance; len > 0; len--)
+        *op++ = *ref++;
+    }
+  return op == oend;
+}
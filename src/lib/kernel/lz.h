@@ -0,0 +1,40 @@
+#ifndef __LIB_KERNEL_LZ_H
+#define __LIB_KERNEL_LZ_H
+
+/* LZ77 compression.
+
+   A small, fast compressor in the style of LZ4, for data that
+   the kernel keeps in memory for a while, such as evicted pages.
+   It finds repeats of 4 or more bytes through a hash table of
+   recent positions and encodes the data as a series of literal
+   runs, each but the last followed by a copy of earlier output.
+   Compression and decompression both run in a single pass
+   without allocating memory; the caller supplies the hash table.
+
+   Each sequence is a token byte, whose high 4 bits give the
+   literal run's length and whose low 4 bits give the copy's
+   length minus 4, then the literals, then the copy's distance
+   back as 2 bytes, least significant first.  A length of 15 in
+   the token continues in the following bytes, each added to it,
+   up to the first byte less than 255.  The last sequence ends
+   after its literals. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Number of entries in the hash table passed to lz_compress(). */
+#define LZ_TABLE_BITS 10
+#define LZ_TABLE_SIZE (1 << LZ_TABLE_BITS)
+
+/* Most bytes lz_compress() takes at once: copy distances must fit
+   in 16 bits. */
+#define LZ_INPUT_MAX 65535
+
+size_t lz_compress (const void *src, size_t src_size,
+                    void *dst, size_t dst_size,
+                    uint16_t table[LZ_TABLE_SIZE]);
+bool lz_decompress (const void *src, size_t src_size,
+                    void *dst, size_t dst_size);
+
+#endif /* lib/kernel/lz.h */
@@ -0,0 +1,391 @@
+/* Open-addressing hash table.
+
+   See ohash.h for basic information. */
+
+#include "ohash.h"
+#include "../debug.h"
+#include "threads/malloc.h"
+
+/* Initial number of slots. */
+#define INITIAL_SLOTS 8
+
+/* Number of old slots moved to the new array by each insertion
+   or deletion while the table grows.  The table grows when it is
+   3/4 full and doubles, so moving 4 slots per operation finishes
+   long before the new array fills up in turn. */
+#define MOVE_SLOTS 4
+
+static struct ohash_slot *find_slot (struct ohash *, struct ohash_slot *,
+                                     size_t slot_cnt, unsigned hash,
+                                     struct ohash_elem *);
+static void insert_slot (struct ohash_slot *, size_t slot_cnt,
+                         unsigned hash, struct ohash_elem *);
+static void remove_slot (struct ohash_slot *, size_t slot_cnt,
+                         struct ohash_slot *);
+static bool grow (struct ohash *);
+static void move_slots (struct ohash *, size_t cnt);
+
+/* Initializes hash table H to compute hash values using HASH and
+   compare hash elements using LESS, given auxiliary data AUX. */
+bool
+ohash_init (struct ohash *h,
+            ohash_hash_func *hash, ohash_less_func *less, void *aux) 
+{
+  h->elem_cnt = 0;
+  h->slot_cnt = INITIAL_SLOTS;
+  h->slots = calloc (h->slot_cnt, sizeof *h->slots);
+  h->old_slot_cnt = 0;
+  h->old_slots = NULL;
+  h->move_idx = h->move_left = 0;
+  h->hash = hash;
+  h->less = less;
+  h->aux = aux;
+  return h->slots != NULL;
+}
+
+/* Calls ACTION, if it is non-null, for each element in the
+   SLOT_CNT slots in SLOTS and empties them. */
+static void
+clear_slots (struct ohash *h, struct ohash_slot *slots, size_t slot_cnt,
+             ohash_action_func *action) 
+{
+  size_t i;
+
+  for (i = 0; i < slot_cnt; i++) 
+    {
+      struct ohash_elem *e = slots[i].elem;
+      if (e != NULL) 
+        {
+          slots[i].elem = NULL;
+          if (action != NULL)
+            action (e, h->aux);
+        }
+    }
+}
+
+/* Removes all the elements from H.
+   
+   If DESTRUCTOR is non-null, then it is called for each element
+   in the hash.  DESTRUCTOR may, if appropriate, deallocate the
+   memory used by the hash element.  However, modifying hash
+   table H while ohash_clear() is running, using any of the
+   functions ohash_clear(), ohash_destroy(), ohash_insert(), or
+   ohash_delete(), yields undefined behavior, whether done in
+   DESTRUCTOR or elsewhere. */
+void
+ohash_clear (struct ohash *h, ohash_action_func *destructor) 
+{
+  clear_slots (h, h->slots, h->slot_cnt, destructor);
+  if (h->old_slots != NULL) 
+    {
+      clear_slots (h, h->old_slots, h->old_slot_cnt, destructor);
+      free (h->old_slots);
+      h->old_slots = NULL;
+      h->old_slot_cnt = h->move_idx = h->move_left = 0;
+    }
+  h->elem_cnt = 0;
+}
+
+/* Destroys hash table H.
+
+   If DESTRUCTOR is non-null, then it is first called for each
+   element in the hash.  DESTRUCTOR may, if appropriate,
+   deallocate the memory used by the hash element.  However,
+   modifying hash table H while ohash_clear() is running, using
+   any of the functions ohash_clear(), ohash_destroy(),
+   ohash_insert(), or ohash_delete(), yields undefined behavior,
+   whether done in DESTRUCTOR or elsewhere. */
+void
+ohash_destroy (struct ohash *h, ohash_action_func *destructor) 
+{
+  ohash_clear (h, destructor);
+  free (h->slots);
+}
+
+/* Inserts NEW into hash table H and returns a null pointer, if
+   no equal element is already in the table.
+   If an equal element is already in the table, returns it
+   without inserting NEW.
+   If the table is too full to take NEW and cannot grow, returns
+   NEW itself without inserting it. */
+struct ohash_elem *
+ohash_insert (struct ohash *h, struct ohash_elem *new) 
+{
+  unsigned hash = h->hash (new, h->aux);
+  struct ohash_slot *s;
+
+  s = find_slot (h, h->slots, h->slot_cnt, hash, new);
+  if (s == NULL && h->old_slots != NULL)
+    s = find_slot (h, h->old_slots, h->old_slot_cnt, hash, new);
+  if (s != NULL)
+    return s->elem;
+
+  /* Grow at 3/4 full.  If memory is short, carry on at a higher
+     load, but always leave one slot empty so that every probe
+     sequence ends. */
+  if ((h->elem_cnt + 1) * 4 > h->slot_cnt * 3
+      && !grow (h) && h->elem_cnt + 1 >= h->slot_cnt)
+    return new;
+
+  insert_slot (h->slots, h->slot_cnt, hash, new);
+  h->elem_cnt++;
+  move_slots (h, MOVE_SLOTS);
+  return NULL;
+}
+
+/* Finds and returns an element equal to E in hash table H, or a
+   null pointer if no equal element exists in the table. */
+struct ohash_elem *
+ohash_find (struct ohash *h, struct ohash_elem *e) 
+{
+  unsigned hash = h->hash (e, h->aux);
+  struct ohash_slot *s;
+
+  s = find_slot (h, h->slots, h->slot_cnt, hash, e);
+  if (s == NULL && h->old_slots != NULL)
+    s = find_slot (h, h->old_slots, h->old_slot_cnt, hash, e);
+  return s != NULL ? s->elem : NULL;
+}
+
+/* Finds, removes, and returns an element equal to E in hash
+   table H.  Returns a null pointer if no equal element existed
+   in the table.
+
+   If the elements of the hash table are dynamically allocated,
+   or own resources that are, then it is the caller's
+   responsibility to deallocate them. */
+struct ohash_elem *
+ohash_delete (struct ohash *h, struct ohash_elem *e) 
+{
+  unsigned hash = h->hash (e, h->aux);
+  struct ohash_elem *found;
+  struct ohash_slot *s;
+
+  s = find_slot (h, h->slots, h->slot_cnt, hash, e);
+  if (s != NULL) 
+    {
+      found = s->elem;
+      remove_slot (h->slots, h->slot_cnt, s);
+    }
+  else if (h->old_slots != NULL
+           && (s = find_slot (h, h->old_slots, h->old_slot_cnt,
+                              hash, e)) != NULL) 
+    {
+      found = s->elem;
+      remove_slot (h->old_slots, h->old_slot_cnt, s);
+    }
+  else
+    return NULL;
+
+  h->elem_cnt--;
+  move_slots (h, MOVE_SLOTS);
+  return found;
+}
+
+/* Calls ACTION for each element in the SLOT_CNT slots in SLOTS. */
+static void
+apply_slots (struct ohash *h, struct ohash_slot *slots, size_t slot_cnt,
+             ohash_action_func *action) 
+{
+  size_t i;
+
+  for (i = 0; i < slot_cnt; i++)
+    if (slots[i].elem != NULL)
+      action (slots[i].elem, h->aux);
+}
+
+/* Calls ACTION for each element in hash table H in arbitrary
+   order. 
+   Modifying hash table H while ohash_apply() is running, using
+   any of the functions ohash_clear(), ohash_destroy(),
+   ohash_insert(), or ohash_delete(), yields undefined behavior,
+   whether done from ACTION or elsewhere. */
+void
+ohash_apply (struct ohash *h, ohash_action_func *action) 
+{
+  ASSERT (action != NULL);
+
+  apply_slots (h, h->slots, h->slot_cnt, action);
+  if (h->old_slots != NULL)
+    apply_slots (h, h->old_slots, h->old_slot_cnt, action);
+}
+
+/* Returns the number of elements in H. */
+size_t
+ohash_size (struct ohash *h) 
+{
+  return h->elem_cnt;
+}
+
+/* Returns true if H contains no elements, false otherwise. */
+bool
+ohash_empty (struct ohash *h) 
+{
+  return h->elem_cnt == 0;
+}
+
+/* Returns the distance of slot IDX, holding an element with
+   hash value HASH, from that element's home slot, in a table of
+   SLOT_CNT slots. */
+static inline size_t
+probe_dist (size_t idx, unsigned hash, size_t slot_cnt) 
+{
+  return (idx - hash) & (slot_cnt - 1);
+}
+
+/* Searches the SLOT_CNT slots in SLOTS, which belong to H, for a
+   slot holding an element equal to E, whose hash value is HASH.
+   Returns the slot if found, otherwise a null pointer.
+
+   The search stops at an empty slot, or at a slot whose element
+   is closer to its home than E would be there: Robin Hood
+   insertion would have put E in that slot. */
+static struct ohash_slot *
+find_slot (struct ohash *h, struct ohash_slot *slots, size_t slot_cnt,
+           unsigned hash, struct ohash_elem *e) 
+{
+  size_t mask = slot_cnt - 1;
+  size_t idx, dist;
+
+  for (idx = hash & mask, dist = 0; ; idx = (idx + 1) & mask, dist++) 
+    {
+      struct ohash_slot *s = &slots[idx];
+      if (s->elem == NULL || probe_dist (idx, s->hash, slot_cnt) < dist)
+        return NULL;
+      if (s->hash == hash
+          && !h->less (s->elem, e, h->aux) && !h->less (e, s->elem, h->aux))
+        return s;
+    }
+}
+
+/* Inserts E, whose hash value is HASH, into the SLOT_CNT slots
+   in SLOTS, at least one of which must be empty.  Along the way,
+   E takes the slot of any element closer to its home than E is
+   to its own, and that element continues the search instead. */
+static void
+insert_slot (struct ohash_slot *slots, size_t slot_cnt,
+             unsigned hash, struct ohash_elem *e) 
+{
+  size_t mask = slot_cnt - 1;
+  size_t idx, dist;
+
+  for (idx = hash & mask, dist = 0; ; idx = (idx + 1) & mask, dist++) 
+    {
+      struct ohash_slot *s = &slots[idx];
+      size_t s_dist;
+
+      if (s->elem == NULL) 
+        {
+          s->hash = hash;
+          s->elem = e;
+          return;
+        }
+
+      s_dist = probe_dist (idx, s->hash, slot_cnt);
+      if (s_dist < dist) 
+        {
+          struct ohash_slot displaced = *s;
+          s->hash = hash;
+          s->elem = e;
+          hash = displaced.hash;
+          e = displaced.elem;
+          dist = s_dist;
+        }
+    }
+}
+
+/* Empties slot S among the SLOT_CNT slots in SLOTS, shifting the
+   rest of its probe sequence back by one slot so that no search
+   stops early at the hole. */
+static void
+remove_slot (struct ohash_slot *slots, size_t slot_cnt,
+             struct ohash_slot *s) 
+{
+  size_t mask = slot_cnt - 1;
+  size_t idx = s - slots;
+
+  for (;;) 
+    {
+      size_t next_idx = (idx + 1) & mask;
+      struct ohash_slot *next = &slots[next_idx];
+
+      if (next->elem == NULL
+          || probe_dist (next_idx, next->hash, slot_cnt) == 0)
+        break;
+      slots[idx] = *next;
+      idx = next_idx;
+    }
+  slots[idx].elem = NULL;
+}
+
+/* Starts doubling the size of H, first finishing any previous
+   growth still in progress.  Elements move to the new array
+   gradually, in move_slots().  Returns true if successful, false
+   if out of memory. */
+static bool
+grow (struct ohash *h) 
+{
+  struct ohash_slot *new_slots;
+  size_t new_slot_cnt = h->slot_cnt * 2;
+
+  if (h->old_slots != NULL)
+    move_slots (h, h->old_slot_cnt);
+  if (new_slot_cnt <= h->slot_cnt)
+    return false;
+  new_slots = calloc (new_slot_cnt, sizeof *new_slots);
+  if (new_slots == NULL)
+    return false;
+
+  h->old_slots = h->slots;
+  h->old_slot_cnt = h->slot_cnt;
+  h->slots = new_slots;
+  h->slot_cnt = new_slot_cnt;
+
+  /* Start moving at an empty slot.  See move_slots(). */
+  for (h->move_idx = 0; h->old_slots[h->move_idx].elem != NULL;
+       h->move_idx++)
+    continue;
+  h->move_left = h->old_slot_cnt;
+  return true;
+}
+
+/* If H is growing, moves at least CNT slots' worth of elements
+   from the old array to the new one, then frees the old array if
+   it is empty.
+
+   Searches of the old array stop at an empty slot, so emptying
+   part of a cluster of full slots could hide the rest of it.
+   Thus, moving starts just past an empty slot and always
+   continues to the end of the cluster it is in, so that the part
+   of the old array still to be moved is made up of whole
+   clusters. */
+static void
+move_slots (struct ohash *h, size_t cnt) 
+{
+  size_t mask = h->old_slot_cnt - 1;
+
+  if (h->old_slots == NULL)
+    return;
+
+  while (h->move_left > 0
+         && (cnt > 0 || h->old_slots[h->move_idx].elem != NULL)) 
+    {
+      struct ohash_slot *s = &h->old_slots[h->move_idx];
+      if (s->elem != NULL) 
+        {
+          insert_slot (h->slots, h->slot_cnt, s->hash, s->elem);
+          s->elem = NULL;
+        }
+      h->move_idx = (h->move_idx + 1) & mask;
+      h->move_left--;
+      if (cnt > 0)
+        cnt--;
+    }
+
+  if (h->move_left == 0) 
+    {
+      free (h->old_slots);
+      h->old_slots = NULL;
+      h->old_slot_cnt = h->move_idx = 0;
+    }
+}
@@ -0,0 +1,112 @@
+#ifndef __LIB_KERNEL_OHASH_H
+#define __LIB_KERNEL_OHASH_H
+
+/* Open-addressing hash table.
+
+   An alternative to the chained hash table in hash.h for tables
+   that are searched far more often than they change.  Instead of
+   an array of lists, the table is a single array of slots, each
+   holding an element's hash value and a pointer to the element.
+   A lookup probes consecutive slots, comparing hash values
+   stored right in the array, and follows a pointer only on a
+   match, so most lookups touch one or two cache lines.
+
+   Collisions are resolved by linear probing with Robin Hood
+   insertion: an element being inserted takes the slot of any
+   element closer to its home slot than itself, which keeps probe
+   sequences short and lets a search give up as soon as it passes
+   where the element would have to be.  Deletion shifts the rest
+   of the probe sequence back by one slot, so no tombstones
+   accumulate.
+
+   When the table gets three-quarters full, it doubles, but the
+   elements move to the new array a few at a time over the next
+   insertions and deletions, so that no single insertion pays for
+   rehashing the whole table.
+
+   As in hash.h, elements are not allocated by the table: each
+   structure that can be in an ohash embeds a struct ohash_elem,
+   and ohash_entry() converts back to the containing structure. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Hash element.
+
+   It holds no data: the table keeps each element's hash value
+   next to the pointer to it.  It is only a place for the table
+   to point at, from which ohash_entry() finds the containing
+   structure. */
+struct ohash_elem 
+  {
+  };
+
+/* Converts pointer to hash element OHASH_ELEM into a pointer to
+   the structure that OHASH_ELEM is embedded inside.  Supply the
+   name of the outer structure STRUCT and the member name MEMBER
+   of the hash element. */
+#define ohash_entry(OHASH_ELEM, STRUCT, MEMBER)                 \
+        ((STRUCT *) ((uint8_t *) (OHASH_ELEM)                   \
+                     - offsetof (STRUCT, MEMBER)))
+
+/* Computes and returns the hash value for hash element E, given
+   auxiliary data AUX. */
+typedef unsigned ohash_hash_func (const struct ohash_elem *e, void *aux);
+
+/* Compares the value of two hash elements A and B, given
+   auxiliary data AUX.  Returns true if A is less than B, or
+   false if A is greater than or equal to B. */
+typedef bool ohash_less_func (const struct ohash_elem *a,
+                              const struct ohash_elem *b,
+                              void *aux);
+
+/* Performs some operation on hash element E, given auxiliary
+   data AUX. */
+typedef void ohash_action_func (struct ohash_elem *e, void *aux);
+
+/* A slot in an ohash. */
+struct ohash_slot
+  {
+    unsigned hash;              /* Hash value of ELEM. */
+    struct ohash_elem *elem;    /* Element, or null if empty. */
+  };
+
+/* Open-addressing hash table. */
+struct ohash 
+  {
+    size_t elem_cnt;            /* Number of elements in table. */
+    size_t slot_cnt;            /* Number of slots, a power of 2. */
+    struct ohash_slot *slots;   /* Array of `slot_cnt' slots. */
+
+    /* While the table grows, the old array, whose elements are
+       still moving to SLOTS. */
+    size_t old_slot_cnt;        /* Number of old slots. */
+    struct ohash_slot *old_slots; /* Old array, or null. */
+    size_t move_idx;            /* Next old slot to move. */
+    size_t move_left;           /* Number of old slots left to move. */
+
+    ohash_hash_func *hash;      /* Hash function. */
+    ohash_less_func *less;      /* Comparison function. */
+    void *aux;                  /* Auxiliary data for `hash' and `less'. */
+  };
+
+/* Basic life cycle. */
+bool ohash_init (struct ohash *, ohash_hash_func *, ohash_less_func *,
+                 void *aux);
+void ohash_clear (struct ohash *, ohash_action_func *);
+void ohash_destroy (struct ohash *, ohash_action_func *);
+
+/* Search, insertion, deletion. */
+struct ohash_elem *ohash_insert (struct ohash *, struct ohash_elem *);
+struct ohash_elem *ohash_find (struct ohash *, struct ohash_elem *);
+struct ohash_elem *ohash_delete (struct ohash *, struct ohash_elem *);
+
+/* Iteration. */
+void ohash_apply (struct ohash *, ohash_action_func *);
+
+/* Information. */
+size_t ohash_size (struct ohash *);
+bool ohash_empty (struct ohash *);
+
+#endif /* lib/kernel/ohash.h */
@@ -0,0 +1,185 @@
+/* Pairing heap.
+
+   See pheap.h for basic information.
+
+   Each element's children form a doubly linked list, threaded
+   through NEXT and PREV, with the first child's PREV pointing to
+   the parent instead.  Thus, an element can be cut out of the
+   tree in O(1) time given only a pointer to it. */
+
+#include "pheap.h"
+#include "../debug.h"
+
+/* Returns the root of a single heap made by combining the heaps
+   rooted at A and B, either of which may be null.  The smaller
+   root becomes the first child of the larger one. */
+static struct pheap_elem *
+meld (struct pheap *h, struct pheap_elem *a, struct pheap_elem *b) 
+{
+  if (a == NULL)
+    return b;
+  if (b == NULL)
+    return a;
+  if (h->less (a, b, h->aux)) 
+    {
+      struct pheap_elem *t = a;
+      a = b;
+      b = t;
+    }
+
+  b->prev = a;
+  b->next = a->child;
+  if (a->child != NULL)
+    a->child->prev = b;
+  a->child = b;
+  a->next = a->prev = NULL;
+  return a;
+}
+
+/* Combines the list of sibling subtrees starting at FIRST into a
+   single heap and returns its root, or a null pointer if FIRST is
+   null.  This is the standard two-pass pairing: melding adjacent
+   pairs from left to right, then melding the results from right
+   to left, which is what gives removal its O(lg n) amortized
+   bound. */
+static struct pheap_elem *
+merge_pairs (struct pheap *h, struct pheap_elem *first) 
+{
+  struct pheap_elem *pairs = NULL;
+  struct pheap_elem *root = NULL;
+
+  /* First pass: meld pairs, pushing each result on PAIRS, which
+     is linked through NEXT. */
+  while (first != NULL) 
+    {
+      struct pheap_elem *a = first;
+      struct pheap_elem *b = a->next;
+      struct pheap_elem *pair;
+
+      first = b != NULL ? b->next : NULL;
+      a->next = a->prev = NULL;
+      if (b != NULL)
+        b->next = b->prev = NULL;
+      pair = meld (h, a, b);
+      pair->next = pairs;
+      pairs = pair;
+    }
+
+  /* Second pass: meld the pairs, last first. */
+  while (pairs != NULL) 
+    {
+      struct pheap_elem *pair = pairs;
+      pairs = pair->next;
+      pair->next = NULL;
+      root = meld (h, root, pair);
+    }
+  return root;
+}
+
+/* Cuts E, which must not be the root, and its subtree out of
+   the tree that contains it. */
+static void
+cut (struct pheap_elem *e) 
+{
+  ASSERT (e->prev != NULL);
+
+  if (e->prev->child == e)
+    e->prev->child = e->next;
+  else
+    e->prev->next = e->next;
+  if (e->next != NULL)
+    e->next->prev = e->prev;
+  e->next = e->prev = NULL;
+}
+
+/* Initializes H as an empty heap ordered by LESS, given
+   auxiliary data AUX. */
+void
+pheap_init (struct pheap *h, pheap_less_func *less, void *aux) 
+{
+  ASSERT (h != NULL);
+  ASSERT (less != NULL);
+
+  h->root = NULL;
+  h->elem_cnt = 0;
+  h->less = less;
+  h->aux = aux;
+}
+
+/* Inserts E into H. */
+void
+pheap_insert (struct pheap *h, struct pheap_elem *e) 
+{
+  ASSERT (e != NULL);
+
+  e->child = e->next = e->prev = NULL;
+  h->root = meld (h, h->root, e);
+  h->elem_cnt++;
+}
+
+/* Removes E, which must be in H, from H. */
+void
+pheap_remove (struct pheap *h, struct pheap_elem *e) 
+{
+  ASSERT (e != NULL);
+  ASSERT (h->elem_cnt > 0);
+
+  if (e == h->root)
+    h->root = merge_pairs (h, e->child);
+  else 
+    {
+      cut (e);
+      h->root = meld (h, h->root, merge_pairs (h, e->child));
+    }
+  e->child = NULL;
+  h->elem_cnt--;
+}
+
+/* Removes and returns the maximum element of H, or returns a null
+   pointer if H is empty. */
+struct pheap_elem *
+pheap_pop (struct pheap *h) 
+{
+  struct pheap_elem *e = h->root;
+
+  if (e != NULL)
+    pheap_remove (h, e);
+  return e;
+}
+
+/* Restores H's order after element E's key became greater.
+   E's subtree is still in order, so it only needs to be cut out
+   and melded with the root. */
+void
+pheap_raise (struct pheap *h, struct pheap_elem *e) 
+{
+  ASSERT (e != NULL);
+
+  if (e != h->root) 
+    {
+      cut (e);
+      h->root = meld (h, h->root, e);
+    }
+}
+
+/* Returns the maximum element of H, or a null pointer if H is
+   empty. */
+struct pheap_elem *
+pheap_top (const struct pheap *h) 
+{
+  return h->root;
+}
+
+/* Returns the number of elements in H. */
+size_t
+pheap_size (const struct pheap *h) 
+{
+  return h->elem_cnt;
+}
+
+/* Returns true if H is empty, false otherwise. */
+bool
+pheap_empty (const struct pheap *h) 
+{
+  return h->root == NULL;
+}
@@ -0,0 +1,83 @@
+#ifndef __LIB_KERNEL_PHEAP_H
+#define __LIB_KERNEL_PHEAP_H
+
+/* Pairing heap.
+
+   A priority queue that always knows its maximum element, as
+   determined by a comparison function.  Insertion, finding the
+   maximum, and raising an element's key take O(1) time; removing
+   the maximum or an arbitrary element takes O(lg n) amortized
+   time.  Compare list_max(), which takes O(n) time on every
+   call.
+
+   Like struct list, the heap does not allocate memory.  Each
+   structure that can be in a heap embeds a struct pheap_elem
+   member, and pheap_entry() converts a struct pheap_elem back to
+   the structure that contains it.
+
+   An element's key must not change while it is in a heap, except
+   through pheap_raise() for a change that makes it greater.  To
+   make a key smaller, remove the element, change the key, and
+   insert it again.
+
+   Elements with equal keys come out in no particular order.  A
+   heap that must be fair among equal keys should break ties in
+   its comparison function, e.g. with a sequence number.
+
+   Pairing heaps are described in Fredman et al., "The Pairing
+   Heap: A New Form of Self-Adjusting Heap", Algorithmica 1(1),
+   1986. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Heap element. */
+struct pheap_elem 
+  {
+    struct pheap_elem *child;   /* First child, or null. */
+    struct pheap_elem *next;    /* Next sibling, or null. */
+    struct pheap_elem *prev;    /* Previous sibling, or parent if the
+                                   first child, or null if the root. */
+  };
+
+/* Converts pointer to heap element PHEAP_ELEM into a pointer to
+   the structure that PHEAP_ELEM is embedded inside.  Supply the
+   name of the outer structure STRUCT and the member name MEMBER
+   of the heap element. */
+#define pheap_entry(PHEAP_ELEM, STRUCT, MEMBER)                 \
+        ((STRUCT *) ((uint8_t *) &(PHEAP_ELEM)->child           \
+                     - offsetof (STRUCT, MEMBER.child)))
+
+/* Compares the value of two heap elements A and B, given
+   auxiliary data AUX.  Returns true if A is less than B, or
+   false if A is greater than or equal to B. */
+typedef bool pheap_less_func (const struct pheap_elem *a,
+                              const struct pheap_elem *b,
+                              void *aux);
+
+/* Pairing heap. */
+struct pheap 
+  {
+    struct pheap_elem *root;    /* Maximum element, or null if empty. */
+    size_t elem_cnt;            /* Number of elements. */
+    pheap_less_func *less;      /* Comparison function. */
+    void *aux;                  /* Auxiliary data for `less'. */
+  };
+
+void pheap_init (struct pheap *, pheap_less_func *, void *aux);
+
+/* Insertion and removal. */
+void pheap_insert (struct pheap *, struct pheap_elem *);
+void pheap_remove (struct pheap *, struct pheap_elem *);
+struct pheap_elem *pheap_pop (struct pheap *);
+
+/* Keys. */
+void pheap_raise (struct pheap *, struct pheap_elem *);
+
+/* Properties. */
+struct pheap_elem *pheap_top (const struct pheap *);
+size_t pheap_size (const struct pheap *);
+bool pheap_empty (const struct pheap *);
+
+#endif /* lib/kernel/pheap.h */
@@ -0,0 +1,393 @@
+/* Red-black tree.
+
+   See rbtree.h for basic information.  The algorithms follow
+   Cormen et al., _Introduction to Algorithms_, chapter 13, except
+   that missing children are null pointers instead of a shared
+   sentinel node, so that a tree is usable without one.  Null
+   children count as black. */
+
+#include "rbtree.h"
+#include "../debug.h"
+
+static void rotate_left (struct rb_tree *, struct rb_node *);
+static void rotate_right (struct rb_tree *, struct rb_node *);
+static void insert_fixup (struct rb_tree *, struct rb_node *);
+static void erase_fixup (struct rb_tree *, struct rb_node *,
+                         struct rb_node *parent);
+
+/* Initializes TREE as an empty tree ordered by LESS, given
+   auxiliary data AUX. */
+void
+rb_init (struct rb_tree *tree, rb_less_func *less, void *aux) 
+{
+  ASSERT (tree != NULL);
+  ASSERT (less != NULL);
+
+  tree->root = NULL;
+  tree->less = less;
+  tree->aux = aux;
+}
+
+/* Returns true if node N is red, false if it is black or
+   null. */
+static inline bool
+is_red (const struct rb_node *n) 
+{
+  return n != NULL && n->red;
+}
+
+/* Returns the leftmost node in the subtree rooted at N. */
+static struct rb_node *
+leftmost (struct rb_node *n) 
+{
+  while (n->left != NULL)
+    n = n->left;
+  return n;
+}
+
+/* Returns the rightmost node in the subtree rooted at N. */
+static struct rb_node *
+rightmost (struct rb_node *n) 
+{
+  while (n->right != NULL)
+    n = n->right;
+  return n;
+}
+
+/* Makes NEW take OLD's place as a child of PARENT, or as the root
+   of TREE if PARENT is null.  Does not update NEW->parent. */
+static void
+change_child (struct rb_tree *tree, struct rb_node *parent,
+              struct rb_node *old, struct rb_node *new) 
+{
+  if (parent == NULL)
+    tree->root = new;
+  else if (parent->left == old)
+    parent->left = new;
+  else
+    parent->right = new;
+}
+
+/* Inserts node N into TREE, after any nodes equal to it. */
+void
+rb_insert (struct rb_tree *tree, struct rb_node *n) 
+{
+  struct rb_node **link = &tree->root;
+  struct rb_node *parent = NULL;
+
+  ASSERT (n != NULL);
+
+  while (*link != NULL) 
+    {
+      parent = *link;
+      if (tree->less (n, parent, tree->aux))
+        link = &parent->left;
+      else
+        link = &parent->right;
+    }
+
+  n->parent = parent;
+  n->left = n->right = NULL;
+  n->red = true;
+  *link = n;
+  insert_fixup (tree, n);
+}
+
+/* Removes node N from TREE. */
+void
+rb_erase (struct rb_tree *tree, struct rb_node *n) 
+{
+  struct rb_node *child, *parent;
+  bool removed_red;
+
+  ASSERT (n != NULL);
+
+  if (n->left == NULL || n->right == NULL) 
+    {
+      /* N has at most one child, which takes its place. */
+      child = n->left != NULL ? n->left : n->right;
+      parent = n->parent;
+      removed_red = n->red;
+      if (child != NULL)
+        child->parent = parent;
+      change_child (tree, parent, n, child);
+    }
+  else 
+    {
+      /* N has two children.  Its successor S, which has no left
+         child, takes its place, and S's right child takes S's
+         place. */
+      struct rb_node *s = leftmost (n->right);
+
+      child = s->right;
+      parent = s->parent;
+      removed_red = s->red;
+      if (parent == n)
+        parent = s;
+      else 
+        {
+          if (child != NULL)
+            child->parent = parent;
+          parent->left = child;
+          s->right = n->right;
+          s->right->parent = s;
+        }
+
+      s->left = n->left;
+      s->left->parent = s;
+      s->parent = n->parent;
+      s->red = n->red;
+      change_child (tree, n->parent, n, s);
+    }
+
+  if (!removed_red)
+    erase_fixup (tree, child, parent);
+}
+
+/* Returns the first node in TREE. */
+struct rb_node *
+rb_first (const struct rb_tree *tree) 
+{
+  return tree->root != NULL ? leftmost (tree->root) : NULL;
+}
+
+/* Returns the last node in TREE. */
+struct rb_node *
+rb_last (const struct rb_tree *tree) 
+{
+  return tree->root != NULL ? rightmost (tree->root) : NULL;
+}
+
+/* Returns the node after N in its tree. */
+struct rb_node *
+rb_next (const struct rb_node *n) 
+{
+  ASSERT (n != NULL);
+
+  if (n->right != NULL)
+    return leftmost (n->right);
+  while (n->parent != NULL && n == n->parent->right)
+    n = n->parent;
+  return n->parent;
+}
+
+/* Returns the node before N in its tree. */
+struct rb_node *
+rb_prev (const struct rb_node *n) 
+{
+  ASSERT (n != NULL);
+
+  if (n->left != NULL)
+    return rightmost (n->left);
+  while (n->parent != NULL && n == n->parent->left)
+    n = n->parent;
+  return n->parent;
+}
+
+/* Returns the first node in TREE that is not less than KEY. */
+struct rb_node *
+rb_lower_bound (const struct rb_tree *tree, const struct rb_node *key) 
+{
+  struct rb_node *n = tree->root;
+  struct rb_node *bound = NULL;
+
+  while (n != NULL)
+    if (tree->less (n, key, tree->aux))
+      n = n->right;
+    else 
+      {
+        bound = n;
+        n = n->left;
+      }
+  return bound;
+}
+
+/* Returns the first node in TREE that is greater than KEY. */
+struct rb_node *
+rb_upper_bound (const struct rb_tree *tree, const struct rb_node *key) 
+{
+  struct rb_node *n = tree->root;
+  struct rb_node *bound = NULL;
+
+  while (n != NULL)
+    if (tree->less (key, n, tree->aux)) 
+      {
+        bound = n;
+        n = n->left;
+      }
+    else
+      n = n->right;
+  return bound;
+}
+
+/* Returns true if TREE is empty, false otherwise. */
+bool
+rb_empty (const struct rb_tree *tree) 
+{
+  return tree->root == NULL;
+}
+
+/* Rotates the subtree rooted at X to the left, making X's right
+   child its root. */
+static void
+rotate_left (struct rb_tree *tree, struct rb_node *x) 
+{
+  struct rb_node *y = x->right;
+
+  x->right = y->left;
+  if (y->left != NULL)
+    y->left->parent = x;
+  y->parent = x->parent;
+  change_child (tree, x->parent, x, y);
+  y->left = x;
+  x->parent = y;
+}
+
+/* Rotates the subtree rooted at X to the right, making X's left
+   child its root. */
+static void
+rotate_right (struct rb_tree *tree, struct rb_node *x) 
+{
+  struct rb_node *y = x->left;
+
+  x->left = y->right;
+  if (y->right != NULL)
+    y->right->parent = x;
+  y->parent = x->parent;
+  change_child (tree, x->parent, x, y);
+  y->right = x;
+  x->parent = y;
+}
+
+/* Restores the red-black properties of TREE after red node N
+   was inserted, by recoloring and rotating until N's parent is
+   black. */
+static void
+insert_fixup (struct rb_tree *tree, struct rb_node *n) 
+{
+  struct rb_node *parent;
+
+  while (is_red (parent = n->parent)) 
+    {
+      /* PARENT is red, so it is not the root and N has a
+         grandparent. */
+      struct rb_node *grandparent = parent->parent;
+
+      if (parent == grandparent->left) 
+        {
+          struct rb_node *uncle = grandparent->right;
+          if (is_red (uncle)) 
+            {
+              parent->red = uncle->red = false;
+              grandparent->red = true;
+              n = grandparent;
+              continue;
+            }
+          if (n == parent->right) 
+            {
+              rotate_left (tree, parent);
+              n = parent;
+              parent = n->parent;
+            }
+          parent->red = false;
+          grandparent->red = true;
+          rotate_right (tree, grandparent);
+        }
+      else 
+        {
+          struct rb_node *uncle = grandparent->left;
+          if (is_red (uncle)) 
+            {
+              parent->red = uncle->red = false;
+              grandparent->red = true;
+              n = grandparent;
+              continue;
+            }
+          if (n == parent->left) 
+            {
+              rotate_right (tree, parent);
+              n = parent;
+              parent = n->parent;
+            }
+          parent->red = false;
+          grandparent->red = true;
+          rotate_left (tree, grandparent);
+        }
+    }
+  tree->root->red = false;
+}
+
+/* Restores the red-black properties of TREE after a black node
+   was removed from below PARENT, leaving N, which may be null,
+   in its place one black node short. */
+static void
+erase_fixup (struct rb_tree *tree, struct rb_node *n,
+             struct rb_node *parent) 
+{
+  while (n != tree->root && !is_red (n)) 
+    {
+      /* N is one black node short, so its sibling has at least
+         one black node below it and cannot be null. */
+      if (n == parent->left) 
+        {
+          struct rb_node *sibling = parent->right;
+          if (sibling->red) 
+            {
+              sibling->red = false;
+              parent->red = true;
+              rotate_left (tree, parent);
+              sibling = parent->right;
+            }
+          if (!is_red (sibling->left) && !is_red (sibling->right)) 
+            {
+              sibling->red = true;
+              n = parent;
+              parent = n->parent;
+              continue;
+            }
+          if (!is_red (sibling->right)) 
+            {
+              sibling->left->red = false;
+              sibling->red = true;
+              rotate_right (tree, sibling);
+              sibling = parent->right;
+            }
+          sibling->red = parent->red;
+          parent->red = false;
+          sibling->right->red = false;
+          rotate_left (tree, parent);
+        }
+      else 
+        {
+          struct rb_node *sibling = parent->left;
+          if (sibling->red) 
+            {
+              sibling->red = false;
+              parent->red = true;
+              rotate_right (tree, parent);
+              sibling = parent->left;
+            }
+          if (!is_red (sibling->left) && !is_red (sibling->right)) 
+            {
+              sibling->red = true;
+              n = parent;
+              parent = n->parent;
+              continue;
+            }
+          if (!is_red (sibling->left)) 
+            {
+              sibling->right->red = false;
+              sibling->red = true;
+              rotate_left (tree, sibling);
+              sibling = parent->left;
+            }
+          sibling->red = parent->red;
+          parent->red = false;
+          sibling->left->red = false;
+          rotate_right (tree, parent);
+        }
+      n = tree->root;
+    }
+  if (n != NULL)
+    n->red = false;
+}
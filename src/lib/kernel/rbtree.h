@@ -0,0 +1,114 @@
+#ifndef __LIB_KERNEL_RBTREE_H
+#define __LIB_KERNEL_RBTREE_H
+
+/* Red-black tree.
+
+   A balanced binary search tree, for ordered collections that
+   see many insertions and deletions: an insertion, deletion, or
+   search takes O(lg n) time, where keeping a struct list in
+   order with list_insert_ordered() takes O(n).
+
+   Like struct list, the tree does not allocate memory.  Each
+   structure that can be in a tree embeds a struct rb_node
+   member, and rb_entry() converts a struct rb_node back to the
+   structure that contains it:
+
+      struct foo
+        {
+          struct rb_node node;
+          int bar;
+          ...other members...
+        };
+
+      static bool
+      foo_less (const struct rb_node *a, const struct rb_node *b,
+                void *aux UNUSED)
+      {
+        return (rb_entry (a, struct foo, node)->bar
+                < rb_entry (b, struct foo, node)->bar);
+      }
+
+      struct rb_tree foo_tree;
+      struct rb_node *n;
+
+      rb_init (&foo_tree, foo_less, NULL);
+      ...
+      for (n = rb_first (&foo_tree); n != NULL; n = rb_next (n))
+        {
+          struct foo *f = rb_entry (n, struct foo, node);
+          ...do something with f...
+        }
+
+   The tree is kept in the order given by its comparison
+   function.  Equal elements are allowed; rb_insert() puts a new
+   element after any equal ones already in the tree, so equal
+   elements stay in insertion order, as with
+   list_insert_ordered().
+
+   To search, fill in the key members of a structure of the
+   element type, which need not be in the tree, and pass its
+   node to rb_lower_bound() or rb_upper_bound().
+
+   Red-black trees are described in detail in Cormen et al.,
+   _Introduction to Algorithms_, chapter 13. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Tree node. */
+struct rb_node 
+  {
+    struct rb_node *parent;     /* Parent, or null for the root. */
+    struct rb_node *left;       /* Left child, or null. */
+    struct rb_node *right;      /* Right child, or null. */
+    bool red;                   /* Red or black? */
+  };
+
+/* Converts pointer to tree node RB_NODE into a pointer to the
+   structure that RB_NODE is embedded inside.  Supply the name of
+   the outer structure STRUCT and the member name MEMBER of the
+   tree node.  See the big comment at the top of the file for an
+   example. */
+#define rb_entry(RB_NODE, STRUCT, MEMBER)                       \
+        ((STRUCT *) ((uint8_t *) &(RB_NODE)->parent             \
+                     - offsetof (STRUCT, MEMBER.parent)))
+
+/* Compares the value of two tree nodes A and B, given auxiliary
+   data AUX.  Returns true if A is less than B, or false if A is
+   greater than or equal to B. */
+typedef bool rb_less_func (const struct rb_node *a,
+                           const struct rb_node *b,
+                           void *aux);
+
+/* Red-black tree. */
+struct rb_tree 
+  {
+    struct rb_node *root;       /* Root, or null if empty. */
+    rb_less_func *less;         /* Comparison function. */
+    void *aux;                  /* Auxiliary data for `less'. */
+  };
+
+void rb_init (struct rb_tree *, rb_less_func *, void *aux);
+
+/* Insertion and removal. */
+void rb_insert (struct rb_tree *, struct rb_node *);
+void rb_erase (struct rb_tree *, struct rb_node *);
+
+/* Traversal.  Each returns a null pointer if there is no such
+   node. */
+struct rb_node *rb_first (const struct rb_tree *);
+struct rb_node *rb_last (const struct rb_tree *);
+struct rb_node *rb_next (const struct rb_node *);
+struct rb_node *rb_prev (const struct rb_node *);
+
+/* Search. */
+struct rb_node *rb_lower_bound (const struct rb_tree *,
+                                const struct rb_node *key);
+struct rb_node *rb_upper_bound (const struct rb_tree *,
+                                const struct rb_node *key);
+
+/* Properties. */
+bool rb_empty (const struct rb_tree *);
+
+#endif /* lib/kernel/rbtree.h */
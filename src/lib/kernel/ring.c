@@ -0,0 +1,225 @@
+#include "ring.h"
+#include <debug.h>
+#include <string.h>
+
+/* Keeps the compiler from moving memory accesses across it.  x86
+   orders loads with loads and stores with stores, and does not
+   move a store ahead of an earlier load, which is all a ring
+   needs of the CPU, so this is enough on SMP as well. */
+#define compiler_barrier() asm volatile ("" : : : "memory")
+
+/* Reads *P exactly once. */
+#define read_once(P) (*(volatile const unsigned *) (P))
+
+/* Returns true if X is a power of 2. */
+static inline bool
+is_power_of_2 (size_t x)
+{
+  return x != 0 && (x & (x - 1)) == 0;
+}
+
+/* Copies an element of SIZE bytes from SRC to DST. */
+static inline void
+copy_elem (void *dst, const void *src, size_t size)
+{
+  if (size == 1)
+    *(uint8_t *) dst = *(const uint8_t *) src;
+  else
+    memcpy (dst, src, size);
+}
+
+/* Initializes R to queue up to ELEM_CNT elements of ELEM_SIZE
+   bytes each in BUF, which must hold ELEM_CNT * ELEM_SIZE bytes
+   and remain allocated as long as R is in use.  ELEM_CNT must be
+   a power of 2. */
+void
+ring_init (struct ring *r, void *buf, size_t elem_cnt, size_t elem_size)
+{
+  ASSERT (r != NULL);
+  ASSERT (buf != NULL);
+  ASSERT (is_power_of_2 (elem_cnt));
+  ASSERT (elem_size > 0);
+
+  r->buf = buf;
+  r->elem_size = elem_size;
+  r->mask = elem_cnt - 1;
+  r->head = r->tail = 0;
+}
+
+/* Copies ELEM to the end of R and returns true, or returns false
+   if R is full.  Only R's producer may call this. */
+bool
+ring_put (struct ring *r, const void *elem)
+{
+  unsigned head = r->head;
+
+  if (head - read_once (&r->tail) > r->mask)
+    return false;
+  copy_elem (r->buf + (head & r->mask) * r->elem_size, elem, r->elem_size);
+
+  /* Publish the element only after it is written. */
+  compiler_barrier ();
+  r->head = head + 1;
+  return true;
+}
+
+/* Copies the element at the front of R to ELEM, removes it, and
+   returns true, or returns false if R is empty.  Only R's
+   consumer may call this. */
+bool
+ring_get (struct ring *r, void *elem)
+{
+  unsigned tail = r->tail;
+
+  if (read_once (&r->head) == tail)
+    return false;
+
+  /* Read the element only after seeing that it was published, and
+     give its slot back only after reading it. */
+  compiler_barrier ();
+  copy_elem (elem, r->buf + (tail & r->mask) * r->elem_size, r->elem_size);
+  compiler_barrier ();
+  r->tail = tail + 1;
+  return true;
+}
+
+/* Returns the number of elements in R.  The answer may be out of
+   date by the time it is used, except that R's producer knows
+   that R will not get bigger and its consumer that it will not
+   get smaller. */
+size_t
+ring_size (const struct ring *r)
+{
+  return read_once (&r->head) - read_once (&r->tail);
+}
+
+/* Returns true if R is empty, false otherwise.  See
+   ring_size(). */
+bool
+ring_empty (const struct ring *r)
+{
+  return ring_size (r) == 0;
+}
+
+/* Returns true if R is full, false otherwise.  See
+   ring_size(). */
+bool
+ring_full (const struct ring *r)
+{
+  return ring_size (r) > r->mask;
+}
+
+/* Multiple-producer rings.
+
+   Producers claim positions by advancing HEAD with a
+   compare-and-swap.  A producer that is interrupted between
+   claiming a position and filling it in must not hold up the
+   others, so each element has a sequence number that says
+   whether it is free or filled in.  Element I holds position P
+   = I (mod N) when its sequence number is P, free for a
+   producer to fill in; P + 1 once filled in, for the consumer to
+   take; and P + N once taken, free again for position P + N.
+   This is Dmitry Vyukov's bounded queue, with a single
+   consumer. */
+
+/* If *P equals OLD, sets it to NEW.  Returns true if it did. */
+static inline bool
+compare_and_swap (unsigned *p, unsigned old, unsigned new)
+{
+  unsigned prev;
+
+  asm volatile ("lock cmpxchgl %2, %1"
+                : "=a" (prev), "+m" (*p)
+                : "r" (new), "0" (old)
+                : "memory");
+  return prev == old;
+}
+
+/* Initializes R to queue up to ELEM_CNT elements of ELEM_SIZE
+   bytes each in BUF, which must hold ELEM_CNT * ELEM_SIZE bytes,
+   with ELEM_CNT sequence numbers in SEQS.  Both must remain
+   allocated as long as R is in use.  ELEM_CNT must be a power of
+   2 greater than 1: with a single element, "filled in" would
+   look the same as "free for the next position". */
+void
+mpsc_ring_init (struct mpsc_ring *r, void *buf, unsigned seqs[],
+                size_t elem_cnt, size_t elem_size)
+{
+  size_t i;
+
+  ASSERT (r != NULL);
+  ASSERT (buf != NULL);
+  ASSERT (seqs != NULL);
+  ASSERT (is_power_of_2 (elem_cnt) && elem_cnt >= 2);
+  ASSERT (elem_size > 0);
+
+  r->buf = buf;
+  r->seqs = seqs;
+  r->elem_size = elem_size;
+  r->mask = elem_cnt - 1;
+  r->head = r->tail = 0;
+  for (i = 0; i < elem_cnt; i++)
+    seqs[i] = i;
+}
+
+/* Copies ELEM to the end of R and returns true, or returns false
+   if R is full.  Any number of producers may call this at once,
+   including interrupt handlers. */
+bool
+mpsc_ring_put (struct mpsc_ring *r, const void *elem)
+{
+  unsigned head, i;
+
+  for (;;)
+    {
+      int diff;
+
+      head = read_once (&r->head);
+      i = head & r->mask;
+      diff = (int) (read_once (&r->seqs[i]) - head);
+      if (diff == 0)
+        {
+          if (compare_and_swap (&r->head, head, head + 1))
+            break;
+        }
+      else if (diff < 0)
+        return false;
+    }
+
+  copy_elem (r->buf + i * r->elem_size, elem, r->elem_size);
+  compiler_barrier ();
+  r->seqs[i] = head + 1;
+  return true;
+}
+
+/* Copies the element at the front of R to ELEM, removes it, and
+   returns true, or returns false if R is empty or the producer
+   of its front element has yet to finish putting it.  Only R's
+   consumer may call this. */
+bool
+mpsc_ring_get (struct mpsc_ring *r, void *elem)
+{
+  unsigned tail = r->tail;
+  unsigned i = tail & r->mask;
+
+  if (read_once (&r->seqs[i]) != tail + 1)
+    return false;
+
+  compiler_barrier ();
+  copy_elem (elem, r->buf + i * r->elem_size, r->elem_size);
+  compiler_barrier ();
+  r->seqs[i] = tail + r->mask + 1;
+  r->tail = tail + 1;
+  return true;
+}
+
+/* Returns true if R has no element ready for its consumer.  Only
+   R's consumer may rely on the answer, and only that R will not
+   become empty. */
+bool
+mpsc_ring_empty (const struct mpsc_ring *r)
+{
+  unsigned tail = r->tail;
+
+  return read_once (&r->seqs[tail & r->mask]) != tail + 1;
+}
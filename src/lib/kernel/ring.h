@@ -0,0 +1,63 @@
+#ifndef __LIB_KERNEL_RING_H
+#define __LIB_KERNEL_RING_H
+
+/* Ring buffers.
+
+   A ring is a bounded FIFO queue of fixed-size elements, stored
+   in a caller-supplied buffer whose element count is a power of
+   2, so that positions wrap with a mask instead of a division.
+   The producer and consumer positions are free-running counters
+   that are only ever masked to index the buffer, so a ring of N
+   elements holds all N of them.
+
+   A struct ring has a single producer and a single consumer.
+   Each side writes only its own position, so neither takes a
+   lock or disables interrupts, and one side may be an interrupt
+   handler and the other a kernel thread, or the two may run on
+   different CPUs.  A struct mpsc_ring also lets any number of
+   producers put elements at once, from threads or interrupt
+   handlers, at the cost of one atomic compare-and-swap per put
+   and a sequence number per element.  Neither kind blocks: a put
+   into a full ring or a get from an empty one just fails, and
+   callers that must wait arrange that themselves, as
+   devices/intq.c does. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Single-producer, single-consumer ring. */
+struct ring
+  {
+    uint8_t *buf;               /* Elements. */
+    size_t elem_size;           /* Size of an element, in bytes. */
+    unsigned mask;              /* Number of elements, minus 1. */
+    unsigned head;              /* Written only by the producer. */
+    unsigned tail;              /* Written only by the consumer. */
+  };
+
+void ring_init (struct ring *, void *buf, size_t elem_cnt, size_t elem_size);
+bool ring_put (struct ring *, const void *elem);
+bool ring_get (struct ring *, void *elem);
+size_t ring_size (const struct ring *);
+bool ring_empty (const struct ring *);
+bool ring_full (const struct ring *);
+
+/* Multiple-producer, single-consumer ring. */
+struct mpsc_ring
+  {
+    uint8_t *buf;               /* Elements. */
+    unsigned *seqs;             /* Sequence number of each element. */
+    size_t elem_size;           /* Size of an element, in bytes. */
+    unsigned mask;              /* Number of elements, minus 1. */
+    unsigned head;              /* Next position a producer claims. */
+    unsigned tail;              /* Written only by the consumer. */
+  };
+
+void mpsc_ring_init (struct mpsc_ring *, void *buf, unsigned seqs[],
+                     size_t elem_cnt, size_t elem_size);
+bool mpsc_ring_put (struct mpsc_ring *, const void *elem);
+bool mpsc_ring_get (struct mpsc_ring *, void *elem);
+bool mpsc_ring_empty (const struct mpsc_ring *);
+
+#endif /* lib/kernel/ring.h */
@@ -14,6 +14,8 @@ struct vsnprintf_aux
   };
 
 static void vsnprintf_helper (char, void *);
+static bool is_simple_format (const char *);
+static int format_simple (struct vsnprintf_aux *, const char *, va_list);
 
 /* Like vprintf(), except that output is stored into BUFFER,
    which must have space for BUF_SIZE characters.  Writes at most
@@ -31,8 +33,12 @@ vsnprintf (char *buffer, size_t buf_size, const char *format, va_list args)
   aux.length = 0;
   aux.max_length = buf_size > 0 ? buf_size - 1 : 0;
 
-  /* Do most of the work. */
-  __vprintf (format, args, vsnprintf_helper, &aux);
+  /* Do most of the work, taking the fast path if FORMAT only uses
+     plain conversions. */
+  if (is_simple_format (format))
+    format_simple (&aux, format, args);
+  else
+    __vprintf (format, args, vsnprintf_helper, &aux);
 
   /* Add null terminator. */
   if (buf_size > 0)
@@ -51,6 +57,138 @@ vsnprintf_helper (char ch, void *aux_)
     *aux->p++ = ch;
 }
 
+/* Appends the LENGTH characters in S to the output in AUX, as
+   vsnprintf_helper() would one at a time. */
+static void
+append (struct vsnprintf_aux *aux, const char *s, int length) 
+{
+  int room = aux->max_length - aux->length;
+  int n = length < room ? length : room > 0 ? room : 0;
+
+  memcpy (aux->p, s, n);
+  aux->p += n;
+  aux->length += length;
+}
+
+/* Returns true if FORMAT's only conversions are %d, %i, %u, %x,
+   %s, %p, %c, and %%, without flags, field widths, precisions,
+   or length modifiers.  Most format strings in Pintos are like
+   this, and format_simple() can handle them much faster than
+   __vprintf(). */
+static bool
+is_simple_format (const char *format) 
+{
+  for (; *format != '\0'; format++)
+    if (*format == '%') 
+      {
+        format++;
+        if (*format == '\0' || strchr ("diuxspc%", *format) == NULL)
+          return false;
+      }
+  return true;
+}
+
+/* Writes the digits of VALUE in base BASE, which is 10 or 16,
+   into the bytes just before END and returns the number of
+   digits written.  Zero is written as a single `0'. */
+static int
+format_digits (char *end, unsigned value, unsigned base) 
+{
+  char *cp = end;
+
+  do 
+    {
+      *--cp = "0123456789abcdef"[value % base];
+      value /= base;
+    }
+  while (value > 0);
+  return end - cp;
+}
+
+/* Formats FORMAT, which must satisfy is_simple_format(), with
+   ARGS into AUX.  Produces exactly the same output as
+   __vprintf(), but copies literal text a run at a time and
+   stores directly into the buffer instead of calling an output
+   function for each character. */
+static int
+format_simple (struct vsnprintf_aux *aux, const char *format, va_list args) 
+{
+  while (*format != '\0') 
+    {
+      char digits[16];
+      char *end = digits + sizeof digits;
+      const char *s;
+      int n;
+
+      /* Literal text, up to the next conversion. */
+      for (n = 0; format[n] != '\0' && format[n] != '%'; n++)
+        continue;
+      append (aux, format, n);
+      format += n;
+      if (*format == '\0')
+        break;
+
+      switch (*++format) 
+        {
+        case 'd':
+        case 'i':
+          {
+            int value = va_arg (args, int);
+            n = format_digits (end, value < 0 ? -(unsigned) value : (unsigned) value, 10);
+            if (value < 0)
+              end[-++n] = '-';
+            append (aux, end - n, n);
+          }
+          break;
+
+        case 'u':
+          n = format_digits (end, va_arg (args, unsigned), 10);
+          append (aux, end - n, n);
+          break;
+
+        case 'x':
+          n = format_digits (end, va_arg (args, unsigned), 16);
+          append (aux, end - n, n);
+          break;
+
+        case 'p':
+          {
+            /* Like %#x: `0x' prefix only if nonzero. */
+            uintptr_t value = (uintptr_t) va_arg (args, void *);
+            n = format_digits (end, value, 16);
+            if (value != 0) 
+              {
+                end[-++n] = 'x';
+                end[-++n] = '0';
+              }
+            append (aux, end - n, n);
+          }
+          break;
+
+        case 's':
+          s = va_arg (args, char *);
+          if (s == NULL)
+            s = "(null)";
+          append (aux, s, strlen (s));
+          break;
+
+        case 'c':
+          digits[0] = va_arg (args, int);
+          append (aux, digits, 1);
+          break;
+
+        case '%':
+          append (aux, "%", 1);
+          break;
+
+        default:
+          NOT_REACHED ();
+        }
+      format++;
+    }
+  return aux->length;
+}
+
 /* Like printf(), except that output is stored into BUFFER,
    which must have space for BUF_SIZE characters.  Writes at most
    BUF_SIZE - 1 characters to BUFFER, followed by a null
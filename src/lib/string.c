@@ -1,5 +1,44 @@
 #include <string.h>
 #include <debug.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* memcpy(), memset(), and memcmp() work a 32-bit word at a time
+   on blocks of at least this many bytes, after handling bytes up
+   to the first word-aligned address one at a time.  Below this
+   size the setup costs more than it saves. */
+#define WORD_OP_MIN 16
+
+/* Returns true if P is aligned on a word boundary. */
+static inline bool
+word_aligned (const void *p)
+{
+  return (uintptr_t) p % sizeof (uint32_t) == 0;
+}
+
+/* strlen(), strcmp(), and the other scanning functions check a
+   word at a time for a null byte or the byte they look for,
+   with the bit trick below.  They read only aligned words, and
+   an aligned word never crosses a page boundary, so reading the
+   bytes past the end of a string that share its last word
+   cannot fault.
+
+   Returns nonzero if and only if some byte of W is zero.
+   Subtracting 1 from each byte sets its top bit if it was 0 or
+   above 0x80, and masking with ~W clears the top bit again for
+   those above 0x80. */
+static inline uint32_t
+has_zero (uint32_t w)
+{
+  return (w - 0x01010101u) & ~w & 0x80808080u;
+}
+
+/* Returns a word with each byte equal to CH. */
+static inline uint32_t
+byte_pattern (unsigned char ch)
+{
+  return ch * 0x01010101u;
+}
 
 /* Copies SIZE bytes from SRC to DST, which must not overlap.
    Returns DST. */
@@ -12,6 +51,20 @@ memcpy (void *dst_, const void *src_, size_t size)
   ASSERT (dst != NULL || size == 0);
   ASSERT (src != NULL || size == 0);
 
+  if (size >= WORD_OP_MIN)
+    {
+      size_t words;
+
+      /* Align DST, then copy whole words with `rep movsl'. */
+      for (; !word_aligned (dst); size--)
+        *dst++ = *src++;
+      words = size / sizeof (uint32_t);
+      size %= sizeof (uint32_t);
+      asm volatile ("rep movsl"
+                    : "+D" (dst), "+S" (src), "+c" (words)
+                    : : "memory");
+    }
+
   while (size-- > 0)
     *dst++ = *src++;
 
@@ -58,6 +111,20 @@ memcmp (const void *a_, const void *b_, size_t size)
   ASSERT (a != NULL || size == 0);
   ASSERT (b != NULL || size == 0);
 
+  /* If A and B can be aligned together, skip over equal words.
+     The first differing byte is then found one byte at a time. */
+  if (size >= WORD_OP_MIN
+      && (uintptr_t) a % sizeof (uint32_t) == (uintptr_t) b % sizeof (uint32_t))
+    {
+      for (; !word_aligned (a) && *a == *b; a++, b++)
+        size--;
+      if (word_aligned (a))
+        for (; size >= sizeof (uint32_t)
+               && *(const uint32_t *) a == *(const uint32_t *) b;
+             a += sizeof (uint32_t), b += sizeof (uint32_t))
+          size -= sizeof (uint32_t);
+    }
+
   for (; size-- > 0; a++, b++)
     if (*a != *b)
       return *a > *b ? +1 : -1;
@@ -78,6 +145,19 @@ strcmp (const char *a_, const char *b_)
   ASSERT (a != NULL);
   ASSERT (b != NULL);
 
+  /* If A and B can be aligned together, skip over equal words
+     that contain no null byte. */
+  if ((uintptr_t) a % sizeof (uint32_t) == (uintptr_t) b % sizeof (uint32_t))
+    {
+      for (; !word_aligned (a) && *a != '\0' && *a == *b; a++, b++)
+        continue;
+      if (word_aligned (a))
+        for (; (*(const uint32_t *) a == *(const uint32_t *) b
+                && !has_zero (*(const uint32_t *) a));
+             a += sizeof (uint32_t), b += sizeof (uint32_t))
+          continue;
+    }
+
   while (*a != '\0' && *a == *b) 
     {
       a++;
@@ -98,6 +178,20 @@ memchr (const void *block_, int ch_, size_t size)
 
   ASSERT (block != NULL || size == 0);
 
+  if (size >= WORD_OP_MIN)
+    {
+      uint32_t pattern = byte_pattern (ch);
+
+      /* Align BLOCK, then skip words that do not contain CH. */
+      for (; !word_aligned (block); block++, size--)
+        if (*block == ch)
+          return (void *) block;
+      for (; (size >= sizeof (uint32_t)
+              && !has_zero (*(const uint32_t *) block ^ pattern));
+           block += sizeof (uint32_t))
+        size -= sizeof (uint32_t);
+    }
+
   for (; size-- > 0; block++)
     if (*block == ch)
       return (void *) block;
@@ -113,9 +207,24 @@ char *
 strchr (const char *string, int c_) 
 {
   char c = c_;
+  uint32_t pattern = byte_pattern (c);
 
   ASSERT (string != NULL);
 
+  /* Align STRING, then skip words that contain neither C nor a
+     null byte. */
+  for (; !word_aligned (string); string++)
+    if (*string == c)
+      return (char *) string;
+    else if (*string == '\0')
+      return NULL;
+  for (;; string += sizeof (uint32_t))
+    {
+      uint32_t w = *(const uint32_t *) string;
+      if (has_zero (w) || has_zero (w ^ pattern))
+        break;
+    }
+
   for (;;) 
     if (*string == c)
       return (char *) string;
@@ -281,7 +390,23 @@ memset (void *dst_, int value, size_t size)
   unsigned char *dst = dst_;
 
   ASSERT (dst != NULL || size == 0);
-  
+
+  if (size >= WORD_OP_MIN)
+    {
+      uint32_t pattern = (unsigned char) value * 0x01010101u;
+      size_t words;
+
+      /* Align DST, then store whole words with `rep stosl'. */
+      for (; !word_aligned (dst); size--)
+        *dst++ = value;
+      words = size / sizeof (uint32_t);
+      size %= sizeof (uint32_t);
+      asm volatile ("rep stosl"
+                    : "+D" (dst), "+c" (words)
+                    : "a" (pattern)
+                    : "memory");
+    }
+
   while (size-- > 0)
     *dst++ = value;
 
@@ -296,7 +421,14 @@ strlen (const char *string)
 
   ASSERT (string != NULL);
 
-  for (p = string; *p != '\0'; p++)
+  /* Align P, then skip words that contain no null byte. */
+  for (p = string; !word_aligned (p); p++)
+    if (*p == '\0')
+      return p - string;
+  for (; !has_zero (*(const uint32_t *) p); p += sizeof (uint32_t))
+    continue;
+
+  for (; *p != '\0'; p++)
     continue;
   return p - string;
 }
@@ -308,7 +440,17 @@ strnlen (const char *string, size_t maxlen)
 {
   size_t length;
 
-  for (length = 0; string[length] != '\0' && length < maxlen; length++)
+  /* Align STRING + LENGTH, then skip words that contain no null
+     byte. */
+  for (length = 0; !word_aligned (string + length); length++)
+    if (length >= maxlen || string[length] == '\0')
+      return length;
+  for (; (maxlen - length >= sizeof (uint32_t)
+          && !has_zero (*(const uint32_t *) (string + length)));
+       length += sizeof (uint32_t))
+    continue;
+
+  for (; length < maxlen && string[length] != '\0'; length++)
     continue;
   return length;
 }
@@ -28,7 +28,79 @@ enum
     SYS_MKDIR,                  /* Create a directory. */
     SYS_READDIR,                /* Reads a directory entry. */
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
-    SYS_INUMBER                 /* Returns the inode number for a fd. */
+    SYS_INUMBER,                /* Returns the inode number for a fd. */
+
+    /* Batched I/O. */
+    SYS_READV,                  /* Read from a file into several buffers. */
+    SYS_WRITEV,                 /* Write to a file from several buffers. */
+    SYS_BATCH,                  /* Run several operations at once. */
+
+    /* Statistics. */
+    SYS_FAULTSTAT,              /* Get the process's page fault counts. */
+    SYS_CLOCK,                  /* Get the time since boot. */
+
+    /* User-space synchronization. */
+    SYS_FUTEX_WAIT,             /* Sleep if a word has a given value. */
+    SYS_FUTEX_WAKE,             /* Wake threads sleeping on a word. */
+
+    /* User threads. */
+    SYS_THREAD_CREATE,          /* Start a thread in this process. */
+    SYS_THREAD_JOIN,            /* Wait for a thread to exit. */
+    SYS_THREAD_EXIT,            /* Exit this thread. */
+
+    /* Pipes and descriptor redirection. */
+    SYS_PIPE,                   /* Create a pipe. */
+    SYS_DUP,                    /* Duplicate a file descriptor. */
+    SYS_DUP2,                   /* Duplicate onto a given descriptor. */
+
+    /* Process creation. */
+    SYS_FORK,                   /* Copy the current process. */
+    SYS_SPAWN,                  /* Start a program with set-up fds. */
+
+    /* In-kernel copying. */
+    SYS_COPY,                   /* Copy from one file to another. */
+
+    /* Directory listing and metadata. */
+    SYS_GETDENTS,               /* Read directory entries and metadata. */
+    SYS_STAT,                   /* Get a file's metadata by name. */
+
+    /* Positional I/O. */
+    SYS_PREAD,                  /* Read from a file at an offset. */
+    SYS_PWRITE,                 /* Write to a file at an offset. */
+
+    /* Space reservation. */
+    SYS_FALLOCATE,              /* Reserve disk space for a file. */
+
+    /* Durability. */
+    SYS_FSYNC,                  /* Make one file durable. */
+    SYS_SYNC,                   /* Make the whole file system durable. */
+
+    /* Memory access hints. */
+    SYS_MADVISE,                /* Describe how memory will be used. */
+
+    /* Shared memory. */
+    SYS_SHM_CREATE,             /* Create and attach a segment. */
+    SYS_SHM_ATTACH,             /* Attach an existing segment. */
+    SYS_SHM_DETACH,             /* Detach a segment. */
+
+    /* Heap. */
+    SYS_SBRK,                   /* Grow or shrink the heap. */
+
+    /* Scheduling. */
+    SYS_SETPRIORITY,            /* Set the thread's priority. */
+    SYS_GETPRIORITY,            /* Get the thread's priority. */
+    SYS_NICE,                   /* Change the thread's nice value. */
+
+    /* Accounting. */
+    SYS_GETRUSAGE,              /* Get resource usage. */
+
+    /* Asynchronous I/O. */
+    SYS_AIO_SUBMIT,             /* Start reading or writing a file. */
+    SYS_AIO_WAIT,               /* Wait for a transfer to finish. */
+    SYS_AIO_POLL,               /* Check whether a transfer is done. */
+
+    /* Readiness. */
+    SYS_POLL                    /* Wait for descriptors to be ready. */
   };
 
 #endif /* lib/syscall-nr.h */
@@ -1,8 +1,63 @@
 #include <stdio.h>
+#include <mutex.h>
 #include <string.h>
 #include <syscall.h>
 #include <syscall-nr.h>
 
+/* Standard output is line-buffered: printf(), puts(), and
+   putchar() collect their output in STDOUT_BUF, which is written
+   with a single write() when a new-line goes into it or it fills
+   up.  exit(), reading standard input, and starting or waiting
+   for a child flush it as well, so that output before those
+   appears before whatever they lead to.  write() itself is not
+   buffered, so a program that mixes it with partial lines of
+   printf() on standard output should call stdout_flush() first.
+   Output still in the buffer when the kernel kills the process
+   is lost. */
+static char stdout_buf[256];
+static size_t stdout_len;
+static struct mutex stdout_mutex = MUTEX_INITIALIZER;
+
+/* Writes out STDOUT_BUF.  STDOUT_MUTEX must be held. */
+static void
+flush_locked (void)
+{
+  if (stdout_len > 0)
+    write (STDOUT_FILENO, stdout_buf, stdout_len);
+  stdout_len = 0;
+}
+
+/* Writes out any buffered standard output. */
+void
+stdout_flush (void)
+{
+  mutex_lock (&stdout_mutex);
+  flush_locked ();
+  mutex_unlock (&stdout_mutex);
+}
+
+/* Writes the SIZE bytes at S to standard output, through
+   STDOUT_BUF. */
+static void
+stdout_write (const char *s, size_t size)
+{
+  bool newline = memchr (s, '\n', size) != NULL;
+
+  mutex_lock (&stdout_mutex);
+  if (stdout_len + size > sizeof stdout_buf)
+    flush_locked ();
+  if (size >= sizeof stdout_buf)
+    write (STDOUT_FILENO, s, size);
+  else
+    {
+      memcpy (stdout_buf + stdout_len, s, size);
+      stdout_len += size;
+      if (newline)
+        flush_locked ();
+    }
+  mutex_unlock (&stdout_mutex);
+}
+
 /* The standard vprintf() function,
    which is like printf() but uses a va_list. */
 int
@@ -30,8 +85,8 @@ hprintf (int handle, const char *format, ...)
 int
 puts (const char *s) 
 {
-  write (STDOUT_FILENO, s, strlen (s));
-  putchar ('\n');
+  stdout_write (s, strlen (s));
+  stdout_write ("\n", 1);
 
   return 0;
 }
@@ -41,7 +96,7 @@ int
 putchar (int c) 
 {
   char c2 = c;
-  write (STDOUT_FILENO, &c2, 1);
+  stdout_write (&c2, 1);
   return c;
 }
 
@@ -84,11 +139,17 @@ add_char (char c, void *aux_)
   aux->char_cnt++;
 }
 
-/* Flushes the buffer in AUX. */
+/* Flushes the buffer in AUX, into STDOUT_BUF if it is for
+   standard output. */
 static void
 flush (struct vhprintf_aux *aux)
 {
   if (aux->p > aux->buf)
-    write (aux->handle, aux->buf, aux->p - aux->buf);
+    {
+      if (aux->handle == STDOUT_FILENO)
+        stdout_write (aux->buf, aux->p - aux->buf);
+      else
+        write (aux->handle, aux->buf, aux->p - aux->buf);
+    }
   aux->p = aux->buf;
 }
@@ -0,0 +1,51 @@
+#include <info.h>
+#include "../infopage.h"
+
+/* See lib/infopage.h for the layout of the info pages. */
+static volatile const struct kernel_info *const kernel_info
+  = INFO_PAGE_ADDR;
+static const struct process_info *const process_info
+  = PROCESS_INFO_PAGE_ADDR;
+
+/* Keeps the compiler from moving memory accesses across it. */
+#define barrier() asm volatile ("" : : : "memory")
+
+/* Returns the number of timer ticks since the OS booted. */
+int64_t
+info_ticks (void)
+{
+  uint32_t seq;
+  int64_t ticks;
+
+  do
+    {
+      seq = kernel_info->seq;
+      barrier ();
+      ticks = kernel_info->ticks;
+      barrier ();
+    }
+  while ((seq & 1) != 0 || seq != kernel_info->seq);
+  return ticks;
+}
+
+/* Returns the MLFQS load average, times 100 and rounded to the
+   nearest integer.  Without the MLFQS scheduler it is 0. */
+int
+info_load_avg (void)
+{
+  return kernel_info->load_avg;
+}
+
+/* Returns the number of timer ticks per second. */
+int
+info_timer_freq (void)
+{
+  return kernel_info->timer_freq;
+}
+
+/* Returns the id of the current process. */
+pid_t
+info_pid (void)
+{
+  return process_info->pid;
+}
@@ -0,0 +1,15 @@
+#ifndef __LIB_USER_INFO_H
+#define __LIB_USER_INFO_H
+
+#include <stdint.h>
+#include <syscall.h>
+
+/* Kernel state read from the info pages that the kernel maps
+   into every process, without entering the kernel.  Each call
+   costs a few memory reads. */
+int64_t info_ticks (void);
+int info_load_avg (void);
+int info_timer_freq (void);
+pid_t info_pid (void);
+
+#endif /* lib/user/info.h */
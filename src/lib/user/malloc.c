@@ -0,0 +1,450 @@
+#include <malloc.h>
+#include <debug.h>
+#include <mutex.h>
+#include <round.h>
+#include <stdint.h>
+#include <string.h>
+#include <syscall.h>
+
+/* A malloc() for user programs, built on sbrk().
+
+   As in the kernel's (see threads/malloc.c), a request of up to
+   1 kB is rounded up to a power of 2, and its "descriptor" hands
+   out blocks of that size carved from page-sized "arenas", while
+   a bigger request gets a run of whole pages with an arena
+   header at its start.  Here, though, each arena keeps its own
+   list of free blocks, and each descriptor a list of the arenas
+   that have any.  An arena whose blocks are all freed can then
+   be given up at once, with no search through a list shared
+   with other arenas.
+
+   Pages come from the heap, which sbrk() grows and the kernel
+   fills with zeros only as they are touched.  Free runs of pages
+   are kept in order of address and merged with their neighbors,
+   and once the run at the end of the heap is at least TRIM_PAGES
+   long, it goes back to the kernel by shrinking the heap.  Thus
+   the memory a program holds follows what it really uses, not
+   its peak.
+
+   MALLOC_MUTEX protects everything. */
+
+/* Size of a page. */
+#define PAGE_SIZE 4096
+
+/* Shortest free run at the end of the heap that free() gives
+   back to the kernel. */
+#define TRIM_PAGES 16
+
+/* Most bytes to move the end of the heap by in one sbrk(), which
+   takes a signed increment. */
+#define SBRK_MAX 0x40000000
+
+/* Descriptor. */
+struct desc
+  {
+    size_t block_size;          /* Size of each block in bytes. */
+    size_t blocks_per_arena;    /* Number of blocks in an arena. */
+    struct arena *arenas;       /* Arenas with a free block. */
+  };
+
+/* Magic number for detecting arena corruption. */
+#define ARENA_MAGIC 0x9a548eed
+
+/* Arena. */
+struct arena
+  {
+    unsigned magic;             /* Always set to ARENA_MAGIC. */
+    struct desc *desc;          /* Owning descriptor, null for big block. */
+    size_t free_cnt;            /* Free blocks; pages in big block. */
+    struct block *free;         /* Free blocks. */
+    struct arena *prev, *next;  /* In DESC's ARENAS, if FREE_CNT > 0. */
+  };
+
+/* Free block. */
+struct block
+  {
+    struct block *next;         /* Next free block in its arena. */
+  };
+
+/* Free run of pages. */
+struct run
+  {
+    size_t page_cnt;            /* Number of pages. */
+    struct run *next;           /* Next run, at a higher address. */
+  };
+
+static struct desc descs[7];    /* Descriptors, 16 to 1024 bytes. */
+static size_t desc_cnt;         /* Number of descriptors. */
+static struct run *runs;        /* Free runs, in order of address. */
+static struct mutex malloc_mutex = MUTEX_INITIALIZER;
+
+static uintptr_t pg_ofs (const void *);
+static struct arena *block_to_arena (struct block *);
+static struct block *arena_to_block (struct arena *, size_t idx);
+static void *get_pages (size_t page_cnt);
+static void put_pages (void *, size_t page_cnt);
+
+/* Initializes the descriptors. */
+static void
+init_descs (void)
+{
+  size_t block_size;
+
+  for (block_size = 16; block_size < PAGE_SIZE / 2; block_size *= 2)
+    {
+      struct desc *d = &descs[desc_cnt++];
+      ASSERT (desc_cnt <= sizeof descs / sizeof *descs);
+      d->block_size = block_size;
+      d->blocks_per_arena = ((PAGE_SIZE - sizeof (struct arena))
+                             / block_size);
+      d->arenas = NULL;
+    }
+}
+
+/* Adds arena A to its descriptor's list of arenas with free
+   blocks. */
+static void
+push_arena (struct arena *a)
+{
+  struct desc *d = a->desc;
+
+  a->prev = NULL;
+  a->next = d->arenas;
+  if (d->arenas != NULL)
+    d->arenas->prev = a;
+  d->arenas = a;
+}
+
+/* Removes arena A from its descriptor's list of arenas with free
+   blocks. */
+static void
+remove_arena (struct arena *a)
+{
+  if (a->prev != NULL)
+    a->prev->next = a->next;
+  else
+    a->desc->arenas = a->next;
+  if (a->next != NULL)
+    a->next->prev = a->prev;
+}
+
+/* Obtains and returns a new block of at least SIZE bytes.
+   Returns a null pointer if memory is not available. */
+void *
+malloc (size_t size) 
+{
+  struct desc *d;
+  struct arena *a;
+  struct block *b;
+
+  /* A null pointer satisfies a request for 0 bytes. */
+  if (size == 0)
+    return NULL;
+
+  mutex_lock (&malloc_mutex);
+  if (desc_cnt == 0)
+    init_descs ();
+
+  /* Find the smallest descriptor that satisfies a SIZE-byte
+     request. */
+  for (d = descs; d < descs + desc_cnt; d++)
+    if (d->block_size >= size)
+      break;
+  if (d == descs + desc_cnt) 
+    {
+      /* SIZE is too big for any descriptor.
+         Allocate enough pages to hold SIZE plus an arena. */
+      size_t page_cnt = DIV_ROUND_UP (size + sizeof *a, PAGE_SIZE);
+
+      a = size < SBRK_MAX ? get_pages (page_cnt) : NULL;
+      mutex_unlock (&malloc_mutex);
+      if (a == NULL)
+        return NULL;
+
+      /* Initialize the arena to indicate a big block of PAGE_CNT
+         pages, and return it. */
+      a->magic = ARENA_MAGIC;
+      a->desc = NULL;
+      a->free_cnt = page_cnt;
+      return a + 1;
+    }
+
+  /* If no arena has a free block, make a new one. */
+  if (d->arenas == NULL) 
+    {
+      size_t i;
+
+      a = get_pages (1);
+      if (a == NULL) 
+        {
+          mutex_unlock (&malloc_mutex);
+          return NULL; 
+        }
+
+      /* Initialize the arena and thread its blocks on its free
+         list, lowest address first. */
+      a->magic = ARENA_MAGIC;
+      a->desc = d;
+      a->free_cnt = d->blocks_per_arena;
+      a->free = NULL;
+      for (i = d->blocks_per_arena; i-- > 0; ) 
+        {
+          b = arena_to_block (a, i);
+          b->next = a->free;
+          a->free = b;
+        }
+      push_arena (a);
+    }
+
+  /* Take a block from the first arena with any. */
+  a = d->arenas;
+  b = a->free;
+  a->free = b->next;
+  if (--a->free_cnt == 0)
+    remove_arena (a);
+  mutex_unlock (&malloc_mutex);
+  return b;
+}
+
+/* Allocates and return A times B bytes initialized to zeroes.
+   Returns a null pointer if memory is not available. */
+void *
+calloc (size_t a, size_t b) 
+{
+  void *p;
+  size_t size;
+
+  /* Calculate block size and make sure it fits in size_t. */
+  size = a * b;
+  if (size < a || size < b)
+    return NULL;
+
+  /* Allocate and zero memory. */
+  p = malloc (size);
+  if (p != NULL)
+    memset (p, 0, size);
+
+  return p;
+}
+
+/* Returns the number of bytes allocated for BLOCK. */
+static size_t
+block_size (void *block) 
+{
+  struct block *b = block;
+  struct arena *a = block_to_arena (b);
+  struct desc *d = a->desc;
+
+  return (d != NULL
+          ? d->block_size
+          : PAGE_SIZE * a->free_cnt - pg_ofs (block));
+}
+
+/* Attempts to resize OLD_BLOCK to NEW_SIZE bytes, possibly
+   moving it in the process.
+   If successful, returns the new block; on failure, returns a
+   null pointer.
+   A call with null OLD_BLOCK is equivalent to malloc(NEW_SIZE).
+   A call with zero NEW_SIZE is equivalent to free(OLD_BLOCK). */
+void *
+realloc (void *old_block, size_t new_size) 
+{
+  if (new_size == 0) 
+    {
+      free (old_block);
+      return NULL;
+    }
+  else 
+    {
+      size_t old_size = old_block != NULL ? block_size (old_block) : 0;
+      void *new_block;
+
+      /* A block already big enough stays where it is. */
+      if (old_size >= new_size)
+        return old_block;
+
+      new_block = malloc (new_size);
+      if (old_block != NULL && new_block != NULL)
+        {
+          memcpy (new_block, old_block, old_size);
+          free (old_block);
+        }
+      return new_block;
+    }
+}
+
+/* Frees block P, which must have been previously allocated with
+   malloc(), calloc(), or realloc(). */
+void
+free (void *p) 
+{
+  struct block *b = p;
+  struct arena *a;
+  struct desc *d;
+
+  if (p == NULL)
+    return;
+
+  a = block_to_arena (b);
+  d = a->desc;
+  mutex_lock (&malloc_mutex);
+  if (d == NULL) 
+    {
+      /* It's a big block.  Free its pages. */
+      put_pages (a, a->free_cnt);
+      mutex_unlock (&malloc_mutex);
+      return;
+    }
+
+  /* Put the block on its arena's free list, making the arena
+     available again if it was full. */
+  b->next = a->free;
+  a->free = b;
+  if (a->free_cnt++ == 0)
+    push_arena (a);
+
+  /* If the arena is now entirely unused, free it. */
+  if (a->free_cnt >= d->blocks_per_arena) 
+    {
+      ASSERT (a->free_cnt == d->blocks_per_arena);
+      remove_arena (a);
+      a->magic = 0;
+      put_pages (a, 1);
+    }
+  mutex_unlock (&malloc_mutex);
+}
+
+/* Returns the byte offset of P within its page. */
+static uintptr_t
+pg_ofs (const void *p)
+{
+  return (uintptr_t) p & (PAGE_SIZE - 1);
+}
+
+/* Returns the arena that block B is inside. */
+static struct arena *
+block_to_arena (struct block *b)
+{
+  struct arena *a = (struct arena *) ((uintptr_t) b & ~(PAGE_SIZE - 1));
+
+  /* Check that the arena is valid. */
+  ASSERT (a != NULL);
+  ASSERT (a->magic == ARENA_MAGIC);
+
+  /* Check that the block is properly aligned for the arena. */
+  ASSERT (a->desc == NULL
+          || (pg_ofs (b) - sizeof *a) % a->desc->block_size == 0);
+  ASSERT (a->desc != NULL || pg_ofs (b) == sizeof *a);
+
+  return a;
+}
+
+/* Returns the (IDX - 1)'th block within arena A. */
+static struct block *
+arena_to_block (struct arena *a, size_t idx) 
+{
+  ASSERT (a != NULL);
+  ASSERT (a->magic == ARENA_MAGIC);
+  ASSERT (idx < a->desc->blocks_per_arena);
+  return (struct block *) ((uint8_t *) a
+                           + sizeof *a
+                           + idx * a->desc->block_size);
+}
+
+/* Returns the address just past free run R. */
+static uint8_t *
+run_end (struct run *r)
+{
+  return (uint8_t *) r + r->page_cnt * PAGE_SIZE;
+}
+
+/* Returns PAGE_CNT contiguous free pages, from the first free
+   run long enough or else by growing the heap, or a null pointer
+   if the heap cannot grow. */
+static void *
+get_pages (size_t page_cnt)
+{
+  struct run **rp;
+  uint8_t *brk;
+  size_t pad;
+
+  for (rp = &runs; *rp != NULL; rp = &(*rp)->next)
+    {
+      struct run *r = *rp;
+
+      if (r->page_cnt == page_cnt)
+        {
+          *rp = r->next;
+          return r;
+        }
+      else if (r->page_cnt > page_cnt)
+        {
+          /* Take the front of R and leave the rest free. */
+          struct run *rest = (struct run *) ((uint8_t *) r
+                                             + page_cnt * PAGE_SIZE);
+          rest->page_cnt = r->page_cnt - page_cnt;
+          rest->next = r->next;
+          *rp = rest;
+          return r;
+        }
+    }
+
+  /* Grow the heap, first to a page boundary, in case the program
+     called sbrk() itself. */
+  brk = sbrk (0);
+  if (brk == (void *) -1)
+    return NULL;
+  pad = (PAGE_SIZE - pg_ofs (brk)) % PAGE_SIZE;
+  if (page_cnt > (SBRK_MAX - pad) / PAGE_SIZE
+      || sbrk (pad + page_cnt * PAGE_SIZE) == (void *) -1)
+    return NULL;
+  return brk + pad;
+}
+
+/* Frees the PAGE_CNT pages at PAGES, merging them with the free
+   runs on either side and shrinking the heap if they end it. */
+static void
+put_pages (void *pages, size_t page_cnt)
+{
+  struct run *r = pages;
+  struct run *prev = NULL, *next;
+
+  for (next = runs; next != NULL && next < r; next = next->next)
+    prev = next;
+  r->page_cnt = page_cnt;
+  r->next = next;
+  if (prev != NULL)
+    prev->next = r;
+  else
+    runs = r;
+
+  if (next != NULL && run_end (r) == (uint8_t *) next)
+    {
+      r->page_cnt += next->page_cnt;
+      r->next = next->next;
+    }
+  if (prev != NULL && run_end (prev) == (uint8_t *) r)
+    {
+      prev->page_cnt += r->page_cnt;
+      prev->next = r->next;
+      r = prev;
+    }
+
+  /* Give a long enough run at the end of the heap back. */
+  if (r->next == NULL && r->page_cnt >= TRIM_PAGES
+      && run_end (r) == sbrk (0))
+    {
+      struct run **rp;
+      size_t size = r->page_cnt * PAGE_SIZE;
+
+      for (rp = &runs; *rp != r; rp = &(*rp)->next)
+        continue;
+      *rp = NULL;
+      while (size > 0)
+        {
+          size_t chunk = size < SBRK_MAX ? size : SBRK_MAX;
+          sbrk (-(intptr_t) chunk);
+          size -= chunk;
+        }
+    }
+}
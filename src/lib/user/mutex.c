@@ -0,0 +1,73 @@
+#include <mutex.h>
+#include <syscall.h>
+
+/* User-space mutexes, after Drepper, "Futexes Are Tricky."
+
+   STATE is 0 if the mutex is unlocked, 1 if it is locked and no
+   thread sleeps on it, or 2 if it is locked and threads may be
+   sleeping on it.  A locker that finds the mutex locked sets
+   STATE to 2 before sleeping, so the unlocker knows to call
+   futex_wake(); it then relocks with 2, not 1, because other
+   sleepers may remain. */
+
+/* Atomically replaces *P by NEW if it is OLD.  Returns the
+   previous value of *P. */
+static inline int
+cmpxchg (int *p, int old, int new)
+{
+  int prev;
+  asm volatile ("lock cmpxchgl %2, %1"
+                : "=a" (prev), "+m" (*p) : "r" (new), "0" (old) : "memory");
+  return prev;
+}
+
+/* Atomically replaces *P by NEW.  Returns the previous value of
+   *P. */
+static inline int
+xchg (int *p, int new)
+{
+  asm volatile ("xchgl %0, %1" : "+r" (new), "+m" (*p) : : "memory");
+  return new;
+}
+
+/* Initializes M as unlocked. */
+void
+mutex_init (struct mutex *m)
+{
+  m->state = 0;
+}
+
+/* Locks M, sleeping until it is available if necessary. */
+void
+mutex_lock (struct mutex *m)
+{
+  int c = cmpxchg (&m->state, 0, 1);
+
+  if (c != 0)
+    {
+      if (c != 2)
+        c = xchg (&m->state, 2);
+      while (c != 0)
+        {
+          futex_wait (&m->state, 2);
+          c = xchg (&m->state, 2);
+        }
+    }
+}
+
+/* Locks M if it is unlocked, without sleeping.  Returns true if
+   successful, false if M was already locked. */
+bool
+mutex_trylock (struct mutex *m)
+{
+  return cmpxchg (&m->state, 0, 1) == 0;
+}
+
+/* Unlocks M, which the caller must have locked, and wakes a
+   thread sleeping on it, if any. */
+void
+mutex_unlock (struct mutex *m)
+{
+  if (xchg (&m->state, 0) == 2)
+    futex_wake (&m->state, 1);
+}
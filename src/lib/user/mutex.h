@@ -0,0 +1,22 @@
+#ifndef __LIB_USER_MUTEX_H
+#define __LIB_USER_MUTEX_H
+
+#include <stdbool.h>
+
+/* A mutex for the threads of a user process.  Locking and
+   unlocking a mutex that no other thread wants are one atomic
+   instruction each; the kernel is entered, through futex_wait()
+   and futex_wake(), only to sleep and to wake a sleeper. */
+struct mutex
+  {
+    int state;          /* 0: unlocked, 1: locked, 2: locked, contended. */
+  };
+
+#define MUTEX_INITIALIZER { 0 }
+
+void mutex_init (struct mutex *);
+void mutex_lock (struct mutex *);
+bool mutex_trylock (struct mutex *);
+void mutex_unlock (struct mutex *);
+
+#endif /* lib/user/mutex.h */
@@ -4,4 +4,7 @@
 int hprintf (int, const char *, ...) PRINTF_FORMAT (2, 3);
 int vhprintf (int, const char *, va_list) PRINTF_FORMAT (2, 0);
 
+/* Writes out any buffered standard output. */
+void stdout_flush (void);
+
 #endif /* lib/user/stdio.h */
@@ -1,16 +1,21 @@
 #include <syscall.h>
+#include <stdio.h>
 #include "../syscall-nr.h"
 
+/* Enters the kernel.  See syscall-entry.S. */
+void syscall_trap (void);
+
 /* Invokes syscall NUMBER, passing no arguments, and returns the
    return value as an `int'. */
 #define syscall0(NUMBER)                                        \
         ({                                                      \
           int retval;                                           \
           asm volatile                                          \
-            ("pushl %[number]; int $0x30; addl $4, %%esp"       \
+            ("pushl %[number]; "                                \
+             "call syscall_trap; addl $4, %%esp"                \
                : "=a" (retval)                                  \
                : [number] "i" (NUMBER)                          \
-               : "memory");                                     \
+               : "ecx", "edx", "cc", "memory");                 \
           retval;                                               \
         })
 
@@ -20,11 +25,12 @@
         ({                                                               \
           int retval;                                                    \
           asm volatile                                                   \
-            ("pushl %[arg0]; pushl %[number]; int $0x30; addl $8, %%esp" \
+            ("pushl %[arg0]; pushl %[number]; "                          \
+             "call syscall_trap; addl $8, %%esp"                         \
                : "=a" (retval)                                           \
                : [number] "i" (NUMBER),                                  \
                  [arg0] "g" (ARG0)                                       \
-               : "memory");                                              \
+               : "ecx", "edx", "cc", "memory");                          \
           retval;                                                        \
         })
 
@@ -35,12 +41,13 @@
           int retval;                                           \
           asm volatile                                          \
             ("pushl %[arg1]; pushl %[arg0]; "                   \
-             "pushl %[number]; int $0x30; addl $12, %%esp"      \
+             "pushl %[number]; call syscall_trap; "             \
+             "addl $12, %%esp"                                  \
                : "=a" (retval)                                  \
                : [number] "i" (NUMBER),                         \
                  [arg0] "r" (ARG0),                             \
                  [arg1] "r" (ARG1)                              \
-               : "memory");                                     \
+               : "ecx", "edx", "cc", "memory");                 \
           retval;                                               \
         })
 
@@ -51,19 +58,40 @@
           int retval;                                           \
           asm volatile                                          \
             ("pushl %[arg2]; pushl %[arg1]; pushl %[arg0]; "    \
-             "pushl %[number]; int $0x30; addl $16, %%esp"      \
+             "pushl %[number]; call syscall_trap; "             \
+             "addl $16, %%esp"                                  \
                : "=a" (retval)                                  \
                : [number] "i" (NUMBER),                         \
                  [arg0] "r" (ARG0),                             \
                  [arg1] "r" (ARG1),                             \
                  [arg2] "r" (ARG2)                              \
-               : "memory");                                     \
+               : "ecx", "edx", "cc", "memory");                 \
+          retval;                                               \
+        })
+
+/* Invokes syscall NUMBER, passing arguments ARG0, ARG1, ARG2,
+   and ARG3, and returns the return value as an `int'. */
+#define syscall4(NUMBER, ARG0, ARG1, ARG2, ARG3)                \
+        ({                                                      \
+          int retval;                                           \
+          asm volatile                                          \
+            ("pushl %[arg3]; pushl %[arg2]; pushl %[arg1]; "    \
+             "pushl %[arg0]; pushl %[number]; "                 \
+             "call syscall_trap; addl $20, %%esp"               \
+               : "=a" (retval)                                  \
+               : [number] "i" (NUMBER),                         \
+                 [arg0] "r" (ARG0),                             \
+                 [arg1] "r" (ARG1),                             \
+                 [arg2] "r" (ARG2),                             \
+                 [arg3] "r" (ARG3)                              \
+               : "ecx", "edx", "cc", "memory");                 \
           retval;                                               \
         })
 
 void
 halt (void) 
 {
+  stdout_flush ();
   syscall0 (SYS_HALT);
   NOT_REACHED ();
 }
@@ -71,6 +99,7 @@ halt (void)
 void
 exit (int status)
 {
+  stdout_flush ();
   syscall1 (SYS_EXIT, status);
   NOT_REACHED ();
 }
@@ -78,12 +107,14 @@ exit (int status)
 pid_t
 exec (const char *file)
 {
+  stdout_flush ();
   return (pid_t) syscall1 (SYS_EXEC, file);
 }
 
 int
 wait (pid_t pid)
 {
+  stdout_flush ();
   return syscall1 (SYS_WAIT, pid);
 }
 
@@ -114,6 +145,8 @@ filesize (int fd)
 int
 read (int fd, void *buffer, unsigned size)
 {
+  if (fd == STDIN_FILENO)
+    stdout_flush ();
   return syscall3 (SYS_READ, fd, buffer, size);
 }
 
@@ -182,3 +215,246 @@ inumber (int fd)
 {
   return syscall1 (SYS_INUMBER, fd);
 }
+
+int
+readv (int fd, const struct iovec *iov, int iov_cnt)
+{
+  return syscall3 (SYS_READV, fd, iov, iov_cnt);
+}
+
+int
+writev (int fd, const struct iovec *iov, int iov_cnt)
+{
+  return syscall3 (SYS_WRITEV, fd, iov, iov_cnt);
+}
+
+int
+batch (struct batch_op *ops, int op_cnt)
+{
+  return syscall2 (SYS_BATCH, ops, op_cnt);
+}
+
+bool
+faultstat (struct fault_stats *stats)
+{
+  return syscall1 (SYS_FAULTSTAT, stats);
+}
+
+int64_t
+clock_ns (void)
+{
+  int64_t ns;
+  syscall1 (SYS_CLOCK, &ns);
+  return ns;
+}
+
+int
+futex_wait (int *addr, int expected)
+{
+  return syscall2 (SYS_FUTEX_WAIT, addr, expected);
+}
+
+int
+futex_wake (int *addr, int cnt)
+{
+  return syscall2 (SYS_FUTEX_WAKE, addr, cnt);
+}
+
+/* Where a new thread starts: the kernel enters it as if it had
+   been called with FUNC and AUX, from a null return address. */
+static void NO_RETURN
+uthread_start (void (*func) (void *), void *aux)
+{
+  func (aux);
+  thread_exit ();
+}
+
+tid_t
+thread_create (void (*func) (void *), void *aux)
+{
+  return syscall3 (SYS_THREAD_CREATE, uthread_start, func, aux);
+}
+
+int
+thread_join (tid_t tid)
+{
+  return syscall1 (SYS_THREAD_JOIN, tid);
+}
+
+void
+thread_exit (void)
+{
+  syscall0 (SYS_THREAD_EXIT);
+  NOT_REACHED ();
+}
+
+bool
+pipe (int fds[2])
+{
+  return syscall1 (SYS_PIPE, fds);
+}
+
+int
+dup (int fd)
+{
+  return syscall1 (SYS_DUP, fd);
+}
+
+int
+dup2 (int fd, int new_fd)
+{
+  return syscall2 (SYS_DUP2, fd, new_fd);
+}
+
+pid_t
+spawn (const char *file, char *const argv[],
+       const struct spawn_action actions[])
+{
+  stdout_flush ();
+  return syscall3 (SYS_SPAWN, file, argv, actions);
+}
+
+int
+copy (int src_fd, int dst_fd, unsigned length)
+{
+  return syscall3 (SYS_COPY, src_fd, dst_fd, length);
+}
+
+int
+getdents (int fd, struct dirent ents[], int cnt)
+{
+  return syscall3 (SYS_GETDENTS, fd, ents, cnt);
+}
+
+bool
+stat (const char *file, struct stat *st)
+{
+  return syscall2 (SYS_STAT, file, st);
+}
+
+int
+pread (int fd, void *buffer, unsigned length, unsigned offset)
+{
+  return syscall4 (SYS_PREAD, fd, buffer, length, offset);
+}
+
+int
+pwrite (int fd, const void *buffer, unsigned length, unsigned offset)
+{
+  return syscall4 (SYS_PWRITE, fd, buffer, length, offset);
+}
+
+bool
+fallocate (int fd, unsigned offset, unsigned length)
+{
+  return syscall3 (SYS_FALLOCATE, fd, offset, length);
+}
+
+bool
+fsync (int fd)
+{
+  return syscall1 (SYS_FSYNC, fd);
+}
+
+void
+sync (void)
+{
+  syscall0 (SYS_SYNC);
+}
+
+int
+madvise (void *addr, unsigned length, int advice)
+{
+  return syscall3 (SYS_MADVISE, addr, length, advice);
+}
+
+mapid_t
+shm_create (const char *name, unsigned length, void *addr)
+{
+  return syscall3 (SYS_SHM_CREATE, name, length, addr);
+}
+
+mapid_t
+shm_attach (const char *name, void *addr)
+{
+  return syscall2 (SYS_SHM_ATTACH, name, addr);
+}
+
+void
+shm_detach (mapid_t mapid)
+{
+  syscall1 (SYS_SHM_DETACH, mapid);
+}
+
+void *
+sbrk (intptr_t increment)
+{
+  return (void *) syscall1 (SYS_SBRK, increment);
+}
+
+bool
+setpriority (int priority)
+{
+  return syscall1 (SYS_SETPRIORITY, priority);
+}
+
+int
+getpriority (void)
+{
+  return syscall0 (SYS_GETPRIORITY);
+}
+
+int
+nice (int increment)
+{
+  return syscall1 (SYS_NICE, increment);
+}
+
+/* RUSAGE_SELF counts the threads of the process that have exited
+   and the calling thread, but not the others still running. */
+bool
+getrusage (int who, struct rusage *usage)
+{
+  return syscall2 (SYS_GETRUSAGE, who, usage);
+}
+
+int
+aio_submit (const struct aiocb *cb)
+{
+  return syscall1 (SYS_AIO_SUBMIT, cb);
+}
+
+int
+aio_wait (int id)
+{
+  return syscall1 (SYS_AIO_WAIT, id);
+}
+
+int
+aio_poll (int id)
+{
+  return syscall1 (SYS_AIO_POLL, id);
+}
+
+int
+poll (struct pollfd *fds, unsigned nfds, int timeout)
+{
+  return syscall3 (SYS_POLL, fds, nfds, timeout);
+}
+
+/* The child resumes from the interrupt frame of this call, which
+   SYSENTER does not save, so always enter through int $0x30. */
+pid_t
+fork (void)
+{
+  int retval;
+
+  /* Flush first, or the child would write out a copy of our
+     buffered output too. */
+  stdout_flush ();
+  asm volatile ("pushl %[number]; int $0x30; addl $4, %%esp"
+                : "=a" (retval)
+                : [number] "i" (SYS_FORK)
+                : "cc", "memory");
+  return retval;
+}
@@ -2,12 +2,18 @@
 #define __LIB_USER_SYSCALL_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <debug.h>
 
 /* Process identifier. */
 typedef int pid_t;
 #define PID_ERROR ((pid_t) -1)
 
+/* Thread identifier. */
+typedef int tid_t;
+#define TID_ERROR ((tid_t) -1)
+
 /* Map region identifier. */
 typedef int mapid_t;
 #define MAP_FAILED ((mapid_t) -1)
@@ -45,4 +51,213 @@ bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
 
+/* Batched I/O. */
+
+/* One buffer for readv() or writev(). */
+struct iovec
+  {
+    void *iov_base;             /* Start of buffer. */
+    size_t iov_len;             /* Length of buffer in bytes. */
+  };
+
+/* Operations for batch(). */
+enum batch_opcode
+  {
+    BATCH_READ,                 /* read (FD, BUF, LEN). */
+    BATCH_WRITE,                /* write (FD, BUF, LEN). */
+    BATCH_SEEK                  /* seek (FD, LEN); BUF is ignored. */
+  };
+
+/* One operation for batch().  RESULT receives the operation's
+   return value, or -1 for an unknown OP. */
+struct batch_op
+  {
+    int op;                     /* One of BATCH_*. */
+    int fd;                     /* File descriptor. */
+    void *buf;                  /* Buffer. */
+    unsigned len;               /* Length of BUF, or seek position. */
+    int result;                 /* Set on return. */
+  };
+
+int readv (int fd, const struct iovec *, int iov_cnt);
+int writev (int fd, const struct iovec *, int iov_cnt);
+int batch (struct batch_op *, int op_cnt);
+
+/* The calling process's page fault counts, as reported by
+   faultstat(). */
+struct fault_stats
+  {
+    unsigned minor;             /* Page in memory already, or zeroed. */
+    unsigned file;              /* Page read from its file. */
+    unsigned swap;              /* Page read from swap. */
+    unsigned stack;             /* Stack grown. */
+    unsigned cow;               /* Shared page copied on write. */
+  };
+
+bool faultstat (struct fault_stats *);
+int64_t clock_ns (void);
+
+int futex_wait (int *, int expected);
+int futex_wake (int *, int cnt);
+
+tid_t thread_create (void (*func) (void *), void *aux);
+int thread_join (tid_t);
+void thread_exit (void) NO_RETURN;
+
+bool pipe (int fds[2]);
+int dup (int fd);
+int dup2 (int fd, int new_fd);
+
+pid_t fork (void);
+
+/* Operations for spawn(). */
+enum spawn_opcode
+  {
+    SPAWN_END,                  /* Ends the list of actions. */
+    SPAWN_DUP2,                 /* Child's NEW_FD = parent's FD. */
+    SPAWN_CLOSE                 /* Close the child's FD. */
+  };
+
+/* An action for spawn() to carry out on the new process's file
+   descriptors, after it inherits descriptors 0 and 1 and before
+   its program is loaded.  At most 16 are allowed. */
+struct spawn_action
+  {
+    int op;                     /* One of SPAWN_*. */
+    int fd;                     /* Parent's descriptor, or child's. */
+    int new_fd;                 /* SPAWN_DUP2: child's descriptor. */
+  };
+
+pid_t spawn (const char *file, char *const argv[],
+             const struct spawn_action actions[]);
+
+int copy (int src_fd, int dst_fd, unsigned length);
+
+/* File types reported by stat() and getdents(). */
+enum file_type
+  {
+    FILE_REGULAR,               /* Ordinary file. */
+    FILE_DIRECTORY              /* Directory. */
+  };
+
+/* What stat() reports about a file. */
+struct stat
+  {
+    int inumber;                /* Inode number. */
+    int type;                   /* One of FILE_*. */
+    unsigned size;              /* Length in bytes. */
+  };
+
+/* A directory entry reported by getdents(). */
+struct dirent
+  {
+    struct stat st;             /* The entry's metadata. */
+    char name[READDIR_MAX_LEN + 1]; /* Null-terminated name. */
+  };
+
+int getdents (int fd, struct dirent ents[], int cnt);
+bool stat (const char *file, struct stat *);
+
+int pread (int fd, void *buffer, unsigned length, unsigned offset);
+int pwrite (int fd, const void *buffer, unsigned length, unsigned offset);
+
+bool fallocate (int fd, unsigned offset, unsigned length);
+
+bool fsync (int fd);
+void sync (void);
+
+/* Access patterns for madvise(). */
+enum madvise_advice
+  {
+    MADV_NORMAL,                /* No particular pattern. */
+    MADV_RANDOM,                /* Random access: no reading ahead. */
+    MADV_SEQUENTIAL,            /* Sequential: read far ahead. */
+    MADV_WILLNEED,              /* Bring the pages in now. */
+    MADV_DONTNEED               /* Evict the pages now. */
+  };
+
+int madvise (void *addr, unsigned length, int advice);
+
+/* Longest name of a shared memory segment. */
+#define SHM_NAME_MAX 14
+
+mapid_t shm_create (const char *name, unsigned length, void *addr);
+mapid_t shm_attach (const char *name, void *addr);
+void shm_detach (mapid_t);
+
+void *sbrk (intptr_t increment);
+
+/* Thread priorities and nice values, as in threads/thread.h. */
+#define PRI_MIN 0               /* Lowest priority. */
+#define PRI_DEFAULT 31          /* Default priority. */
+#define PRI_MAX 63              /* Highest priority. */
+#define NICE_MIN -20            /* Most favored. */
+#define NICE_MAX 20             /* Least favored. */
+
+bool setpriority (int priority);
+int getpriority (void);
+int nice (int increment);
+
+/* Resources used, as reported by getrusage(). */
+struct rusage
+  {
+    int64_t user_ns;            /* CPU time in user mode. */
+    int64_t kernel_ns;          /* CPU time in the kernel. */
+    unsigned faults;            /* Page faults. */
+    unsigned sectors_read;      /* Disk sectors read. */
+    unsigned sectors_written;   /* Disk sectors written. */
+  };
+
+/* Whose usage getrusage() reports. */
+#define RUSAGE_SELF 0           /* Calling process, see getrusage(). */
+#define RUSAGE_THREAD 1         /* Calling thread. */
+
+bool getrusage (int who, struct rusage *);
+
+/* An asynchronous transfer, as started by aio_submit(). */
+struct aiocb
+  {
+    int fd;                     /* File descriptor. */
+    void *buffer;               /* Data to write or room to read into. */
+    unsigned length;            /* Bytes to transfer. */
+    unsigned offset;            /* Offset in the file. */
+    int op;                     /* AIO_READ or AIO_WRITE. */
+  };
+
+/* Transfers in aiocb's OP. */
+#define AIO_READ 0              /* Read from the file into BUFFER. */
+#define AIO_WRITE 1             /* Write BUFFER to the file. */
+
+/* Returned by aio_poll() while a transfer is in progress. */
+#define AIO_PENDING (-2)
+
+/* aio_submit() returns an id for the transfer, or -1.  The
+   first aio_wait() or aio_poll() to find it done reaps it and
+   returns the number of bytes transferred; the id is then no
+   longer valid. */
+int aio_submit (const struct aiocb *);
+int aio_wait (int id);
+int aio_poll (int id);
+
+/* A descriptor for poll() to wait for. */
+struct pollfd
+  {
+    int fd;                     /* File descriptor. */
+    short events;               /* POLL* events to wait for. */
+    short revents;              /* POLL* events that happened. */
+  };
+
+/* Events in struct pollfd.  POLLHUP and POLLNVAL are reported
+   whether asked for or not. */
+#define POLLIN 0x01             /* Reading would not wait. */
+#define POLLOUT 0x02            /* Writing would not wait. */
+#define POLLHUP 0x04            /* The other end of a pipe is gone. */
+#define POLLNVAL 0x08           /* Not an open descriptor. */
+
+/* Waits up to TIMEOUT timer ticks, or forever if TIMEOUT is
+   negative, for any of the NFDS descriptors in FDS to be ready.
+   Returns the number of descriptors with events, 0 on timeout,
+   or -1 on failure. */
+int poll (struct pollfd *fds, unsigned nfds, int timeout);
+
 #endif /* lib/user/syscall.h */
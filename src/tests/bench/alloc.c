@@ -0,0 +1,82 @@
+/* Benchmarks of the kernel memory allocators.
+
+   malloc: For each power-of-2 block size from 16 to 4096 bytes,
+   the last of which malloc() satisfies with whole pages, times
+   a malloc() immediately followed by free(), and also a batch of
+   BATCH_CNT malloc() calls followed by freeing them all.
+
+   palloc: Times palloc_get_page() followed by palloc_free_page(),
+   and the same for multi-page blocks. */
+
+#include "tests/bench/bench.h"
+#include <stdio.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "devices/timer.h"
+
+/* Number of allocations timed for each size. */
+#define ITER_CNT 1000
+
+/* Number of blocks allocated before freeing in a batch. */
+#define BATCH_CNT 64
+
+/* Returns the time between START and now, in nanoseconds,
+   divided by CNT. */
+static int64_t
+ns_per (uint64_t start, int cnt) 
+{
+  return timer_cycles_to_ns (timer_cycles () - start) / cnt;
+}
+
+void
+bench_malloc (void) 
+{
+  size_t size;
+
+  for (size = 16; size <= 4096; size *= 2) 
+    {
+      static void *blocks[BATCH_CNT];
+      char metric[32];
+      uint64_t start;
+      int i, j;
+
+      start = timer_cycles ();
+      for (i = 0; i < ITER_CNT; i++)
+        free (malloc (size));
+      snprintf (metric, sizeof metric, "pair_ns_%zu", size);
+      bench_report (metric, ns_per (start, ITER_CNT));
+
+      start = timer_cycles ();
+      for (i = 0; i < ITER_CNT / BATCH_CNT; i++) 
+        {
+          for (j = 0; j < BATCH_CNT; j++)
+            blocks[j] = malloc (size);
+          for (j = 0; j < BATCH_CNT; j++)
+            free (blocks[j]);
+        }
+      snprintf (metric, sizeof metric, "batch_ns_%zu", size);
+      bench_report (metric, ns_per (start, ITER_CNT / BATCH_CNT * BATCH_CNT));
+    }
+}
+
+void
+bench_palloc (void) 
+{
+  static const size_t page_cnts[] = {1, 4, 16};
+  size_t k;
+
+  for (k = 0; k < sizeof page_cnts / sizeof *page_cnts; k++) 
+    {
+      size_t page_cnt = page_cnts[k];
+      char metric[32];
+      uint64_t start;
+      int i;
+
+      start = timer_cycles ();
+      for (i = 0; i < ITER_CNT; i++)
+        palloc_free_multiple (palloc_get_multiple (PAL_ASSERT, page_cnt),
+                              page_cnt);
+      snprintf (metric, sizeof metric, "pair_ns_%zu_pages", page_cnt);
+      bench_report (metric, ns_per (start, ITER_CNT));
+    }
+}
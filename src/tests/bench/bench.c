@@ -0,0 +1,65 @@
+#include "tests/bench/bench.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Kernel microbenchmarks.
+
+   Each benchmark measures one kernel facility with the
+   time-stamp counter and reports its results through
+   bench_report(), which prints one line per result in the
+   machine-readable form
+        BENCH <benchmark> <metric> <value>
+   "make bench" in a kernel directory runs every benchmark and
+   collects these lines into build/bench.out. */
+
+struct bench 
+  {
+    const char *name;
+    bench_func *function;
+  };
+
+static const struct bench benches[] = 
+  {
+    {"ctxsw", bench_ctxsw},
+    {"lock", bench_lock},
+    {"sema", bench_sema},
+    {"sleep", bench_sleep},
+    {"malloc", bench_malloc},
+    {"palloc", bench_palloc},
+#ifdef FILESYS
+    {"inode", bench_inode},
+#endif
+  };
+
+/* Name of the benchmark being run. */
+static const char *bench_name;
+
+/* Runs the benchmark named NAME, or all of them if NAME is
+   "all". */
+void
+run_bench (const char *name) 
+{
+  const struct bench *b;
+  bool all = !strcmp (name, "all");
+
+  for (b = benches; b < benches + sizeof benches / sizeof *benches; b++)
+    if (all || !strcmp (name, b->name))
+      {
+        bench_name = b->name;
+        b->function ();
+        if (!all)
+          return;
+      }
+  if (!all)
+    PANIC ("no benchmark named \"%s\"", name);
+}
+
+/* Reports VALUE as the result for METRIC of the running
+   benchmark. */
+void
+bench_report (const char *metric, int64_t value) 
+{
+  printf ("BENCH %s %s %"PRId64"\n", bench_name, metric, value);
+}
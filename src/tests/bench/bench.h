@@ -0,0 +1,22 @@
+#ifndef TESTS_BENCH_BENCH_H
+#define TESTS_BENCH_BENCH_H
+
+#include <stdint.h>
+
+void run_bench (const char *name);
+
+typedef void bench_func (void);
+
+extern bench_func bench_ctxsw;
+extern bench_func bench_lock;
+extern bench_func bench_sema;
+extern bench_func bench_sleep;
+extern bench_func bench_malloc;
+extern bench_func bench_palloc;
+#ifdef FILESYS
+extern bench_func bench_inode;
+#endif
+
+void bench_report (const char *metric, int64_t value);
+
+#endif /* tests/bench/bench.h */
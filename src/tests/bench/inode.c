@@ -0,0 +1,64 @@
+/* Benchmark of inode_read_at().
+
+   Creates a FILE_SIZE-byte file and times BLOCK_SECTOR_SIZE-byte
+   inode_read_at() calls over it, first sequentially from start
+   to end, then at RANDOM_CNT random sector-aligned offsets.  The
+   sequential pass starts with the file's blocks out of the
+   buffer cache, as far as creating the file allows.  Requires
+   the file system to have been formatted with -f. */
+
+#ifdef FILESYS
+#include "tests/bench/bench.h"
+#include <debug.h>
+#include <random.h>
+#include "filesys/file.h"
+#include "filesys/filesys.h"
+#include "filesys/inode.h"
+#include "devices/block.h"
+#include "devices/timer.h"
+
+/* Size of the file read. */
+#define FILE_SIZE (128 * 1024)
+
+/* Number of random reads. */
+#define RANDOM_CNT 256
+
+void
+bench_inode (void) 
+{
+  static char buf[BLOCK_SECTOR_SIZE];
+  const int sector_cnt = FILE_SIZE / BLOCK_SECTOR_SIZE;
+  struct file *file;
+  struct inode *inode;
+  uint64_t start, cycles;
+  off_t ofs;
+  int i;
+
+  if (!filesys_create ("bench-inode", FILE_SIZE))
+    PANIC ("bench-inode: create failed (format the file system with -f)");
+  file = filesys_open ("bench-inode");
+  if (file == NULL)
+    PANIC ("bench-inode: open failed");
+  inode = file_get_inode (file);
+
+  start = timer_cycles ();
+  for (ofs = 0; ofs < FILE_SIZE; ofs += BLOCK_SECTOR_SIZE)
+    inode_read_at (inode, buf, BLOCK_SECTOR_SIZE, ofs);
+  cycles = timer_cycles () - start;
+  bench_report ("seq_read_ns", timer_cycles_to_ns (cycles) / sector_cnt);
+  bench_report ("seq_kb_per_s", (int64_t) FILE_SIZE / 1024 * 1000 * 1000
+                / (timer_cycles_to_ns (cycles) / 1000 + 1));
+
+  start = timer_cycles ();
+  for (i = 0; i < RANDOM_CNT; i++) 
+    {
+      ofs = random_ulong () % sector_cnt * BLOCK_SECTOR_SIZE;
+      inode_read_at (inode, buf, BLOCK_SECTOR_SIZE, ofs);
+    }
+  cycles = timer_cycles () - start;
+  bench_report ("rand_read_ns", timer_cycles_to_ns (cycles) / RANDOM_CNT);
+
+  file_close (file);
+  filesys_remove ("bench-inode");
+}
+#endif /* FILESYS */
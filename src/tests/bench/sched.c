@@ -0,0 +1,182 @@
+/* Benchmarks of thread switching, synchronization, and sleep.
+
+   ctxsw: Two threads of equal priority call thread_yield() back
+   and forth.  Reports the time for one round trip, that is, two
+   context switches.
+
+   lock: Times uncontended lock_acquire() plus lock_release(),
+   and a contended acquire, in which a higher-priority thread
+   blocks on a lock held by the main thread and takes it over
+   when the main thread releases it.
+
+   sema: Two threads ping-pong through a pair of semaphores, as
+   in sema_self_test().  Reports the time for one round trip.
+
+   sleep: Repeatedly sleeps for one tick, starting just after a
+   tick, and reports how long after the expected wakeup time the
+   thread actually ran again. */
+
+#include "tests/bench/bench.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+/* Number of iterations for each of the thread benchmarks. */
+#define ITER_CNT 10000
+
+/* Number of one-tick sleeps timed by bench_sleep(). */
+#define SLEEP_CNT 20
+
+/* Data shared with the helper threads. */
+struct pair 
+  {
+    struct semaphore sema[2];   /* For ping-pong. */
+    struct semaphore done;      /* Upped when helper finishes. */
+    struct lock lock;           /* For the contended lock. */
+  };
+
+/* Returns the time between START and now, in nanoseconds,
+   divided by CNT. */
+static int64_t
+ns_per (uint64_t start, int cnt) 
+{
+  return timer_cycles_to_ns (timer_cycles () - start) / cnt;
+}
+
+static void
+yield_thread (void *pair_) 
+{
+  struct pair *p = pair_;
+  int i;
+
+  for (i = 0; i < ITER_CNT; i++)
+    thread_yield ();
+  sema_up (&p->done);
+}
+
+void
+bench_ctxsw (void) 
+{
+  struct pair p;
+  uint64_t start;
+  int i;
+
+  sema_init (&p.done, 0);
+  thread_create ("yield", thread_get_priority (), yield_thread, &p);
+
+  start = timer_cycles ();
+  for (i = 0; i < ITER_CNT; i++)
+    thread_yield ();
+  sema_down (&p.done);
+  bench_report ("round_trip_ns", ns_per (start, ITER_CNT));
+}
+
+static void
+lock_thread (void *pair_) 
+{
+  struct pair *p = pair_;
+  int i;
+
+  for (i = 0; i < ITER_CNT; i++) 
+    {
+      sema_down (&p->sema[0]);
+      lock_acquire (&p->lock);
+      lock_release (&p->lock);
+    }
+  sema_up (&p->done);
+}
+
+void
+bench_lock (void) 
+{
+  struct pair p;
+  uint64_t start;
+  int i;
+
+  lock_init (&p.lock);
+  sema_init (&p.sema[0], 0);
+  sema_init (&p.done, 0);
+
+  start = timer_cycles ();
+  for (i = 0; i < ITER_CNT; i++) 
+    {
+      lock_acquire (&p.lock);
+      lock_release (&p.lock);
+    }
+  bench_report ("uncontended_ns", ns_per (start, ITER_CNT));
+
+  /* The helper runs as soon as it is woken (except under the
+     MLFQS, which ignores the priority given here), blocks on
+     the lock, and acquires it as soon as this thread lets go. */
+  thread_create ("lock", thread_get_priority () + 1, lock_thread, &p);
+  start = timer_cycles ();
+  for (i = 0; i < ITER_CNT; i++) 
+    {
+      lock_acquire (&p.lock);
+      sema_up (&p.sema[0]);
+      lock_release (&p.lock);
+    }
+  sema_down (&p.done);
+  bench_report ("contended_ns", ns_per (start, ITER_CNT));
+}
+
+static void
+sema_thread (void *pair_) 
+{
+  struct pair *p = pair_;
+  int i;
+
+  for (i = 0; i < ITER_CNT; i++) 
+    {
+      sema_down (&p->sema[0]);
+      sema_up (&p->sema[1]);
+    }
+  sema_up (&p->done);
+}
+
+void
+bench_sema (void) 
+{
+  struct pair p;
+  uint64_t start;
+  int i;
+
+  sema_init (&p.sema[0], 0);
+  sema_init (&p.sema[1], 0);
+  sema_init (&p.done, 0);
+  thread_create ("sema", thread_get_priority (), sema_thread, &p);
+
+  start = timer_cycles ();
+  for (i = 0; i < ITER_CNT; i++) 
+    {
+      sema_up (&p.sema[0]);
+      sema_down (&p.sema[1]);
+    }
+  sema_down (&p.done);
+  bench_report ("round_trip_ns", ns_per (start, ITER_CNT));
+}
+
+void
+bench_sleep (void) 
+{
+  const int64_t tick_ns = 1000 * 1000 * 1000 / TIMER_FREQ;
+  int64_t total = 0, max = 0;
+  int i;
+
+  /* Start just after a tick. */
+  timer_sleep (1);
+
+  for (i = 0; i < SLEEP_CNT; i++) 
+    {
+      int64_t start = timer_ns ();
+      int64_t latency;
+
+      timer_sleep (1);
+      latency = timer_ns () - start - tick_ns;
+      total += latency;
+      if (latency > max)
+        max = latency;
+    }
+  bench_report ("avg_latency_ns", total / SLEEP_CNT);
+  bench_report ("max_latency_ns", max);
+}
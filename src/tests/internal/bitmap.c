@@ -0,0 +1,159 @@
+/* Test program for lib/kernel/bitmap.c.
+
+   Checks bitmap_scan(), bitmap_count(), and bitmap_contains()
+   against simple bit-at-a-time versions on bitmaps of random
+   sizes and densities, then times bitmap_scan() on a fragmented
+   bitmap the size of the free map of an 8 MB disk.
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <bitmap.h>
+#include <debug.h>
+#include <random.h>
+#include <stdio.h>
+#include "devices/timer.h"
+#include "threads/test.h"
+
+/* Largest bitmap checked against the reference versions. */
+#define MAX_BITS 300
+
+/* Bits in the free map of an 8 MB disk with 512-byte sectors. */
+#define FREE_MAP_BITS (8 * 1024 * 1024 / 512)
+
+/* Scans timed for each run length. */
+#define SCAN_CNT 1000
+
+static size_t slow_scan (const struct bitmap *, size_t start, size_t cnt,
+                         bool value);
+static size_t slow_count (const struct bitmap *, size_t start, size_t cnt,
+                          bool value);
+static void check_random (void);
+static void time_scans (void);
+
+/* Test the bitmap implementation. */
+void
+test (void) 
+{
+  check_random ();
+  time_scans ();
+  printf ("bitmap: PASS\n");
+}
+
+/* Checks the word-at-a-time functions against the reference
+   versions on random bitmaps. */
+static void
+check_random (void) 
+{
+  int repeat;
+
+  printf ("testing random bitmaps:");
+  for (repeat = 0; repeat < 1000; repeat++) 
+    {
+      size_t bit_cnt = random_ulong () % MAX_BITS;
+      unsigned density = random_ulong () % 100;
+      struct bitmap *b = bitmap_create (bit_cnt);
+      size_t i;
+      int query;
+
+      ASSERT (b != NULL);
+      for (i = 0; i < bit_cnt; i++)
+        bitmap_set (b, i, random_ulong () % 100 < density);
+
+      for (query = 0; query < 50; query++) 
+        {
+          size_t start = random_ulong () % (bit_cnt + 1);
+          size_t cnt = random_ulong () % (bit_cnt + 2);
+          bool value = random_ulong () % 2;
+
+          ASSERT (bitmap_scan (b, start, cnt, value)
+                  == slow_scan (b, start, cnt, value));
+          if (start + cnt <= bit_cnt) 
+            {
+              size_t value_cnt = slow_count (b, start, cnt, value);
+              ASSERT (bitmap_count (b, start, cnt, value) == value_cnt);
+              ASSERT (bitmap_contains (b, start, cnt, value)
+                      == (value_cnt > 0));
+            }
+        }
+      bitmap_destroy (b);
+
+      if (repeat % 100 == 0)
+        printf (" %d", repeat);
+    }
+  printf (" done\n");
+}
+
+/* Times bitmap_scan() and the reference version on a free map
+   that is mostly allocated, with free runs of random lengths. */
+static void
+time_scans (void) 
+{
+  static const size_t run_lengths[] = {1, 8, 64};
+  struct bitmap *b = bitmap_create (FREE_MAP_BITS);
+  size_t i;
+
+  ASSERT (b != NULL);
+  bitmap_set_all (b, true);
+  for (i = 0; i < FREE_MAP_BITS; i += 64) 
+    {
+      size_t len = random_ulong () % 40;
+      if (i + len <= FREE_MAP_BITS)
+        bitmap_set_multiple (b, i, len, false);
+    }
+  bitmap_set_multiple (b, FREE_MAP_BITS - 64, 64, false);
+
+  for (i = 0; i < sizeof run_lengths / sizeof *run_lengths; i++) 
+    {
+      size_t cnt = run_lengths[i];
+      int64_t start;
+      int64_t fast, slow;
+      int j;
+
+      start = timer_ticks ();
+      for (j = 0; j < SCAN_CNT; j++)
+        ASSERT (bitmap_scan (b, 0, cnt, false) != BITMAP_ERROR);
+      fast = timer_elapsed (start);
+
+      start = timer_ticks ();
+      for (j = 0; j < SCAN_CNT; j++)
+        ASSERT (slow_scan (b, 0, cnt, false) != BITMAP_ERROR);
+      slow = timer_elapsed (start);
+
+      printf ("runs of %zu: %d scans in %"PRId64" ticks, "
+              "%"PRId64" bit at a time\n", cnt, SCAN_CNT, fast, slow);
+    }
+  bitmap_destroy (b);
+}
+
+/* Finds a run of CNT bits set to VALUE the way bitmap_scan()
+   used to, one starting position and one bit at a time. */
+static size_t
+slow_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) 
+{
+  if (cnt <= bitmap_size (b)) 
+    {
+      size_t last = bitmap_size (b) - cnt;
+      size_t i;
+
+      for (i = start; i <= last; i++)
+        if (slow_count (b, i, cnt, value) == cnt)
+          return i;
+    }
+  return BITMAP_ERROR;
+}
+
+/* Counts the bits set to VALUE one at a time. */
+static size_t
+slow_count (const struct bitmap *b, size_t start, size_t cnt, bool value) 
+{
+  size_t value_cnt = 0;
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    if (bitmap_test (b, start + i) == value)
+      value_cnt++;
+  return value_cnt;
+}
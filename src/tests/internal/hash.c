@@ -0,0 +1,127 @@
+/* Test program for the hash functions in lib/kernel/hash.c.
+
+   Checks that hash_string() and hash_bytes() do not depend on
+   the alignment of their input, then measures how evenly
+   hash_u32() and hash_ptr() spread the kinds of keys kernel
+   tables use (small integers, sector numbers, page addresses)
+   over a power-of-2 number of buckets, and how fast hash_bytes()
+   hashes a page.
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <debug.h>
+#include <hash.h>
+#include <inttypes.h>
+#include <random.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/test.h"
+#include "devices/timer.h"
+
+/* Number of buckets and keys for the distribution tests. */
+#define BUCKET_CNT 64
+#define KEY_CNT (BUCKET_CNT * 64)
+
+/* Number of times to hash a page for the speed test. */
+#define SPEED_LOOPS 1000
+
+static void test_alignment (void);
+static void test_distribution (const char *name, uint32_t step,
+                               bool as_ptr);
+static void test_speed (void);
+
+/* Test the hash functions. */
+void
+test (void) 
+{
+  test_alignment ();
+  test_distribution ("integers", 1, false);
+  test_distribution ("sectors", 8, false);
+  test_distribution ("pages", 4096, true);
+  test_speed ();
+  printf ("hash: PASS\n");
+}
+
+/* Checks that a string hashes the same at every alignment, the
+   same as its bytes, and differently from its prefixes. */
+static void
+test_alignment (void) 
+{
+  static const char s[] = "the quick brown fox jumps over the lazy dog";
+  char buf[sizeof s + sizeof (uint32_t)];
+  size_t len;
+
+  printf ("testing alignment and prefixes:");
+  for (len = 0; len < sizeof s; len++) 
+    {
+      unsigned expected = hash_bytes (s, len);
+      size_t ofs;
+
+      for (ofs = 0; ofs < sizeof (uint32_t); ofs++)
+        {
+          memcpy (buf + ofs, s, len);
+          buf[ofs + len] = '\0';
+          ASSERT (hash_bytes (buf + ofs, len) == expected);
+          ASSERT (hash_string (buf + ofs) == expected);
+        }
+      if (len > 0)
+        {
+          ASSERT (expected != hash_bytes (s, len - 1));
+        }
+    }
+  printf (" done\n");
+}
+
+/* Hashes KEY_CNT keys 0, STEP, 2 * STEP, ... into BUCKET_CNT
+   buckets, as hash_u32() or, if AS_PTR, as pointers with
+   hash_ptr(), and checks that no bucket gets more than twice
+   its share.  With a perfect hash, the count in each bucket is
+   about 64 +/- 8. */
+static void
+test_distribution (const char *name, uint32_t step, bool as_ptr) 
+{
+  static size_t buckets[BUCKET_CNT];
+  size_t max = 0, min = KEY_CNT;
+  size_t i;
+
+  memset (buckets, 0, sizeof buckets);
+  for (i = 0; i < KEY_CNT; i++) 
+    {
+      uint32_t key = i * step;
+      unsigned hash = as_ptr ? hash_ptr ((void *) key) : hash_u32 (key);
+      buckets[hash % BUCKET_CNT]++;
+    }
+  for (i = 0; i < BUCKET_CNT; i++) 
+    {
+      if (buckets[i] > max)
+        max = buckets[i];
+      if (buckets[i] < min)
+        min = buckets[i];
+    }
+  printf ("%s: %d keys in %d buckets, %zu to %zu per bucket\n",
+          name, KEY_CNT, BUCKET_CNT, min, max);
+  ASSERT (max <= 2 * KEY_CNT / BUCKET_CNT);
+  ASSERT (min >= KEY_CNT / BUCKET_CNT / 2);
+}
+
+/* Reports how long hash_bytes() takes to hash a page of random
+   data SPEED_LOOPS times. */
+static void
+test_speed (void) 
+{
+  static uint32_t page[4096 / sizeof (uint32_t)];
+  unsigned hash = 0;
+  int64_t start;
+  size_t i;
+
+  for (i = 0; i < sizeof page / sizeof *page; i++)
+    page[i] = random_ulong ();
+  start = timer_ticks ();
+  for (i = 0; i < SPEED_LOOPS; i++)
+    hash ^= hash_bytes (page, sizeof page);
+  printf ("hashed %d pages in %"PRId64" ticks (%08x)\n",
+          SPEED_LOOPS, timer_elapsed (start), hash);
+}
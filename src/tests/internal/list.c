@@ -25,6 +25,9 @@ struct value
     int value;                  /* Item value. */
   };
 
+/* The same operations, specialized to struct value. */
+LIST_DEFINE_ORDERED (value, struct value, elem, value)
+
 static void shuffle (struct value[], size_t);
 static bool value_less (const struct list_elem *, const struct list_elem *,
                         void *);
@@ -85,6 +88,24 @@ test (void)
                                  value_less, NULL);
           verify_list_fwd (&list, size);
 
+          /* The same, with the specialized functions. */
+          shuffle (values, size);
+          list_init (&list);
+          for (i = 0; i < size; i++)
+            list_push_back (&list, &values[i].elem);
+          ASSERT (size ? value_min (&list)->value == 0
+                  : value_min (&list) == NULL);
+          ASSERT (size ? value_max (&list)->value == size - 1
+                  : value_max (&list) == NULL);
+          value_sort (&list);
+          verify_list_fwd (&list, size);
+
+          shuffle (values, size);
+          list_init (&list);
+          for (i = 0; i < size; i++)
+            value_insert_ordered (&list, &values[i]);
+          verify_list_fwd (&list, size);
+
           /* Duplicate some items, uniquify, and verify. */
           ofs = size;
           for (e = list_begin (&list); e != list_end (&list);
@@ -0,0 +1,133 @@
+/* Test program for lib/kernel/ohash.c.
+
+   Inserts, finds, and deletes random keys, checking the table
+   against an array of flags that records which keys are present,
+   with many operations falling while the table is part of the
+   way through growing.
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <debug.h>
+#include <hash.h>
+#include <ohash.h>
+#include <random.h>
+#include <stdio.h>
+#include "threads/test.h"
+
+/* Number of distinct keys. */
+#define KEY_CNT 1000
+
+/* An element of the table. */
+struct item 
+  {
+    struct ohash_elem elem;
+    int key;
+  };
+
+static struct item items[KEY_CNT];
+static bool present[KEY_CNT];
+
+static unsigned item_hash (const struct ohash_elem *, void *);
+static bool item_less (const struct ohash_elem *, const struct ohash_elem *,
+                       void *);
+static void count_item (struct ohash_elem *, void *);
+static int find_key (struct ohash *, int key);
+
+/* Test the open-addressing hash table implementation. */
+void
+test (void) 
+{
+  struct ohash h;
+  size_t cnt = 0;
+  size_t seen;
+  int i;
+
+  ASSERT (ohash_init (&h, item_hash, item_less, NULL));
+  for (i = 0; i < KEY_CNT; i++)
+    items[i].key = i;
+
+  printf ("testing random insertions and deletions:");
+  for (i = 0; i < 100000; i++) 
+    {
+      int key = random_ulong () % KEY_CNT;
+
+      /* Lean towards insertion early on, so the table grows,
+         and towards deletion later, so it empties again. */
+      if (random_ulong () % 100 < (i < 50000 ? 70 : 30)) 
+        {
+          struct ohash_elem *old = ohash_insert (&h, &items[key].elem);
+          ASSERT (present[key] ? old == &items[key].elem : old == NULL);
+          if (!present[key])
+            cnt++;
+          present[key] = true;
+        }
+      else 
+        {
+          struct ohash_elem *old = ohash_delete (&h, &items[key].elem);
+          ASSERT (present[key] ? old == &items[key].elem : old == NULL);
+          if (present[key])
+            cnt--;
+          present[key] = false;
+        }
+
+      ASSERT (ohash_size (&h) == cnt);
+      ASSERT (find_key (&h, random_ulong () % KEY_CNT) >= 0);
+      if (i % 10000 == 0)
+        printf (" %d", i / 10000);
+    }
+  printf ("\n");
+
+  for (i = 0; i < KEY_CNT; i++)
+    ASSERT (find_key (&h, i) >= 0);
+  ohash_apply (&h, count_item);
+  seen = 0;
+  for (i = 0; i < KEY_CNT; i++)
+    seen += present[i];
+  ASSERT (seen == cnt);
+
+  ohash_destroy (&h, NULL);
+  printf ("ohash: PASS\n");
+}
+
+/* Returns KEY if it is correctly present or absent in H,
+   otherwise -1. */
+static int
+find_key (struct ohash *h, int key) 
+{
+  struct item probe;
+  struct ohash_elem *e;
+
+  probe.key = key;
+  e = ohash_find (h, &probe.elem);
+  if (present[key])
+    return e == &items[key].elem ? key : -1;
+  else
+    return e == NULL ? key : -1;
+}
+
+/* Checks that element E is marked present. */
+static void
+count_item (struct ohash_elem *e, void *aux UNUSED) 
+{
+  struct item *item = ohash_entry (e, struct item, elem);
+  ASSERT (present[item->key]);
+}
+
+/* Hashes the key of element E. */
+static unsigned
+item_hash (const struct ohash_elem *e, void *aux UNUSED) 
+{
+  return hash_int (ohash_entry (e, struct item, elem)->key);
+}
+
+/* Returns true if element A's key is less than element B's. */
+static bool
+item_less (const struct ohash_elem *a, const struct ohash_elem *b,
+           void *aux UNUSED) 
+{
+  return (ohash_entry (a, struct item, elem)->key
+          < ohash_entry (b, struct item, elem)->key);
+}
@@ -0,0 +1,160 @@
+/* Test program for lib/kernel/pheap.c.
+
+   Runs random sequences of insertions, raised keys, removals of
+   arbitrary elements, and removals of the maximum against a
+   heap, checking after every step that it reports the same
+   maximum as a search of all the elements.
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <debug.h>
+#include <pheap.h>
+#include <random.h>
+#include <stdio.h>
+#include "threads/test.h"
+
+/* Maximum number of elements in a heap that we will test. */
+#define MAX_SIZE 64
+
+/* A heap element. */
+struct value 
+  {
+    struct pheap_elem elem;     /* Heap element. */
+    int value;                  /* Item value. */
+    bool in_heap;               /* Currently in the heap? */
+  };
+
+static bool value_less (const struct pheap_elem *, const struct pheap_elem *,
+                        void *);
+static void verify_max (struct pheap *, struct value[], int size);
+
+/* Test the pairing heap implementation. */
+void
+test (void) 
+{
+  int size;
+
+  printf ("testing various size heaps:");
+  for (size = 1; size <= MAX_SIZE; size++) 
+    {
+      int repeat;
+
+      printf (" %d", size);
+      for (repeat = 0; repeat < 10; repeat++) 
+        {
+          static struct value values[MAX_SIZE];
+          struct pheap heap;
+          int i, step;
+
+          pheap_init (&heap, value_less, NULL);
+          for (i = 0; i < size; i++)
+            values[i].in_heap = false;
+
+          for (step = 0; step < size * 20; step++) 
+            {
+              struct value *v = &values[random_ulong () % size];
+
+              switch (random_ulong () % 4) 
+                {
+                case 0:
+                  /* Insert. */
+                  if (!v->in_heap) 
+                    {
+                      v->value = random_ulong () % (size * 2);
+                      pheap_insert (&heap, &v->elem);
+                      v->in_heap = true;
+                    }
+                  break;
+
+                case 1:
+                  /* Raise. */
+                  if (v->in_heap) 
+                    {
+                      v->value += random_ulong () % (size + 1);
+                      pheap_raise (&heap, &v->elem);
+                    }
+                  break;
+
+                case 2:
+                  /* Remove. */
+                  if (v->in_heap) 
+                    {
+                      pheap_remove (&heap, &v->elem);
+                      v->in_heap = false;
+                    }
+                  break;
+
+                case 3:
+                  /* Pop. */
+                  if (!pheap_empty (&heap)) 
+                    {
+                      struct pheap_elem *e = pheap_pop (&heap);
+                      pheap_entry (e, struct value, elem)->in_heap = false;
+                    }
+                  else
+                    ASSERT (pheap_pop (&heap) == NULL);
+                  break;
+                }
+              verify_max (&heap, values, size);
+            }
+
+          /* Popping everything must yield nonincreasing values. */
+          while (!pheap_empty (&heap)) 
+            {
+              struct value *v = pheap_entry (pheap_pop (&heap),
+                                             struct value, elem);
+              v->in_heap = false;
+              verify_max (&heap, values, size);
+              ASSERT (pheap_top (&heap) == NULL
+                      || (pheap_entry (pheap_top (&heap), struct value, elem)
+                          ->value <= v->value));
+            }
+        }
+    }
+  printf (" done\n");
+  printf ("pheap: PASS\n");
+}
+
+/* Returns true if value A is less than value B, false
+   otherwise. */
+static bool
+value_less (const struct pheap_elem *a_, const struct pheap_elem *b_,
+            void *aux UNUSED) 
+{
+  const struct value *a = pheap_entry (a_, struct value, elem);
+  const struct value *b = pheap_entry (b_, struct value, elem);
+  
+  return a->value < b->value;
+}
+
+/* Verifies that HEAP holds exactly the elements of VALUES[] that
+   are marked as in the heap, and that its top has the greatest
+   value among them. */
+static void
+verify_max (struct pheap *heap, struct value values[], int size) 
+{
+  size_t cnt = 0;
+  int max = -1;
+  int i;
+
+  for (i = 0; i < size; i++)
+    if (values[i].in_heap) 
+      {
+        cnt++;
+        if (values[i].value > max)
+          max = values[i].value;
+      }
+
+  ASSERT (pheap_size (heap) == cnt);
+  if (cnt == 0)
+    {
+      ASSERT (pheap_top (heap) == NULL);
+    }
+  else
+    {
+      ASSERT (pheap_entry (pheap_top (heap), struct value, elem)->value == max);
+    }
+}
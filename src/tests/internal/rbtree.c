@@ -0,0 +1,258 @@
+/* Test program for lib/kernel/rbtree.c.
+
+   Builds trees of various sizes in random order, checking the
+   red-black properties after every insertion and deletion, and
+   checks traversal and searches against the expected values.
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <debug.h>
+#include <random.h>
+#include <rbtree.h>
+#include <stdio.h>
+#include "threads/test.h"
+
+/* Maximum number of nodes in a tree that we will test. */
+#define MAX_SIZE 64
+
+/* A tree node. */
+struct value 
+  {
+    struct rb_node node;        /* Tree node. */
+    int value;                  /* Item value. */
+    int seq;                    /* Order of insertion. */
+  };
+
+static void shuffle (struct value[], size_t);
+static bool value_less (const struct rb_node *, const struct rb_node *,
+                        void *);
+static int check_node (const struct rb_node *, const struct rb_node *parent);
+static void verify_tree (struct rb_tree *, int size, int step);
+static void verify_bounds (struct rb_tree *, int size);
+static void verify_duplicates (void);
+
+/* Test the red-black tree implementation. */
+void
+test (void) 
+{
+  int size;
+
+  printf ("testing various size trees:");
+  for (size = 0; size < MAX_SIZE; size++) 
+    {
+      int repeat;
+
+      printf (" %d", size);
+      for (repeat = 0; repeat < 10; repeat++) 
+        {
+          static struct value values[MAX_SIZE];
+          struct rb_tree tree;
+          int i;
+
+          /* Put values 0, 2, ..., 2 * (SIZE - 1) in random order
+             in VALUES and insert them. */
+          for (i = 0; i < size; i++)
+            values[i].value = i * 2;
+          shuffle (values, size);
+          rb_init (&tree, value_less, NULL);
+          for (i = 0; i < size; i++) 
+            {
+              rb_insert (&tree, &values[i].node);
+              check_node (tree.root, NULL);
+            }
+          verify_tree (&tree, size, 2);
+          verify_bounds (&tree, size);
+
+          /* Erase the odd multiples of 2, then the rest.  VALUES
+             is still in random order. */
+          for (i = 0; i < size; i++)
+            if (values[i].value % 4 == 2) 
+              {
+                rb_erase (&tree, &values[i].node);
+                check_node (tree.root, NULL);
+              }
+          verify_tree (&tree, (size + 1) / 2, 4);
+          for (i = 0; i < size; i++)
+            if (values[i].value % 4 == 0) 
+              {
+                rb_erase (&tree, &values[i].node);
+                check_node (tree.root, NULL);
+              }
+          ASSERT (rb_empty (&tree));
+          ASSERT (rb_first (&tree) == NULL);
+          ASSERT (rb_last (&tree) == NULL);
+        }
+    }
+  printf (" done\n");
+
+  verify_duplicates ();
+  printf ("rbtree: PASS\n");
+}
+
+/* Shuffles the CNT elements in ARRAY into random order. */
+static void
+shuffle (struct value *array, size_t cnt) 
+{
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    {
+      size_t j = i + random_ulong () % (cnt - i);
+      struct value t = array[j];
+      array[j] = array[i];
+      array[i] = t;
+    }
+}
+
+/* Returns true if value A is less than value B, false
+   otherwise. */
+static bool
+value_less (const struct rb_node *a_, const struct rb_node *b_,
+            void *aux UNUSED) 
+{
+  const struct value *a = rb_entry (a_, struct value, node);
+  const struct value *b = rb_entry (b_, struct value, node);
+  
+  return a->value < b->value;
+}
+
+/* Checks the subtree rooted at N, whose parent should be PARENT,
+   for correct parent pointers, for red nodes with red children,
+   and for paths with differing numbers of black nodes.  Returns
+   the number of black nodes on each path to a leaf. */
+static int
+check_node (const struct rb_node *n, const struct rb_node *parent) 
+{
+  int left, right;
+
+  if (n == NULL)
+    return 1;
+  ASSERT (n->parent == parent);
+  if (parent == NULL)
+    {
+      ASSERT (!n->red);
+    }
+  if (n->red)
+    {
+      ASSERT ((n->left == NULL || !n->left->red)
+              && (n->right == NULL || !n->right->red));
+    }
+
+  left = check_node (n->left, n);
+  right = check_node (n->right, n);
+  ASSERT (left == right);
+  return left + !n->red;
+}
+
+/* Verifies that TREE contains the SIZE values 0, STEP, 2 * STEP,
+   ..., in forward and reverse order. */
+static void
+verify_tree (struct rb_tree *tree, int size, int step) 
+{
+  struct rb_node *n;
+  int i;
+
+  for (i = 0, n = rb_first (tree); i < size && n != NULL;
+       i++, n = rb_next (n)) 
+    ASSERT (rb_entry (n, struct value, node)->value == i * step);
+  ASSERT (i == size);
+  ASSERT (n == NULL);
+
+  for (i = size - 1, n = rb_last (tree); i >= 0 && n != NULL;
+       i--, n = rb_prev (n)) 
+    ASSERT (rb_entry (n, struct value, node)->value == i * step);
+  ASSERT (i == -1);
+  ASSERT (n == NULL);
+}
+
+/* Verifies rb_lower_bound() and rb_upper_bound() for every key
+   from just below to just above the values 0, 2, ...,
+   2 * (SIZE - 1) in TREE. */
+static void
+verify_bounds (struct rb_tree *tree, int size) 
+{
+  int key;
+
+  for (key = -1; key <= size * 2; key++) 
+    {
+      struct value k;
+      struct rb_node *n;
+      int lower = key <= 0 ? 0 : (key + 1) / 2 * 2;
+      int upper = key < 0 ? 0 : key / 2 * 2 + 2;
+
+      k.value = key;
+      n = rb_lower_bound (tree, &k.node);
+      if (lower < size * 2)
+        {
+          ASSERT (n != NULL && rb_entry (n, struct value, node)->value == lower);
+        }
+      else
+        {
+          ASSERT (n == NULL);
+        }
+
+      n = rb_upper_bound (tree, &k.node);
+      if (upper < size * 2)
+        {
+          ASSERT (n != NULL && rb_entry (n, struct value, node)->value == upper);
+        }
+      else
+        {
+          ASSERT (n == NULL);
+        }
+    }
+}
+
+/* Verifies that equal values stay in the order they were
+   inserted, and that rb_lower_bound() finds the first of
+   them. */
+static void
+verify_duplicates (void) 
+{
+  static struct value values[MAX_SIZE * 4];
+  const int cnt = sizeof values / sizeof *values;
+  struct rb_tree tree;
+  struct rb_node *n;
+  struct value k;
+  int i, last_value, last_seq;
+
+  printf ("testing duplicate values:");
+  rb_init (&tree, value_less, NULL);
+  for (i = 0; i < cnt; i++) 
+    {
+      values[i].value = random_ulong () % 8;
+      values[i].seq = i;
+      rb_insert (&tree, &values[i].node);
+    }
+  check_node (tree.root, NULL);
+
+  last_value = -1;
+  last_seq = -1;
+  for (n = rb_first (&tree); n != NULL; n = rb_next (n)) 
+    {
+      struct value *v = rb_entry (n, struct value, node);
+      ASSERT (v->value >= last_value);
+      if (v->value == last_value)
+        {
+          ASSERT (v->seq > last_seq);
+        }
+      last_value = v->value;
+      last_seq = v->seq;
+    }
+
+  for (k.value = 0; k.value < 8; k.value++) 
+    {
+      n = rb_lower_bound (&tree, &k.node);
+      if (n != NULL) 
+        {
+          struct rb_node *prev = rb_prev (n);
+          ASSERT (rb_entry (n, struct value, node)->value >= k.value);
+          ASSERT (prev == NULL
+                  || rb_entry (prev, struct value, node)->value < k.value);
+        }
+    }
+  printf (" done\n");
+}
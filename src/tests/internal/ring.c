@@ -0,0 +1,182 @@
+/* Test program for lib/kernel/ring.c.
+
+   Runs random sequences of puts and gets against rings of
+   various sizes, of single bytes and of larger elements, checking
+   that elements come out in the order they went in, that a put
+   fails exactly when the ring is full, and that a get fails
+   exactly when it is empty.  Both kinds of ring are tested, and
+   the counters are started near their wraparound point.
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <debug.h>
+#include <random.h>
+#include <ring.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/test.h"
+
+/* Largest ring, in elements, that we will test. */
+#define MAX_CNT 64
+
+/* A larger element. */
+struct elem
+  {
+    unsigned value;
+    char pad[9];
+  };
+
+static void test_ring (size_t cnt, size_t elem_size);
+static void test_mpsc_ring (size_t cnt, size_t elem_size);
+static void make_elem (void *elem, size_t elem_size, unsigned value);
+static void check_elem (const void *elem, size_t elem_size, unsigned value);
+
+/* Test the ring buffer implementations. */
+void
+test (void) 
+{
+  size_t cnt;
+
+  printf ("testing various size rings:");
+  for (cnt = 1; cnt <= MAX_CNT; cnt *= 2) 
+    {
+      printf (" %zu", cnt);
+      test_ring (cnt, 1);
+      test_ring (cnt, sizeof (struct elem));
+      if (cnt >= 2) 
+        {
+          test_mpsc_ring (cnt, 1);
+          test_mpsc_ring (cnt, sizeof (struct elem));
+        }
+    }
+  printf (" done\n");
+  printf ("ring: PASS\n");
+}
+
+/* Tests a struct ring of CNT elements of ELEM_SIZE bytes. */
+static void
+test_ring (size_t cnt, size_t elem_size) 
+{
+  static struct elem buf[MAX_CNT];
+  struct ring r;
+  unsigned next_put = 0, next_get = 0;
+  int step;
+
+  ring_init (&r, buf, cnt, elem_size);
+  r.head = r.tail = -(unsigned) cnt * 3;
+  for (step = 0; step < MAX_CNT * 40; step++) 
+    {
+      struct elem e;
+      size_t size = next_put - next_get;
+
+      ASSERT (ring_size (&r) == size);
+      ASSERT (ring_empty (&r) == (size == 0));
+      ASSERT (ring_full (&r) == (size == cnt));
+      if (random_ulong () % 2) 
+        {
+          make_elem (&e, elem_size, next_put);
+          ASSERT (ring_put (&r, &e) == (size < cnt));
+          if (size < cnt)
+            next_put++;
+        }
+      else 
+        {
+          ASSERT (ring_get (&r, &e) == (size > 0));
+          if (size > 0)
+            check_elem (&e, elem_size, next_get++);
+        }
+    }
+}
+
+/* Tests a struct mpsc_ring of CNT elements of ELEM_SIZE
+   bytes. */
+static void
+test_mpsc_ring (size_t cnt, size_t elem_size) 
+{
+  static struct elem buf[MAX_CNT];
+  static unsigned seqs[MAX_CNT];
+  struct mpsc_ring r;
+  unsigned next_put = 0, next_get = 0;
+  int step;
+
+  mpsc_ring_init (&r, buf, seqs, cnt, elem_size);
+  for (step = 0; step < MAX_CNT * 40; step++) 
+    {
+      struct elem e;
+      size_t size = next_put - next_get;
+
+      ASSERT (mpsc_ring_empty (&r) == (size == 0));
+      if (random_ulong () % 2) 
+        {
+          make_elem (&e, elem_size, next_put);
+          ASSERT (mpsc_ring_put (&r, &e) == (size < cnt));
+          if (size < cnt)
+            next_put++;
+        }
+      else 
+        {
+          ASSERT (mpsc_ring_get (&r, &e) == (size > 0));
+          if (size > 0)
+            check_elem (&e, elem_size, next_get++);
+        }
+    }
+
+  /* A claimed position that a producer has yet to fill in stalls
+     the consumer there but not the other producers. */
+  {
+    struct elem e;
+
+    while (mpsc_ring_get (&r, &e))
+      continue;
+    r.head++;
+    make_elem (&e, elem_size, 1);
+    ASSERT (mpsc_ring_put (&r, &e));
+    ASSERT (mpsc_ring_empty (&r));
+    ASSERT (!mpsc_ring_get (&r, &e));
+
+    /* Finish the stalled put by hand. */
+    r.seqs[(r.head - 2) & r.mask] = r.head - 1;
+    ASSERT (mpsc_ring_get (&r, &e));
+    ASSERT (mpsc_ring_get (&r, &e));
+    check_elem (&e, elem_size, 1);
+    ASSERT (mpsc_ring_empty (&r));
+  }
+}
+
+/* Fills in ELEM, of ELEM_SIZE bytes, to represent VALUE. */
+static void
+make_elem (void *elem, size_t elem_size, unsigned value) 
+{
+  if (elem_size == 1)
+    *(uint8_t *) elem = value;
+  else 
+    {
+      struct elem *e = elem;
+      e->value = value;
+      memset (e->pad, value, sizeof e->pad);
+    }
+}
+
+/* Checks that ELEM, of ELEM_SIZE bytes, is intact and represents
+   VALUE, as made by make_elem().  Byte elements hold only the
+   value's low 8 bits. */
+static void
+check_elem (const void *elem, size_t elem_size, unsigned value) 
+{
+  if (elem_size == 1)
+    {
+      ASSERT (*(const uint8_t *) elem == (uint8_t) value);
+    }
+  else 
+    {
+      const struct elem *e = elem;
+      size_t i;
+
+      ASSERT (e->value == value);
+      for (i = 0; i < sizeof e->pad; i++)
+        ASSERT ((uint8_t) e->pad[i] == (uint8_t) value);
+    }
+}
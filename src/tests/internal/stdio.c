@@ -1,24 +1,34 @@
 /* Test program for printf() in lib/stdio.c.
 
    Attempts to test printf() functionality that is not
-   sufficiently tested elsewhere in Pintos.
+   sufficiently tested elsewhere in Pintos, and times
+   vsnprintf()'s fast path for simple formats against the
+   general formatter.
 
    This is not a test we will run on your submitted projects.
    It is here for completeness.
 */
 
 #undef NDEBUG
+#include <inttypes.h>
 #include <limits.h>
 #include <stdarg.h>
 #include <stddef.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include "devices/timer.h"
 #include "threads/test.h"
 
 /* Number of failures so far. */
 static int failure_cnt;
 
+/* Number of calls timed for each format. */
+#define TIME_CNT 10000
+
+static void check_truncation (void);
+static void time_formats (void);
+
 static void
 checkf (const char *expect, const char *format, ...) 
 {
@@ -201,8 +211,76 @@ test (void)
   checkf ("-155209728", "%zd", (size_t) -155209728);
   checkf ("-155209728", "%+zi", (size_t) -155209728);
 
+  /* Formats that take vsnprintf()'s fast path. */
+  checkf ("0", "%d", 0);
+  checkf ("-2147483648", "%d", INT_MIN);
+  checkf ("2147483647", "%i", INT_MAX);
+  checkf ("4294967295", "%u", UINT_MAX);
+  checkf ("deadbeef", "%x", 0xdeadbeef);
+  checkf ("0", "%p", NULL);
+  checkf ("0xc0001234", "%p", (void *) 0xc0001234);
+  checkf ("(null)", "%s", (char *) NULL);
+  checkf ("a 1 b -1 c x d %", "a %d b %i c %c d %%", 1, -1, 'x');
+  check_truncation ();
+
+  time_formats ();
+
   if (failure_cnt == 0)
     printf ("\nstdio: PASS\n");
   else
     printf ("\nstdio: FAIL: %d tests failed\n", failure_cnt);
-}                                                                  
+}
+
+/* Checks that the fast path truncates its output and computes
+   its return value just like the general formatter. */
+static void
+check_truncation (void) 
+{
+  size_t size;
+
+  printf ("checking truncation: ");
+  for (size = 0; size <= 16; size++) 
+    {
+      char fast[20], slow[20];
+      int fast_len, slow_len;
+
+      memset (fast, 'z', sizeof fast);
+      memset (slow, 'z', sizeof slow);
+      fast_len = snprintf (fast, size, "%s=%d/%x", "abc", -123, 0xbeef);
+      slow_len = snprintf (slow, size, "%s=%1d/%1x", "abc", -123, 0xbeef);
+      if (fast_len != slow_len || memcmp (fast, slow, sizeof fast)) 
+        {
+          printf ("\nFAIL: size %zu\n", size);
+          failure_cnt++;
+          return;
+        }
+    }
+  printf ("okay\n");
+}
+
+/* Times TIME_CNT calls to snprintf() with a format that takes
+   the fast path, and with the same format made to take the
+   general path by adding a field width that changes nothing. */
+static void
+time_formats (void) 
+{
+  char buf[64];
+  int64_t start, fast_ticks, slow_ticks;
+  int i;
+
+  start = timer_ticks ();
+  for (i = 0; i < TIME_CNT; i++)
+    snprintf (buf, sizeof buf, "thread %s: tid %d, %u ticks at %p",
+              "main", i, (unsigned) i * 7, buf);
+  fast_ticks = timer_elapsed (start);
+
+  start = timer_ticks ();
+  for (i = 0; i < TIME_CNT; i++)
+    snprintf (buf, sizeof buf, "thread %1s: tid %1d, %1u ticks at %p",
+              "main", i, (unsigned) i * 7, buf);
+  slow_ticks = timer_elapsed (start);
+
+  printf ("%d snprintf() calls: %" PRId64 " ticks on the fast path, "
+          "%" PRId64 " ticks on the general path\n",
+          TIME_CNT, fast_ticks, slow_ticks);
+}
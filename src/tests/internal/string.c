@@ -0,0 +1,205 @@
+/* Test program and microbenchmark for the memory and string
+   functions in lib/string.c.
+
+   Checks memcpy(), memset(), and memcmp(), and the scanning
+   functions strlen(), strnlen(), strchr(), memchr(), and
+   strcmp(), against simple byte-at-a-time versions for every
+   combination of small sizes and alignments, then reports the
+   throughput of memcpy(), memset(), memcmp(), and strlen(),
+   in MB/s, for a range of block sizes.  Each result line has the
+   form "string: FUNCTION SIZE MB/s" to be easy to parse.
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <debug.h>
+#include <random.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "threads/test.h"
+
+/* Largest block size tested, in bytes. */
+#define MAX_SIZE 65536
+
+/* Bytes processed per benchmark measurement. */
+#define BENCH_BYTES (16 * 1024 * 1024)
+
+static unsigned char src[MAX_SIZE + 8];
+static unsigned char dst[MAX_SIZE + 8];
+static unsigned char ref[MAX_SIZE + 8];
+
+static void verify (void);
+static void verify_strings (void);
+static void bench (const char *name, size_t size);
+static int sign (int);
+
+/* Test and benchmark the memory functions. */
+void
+test (void) 
+{
+  size_t size;
+
+  verify ();
+  verify_strings ();
+  printf ("string: correctness checks passed\n");
+
+  for (size = 16; size <= MAX_SIZE; size *= 4)
+    {
+      bench ("memcpy", size);
+      bench ("memset", size);
+      bench ("memcmp", size);
+      bench ("strlen", size);
+    }
+}
+
+/* Compares memcpy(), memset(), and memcmp() against byte loops
+   for every size up to 64 bytes at every pair of alignments. */
+static void
+verify (void) 
+{
+  size_t size, src_ofs, dst_ofs, i;
+
+  for (size = 0; size <= 64; size++)
+    for (src_ofs = 0; src_ofs < 4; src_ofs++)
+      for (dst_ofs = 0; dst_ofs < 4; dst_ofs++)
+        {
+          random_bytes (src, sizeof src);
+          random_bytes (dst, sizeof dst);
+          memcpy (ref, dst, sizeof ref);
+
+          /* memcpy(). */
+          memcpy (dst + dst_ofs, src + src_ofs, size);
+          for (i = 0; i < size; i++)
+            ref[dst_ofs + i] = src[src_ofs + i];
+          for (i = 0; i < sizeof ref; i++)
+            ASSERT (dst[i] == ref[i]);
+
+          /* memcmp() of equal blocks, then of blocks differing
+             in their last byte. */
+          ASSERT (memcmp (dst + dst_ofs, src + src_ofs, size) == 0);
+          if (size > 0)
+            {
+              dst[dst_ofs + size - 1] ^= 1;
+              ASSERT (sign (memcmp (dst + dst_ofs, src + src_ofs, size))
+                      == (dst[dst_ofs + size - 1] > src[src_ofs + size - 1]
+                          ? 1 : -1));
+            }
+
+          /* memset(). */
+          memcpy (ref, dst, sizeof ref);
+          memset (dst + src_ofs, (int) size, size);
+          for (i = 0; i < size; i++)
+            ref[src_ofs + i] = size;
+          for (i = 0; i < sizeof ref; i++)
+            ASSERT (dst[i] == ref[i]);
+        }
+}
+
+/* Fills SRC at offset OFS with a string of LEN random nonzero
+   bytes, none of them equal to 0xff, followed by a null
+   terminator and more random bytes. */
+static char *
+make_string (size_t ofs, size_t len) 
+{
+  size_t i;
+
+  random_bytes (src, sizeof src);
+  for (i = 0; i < len; i++)
+    src[ofs + i] = random_ulong () % 0xfe + 1;
+  src[ofs + len] = '\0';
+  return (char *) src + ofs;
+}
+
+/* Checks strlen(), strnlen(), strchr(), memchr(), and strcmp()
+   for every string length up to 64 at every alignment, with
+   the byte looked for at every position. */
+static void
+verify_strings (void) 
+{
+  size_t len, ofs, i;
+
+  for (len = 0; len <= 64; len++)
+    for (ofs = 0; ofs < 4; ofs++)
+      {
+        char *s = make_string (ofs, len);
+
+        ASSERT (strlen (s) == len);
+        for (i = 0; i <= len + 4; i++)
+          ASSERT (strnlen (s, i) == (i < len ? i : len));
+        ASSERT (strchr (s, '\0') == s + len);
+        ASSERT (strchr (s, 0xff) == NULL);
+        ASSERT (memchr (s, 0xff, len) == NULL);
+
+        /* Each position, as the first occurrence of 0xff. */
+        for (i = 0; i < len; i++)
+          {
+            char saved = s[i];
+
+            s[i] = 0xff;
+            ASSERT (strchr (s, 0xff) == s + i);
+            ASSERT (memchr (s, 0xff, len) == s + i);
+            ASSERT (memchr (s, 0xff, i) == NULL);
+            s[i] = saved;
+          }
+
+        /* strcmp() against a copy at every alignment, equal,
+           then differing in its last character, then shorter. */
+        for (i = 0; i < 4; i++)
+          {
+            char *t = (char *) dst + i;
+
+            memcpy (t, s, len + 1);
+            ASSERT (strcmp (s, t) == 0);
+            if (len > 0)
+              {
+                t[len - 1] = 0xff;
+                ASSERT (strcmp (s, t) < 0 && strcmp (t, s) > 0);
+                t[len - 1] = '\0';
+                ASSERT (strcmp (s, t) > 0 && strcmp (t, s) < 0);
+              }
+          }
+      }
+}
+
+/* Runs function NAME over blocks of SIZE bytes until BENCH_BYTES
+   bytes have been processed and prints the throughput. */
+static void
+bench (const char *name, size_t size) 
+{
+  size_t iterations = BENCH_BYTES / size;
+  int64_t start, elapsed;
+  size_t i;
+  int sum = 0;
+
+  memset (src, 0x5a, sizeof src);
+  memset (dst, 0x5a, sizeof dst);
+  src[size] = '\0';
+
+  start = timer_ticks ();
+  for (i = 0; i < iterations; i++)
+    if (!strcmp (name, "memcpy"))
+      memcpy (dst, src, size);
+    else if (!strcmp (name, "memset"))
+      memset (dst, i, size);
+    else if (!strcmp (name, "strlen"))
+      sum += strlen ((const char *) src);
+    else
+      sum += memcmp (dst, src, size);
+  elapsed = timer_elapsed (start);
+  if (elapsed == 0)
+    elapsed = 1;
+
+  printf ("string: %s %zu %lld MB/s\n", name, size,
+          (long long) BENCH_BYTES * TIMER_FREQ / elapsed / (1024 * 1024));
+  (void) sum;
+}
+
+/* Returns the sign of X: -1, 0, or 1. */
+static int
+sign (int x) 
+{
+  return (x > 0) - (x < 0);
+}
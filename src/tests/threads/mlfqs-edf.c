@@ -0,0 +1,140 @@
+/* Checks that EDF threads meet their deadlines under the load of
+   mlfqs-load-60.
+
+   Three periodic threads join the EDF class, for a total density
+   of 0.65, and admission control must then refuse a fourth
+   request that would take the total past 0.9, as well as
+   requests with invalid parameters.  Then LOAD_CNT threads spin
+   for PHASE_SECS seconds, in the manner of mlfqs-load-60, while
+   each periodic thread computes for half its budget in each of
+   its periods.  Every job should end by its deadline. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define LOAD_CNT 60
+#define PHASE_SECS 10
+
+/* A periodic thread. */
+struct periodic
+  {
+    int64_t period, budget, deadline; /* Its EDF parameters. */
+    struct semaphore started;   /* Up'd once it has joined EDF. */
+    struct semaphore done;      /* Up'd when the phase is over. */
+    bool admitted;              /* Did it join EDF? */
+    unsigned jobs;              /* Jobs run. */
+    unsigned misses;            /* Jobs that missed their deadlines. */
+  };
+
+#define PERIODIC_CNT 3
+static struct periodic periodics[PERIODIC_CNT] =
+  {
+    {.period = 10, .budget = 2, .deadline = 10},
+    {.period = 20, .budget = 4, .deadline = 16},
+    {.period = 25, .budget = 4, .deadline = 20},
+  };
+
+static int64_t phase_end;
+
+static void load_thread (void *aux);
+static void periodic_thread (void *p_);
+
+void
+test_mlfqs_edf (void)
+{
+  unsigned jobs = 0, misses = 0;
+  int i;
+
+  ASSERT (thread_mlfqs);
+
+  if (thread_set_deadline (10, 0, 10)
+      || thread_set_deadline (10, 5, 4)
+      || thread_set_deadline (10, 5, 20))
+    fail ("invalid deadline parameters were accepted");
+  msg ("Invalid deadline parameters are refused.");
+
+  /* Start the periodic threads first, so that they join EDF
+     before the load keeps best-effort threads waiting. */
+  msg ("Starting %d periodic threads.", PERIODIC_CNT);
+  phase_end = timer_ticks () + (PHASE_SECS + 1) * TIMER_FREQ;
+  for (i = 0; i < PERIODIC_CNT; i++)
+    {
+      struct periodic *p = &periodics[i];
+      char name[16];
+
+      sema_init (&p->started, 0);
+      sema_init (&p->done, 0);
+      snprintf (name, sizeof name, "periodic %d", i);
+      thread_create (name, PRI_DEFAULT, periodic_thread, p);
+      sema_down (&p->started);
+      if (!p->admitted)
+        fail ("periodic thread %d was not admitted", i);
+    }
+
+  if (thread_set_deadline (10, 3, 10))
+    fail ("admission control accepted a total density of 0.95");
+  msg ("Admission control refuses a fourth thread.");
+
+  msg ("Starting %d load threads.", LOAD_CNT);
+  for (i = 0; i < LOAD_CNT; i++)
+    {
+      char name[16];
+      snprintf (name, sizeof name, "load %d", i);
+      thread_create (name, PRI_DEFAULT, load_thread, NULL);
+    }
+
+  for (i = 0; i < PERIODIC_CNT; i++)
+    {
+      struct periodic *p = &periodics[i];
+
+      sema_down (&p->done);
+      if (p->jobs < PHASE_SECS * TIMER_FREQ / p->period)
+        fail ("periodic thread %d ran only %u jobs in %d seconds",
+              i, p->jobs, PHASE_SECS);
+      jobs += p->jobs;
+      misses += p->misses;
+    }
+  if (misses > 0)
+    fail ("%u of %u jobs missed their deadlines", misses, jobs);
+  msg ("Periodic threads met every deadline.");
+
+  /* Give the load threads time to exit. */
+  timer_sleep_until (phase_end + TIMER_FREQ);
+}
+
+static void
+load_thread (void *aux UNUSED)
+{
+  while (timer_ticks () < phase_end)
+    continue;
+}
+
+static void
+periodic_thread (void *p_)
+{
+  struct periodic *p = p_;
+
+  p->admitted = thread_set_deadline (p->period, p->budget, p->deadline);
+  sema_up (&p->started);
+  if (!p->admitted)
+    return;
+
+  while (timer_ticks () < phase_end)
+    {
+      int64_t start = timer_ticks ();
+
+      /* Compute for half the budget. */
+      while (timer_ticks () - start < p->budget / 2)
+        continue;
+
+      p->jobs++;
+      if (!thread_wait_next_period ())
+        p->misses++;
+    }
+  thread_set_deadline (0, 0, 0);
+  sema_up (&p->done);
+}
@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(mlfqs-edf) begin
+(mlfqs-edf) Invalid deadline parameters are refused.
+(mlfqs-edf) Starting 3 periodic threads.
+(mlfqs-edf) Admission control refuses a fourth thread.
+(mlfqs-edf) Starting 60 load threads.
+(mlfqs-edf) Periodic threads met every deadline.
+(mlfqs-edf) end
+EOF
+pass;
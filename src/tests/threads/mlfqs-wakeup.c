@@ -0,0 +1,110 @@
+/* Checks that the MLFQS wake-up boost gets an interactive thread
+   onto the CPU sooner after it wakes.
+
+   The test runs two phases, the first with the boost off and the
+   second with it on.  In each, SPINNER_CNT threads spin for
+   PHASE_SECS seconds, in the manner of mlfqs-load-60, while an
+   "interactive" thread repeatedly sleeps for SLEEP_TICKS ticks
+   and then computes for one tick.  That is a little more CPU
+   than each spinner gets, so without the boost the interactive
+   thread's recent_cpu keeps its priority down among theirs.  The
+   interactive thread adds up how many ticks late it started
+   running after each wake-up.  The boosted phase should be no
+   later in total. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define SPINNER_CNT 10
+#define PHASE_SECS 10
+#define SLEEP_TICKS 8
+
+/* The interactive thread's results. */
+struct interactive
+  {
+    struct semaphore done;      /* Up'd when the phase is over. */
+    int64_t late;               /* Total ticks late after wake-ups. */
+  };
+
+static int64_t phase_end;
+
+static int64_t run_phase (bool boost);
+static void spinner_thread (void *aux);
+static void interactive_thread (void *in_);
+
+void
+test_mlfqs_wakeup (void)
+{
+  int64_t late_off, late_on;
+
+  ASSERT (thread_mlfqs);
+
+  late_off = run_phase (false);
+  late_on = run_phase (true);
+  if (late_on > late_off)
+    fail ("boosted wake-ups were %lld ticks late in total, "
+          "unboosted ones only %lld", late_on, late_off);
+  msg ("Boosted wake-ups ran no later than unboosted ones.");
+}
+
+/* Runs one phase, with the wake-up boost on if BOOST is true,
+   and returns the number of ticks that the interactive thread
+   was late in total. */
+static int64_t
+run_phase (bool boost)
+{
+  struct interactive in;
+  int i;
+
+  msg ("Starting %d spinners, wake-up boost %s.",
+       SPINNER_CNT, boost ? "on" : "off");
+  thread_mlfqs_boost = boost;
+  phase_end = timer_ticks () + PHASE_SECS * TIMER_FREQ;
+  for (i = 0; i < SPINNER_CNT; i++)
+    {
+      char name[16];
+      snprintf (name, sizeof name, "spin %d", i);
+      thread_create (name, PRI_DEFAULT, spinner_thread, NULL);
+    }
+
+  sema_init (&in.done, 0);
+  in.late = 0;
+  thread_create ("interactive", PRI_DEFAULT, interactive_thread, &in);
+  sema_down (&in.done);
+
+  /* Give the spinners time to exit. */
+  timer_sleep_until (phase_end + TIMER_FREQ);
+  return in.late;
+}
+
+static void
+spinner_thread (void *aux UNUSED)
+{
+  while (timer_ticks () < phase_end)
+    continue;
+}
+
+static void
+interactive_thread (void *in_)
+{
+  struct interactive *in = in_;
+
+  while (timer_ticks () + SLEEP_TICKS < phase_end)
+    {
+      int64_t wake = timer_ticks () + SLEEP_TICKS;
+      int64_t start;
+
+      timer_sleep_until (wake);
+      start = timer_ticks ();
+      in->late += start - wake;
+
+      /* Compute until the next tick. */
+      while (timer_ticks () == start)
+        continue;
+    }
+  sema_up (&in->done);
+}
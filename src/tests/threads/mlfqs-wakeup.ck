@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(mlfqs-wakeup) begin
+(mlfqs-wakeup) Starting 10 spinners, wake-up boost off.
+(mlfqs-wakeup) Starting 10 spinners, wake-up boost on.
+(mlfqs-wakeup) Boosted wake-ups ran no later than unboosted ones.
+(mlfqs-wakeup) end
+EOF
+pass;
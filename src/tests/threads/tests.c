@@ -2,6 +2,10 @@
 #include <debug.h>
 #include <string.h>
 #include <stdio.h>
+#include "threads/interrupt.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
 
 struct test 
   {
@@ -38,6 +42,8 @@ static const struct test tests[] =
     {"mlfqs-nice-2", test_mlfqs_nice_2},
     {"mlfqs-nice-10", test_mlfqs_nice_10},
     {"mlfqs-block", test_mlfqs_block},
+    {"mlfqs-wakeup", test_mlfqs_wakeup},
+    {"mlfqs-edf", test_mlfqs_edf},
   };
 
 static const char *test_name;
@@ -60,6 +66,115 @@ run_test (const char *name)
   PANIC ("no test named \"%s\"", name);
 }
 
+/* Most seconds run_tests() waits for the threads that a test
+   created to exit before starting the next test. */
+#define BATCH_SETTLE_SECS 10
+
+static struct semaphore batch_done;
+
+static bool batch_matches (const char *patterns, const char *name);
+static size_t count_threads (void);
+
+/* Runs test T_ in a thread of its own, then ups BATCH_DONE. */
+static void
+batch_thread (void *t_) 
+{
+  const struct test *t = t_;
+
+  test_name = t->name;
+  msg ("begin");
+  t->function ();
+  msg ("end");
+  sema_up (&batch_done);
+}
+
+/* Runs, in one boot, each test whose name matches PATTERNS, a
+   comma-separated list of test names and of name prefixes
+   followed by `*', in the order of the tests table.  Each test
+   starts as if it had the boot to itself: in a fresh thread
+   named "main", with the load average back at 0, once the
+   threads of the test before it have exited.  Its output is
+   framed as run_task() frames a single test's, so that the
+   output of the whole boot can be split into one per test. */
+void
+run_tests (const char *patterns) 
+{
+  size_t base_cnt = count_threads ();
+  const struct test *t;
+  size_t test_cnt = 0;
+
+  sema_init (&batch_done, 0);
+  for (t = tests; t < tests + sizeof tests / sizeof *tests; t++)
+    if (batch_matches (patterns, t->name))
+      {
+        int64_t start;
+        bool settled;
+
+        printf ("Executing '%s':\n", t->name);
+        thread_reset_load_avg ();
+        if (thread_create ("main", PRI_DEFAULT, batch_thread,
+                           (void *) t) == TID_ERROR)
+          PANIC ("cannot start test \"%s\"", t->name);
+        sema_down (&batch_done);
+
+        start = timer_ticks ();
+        while (!(settled = count_threads () <= base_cnt)
+               && timer_elapsed (start) < BATCH_SETTLE_SECS * TIMER_FREQ)
+          timer_sleep (1);
+        printf ("Execution of '%s' complete.\n", t->name);
+        if (!settled)
+          printf ("run-batch: threads of '%s' still running\n", t->name);
+        test_cnt++;
+      }
+  if (test_cnt == 0)
+    PANIC ("no test matches \"%s\"", patterns);
+}
+
+/* Returns true if NAME matches one of PATTERNS, as described
+   for run_tests(). */
+static bool
+batch_matches (const char *patterns, const char *name) 
+{
+  const char *p = patterns;
+
+  while (*p != '\0')
+    {
+      size_t len = strcspn (p, ",");
+
+      if (len > 0 && p[len - 1] == '*')
+        {
+          if (strlen (name) >= len - 1 && !memcmp (p, name, len - 1))
+            return true;
+        }
+      else if (strlen (name) == len && !memcmp (p, name, len))
+        return true;
+      p += len;
+      if (*p == ',')
+        p++;
+    }
+  return false;
+}
+
+/* Adds 1 to *CNT_. */
+static void
+count_thread (struct thread *t UNUSED, void *cnt_) 
+{
+  size_t *cnt = cnt_;
+  (*cnt)++;
+}
+
+/* Returns the number of threads alive, dying ones included. */
+static size_t
+count_threads (void) 
+{
+  enum intr_level old_level = intr_disable ();
+  size_t cnt = 0;
+
+  thread_foreach (count_thread, &cnt);
+  intr_set_level (old_level);
+  return cnt;
+}
+
 /* Prints FORMAT as if with printf(),
    prefixing the output by the name of the test
    and following it with a new-line character. */
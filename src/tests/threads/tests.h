@@ -2,6 +2,7 @@
 #define TESTS_THREADS_TESTS_H
 
 void run_test (const char *);
+void run_tests (const char *patterns);
 
 typedef void test_func (void);
 
@@ -32,6 +33,8 @@ extern test_func test_mlfqs_fair_20;
 extern test_func test_mlfqs_nice_2;
 extern test_func test_mlfqs_nice_10;
 extern test_func test_mlfqs_block;
+extern test_func test_mlfqs_wakeup;
+extern test_func test_mlfqs_edf;
 
 void msg (const char *, ...);
 void fail (const char *, ...);
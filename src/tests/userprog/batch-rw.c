@@ -0,0 +1,49 @@
+/* Writes a file with writev(), reads it back with batch(), and
+   reads it back again with readv(). */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/userprog/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  char buf[sizeof sample];
+  struct iovec iov[3];
+  struct batch_op ops[3];
+  size_t size = sizeof sample - 1;
+  size_t third = size / 3;
+  int handle;
+
+  CHECK (create ("test.txt", 0), "create \"test.txt\"");
+  CHECK ((handle = open ("test.txt")) > 1, "open \"test.txt\"");
+
+  iov[0].iov_base = sample;
+  iov[0].iov_len = third;
+  iov[1].iov_base = sample + third;
+  iov[1].iov_len = third;
+  iov[2].iov_base = sample + 2 * third;
+  iov[2].iov_len = size - 2 * third;
+  CHECK (writev (handle, iov, 3) == (int) size, "writev \"test.txt\"");
+
+  memset (buf, 0, sizeof buf);
+  ops[0] = (struct batch_op) {BATCH_SEEK, handle, NULL, 0, 0};
+  ops[1] = (struct batch_op) {BATCH_READ, handle, buf, third, 0};
+  ops[2] = (struct batch_op) {BATCH_READ, handle, buf + third,
+                              size - third, 0};
+  CHECK (batch (ops, 3) == 3, "batch seek and read \"test.txt\"");
+  if (ops[1].result != (int) third || ops[2].result != (int) (size - third))
+    fail ("batch reads returned %d and %d instead of %zu and %zu",
+          ops[1].result, ops[2].result, third, size - third);
+  compare_bytes (buf, sample, size, 0, "test.txt");
+
+  memset (buf, 0, sizeof buf);
+  seek (handle, 0);
+  iov[0].iov_base = buf;
+  iov[1].iov_base = buf + third;
+  iov[2].iov_base = buf + 2 * third;
+  CHECK (readv (handle, iov, 3) == (int) size, "readv \"test.txt\"");
+  compare_bytes (buf, sample, size, 0, "test.txt");
+}
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(batch-rw) begin
+(batch-rw) create "test.txt"
+(batch-rw) open "test.txt"
+(batch-rw) writev "test.txt"
+(batch-rw) batch seek and read "test.txt"
+(batch-rw) readv "test.txt"
+(batch-rw) end
+batch-rw: exit(0)
+EOF
+pass;
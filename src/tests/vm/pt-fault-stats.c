@@ -0,0 +1,41 @@
+/* Checks that faultstat() counts the faults a process takes
+   when it touches fresh zeroed pages and grows its stack. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define PAGE_CNT 8
+
+static char zeros[PAGE_CNT * PAGE_SIZE];
+
+/* Writes to a 64 kB object on the stack. */
+static void __attribute__ ((noinline))
+grow_stack (void)
+{
+  char stk_obj[65536];
+
+  memset (stk_obj, 0, sizeof stk_obj);
+  asm volatile ("" : : "r" (stk_obj) : "memory");
+}
+
+void
+test_main (void)
+{
+  struct fault_stats before, after;
+  size_t i;
+
+  CHECK (faultstat (&before), "get fault counts");
+  for (i = 0; i < sizeof zeros; i += PAGE_SIZE)
+    zeros[i] = 1;
+  grow_stack ();
+  CHECK (faultstat (&after), "get fault counts again");
+
+  /* The first page of ZEROS may share a page with initialized
+     data, so it is not counted. */
+  CHECK (after.minor >= before.minor + PAGE_CNT - 1,
+         "zeroed pages counted as minor faults");
+  CHECK (after.stack > before.stack, "stack growth counted");
+}
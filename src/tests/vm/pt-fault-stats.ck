@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(pt-fault-stats) begin
+(pt-fault-stats) get fault counts
+(pt-fault-stats) get fault counts again
+(pt-fault-stats) zeroed pages counted as minor faults
+(pt-fault-stats) stack growth counted
+(pt-fault-stats) end
+pt-fault-stats: exit(0)
+EOF
+pass;
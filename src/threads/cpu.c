@@ -0,0 +1,590 @@
+#include "threads/cpu.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <packed.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/flags.h"
+#include "threads/init.h"
+#include "threads/interrupt.h"
+#include "threads/loader.h"
+#include "threads/palloc.h"
+#include "threads/pte.h"
+#include "threads/rcu.h"
+#include "threads/spinlock.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "devices/lapic.h"
+#include "devices/timer.h"
+#ifdef USERPROG
+#include "userprog/gdt.h"
+#include "userprog/sysenter.h"
+#include "userprog/tss.h"
+#endif
+
+/* The processors.  Until cpu_init() has run, cpus[0] stands for
+   the processor that booted. */
+struct cpu cpus[CPU_MAX] = { { .bsp = true, .online = true } };
+size_t cpu_cnt = 1;
+size_t cpu_online_cnt = 1;
+
+/* Start the application processors? */
+bool cpu_smp;
+
+/* The kernel lock.
+
+   Once cpu_start() engages it, a processor takes the lock on
+   every way into the kernel: intr_handler() takes it for an
+   interrupt from user mode or from the idle thread's halt,
+   syscall_sysenter() for a fast system call, and the idle thread
+   when its halt ends.  Each of those releases it on the way out,
+   which is to say only when the processor returns to user mode
+   or halts again, since kernel code that already holds the lock,
+   interrupted or not, just goes on holding it.  It belongs to the
+   processor, not the thread: a thread that blocks, say in a system
+   call, leaves the lock with the processor, for the next thread
+   to run there, and may return to user mode from another one.
+   So the kernel's own locks and interrupt disabling keep working
+   as on a single processor.
+
+   A processor waiting for the lock does so with interrupts off,
+   so it still answers TLB shootdowns (see cpu_tlb_shootdown())
+   while it spins, or the holder, waiting for the answer, would
+   never let go. */
+static struct spinlock kernel_lock;
+static bool kernel_lock_engaged;
+
+/* Number of kernel mapping changes, for cpu_flush_kernel_tlbs(). */
+static unsigned kernel_tlb_gen;
+
+/* Control register 4 flags. */
+#define CR4_PGE (1 << 7)        /* Enable global pages. */
+
+/* Arguments to ap-start.S, in its copy at LOADER_AP_START, laid
+   out as it expects. */
+struct ap_args
+  {
+    uint64_t gdtr;              /* GDT to load, as an LGDT operand. */
+    uint32_t cr3;               /* Page directory to start with. */
+    uint32_t cr4;               /* CR4, with global pages off. */
+    void *esp;                  /* Stack: the idle thread's. */
+    struct cpu *cpu;            /* Argument to cpu_ap_main(). */
+  };
+extern char ap_start[], ap_start_args[], ap_start_end[];
+
+/* Microseconds that cpu_start() waits for a processor to come
+   online. */
+#define AP_START_US 100000
+
+/* CR4 of the bootstrap processor, for the others to copy. */
+static uint32_t bsp_cr4;
+
+/* Structures from the Intel MultiProcessor Specification,
+   version 1.4, cited as [MP] below. */
+
+/* MP floating pointer structure.  See [MP] section 4.1. */
+struct mp_float
+  {
+    char signature[4];          /* "_MP_". */
+    uint32_t config;            /* Physical address of struct mp_config. */
+    uint8_t length;             /* Length in 16-byte units: 1. */
+    uint8_t spec_rev;           /* Specification revision. */
+    uint8_t checksum;           /* Makes all the bytes sum to 0. */
+    uint8_t features[5];        /* Nonzero features[0]: default config. */
+  }
+PACKED;
+
+/* MP configuration table header, followed by its entries.  See
+   [MP] section 4.2. */
+struct mp_config
+  {
+    char signature[4];          /* "PCMP". */
+    uint16_t length;            /* Length of header and entries. */
+    uint8_t spec_rev;           /* Specification revision. */
+    uint8_t checksum;           /* Makes all LENGTH bytes sum to 0. */
+    char oem[20];               /* OEM and product IDs. */
+    uint32_t oem_table;         /* Physical address of OEM table. */
+    uint16_t oem_length;        /* Size of OEM table. */
+    uint16_t entry_cnt;         /* Number of entries. */
+    uint32_t lapic;             /* Physical address of local APICs. */
+    uint16_t ext_length;        /* Size of extended entries. */
+    uint8_t ext_checksum;       /* Checksum of extended entries. */
+    uint8_t reserved;
+  }
+PACKED;
+
+/* MP configuration table processor entry.  See [MP] section 4.3.1.
+   Every other kind of entry is 8 bytes long. */
+#define MP_PROCESSOR 0
+struct mp_processor
+  {
+    uint8_t type;               /* MP_PROCESSOR. */
+    uint8_t lapic_id;           /* Local APIC ID. */
+    uint8_t lapic_version;      /* Local APIC version. */
+    uint8_t flags;              /* MP_ENABLED, MP_BSP. */
+    uint32_t signature;         /* CPU family, model, stepping. */
+    uint32_t features;          /* CPUID feature flags. */
+    uint32_t reserved[2];
+  }
+PACKED;
+#define MP_ENABLED 0x01         /* Usable processor. */
+#define MP_BSP 0x02             /* Bootstrap processor. */
+
+static struct mp_float *find_mp_float (void);
+static struct mp_float *scan_mp_float (uintptr_t phys, size_t size);
+static void *phys_to_kernel (uintptr_t phys, size_t size);
+static bool checksum_ok (const void *, size_t size);
+static void engage_kernel_lock (void);
+static intr_handler_func tick_interrupt, resched_interrupt;
+
+/* Finds the machine's processors and prints how many there are.
+   Must be called after paging_init(). */
+void
+cpu_init (void)
+{
+  struct mp_float *mpf = find_mp_float ();
+  struct mp_config *conf;
+  const uint8_t *p, *end;
+  size_t found = 0;
+  size_t i;
+
+  if (mpf == NULL || mpf->features[0] != 0
+      || (conf = phys_to_kernel (mpf->config, sizeof *conf)) == NULL
+      || memcmp (conf->signature, "PCMP", 4)
+      || phys_to_kernel (mpf->config, conf->length) == NULL
+      || !checksum_ok (conf, conf->length))
+    {
+      printf ("No usable MultiProcessor tables, assuming 1 CPU.\n");
+      return;
+    }
+
+  p = (const uint8_t *) (conf + 1);
+  end = (const uint8_t *) conf + conf->length;
+  for (i = 0; i < conf->entry_cnt && p < end; i++)
+    if (*p == MP_PROCESSOR)
+      {
+        const struct mp_processor *proc = (const void *) p;
+
+        if (proc->flags & MP_ENABLED)
+          {
+            found++;
+            if (proc->flags & MP_BSP)
+              cpus[0].lapic_id = proc->lapic_id;
+            else if (cpu_cnt < CPU_MAX)
+              {
+                struct cpu *c = &cpus[cpu_cnt++];
+                c->lapic_id = proc->lapic_id;
+                c->bsp = false;
+                c->online = false;
+              }
+          }
+        p += sizeof *proc;
+      }
+    else
+      p += 8;
+
+  printf ("%zu CPU%s found, ", found, found != 1 ? "s" : "");
+  if (found > 1 && !cpu_smp)
+    printf ("using only the bootstrap CPU ");
+  printf ("(local APIC %u at %#"PRIx32").\n",
+          (unsigned) cpus[0].lapic_id, conf->lapic);
+}
+
+/* Starts the application processors, if "-smp" asked for them,
+   and waits for each to come online.  Must be called by main()
+   after thread_start() and timer_calibrate(), before any user
+   process starts. */
+void
+cpu_start (void)
+{
+  struct ap_args *args;
+  uint32_t *ap_pd;
+  uint64_t gdtr;
+  size_t i;
+
+  ASSERT (intr_get_level () == INTR_ON);
+
+  if (!cpu_smp || cpu_cnt == 1)
+    return;
+  if (!lapic_available ())
+    {
+      printf ("No local APIC, not starting the other CPUs.\n");
+      return;
+    }
+
+  /* ap-start.S turns paging on before it jumps into the kernel,
+     so it needs a page directory that maps its own page where it
+     is as well as the kernel. */
+  ap_pd = palloc_get_page (0);
+  if (ap_pd == NULL)
+    {
+      printf ("Out of memory, not starting the other CPUs.\n");
+      return;
+    }
+  memcpy (ap_pd, init_page_dir, PGSIZE);
+  ap_pd[0] = init_page_dir[pd_no (ptov (0))];
+
+  memcpy (ptov (LOADER_AP_START), ap_start, ap_start_end - ap_start);
+  args = ptov (LOADER_AP_START + (ap_start_args - ap_start));
+  asm volatile ("sgdt %0" : "=m" (gdtr));
+  asm volatile ("movl %%cr4, %0" : "=r" (bsp_cr4));
+
+  intr_register_lapic (LAPIC_TICK_VEC, tick_interrupt, "IPI Tick");
+  intr_register_lapic (LAPIC_RESCHED_VEC, resched_interrupt,
+                       "IPI Reschedule");
+  engage_kernel_lock ();
+
+  for (i = 1; i < cpu_cnt; i++)
+    {
+      struct cpu *c = &cpus[i];
+      int us;
+
+      if (!thread_cpu_init (c)
+#ifdef USERPROG
+          || !tss_init_ap (c) || !gdt_init_ap (c)
+#endif
+          )
+        {
+          printf ("Out of memory starting CPU %zu.\n", i);
+          break;
+        }
+
+      args->gdtr = gdtr;
+      args->cr3 = vtop (ap_pd);
+      args->cr4 = bsp_cr4 & ~CR4_PGE;
+      args->esp = c->idle_thread->stack_top;
+      args->cpu = c;
+      lapic_start_ap (c->lapic_id, LOADER_AP_START);
+
+      /* The processor goes online holding the kernel lock, so let
+         go of it meanwhile.  Without the lock, this processor must
+         keep interrupts off, so it polls instead of sleeping. */
+      intr_disable ();
+      kernel_lock_exit ();
+      for (us = 0; !c->online && us < AP_START_US; us += 100)
+        timer_udelay (100);
+      kernel_lock_enter ();
+      intr_enable ();
+      if (!c->online)
+        {
+          /* It may yet start, reading ARGS and AP_PD, so leave them
+             alone and start no more. */
+          printf ("CPU %zu (local APIC %u) did not start.\n",
+                  i, (unsigned) c->lapic_id);
+          ap_pd = NULL;
+          break;
+        }
+    }
+  if (ap_pd != NULL)
+    palloc_free_page (ap_pd);
+  printf ("%zu of %zu CPUs online.\n", cpu_online_cnt, cpu_cnt);
+}
+
+/* Called by ap-start.S on application processor C, on the stack
+   of C's idle thread, with interrupts off.  Sets up the processor
+   like the bootstrap processor and runs its idle thread. */
+void
+cpu_ap_main (struct cpu *c)
+{
+  /* Leave ap-start.S's page directory for the kernel's, then turn
+     global pages on, which flushes the TLB once more. */
+  asm volatile ("movl %0, %%cr3" : : "r" (vtop (init_page_dir)) : "memory");
+  asm volatile ("movl %0, %%cr4" : : "r" (bsp_cr4) : "memory");
+  ASSERT (cpu_current () == c);
+
+  intr_init_ap ();
+#ifdef USERPROG
+  gdt_load ();
+  sysenter_init ();
+#endif
+  lapic_init_ap ();
+
+  kernel_lock_enter ();
+  rcu_cpu_online ();
+  c->online = true;
+  cpu_online_cnt++;
+  thread_start_ap ();
+}
+
+/* Disables interrupts and returns the old flags register.  The
+   kernel lock cannot use intr_disable(), whose interrupts-off
+   tracing keeps state that the lock protects. */
+static inline uint32_t
+irq_save (void)
+{
+  uint32_t flags;
+
+  asm volatile ("pushfl; popl %0; cli" : "=g" (flags) : : "memory");
+  return flags;
+}
+
+/* Turns interrupts back on if FLAGS, from irq_save(), says that
+   they were on. */
+static inline void
+irq_restore (uint32_t flags)
+{
+  if (flags & FLAG_IF)
+    asm volatile ("sti" : : : "memory");
+}
+
+/* Flushes the TLB of global entries too, that is, of kernel
+   mappings, by turning global pages off and on. */
+static void
+flush_global_tlb (void)
+{
+  uint32_t cr4;
+
+  asm volatile ("movl %%cr4, %0" : "=r" (cr4));
+  if (cr4 & CR4_PGE)
+    {
+      asm volatile ("movl %0, %%cr4" : : "r" (cr4 & ~CR4_PGE));
+      asm volatile ("movl %0, %%cr4" : : "r" (cr4) : "memory");
+    }
+}
+
+/* Turns the kernel lock on, held by the bootstrap processor,
+   which is still the only one running. */
+static void
+engage_kernel_lock (void)
+{
+  enum intr_level old_level = intr_disable ();
+
+  spinlock_init (&kernel_lock, "kernel");
+  spin_lock (&kernel_lock);
+  cpus[0].kernel_locked = true;
+  cpus[0].kernel_tlb_gen = kernel_tlb_gen;
+  kernel_lock_engaged = true;
+  intr_set_level (old_level);
+}
+
+/* Takes the kernel lock for the running processor, on its way
+   into the kernel, unless it already holds it.  Returns true if
+   it took the lock, which the caller must then release with
+   kernel_lock_exit() on its way out.  Before the lock is engaged,
+   does nothing and returns false. */
+bool
+kernel_lock_enter (void)
+{
+  struct cpu *c;
+  uint32_t flags;
+
+  if (!kernel_lock_engaged)
+    return false;
+
+  flags = irq_save ();
+  c = cpu_current ();
+  if (c->kernel_locked)
+    {
+      irq_restore (flags);
+      return false;
+    }
+  while (!spin_trylock (&kernel_lock))
+    {
+      if (c->tlb_flush)
+        cpu_tlb_flush ();
+      asm volatile ("pause" : : : "memory");
+    }
+  c->kernel_locked = true;
+
+  /* Kernel mappings may have changed while we were out. */
+  if (c->kernel_tlb_gen != kernel_tlb_gen)
+    {
+      flush_global_tlb ();
+      c->kernel_tlb_gen = kernel_tlb_gen;
+    }
+  irq_restore (flags);
+  return true;
+}
+
+/* Releases the kernel lock, if the running processor holds it, on
+   its way back to user mode or into a halt. */
+void
+kernel_lock_exit (void)
+{
+  struct cpu *c;
+  uint32_t flags;
+
+  if (!kernel_lock_engaged)
+    return;
+
+  flags = irq_save ();
+  c = cpu_current ();
+  if (c->kernel_locked)
+    {
+      c->kernel_locked = false;
+      spin_unlock (&kernel_lock);
+    }
+  irq_restore (flags);
+}
+
+/* Passes the timer tick that the bootstrap processor has just
+   taken on to the other online processors, which have no timer
+   interrupt of their own. */
+void
+cpu_broadcast_tick (void)
+{
+  size_t i;
+
+  if (cpu_online_cnt == 1)
+    return;
+  for (i = 1; i < cpu_cnt; i++)
+    if (cpus[i].online)
+      lapic_send_ipi (cpus[i].lapic_id, LAPIC_TICK_VEC);
+}
+
+/* Interrupts processor C so that it checks whether to run a
+   thread that has just become ready there. */
+void
+cpu_resched (struct cpu *c)
+{
+  ASSERT (c->online);
+
+  lapic_send_ipi (c->lapic_id, LAPIC_RESCHED_VEC);
+}
+
+/* An application processor's timer tick. */
+static void
+tick_interrupt (struct intr_frame *f UNUSED)
+{
+  thread_tick ();
+}
+
+/* A thread became ready on this processor. */
+static void
+resched_interrupt (struct intr_frame *f UNUSED)
+{
+  check_thread_yield ();
+}
+
+/* Flushes the running processor's TLB of user mappings and
+   answers the TLB shootdown that asked for it.  Called with
+   interrupts off. */
+void
+cpu_tlb_flush (void)
+{
+  struct cpu *c = cpu_current ();
+  uint32_t cr3;
+
+  asm volatile ("movl %%cr3, %0; movl %0, %%cr3" : "=r" (cr3) : : "memory");
+  c->tlb_flush = false;
+}
+
+/* Has each other processor that has page directory PD loaded
+   flush its TLB, and waits until all of them have.  Called by
+   pagedir.c after it changes a user mapping in PD, with the
+   kernel lock held.  Only a processor that runs PD's process can
+   be using the old mapping, and none can load PD meanwhile,
+   because loading a page directory takes the kernel lock. */
+void
+cpu_tlb_shootdown (uint32_t *pd)
+{
+#ifdef USERPROG
+  enum intr_level old_level;
+  struct cpu *self;
+  size_t i;
+
+  if (cpu_online_cnt == 1)
+    return;
+
+  old_level = intr_disable ();
+  self = cpu_current ();
+  ASSERT (self->kernel_locked);
+  for (i = 0; i < cpu_cnt; i++)
+    {
+      struct cpu *c = &cpus[i];
+
+      if (c != self && c->online && c->pagedir == pd)
+        {
+          c->tlb_flush = true;
+          lapic_send_ipi (c->lapic_id, LAPIC_FLUSH_VEC);
+        }
+    }
+  for (i = 0; i < cpu_cnt; i++)
+    while (cpus[i].tlb_flush)
+      asm volatile ("pause" : : : "memory");
+  intr_set_level (old_level);
+#else
+  (void) pd;
+#endif
+}
+
+/* Notes that a kernel mapping has changed or gone away, after
+   the running processor, which must hold the kernel lock, has
+   invalidated its own TLB entry for it.  Every other processor
+   flushes its TLB, global entries and all, the next time it takes
+   the kernel lock.  Until then it runs only user code, which
+   cannot use kernel mappings, or halts. */
+void
+cpu_flush_kernel_tlbs (void)
+{
+  struct cpu *c;
+
+  if (!kernel_lock_engaged)
+    return;
+
+  c = cpu_current ();
+  ASSERT (c->kernel_locked);
+  c->kernel_tlb_gen = ++kernel_tlb_gen;
+}
+
+/* Searches for the MP floating pointer structure in the places
+   that [MP] section 4 lists: the first kilobyte of the extended
+   BIOS data area, the last kilobyte of base memory, and the BIOS
+   ROM. */
+static struct mp_float *
+find_mp_float (void)
+{
+  const uint16_t *ebda_seg = ptov (0x40e);
+  const uint16_t *base_kb = ptov (0x413);
+  struct mp_float *mpf;
+
+  if (*ebda_seg != 0
+      && (mpf = scan_mp_float ((uintptr_t) *ebda_seg << 4, 1024)) != NULL)
+    return mpf;
+  if ((mpf = scan_mp_float ((uintptr_t) *base_kb * 1024 - 1024, 1024)) != NULL)
+    return mpf;
+  return scan_mp_float (0xf0000, 0x10000);
+}
+
+/* Returns the MP floating pointer structure among the SIZE bytes
+   of physical memory at PHYS, or a null pointer if there is
+   none. */
+static struct mp_float *
+scan_mp_float (uintptr_t phys, size_t size)
+{
+  uint8_t *p = phys_to_kernel (phys, size);
+  size_t ofs;
+
+  if (p == NULL)
+    return NULL;
+  for (ofs = 0; ofs + sizeof (struct mp_float) <= size; ofs += 16)
+    if (!memcmp (p + ofs, "_MP_", 4)
+        && checksum_ok (p + ofs, sizeof (struct mp_float)))
+      return (struct mp_float *) (p + ofs);
+  return NULL;
+}
+
+/* Returns the kernel virtual address of the SIZE bytes of
+   physical memory at PHYS, or a null pointer if the kernel does
+   not map all of them. */
+static void *
+phys_to_kernel (uintptr_t phys, size_t size)
+{
+  uintptr_t ram_size = (uintptr_t) init_ram_pages * PGSIZE;
+
+  if (phys >= ram_size || size > ram_size - phys)
+    return NULL;
+  return ptov (phys);
+}
+
+/* Returns true if the SIZE bytes at P sum to 0 modulo 256. */
+static bool
+checksum_ok (const void *p_, size_t size)
+{
+  const uint8_t *p = p_;
+  uint8_t sum = 0;
+
+  while (size-- > 0)
+    sum += *p++;
+  return sum == 0;
+}
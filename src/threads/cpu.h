@@ -0,0 +1,117 @@
+#ifndef THREADS_CPU_H
+#define THREADS_CPU_H
+
+#include <debug.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Processors.
+
+   cpu_init() finds the processors in the machine from the BIOS's
+   MultiProcessor Specification tables.  The bootstrap processor,
+   cpus[0], runs Pintos from boot.  With the "-smp" option,
+   cpu_start() then starts the application processors too.
+
+   The kernel serializes with interrupt disabling, which only
+   excludes other code on the same processor, so once more than
+   one is running, the kernel lock keeps all but one of them out
+   of the kernel: a processor holds it from the moment it enters
+   the kernel, by an interrupt, a system call or waking from
+   idle, until it goes back to user mode or halts.  Switching
+   threads does not release it.  User programs thus run in
+   parallel, and the kernel runs on one processor at a time, just
+   as it always has.  See cpu.c.
+
+   Each processor has its own run queues and idle thread.  State
+   that belongs to a processor rather than to the whole kernel
+   lives in its struct cpu and is reached through cpu_current(). */
+
+/* Most processors that cpu_init() records. */
+#define CPU_MAX 16
+
+struct thread;
+struct tss;
+
+/* A processor. */
+struct cpu
+  {
+    uint8_t lapic_id;           /* Local APIC ID. */
+    bool bsp;                   /* Bootstrap processor? */
+    bool online;                /* Running Pintos? */
+
+    /* Owned by cpu.c. */
+    bool kernel_locked;         /* Holding the kernel lock? */
+    volatile bool tlb_flush;    /* TLB shootdown requested? */
+    unsigned kernel_tlb_gen;    /* Kernel TLB flushes seen. */
+
+    /* Owned by thread.c. */
+    struct thread *idle_thread; /* This CPU's idle thread. */
+    struct thread *current;     /* Thread running here. */
+    size_t ready_cnt;           /* # of threads on its run queues. */
+    unsigned thread_ticks;      /* # of timer ticks since last yield. */
+
+#ifdef USERPROG
+    /* Owned by userprog/tss.c, gdt.c and pagedir.c. */
+    struct tss *tss;            /* Task-state segment. */
+    struct tss *df_tss;         /* Double fault task's TSS. */
+    uint64_t *gdt;              /* Global descriptor table. */
+    uint32_t *pagedir;          /* Page directory loaded in CR3. */
+#endif
+  };
+
+extern struct cpu cpus[CPU_MAX];
+extern size_t cpu_cnt;
+extern size_t cpu_online_cnt;
+
+/* Start the application processors?  Controlled by kernel
+   command-line option "-smp". */
+extern bool cpu_smp;
+
+void cpu_init (void);
+void cpu_start (void);
+void cpu_ap_main (struct cpu *) NO_RETURN;
+struct cpu *cpu_current (void);
+
+bool kernel_lock_enter (void);
+void kernel_lock_exit (void);
+
+void cpu_broadcast_tick (void);
+void cpu_resched (struct cpu *);
+void cpu_tlb_flush (void);
+void cpu_tlb_shootdown (uint32_t *pd);
+void cpu_flush_kernel_tlbs (void);
+
+/* Returns the index in cpus[] of the processor running the
+   caller. */
+static inline size_t
+cpu_id (void)
+{
+  return cpu_current () - cpus;
+}
+
+/* Per-CPU variables.
+
+   PERCPU (TYPE, NAME) defines NAME as one TYPE per processor,
+   each in a cache line of its own, so that processors updating
+   their own copies never contend for a line.  Use it with
+   `static': each definition has a type of its own.  this_cpu
+   (NAME) is the running processor's copy, which should only be
+   used with interrupts off or with a value that can tolerate the
+   thread moving to another CPU, and per_cpu (NAME, ID) is the
+   copy of processor ID, as for summing statistics:
+
+      static PERCPU (long long, hits);
+      ...
+      this_cpu (hits)++;
+      ...
+      for (id = 0; id < cpu_cnt; id++)
+        total += per_cpu (hits, id); */
+#define CACHE_LINE_SIZE 64
+#define PERCPU(TYPE, NAME)                                      \
+        struct { TYPE value; }                                  \
+        __attribute__ ((aligned (CACHE_LINE_SIZE))) NAME[CPU_MAX]
+#define per_cpu(NAME, ID) ((NAME)[ID].value)
+#define this_cpu(NAME) per_cpu (NAME, cpu_id ())
+
+#endif /* threads/cpu.h */
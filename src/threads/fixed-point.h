@@ -1,34 +1,129 @@
 #ifndef THREADS_FIXED_POINT_H
 #define THREADS_FIXED_POINT_H
 
-typedef int fixed_point;
+#include <stdint.h>
+
+/* Signed fixed-point numbers with FRACTION_BITS fraction bits,
+   used by the MLFQS scheduler.
+
+   A fixed_point is a struct, not a bare int, so that mixing up
+   fixed-point and integer operands is a compile-time error
+   instead of a silently wrong result: each operation below
+   says in its name whether its second operand is fixed-point
+   (fp_mul) or an integer (fp_mul_int).  Products and quotients
+   of two fixed-point numbers go through int64_t, so they do not
+   overflow for any operands whose result fits. */
 
 #define FRACTION_BITS 15
+#define FP_ONE (1 << FRACTION_BITS)
+
+typedef struct
+{
+  int32_t raw; /* Value times FP_ONE. */
+} fixed_point;
+
+/* Returns N as a fixed-point number. */
+static inline fixed_point
+fp_from_int(int n)
+{
+  fixed_point f = {n * FP_ONE};
+  return f;
+}
+
+/* Returns X rounded toward zero. */
+static inline int
+fp_to_int(fixed_point x)
+{
+  /* Adding FP_ONE - 1 to a negative value before the arithmetic
+     shift turns its rounding toward negative infinity into
+     rounding toward zero. */
+  return (x.raw + ((x.raw >> 31) & (FP_ONE - 1))) >> FRACTION_BITS;
+}
+
+/* Returns X rounded to the nearest integer, with halves rounded
+   away from zero.  Branchless: rounds the magnitude and restores
+   the sign with a mask that is 0 for nonnegative X and -1 for
+   negative X. */
+static inline int
+fp_round(fixed_point x)
+{
+  int32_t sign = x.raw >> 31;
+  int32_t magnitude = (x.raw ^ sign) - sign;
+  int32_t rounded = (magnitude + FP_ONE / 2) >> FRACTION_BITS;
+  return (rounded ^ sign) - sign;
+}
+
+/* Returns X + Y. */
+static inline fixed_point
+fp_add(fixed_point x, fixed_point y)
+{
+  fixed_point f = {x.raw + y.raw};
+  return f;
+}
+
+/* Returns X - Y. */
+static inline fixed_point
+fp_sub(fixed_point x, fixed_point y)
+{
+  fixed_point f = {x.raw - y.raw};
+  return f;
+}
 
-#define convert_int_to_fixed_point(int_value) ((fixed_point)(int_value << FRACTION_BITS))
+/* Returns X + N. */
+static inline fixed_point
+fp_add_int(fixed_point x, int n)
+{
+  fixed_point f = {x.raw + n * FP_ONE};
+  return f;
+}
 
-#define convert_fixed_point_to_int_round_towards_zero(fixed_point_value) (fixed_point_value >> FRACTION_BITS)
+/* Returns X - N. */
+static inline fixed_point
+fp_sub_int(fixed_point x, int n)
+{
+  fixed_point f = {x.raw - n * FP_ONE};
+  return f;
+}
 
-#define convert_fixed_point_to_int_round_to_nearest(fixed_point_value) (fixed_point_value >= 0 ? ((fixed_point_value + (1 << (FRACTION_BITS - 1))) >> FRACTION_BITS) : ((fixed_point_value - (1 << (FRACTION_BITS - 1))) >> FRACTION_BITS))
+/* Returns X * Y. */
+static inline fixed_point
+fp_mul(fixed_point x, fixed_point y)
+{
+  fixed_point f = {(int32_t)(((int64_t)x.raw * y.raw) >> FRACTION_BITS)};
+  return f;
+}
 
-/* Add two fixed-point numbers */
-#define add_fixed_point_numbers(fixed_point_number1, fixed_point_number2) (fixed_point_number1 + fixed_point_number2)
-/* Add integer n to fixed-point number x */
-#define add_int_to_fixed_point_number(fixed_point_number, int_value) (fixed_point_number + (int_value << FRACTION_BITS))
+/* Returns X * N. */
+static inline fixed_point
+fp_mul_int(fixed_point x, int n)
+{
+  fixed_point f = {x.raw * n};
+  return f;
+}
 
-/* Subtract two fixed-point numbers */
-#define subtract_fixed_point_numbers(fixed_point_number1, fixed_point_number2) (fixed_point_number1 - fixed_point_number2)
-/* Subtract integer n from fixed-point number x */
-#define subtract_int_from_fixed_point_number(fixed_point_number, int_value) (fixed_point_number - (int_value << FRACTION_BITS))
+/* Returns X / Y.  Y must not be zero. */
+static inline fixed_point
+fp_div(fixed_point x, fixed_point y)
+{
+  fixed_point f = {(int32_t)(((int64_t)x.raw << FRACTION_BITS) / y.raw)};
+  return f;
+}
 
-/* Multiply two fixed-point numbers */
-#define multiply_fixed_point_numbers(fixed_point_number1, fixed_point_number2) (fixed_point_number1 * fixed_point_number2)
-/* Multiply fixed-point number x by integer n */
-#define multiply_fixed_point_numbers_by_int(fixed_point_number, int_value) ((fixed_point)(((int64_t) fixed_point_number) * int_value >> FRACTION_BITS))
+/* Returns X / N.  N must not be zero. */
+static inline fixed_point
+fp_div_int(fixed_point x, int n)
+{
+  fixed_point f = {x.raw / n};
+  return f;
+}
 
-/* Divide two fixed-point numbers */
-#define divide_fixed_point_numbers(fixed_point_number1, fixed_point_number2) (fixed_point_number1 / fixed_point_number2)
-/* Divide fixed-point number x by integer n */
-#define divide_integer_by_fixed_point(int_value, fixed_point_number) ((fixed_point)((((int64_t) int_value) << FRACTION_BITS) / fixed_point_number))
+/* Returns the fixed-point number nearest to NUM / DENOM, for
+   computing constants. */
+static inline fixed_point
+fp_ratio(int num, int denom)
+{
+  fixed_point f = {(int32_t)(((int64_t)num * FP_ONE + denom / 2) / denom)};
+  return f;
+}
 
-#endif
\ No newline at end of file
+#endif /* threads/fixed-point.h */
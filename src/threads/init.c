@@ -15,49 +15,93 @@
 #include "devices/timer.h"
 #include "devices/vga.h"
 #include "devices/rtc.h"
+#include "threads/cpu.h"
 #include "threads/interrupt.h"
 #include "threads/io.h"
+#include "threads/klog.h"
 #include "threads/loader.h"
 #include "threads/malloc.h"
 #include "threads/palloc.h"
+#include "threads/profile.h"
 #include "threads/pte.h"
+#include "threads/rcu.h"
+#include "threads/slab.h"
+#include "threads/snapshot.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
+#include "threads/trace.h"
+#include "threads/vmalloc.h"
 #ifdef USERPROG
 #include "userprog/process.h"
 #include "userprog/exception.h"
+#include "userprog/exec-cache.h"
 #include "userprog/gdt.h"
+#include "userprog/infopage.h"
 #include "userprog/syscall.h"
+#include "userprog/sysenter.h"
 #include "userprog/tss.h"
 #else
 #include "tests/threads/tests.h"
 #endif
+#include "tests/bench/bench.h"
 #ifdef FILESYS
 #include "devices/block.h"
 #include "devices/ide.h"
+#include "devices/ramdisk.h"
+#include "devices/stripe.h"
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/page.h"
+#include "vm/shm.h"
+#include "vm/swap.h"
+#endif
 
 /* Page directory with kernel mappings only. */
 uint32_t *init_page_dir;
 
+/* 4 MB pages enabled? */
+bool init_large_pages;
+
 #ifdef FILESYS
 /* -f: Format the file system? */
 static bool format_filesys;
 
+/* -resume: Continue from the snapshot on the scratch device? */
+static bool resume_snapshot;
+
 /* -filesys, -scratch, -swap: Names of block devices to use,
    overriding the defaults. */
 static const char *filesys_bdev_name;
 static const char *scratch_bdev_name;
+
+/* -ramdisk: Size of the RAM disk in kB, or 0 for none. */
+static size_t ramdisk_kb;
+
+/* -stripe, -stripe-chunk: Members of the striped device, if
+   any, and its chunk size in sectors. */
+static char *stripe_members;
+static size_t stripe_chunk = STRIPE_CHUNK_DEFAULT;
 #ifdef VM
 static const char *swap_bdev_name;
 #endif
 #endif /* FILESYS */
 
+/* Number of locks printed by the "lockstat" action. */
+#define LOCKSTAT_TOP 10
+
 /* -ul: Maximum number of pages to put into palloc's user pool. */
 static size_t user_page_limit = SIZE_MAX;
 
+/* Pages of RAM beyond what the kernel can map, not used. */
+static uint32_t unused_ram_pages;
+
 static void bss_init (void);
+static void ram_init (void);
+static bool cpu_has_feature (uint32_t);
 static void paging_init (void);
 
 static char **read_command_line (void);
@@ -80,6 +124,7 @@ main (void)
 
   /* Clear BSS. */  
   bss_init ();
+  ram_init ();
 
   /* Break command line into arguments and parse options. */
   argv = read_command_line ();
@@ -93,16 +138,27 @@ main (void)
   /* Greet user. */
   printf ("Pintos booting with %'"PRIu32" kB RAM...\n",
           init_ram_pages * PGSIZE / 1024);
+  if (unused_ram_pages > 0)
+    printf ("Ignoring %'"PRIu32" kB RAM above the kernel's "
+            "direct mapping.\n", unused_ram_pages * PGSIZE / 1024);
   
   /* Initialize memory system. */
   palloc_init (user_page_limit);
   malloc_init ();
+  kmem_cache_init ();
+  trace_init ();
+  klog_init ();
+  thread_kstacks_reserve ();
   paging_init ();
+  palloc_add_ram ();
+  vmalloc_init ();
+  cpu_init ();
 
   /* Segmentation. */
 #ifdef USERPROG
   tss_init ();
   gdt_init ();
+  sysenter_init ();
 #endif
   /* Initialize interrupt handlers. */
   intr_init ();
@@ -112,21 +168,44 @@ main (void)
 #ifdef USERPROG
   exception_init ();
   syscall_init ();
+  infopage_init ();
+  exec_cache_init ();
 #endif
 
   /* Start thread scheduler and enable interrupts. */
   thread_start ();
+  rcu_init ();
+  palloc_start_zeroer ();
   serial_init_queue ();
   timer_calibrate ();
 
 #ifdef FILESYS
   /* Initialize file system. */
   ide_init ();
+  ramdisk_init (ramdisk_kb);
+  stripe_init (stripe_members, stripe_chunk);
   locate_block_devices ();
+  if (resume_snapshot)
+    snapshot_restore ();
   filesys_init (format_filesys);
 #endif
+  klog_start ();
+
+#ifdef VM
+  /* Initialize virtual memory. */
+  page_tables_init ();
+  frame_init ();
+  swap_init ();
+  shm_init ();
+#endif
+#ifdef USERPROG
+  syscall_start ();
+  process_start ();
+#endif
+  cpu_start ();
 
   printf ("Boot complete.\n");
+  profile_start ();
   
   /* Run actions specified on kernel command line. */
   run_actions (argv);
@@ -149,16 +228,88 @@ bss_init (void)
   memset (&_start_bss, 0, &_end_bss - &_start_bss);
 }
 
+/* Most physical memory that the kernel maps, at PHYS_BASE, up to
+   the vmalloc() window.  Memory beyond it would need temporary
+   mappings to be used, which Pintos does not implement. */
+#define DIRECT_MAP_LIMIT 0x30000000
+
+/* Takes the amount of RAM from the BIOS memory map, if start.S
+   got one, instead of from interrupt 15h function 88h, which
+   cannot report more than 64 MB.  init_ram_pages is set to the
+   end of the highest usable region, capped at DIRECT_MAP_LIMIT;
+   palloc_init() skips the holes below it. */
+static void
+ram_init (void)
+{
+  uint64_t end = 0;
+  uint32_t i;
+
+  for (i = 0; i < init_mem_map_cnt; i++)
+    {
+      const struct mem_map_entry *e = &init_mem_map[i];
+      uint64_t e_end = e->base + e->length;
+
+      /* Memory above 4 GB is out of reach without PAE. */
+      if (e->type == LOADER_MEM_USABLE && e->base < 0x100000000ULL
+          && e_end > end)
+        end = e_end < 0x100000000ULL ? e_end : 0x100000000ULL;
+    }
+  if (end == 0)
+    return;
+
+  if (end > DIRECT_MAP_LIMIT)
+    {
+      unused_ram_pages = (end - DIRECT_MAP_LIMIT) / PGSIZE;
+      end = DIRECT_MAP_LIMIT;
+    }
+  init_ram_pages = end / PGSIZE;
+}
+
+/* CPUID feature flags, in EDX for CPUID function 1. */
+#define CPUID_PSE (1 << 3)      /* Page Size Extension (4 MB pages). */
+#define CPUID_PGE (1 << 13)     /* Page Global Enable. */
+
+/* CR4 control bits. */
+#define CR4_PSE (1 << 4)        /* Enable 4 MB pages. */
+#define CR4_PGE (1 << 7)        /* Enable global pages. */
+
+/* Returns true if the CPU reports all of the FEATURES, a set of
+   CPUID_* flags. */
+static bool
+cpu_has_feature (uint32_t features)
+{
+  uint32_t eax = 1, ebx, ecx, edx;
+
+  asm ("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+  return (edx & features) == features;
+}
+
 /* Populates the base page directory and page table with the
    kernel virtual mapping, and then sets up the CPU to use the
    new page directory.  Points init_page_dir to the page
-   directory it creates. */
+   directory it creates.
+
+   If the CPU supports 4 MB pages, each 4 MB region of physical
+   memory is mapped with a single page directory entry, which
+   saves page tables and TLB entries.  Regions holding kernel
+   text, and a partial region at the end of memory, still get 4
+   kB pages, so that the text can be mapped read-only.  So do
+   regions holding guarded kernel stacks, whose guard pages are
+   left unmapped.
+
+   If the CPU supports global pages, the kernel mappings, which
+   are the same in every page directory, are marked global so
+   that their TLB entries survive loading CR3 on a switch between
+   processes. */
 static void
 paging_init (void)
 {
   uint32_t *pd, *pt;
   size_t page;
   extern char _start, _end_kernel_text;
+  bool pse = cpu_has_feature (CPUID_PSE);
+  bool pge = cpu_has_feature (CPUID_PGE);
+  uint32_t global = pge ? PTE_G : 0;
 
   pd = init_page_dir = palloc_get_page (PAL_ASSERT | PAL_ZERO);
   pt = NULL;
@@ -170,13 +321,40 @@ paging_init (void)
       size_t pte_idx = pt_no (vaddr);
       bool in_kernel_text = &_start <= vaddr && vaddr < &_end_kernel_text;
 
+      if (pse && pte_idx == 0
+          && init_ram_pages - page >= PTSPAN / PGSIZE
+          && (vaddr + PTSPAN <= &_start || vaddr >= &_end_kernel_text)
+          && !thread_kstacks_overlap (vaddr, vaddr + PTSPAN))
+        {
+          pd[pde_idx] = pde_create_large (vaddr, true) | global;
+          page += PTSPAN / PGSIZE - 1;
+          continue;
+        }
+
       if (pd[pde_idx] == 0)
         {
           pt = palloc_get_page (PAL_ASSERT | PAL_ZERO);
           pd[pde_idx] = pde_create (pt);
         }
 
-      pt[pte_idx] = pte_create_kernel (vaddr, !in_kernel_text);
+      if (thread_kstack_is_guard (vaddr))
+        pt[pte_idx] = 0;
+      else
+        pt[pte_idx] = pte_create_kernel (vaddr, !in_kernel_text) | global;
+    }
+
+  /* Turn on 4 MB pages and global pages before any entry needs
+     them. */
+  if (pse || pge)
+    {
+      uint32_t cr4;
+      asm volatile ("movl %%cr4, %0" : "=r" (cr4));
+      if (pse)
+        cr4 |= CR4_PSE;
+      init_large_pages = pse;
+      if (pge)
+        cr4 |= CR4_PGE;
+      asm volatile ("movl %0, %%cr4" : : "r" (cr4));
     }
 
   /* Store the physical address of the page directory into CR3
@@ -242,22 +420,88 @@ parse_options (char **argv)
 #ifdef FILESYS
       else if (!strcmp (name, "-f"))
         format_filesys = true;
+      else if (!strcmp (name, "-resume"))
+        resume_snapshot = true;
       else if (!strcmp (name, "-filesys"))
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-ramdisk"))
+        ramdisk_kb = atoi (value);
+      else if (!strcmp (name, "-stripe"))
+        stripe_members = value;
+      else if (!strcmp (name, "-stripe-chunk"))
+        stripe_chunk = atoi (value);
+      else if (!strcmp (name, "-cache"))
+        {
+          if (value == NULL || !cache_set_policy (value))
+            PANIC ("bad -cache policy (use -h for help)");
+        }
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
+      else if (!strcmp (name, "-stack"))
+        stack_page_limit = atoi (value);
+      else if (!strcmp (name, "-merge"))
+        frame_merge_pages = true;
+      else if (!strcmp (name, "-evict"))
+        {
+          if (value == NULL || !frame_set_policy (value))
+            PANIC ("bad -evict policy (use -h for help)");
+        }
 #endif
 #endif
       else if (!strcmp (name, "-rs"))
         random_init (atoi (value));
       else if (!strcmp (name, "-mlfqs"))
         thread_mlfqs = true;
+      else if (!strcmp (name, "-mlfqs-boost"))
+        thread_mlfqs_boost = true;
+      else if (!strcmp (name, "-cfs"))
+        thread_cfs = true;
+      else if (!strcmp (name, "-smp"))
+        cpu_smp = true;
+      else if (!strcmp (name, "-lpt"))
+        timer_loops_per_tick = atoi (value);
+      else if (!strcmp (name, "-tickless"))
+        timer_tickless = true;
+      else if (!strcmp (name, "-slice"))
+        thread_slice = atoi (value);
+      else if (!strcmp (name, "-slice-scaled"))
+        thread_slice_scaled = true;
+      else if (!strcmp (name, "-kstacks"))
+        thread_kstack_cnt = atoi (value);
+      else if (!strcmp (name, "-profile"))
+        {
+          if (!profile_configure (value))
+            PANIC ("bad -profile rate (use -h for help)");
+        }
+      else if (!strcmp (name, "-profile-stacks"))
+        {
+          if (!profile_configure_stacks (value))
+            PANIC ("bad -profile-stacks depth (use -h for help)");
+        }
+      else if (!strcmp (name, "-trace"))
+        {
+          if (value == NULL || !trace_configure (value))
+            PANIC ("bad -trace event list (use -h for help)");
+        }
+      else if (!strcmp (name, "-irqoff"))
+        intr_trace_off = true;
+      else if (!strcmp (name, "-klog"))
+        klog_enabled = true;
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
+      else if (!strcmp (name, "-rusage"))
+        process_print_usage = true;
+      else if (!strcmp (name, "-strace"))
+        {
+          if (value == NULL)
+            PANIC ("-strace needs a program name (use -h for help)");
+          process_strace = value;
+          klog_enabled = true;
+        }
 #endif
       else
         PANIC ("unknown option `%s' (use -h for help)", name);
@@ -282,6 +526,11 @@ run_task (char **argv)
 {
   const char *task = argv[1];
   
+#ifdef FILESYS
+  /* A process is loaded from the file system, so mount it first,
+     to keep its messages out of the task's output. */
+  filesys_mount ();
+#endif
   printf ("Executing '%s':\n", task);
 #ifdef USERPROG
   process_wait (process_execute (task));
@@ -291,6 +540,48 @@ run_task (char **argv)
   printf ("Execution of '%s' complete.\n", task);
 }
 
+#ifndef USERPROG
+/* Runs the tests matching ARGV[1] in one boot. */
+static void
+run_batch (char **argv)
+{
+  run_tests (argv[1]);
+}
+#endif
+
+/* Runs the benchmark named in ARGV[1]. */
+static void
+run_bench_action (char **argv)
+{
+  run_bench (argv[1]);
+}
+
+/* Prints statistics for the most contended named locks. */
+static void
+lockstat (char **argv UNUSED)
+{
+  lock_print_stats (LOCKSTAT_TOP);
+}
+
+/* Prints page allocator and malloc() memory use. */
+static void
+meminfo (char **argv UNUSED)
+{
+  palloc_print_stats ();
+  malloc_print_stats ();
+}
+
+#ifdef FILESYS
+/* Saves a snapshot of the kernel to the scratch device, with the
+   file system synced first. */
+static void
+snapshot (char **argv UNUSED)
+{
+  filesys_sync ();
+  snapshot_save ();
+}
+#endif
+
 /* Executes all of the actions specified in ARGV[]
    up to the null pointer sentinel. */
 static void
@@ -308,12 +599,22 @@ run_actions (char **argv)
   static const struct action actions[] = 
     {
       {"run", 2, run_task},
+#ifndef USERPROG
+      {"run-batch", 2, run_batch},
+#endif
+      {"bench", 2, run_bench_action},
+      {"lockstat", 1, lockstat},
+      {"meminfo", 1, meminfo},
 #ifdef FILESYS
       {"ls", 1, fsutil_ls},
       {"cat", 2, fsutil_cat},
       {"rm", 2, fsutil_rm},
       {"extract", 1, fsutil_extract},
       {"append", 2, fsutil_append},
+      {"iostat", 1, fsutil_iostat},
+      {"defrag", 1, fsutil_defrag},
+      {"defragd", 1, fsutil_defragd},
+      {"snapshot", 1, snapshot},
 #endif
       {NULL, 0, NULL},
     };
@@ -355,11 +656,20 @@ usage (void)
           "  run 'PROG [ARG...]' Run PROG and wait for it to complete.\n"
 #else
           "  run TEST           Run TEST.\n"
+          "  run-batch TEST,... Run each TEST, or each test starting with\n"
+          "                     PREFIX for PREFIX*, in one boot.\n"
 #endif
+          "  bench BENCH        Run kernel benchmark BENCH, or `all'.\n"
+          "  lockstat           Print statistics for the most contended locks.\n"
+          "  meminfo            Print page allocator and malloc memory use.\n"
 #ifdef FILESYS
           "  ls                 List files in the root directory.\n"
           "  cat FILE           Print FILE to the console.\n"
           "  rm FILE            Delete FILE.\n"
+          "  iostat             Print I/O statistics for each block device.\n"
+          "  defrag             Move fragmented files into contiguous runs.\n"
+          "  defragd            Defragment in the background from now on.\n"
+          "  snapshot           Save a snapshot to the scratch device.\n"
           "Use these actions indirectly via `pintos' -g and -p options:\n"
           "  extract            Untar from scratch device into file system.\n"
           "  append FILE        Append FILE to tar file on scratch device.\n"
@@ -370,16 +680,59 @@ usage (void)
           "  -r                 Reboot after actions.\n"
 #ifdef FILESYS
           "  -f                 Format file system device during startup.\n"
+          "  -resume            Continue from the snapshot on the scratch\n"
+          "                     device, after its `snapshot' action, instead\n"
+          "                     of running this command line's actions.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -ramdisk=KB        Add a KB kB RAM disk, ram0, for use as BDEV.\n"
+          "  -stripe=BDEV,...   Stripe BDEVs into one device, md0, for use\n"
+          "                     as BDEV.\n"
+          "  -stripe-chunk=N    Stripe in chunks of N sectors (default 4).\n"
+          "  -cache=POLICY      Replace buffer cache sectors by POLICY: clock\n"
+          "                     (default), 2q, or arc.\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
+          "  -stack=COUNT       Limit user stacks to COUNT pages.\n"
+          "  -evict=POLICY      Choose pages to evict by POLICY: clock\n"
+          "                     (default), clock2, 2q, or aging.\n"
+          "  -merge             Merge identical private pages in the\n"
+          "                     background.\n"
 #endif
 #endif
           "  -rs=SEED           Set random number seed to SEED.\n"
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
+          "  -mlfqs-boost       Boost MLFQS priority on wake-up.\n"
+          "  -cfs               Use fair scheduler, weighted by nice values.\n"
+          "  -smp               Start every processor, not just the first.\n"
+          "  -tickless          Stop the periodic timer tick while idle.\n"
+          "  -lpt=CYCLES        Skip timer calibration, taking CYCLES\n"
+          "                     time-stamp counter cycles per tick, as\n"
+          "                     printed by an earlier boot.\n"
+          "  -slice=TICKS       Preempt threads after TICKS timer ticks\n"
+          "                     (default 4).\n"
+          "  -slice-scaled      Give low priorities longer time slices and\n"
+          "                     high priorities shorter ones.\n"
+          "  -kstacks=COUNT     Give up to COUNT threads 8 kB kernel stacks\n"
+          "                     with a guard page.\n"
+          "  -profile[=HZ]      Profile the kernel once per tick, or HZ times\n"
+          "                     per second, and dump the profile at exit.\n"
+          "  -profile-stacks[=DEPTH]\n"
+          "                     Also sample kernel call stacks up to DEPTH\n"
+          "                     callers deep (default 15), for pintos-flame.\n"
+          "  -trace=EVENT,...   Trace EVENTs, or `all', and dump them at exit.\n"
+          "                     Events: schedule block unblock lock sema_down\n"
+          "                     intr_enter intr_exit page_fault ide_read\n"
+          "                     ide_write.\n"
+          "  -irqoff            Trace how long interrupts stay off and\n"
+          "                     report the longest stretches at exit.\n"
+          "  -klog              Keep a binary log at the end of the scratch\n"
+          "                     device, for utils/pintos-klog.\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+          "  -rusage            Print each process's resource usage at exit.\n"
+          "  -strace=PROG       Log the system calls of processes running\n"
+          "                     PROG, or of all if PROG is `all', with -klog.\n"
 #endif
           );
   shutdown_power_off ();
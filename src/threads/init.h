@@ -9,4 +9,7 @@
 /* Page directory with kernel mappings only. */
 extern uint32_t *init_page_dir;
 
+/* Did paging_init() turn on 4 MB pages? */
+extern bool init_large_pages;
+
 #endif /* threads/init.h */
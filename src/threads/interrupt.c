@@ -3,12 +3,19 @@
 #include <inttypes.h>
 #include <stdint.h>
 #include <stdio.h>
+#include "threads/cpu.h"
 #include "threads/flags.h"
 #include "threads/intr-stubs.h"
 #include "threads/io.h"
 #include "threads/thread.h"
+#include "threads/trace.h"
 #include "threads/vaddr.h"
+#include "devices/lapic.h"
 #include "devices/timer.h"
+#ifdef USERPROG
+#include "userprog/gdt.h"
+#include "userprog/process.h"
+#endif
 
 /* Programmable Interrupt Controller (PIC) registers.
    A PC has two PICs, called the master and slave PICs, with the
@@ -33,10 +40,21 @@ static intr_handler_func *intr_handlers[INTR_CNT];
 /* Names for each interrupt, for debugging purposes. */
 static const char *intr_names[INTR_CNT];
 
+/* External interrupts delivered by the local APIC rather than the
+   PIC, which are acknowledged there. */
+static bool lapic_vectors[INTR_CNT];
+
 /* Number of unexpected interrupts for each vector.  An
    unexpected interrupt is one that has no registered handler. */
 static unsigned int unexpected_cnt[INTR_CNT];
 
+/* Number of times each vector's handler has run, and the total
+   time-stamp counter cycles spent in it.  The cycles include any
+   nested interrupts and, for internal interrupts such as system
+   calls, any time the handler spent blocked. */
+static int64_t intr_cnt[INTR_CNT];
+static uint64_t intr_cycles[INTR_CNT];
+
 /* External interrupts are those generated by devices outside the
    CPU, such as the timer.  External interrupts run with
    interrupts turned off, so they never nest, nor are they ever
@@ -47,6 +65,53 @@ static unsigned int unexpected_cnt[INTR_CNT];
 static bool in_external_intr;   /* Are we processing an external interrupt? */
 static bool yield_on_return;    /* Should we yield on interrupt return? */
 
+/* Work deferred by external interrupt handlers with intr_defer().
+   It runs just after the handler returns, with interrupts on,
+   still on the interrupted thread's stack and before any yield
+   the handler requested.  An external interrupt that arrives
+   while deferred work is running leaves its own deferred work and
+   its yield request to the outer invocation, which keeps going
+   until the list is empty, so deferred work never nests. */
+static struct list deferred_work;
+static bool in_deferred_work;   /* Are we running deferred work? */
+
+/* Interrupts-off latency tracing, enabled with "-irqoff".
+
+   A period with interrupts off starts when intr_disable() or
+   intr_set_level() turns them off, or when an interrupt gate
+   turns them off on entry to a handler, and ends when
+   intr_enable() or intr_set_level() turns them back on, or when a
+   handler returns to code that ran with interrupts on.  Periods
+   that end some other way, such as the idle thread's "sti; hlt",
+   go unrecorded.  A period that spans a thread switch counts
+   against the thread that turned interrupts off.
+
+   Bucket 0 of the histogram counts periods shorter than
+   2**IRQOFF_MIN_BITS cycles, each later bucket those up to twice
+   as long as the one before, and the last bucket all longer
+   periods. */
+bool intr_trace_off;
+#define IRQOFF_MIN_BITS 8
+#define IRQOFF_BUCKETS 16
+static int64_t irqoff_hist[IRQOFF_BUCKETS];
+static uint64_t irqoff_max;     /* Longest period, in cycles. */
+
+/* The current period: when it started, the code that started
+   it, and whether it is one to record. */
+static uint64_t irqoff_start;
+static void *irqoff_caller;
+static bool irqoff_open;
+
+/* The callers responsible for the longest periods, each with its
+   longest period, in cycles, longest first. */
+#define IRQOFF_WORST 4
+struct irqoff_worst
+  {
+    void *caller;
+    uint64_t cycles;
+  };
+static struct irqoff_worst irqoff_worst[IRQOFF_WORST];
+
 /* Programmable Interrupt Controller helpers. */
 static void pic_init (void);
 static void pic_end_of_interrupt (int irq);
@@ -54,11 +119,19 @@ static void pic_end_of_interrupt (int irq);
 /* Interrupt Descriptor Table helpers. */
 static uint64_t make_intr_gate (void (*) (void), int dpl);
 static uint64_t make_trap_gate (void (*) (void), int dpl);
+static uint64_t make_task_gate (uint16_t tss_sel);
 static inline uint64_t make_idtr_operand (uint16_t limit, void *base);
 
 /* Interrupt handlers. */
 void intr_handler (struct intr_frame *args);
 static void unexpected_interrupt (const struct intr_frame *);
+static void run_deferred_work (void);
+
+/* Interrupts-off tracing helpers. */
+static enum intr_level enable (void);
+static enum intr_level disable (void *caller);
+static void irqoff_begin (void *caller);
+static void irqoff_end (void);
 
 /* Returns the current interrupt status. */
 enum intr_level
@@ -80,16 +153,35 @@ intr_get_level (void)
 enum intr_level
 intr_set_level (enum intr_level level) 
 {
-  return level == INTR_ON ? intr_enable () : intr_disable ();
+  return (level == INTR_ON
+          ? enable () : disable (__builtin_return_address (0)));
 }
 
 /* Enables interrupts and returns the previous interrupt status. */
 enum intr_level
 intr_enable (void) 
+{
+  return enable ();
+}
+
+/* Disables interrupts and returns the previous interrupt status. */
+enum intr_level
+intr_disable (void) 
+{
+  return disable (__builtin_return_address (0));
+}
+
+/* Enables interrupts and returns the previous interrupt status,
+   ending the interrupts-off period if there was one. */
+static inline enum intr_level
+enable (void) 
 {
   enum intr_level old_level = intr_get_level ();
   ASSERT (!intr_context ());
 
+  if (intr_trace_off && old_level == INTR_OFF)
+    irqoff_end ();
+
   /* Enable interrupts by setting the interrupt flag.
 
      See [IA32-v2b] "STI" and [IA32-v3a] 5.8.1 "Masking Maskable
@@ -99,9 +191,11 @@ intr_enable (void)
   return old_level;
 }
 
-/* Disables interrupts and returns the previous interrupt status. */
-enum intr_level
-intr_disable (void) 
+/* Disables interrupts and returns the previous interrupt status,
+   blaming CALLER for the interrupts-off period if this starts
+   one. */
+static inline enum intr_level
+disable (void *caller) 
 {
   enum intr_level old_level = intr_get_level ();
 
@@ -110,6 +204,9 @@ intr_disable (void)
      Hardware Interrupts". */
   asm volatile ("cli" : : : "memory");
 
+  if (intr_trace_off && old_level == INTR_ON)
+    irqoff_begin (caller);
+
   return old_level;
 }
 
@@ -122,6 +219,7 @@ intr_init (void)
 
   /* Initialize interrupt controller. */
   pic_init ();
+  list_init (&deferred_work);
 
   /* Initialize IDT. */
   for (i = 0; i < INTR_CNT; i++)
@@ -157,6 +255,15 @@ intr_init (void)
   intr_names[19] = "#XF SIMD Floating-Point Exception";
 }
 
+/* Loads the IDT that intr_init() set up into the application
+   processor that calls it. */
+void
+intr_init_ap (void)
+{
+  uint64_t idtr_operand = make_idtr_operand (sizeof idt - 1, idt);
+  asm volatile ("lidt %0" : : "m" (idtr_operand));
+}
+
 /* Registers interrupt VEC_NO to invoke HANDLER with descriptor
    privilege level DPL.  Names the interrupt NAME for debugging
    purposes.  The interrupt handler will be invoked with
@@ -185,6 +292,19 @@ intr_register_ext (uint8_t vec_no, intr_handler_func *handler,
   register_handler (vec_no, 0, INTR_OFF, handler, name);
 }
 
+/* Registers external interrupt VEC_NO, delivered by the local
+   APIC, to invoke HANDLER, which is named NAME for debugging
+   purposes.  The handler runs like any other external interrupt
+   handler. */
+void
+intr_register_lapic (uint8_t vec_no, intr_handler_func *handler,
+                     const char *name) 
+{
+  ASSERT (vec_no >= 0x30);
+  register_handler (vec_no, 0, INTR_OFF, handler, name);
+  lapic_vectors[vec_no] = true;
+}
+
 /* Registers internal interrupt VEC_NO to invoke HANDLER, which
    is named NAME for debugging purposes.  The interrupt handler
    will be invoked with interrupt status LEVEL.
@@ -206,6 +326,22 @@ intr_register_int (uint8_t vec_no, int dpl, enum intr_level level,
   register_handler (vec_no, dpl, level, handler, name);
 }
 
+/* Registers internal interrupt VEC_NO to switch to the task whose
+   task-state segment is selected by TSS_SEL, through a task gate.
+   The task runs on its own registers and stack, starting where
+   its TSS says, rather than in intr_handler().  It returns to
+   the interrupted task with IRET.  For debugging purposes, the
+   interrupt is named NAME. */
+void
+intr_register_task (uint8_t vec_no, uint16_t tss_sel, const char *name)
+{
+  ASSERT (vec_no < 0x20 || vec_no > 0x2f);
+  ASSERT (intr_handlers[vec_no] == NULL);
+
+  idt[vec_no] = make_task_gate (tss_sel);
+  intr_names[vec_no] = name;
+}
+
 /* Returns true during processing of an external interrupt
    and false at all other times. */
 bool
@@ -217,13 +353,40 @@ intr_context (void)
 /* During processing of an external interrupt, directs the
    interrupt handler to yield to a new process just before
    returning from the interrupt.  May not be called at any other
-   time. */
+   time, except from deferred work. */
 void
 intr_yield_on_return (void) 
 {
-  ASSERT (intr_context ());
+  ASSERT (intr_context () || in_deferred_work);
   yield_on_return = true;
 }
+
+/* Initializes W to call FUNC with AUX when it is deferred. */
+void
+intr_work_init (struct intr_work *w, intr_work_func *func, void *aux) 
+{
+  w->func = func;
+  w->aux = aux;
+  w->pending = false;
+}
+
+/* Arranges for W to run once the current external interrupt
+   handler returns.  Deferring W again before it has run has no
+   further effect.  Deferred work runs with interrupts on, but it
+   may not sleep or yield; like an external interrupt handler, it
+   may call intr_yield_on_return(). */
+void
+intr_defer (struct intr_work *w) 
+{
+  enum intr_level old_level = intr_disable ();
+
+  if (!w->pending)
+    {
+      w->pending = true;
+      list_push_back (&deferred_work, &w->elem);
+    }
+  intr_set_level (old_level);
+}
 
 /* 8259A Programmable Interrupt Controller. */
 
@@ -327,6 +490,22 @@ make_trap_gate (void (*function) (void), int dpl)
   return make_gate (function, dpl, 15);
 }
 
+/* Creates a task gate, with DPL 0, that switches to the task
+   whose TSS is selected by TSS_SEL.
+   See [IA32-v3a] 6.2.5 "Task-Gate Descriptor". */
+static uint64_t
+make_task_gate (uint16_t tss_sel)
+{
+  uint32_t e0, e1;
+
+  e0 = (uint32_t) tss_sel << 16;         /* TSS segment selector. */
+  e1 = ((1 << 15)                        /* Present. */
+        | (0 << 13)                      /* Descriptor privilege level. */
+        | (5 << 8));                     /* Task gate type. */
+
+  return e0 | ((uint64_t) e1 << 32);
+}
+
 /* Returns a descriptor that yields the given LIMIT and BASE when
    used as an operand for the LIDT instruction. */
 static inline uint64_t
@@ -340,29 +519,59 @@ make_idtr_operand (uint16_t limit, void *base)
 /* Handler for all interrupts, faults, and exceptions.  This
    function is called by the assembly language interrupt stubs in
    intr-stubs.S.  FRAME describes the interrupt and the
-   interrupted thread's registers. */
+   interrupted thread's registers.
+
+   With more than one processor, an interrupt from user mode or
+   from an idle processor takes the kernel lock for as long as it
+   runs.  A TLB shootdown is answered without it, because the
+   processor that sends one holds the lock and waits for the
+   answer. */
 void
 intr_handler (struct intr_frame *frame) 
 {
   bool external;
   intr_handler_func *handler;
+  enum intr_level old_level;
+  uint64_t start;
+  bool locked;
+
+  if (frame->vec_no == LAPIC_FLUSH_VEC)
+    {
+      cpu_tlb_flush ();
+      lapic_eoi ();
+      return;
+    }
+  locked = kernel_lock_enter ();
+
+  /* An interrupt gate turned interrupts off on the way in. */
+  handler = intr_handlers[frame->vec_no];
+  if (intr_trace_off && (frame->eflags & FLAG_IF)
+      && intr_get_level () == INTR_OFF)
+    irqoff_begin (handler);
 
   /* External interrupts are special.
      We only handle one at a time (so interrupts must be off)
      and they need to be acknowledged on the PIC (see below).
      An external interrupt handler cannot sleep. */
-  external = frame->vec_no >= 0x20 && frame->vec_no < 0x30;
+  external = ((frame->vec_no >= 0x20 && frame->vec_no < 0x30)
+              || lapic_vectors[frame->vec_no]);
   if (external) 
     {
       ASSERT (intr_get_level () == INTR_OFF);
       ASSERT (!intr_context ());
 
       in_external_intr = true;
-      yield_on_return = false;
+      if (!in_deferred_work)
+        yield_on_return = false;
     }
+#ifdef USERPROG
+  if (frame->cs == SEL_UCSEG)
+    thread_charge_user ();
+#endif
+  trace (TRACE_INTR_ENTER, frame->vec_no, 0);
+  start = timer_cycles ();
 
   /* Invoke the interrupt's handler. */
-  handler = intr_handlers[frame->vec_no];
   if (handler != NULL)
     handler (frame);
   else if (frame->vec_no == 0x27 || frame->vec_no == 0x2f)
@@ -374,6 +583,14 @@ intr_handler (struct intr_frame *frame)
   else
     unexpected_interrupt (frame);
 
+  /* Internal handlers may run with interrupts on and be
+     preempted, so update the statistics atomically. */
+  old_level = intr_disable ();
+  intr_cnt[frame->vec_no]++;
+  intr_cycles[frame->vec_no] += timer_cycles () - start;
+  intr_set_level (old_level);
+  trace (TRACE_INTR_EXIT, frame->vec_no, 0);
+
   /* Complete the processing of an external interrupt. */
   if (external) 
     {
@@ -381,11 +598,55 @@ intr_handler (struct intr_frame *frame)
       ASSERT (intr_context ());
 
       in_external_intr = false;
-      pic_end_of_interrupt (frame->vec_no); 
+      if (lapic_vectors[frame->vec_no])
+        lapic_eoi ();
+      else
+        pic_end_of_interrupt (frame->vec_no); 
+
+      if (!in_deferred_work) 
+        {
+          run_deferred_work ();
+          if (yield_on_return) 
+            thread_preempt (); 
+        }
+    }
+
+#ifdef USERPROG
+  /* A thread of a process that is exiting does not go back to
+     user mode. */
+  if (frame->cs == SEL_UCSEG)
+    {
+      process_check_terminated ();
+      thread_charge_kernel ();
+    }
+#endif
 
-      if (yield_on_return) 
-        thread_yield (); 
+  /* Returning turns interrupts back on. */
+  if (intr_trace_off && (frame->eflags & FLAG_IF))
+    irqoff_end ();
+  if (locked)
+    kernel_lock_exit ();
+}
+
+/* Runs deferred work until none is left.  Called at the end of
+   an external interrupt with interrupts off, which it turns on
+   around each piece of work. */
+static void
+run_deferred_work (void) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  in_deferred_work = true;
+  while (!list_empty (&deferred_work))
+    {
+      struct intr_work *w = list_entry (list_pop_front (&deferred_work),
+                                        struct intr_work, elem);
+      w->pending = false;
+      intr_enable ();
+      w->func (w->aux);
+      intr_disable ();
     }
+  in_deferred_work = false;
 }
 
 /* Handles an unexpected interrupt with interrupt frame F.  An
@@ -406,6 +667,98 @@ unexpected_interrupt (const struct intr_frame *f)
     f->vec_no, intr_names[f->vec_no]);
 }
 
+/* Starts an interrupts-off period, blaming CALLER for it.
+   Interrupts must be off. */
+static void
+irqoff_begin (void *caller) 
+{
+  irqoff_start = timer_cycles ();
+  irqoff_caller = caller;
+  irqoff_open = true;
+}
+
+/* Records the interrupts-off period that is ending, if any.
+   Interrupts must still be off. */
+static void
+irqoff_end (void) 
+{
+  uint64_t cycles;
+  int bucket = 0;
+  int i;
+
+  if (!irqoff_open)
+    return;
+  irqoff_open = false;
+  cycles = timer_cycles () - irqoff_start;
+
+  while (bucket < IRQOFF_BUCKETS - 1
+         && cycles >= (uint64_t) 1 << (IRQOFF_MIN_BITS + bucket))
+    bucket++;
+  irqoff_hist[bucket]++;
+  if (cycles > irqoff_max)
+    irqoff_max = cycles;
+
+  /* Find the caller's entry, or failing that the last one, and
+     if this is a new worst for it, move it up into place. */
+  for (i = 0; i < IRQOFF_WORST - 1; i++)
+    if (irqoff_worst[i].caller == irqoff_caller)
+      break;
+  if (irqoff_worst[i].cycles >= cycles)
+    return;
+  for (; i > 0 && irqoff_worst[i - 1].cycles < cycles; i--)
+    irqoff_worst[i] = irqoff_worst[i - 1];
+  irqoff_worst[i].caller = irqoff_caller;
+  irqoff_worst[i].cycles = cycles;
+}
+
+/* Prints, for each interrupt vector that has been handled, how
+   many times it ran and how long its handler took on average,
+   followed by the share of time since boot spent in handlers,
+   and then what interrupts-off tracing recorded. */
+void
+intr_print_stats (void) 
+{
+  int64_t total_ns = 0;
+  int64_t uptime_ns;
+  int vec;
+
+  for (vec = 0; vec < INTR_CNT; vec++)
+    if (intr_cnt[vec] > 0)
+      {
+        int64_t ns = timer_cycles_to_ns (intr_cycles[vec]);
+
+        printf ("Interrupt %#04x (%s): %"PRId64" calls, "
+                "%"PRId64" ns avg\n",
+                vec, intr_names[vec], intr_cnt[vec], ns / intr_cnt[vec]);
+        total_ns += ns;
+      }
+
+  uptime_ns = timer_ns ();
+  if (uptime_ns > 0)
+    printf ("Interrupts: %"PRId64" ms in handlers, %"PRId64".%"PRId64
+            "%% of %"PRId64" ms\n",
+            total_ns / 1000000, total_ns * 100 / uptime_ns,
+            total_ns * 1000 / uptime_ns % 10, uptime_ns / 1000000);
+
+  if (intr_trace_off)
+    {
+      int i;
+
+      printf ("Interrupts off: %"PRId64" ns max, cycles:",
+              timer_cycles_to_ns (irqoff_max));
+      for (i = 0; i < IRQOFF_BUCKETS; i++)
+        if (irqoff_hist[i] != 0)
+          printf (" %s2^%d: %"PRId64, i < IRQOFF_BUCKETS - 1 ? "<" : ">=",
+                  IRQOFF_MIN_BITS + (i < IRQOFF_BUCKETS - 1 ? i : i - 1),
+                  irqoff_hist[i]);
+      printf ("\n");
+      for (i = 0; i < IRQOFF_WORST && irqoff_worst[i].cycles != 0; i++)
+        printf ("Interrupts off: %"PRId64" ns by %p\n",
+                timer_cycles_to_ns (irqoff_worst[i].cycles),
+                irqoff_worst[i].caller);
+    }
+}
+
 /* Dumps interrupt frame F to the console, for debugging. */
 void
 intr_dump_frame (const struct intr_frame *f) 
@@ -1,6 +1,7 @@
 #ifndef THREADS_INTERRUPT_H
 #define THREADS_INTERRUPT_H
 
+#include <list.h>
 #include <stdbool.h>
 #include <stdint.h>
 
@@ -58,12 +59,31 @@ struct intr_frame
 typedef void intr_handler_func (struct intr_frame *);
 
 void intr_init (void);
+void intr_init_ap (void);
 void intr_register_ext (uint8_t vec, intr_handler_func *, const char *name);
+void intr_register_lapic (uint8_t vec, intr_handler_func *, const char *name);
 void intr_register_int (uint8_t vec, int dpl, enum intr_level,
                         intr_handler_func *, const char *name);
+void intr_register_task (uint8_t vec, uint16_t tss_sel, const char *name);
 bool intr_context (void);
 void intr_yield_on_return (void);
 
+/* Work that an external interrupt handler defers until it has
+   returned, to keep the time spent with interrupts off short. */
+typedef void intr_work_func (void *aux);
+struct intr_work
+  {
+    struct list_elem elem;      /* Element in deferred work list. */
+    intr_work_func *func;       /* Function to call. */
+    void *aux;                  /* Argument to FUNC. */
+    bool pending;               /* Deferred and not yet run? */
+  };
+
+void intr_work_init (struct intr_work *, intr_work_func *, void *aux);
+void intr_defer (struct intr_work *);
+
+extern bool intr_trace_off;
+void intr_print_stats (void);
 void intr_dump_frame (const struct intr_frame *);
 const char *intr_name (uint8_t vec);
 
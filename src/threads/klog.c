@@ -0,0 +1,313 @@
+#include "threads/klog.h"
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "devices/timer.h"
+#include "threads/interrupt.h"
+#include "threads/loader.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "threads/workqueue.h"
+
+/* Kernel log.
+
+   With "-klog", klog() appends compact binary records, each a
+   timer tick, a tid, a format and two arguments, to a ring in
+   RAM.  That takes neither the console lock nor any I/O, so it
+   is cheap enough to leave on.  Every KLOG_FLUSH_INTERVAL ticks
+   a worker thread writes the ring's new records, as whole
+   sectors, to a region of 1 + DATA_SECTORS sectors at the end of
+   the scratch device, which is a ring itself.  klog_done() at
+   shutdown and klog_panic() on a kernel panic write what is
+   left, so that the log outlives a crash.  utils/pintos-klog
+   decodes the region from the scratch disk.
+
+   The region's first sector is a header that also holds the
+   format strings, so that the decoder needs nothing but the
+   disk.  Each boot with "-klog" starts a new log, numbered one
+   more than the one before, and takes data sectors that carry
+   another log's number for stale.  Other users of the scratch
+   device, such as "extract" and "snapshot", do not know about
+   the region and must fit below it. */
+
+/* Records in a sector, after the sector's own header. */
+#define RECS_PER_SECTOR 31
+
+/* Sectors of records in the RAM ring and in the disk region. */
+#define RAM_SECTORS 32
+#define DATA_SECTORS 1024
+
+/* Pages in the RAM ring. */
+#define RING_PAGES DIV_ROUND_UP (RAM_SECTORS * BLOCK_SECTOR_SIZE, PGSIZE)
+
+/* Ticks between writes of the ring to disk. */
+#define KLOG_FLUSH_INTERVAL TIMER_FREQ
+
+/* Identifies a log header. */
+#define KLOG_MAGIC 0x474f4c4b           /* "KLOG". */
+
+/* A log record. */
+struct klog_rec
+  {
+    uint32_t tick;              /* timer_ticks(), low 32 bits. */
+    uint16_t tid;               /* Running thread. */
+    uint16_t format;            /* KLOG_*. */
+    uint32_t arg0, arg1;        /* Arguments to the format. */
+  };
+
+/* A sector of records, in the RAM ring and on disk. */
+struct klog_sector
+  {
+    uint32_t boot;              /* Number of the log, on disk. */
+    uint32_t first;             /* Index of RECS[0] in the log. */
+    uint32_t cnt;               /* Number of RECS in use. */
+    uint32_t unused;
+    struct klog_rec recs[RECS_PER_SECTOR];
+  };
+
+/* The first sector of the region. */
+struct klog_header
+  {
+    uint32_t magic;             /* KLOG_MAGIC. */
+    uint32_t boot;              /* Number of the log. */
+    uint32_t rec_cnt;           /* Records logged, as of the header. */
+    uint32_t lost_cnt;          /* Records overwritten before written. */
+    uint32_t timer_freq;        /* Timer ticks per second. */
+    uint16_t data_sectors;      /* Sectors of records after this one. */
+    uint16_t format_cnt;        /* Number of strings in FORMATS. */
+    char formats[488];          /* Format strings, null-terminated. */
+  };
+
+/* Format strings, indexed by KLOG_*. */
+static const char *formats[KLOG_FORMAT_CNT] =
+  {
+    "log started with %u kB RAM",
+    "process exit(%d)",
+    "user process killed by interrupt %#x at eip %#x",
+    "kernel PANIC at line %u, called from %#x",
+    "system call %u (%#x)",
+    "  arguments %#x %#x",
+    "  name bytes %#x %#x",
+    "  returned %d after %u us",
+  };
+
+bool klog_enabled;
+
+/* The RAM ring, or a null pointer before klog_init().  Sector N
+   of the log, holding records N * RECS_PER_SECTOR onward, goes
+   into ring[N % RAM_SECTORS]. */
+static struct klog_sector *ring;
+static uint32_t rec_cnt;        /* Records ever logged. */
+
+/* The scratch device and the region's first sector, or a null
+   pointer if the log stays in RAM. */
+static struct block *device;
+static block_sector_t region;
+
+/* Writing the ring to disk, serialized by FLUSH_LOCK. */
+static struct lock flush_lock;
+static struct klog_header header;
+static struct klog_sector bounce;
+static uint32_t flushed_cnt;    /* Records written as of the header. */
+static uint32_t next_sector;    /* First log sector not yet written whole. */
+
+static struct workqueue klog_wq;
+static struct work flush_work;
+
+static work_func klog_flush_work;
+static bool flush (bool polled);
+
+/* Allocates the RAM ring, if the log is on.  Must be called
+   after palloc_init(). */
+void
+klog_init (void)
+{
+  if (!klog_enabled)
+    return;
+  ring = palloc_get_multiple (PAL_ZERO, RING_PAGES);
+  if (ring == NULL)
+    {
+      printf ("Klog: no memory for %zu-page ring, log disabled.\n",
+              (size_t) RING_PAGES);
+      klog_enabled = false;
+    }
+}
+
+/* Finds the region on the scratch device and starts writing the
+   log there.  Called once the block devices have been located.
+   Without a scratch device, or with one too small, the log
+   stays in RAM. */
+void
+klog_start (void)
+{
+  struct block *scratch = block_get_role (BLOCK_SCRATCH);
+  const char **f;
+  char *p;
+
+  if (!klog_enabled)
+    return;
+  if (scratch == NULL || block_size (scratch) < 1 + DATA_SECTORS)
+    {
+      printf ("Klog: no scratch device of %d sectors, "
+              "log kept in RAM only.\n", 1 + DATA_SECTORS);
+      return;
+    }
+
+  /* Number this log after the one already there, if any. */
+  region = block_size (scratch) - (1 + DATA_SECTORS);
+  block_read (scratch, region, &header);
+  header.boot = header.magic == KLOG_MAGIC ? header.boot + 1 : 1;
+  header.magic = KLOG_MAGIC;
+  header.rec_cnt = header.lost_cnt = 0;
+  header.timer_freq = TIMER_FREQ;
+  header.data_sectors = DATA_SECTORS;
+  header.format_cnt = KLOG_FORMAT_CNT;
+  memset (header.formats, 0, sizeof header.formats);
+  for (p = header.formats, f = formats; f < formats + KLOG_FORMAT_CNT; f++)
+    {
+      size_t len = strlen (*f) + 1;
+      ASSERT (p + len <= header.formats + sizeof header.formats);
+      memcpy (p, *f, len);
+      p += len;
+    }
+  block_write (scratch, region, &header);
+
+  lock_init (&flush_lock);
+  device = scratch;
+  printf ("Klog: log %u in sectors %u-%u of %s.\n", header.boot,
+          region, region + DATA_SECTORS, block_name (scratch));
+  klog (KLOG_START, init_ram_pages * (PGSIZE / 1024), 0);
+
+  workqueue_init (&klog_wq, "klog", 1, PRI_DEFAULT);
+  work_init (&flush_work, klog_flush_work, NULL);
+  work_queue_delayed (&klog_wq, &flush_work, KLOG_FLUSH_INTERVAL);
+}
+
+/* Appends a record in FORMAT with arguments ARG0 and ARG1 to the
+   ring.  Use klog() instead, which checks klog_enabled first.
+   May be called from an interrupt handler. */
+void
+klog_record (enum klog_format format, uint32_t arg0, uint32_t arg1)
+{
+  enum intr_level old_level;
+  struct klog_sector *s;
+  struct klog_rec *r;
+  uint32_t idx;
+
+  ASSERT (format < KLOG_FORMAT_CNT);
+  if (ring == NULL)
+    return;
+
+  old_level = intr_disable ();
+  idx = rec_cnt++;
+  s = &ring[idx / RECS_PER_SECTOR % RAM_SECTORS];
+  if (idx % RECS_PER_SECTOR == 0)
+    {
+      s->first = idx;
+      s->cnt = 0;
+    }
+  r = &s->recs[s->cnt++];
+  r->tick = timer_ticks ();
+  r->tid = thread_current ()->tid;
+  r->format = format;
+  r->arg0 = arg0;
+  r->arg1 = arg1;
+  intr_set_level (old_level);
+}
+
+/* Writes the rest of the log to disk.  Called at shutdown. */
+void
+klog_done (void)
+{
+  if (device == NULL)
+    return;
+  lock_acquire (&flush_lock);
+  flush (false);
+  lock_release (&flush_lock);
+}
+
+/* Writes the rest of the log to disk with interrupts off, if
+   the device is not busy.  Called on a kernel panic, which
+   never returns, so a flush that the panic interrupted does not
+   matter. */
+void
+klog_panic (void)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (device != NULL)
+    flush (true);
+}
+
+/* Writes the log to disk every KLOG_FLUSH_INTERVAL ticks. */
+static void
+klog_flush_work (void *aux UNUSED)
+{
+  lock_acquire (&flush_lock);
+  flush (false);
+  lock_release (&flush_lock);
+  work_queue_delayed (&klog_wq, &flush_work, KLOG_FLUSH_INTERVAL);
+}
+
+/* Writes SECTOR of the region from BUFFER, with
+   block_write_polled() if POLLED is true.  Returns true if
+   successful. */
+static bool
+write_sector (block_sector_t sector, const void *buffer, bool polled)
+{
+  if (polled)
+    return block_write_polled (device, region + sector, 1, buffer);
+  block_write (device, region + sector, buffer);
+  return true;
+}
+
+/* Writes the sectors of the ring with records not yet on disk,
+   and then the header, using block_write_polled() if POLLED is
+   true.  A sector that is not full yet is written again the
+   next time.  Returns false if a write fails. */
+static bool
+flush (bool polled)
+{
+  enum intr_level old_level;
+  uint32_t cnt, last, n;
+
+  old_level = intr_disable ();
+  cnt = rec_cnt;
+  intr_set_level (old_level);
+  if (cnt == flushed_cnt)
+    return true;
+
+  /* Sectors the ring has already overwritten are lost. */
+  last = (cnt - 1) / RECS_PER_SECTOR;
+  if (last - next_sector >= RAM_SECTORS)
+    {
+      uint32_t skip = last - RAM_SECTORS + 1 - next_sector;
+      header.lost_cnt += skip * RECS_PER_SECTOR;
+      next_sector += skip;
+    }
+
+  for (n = next_sector; n <= last; n++)
+    {
+      old_level = intr_disable ();
+      bounce = ring[n % RAM_SECTORS];
+      intr_set_level (old_level);
+      if (bounce.first != n * RECS_PER_SECTOR || bounce.cnt == 0)
+        {
+          /* Overwritten while we were writing. */
+          header.lost_cnt += RECS_PER_SECTOR;
+          continue;
+        }
+      bounce.boot = header.boot;
+      if (!write_sector (1 + n % DATA_SECTORS, &bounce, polled))
+        return false;
+    }
+  next_sector = cnt / RECS_PER_SECTOR;
+  flushed_cnt = cnt;
+
+  header.rec_cnt = cnt;
+  return write_sector (0, &header, polled);
+}
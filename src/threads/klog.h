@@ -0,0 +1,41 @@
+#ifndef THREADS_KLOG_H
+#define THREADS_KLOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Formats of kernel log records.  The format strings, which
+   take the record's two arguments, are in klog.c. */
+enum klog_format
+  {
+    KLOG_START,                 /* klog_start(): kB of RAM. */
+    KLOG_PROCESS_EXIT,          /* process_exit(): exit code. */
+    KLOG_USER_FAULT,            /* kill(): vector, user EIP. */
+    KLOG_PANIC,                 /* debug_panic(): line, caller. */
+    KLOG_SYSCALL,               /* System call: number, 1st argument. */
+    KLOG_SYSCALL_ARGS,          /* Its next two arguments. */
+    KLOG_SYSCALL_NAME,          /* 8 bytes of the file name it takes. */
+    KLOG_SYSCALL_DONE,          /* Its return value, microseconds. */
+    KLOG_FORMAT_CNT
+  };
+
+/* True if the kernel log is on. */
+extern bool klog_enabled;
+
+void klog_init (void);
+void klog_start (void);
+void klog_record (enum klog_format, uint32_t arg0, uint32_t arg1);
+void klog_done (void);
+void klog_panic (void);
+
+/* Logs a record in FORMAT with arguments ARG0 and ARG1 if the
+   kernel log is on.  Costs only a test and a branch when it is
+   not. */
+static inline void
+klog (enum klog_format format, uint32_t arg0, uint32_t arg1)
+{
+  if (klog_enabled)
+    klog_record (format, arg0, arg1);
+}
+
+#endif /* threads/klog.h */
@@ -8,6 +8,11 @@
 /* Physical address of kernel base. */
 #define LOADER_KERN_BASE 0x20000       /* 128 kB. */
 
+/* Physical address to which cpu.c copies ap-start.S, where the
+   application processors start.  Must be page-aligned and below
+   1 MB, and nothing else may use the page once they start. */
+#define LOADER_AP_START 0x1000         /* 4 kB. */
+
 /* Kernel virtual address at which all physical memory is mapped.
    Must be aligned on a 4 MB boundary. */
 #define LOADER_PHYS_BASE 0xc0000000     /* 3 GB. */
@@ -24,6 +29,14 @@
 #define LOADER_ARGS_LEN 128
 #define LOADER_ARG_CNT_LEN 4
 
+/* Most entries of the BIOS memory map that start.S saves, and
+   the size of each. */
+#define LOADER_MEM_MAP_MAX 32
+#define LOADER_MEM_MAP_ENTRY_LEN 20
+
+/* Type of a BIOS memory map entry for RAM that is free to use. */
+#define LOADER_MEM_USABLE 1
+
 /* GDT selectors defined by loader.
    More selectors are defined by userprog/gdt.h. */
 #define SEL_NULL        0x00    /* Null selector. */
@@ -35,6 +48,24 @@
 
 /* Amount of physical memory, in 4 kB pages. */
 extern uint32_t init_ram_pages;
+
+/* An entry in the BIOS memory map, as returned by interrupt 15h
+   function e820h.  Physical memory outside every entry of type
+   LOADER_MEM_USABLE, such as the hole below 1 MB for the video
+   memory and BIOS or memory reserved for ACPI, must not be used
+   as RAM. */
+struct mem_map_entry
+  {
+    uint64_t base;              /* Physical base address. */
+    uint64_t length;            /* Length in bytes. */
+    uint32_t type;              /* LOADER_MEM_USABLE or another type. */
+  }
+__attribute__ ((packed));
+
+/* BIOS memory map saved by start.S, and its number of entries,
+   which is 0 if the BIOS did not provide one. */
+extern struct mem_map_entry init_mem_map[LOADER_MEM_MAP_MAX];
+extern uint32_t init_mem_map_cnt;
 #endif
 
 #endif /* threads/loader.h */
@@ -5,9 +5,12 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/cpu.h"
+#include "threads/interrupt.h"
 #include "threads/palloc.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
+#include "threads/vmalloc.h"
 
 /* A simple implementation of malloc().
 
@@ -32,7 +35,37 @@
    because they're too big to fit in a single page with a
    descriptor.  We handle those by allocating contiguous pages
    with the page allocator and sticking the allocation size at
-   the beginning of the allocated block's arena header. */
+   the beginning of the allocated block's arena header.  If no
+   run of physically contiguous pages is free, the pages come
+   from vmalloc() instead, which only needs them to be
+   contiguous in virtual memory.
+
+   Taking the descriptor's lock for every block would make it the
+   cost of most calls, so each descriptor also keeps, for each
+   CPU, a "magazine": a small stack of free blocks that the CPU
+   pushes and pops with just interrupts disabled.  When the
+   magazine is empty, malloc() refills half of it from the free
+   list under the lock, and when it is full, free() drains half
+   of it back the same way.  A block in a magazine is still in
+   use as far as its arena is concerned, so an arena is freed
+   only once its blocks have all left the magazines.  When memory
+   runs low, the page allocator has the magazines drained (see
+   shrink_magazines()). */
+
+/* Blocks in a magazine: enough to fill a cache line. */
+#define MAGAZINE_SIZE 15
+
+/* Blocks moved at a time between a magazine and a free list. */
+#define MAGAZINE_BATCH (MAGAZINE_SIZE / 2)
+
+/* Magazine: one CPU's stack of free blocks of one size, in a
+   cache line of its own. */
+struct magazine
+  {
+    size_t cnt;                         /* Number of blocks. */
+    struct block *blocks[MAGAZINE_SIZE]; /* Blocks, most recent last. */
+  }
+__attribute__ ((aligned (CACHE_LINE_SIZE)));
 
 /* Descriptor. */
 struct desc
@@ -41,6 +74,11 @@ struct desc
     size_t blocks_per_arena;    /* Number of blocks in an arena. */
     struct list free_list;      /* List of free blocks. */
     struct lock lock;           /* Lock. */
+    char name[16];              /* Name of LOCK, e.g. "malloc 16". */
+    struct magazine *magazines; /* Free blocks, CPU_MAX of them. */
+    size_t free_cnt;            /* Number of blocks in FREE_LIST. */
+    size_t arena_cnt;           /* Number of arenas. */
+    size_t peak_arena_cnt;      /* Most arenas at once. */
   };
 
 /* Magic number for detecting arena corruption. */
@@ -64,24 +102,53 @@ struct block
 static struct desc descs[10];   /* Descriptors. */
 static size_t desc_cnt;         /* Number of descriptors. */
 
+/* Big blocks in use and their pages.  Updated with interrupts
+   off. */
+static size_t big_cnt, big_page_cnt;
+static size_t peak_big_page_cnt;
+
+/* Drains the magazines when memory runs low. */
+static struct shrinker magazine_shrinker;
+
 static struct arena *block_to_arena (struct block *);
 static struct block *arena_to_block (struct arena *, size_t idx);
+static bool release_block (struct desc *, struct block *);
+static size_t drain_magazine (struct desc *, size_t cnt);
+static bool resize_big_block (struct arena *, size_t size);
+static void count_big_pages (long page_cnt, int block_cnt);
+static shrink_func shrink_magazines;
 
 /* Initializes the malloc() descriptors. */
 void
 malloc_init (void) 
 {
+  size_t desc_max = sizeof descs / sizeof *descs;
+  size_t mag_pages = DIV_ROUND_UP (desc_max * CPU_MAX
+                                   * sizeof (struct magazine), PGSIZE);
+  struct magazine *magazines;
   size_t block_size;
 
+  /* The magazines would take a lot of the kernel image's BSS,
+     so they come from the page allocator instead. */
+  magazines = palloc_get_multiple (PAL_ASSERT | PAL_ZERO, mag_pages);
+
   for (block_size = 16; block_size < PGSIZE / 2; block_size *= 2)
     {
       struct desc *d = &descs[desc_cnt++];
-      ASSERT (desc_cnt <= sizeof descs / sizeof *descs);
+      ASSERT (desc_cnt <= desc_max);
+      d->magazines = magazines + (desc_cnt - 1) * CPU_MAX;
       d->block_size = block_size;
       d->blocks_per_arena = (PGSIZE - sizeof (struct arena)) / block_size;
       list_init (&d->free_list);
+      d->free_cnt = 0;
+      d->arena_cnt = 0;
+      d->peak_arena_cnt = 0;
       lock_init (&d->lock);
+      snprintf (d->name, sizeof d->name, "malloc %zu", block_size);
+      lock_set_name (&d->lock, d->name);
     }
+  palloc_register_shrinker (&magazine_shrinker, "malloc magazines",
+                            shrink_magazines);
 }
 
 /* Obtains and returns a new block of at least SIZE bytes.
@@ -92,6 +159,8 @@ malloc (size_t size)
   struct desc *d;
   struct block *b;
   struct arena *a;
+  struct magazine *m;
+  enum intr_level old_level;
 
   /* A null pointer satisfies a request for 0 bytes. */
   if (size == 0)
@@ -108,6 +177,8 @@ malloc (size_t size)
          Allocate enough pages to hold SIZE plus an arena. */
       size_t page_cnt = DIV_ROUND_UP (size + sizeof *a, PGSIZE);
       a = palloc_get_multiple (0, page_cnt);
+      if (a == NULL)
+        a = vmalloc (page_cnt * PGSIZE);
       if (a == NULL)
         return NULL;
 
@@ -116,9 +187,21 @@ malloc (size_t size)
       a->magic = ARENA_MAGIC;
       a->desc = NULL;
       a->free_cnt = page_cnt;
+      count_big_pages (page_cnt, 1);
       return a + 1;
     }
 
+  /* Take a block from this CPU's magazine, if it has one. */
+  old_level = intr_disable ();
+  m = &d->magazines[cpu_id ()];
+  if (m->cnt > 0)
+    {
+      b = m->blocks[--m->cnt];
+      intr_set_level (old_level);
+      return b;
+    }
+  intr_set_level (old_level);
+
   lock_acquire (&d->lock);
 
   /* If the free list is empty, create a new arena. */
@@ -126,13 +209,14 @@ malloc (size_t size)
     {
       size_t i;
 
-      /* Allocate a page. */
+      /* Allocate a page.  The page allocator may reclaim memory
+         from caches that free blocks of this size, so do not
+         hold D's lock meanwhile. */
+      lock_release (&d->lock);
       a = palloc_get_page (0);
       if (a == NULL) 
-        {
-          lock_release (&d->lock);
-          return NULL; 
-        }
+        return NULL; 
+      lock_acquire (&d->lock);
 
       /* Initialize arena and add its blocks to the free list. */
       a->magic = ARENA_MAGIC;
@@ -143,12 +227,28 @@ malloc (size_t size)
           struct block *b = arena_to_block (a, i);
           list_push_back (&d->free_list, &b->free_elem);
         }
+      d->free_cnt += d->blocks_per_arena;
+      if (++d->arena_cnt > d->peak_arena_cnt)
+        d->peak_arena_cnt = d->arena_cnt;
     }
 
-  /* Get a block from free list and return it. */
-  b = list_entry (list_pop_front (&d->free_list), struct block, free_elem);
-  a = block_to_arena (b);
-  a->free_cnt--;
+  /* Get a block from free list to return, and refill the
+     magazine with up to a batch more. */
+  old_level = intr_disable ();
+  m = &d->magazines[cpu_id ()];
+  do
+    {
+      b = list_entry (list_pop_front (&d->free_list),
+                      struct block, free_elem);
+      a = block_to_arena (b);
+      a->free_cnt--;
+      d->free_cnt--;
+      if (list_empty (&d->free_list) || m->cnt >= MAGAZINE_BATCH)
+        break;
+      m->blocks[m->cnt++] = b;
+    }
+  while (true);
+  intr_set_level (old_level);
   lock_release (&d->lock);
   return b;
 }
@@ -190,7 +290,13 @@ block_size (void *block)
    If successful, returns the new block; on failure, returns a
    null pointer.
    A call with null OLD_BLOCK is equivalent to malloc(NEW_SIZE).
-   A call with zero NEW_SIZE is equivalent to free(OLD_BLOCK). */
+   A call with zero NEW_SIZE is equivalent to free(OLD_BLOCK).
+
+   OLD_BLOCK stays where it is if NEW_SIZE is in its descriptor's
+   size class, or if it is a big block and NEW_SIZE is also too
+   big for any descriptor and its pages can be trimmed or the
+   pages following them taken.  A shrinking block that cannot be
+   moved stays where it is, too. */
 void *
 realloc (void *old_block, size_t new_size) 
 {
@@ -199,20 +305,65 @@ realloc (void *old_block, size_t new_size)
       free (old_block);
       return NULL;
     }
+  else if (old_block == NULL)
+    return malloc (new_size);
   else 
     {
-      void *new_block = malloc (new_size);
-      if (old_block != NULL && new_block != NULL)
-        {
-          size_t old_size = block_size (old_block);
-          size_t min_size = new_size < old_size ? new_size : old_size;
-          memcpy (new_block, old_block, min_size);
-          free (old_block);
-        }
+      struct arena *a = block_to_arena (old_block);
+      struct desc *d = a->desc;
+      size_t old_size = block_size (old_block);
+      void *new_block;
+
+      if (d != NULL
+          ? new_size <= d->block_size
+            && (d == descs || new_size > d[-1].block_size)
+          : new_size > descs[desc_cnt - 1].block_size
+            && resize_big_block (a, new_size))
+        return old_block;
+
+      new_block = malloc (new_size);
+      if (new_block == NULL)
+        return new_size <= old_size ? old_block : NULL;
+      memcpy (new_block, old_block,
+              new_size < old_size ? new_size : old_size);
+      free (old_block);
       return new_block;
     }
 }
 
+/* Tries to resize big block arena A, without moving it, to hold
+   SIZE bytes.  Returns true if successful. */
+static bool
+resize_big_block (struct arena *a, size_t size) 
+{
+  size_t page_cnt = DIV_ROUND_UP (size + sizeof *a, PGSIZE);
+
+  if (page_cnt == a->free_cnt)
+    return true;
+  else if (is_vmalloc_addr (a))
+    {
+      /* vfree() releases as much of the window as is still
+         mapped, so keep all of the pages of a shrinking block. */
+      return page_cnt < a->free_cnt;
+    }
+  else if (page_cnt < a->free_cnt)
+    {
+      palloc_free_multiple ((uint8_t *) a + page_cnt * PGSIZE,
+                            a->free_cnt - page_cnt);
+      count_big_pages ((long) page_cnt - (long) a->free_cnt, 0);
+      a->free_cnt = page_cnt;
+      return true;
+    }
+  else if (palloc_extend (a, a->free_cnt, page_cnt))
+    {
+      count_big_pages ((long) page_cnt - (long) a->free_cnt, 0);
+      a->free_cnt = page_cnt;
+      return true;
+    }
+  else
+    return false;
+}
+
 /* Frees block P, which must have been previously allocated with
    malloc(), calloc(), or realloc(). */
 void
@@ -227,42 +378,167 @@ free (void *p)
       if (d != NULL) 
         {
           /* It's a normal block.  We handle it here. */
+          struct magazine *m;
+          enum intr_level old_level;
 
 #ifndef NDEBUG
           /* Clear the block to help detect use-after-free bugs. */
           memset (b, 0xcc, d->block_size);
 #endif
-  
-          lock_acquire (&d->lock);
 
-          /* Add block to free list. */
-          list_push_front (&d->free_list, &b->free_elem);
-
-          /* If the arena is now entirely unused, free it. */
-          if (++a->free_cnt >= d->blocks_per_arena) 
+          /* Push the block on this CPU's magazine, draining half
+             of the magazine first if it is full. */
+          old_level = intr_disable ();
+          m = &d->magazines[cpu_id ()];
+          if (m->cnt < MAGAZINE_SIZE)
             {
-              size_t i;
-
-              ASSERT (a->free_cnt == d->blocks_per_arena);
-              for (i = 0; i < d->blocks_per_arena; i++) 
-                {
-                  struct block *b = arena_to_block (a, i);
-                  list_remove (&b->free_elem);
-                }
-              palloc_free_page (a);
+              m->blocks[m->cnt++] = b;
+              intr_set_level (old_level);
+              return;
             }
+          intr_set_level (old_level);
 
+          lock_acquire (&d->lock);
+          drain_magazine (d, MAGAZINE_BATCH);
+          release_block (d, b);
           lock_release (&d->lock);
         }
       else
         {
           /* It's a big block.  Free its pages. */
-          palloc_free_multiple (a, a->free_cnt);
+          count_big_pages (-(long) a->free_cnt, -1);
+          if (is_vmalloc_addr (a))
+            vfree (a);
+          else
+            palloc_free_multiple (a, a->free_cnt);
           return;
         }
     }
 }
 
+/* Returns block B to D's free list, freeing B's arena if none
+   of its blocks is in use any longer.  Returns true if the arena
+   was freed.  D's lock must be held. */
+static bool
+release_block (struct desc *d, struct block *b)
+{
+  struct arena *a = block_to_arena (b);
+
+  ASSERT (lock_held_by_current_thread (&d->lock));
+
+  /* Add block to free list. */
+  list_push_front (&d->free_list, &b->free_elem);
+  d->free_cnt++;
+
+  /* If the arena is now entirely unused, free it. */
+  if (++a->free_cnt >= d->blocks_per_arena) 
+    {
+      size_t i;
+
+      ASSERT (a->free_cnt == d->blocks_per_arena);
+      for (i = 0; i < d->blocks_per_arena; i++) 
+        {
+          struct block *b = arena_to_block (a, i);
+          list_remove (&b->free_elem);
+        }
+      d->free_cnt -= d->blocks_per_arena;
+      d->arena_cnt--;
+      palloc_free_page (a);
+      return true;
+    }
+  return false;
+}
+
+/* Moves the CNT least recently freed blocks of this CPU's
+   magazine for D, or all of them if it has fewer, to D's free
+   list.  Returns the number of arenas freed as a result.  D's
+   lock must be held. */
+static size_t
+drain_magazine (struct desc *d, size_t cnt)
+{
+  struct block *blocks[MAGAZINE_SIZE];
+  struct magazine *m;
+  enum intr_level old_level;
+  size_t freed = 0;
+  size_t i;
+
+  old_level = intr_disable ();
+  m = &d->magazines[cpu_id ()];
+  if (cnt > m->cnt)
+    cnt = m->cnt;
+  memcpy (blocks, m->blocks, cnt * sizeof *blocks);
+  m->cnt -= cnt;
+  memmove (m->blocks, m->blocks + cnt, m->cnt * sizeof *m->blocks);
+  intr_set_level (old_level);
+
+  for (i = 0; i < cnt; i++)
+    if (release_block (d, blocks[i]))
+      freed++;
+  return freed;
+}
+
+/* Drains this CPU's magazines, for the page allocator, until
+   PAGE_CNT arenas have been freed.  Returns the number freed.
+   Skips a descriptor whose lock is busy. */
+static size_t
+shrink_magazines (size_t page_cnt)
+{
+  size_t freed = 0;
+  struct desc *d;
+
+  for (d = descs; d < descs + desc_cnt && freed < page_cnt; d++)
+    if (!lock_held_by_current_thread (&d->lock)
+        && lock_try_acquire (&d->lock))
+      {
+        freed += drain_magazine (d, MAGAZINE_SIZE);
+        lock_release (&d->lock);
+      }
+  return freed;
+}
+
+/* Adds PAGE_CNT pages and BLOCK_CNT blocks, either of which may
+   be negative, to the big block counts. */
+static void
+count_big_pages (long page_cnt, int block_cnt)
+{
+  enum intr_level old_level = intr_disable ();
+
+  big_cnt += block_cnt;
+  big_page_cnt += page_cnt;
+  if (big_page_cnt > peak_big_page_cnt)
+    peak_big_page_cnt = big_page_cnt;
+  intr_set_level (old_level);
+}
+
+/* Prints, for each block size in use or once used, the blocks
+   in use, in magazines, and free, and the arenas holding them,
+   then the big blocks and their pages.  The counts are read
+   without locking, so they may be slightly inconsistent. */
+void
+malloc_print_stats (void)
+{
+  struct desc *d;
+
+  for (d = descs; d < descs + desc_cnt; d++)
+    if (d->peak_arena_cnt > 0)
+      {
+        size_t mag_cnt = 0;
+        size_t total_cnt = d->arena_cnt * d->blocks_per_arena;
+        size_t used_cnt;
+        int i;
+
+        for (i = 0; i < CPU_MAX; i++)
+          mag_cnt += d->magazines[i].cnt;
+        used_cnt = total_cnt - d->free_cnt - mag_cnt;
+        printf ("Malloc: %zu-byte blocks: %zu in use (%zu bytes), "
+                "%zu in magazines, %zu free; %zu arenas, %zu peak\n",
+                d->block_size, used_cnt, used_cnt * d->block_size,
+                mag_cnt, d->free_cnt, d->arena_cnt, d->peak_arena_cnt);
+      }
+  printf ("Malloc: %zu big blocks in use, %zu pages, %zu peak pages\n",
+          big_cnt, big_page_cnt, peak_big_page_cnt);
+}
+
 /* Returns the arena that block B is inside. */
 static struct arena *
 block_to_arena (struct block *b)
@@ -2,13 +2,16 @@
 #include <bitmap.h>
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/interrupt.h"
 #include "threads/loader.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
 
 /* Page allocator.  Hands out memory in page-size (or
@@ -22,26 +25,168 @@
    even if user processes are swapping like mad.
 
    By default, half of system RAM is given to the kernel pool and
-   half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   half to the user pool, but the split moves with demand: a pool
+   that cannot satisfy an allocation borrows a "chunk" of
+   CHUNK_PAGES free pages (or a larger block, for a larger
+   allocation) from the other pool, which lends it only if it
+   keeps LEND_WATERMARK pages free.  A pool gives borrowed chunks
+   back once they are free and at least RETURN_WATERMARK of its
+   pages would still be free.  So a VM-heavy workload can use the
+   kernel's idle pages for frames, and a file system workload the
+   user pool's for its caches, while each pool keeps a reserve.
+
+   Each pool is managed by a binary buddy allocator.  Free pages
+   are kept in blocks of 2**ORDER pages whose index is a multiple
+   of 2**ORDER, with one free list per order.  A request for
+   PAGE_CNT pages takes a block of the smallest sufficient order,
+   splitting larger blocks as needed, and gives back the pages
+   beyond PAGE_CNT.  Freeing merges a block with its "buddy" (the
+   other half of the enclosing block of the next order) for as
+   long as the buddy is a free block of the same pool.  A free
+   list element is stored in the first page of each free block,
+   and the order of each free block is recorded in ORDERS, one
+   byte per page.
+
+   Both pools index the same range of pages, so that a chunk can
+   move between them without renumbering, and USER_MAP records
+   which pool each page currently belongs to.  The pools' own
+   ranges, and therefore all chunks, start at multiples of
+   CHUNK_PAGES, so no word of USED_MAP or USER_MAP spans pages of
+   both pools and each pool's lock protects its pages' bits.
+   Moving a chunk requires both locks.
+
+   Kernel caches that can give memory back, such as the slab
+   allocator's spare slabs and the file system's recently closed
+   inodes and directories, register a "shrinker".  When the kernel
+   pool cannot satisfy an allocation even by borrowing, the
+   shrinkers are asked, in order of registration, to free the
+   pages that are missing, and the allocation is retried before
+   it fails.  An allocation that leaves fewer than
+   RECLAIM_WATERMARK free pages in the kernel pool also runs them,
+   so that memory is reclaimed before it is exhausted rather than
+   after.  Register the caches whose memory is cheapest to
+   rebuild first.  User pages are not reclaimed here; the VM
+   system evicts frames for them instead.
+
+   Zeroing a page for PAL_ZERO costs more than allocating it, and
+   it falls on the allocating thread, often in the middle of
+   creating a thread or handling a page fault.  So a page-zeroer
+   thread of the lowest priority, which runs only when nothing
+   else wants the CPU, keeps up to ZEROED_MAX free single pages
+   of each pool zeroed, on the pool's ZEROED list, and PAL_ZERO
+   allocations of a single page take one from there.  The pages
+   on ZEROED are out of the buddy allocator, but still counted as
+   free, and any allocation takes them when nothing else is left.
+   The zeroer is woken when an allocation leaves fewer than half
+   of ZEROED_MAX. */
+
+/* Largest block order: 2**20 pages is 4 GB. */
+#define MAX_ORDER 20
+
+/* ORDERS value for a page that does not start a free block. */
+#define NOT_FREE 0xff
+
+/* Free kernel pages below which allocation reclaims memory. */
+#define RECLAIM_WATERMARK 16
+
+/* Unit in which the pools lend pages to each other.  Must be at
+   least the number of bits in a bitmap word. */
+#define CHUNK_ORDER 6
+#define CHUNK_PAGES ((size_t) 1 << CHUNK_ORDER)
+
+/* A pool lends pages only if this many of its pages stay free. */
+#define LEND_WATERMARK (2 * CHUNK_PAGES)
+
+/* A pool gives a borrowed chunk back only if this many of its
+   pages stay free. */
+#define RETURN_WATERMARK (3 * CHUNK_PAGES)
+
+/* Most pages of each pool kept zeroed ahead of time. */
+#define ZEROED_MAX 32
 
 /* A memory pool. */
 struct pool
   {
-    struct lock lock;                   /* Mutual exclusion. */
-    struct bitmap *used_map;            /* Bitmap of free pages. */
-    uint8_t *base;                      /* Base of pool. */
+    struct fastlock lock;               /* Mutual exclusion. */
+    struct list free_lists[MAX_ORDER + 1]; /* Free blocks by order. */
+    size_t start, end;                  /* Pool's own pages. */
+    size_t page_cnt;                    /* Pages in pool now. */
+    size_t free_cnt;                    /* Number of free pages. */
+    size_t peak_cnt;                    /* Most pages ever in use. */
+    size_t max_cnt;                     /* Most pages pool may have. */
+    size_t borrowed;                    /* Pages not its own. */
+    struct list zeroed;                 /* Free pages already zeroed. */
+    size_t zeroed_cnt;                  /* Number of pages in ZEROED. */
+    bool zeroer_idle;                   /* Zeroer waiting for work? */
+    unsigned long long borrow_cnt;      /* Blocks borrowed. */
+    unsigned long long return_cnt;      /* Chunks given back. */
+    unsigned long long zero_hit_cnt;    /* PAL_ZERO pages from ZEROED. */
+    unsigned long long zero_miss_cnt;   /* PAL_ZERO pages zeroed inline. */
   };
 
+/* Physical memory that start.S maps for the kernel, before
+   paging_init() maps the rest. */
+#define EARLY_MAP_LIMIT (64 * 1024 * 1024)
+
 /* Two pools: one for kernel data, one for user pages. */
 static struct pool kernel_pool, user_pool;
 
-static void init_pool (struct pool *, void *base, size_t page_cnt,
-                       const char *name);
-static bool page_from_pool (const struct pool *, void *page);
+/* State shared by the pools.  A page's bits and ORDERS byte are
+   protected by the lock of the pool that it belongs to. */
+static uint8_t *base;                   /* First page of either pool. */
+static size_t total_cnt;                /* Pages in both pools. */
+static struct bitmap *used_map;         /* Pages in use. */
+static struct bitmap *user_map;         /* Pages of the user pool. */
+static uint8_t *orders;                 /* Order of each free block. */
+static size_t early_cnt;                /* Pages freed by palloc_init(). */
+
+/* Registered shrinkers, in the order they are asked to free
+   memory, and the lock that protects the list.  The thread that
+   holds RECLAIM_LOCK is the one reclaiming. */
+static struct list shrinkers = LIST_INITIALIZER (shrinkers);
+static struct lock reclaim_lock;
+
+/* Statistics. */
+static unsigned long long reclaim_cnt;  /* Times the shrinkers ran. */
+static unsigned long long retry_cnt;    /* Failed allocations retried. */
+static unsigned long long rescue_cnt;   /* Retries that succeeded. */
+
+/* The page-zeroer thread sleeps on this while no pool has work
+   for it. */
+static struct semaphore zeroer_sema;
+
+static void init_pool (struct pool *, size_t start, size_t end,
+                       size_t max_cnt, const char *name);
+static void add_ram (size_t start, size_t end);
+static bool page_usable (size_t page_idx);
+static struct pool *page_pool (size_t page_idx);
+static struct list_elem *page_elem (size_t page_idx);
+static size_t elem_page (struct list_elem *);
+static size_t buddy_alloc (struct pool *, size_t page_cnt);
+static void buddy_free (struct pool *, size_t page_idx, size_t page_cnt);
+static void buddy_free_block (struct pool *, size_t page_idx, int order);
+static void buddy_take (struct pool *, size_t page_idx, size_t page_cnt);
+static int order_for (size_t page_cnt);
+static void lock_pools (void);
+static void unlock_pools (void);
+static size_t foreign_pages (const struct pool *, size_t page_idx,
+                             size_t page_cnt);
+static void move_block (struct pool *from, struct pool *to,
+                        size_t page_idx, int order);
+static void *take_pages (struct pool *, size_t page_cnt,
+                         enum palloc_flags);
+static bool zero_page (struct pool *);
+static void flush_zeroed (struct pool *);
+static thread_func zeroer NO_RETURN;
+static bool borrow (struct pool *, size_t page_cnt);
+static void give_back (struct pool *);
+static void note_usage (struct pool *);
+static void print_pool_stats (const struct pool *, const char *name);
+static size_t reclaim (size_t page_cnt);
 
 /* Initializes the page allocator.  At most USER_PAGE_LIMIT
-   pages are put into the user pool. */
+   pages are put into the user pool, to begin with or by
+   borrowing. */
 void
 palloc_init (size_t user_page_limit)
 {
@@ -49,16 +194,83 @@ palloc_init (size_t user_page_limit)
   uint8_t *free_start = ptov (1024 * 1024);
   uint8_t *free_end = ptov (init_ram_pages * PGSIZE);
   size_t free_pages = (free_end - free_start) / PGSIZE;
-  size_t user_pages = free_pages / 2;
-  size_t kernel_pages;
-  if (user_pages > user_page_limit)
-    user_pages = user_page_limit;
-  kernel_pages = free_pages - user_pages;
+  size_t bm_size, meta_pages, user_start;
+
+  /* We'll put the bitmaps and orders array at the start of free
+     memory.  Calculate the space needed for them and subtract it
+     from the pages available.  (This slightly overestimates,
+     since they are sized for the pages they occupy too.) */
+  bm_size = bitmap_buf_size (free_pages);
+  meta_pages = DIV_ROUND_UP (2 * bm_size + free_pages, PGSIZE);
+  if (meta_pages > free_pages)
+    PANIC ("Not enough memory for page allocator bitmaps.");
+  total_cnt = free_pages - meta_pages;
+  base = free_start + meta_pages * PGSIZE;
+  used_map = bitmap_create_in_buf (total_cnt, free_start, bm_size);
+  user_map = bitmap_create_in_buf (total_cnt, free_start + bm_size, bm_size);
+  orders = free_start + 2 * bm_size;
+  memset (orders, NOT_FREE, total_cnt);
+  bitmap_set_all (used_map, true);
+
+  /* Give half of memory to kernel, half to user, splitting at a
+     chunk boundary. */
+  user_start = total_cnt - total_cnt / 2;
+  if (total_cnt - user_start > user_page_limit)
+    user_start = total_cnt - user_page_limit;
+  user_start = ROUND_UP (user_start, CHUNK_PAGES);
+  if (user_start > total_cnt)
+    user_start = total_cnt;
+  bitmap_set_multiple (user_map, user_start, total_cnt - user_start, true);
+
+  init_pool (&kernel_pool, 0, user_start, SIZE_MAX, "kernel pool");
+  init_pool (&user_pool, user_start, total_cnt,
+             user_page_limit, "user pool");
+  lock_init (&reclaim_lock);
+  sema_init (&zeroer_sema, 0);
 
-  /* Give half of memory to kernel, half to user. */
-  init_pool (&kernel_pool, free_start, kernel_pages, "kernel pool");
-  init_pool (&user_pool, free_start + kernel_pages * PGSIZE,
-             user_pages, "user pool");
+  /* A free page holds its free list element, so only the pages
+     that start.S mapped can be freed before paging_init(). */
+  early_cnt = pg_no (ptov (EARLY_MAP_LIMIT)) - pg_no (base);
+  if (early_cnt > total_cnt)
+    early_cnt = total_cnt;
+  add_ram (0, early_cnt);
+}
+
+/* Frees the pages beyond those that start.S mapped.  Must be
+   called once paging_init() has mapped all of RAM. */
+void
+palloc_add_ram (void)
+{
+  add_ram (early_cnt, total_cnt);
+  printf ("%zu pages available in kernel pool.\n", kernel_pool.free_cnt);
+  printf ("%zu pages available in user pool.\n", user_pool.free_cnt);
+}
+
+/* Starts the thread that zeroes free pages ahead of PAL_ZERO
+   allocations.  Must be called after thread_start(). */
+void
+palloc_start_zeroer (void)
+{
+  thread_create ("page-zeroer", PRI_MIN, zeroer, NULL);
+}
+
+/* Registers S, named NAME, to free memory by calling SHRINK when
+   the kernel pool runs low.  S is asked after every shrinker
+   registered before it. */
+void
+palloc_register_shrinker (struct shrinker *s, const char *name,
+                          shrink_func *shrink)
+{
+  ASSERT (s != NULL);
+  ASSERT (shrink != NULL);
+
+  s->name = name;
+  s->shrink = shrink;
+  s->call_cnt = 0;
+  s->page_cnt = 0;
+  lock_acquire (&reclaim_lock);
+  list_push_back (&shrinkers, &s->elem);
+  lock_release (&reclaim_lock);
 }
 
 /* Obtains and returns a group of PAGE_CNT contiguous free pages.
@@ -72,31 +284,34 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
 {
   struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
   void *pages;
-  size_t page_idx;
 
   if (page_cnt == 0)
     return NULL;
 
-  lock_acquire (&pool->lock);
-  page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-  lock_release (&pool->lock);
-
-  if (page_idx != BITMAP_ERROR)
-    pages = pool->base + PGSIZE * page_idx;
-  else
-    pages = NULL;
-
-  if (pages != NULL) 
+  pages = take_pages (pool, page_cnt, flags);
+  if (pages == NULL && borrow (pool, page_cnt))
+    pages = take_pages (pool, page_cnt, flags);
+  if (pool == &kernel_pool)
     {
-      if (flags & PAL_ZERO)
-        memset (pages, 0, PGSIZE * page_cnt);
-    }
-  else 
-    {
-      if (flags & PAL_ASSERT)
-        PANIC ("palloc_get: out of pages");
+      if (pages == NULL)
+        {
+          /* Even if fewer than PAGE_CNT pages were freed, they may
+             merge with free neighbors into a large enough block. */
+          if (reclaim (page_cnt) > 0)
+            {
+              retry_cnt++;
+              pages = take_pages (pool, page_cnt, flags);
+              if (pages != NULL)
+                rescue_cnt++;
+            }
+        }
+      else if (pool->free_cnt < RECLAIM_WATERMARK)
+        reclaim (RECLAIM_WATERMARK - pool->free_cnt);
     }
 
+  if (pages == NULL && (flags & PAL_ASSERT))
+    PANIC ("palloc_get: out of pages");
+
   return pages;
 }
 
@@ -124,21 +339,24 @@ palloc_free_multiple (void *pages, size_t page_cnt)
   if (pages == NULL || page_cnt == 0)
     return;
 
-  if (page_from_pool (&kernel_pool, pages))
-    pool = &kernel_pool;
-  else if (page_from_pool (&user_pool, pages))
-    pool = &user_pool;
-  else
-    NOT_REACHED ();
-
-  page_idx = pg_no (pages) - pg_no (pool->base);
+  page_idx = pg_no (pages) - pg_no (base);
+  ASSERT (page_idx < total_cnt);
+  pool = page_pool (page_idx);
 
 #ifndef NDEBUG
   memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
 
-  ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
-  bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+  fastlock_acquire (&pool->lock);
+  ASSERT (bitmap_all (used_map, page_idx, page_cnt));
+  bitmap_set_multiple (used_map, page_idx, page_cnt, false);
+  buddy_free (pool, page_idx, page_cnt);
+  pool->free_cnt += page_cnt;
+  fastlock_release (&pool->lock);
+
+  if (pool->borrowed > 0
+      && pool->free_cnt >= RETURN_WATERMARK + CHUNK_PAGES)
+    give_back (pool);
 }
 
 /* Frees the page at PAGE. */
@@ -148,35 +366,667 @@ palloc_free_page (void *page)
   palloc_free_multiple (page, 1);
 }
 
-/* Initializes pool P as starting at START and ending at END,
-   naming it NAME for debugging purposes. */
+/* Tries to grow the block of OLD_CNT pages at PAGES, obtained
+   from the page allocator, to NEW_CNT pages by taking the pages
+   that follow it, without moving it.  The pages taken are not
+   zeroed.  Returns true if successful, in which case the block
+   is afterward freed as NEW_CNT pages.  Returns false, leaving
+   the block unchanged, if any of those pages is in use or
+   belongs to the other pool. */
+bool
+palloc_extend (void *pages, size_t old_cnt, size_t new_cnt)
+{
+  struct pool *pool;
+  size_t page_idx, cnt;
+  bool success;
+
+  ASSERT (pg_ofs (pages) == 0);
+  ASSERT (old_cnt > 0);
+  ASSERT (new_cnt >= old_cnt);
+
+  page_idx = pg_no (pages) - pg_no (base);
+  ASSERT (page_idx < total_cnt);
+  if (new_cnt - old_cnt > total_cnt - page_idx - old_cnt)
+    return false;
+  if (new_cnt == old_cnt)
+    return true;
+  pool = page_pool (page_idx);
+  page_idx += old_cnt;
+  cnt = new_cnt - old_cnt;
+
+  /* Holding POOL's lock keeps the pages from moving between the
+     pools, since that requires both locks. */
+  fastlock_acquire (&pool->lock);
+  success = (bitmap_none (used_map, page_idx, cnt)
+             && (pool == &user_pool
+                 ? bitmap_all (user_map, page_idx, cnt)
+                 : bitmap_none (user_map, page_idx, cnt)));
+  if (success)
+    {
+      buddy_take (pool, page_idx, cnt);
+      bitmap_set_multiple (used_map, page_idx, cnt, true);
+      pool->free_cnt -= cnt;
+      note_usage (pool);
+    }
+  fastlock_release (&pool->lock);
+  return success;
+}
+
+/* Returns true if PAGE belongs to one of the pools and is free
+   in the buddy allocator, false if it is in use, waiting on a
+   ZEROED list, or not the allocator's to give out. */
+bool
+palloc_page_free (const void *page)
+{
+  size_t page_idx;
+
+  if ((const uint8_t *) page < base)
+    return false;
+  page_idx = pg_no (page) - pg_no (base);
+  return page_idx < total_cnt && !bitmap_test (used_map, page_idx);
+}
+
+/* Rebuilds the free lists after snapshot_restore() has brought
+   back memory as it was when a snapshot was taken.  A snapshot
+   leaves out free pages, but each free block's first page holds
+   its list element, so the lists are made again from ORDERS,
+   which the snapshot kept.  Interrupts must be off. */
+void
+palloc_resume (void)
+{
+  struct pool *pools[] = {&kernel_pool, &user_pool};
+  size_t i;
+  int order;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (i = 0; i < sizeof pools / sizeof *pools; i++)
+    for (order = 0; order <= MAX_ORDER; order++)
+      list_init (&pools[i]->free_lists[order]);
+  for (i = 0; i < total_cnt; i++)
+    if (orders[i] != NOT_FREE)
+      list_push_front (&page_pool (i)->free_lists[orders[i]],
+                       page_elem (i));
+}
+
+/* Returns about how many pages an allocation with the given
+   FLAGS could obtain without reclaiming memory: those free in its
+   pool, plus those that the other pool could lend it. */
+size_t
+palloc_avail (enum palloc_flags flags)
+{
+  struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+  struct pool *other = flags & PAL_USER ? &kernel_pool : &user_pool;
+  size_t avail = pool->free_cnt;
+
+  if (other->free_cnt > LEND_WATERMARK)
+    avail += other->free_cnt - LEND_WATERMARK;
+  return avail;
+}
+
+/* Prints page allocator statistics. */
+void
+palloc_print_stats (void)
+{
+  struct list_elem *e;
+
+  print_pool_stats (&kernel_pool, "kernel");
+  print_pool_stats (&user_pool, "user");
+  printf ("Palloc: %llu reclaims, %llu failed allocations retried, "
+          "%llu of them rescued\n", reclaim_cnt, retry_cnt, rescue_cnt);
+  for (e = list_begin (&shrinkers); e != list_end (&shrinkers);
+       e = list_next (e))
+    {
+      struct shrinker *s = list_entry (e, struct shrinker, elem);
+      printf ("Palloc: shrinker %s: %llu calls, %llu pages freed\n",
+              s->name, s->call_cnt, s->page_cnt);
+    }
+}
+
+/* Updates POOL's peak usage after pages were taken from it.
+   POOL must be locked. */
+static void
+note_usage (struct pool *pool)
+{
+  size_t used = pool->page_cnt - pool->free_cnt;
+
+  if (used > pool->peak_cnt)
+    pool->peak_cnt = used;
+}
+
+/* Prints statistics for POOL, named NAME. */
 static void
-init_pool (struct pool *p, void *base, size_t page_cnt, const char *name) 
+print_pool_stats (const struct pool *pool, const char *name)
 {
-  /* We'll put the pool's used_map at its base.
-     Calculate the space needed for the bitmap
-     and subtract it from the pool's size. */
-  size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (page_cnt), PGSIZE);
-  if (bm_pages > page_cnt)
-    PANIC ("Not enough memory in %s for bitmap.", name);
-  page_cnt -= bm_pages;
+  printf ("Palloc: %s pool: %zu pages (%zu own, %zu borrowed), "
+          "%zu free, %zu used, %zu peak used\n", name, pool->page_cnt,
+          pool->end - pool->start, pool->borrowed, pool->free_cnt,
+          pool->page_cnt - pool->free_cnt, pool->peak_cnt);
+  printf ("Palloc: %s pool: %llu blocks borrowed, %llu chunks given "
+          "back\n", name, pool->borrow_cnt, pool->return_cnt);
+  printf ("Palloc: %s pool: %zu pages zeroed ahead, %llu zeroed "
+          "pages taken from them, %llu zeroed on demand\n", name,
+          pool->zeroed_cnt, pool->zero_hit_cnt, pool->zero_miss_cnt);
+}
+
+/* Takes PAGE_CNT contiguous pages from POOL and returns the
+   first, or returns a null pointer if POOL has no free block
+   large enough.  Zeroes the pages if FLAGS includes PAL_ZERO. */
+static void *
+take_pages (struct pool *pool, size_t page_cnt, enum palloc_flags flags)
+{
+  bool zero = (flags & PAL_ZERO) != 0;
+  bool zeroed = false;
+  bool wake = false;
+  size_t page_idx;
+  uint8_t *pages;
+
+  /* A single page for PAL_ZERO comes from ZEROED if possible.
+     Other requests come from the buddy allocator, falling back
+     on ZEROED. */
+  fastlock_acquire (&pool->lock);
+  page_idx = BITMAP_ERROR;
+  if (page_cnt > 1 || !zero || list_empty (&pool->zeroed))
+    {
+      page_idx = buddy_alloc (pool, page_cnt);
+      if (page_idx == BITMAP_ERROR && page_cnt > 1 && pool->zeroed_cnt > 0)
+        {
+          /* The zeroed pages may be what the buddies lack. */
+          flush_zeroed (pool);
+          page_idx = buddy_alloc (pool, page_cnt);
+        }
+      if (page_idx != BITMAP_ERROR)
+        bitmap_set_multiple (used_map, page_idx, page_cnt, true);
+    }
+  if (page_idx == BITMAP_ERROR && page_cnt == 1
+      && !list_empty (&pool->zeroed))
+    {
+      page_idx = elem_page (list_pop_front (&pool->zeroed));
+      pool->zeroed_cnt--;
+      zeroed = true;
+    }
+  if (page_idx != BITMAP_ERROR)
+    {
+      pool->free_cnt -= page_cnt;
+      note_usage (pool);
+      if (zero && zeroed)
+        pool->zero_hit_cnt++;
+      else if (zero)
+        pool->zero_miss_cnt++;
+    }
+  if (pool->zeroer_idle && pool->zeroed_cnt < ZEROED_MAX / 2)
+    {
+      pool->zeroer_idle = false;
+      wake = true;
+    }
+  fastlock_release (&pool->lock);
 
-  printf ("%zu pages available in %s.\n", page_cnt, name);
+  if (wake)
+    sema_up (&zeroer_sema);
+  if (page_idx == BITMAP_ERROR)
+    return NULL;
 
-  /* Initialize the pool. */
-  lock_init (&p->lock);
-  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_pages * PGSIZE);
-  p->base = base + bm_pages * PGSIZE;
+  pages = base + PGSIZE * page_idx;
+  if (zeroed)
+    {
+      /* Only the list element needs clearing. */
+      memset (pages, 0, sizeof (struct list_elem));
+    }
+  else if (zero)
+    memset (pages, 0, PGSIZE * page_cnt);
+  return pages;
 }
 
-/* Returns true if PAGE was allocated from POOL,
-   false otherwise. */
+/* Zeroes a free page of POOL and puts it on POOL's ZEROED list,
+   if POOL's list is not full and it has a free page.  Returns
+   true if it zeroed a page, false if POOL has no work for the
+   zeroer, in which case POOL wakes the zeroer when it does. */
 static bool
-page_from_pool (const struct pool *pool, void *page) 
+zero_page (struct pool *pool)
+{
+  size_t page_idx = BITMAP_ERROR;
+
+  fastlock_acquire (&pool->lock);
+  if (pool->zeroed_cnt < ZEROED_MAX)
+    page_idx = buddy_alloc (pool, 1);
+  if (page_idx != BITMAP_ERROR)
+    bitmap_mark (used_map, page_idx);
+  else
+    pool->zeroer_idle = true;
+  fastlock_release (&pool->lock);
+
+  if (page_idx == BITMAP_ERROR)
+    return false;
+
+  /* The page stays counted as free while we zero it. */
+  memset (base + PGSIZE * page_idx, 0, PGSIZE);
+
+  fastlock_acquire (&pool->lock);
+  list_push_back (&pool->zeroed, page_elem (page_idx));
+  pool->zeroed_cnt++;
+  fastlock_release (&pool->lock);
+  return true;
+}
+
+/* Returns the pages on POOL's ZEROED list to the buddy
+   allocator.  POOL must be locked. */
+static void
+flush_zeroed (struct pool *pool)
+{
+  while (!list_empty (&pool->zeroed))
+    {
+      size_t page_idx = elem_page (list_pop_front (&pool->zeroed));
+      bitmap_reset (used_map, page_idx);
+      buddy_free_block (pool, page_idx, 0);
+    }
+  pool->zeroed_cnt = 0;
+}
+
+/* Page-zeroer thread.  Keeps the pools' ZEROED lists filled,
+   sleeping while neither has work for it.  Its priority is
+   PRI_MIN, so it runs only when the CPU would otherwise idle. */
+static void
+zeroer (void *aux UNUSED)
+{
+  for (;;)
+    {
+      /* Not short-circuit: each pool with no work must be told
+         to wake us. */
+      bool worked = zero_page (&kernel_pool) | zero_page (&user_pool);
+      if (!worked)
+        sema_down (&zeroer_sema);
+    }
+}
+
+/* Tries to borrow a free block from the other pool into POOL
+   that is large enough for PAGE_CNT pages and at least a chunk.
+   Returns true if successful. */
+static bool
+borrow (struct pool *pool, size_t page_cnt)
+{
+  struct pool *other = pool == &kernel_pool ? &user_pool : &kernel_pool;
+  int order = order_for (page_cnt);
+  bool success = false;
+  size_t cnt;
+
+  if (order < CHUNK_ORDER)
+    order = CHUNK_ORDER;
+  if (order > MAX_ORDER)
+    return false;
+  cnt = (size_t) 1 << order;
+
+  lock_pools ();
+  if (cnt <= pool->max_cnt - pool->page_cnt
+      && other->free_cnt >= cnt + LEND_WATERMARK)
+    {
+      size_t page_idx = buddy_alloc (other, cnt);
+      if (page_idx != BITMAP_ERROR)
+        {
+          move_block (other, pool, page_idx, order);
+          pool->borrow_cnt++;
+          success = true;
+        }
+    }
+  unlock_pools ();
+
+  return success;
+}
+
+/* Returns a free block of POOL's of at least a chunk that holds
+   a borrowed chunk, storing its order in *ORDER, or BITMAP_ERROR
+   if there is none.  POOL must be locked. */
+static size_t
+find_borrowed (struct pool *pool, int *order)
+{
+  for (*order = MAX_ORDER; *order >= CHUNK_ORDER; (*order)--)
+    {
+      struct list *list = &pool->free_lists[*order];
+      struct list_elem *e;
+
+      for (e = list_begin (list); e != list_end (list); e = list_next (e))
+        {
+          size_t page_idx = elem_page (e);
+          if (foreign_pages (pool, page_idx, (size_t) 1 << *order) > 0)
+            return page_idx;
+        }
+    }
+  return BITMAP_ERROR;
+}
+
+/* Gives the free chunks that POOL borrowed back to the other
+   pool, for as long as POOL keeps RETURN_WATERMARK pages free. */
+static void
+give_back (struct pool *pool)
+{
+  struct pool *other = pool == &kernel_pool ? &user_pool : &kernel_pool;
+  size_t page_idx, i;
+  int order;
+
+  lock_pools ();
+  while (pool->free_cnt >= RETURN_WATERMARK + CHUNK_PAGES
+         && (page_idx = find_borrowed (pool, &order)) != BITMAP_ERROR)
+    {
+      /* Take the block apart into chunks, giving back the
+         borrowed ones and freeing the rest again. */
+      list_remove (page_elem (page_idx));
+      orders[page_idx] = NOT_FREE;
+      for (i = page_idx; i < page_idx + ((size_t) 1 << order);
+           i += CHUNK_PAGES)
+        if (foreign_pages (pool, i, CHUNK_PAGES) > 0
+            && pool->free_cnt >= RETURN_WATERMARK + CHUNK_PAGES)
+          {
+            move_block (pool, other, i, CHUNK_ORDER);
+            pool->return_cnt++;
+          }
+        else
+          buddy_free_block (pool, i, CHUNK_ORDER);
+    }
+  unlock_pools ();
+}
+
+/* Asks the shrinkers, in order, to free PAGE_CNT kernel pages,
+   and returns the number they freed.  Returns 0 without asking
+   them if called from an interrupt handler, which must not take
+   their locks, or if another thread is already reclaiming, which
+   frees pages for us too, or if a shrinker is itself allocating. */
+static size_t
+reclaim (size_t page_cnt)
+{
+  struct list_elem *e;
+  size_t freed = 0;
+
+  if (intr_context () || lock_held_by_current_thread (&reclaim_lock)
+      || !lock_try_acquire (&reclaim_lock))
+    return 0;
+
+  reclaim_cnt++;
+  for (e = list_begin (&shrinkers);
+       e != list_end (&shrinkers) && freed < page_cnt; e = list_next (e))
+    {
+      struct shrinker *s = list_entry (e, struct shrinker, elem);
+      size_t cnt = s->shrink (page_cnt - freed);
+      s->call_cnt++;
+      s->page_cnt += cnt;
+      freed += cnt;
+    }
+  lock_release (&reclaim_lock);
+
+  return freed;
+}
+
+/* Initializes pool P as owning pages START up to END, of which
+   it may have at most MAX_CNT at once, naming it NAME for
+   debugging purposes. */
+static void
+init_pool (struct pool *p, size_t start, size_t end, size_t max_cnt,
+           const char *name) 
+{
+  int order;
+
+  fastlock_init (&p->lock);
+  lock_set_name (&p->lock.lock, name);
+  for (order = 0; order <= MAX_ORDER; order++)
+    list_init (&p->free_lists[order]);
+  p->start = start;
+  p->end = end;
+  p->page_cnt = 0;
+  p->free_cnt = 0;
+  p->peak_cnt = 0;
+  p->max_cnt = max_cnt;
+  p->borrowed = 0;
+  list_init (&p->zeroed);
+  p->zeroed_cnt = 0;
+  p->zeroer_idle = false;
+  p->zero_hit_cnt = 0;
+  p->zero_miss_cnt = 0;
+  p->borrow_cnt = 0;
+  p->return_cnt = 0;
+}
+
+/* Frees those of pages START up to END that the BIOS memory map
+   says are RAM, adding them to their pools.  Every page starts
+   out in use, so that the holes in memory never get handed out. */
+static void
+add_ram (size_t start, size_t end)
+{
+  size_t i = start;
+
+  while (i < end)
+    {
+      struct pool *pool = page_pool (i);
+      size_t run;
+
+      if (!page_usable (i))
+        {
+          i++;
+          continue;
+        }
+      for (run = 1; i + run < end && page_pool (i + run) == pool
+             && page_usable (i + run); run++)
+        continue;
+
+      bitmap_set_multiple (used_map, i, run, false);
+      buddy_free (pool, i, run);
+      pool->page_cnt += run;
+      pool->free_cnt += run;
+      i += run;
+    }
+}
+
+/* Returns true if page PAGE_IDX lies entirely within a usable
+   region of the BIOS memory map, or if there is no map. */
+static bool
+page_usable (size_t page_idx)
+{
+  uint64_t start = vtop (base) + (uint64_t) page_idx * PGSIZE;
+  uint32_t i;
+
+  if (init_mem_map_cnt == 0)
+    return true;
+  for (i = 0; i < init_mem_map_cnt; i++)
+    {
+      const struct mem_map_entry *e = &init_mem_map[i];
+      if (e->type == LOADER_MEM_USABLE && e->base <= start
+          && start + PGSIZE <= e->base + e->length)
+        return true;
+    }
+  return false;
+}
+
+/* Returns the pool that page PAGE_IDX belongs to.  The answer
+   can change only while the page is free. */
+static struct pool *
+page_pool (size_t page_idx)
+{
+  return bitmap_test (user_map, page_idx) ? &user_pool : &kernel_pool;
+}
+
+/* Locks both pools, in the one order that avoids deadlock. */
+static void
+lock_pools (void)
+{
+  fastlock_acquire (&kernel_pool.lock);
+  fastlock_acquire (&user_pool.lock);
+}
+
+/* Unlocks both pools. */
+static void
+unlock_pools (void)
+{
+  fastlock_release (&user_pool.lock);
+  fastlock_release (&kernel_pool.lock);
+}
+
+/* Returns how many of the PAGE_CNT pages starting at PAGE_IDX
+   are outside POOL's own pages. */
+static size_t
+foreign_pages (const struct pool *pool, size_t page_idx, size_t page_cnt)
+{
+  size_t lo = page_idx > pool->start ? page_idx : pool->start;
+  size_t hi = page_idx + page_cnt < pool->end ? page_idx + page_cnt
+                                                : pool->end;
+  return hi > lo ? page_cnt - (hi - lo) : page_cnt;
+}
+
+/* Moves the free block of 2**ORDER pages starting at PAGE_IDX,
+   which is on none of FROM's free lists, from pool FROM to pool
+   TO.  Both pools must be locked. */
+static void
+move_block (struct pool *from, struct pool *to, size_t page_idx, int order)
+{
+  size_t cnt = (size_t) 1 << order;
+
+  bitmap_set_multiple (user_map, page_idx, cnt, to == &user_pool);
+  from->page_cnt -= cnt;
+  from->free_cnt -= cnt;
+  from->borrowed -= foreign_pages (from, page_idx, cnt);
+  to->page_cnt += cnt;
+  to->free_cnt += cnt;
+  to->borrowed += foreign_pages (to, page_idx, cnt);
+  buddy_free_block (to, page_idx, order);
+}
+
+/* Returns the free list element stored in page PAGE_IDX. */
+static struct list_elem *
+page_elem (size_t page_idx)
+{
+  return (struct list_elem *) (base + PGSIZE * page_idx);
+}
+
+/* Returns the index of the page holding free list element E. */
+static size_t
+elem_page (struct list_elem *e)
+{
+  return ((uint8_t *) e - base) / PGSIZE;
+}
+
+/* Allocates PAGE_CNT contiguous pages from POOL and returns the
+   index of the first one, or BITMAP_ERROR if POOL has no free
+   block large enough.  POOL's lock must be held. */
+static size_t
+buddy_alloc (struct pool *pool, size_t page_cnt)
+{
+  int want = order_for (page_cnt);
+  int order;
+  size_t page_idx;
+
+  if (want > MAX_ORDER)
+    return BITMAP_ERROR;
+
+  /* Find the smallest nonempty free list of sufficient order. */
+  for (order = want; order <= MAX_ORDER; order++)
+    if (!list_empty (&pool->free_lists[order]))
+      break;
+  if (order > MAX_ORDER)
+    return BITMAP_ERROR;
+
+  page_idx = elem_page (list_pop_front (&pool->free_lists[order]));
+  orders[page_idx] = NOT_FREE;
+
+  /* Split the block down to the wanted order, freeing the upper
+     halves. */
+  while (order > want)
+    {
+      order--;
+      buddy_free_block (pool, page_idx + ((size_t) 1 << order), order);
+    }
+
+  /* Give back the pages beyond PAGE_CNT. */
+  if (page_cnt < ((size_t) 1 << want))
+    buddy_free (pool, page_idx + page_cnt, ((size_t) 1 << want) - page_cnt);
+
+  return page_idx;
+}
+
+/* Frees the PAGE_CNT pages of POOL starting at PAGE_IDX, which
+   need not be a power of 2 or aligned, by breaking them up into
+   maximal aligned blocks. */
+static void
+buddy_free (struct pool *pool, size_t page_idx, size_t page_cnt)
+{
+  size_t end = page_idx + page_cnt;
+
+  while (page_idx < end)
+    {
+      int order = 0;
+      while (order < MAX_ORDER
+             && page_idx % ((size_t) 2 << order) == 0
+             && page_idx + ((size_t) 2 << order) <= end)
+        order++;
+      buddy_free_block (pool, page_idx, order);
+      page_idx += (size_t) 1 << order;
+    }
+}
+
+/* Removes the PAGE_CNT pages of POOL starting at PAGE_IDX, all
+   of them free, from POOL's free blocks, freeing again the parts
+   of those blocks outside the range. */
+static void
+buddy_take (struct pool *pool, size_t page_idx, size_t page_cnt)
+{
+  size_t end = page_idx + page_cnt;
+  size_t cur = page_idx;
+
+  while (cur < end)
+    {
+      size_t block = cur;
+      size_t block_end;
+      int order;
+
+      /* The free block holding CUR is the one whose first page is
+         CUR rounded down to the block's own order. */
+      for (order = 0; order <= MAX_ORDER; order++)
+        {
+          block = cur & ~(((size_t) 1 << order) - 1);
+          if (orders[block] == order)
+            break;
+        }
+      ASSERT (order <= MAX_ORDER);
+
+      list_remove (page_elem (block));
+      orders[block] = NOT_FREE;
+      block_end = block + ((size_t) 1 << order);
+      if (block < page_idx)
+        buddy_free (pool, block, page_idx - block);
+      if (block_end > end)
+        buddy_free (pool, end, block_end - end);
+      cur = block_end;
+    }
+}
+
+/* Frees the block of 2**ORDER pages of POOL starting at
+   PAGE_IDX, merging it with its buddy as many times as
+   possible. */
+static void
+buddy_free_block (struct pool *pool, size_t page_idx, int order)
+{
+  ASSERT (page_idx % ((size_t) 1 << order) == 0);
+
+  while (order < MAX_ORDER)
+    {
+      size_t buddy = page_idx ^ ((size_t) 1 << order);
+      if (buddy >= total_cnt || orders[buddy] != order
+          || page_pool (buddy) != pool)
+        break;
+
+      list_remove (page_elem (buddy));
+      orders[buddy] = NOT_FREE;
+      if (buddy < page_idx)
+        page_idx = buddy;
+      order++;
+    }
+
+  orders[page_idx] = order;
+  list_push_front (&pool->free_lists[order], page_elem (page_idx));
+}
+
+/* Returns the smallest order whose blocks hold PAGE_CNT pages. */
+static int
+order_for (size_t page_cnt)
 {
-  size_t page_no = pg_no (page);
-  size_t start_page = pg_no (pool->base);
-  size_t end_page = start_page + bitmap_size (pool->used_map);
+  int order = 0;
 
-  return page_no >= start_page && page_no < end_page;
+  while (order <= MAX_ORDER && ((size_t) 1 << order) < page_cnt)
+    order++;
+  return order;
 }
@@ -1,6 +1,8 @@
 #ifndef THREADS_PALLOC_H
 #define THREADS_PALLOC_H
 
+#include <list.h>
+#include <stdbool.h>
 #include <stddef.h>
 
 /* How to allocate pages. */
@@ -11,10 +13,37 @@ enum palloc_flags
     PAL_USER = 004              /* User page. */
   };
 
+/* Frees up to about PAGE_CNT pages of a cache's memory, least
+   recently used objects first, and returns the number of pages
+   freed.  Runs in the thread whose allocation fell short, which
+   may hold any of its own locks, so it must not wait for a lock:
+   it should try its locks and free nothing if they are busy. */
+typedef size_t shrink_func (size_t page_cnt);
+
+/* A kernel cache that gives memory back when the kernel pool
+   runs low.  Owned by threads/palloc.c once registered. */
+struct shrinker
+  {
+    struct list_elem elem;      /* Element in shrinker list. */
+    const char *name;           /* Name, for statistics. */
+    shrink_func *shrink;        /* Frees pages. */
+    unsigned long long call_cnt; /* Number of calls to SHRINK. */
+    unsigned long long page_cnt; /* Pages freed by SHRINK. */
+  };
+
 void palloc_init (size_t user_page_limit);
+void palloc_add_ram (void);
+void palloc_start_zeroer (void);
+void palloc_register_shrinker (struct shrinker *, const char *name,
+                               shrink_func *);
 void *palloc_get_page (enum palloc_flags);
 void *palloc_get_multiple (enum palloc_flags, size_t page_cnt);
 void palloc_free_page (void *);
 void palloc_free_multiple (void *, size_t page_cnt);
+bool palloc_extend (void *, size_t old_cnt, size_t new_cnt);
+size_t palloc_avail (enum palloc_flags);
+bool palloc_page_free (const void *);
+void palloc_resume (void);
+void palloc_print_stats (void);
 
 #endif /* threads/palloc.h */
@@ -0,0 +1,130 @@
+#include "threads/poll.h"
+#include <debug.h>
+#include "devices/timer.h"
+#include "threads/interrupt.h"
+#include "threads/thread.h"
+
+/* Waiting for any of several objects.
+
+   An object that can be polled, such as a pipe or the console's
+   input, has a poll_queue.  A thread that wants to wait for more
+   than one object at a time puts an entry for its poller on the
+   queue of each, checks whether any of them is ready, and if
+   none is calls poller_wait().  The object calls
+   poll_queue_wake() whenever it may have become ready, which
+   wakes every poller on its queue to check again.  Entering the
+   queue before checking means that no wakeup can be lost in
+   between: it only sets the poller's KICKED flag, and
+   poller_wait() then returns at once.
+
+   A poller with a deadline sleeps on the sleep wheel, from which
+   poll_queue_wake() takes it with thread_wake_early(), so that
+   timeouts cost no timer of their own.  Queues are changed with
+   interrupts off, so that objects fed by interrupt handlers may
+   wake pollers from there. */
+
+/* Initializes Q as an empty queue. */
+void
+poll_queue_init (struct poll_queue *q)
+{
+  list_init (&q->entries);
+}
+
+/* Wakes every poller waiting on Q.  May be called from an
+   interrupt handler. */
+void
+poll_queue_wake (struct poll_queue *q)
+{
+  enum intr_level old_level = intr_disable ();
+  struct list_elem *e;
+
+  for (e = list_begin (&q->entries); e != list_end (&q->entries);
+       e = list_next (e))
+    {
+      struct poller *p = list_entry (e, struct poll_entry, elem)->poller;
+
+      p->kicked = true;
+      if (p->blocked)
+        {
+          p->blocked = false;
+          thread_unblock (p->thread);
+        }
+      else
+        thread_wake_early (p->thread);
+    }
+  intr_set_level (old_level);
+}
+
+/* Initializes P as a poller for the current thread. */
+void
+poller_init (struct poller *p)
+{
+  p->thread = thread_current ();
+  p->kicked = false;
+  p->blocked = false;
+}
+
+/* Initializes E as an entry for poller P, on no queue yet. */
+void
+poll_entry_init (struct poll_entry *e, struct poller *p)
+{
+  e->poller = p;
+  e->queue = NULL;
+}
+
+/* Puts E on Q, unless it is already on a queue. */
+void
+poll_entry_add (struct poll_entry *e, struct poll_queue *q)
+{
+  enum intr_level old_level;
+
+  if (e->queue != NULL)
+    return;
+  old_level = intr_disable ();
+  e->queue = q;
+  list_push_back (&q->entries, &e->elem);
+  intr_set_level (old_level);
+}
+
+/* Takes E off its queue, if it is on one. */
+void
+poll_entry_remove (struct poll_entry *e)
+{
+  enum intr_level old_level;
+
+  if (e->queue == NULL)
+    return;
+  old_level = intr_disable ();
+  list_remove (&e->elem);
+  e->queue = NULL;
+  intr_set_level (old_level);
+}
+
+/* Waits until a queue that P has an entry on is woken, or until
+   timer tick DEADLINE if it is nonnegative.  Returns at once if
+   a queue was woken since the last call.  Returns true if a
+   queue was woken, false if the deadline passed. */
+bool
+poller_wait (struct poller *p, int64_t deadline)
+{
+  enum intr_level old_level;
+  bool kicked;
+
+  ASSERT (p->thread == thread_current ());
+
+  old_level = intr_disable ();
+  if (!p->kicked)
+    {
+      if (deadline < 0)
+        {
+          p->blocked = true;
+          thread_block ();
+        }
+      else if (deadline > timer_ticks ())
+        set_sleeping_thread (deadline);
+    }
+  kicked = p->kicked;
+  p->kicked = false;
+  intr_set_level (old_level);
+  return kicked;
+}
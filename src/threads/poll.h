@@ -0,0 +1,47 @@
+#ifndef THREADS_POLL_H
+#define THREADS_POLL_H
+
+#include <list.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Readiness of an object being polled.  Must match the POLL*
+   constants in lib/user/syscall.h. */
+#define POLLIN 0x01             /* Reading would not wait. */
+#define POLLOUT 0x02            /* Writing would not wait. */
+#define POLLHUP 0x04            /* The other end is gone. */
+#define POLLNVAL 0x08           /* Not an open descriptor. */
+
+/* A thread waiting in poller_wait() for any of several objects
+   to become ready. */
+struct poller
+  {
+    struct thread *thread;      /* The waiting thread. */
+    bool kicked;                /* Woken since the last wait? */
+    bool blocked;               /* Blocked without a deadline? */
+  };
+
+/* The pollers waiting on one object. */
+struct poll_queue
+  {
+    struct list entries;        /* List of struct poll_entry. */
+  };
+
+/* A poller's place in one poll_queue. */
+struct poll_entry
+  {
+    struct list_elem elem;      /* In QUEUE's list. */
+    struct poller *poller;      /* The poller. */
+    struct poll_queue *queue;   /* Queue, or null if on none. */
+  };
+
+void poll_queue_init (struct poll_queue *);
+void poll_queue_wake (struct poll_queue *);
+
+void poller_init (struct poller *);
+void poll_entry_init (struct poll_entry *, struct poller *);
+void poll_entry_add (struct poll_entry *, struct poll_queue *);
+void poll_entry_remove (struct poll_entry *);
+bool poller_wait (struct poller *, int64_t deadline);
+
+#endif /* threads/poll.h */
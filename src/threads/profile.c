@@ -0,0 +1,303 @@
+#include "threads/profile.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "devices/rtc.h"
+#include "devices/timer.h"
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Sampling profiler.
+
+   Each sample records the instruction pointer that an interrupt
+   interrupted, whether it was in user or kernel mode, and the
+   running thread, into a histogram of (address, thread) pairs.
+   By default the timer interrupt takes a sample on every tick.
+   For a finer profile, "-profile=HZ" instead takes samples from
+   the RTC's periodic interrupt at up to 8192 Hz, which leaves
+   the timer tick, and so scheduling, unchanged.
+
+   profile_dump() prints the histogram at shutdown, and
+   utils/pintos-prof turns it into a flat profile by function.
+
+   With "-profile-stacks[=DEPTH]", each kernel-mode sample also
+   walks the interrupted code's chain of frame pointers, as
+   debug_backtrace() does, for up to DEPTH callers, and counts
+   the resulting call stack in a second table.  The walk stays
+   within the running thread's kernel stack, so a corrupt or user
+   frame pointer ends it instead of faulting.  profile_dump()
+   prints those stacks too, and utils/pintos-flame turns them
+   into folded stacks for flame graphs. */
+
+/* Number of histogram slots.  Must be a power of 2. */
+#define PROFILE_SLOTS 4096
+
+/* A histogram slot.  Empty if CNT is 0. */
+struct profile_slot
+  {
+    uintptr_t eip;              /* Interrupted instruction. */
+    tid_t tid;                  /* Running thread. */
+    bool user;                  /* In user mode? */
+    unsigned cnt;               /* Number of samples. */
+  };
+
+/* Pages in the histogram. */
+#define SLOT_PAGES DIV_ROUND_UP (PROFILE_SLOTS \
+                                 * sizeof (struct profile_slot), PGSIZE)
+
+/* The histogram, or a null pointer before profile_start(). */
+static struct profile_slot *slots;
+
+/* Most addresses in a sampled call stack, and number of slots
+   for call stacks, a power of 2. */
+#define STACK_DEPTH_MAX 31
+#define STACK_SLOTS 512
+
+/* A call stack slot.  Empty if CNT is 0. */
+struct stack_slot
+  {
+    unsigned cnt;               /* Number of samples. */
+    uintptr_t pcs[STACK_DEPTH_MAX + 1]; /* Interrupted eip, callers,
+                                           then zeros. */
+  };
+
+/* Pages of call stack slots. */
+#define STACK_PAGES DIV_ROUND_UP (STACK_SLOTS * sizeof (struct stack_slot), \
+                                  PGSIZE)
+
+/* Callers to record per sample, 0 if call stacks are off; and the
+   call stack slots, or a null pointer. */
+static unsigned stack_depth;
+static struct stack_slot *stacks;
+
+/* Requested and actual sampling rates, in Hz; 0 if profiling
+   is off. */
+static unsigned request_hz;
+static unsigned profile_hz;
+
+/* True while samples are being taken. */
+static bool sampling;
+
+/* True if the timer interrupt takes the samples, false if the
+   RTC interrupt does. */
+static bool on_tick;
+
+/* Numbers of samples taken and of samples that found the
+   histogram full. */
+static unsigned sample_cnt;
+static unsigned drop_cnt;
+static unsigned stack_drop_cnt;
+
+static void sample (const struct intr_frame *);
+static void sample_stack (const struct intr_frame *);
+static intr_handler_func rtc_sample;
+
+/* Turns on profiling, at HZ samples per second if HZ is
+   non-null, otherwise once per timer tick.  Returns false if HZ
+   is not a positive number. */
+bool
+profile_configure (const char *hz) 
+{
+  request_hz = hz != NULL ? atoi (hz) : TIMER_FREQ;
+  return request_hz > 0;
+}
+
+/* Turns on call stack sampling, for DEPTH callers if DEPTH is
+   non-null, otherwise for 15, and turns on profiling once per
+   timer tick unless profile_configure() picks another rate.
+   Returns false if DEPTH is not between 1 and STACK_DEPTH_MAX. */
+bool
+profile_configure_stacks (const char *depth)
+{
+  int n = depth != NULL ? atoi (depth) : 15;
+
+  if (n < 1 || n > STACK_DEPTH_MAX)
+    return false;
+  stack_depth = n;
+  if (request_hz == 0)
+    request_hz = TIMER_FREQ;
+  return true;
+}
+
+/* Allocates the histogram and starts taking samples, if
+   profiling was configured. */
+void
+profile_start (void) 
+{
+  if (request_hz == 0)
+    return;
+  slots = palloc_get_multiple (PAL_ZERO, SLOT_PAGES);
+  if (slots == NULL)
+    {
+      printf ("Profile: no memory for %zu-page histogram, "
+              "profiling disabled.\n", (size_t) SLOT_PAGES);
+      return;
+    }
+  if (stack_depth > 0)
+    {
+      stacks = palloc_get_multiple (PAL_ZERO, STACK_PAGES);
+      if (stacks == NULL)
+        printf ("Profile: no memory for %zu pages of call stacks, "
+                "call stacks disabled.\n", (size_t) STACK_PAGES);
+    }
+  if (request_hz <= TIMER_FREQ)
+    {
+      profile_hz = TIMER_FREQ;
+      on_tick = true;
+    }
+  else
+    profile_hz = rtc_start_periodic (request_hz, rtc_sample);
+  sampling = true;
+}
+
+/* Called by the timer interrupt handler on each tick, with F the
+   interrupted context. */
+void
+profile_tick (const struct intr_frame *f) 
+{
+  if (sampling && on_tick)
+    sample (f);
+}
+
+/* RTC periodic interrupt handler. */
+static void
+rtc_sample (struct intr_frame *f) 
+{
+  if (sampling)
+    sample (f);
+}
+
+/* Adds a sample of the context F interrupted. */
+static void
+sample (const struct intr_frame *f) 
+{
+  uintptr_t eip = (uintptr_t) f->eip;
+  tid_t tid = thread_current ()->tid;
+  size_t i, probe;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (stacks != NULL)
+    sample_stack (f);
+  sample_cnt++;
+  i = (eip ^ (eip >> 12) ^ (unsigned) tid * 0x9e3779b1u) % PROFILE_SLOTS;
+  for (probe = 0; probe < PROFILE_SLOTS; probe++, i = (i + 1) % PROFILE_SLOTS)
+    {
+      struct profile_slot *s = &slots[i];
+      if (s->cnt == 0)
+        {
+          s->eip = eip;
+          s->tid = tid;
+          s->user = (f->cs & 3) == 3;
+          s->cnt = 1;
+          return;
+        }
+      else if (s->eip == eip && s->tid == tid)
+        {
+          s->cnt++;
+          return;
+        }
+    }
+  drop_cnt++;
+}
+
+/* Adds the call stack of the context F interrupted to the call
+   stack slots.  A user-mode sample gets just its eip. */
+static void
+sample_stack (const struct intr_frame *f)
+{
+  struct thread *t = thread_current ();
+  uintptr_t pcs[STACK_DEPTH_MAX + 1];
+  void **frame;
+  unsigned hash, depth;
+  size_t i, probe;
+
+  /* Walk the frame pointers while they point upward within T's
+     kernel stack, which also rules out loops. */
+  memset (pcs, 0, sizeof pcs);
+  pcs[0] = (uintptr_t) f->eip;
+  depth = 1;
+  if ((f->cs & 3) != 3)
+    for (frame = (void **) f->ebp;
+         depth <= stack_depth
+           && (uint8_t *) frame >= t->stack_base
+           && (uint8_t *) (frame + 2) <= t->stack_top
+           && (uintptr_t) frame % sizeof (void *) == 0
+           && frame[1] != NULL;
+         frame = frame[0])
+      {
+        pcs[depth++] = (uintptr_t) frame[1];
+        if ((void **) frame[0] <= frame)
+          break;
+      }
+
+  hash = 2166136261u;
+  for (i = 0; i < depth; i++)
+    hash = (hash ^ pcs[i]) * 16777619u;
+  i = hash % STACK_SLOTS;
+  for (probe = 0; probe < STACK_SLOTS; probe++, i = (i + 1) % STACK_SLOTS)
+    {
+      struct stack_slot *s = &stacks[i];
+      if (s->cnt == 0)
+        {
+          memcpy (s->pcs, pcs, sizeof pcs);
+          s->cnt = 1;
+          return;
+        }
+      else if (!memcmp (s->pcs, pcs, sizeof pcs))
+        {
+          s->cnt++;
+          return;
+        }
+    }
+  stack_drop_cnt++;
+}
+
+/* Prints the histogram and stops taking samples.  Prints nothing
+   if profiling is off. */
+void
+profile_dump (void) 
+{
+  enum intr_level old_level;
+  size_t i;
+
+  if (!sampling)
+    return;
+
+  /* Stop sampling.  The RTC interrupt stays on, but it no longer
+     takes samples. */
+  old_level = intr_disable ();
+  sampling = false;
+  intr_set_level (old_level);
+
+  printf ("Profile: %u samples at %u Hz, %u dropped\n",
+          sample_cnt, profile_hz, drop_cnt);
+  for (i = 0; i < PROFILE_SLOTS; i++)
+    if (slots[i].cnt != 0)
+      printf ("profile %#"PRIxPTR" %d %c %u\n", slots[i].eip, slots[i].tid,
+              slots[i].user ? 'U' : 'K', slots[i].cnt);
+
+  /* Call stacks, innermost address first. */
+  if (stacks != NULL)
+    {
+      printf ("Profile: call stacks up to %u callers deep, %u dropped\n",
+              stack_depth, stack_drop_cnt);
+      for (i = 0; i < STACK_SLOTS; i++)
+        if (stacks[i].cnt != 0)
+          {
+            const uintptr_t *pc;
+
+            printf ("profile-stack %u", stacks[i].cnt);
+            for (pc = stacks[i].pcs;
+                 pc < stacks[i].pcs + STACK_DEPTH_MAX + 1 && *pc != 0; pc++)
+              printf (" %#"PRIxPTR, *pc);
+            printf ("\n");
+          }
+    }
+}
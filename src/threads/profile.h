@@ -0,0 +1,14 @@
+#ifndef THREADS_PROFILE_H
+#define THREADS_PROFILE_H
+
+#include <stdbool.h>
+
+struct intr_frame;
+
+bool profile_configure (const char *hz);
+bool profile_configure_stacks (const char *depth);
+void profile_start (void);
+void profile_tick (const struct intr_frame *);
+void profile_dump (void);
+
+#endif /* threads/profile.h */
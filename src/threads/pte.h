@@ -64,8 +64,12 @@ static inline uintptr_t pd_no (const void *va) {
 #define PTE_P 0x1               /* 1=present, 0=not present. */
 #define PTE_W 0x2               /* 1=read/write, 0=read-only. */
 #define PTE_U 0x4               /* 1=user/kernel, 0=kernel only. */
+#define PTE_PWT 0x8             /* 1=write-through, 0=write-back. */
+#define PTE_PCD 0x10            /* 1=cache disabled, 0=cached. */
 #define PTE_A 0x20              /* 1=accessed, 0=not acccessed. */
 #define PTE_D 0x40              /* 1=dirty, 0=not dirty (PTEs only). */
+#define PDE_PS 0x80             /* 1=4 MB page, 0=page table (PDEs only). */
+#define PTE_G 0x100             /* 1=global, 0=flushed with CR3 load. */
 
 /* Returns a PDE that points to page table PT. */
 static inline uint32_t pde_create (uint32_t *pt) {
@@ -73,10 +77,36 @@ static inline uint32_t pde_create (uint32_t *pt) {
   return vtop (pt) | PTE_U | PTE_P | PTE_W;
 }
 
+/* Returns a PDE that maps the PTSPAN bytes starting at PAGE,
+   which must be aligned on a PTSPAN boundary, as a single 4 MB
+   page, usable only by ring 0 code (the kernel).  The page is
+   readable, and writable as well if WRITABLE is true.  The CPU
+   honors such a PDE only with CR4.PSE set. */
+static inline uint32_t pde_create_large (void *page, bool writable) {
+  ASSERT (((uintptr_t) page & (PTSPAN - 1)) == 0);
+  return vtop (page) | PDE_PS | PTE_P | (writable ? PTE_W : 0);
+}
+
+/* Returns a PDE that maps the PTSPAN bytes starting at PAGE, as
+   pde_create_large() does, for user code. */
+static inline uint32_t pde_create_user_large (void *page, bool writable) {
+  return pde_create_large (page, writable) | PTE_U;
+}
+
+/* Returns a pointer to the first byte of the 4 MB page that PDE,
+   which must be "present" and map a 4 MB page, maps. */
+static inline void *pde_get_large (uint32_t pde) {
+  ASSERT (pde & PTE_P);
+  ASSERT (pde & PDE_PS);
+  return ptov (pde & ~(uint32_t) (PTSPAN - 1));
+}
+
 /* Returns a pointer to the page table that page directory entry
-   PDE, which must "present", points to. */
+   PDE, which must "present" and not map a 4 MB page, points
+   to. */
 static inline uint32_t *pde_get_pt (uint32_t pde) {
   ASSERT (pde & PTE_P);
+  ASSERT (!(pde & PDE_PS));
   return ptov (pde & PTE_ADDR);
 }
 
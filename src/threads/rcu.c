@@ -0,0 +1,276 @@
+#include "threads/rcu.h"
+#include <debug.h>
+#include "threads/cpu.h"
+#include "threads/interrupt.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Read-copy update.
+
+   RCU lets code walk a list, or any other linked structure, with
+   interrupts on and without taking a lock, while other threads
+   add and remove elements.  A reader brackets its walk with
+   rcu_read_lock() and rcu_read_unlock().  A writer unlinks an
+   element, under whatever lock or with interrupts off as writers
+   already serialize among themselves, but does not free it until
+   every reader that might have reached it has finished: it passes
+   the element to call_rcu(), which calls a function to free it
+   later, or waits with synchronize_rcu() and frees it itself.
+   list_remove() leaves the removed element's `next' intact, so a
+   reader standing on it can go on.  New elements are linked in
+   with rcu_list_push_back(), which fills in the element before
+   any reader can reach it.
+
+   Read-side critical sections must not sleep.  A thread in one is
+   not preempted either: thread_preempt() notes that it should
+   yield and rcu_read_unlock() does so.  Then a processor that
+   runs schedule(), or that takes a timer tick outside a
+   critical section, no longer holds any reference that a reader
+   picked up before that point.  A "grace period" ends once every
+   online processor has done so since it began, and the callbacks
+   queued before it began can then run.  Readers thus cost only a
+   counter in their struct thread.  Code that runs with interrupts
+   off is implicitly a reader, since it cannot reach schedule().
+
+   Callbacks run in a thread of their own, "rcu", so they may
+   sleep, for example to take the lock in free().
+
+   All of this module's state is protected by disabling
+   interrupts. */
+
+/* Callbacks, queued by call_rcu() and moved from list to list as
+   grace periods begin and end. */
+static struct list next_cbs;    /* Waiting for a grace period to begin. */
+static struct list wait_cbs;    /* Waiting for the current one to end. */
+static struct list done_cbs;    /* Ready to be called. */
+
+static bool gp_active;          /* Grace period in progress? */
+static unsigned gp_seq;         /* Number of the latest grace period. */
+static size_t gp_pending;       /* # of CPUs still to pass through one. */
+
+/* Number of the last grace period for which each processor passed
+   through a quiescent state. */
+static PERCPU (unsigned, qs_seq);
+
+static struct thread *worker;   /* The "rcu" thread. */
+static bool worker_blocked;     /* Is it waiting for DONE_CBS? */
+
+static thread_func run_callbacks NO_RETURN;
+static void start_grace_period (void);
+static void end_grace_period (void);
+
+/* Initializes RCU and starts the thread that runs callbacks.
+   Callbacks queued before this are held until it runs. */
+void
+rcu_init (void)
+{
+  struct semaphore started;
+
+  list_init (&next_cbs);
+  list_init (&wait_cbs);
+  list_init (&done_cbs);
+
+  sema_init (&started, 0);
+  thread_create ("rcu", PRI_MAX, run_callbacks, &started);
+  sema_down (&started);
+}
+
+/* Begins a read-side critical section.  Sections may nest. */
+void
+rcu_read_lock (void)
+{
+  thread_current ()->rcu_depth++;
+  barrier ();
+}
+
+/* Ends a read-side critical section, yielding the CPU if the
+   thread would have been preempted during it. */
+void
+rcu_read_unlock (void)
+{
+  struct thread *t = thread_current ();
+
+  ASSERT (t->rcu_depth > 0);
+
+  barrier ();
+  if (--t->rcu_depth == 0 && t->rcu_preempt_pending)
+    {
+      t->rcu_preempt_pending = false;
+      if (!intr_context () && intr_get_level () == INTR_ON)
+        thread_preempt ();
+    }
+}
+
+/* Returns true if the running thread is in a read-side critical
+   section. */
+bool
+rcu_read_held (void)
+{
+  return thread_current ()->rcu_depth > 0;
+}
+
+/* Arranges for FUNC to be called with HEAD, in the "rcu" thread,
+   once every read-side critical section that is in progress now
+   has ended.  May be called from an interrupt handler. */
+void
+call_rcu (struct rcu_head *head, rcu_func *func)
+{
+  enum intr_level old_level;
+
+  ASSERT (head != NULL);
+  ASSERT (func != NULL);
+
+  head->func = func;
+  old_level = intr_disable ();
+  list_push_back (&next_cbs, &head->elem);
+  if (!gp_active)
+    start_grace_period ();
+  intr_set_level (old_level);
+}
+
+/* A synchronize_rcu() in progress. */
+struct rcu_waiter
+  {
+    struct rcu_head head;
+    struct semaphore done;      /* Up'd by wake_waiter(). */
+  };
+
+static void
+wake_waiter (struct rcu_head *head)
+{
+  sema_up (&rcu_entry (head, struct rcu_waiter, head)->done);
+}
+
+/* Waits until every read-side critical section that is in
+   progress now has ended.  Must not be called from an interrupt
+   handler or in a critical section. */
+void
+synchronize_rcu (void)
+{
+  struct rcu_waiter w;
+
+  ASSERT (!intr_context ());
+  ASSERT (!rcu_read_held ());
+
+  sema_init (&w.done, 0);
+  call_rcu (&w.head, wake_waiter);
+  sema_down (&w.done);
+}
+
+/* Inserts ELEM at the end of LIST, which readers may be walking.
+   The caller must otherwise serialize changes to LIST, as for
+   list_push_back(). */
+void
+rcu_list_push_back (struct list *list, struct list_elem *elem)
+{
+  struct list_elem *tail = list_end (list);
+
+  elem->prev = tail->prev;
+  elem->next = tail;
+  barrier ();
+  tail->prev->next = elem;
+  tail->prev = elem;
+}
+
+/* Notes that the running CPU has passed through a quiescent
+   state, unless the running thread is in a read-side critical
+   section.  Called with interrupts off by thread.c at every
+   thread switch and timer tick. */
+void
+rcu_quiescent (void)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (!gp_active || this_cpu (qs_seq) == gp_seq
+      || thread_current ()->rcu_depth > 0)
+    return;
+  this_cpu (qs_seq) = gp_seq;
+  if (--gp_pending == 0)
+    end_grace_period ();
+}
+
+/* Notes that the running processor, which is just coming online,
+   holds no references, so that a grace period already in
+   progress, which did not count it, does not wait for it
+   either.  Called with interrupts off by cpu_ap_main(). */
+void
+rcu_cpu_online (void)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  this_cpu (qs_seq) = gp_seq;
+}
+
+/* Returns true if the running thread may be preempted.  If it is
+   in a read-side critical section, returns false instead and has
+   rcu_read_unlock() yield at the end of the section. */
+bool
+rcu_may_preempt (void)
+{
+  struct thread *t = thread_current ();
+
+  if (t->rcu_depth == 0)
+    return true;
+  t->rcu_preempt_pending = true;
+  return false;
+}
+
+/* Begins a grace period for the callbacks in NEXT_CBS. */
+static void
+start_grace_period (void)
+{
+  size_t i;
+
+  ASSERT (!gp_active);
+
+  gp_seq++;
+  gp_pending = 0;
+  for (i = 0; i < cpu_cnt; i++)
+    if (cpus[i].online)
+      gp_pending++;
+  list_splice (list_end (&wait_cbs),
+               list_begin (&next_cbs), list_end (&next_cbs));
+  gp_active = true;
+}
+
+/* Ends the current grace period, hands its callbacks to the
+   "rcu" thread, and begins another if callbacks are waiting. */
+static void
+end_grace_period (void)
+{
+  list_splice (list_end (&done_cbs),
+               list_begin (&wait_cbs), list_end (&wait_cbs));
+  gp_active = false;
+  if (worker_blocked)
+    {
+      worker_blocked = false;
+      thread_unblock (worker);
+    }
+  if (!list_empty (&next_cbs))
+    start_grace_period ();
+}
+
+/* The "rcu" thread.  Calls the callbacks in DONE_CBS, in the
+   order they were queued. */
+static void
+run_callbacks (void *started)
+{
+  worker = thread_current ();
+  sema_up (started);
+
+  for (;;)
+    {
+      enum intr_level old_level = intr_disable ();
+      struct rcu_head *head;
+
+      while (list_empty (&done_cbs))
+        {
+          worker_blocked = true;
+          thread_block ();
+        }
+      head = list_entry (list_pop_front (&done_cbs), struct rcu_head, elem);
+      intr_set_level (old_level);
+
+      head->func (head);
+    }
+}
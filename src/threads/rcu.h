@@ -0,0 +1,45 @@
+#ifndef THREADS_RCU_H
+#define THREADS_RCU_H
+
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Read-copy update.  See rcu.c for how to use it. */
+
+struct rcu_head;
+typedef void rcu_func (struct rcu_head *);
+
+/* An object waiting, with call_rcu(), for the readers that might
+   still see it to finish.  Embed one in the object, and convert
+   back with rcu_entry(), as with struct list_elem. */
+struct rcu_head
+  {
+    struct list_elem elem;      /* Element in a callback list. */
+    rcu_func *func;             /* Function to call. */
+  };
+
+/* Converts pointer to rcu_head RCU_HEAD into a pointer to the
+   structure that RCU_HEAD is embedded inside. */
+#define rcu_entry(RCU_HEAD, STRUCT, MEMBER)                     \
+        ((STRUCT *) ((uint8_t *) (RCU_HEAD)                     \
+                     - offsetof (STRUCT, MEMBER)))
+
+void rcu_init (void);
+
+void rcu_read_lock (void);
+void rcu_read_unlock (void);
+bool rcu_read_held (void);
+
+void call_rcu (struct rcu_head *, rcu_func *);
+void synchronize_rcu (void);
+
+void rcu_list_push_back (struct list *, struct list_elem *);
+
+/* For thread.c and cpu.c. */
+void rcu_quiescent (void);
+bool rcu_may_preempt (void);
+void rcu_cpu_online (void);
+
+#endif /* threads/rcu.h */
@@ -0,0 +1,228 @@
+#include "threads/sched.h"
+#include <debug.h>
+#include <rbtree.h>
+#include "threads/cpu.h"
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+
+/* Completely fair scheduling class, after Linux's CFS.
+
+   Each ready thread is kept in a red-black tree ordered by its
+   virtual runtime, the timer ticks it has run, each scaled by
+   NICE_0_WEIGHT divided by the thread's weight.  The weight falls
+   by about 25% per nice level.  The leftmost thread, the one that
+   has received the least weighted CPU time, runs next, so each
+   CPU-bound thread gets a share of the CPU in proportion to its
+   weight, however many threads come and go around it.  Priorities
+   are ignored.
+
+   Virtual runtimes are in units of 1/VRUNTIME_TICK of a tick at
+   nice 0.  MIN_VRUNTIME follows the smallest virtual runtime of
+   any runnable thread and never decreases.  A thread that wakes
+   up is placed no further back than MIN_VRUNTIME minus half a
+   time slice: enough credit for having slept that interactive
+   threads run promptly, but not so much that a thread that slept
+   for a long time can monopolize the CPU to catch up.
+
+   Each processor has its own tree and MIN_VRUNTIME.  A thread
+   that moves to another processor keeps its place relative to
+   its old processor's MIN_VRUNTIME. */
+
+#define NICE_0_WEIGHT 1024
+#define VRUNTIME_TICK 1024
+
+/* Weights for nice values -20 through 20.  These are Linux's,
+   extended by one more level for nice 20. */
+#define NICE_LOW -20
+#define NICE_HIGH 20
+static const int nice_weights[NICE_HIGH - NICE_LOW + 1] =
+  {
+    /* -20 */ 88761, 71755, 56483, 46273, 36291,
+    /* -15 */ 29154, 23254, 18705, 14949, 11916,
+    /* -10 */ 9548, 7620, 6100, 4904, 3906,
+    /*  -5 */ 3121, 2501, 1991, 1586, 1277,
+    /*   0 */ 1024, 820, 655, 526, 423,
+    /*   5 */ 335, 272, 215, 172, 137,
+    /*  10 */ 110, 87, 70, 56, 45,
+    /*  15 */ 36, 29, 23, 18, 15,
+    /*  20 */ 12,
+  };
+
+/* A woken thread preempts the running thread only if it is
+   behind by more than this much virtual runtime, so that
+   threads that wake each other up do not switch on every wakeup. */
+#define WAKEUP_GRANULARITY VRUNTIME_TICK
+
+/* A processor's run queue.  The bootstrap processor's is static
+   and cfs_init() allocates the others'. */
+struct cfs_rq
+  {
+    struct rb_tree tree;
+    int64_t min_vruntime;
+  };
+static struct cfs_rq boot_rq;
+static struct cfs_rq *rqs[CPU_MAX];
+
+static rb_less_func vruntime_less;
+
+static struct cfs_rq *
+rq_of (const struct cpu *c)
+{
+  return rqs[c - cpus];
+}
+
+static struct thread *
+leftmost (struct cfs_rq *rq)
+{
+  struct rb_node *n = rb_first (&rq->tree);
+  return n != NULL ? rb_entry (n, struct thread, sched_node) : NULL;
+}
+
+/* Raises RQ's MIN_VRUNTIME to the smaller of the virtual runtimes
+   of the running thread CUR and the leftmost ready thread. */
+static void
+update_min_vruntime (struct cfs_rq *rq, const struct thread *cur)
+{
+  struct thread *first = leftmost (rq);
+  int64_t vruntime = cur->vruntime;
+
+  if (first != NULL && first->vruntime < vruntime)
+    vruntime = first->vruntime;
+  if (vruntime > rq->min_vruntime)
+    rq->min_vruntime = vruntime;
+}
+
+static bool
+cfs_init (struct cpu *c)
+{
+  struct cfs_rq *rq = c->bsp ? &boot_rq : malloc (sizeof *rq);
+
+  if (rq == NULL)
+    return false;
+  rb_init (&rq->tree, vruntime_less, NULL);
+  rq->min_vruntime = 0;
+  rqs[c - cpus] = rq;
+  return true;
+}
+
+static void
+cfs_enqueue (struct thread *t)
+{
+  struct cfs_rq *rq = rq_of (t->cpu);
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (t->status == THREAD_BLOCKED)
+    {
+      int64_t floor = (rq->min_vruntime
+                       - (int64_t) thread_slice * VRUNTIME_TICK / 2);
+      if (t->vruntime < floor)
+        t->vruntime = floor;
+    }
+  rb_insert (&rq->tree, &t->sched_node);
+}
+
+static void
+cfs_dequeue (struct thread *t)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  rb_erase (&rq_of (t->cpu)->tree, &t->sched_node);
+}
+
+static struct thread *
+cfs_pick_next (struct cpu *c)
+{
+  struct cfs_rq *rq = rq_of (c);
+  struct thread *t = leftmost (rq);
+
+  if (t != NULL)
+    {
+      rb_erase (&rq->tree, &t->sched_node);
+      if (t->vruntime > rq->min_vruntime)
+        rq->min_vruntime = t->vruntime;
+    }
+  return t;
+}
+
+/* Removes and returns the migratable thread furthest behind on
+   C's run queue. */
+static struct thread *
+cfs_steal (struct cpu *c)
+{
+  struct cfs_rq *rq = rq_of (c);
+  struct rb_node *n;
+
+  for (n = rb_first (&rq->tree); n != NULL; n = rb_next (n))
+    {
+      struct thread *t = rb_entry (n, struct thread, sched_node);
+
+      if (thread_migratable (t))
+        {
+          rb_erase (&rq->tree, n);
+          return t;
+        }
+    }
+  return NULL;
+}
+
+/* Charges the running thread T for one tick and preempts it once
+   it has run for a full time slice and is no longer the thread
+   furthest behind. */
+static bool
+cfs_tick (struct thread *t, unsigned ticks_run)
+{
+  struct thread *first;
+  int nice = t->nice;
+
+  if (nice < NICE_LOW)
+    nice = NICE_LOW;
+  else if (nice > NICE_HIGH)
+    nice = NICE_HIGH;
+  t->vruntime += VRUNTIME_TICK * NICE_0_WEIGHT / nice_weights[nice - NICE_LOW];
+  update_min_vruntime (rq_of (t->cpu), t);
+
+  first = leftmost (rq_of (t->cpu));
+  return (first != NULL && ticks_run >= thread_slice
+          && first->vruntime < t->vruntime);
+}
+
+static bool
+cfs_yield_check (struct thread *t)
+{
+  struct thread *first = leftmost (rq_of (t->cpu));
+  return first != NULL && first->vruntime + WAKEUP_GRANULARITY < t->vruntime;
+}
+
+/* Rebases T's virtual runtime from its old processor's
+   MIN_VRUNTIME to TO's. */
+static void
+cfs_migrate (struct thread *t, struct cpu *to)
+{
+  t->vruntime += rq_of (to)->min_vruntime - rq_of (t->cpu)->min_vruntime;
+}
+
+const struct sched_class sched_cfs =
+  {
+    "cfs",
+    cfs_init,
+    cfs_enqueue,
+    cfs_dequeue,
+    cfs_pick_next,
+    cfs_steal,
+    cfs_tick,
+    cfs_yield_check,
+    cfs_migrate
+  };
+
+/* Orders threads by virtual runtime. */
+static bool
+vruntime_less (const struct rb_node *a_, const struct rb_node *b_,
+               void *aux UNUSED)
+{
+  const struct thread *a = rb_entry (a_, struct thread, sched_node);
+  const struct thread *b = rb_entry (b_, struct thread, sched_node);
+
+  return a->vruntime < b->vruntime;
+}
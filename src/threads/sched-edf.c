@@ -0,0 +1,258 @@
+#include "threads/sched.h"
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include <stdio.h>
+#include "devices/timer.h"
+#include "threads/cpu.h"
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+
+/* Earliest-deadline-first scheduling class, for periodic
+   real-time threads.
+
+   A thread joins the class with thread_set_deadline(), which
+   gives it a period, a budget of CPU ticks per period, and a
+   deadline relative to the start of each period.  Each period
+   releases a job with a budget of BUDGET ticks that should be
+   done by its deadline; the thread ends the job by calling
+   thread_wait_next_period(), which sleeps until the next release
+   on the timer's absolute sleep queue.  Admission control keeps
+   the sum of the threads' densities, BUDGET / DEADLINE, at most
+   UTIL_MAX, under which EDF meets every deadline of threads that
+   stay within their budgets.
+
+   thread.c runs the ready thread with the earliest absolute
+   deadline ahead of every thread of the best-effort class chosen
+   at boot, so priorities, nice values and priority donation play
+   no part in choosing among EDF threads, and a release preempts
+   a best-effort thread by the next timer tick.  A job that uses
+   up its budget finishes as a best-effort thread, so that an
+   overrunning thread cannot starve the rest of the system; the
+   next job gets a fresh budget.
+
+   EDF threads wait, ordered by absolute deadline, in a list for
+   each processor through their `elem' members, which only the
+   best-effort run queues otherwise use for ready threads.
+   Admission control counts the densities of the threads on every
+   processor together. */
+
+/* Densities are in parts per UTIL_SCALE.  Admitted threads may
+   take up to UTIL_MAX of the CPU, leaving the rest for the
+   best-effort class. */
+#define UTIL_SCALE 1000
+#define UTIL_MAX 900
+
+/* Each processor's run queue.  The bootstrap processor's is
+   static and edf_init() allocates the others'. */
+static struct list boot_rq;
+static struct list *rqs[CPU_MAX];
+
+/* Sum of the admitted threads' densities. */
+static int util_sum;
+
+/* Statistics. */
+static unsigned job_cnt;        /* Jobs ended. */
+static unsigned miss_cnt;       /* Jobs that ended after their deadline. */
+static unsigned overrun_cnt;    /* Jobs that used up their budget. */
+
+LIST_DEFINE_ORDERED (edf, struct thread, elem, edf_deadline)
+
+static bool
+edf_init (struct cpu *c)
+{
+  struct list *rq = c->bsp ? &boot_rq : malloc (sizeof *rq);
+
+  if (rq == NULL)
+    return false;
+  list_init (rq);
+  rqs[c - cpus] = rq;
+  return true;
+}
+
+static void
+edf_enqueue (struct thread *t)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  edf_insert_ordered (rqs[t->cpu - cpus], t);
+}
+
+static void
+edf_dequeue (struct thread *t)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  list_remove (&t->elem);
+}
+
+static struct thread *
+edf_pick_next (struct cpu *c)
+{
+  struct list *rq = rqs[c - cpus];
+
+  if (list_empty (rq))
+    return NULL;
+  return list_entry (list_pop_front (rq), struct thread, elem);
+}
+
+/* Returns true if a ready EDF thread on running thread T's
+   processor has an earlier deadline than T. */
+static bool
+earlier_ready (const struct thread *t)
+{
+  struct list *rq = rqs[t->cpu - cpus];
+
+  return (!list_empty (rq)
+          && list_entry (list_front (rq), struct thread,
+                         elem)->edf_deadline < t->edf_deadline);
+}
+
+/* Charges T's job for one tick.  T is preempted by a ready
+   thread with an earlier deadline, or, once its budget is gone,
+   so that it can go on as a best-effort thread. */
+static bool
+edf_tick (struct thread *t, unsigned ticks_run UNUSED)
+{
+  if (--t->edf_left <= 0)
+    {
+      t->edf_throttled = true;
+      overrun_cnt++;
+      return true;
+    }
+  return earlier_ready (t);
+}
+
+static bool
+edf_yield_check (struct thread *t)
+{
+  return earlier_ready (t);
+}
+
+const struct sched_class sched_edf =
+  {
+    "edf",
+    edf_init,
+    edf_enqueue,
+    edf_dequeue,
+    edf_pick_next,
+    NULL,
+    edf_tick,
+    edf_yield_check,
+    NULL
+  };
+
+/* Returns true if T belongs in the EDF class: it has a deadline
+   and the current job still has budget left. */
+bool
+sched_edf_member (const struct thread *t)
+{
+  return t->edf_period != 0 && !t->edf_throttled;
+}
+
+/* Returns true if an EDF thread is ready to run on processor
+   C. */
+bool
+sched_edf_pending (const struct cpu *c)
+{
+  return !list_empty (rqs[c - cpus]);
+}
+
+/* Prints EDF statistics, if any thread has used the class. */
+void
+sched_edf_print_stats (void)
+{
+  if (job_cnt > 0 || overrun_cnt > 0)
+    printf ("Thread: EDF %u jobs, %u missed deadlines, "
+            "%u budget overruns\n", job_cnt, miss_cnt, overrun_cnt);
+}
+
+/* Makes the running thread a periodic real-time thread that is
+   released every PERIOD ticks, starting now, for a job of up to
+   BUDGET ticks of CPU time that is due DEADLINE ticks after its
+   release.  0 < BUDGET <= DEADLINE <= PERIOD is required.  Calling
+   it again changes the parameters, starting a new job now.
+   Returns false, leaving the thread as it was, if the parameters
+   are invalid or the thread's density BUDGET / DEADLINE would
+   take the admitted threads past UTIL_MAX.
+
+   With PERIOD 0, returns the thread to the best-effort class
+   instead.  thread_exit() does that for a thread that has not. */
+bool
+thread_set_deadline (int64_t period, int64_t budget, int64_t deadline)
+{
+  struct thread *t = thread_current ();
+  enum intr_level old_level;
+  int util;
+
+  if (period == 0)
+    {
+      old_level = intr_disable ();
+      util_sum -= t->edf_util;
+      t->edf_util = 0;
+      t->edf_period = 0;
+      t->edf_throttled = false;
+      intr_set_level (old_level);
+      return true;
+    }
+  if (budget <= 0 || budget > deadline || deadline > period)
+    return false;
+
+  util = DIV_ROUND_UP (budget * UTIL_SCALE, deadline);
+  old_level = intr_disable ();
+  if (util_sum - t->edf_util + util > UTIL_MAX)
+    {
+      intr_set_level (old_level);
+      return false;
+    }
+  util_sum += util - t->edf_util;
+  t->edf_util = util;
+  t->edf_period = period;
+  t->edf_rel_deadline = deadline;
+  t->edf_budget = budget;
+  t->edf_release = timer_ticks ();
+  t->edf_deadline = t->edf_release + deadline;
+  t->edf_left = budget;
+  t->edf_throttled = false;
+  intr_set_level (old_level);
+
+  /* A ready EDF thread may be due sooner. */
+  check_thread_yield ();
+  return true;
+}
+
+/* Ends the running EDF thread's current job and sleeps until its
+   next release.  If the thread is late by a period or more, the
+   releases it missed are skipped, as periodic_timer_wait() does,
+   and the next job starts at once.  Returns true if the job that
+   ended met its deadline. */
+bool
+thread_wait_next_period (void)
+{
+  struct thread *t = thread_current ();
+  enum intr_level old_level;
+  int64_t now, next;
+  bool made;
+
+  ASSERT (t->edf_period != 0);
+
+  old_level = intr_disable ();
+  now = timer_ticks ();
+  made = now <= t->edf_deadline;
+  job_cnt++;
+  if (!made)
+    miss_cnt++;
+
+  next = t->edf_release + t->edf_period;
+  if (next < now)
+    next += (now - next) / t->edf_period * t->edf_period;
+  t->edf_release = next;
+  t->edf_deadline = next + t->edf_rel_deadline;
+  t->edf_left = t->edf_budget;
+  t->edf_throttled = false;
+  intr_set_level (old_level);
+
+  timer_sleep_until (next);
+  return made;
+}
@@ -0,0 +1,81 @@
+#ifndef THREADS_SCHED_H
+#define THREADS_SCHED_H
+
+#include <stdbool.h>
+
+struct cpu;
+struct thread;
+
+/* A scheduling class: the policy half of the scheduler.
+
+   thread.c owns the mechanism (thread states, context switches,
+   the idle thread, statistics) and calls into the class selected
+   at boot for each decision about which ready thread runs next.
+   Every hook runs with interrupts off.
+
+   The idle threads are never given to a class.  Each class keeps
+   its own run queue of the remaining ready threads for each
+   processor, and a ready thread T is on the run queue of
+   processor T->cpu; thread.c keeps only each processor's count
+   and chooses the processor. */
+struct sched_class
+  {
+    const char *name;           /* Name, for statistics. */
+
+    /* Initializes processor C's run queue.  Called by
+       thread_init() for the bootstrap processor and by
+       thread_cpu_init() for each other processor before it
+       starts.  Returns false if memory runs out, which cannot
+       happen for the bootstrap processor. */
+    bool (*init) (struct cpu *c);
+
+    /* Adds ready thread T to T->cpu's run queue.  T's status says
+       why: THREAD_BLOCKED if it is waking up or new,
+       THREAD_RUNNING if it is giving up the CPU, or THREAD_READY
+       if it is being requeued by dequeue() and enqueue() after a
+       priority change. */
+    void (*enqueue) (struct thread *t);
+
+    /* Removes ready thread T from the run queue. */
+    void (*dequeue) (struct thread *t);
+
+    /* Removes and returns the thread to run next on processor C,
+       or returns a null pointer if C's run queue is empty. */
+    struct thread *(*pick_next) (struct cpu *c);
+
+    /* Removes and returns the thread that would run first on
+       processor C among those that thread_migratable() lets move
+       to another processor, or returns a null pointer if there is
+       none.  thread.c calls it to hand work from a busy processor
+       to an idle one.  May be a null pointer if the class never
+       gives threads up. */
+    struct thread *(*steal) (struct cpu *c);
+
+    /* Called from the timer interrupt for the running thread T,
+       other than the idle thread, which has now run for TICKS_RUN
+       ticks since it was last scheduled.  Returns true if T
+       should be preempted. */
+    bool (*tick) (struct thread *t, unsigned ticks_run);
+
+    /* Returns true if the running thread T, other than the idle
+       thread, should yield to a ready thread right away, as after
+       waking a thread that it ought not to run ahead of. */
+    bool (*yield_check) (struct thread *t);
+
+    /* Called before waking thread T moves from processor T->cpu to
+       processor TO, to carry T's scheduling state over.  May be
+       a null pointer if the state does not depend on the
+       processor. */
+    void (*migrate) (struct thread *t, struct cpu *to);
+  };
+
+extern const struct sched_class sched_cfs;
+
+/* The EDF class for real-time threads, which thread.c runs ahead
+   of the class selected at boot.  See sched-edf.c. */
+extern const struct sched_class sched_edf;
+bool sched_edf_member (const struct thread *);
+bool sched_edf_pending (const struct cpu *);
+void sched_edf_print_stats (void);
+
+#endif /* threads/sched.h */
@@ -0,0 +1,325 @@
+#include "threads/slab.h"
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* A slab allocator for fixed-size kernel objects.
+
+   malloc() rounds every request up to a power of 2, so an object
+   just over a power of 2 in size wastes almost half of its
+   block.  An object cache instead carves pages obtained from the
+   page allocator, called "slabs", into objects of exactly the
+   cache's size (rounded up to a word).
+
+   Each slab starts with a header and keeps its own list of free
+   objects.  The cache keeps its slabs on two lists: slabs with
+   at least one free object ("partial") and slabs with none
+   ("full").  Allocation takes an object from the first partial
+   slab, creating a new slab if there is none.  When freeing
+   empties a slab, the slab is kept as the cache's single spare,
+   and any older spare is returned to the page allocator, so a
+   cache that oscillates around a slab boundary does not call
+   palloc on every allocation.  When the kernel pool runs low,
+   the page allocator takes the spares back (see
+   kmem_cache_shrink()).  A cache's lock is not held while it
+   allocates a slab, so that a cache's owner may free objects to
+   it while reclaiming memory for that very allocation.
+
+   If a constructor is given, kmem_cache_alloc() runs it on each
+   object before handing it out, so callers of a cache always get
+   objects in the same initial state. */
+
+/* Magic number for detecting slab corruption. */
+#define SLAB_MAGIC 0x51ab51ab
+
+/* Object cache. */
+struct kmem_cache
+  {
+    struct list_elem elem;      /* Element in cache_list. */
+    const char *name;           /* Name, for debugging. */
+    size_t obj_size;            /* Size of each object in bytes. */
+    size_t objs_per_slab;       /* Number of objects in a slab. */
+    kmem_ctor_func *ctor;       /* Constructor, or null. */
+    struct fastlock lock;       /* Protects the members below. */
+    struct list partial;        /* Slabs with some free objects. */
+    struct list full;           /* Slabs with no free objects. */
+    struct slab *spare;         /* Empty slab kept for reuse. */
+    size_t slab_cnt;            /* Number of slabs, including spare. */
+    size_t alloc_cnt;           /* Number of allocated objects. */
+  };
+
+/* Slab header, at the start of each slab's page. */
+struct slab
+  {
+    unsigned magic;             /* Always set to SLAB_MAGIC. */
+    struct kmem_cache *cache;   /* Owning cache. */
+    struct list_elem elem;      /* Element in partial or full list. */
+    size_t free_cnt;            /* Number of free objects. */
+    void *free;                 /* First free object, or null. */
+  };
+
+/* All caches, for kmem_cache_print_stats(). */
+static struct list cache_list = LIST_INITIALIZER (cache_list);
+
+/* Gives spare slabs back to the page allocator. */
+static struct shrinker spare_shrinker;
+
+static struct slab *slab_create (struct kmem_cache *);
+static struct slab *object_to_slab (struct kmem_cache *, void *);
+static shrink_func shrink_spares;
+
+/* Initializes the slab allocator. */
+void
+kmem_cache_init (void)
+{
+  palloc_register_shrinker (&spare_shrinker, "slab spares", shrink_spares);
+}
+
+/* Returns a new cache named NAME of objects SIZE bytes long,
+   which must fit in one page along with a slab header.  If CTOR
+   is non-null, it is called on each object that
+   kmem_cache_alloc() returns.  Returns a null pointer if memory is not
+   available. */
+struct kmem_cache *
+kmem_cache_create (const char *name, size_t size, kmem_ctor_func *ctor)
+{
+  struct kmem_cache *c;
+
+  ASSERT (name != NULL);
+  ASSERT (size > 0);
+
+  /* Each free object holds the free list's next pointer. */
+  size = ROUND_UP (size, sizeof (void *));
+  ASSERT (size <= PGSIZE - sizeof (struct slab));
+
+  c = malloc (sizeof *c);
+  if (c == NULL)
+    return NULL;
+
+  c->name = name;
+  c->obj_size = size;
+  c->objs_per_slab = (PGSIZE - sizeof (struct slab)) / size;
+  c->ctor = ctor;
+  fastlock_init (&c->lock);
+  list_init (&c->partial);
+  list_init (&c->full);
+  c->spare = NULL;
+  c->slab_cnt = 0;
+  c->alloc_cnt = 0;
+  list_push_back (&cache_list, &c->elem);
+  return c;
+}
+
+/* Destroys cache C, returning its slabs to the page allocator.
+   Every object allocated from C must already have been freed. */
+void
+kmem_cache_destroy (struct kmem_cache *c)
+{
+  if (c == NULL)
+    return;
+
+  ASSERT (c->alloc_cnt == 0);
+  ASSERT (list_empty (&c->full));
+  while (!list_empty (&c->partial))
+    palloc_free_page (list_entry (list_pop_front (&c->partial),
+                                  struct slab, elem));
+  if (c->spare != NULL)
+    palloc_free_page (c->spare);
+  list_remove (&c->elem);
+  free (c);
+}
+
+/* Obtains and returns an object from cache C.  Returns a null
+   pointer if memory is not available. */
+void *
+kmem_cache_alloc (struct kmem_cache *c)
+{
+  struct slab *s;
+  void *obj;
+
+  ASSERT (c != NULL);
+
+  fastlock_acquire (&c->lock);
+  if (list_empty (&c->partial))
+    {
+      if (c->spare != NULL)
+        {
+          s = c->spare;
+          c->spare = NULL;
+        }
+      else
+        {
+          fastlock_release (&c->lock);
+          s = slab_create (c);
+          if (s == NULL)
+            return NULL;
+          fastlock_acquire (&c->lock);
+          c->slab_cnt++;
+        }
+      list_push_front (&c->partial, &s->elem);
+    }
+
+  /* Take the first free object of the first partial slab. */
+  s = list_entry (list_front (&c->partial), struct slab, elem);
+  obj = s->free;
+  s->free = *(void **) obj;
+  if (--s->free_cnt == 0)
+    {
+      list_remove (&s->elem);
+      list_push_back (&c->full, &s->elem);
+    }
+  c->alloc_cnt++;
+  fastlock_release (&c->lock);
+
+  if (c->ctor != NULL)
+    c->ctor (obj);
+  return obj;
+}
+
+/* Returns object OBJ, which must have been allocated from cache
+   C, to C.  Does nothing if OBJ is null. */
+void
+kmem_cache_free (struct kmem_cache *c, void *obj)
+{
+  struct slab *s;
+
+  ASSERT (c != NULL);
+  if (obj == NULL)
+    return;
+
+  s = object_to_slab (c, obj);
+
+#ifndef NDEBUG
+  /* Clear the object to help detect use-after-free bugs. */
+  memset (obj, 0xcc, c->obj_size);
+#endif
+
+  fastlock_acquire (&c->lock);
+  *(void **) obj = s->free;
+  s->free = obj;
+  c->alloc_cnt--;
+  if (s->free_cnt++ == 0)
+    {
+      /* Full slab becomes partial. */
+      list_remove (&s->elem);
+      list_push_front (&c->partial, &s->elem);
+    }
+  if (s->free_cnt == c->objs_per_slab)
+    {
+      /* Empty slab becomes the spare, replacing any older one. */
+      list_remove (&s->elem);
+      if (c->spare != NULL)
+        {
+          palloc_free_page (c->spare);
+          c->slab_cnt--;
+        }
+      c->spare = s;
+    }
+  fastlock_release (&c->lock);
+}
+
+/* Returns cache C's spare slab, if it has one, to the page
+   allocator, and returns the number of pages freed.  Frees
+   nothing if C is in use, so that it may be called while
+   reclaiming memory. */
+size_t
+kmem_cache_shrink (struct kmem_cache *c)
+{
+  struct slab *spare;
+
+  ASSERT (c != NULL);
+
+  if (fastlock_held_by_current_thread (&c->lock)
+      || !fastlock_try_acquire (&c->lock))
+    return 0;
+  spare = c->spare;
+  if (spare != NULL)
+    {
+      c->spare = NULL;
+      c->slab_cnt--;
+    }
+  fastlock_release (&c->lock);
+
+  if (spare == NULL)
+    return 0;
+  palloc_free_page (spare);
+  return 1;
+}
+
+/* Frees up to PAGE_CNT spare slabs, for the page allocator. */
+static size_t
+shrink_spares (size_t page_cnt)
+{
+  struct list_elem *e;
+  size_t freed = 0;
+
+  for (e = list_begin (&cache_list);
+       e != list_end (&cache_list) && freed < page_cnt; e = list_next (e))
+    freed += kmem_cache_shrink (list_entry (e, struct kmem_cache, elem));
+  return freed;
+}
+
+/* Prints memory usage of every cache. */
+void
+kmem_cache_print_stats (void)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&cache_list); e != list_end (&cache_list);
+       e = list_next (e))
+    {
+      struct kmem_cache *c = list_entry (e, struct kmem_cache, elem);
+      printf ("Slab: %s: %zu objects of %zu bytes in use, %zu slabs\n",
+              c->name, c->alloc_cnt, c->obj_size, c->slab_cnt);
+    }
+}
+
+/* Allocates a new slab for cache C and threads all of its
+   objects onto its free list.  Returns a null pointer if no page
+   is available.  C's lock need not be held. */
+static struct slab *
+slab_create (struct kmem_cache *c)
+{
+  struct slab *s;
+  uint8_t *obj;
+  size_t i;
+
+  s = palloc_get_page (0);
+  if (s == NULL)
+    return NULL;
+
+  s->magic = SLAB_MAGIC;
+  s->cache = c;
+  s->free_cnt = c->objs_per_slab;
+  s->free = NULL;
+
+  /* Thread in reverse so that objects are handed out in address
+     order. */
+  obj = (uint8_t *) (s + 1) + c->objs_per_slab * c->obj_size;
+  for (i = 0; i < c->objs_per_slab; i++)
+    {
+      obj -= c->obj_size;
+      *(void **) obj = s->free;
+      s->free = obj;
+    }
+  return s;
+}
+
+/* Returns the slab that OBJ, an object from cache C, is in. */
+static struct slab *
+object_to_slab (struct kmem_cache *c, void *obj)
+{
+  struct slab *s = pg_round_down (obj);
+
+  ASSERT (s->magic == SLAB_MAGIC);
+  ASSERT (s->cache == c);
+  ASSERT (((uint8_t *) obj - (uint8_t *) (s + 1)) % c->obj_size == 0);
+  return s;
+}
@@ -0,0 +1,21 @@
+#ifndef THREADS_SLAB_H
+#define THREADS_SLAB_H
+
+#include <stddef.h>
+
+/* Object cache.  Opaque; see slab.c. */
+struct kmem_cache;
+
+/* Constructor for objects in a cache. */
+typedef void kmem_ctor_func (void *object);
+
+void kmem_cache_init (void);
+struct kmem_cache *kmem_cache_create (const char *name, size_t size,
+                                      kmem_ctor_func *);
+void kmem_cache_destroy (struct kmem_cache *);
+void *kmem_cache_alloc (struct kmem_cache *);
+void kmem_cache_free (struct kmem_cache *, void *);
+size_t kmem_cache_shrink (struct kmem_cache *);
+void kmem_cache_print_stats (void);
+
+#endif /* threads/slab.h */
@@ -0,0 +1,499 @@
+#include "threads/snapshot.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <hash.h>
+#include <inttypes.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "devices/serial.h"
+#include "devices/timer.h"
+#include "threads/cpu.h"
+#include "threads/interrupt.h"
+#include "threads/loader.h"
+#include "threads/palloc.h"
+#include "threads/pte.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#ifdef USERPROG
+#include "userprog/gdt.h"
+#include "userprog/sysenter.h"
+#endif
+
+/* Snapshots of the running kernel, for warm restarts.
+
+   snapshot_save(), run by the "snapshot" action, writes every
+   page of RAM that the kernel may have written to the scratch
+   device, with interrupts off, and then lets the kernel go on.
+   A later boot of the same kernel binary with "-resume" calls
+   snapshot_restore(), which reads those pages back over its own
+   memory and jumps into the middle of snapshot_save(), so that
+   the kernel that took the snapshot picks up where it was, with
+   its threads, processes, page tables and buffer cache, and goes
+   on to the actions after "snapshot".
+
+   Free pages are left out of the image, and so is the kernel's
+   text, which is read-only and loaded unchanged by every boot.
+   Everything else, which is the kernel's data and BSS, the
+   loader's pages below them, and every allocated page, is saved
+   whole.
+
+   Restoring cannot simply read each page into place, because the
+   place may be in use by the kernel that is restoring.  Pages it
+   obtains from the page allocator are its own to overwrite: an
+   image page whose place is one of them is read there directly,
+   and any other into one that is not a place, a "safe" page, to
+   be copied into place at the very end by restore_pages().  That
+   runs on a safe stack, with safe page tables, and uses nothing
+   else.
+
+   Besides memory, the CPU and devices are left as the booting
+   kernel set them up.  That matches what the saved kernel
+   expects, because it is the same kernel, apart from a few CPU
+   registers that snapshot_save() sets again when it resumes and
+   block devices that were busy, which block_write_polled()
+   refuses to run alongside.  The file system and swap disks must
+   be as they were when the snapshot was taken, or the resumed
+   kernel's buffer cache and swap slots would disagree with them.
+   The local APIC timer's pending one-shot, if any, is not saved:
+   with "-tickless", the resumed kernel's first tick may be
+   late. */
+
+/* Identifies a snapshot header. */
+#define SNAPSHOT_MAGIC 0x50414e53       /* "SNAP". */
+
+/* Sector 0 of the scratch device.  Sectors 1 onward hold the
+   page frame numbers of the saved pages, in ascending order, as
+   uint32_t's, and then the pages themselves, in the same order,
+   PAGE_SECTORS sectors each. */
+struct snapshot_header
+  {
+    uint32_t magic;             /* SNAPSHOT_MAGIC. */
+    uint32_t kernel_sum;        /* kernel_sum() of the saving kernel. */
+    uint32_t ram_pages;         /* init_ram_pages at the time. */
+    uint32_t page_cnt;          /* Number of pages saved. */
+    uint64_t tsc;               /* Time-stamp counter at the time. */
+    uint32_t cr3;               /* Page directory in use. */
+    void *jump[5];              /* For __builtin_longjmp(). */
+  };
+
+/* Sectors per page. */
+#define PAGE_SECTORS (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* Most pages that snapshot_save() writes at once. */
+#define RUN_PAGES 32
+
+/* Time-stamp counter model-specific register. */
+#define MSR_TSC 0x10
+
+/* CR4 control bit to enable global pages. */
+#define CR4_PGE (1 << 7)
+
+/* A page for restore_pages() to copy into place. */
+struct copy
+  {
+    const void *src;            /* Safe page holding the data. */
+    void *dst;                  /* Its place. */
+  };
+
+/* A safe page full of copies. */
+struct copy_chunk
+  {
+    struct copy_chunk *next;
+    size_t cnt;
+    struct copy copies[];
+  };
+
+#define COPIES_PER_PAGE \
+        ((PGSIZE - sizeof (struct copy_chunk)) / sizeof (struct copy))
+
+/* What restore_pages() needs, at the bottom of its safe stack. */
+struct restore
+  {
+    uint32_t pd;                /* Physical address of safe page dir. */
+    struct copy_chunk *chunks;  /* Copies to make. */
+    void *jump[5];              /* From the snapshot header. */
+  };
+
+static bool page_saved (size_t pfn);
+static bool page_restorable (size_t pfn);
+static unsigned kernel_sum (void);
+static size_t list_sectors (size_t page_cnt);
+static bool write_image (struct block *, struct snapshot_header *,
+                         const uint32_t *pfns);
+static void *take_safe (void **safe);
+static void restore_pages (struct restore *) NO_RETURN NO_INLINE;
+
+/* Writes a snapshot of the running kernel to the scratch device,
+   for a later boot with "-resume" to continue from.  Returns
+   here twice if that happens: once in this boot, once the image
+   is written, with a message saying so, and then in the resumed
+   boot, with a message saying that instead.  Interrupts must be
+   on, and the file system should have just been synced.  The
+   image holds only one processor's state, so this refuses to run
+   with more than one online. */
+void
+snapshot_save (void)
+{
+  struct block *dev = block_get_role (BLOCK_SCRATCH);
+  size_t pfn_pages = DIV_ROUND_UP (init_ram_pages * sizeof (uint32_t),
+                                   PGSIZE);
+  struct snapshot_header *h;
+  uint32_t *pfns;
+  enum intr_level old_level;
+  size_t pfn;
+
+  if (dev == NULL)
+    {
+      printf ("snapshot: no scratch device\n");
+      return;
+    }
+  if (cpu_online_cnt > 1)
+    {
+      printf ("snapshot: more than one processor online\n");
+      return;
+    }
+  h = palloc_get_page (PAL_ZERO);
+  pfns = palloc_get_multiple (0, pfn_pages);
+  if (h == NULL || pfns == NULL)
+    {
+      printf ("snapshot: out of memory\n");
+      goto done;
+    }
+  h->kernel_sum = kernel_sum ();
+  h->ram_pages = init_ram_pages;
+  serial_flush ();
+
+  /* Nothing but this thread may change memory from here until the
+     image is written. */
+  old_level = intr_disable ();
+  for (pfn = 0; pfn < init_ram_pages; pfn++)
+    if (page_saved (pfn))
+      pfns[h->page_cnt++] = pfn;
+  asm volatile ("movl %%cr3, %0" : "=r" (h->cr3));
+  h->tsc = timer_cycles ();
+
+  if (__builtin_setjmp (h->jump) == 0)
+    {
+      bool ok = write_image (dev, h, pfns);
+      intr_set_level (old_level);
+
+      if (ok)
+        {
+          block_flush (dev);
+          printf ("snapshot: saved %"PRIu32" pages to %s\n",
+                  h->page_cnt, block_name (dev));
+        }
+      else
+        printf ("snapshot: could not write to %s\n", block_name (dev));
+    }
+  else
+    {
+      /* restore_pages() jumped here, still on its page tables. */
+      uint32_t cr4;
+
+      asm volatile ("movl %0, %%cr3" : : "r" (h->cr3) : "memory");
+      asm volatile ("movl %%cr4, %0" : "=r" (cr4));
+      if (cr4 & CR4_PGE)
+        {
+          /* Flush the global TLB entries of the restoring kernel,
+             whose guard pages may differ from ours. */
+          asm volatile ("movl %0, %%cr4" : : "r" (cr4 & ~CR4_PGE));
+          asm volatile ("movl %0, %%cr4" : : "r" (cr4) : "memory");
+        }
+      palloc_resume ();
+      asm volatile ("wrmsr" : : "c" (MSR_TSC), "A" (h->tsc));
+#ifdef USERPROG
+      gdt_reload_tss ();
+      sysenter_init ();
+#endif
+      intr_set_level (old_level);
+      printf ("snapshot: resumed %"PRIu32" pages\n", h->page_cnt);
+    }
+
+ done:
+  palloc_free_page (h);
+  palloc_free_multiple (pfns, pfn_pages);
+}
+
+/* Continues from the snapshot on the scratch device, taken by a
+   boot of the same kernel with as much RAM, if there is one.
+   Returns, having changed nothing but the scratch device's
+   statistics, only if there is none or it cannot be restored:
+   otherwise snapshot_save() returns instead, in the snapshot's
+   kernel.  Must be called before anything but the block devices
+   has come to depend on memory being as this boot left it. */
+void
+snapshot_restore (void)
+{
+  struct block *dev = block_get_role (BLOCK_SCRATCH);
+  size_t pfn_pages = DIV_ROUND_UP (init_ram_pages * sizeof (uint32_t),
+                                   PGSIZE);
+  size_t pt_cnt = DIV_ROUND_UP (init_ram_pages,
+                                PGSIZE / sizeof (uint32_t));
+  struct snapshot_header *h = NULL;
+  uint32_t *pfns = NULL;
+  struct bitmap *dest = NULL, *owned = NULL;
+  struct copy_chunk *chunks = NULL;
+  void *safe = NULL;
+  size_t safe_cnt = 0, direct = 0;
+  block_sector_t sector;
+  struct restore *r;
+  uint32_t *pd;
+  size_t cnt, i;
+  const char *error;
+
+  if (dev == NULL)
+    {
+      printf ("resume: no scratch device\n");
+      return;
+    }
+  h = palloc_get_page (0);
+  pfns = palloc_get_multiple (0, pfn_pages);
+  dest = bitmap_create (init_ram_pages);
+  owned = bitmap_create (init_ram_pages);
+  error = "out of memory";
+  if (h == NULL || pfns == NULL || dest == NULL || owned == NULL)
+    goto fail;
+  bitmap_set_all (owned, false);
+
+  /* Check the header and the list of pages. */
+  block_read (dev, 0, h);
+  error = "no snapshot of this kernel";
+  if (h->magic != SNAPSHOT_MAGIC || h->ram_pages != init_ram_pages
+      || h->kernel_sum != kernel_sum ())
+    goto fail;
+  cnt = h->page_cnt;
+  sector = 1 + list_sectors (cnt);
+  error = "bad snapshot";
+  if (cnt == 0 || cnt > init_ram_pages
+      || sector + cnt * PAGE_SECTORS > block_size (dev))
+    goto fail;
+  block_read_multiple (dev, 1, list_sectors (cnt), pfns);
+  for (i = 0; i < cnt; i++)
+    {
+      if (!page_restorable (pfns[i]) || (i > 0 && pfns[i] <= pfns[i - 1]))
+        goto fail;
+      bitmap_mark (dest, pfns[i]);
+    }
+
+  /* Take pages until there are enough safe ones for the image
+     pages that cannot be read into place, their copies, and the
+     page directory, page tables and stack of restore_pages(). */
+  error = "not enough memory";
+  while (safe_cnt < ((cnt - direct) + DIV_ROUND_UP (cnt - direct,
+                                                     COPIES_PER_PAGE)
+                     + pt_cnt + 2))
+    {
+      void *page = palloc_get_page (PAL_USER);
+      size_t pfn;
+
+      if (page == NULL)
+        page = palloc_get_page (0);
+      if (page == NULL)
+        goto fail;
+      pfn = vtop (page) / PGSIZE;
+      bitmap_mark (owned, pfn);
+      if (bitmap_test (dest, pfn))
+        direct++;
+      else
+        {
+          *(void **) page = safe;
+          safe = page;
+          safe_cnt++;
+        }
+    }
+
+  printf ("resume: reading %zu pages from %s\n", cnt, block_name (dev));
+  for (i = 0; i < cnt; i++, sector += PAGE_SECTORS)
+    {
+      void *dst = ptov (pfns[i] * PGSIZE);
+
+      if (bitmap_test (owned, pfns[i]))
+        block_read_multiple (dev, sector, PAGE_SECTORS, dst);
+      else
+        {
+          void *src = take_safe (&safe);
+
+          block_read_multiple (dev, sector, PAGE_SECTORS, src);
+          if (chunks == NULL || chunks->cnt == COPIES_PER_PAGE)
+            {
+              struct copy_chunk *c = take_safe (&safe);
+              c->next = chunks;
+              c->cnt = 0;
+              chunks = c;
+            }
+          chunks->copies[chunks->cnt].src = src;
+          chunks->copies[chunks->cnt].dst = dst;
+          chunks->cnt++;
+        }
+    }
+
+  /* Map all of RAM, without this kernel's guard pages, which may
+     be where the snapshot has data. */
+  pd = take_safe (&safe);
+  memset (pd, 0, PGSIZE);
+  for (i = 0; i < pt_cnt; i++)
+    {
+      uint32_t *pt = take_safe (&safe);
+      size_t j;
+
+      for (j = 0; j < PGSIZE / sizeof *pt; j++)
+        {
+          size_t pfn = i * (PGSIZE / sizeof *pt) + j;
+          pt[j] = (pfn < init_ram_pages
+                   ? pte_create_kernel (ptov (pfn * PGSIZE), true) : 0);
+        }
+      pd[pd_no (PHYS_BASE) + i] = pde_create (pt);
+    }
+
+  r = take_safe (&safe);
+  r->pd = vtop (pd);
+  r->chunks = chunks;
+  memcpy (r->jump, h->jump, sizeof r->jump);
+
+  serial_flush ();
+  intr_disable ();
+  asm volatile ("movl %0, %%esp; pushl %1; call *%2"
+                : : "r" ((uint8_t *) r + PGSIZE), "r" (r),
+                    "r" (restore_pages)
+                : "memory");
+  NOT_REACHED ();
+
+ fail:
+  printf ("resume: %s on %s, booting normally\n",
+          error, dev != NULL ? block_name (dev) : "");
+  if (owned != NULL)
+    for (i = 0; i < init_ram_pages; i++)
+      if (bitmap_test (owned, i))
+        palloc_free_page (ptov (i * PGSIZE));
+  bitmap_destroy (owned);
+  bitmap_destroy (dest);
+  palloc_free_multiple (pfns, pfn_pages);
+  palloc_free_page (h);
+}
+
+/* Copies the pages listed in R into place and jumps into
+   snapshot_save(), on the stack and page tables that
+   snapshot_restore() set up, none of which is in a place.
+   Touches no other memory, because all of it may be overwritten
+   midway. */
+static void
+restore_pages (struct restore *r)
+{
+  struct copy_chunk *c;
+  size_t i;
+
+  asm volatile ("movl %0, %%cr3" : : "r" (r->pd) : "memory");
+  for (c = r->chunks; c != NULL; c = c->next)
+    for (i = 0; i < c->cnt; i++)
+      memcpy (c->copies[i].dst, c->copies[i].src, PGSIZE);
+  __builtin_longjmp (r->jump, 1);
+}
+
+/* Returns true if page PFN of RAM lies entirely within a usable
+   region of the BIOS memory map, or below the video memory if
+   there is no map. */
+static bool
+page_is_ram (size_t pfn)
+{
+  uint64_t start = (uint64_t) pfn * PGSIZE;
+  uint32_t i;
+
+  if (init_mem_map_cnt == 0)
+    return start < 0xa0000 || start >= 0x100000;
+  for (i = 0; i < init_mem_map_cnt; i++)
+    {
+      const struct mem_map_entry *e = &init_mem_map[i];
+      if (e->type == LOADER_MEM_USABLE && e->base <= start
+          && start + PGSIZE <= e->base + e->length)
+        return true;
+    }
+  return false;
+}
+
+/* Returns true if page PFN of RAM may be in a snapshot: it is
+   RAM, and not kernel text. */
+static bool
+page_restorable (size_t pfn)
+{
+  extern char _start, _end_kernel_text;
+  const char *page;
+
+  if (pfn >= init_ram_pages || !page_is_ram (pfn))
+    return false;
+  page = ptov (pfn * PGSIZE);
+  return page + PGSIZE <= &_start || page >= &_end_kernel_text;
+}
+
+/* Returns true if snapshot_save() should save page PFN: it may
+   be in a snapshot, it is mapped, and it is not free. */
+static bool
+page_saved (size_t pfn)
+{
+  const void *page = ptov (pfn * PGSIZE);
+
+  return (page_restorable (pfn) && !thread_kstack_is_guard (page)
+          && !palloc_page_free (page));
+}
+
+/* Returns a hash of the kernel's text, which a snapshot leaves
+   out, so that it is restored only by the kernel that took it. */
+static unsigned
+kernel_sum (void)
+{
+  extern char _start, _end_kernel_text;
+  return hash_bytes (&_start, &_end_kernel_text - &_start);
+}
+
+/* Returns the number of sectors in the list of PAGE_CNT page
+   frame numbers. */
+static size_t
+list_sectors (size_t page_cnt)
+{
+  return DIV_ROUND_UP (page_cnt * sizeof (uint32_t), BLOCK_SECTOR_SIZE);
+}
+
+/* Writes the image described by H, of the pages listed in PFNS,
+   to DEV.  The header goes last, once the rest is in place, and
+   an old header is first cleared, so that a partial image is
+   never taken for a snapshot.  Interrupts must be off.  Returns
+   true if successful. */
+static bool
+write_image (struct block *dev, struct snapshot_header *h,
+             const uint32_t *pfns)
+{
+  block_sector_t sector = 1 + list_sectors (h->page_cnt);
+  size_t i, run;
+
+  if (sector + h->page_cnt * PAGE_SECTORS > block_size (dev)
+      || !block_write_polled (dev, 0, 1, h)
+      || !block_write_polled (dev, 1, list_sectors (h->page_cnt), pfns))
+    return false;
+  for (i = 0; i < h->page_cnt; i += run)
+    {
+      for (run = 1; (run < RUN_PAGES && i + run < h->page_cnt
+                     && pfns[i + run] == pfns[i] + run); run++)
+        continue;
+      if (!block_write_polled (dev, sector, run * PAGE_SECTORS,
+                               ptov (pfns[i] * PGSIZE)))
+        return false;
+      sector += run * PAGE_SECTORS;
+    }
+
+  h->magic = SNAPSHOT_MAGIC;
+  return block_write_polled (dev, 0, 1, h);
+}
+
+/* Removes and returns a page from the list of safe pages SAFE. */
+static void *
+take_safe (void **safe)
+{
+  void *page = *safe;
+
+  ASSERT (page != NULL);
+  *safe = *(void **) page;
+  return page;
+}
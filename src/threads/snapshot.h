@@ -0,0 +1,7 @@
+#ifndef THREADS_SNAPSHOT_H
+#define THREADS_SNAPSHOT_H
+
+void snapshot_save (void);
+void snapshot_restore (void);
+
+#endif /* threads/snapshot.h */
@@ -0,0 +1,150 @@
+#include "threads/spinlock.h"
+#include <debug.h>
+#include <stddef.h>
+#include "threads/cpu.h"
+
+/* Atomically increments *P and returns its old value. */
+static inline uint16_t
+fetch_and_increment (volatile uint16_t *p)
+{
+  uint16_t old = 1;
+
+  asm volatile ("lock xaddw %0, %1" : "+r" (old), "+m" (*p) : : "memory");
+  return old;
+}
+
+/* Atomically increments *P if it equals OLD.  Returns true if it
+   did. */
+static inline bool
+compare_and_increment (volatile uint16_t *p, uint16_t old)
+{
+  uint16_t new = old + 1;
+  bool done;
+
+  asm volatile ("lock cmpxchgw %3, %1; sete %0"
+                : "=q" (done), "+m" (*p), "+a" (old)
+                : "r" (new) : "memory", "cc");
+  return done;
+}
+
+/* Initializes LOCK, which is named NAME for debugging, as free. */
+void
+spinlock_init (struct spinlock *lock, const char *name)
+{
+  ASSERT (lock != NULL);
+
+  lock->next = 0;
+  lock->serving = 0;
+#ifndef NDEBUG
+  lock->name = name;
+  lock->holder = NULL;
+  lock->acquired_at = NULL;
+#else
+  (void) name;
+#endif
+}
+
+/* Acquires LOCK, spinning until it is available.  Interrupts
+   must be off. */
+void
+spin_lock (struct spinlock *lock)
+{
+  uint16_t ticket;
+
+  ASSERT (lock != NULL);
+  ASSERT (intr_get_level () == INTR_OFF);
+#ifndef NDEBUG
+  if (lock->holder == cpu_current ())
+    PANIC ("spinlock %s acquired again on the CPU holding it, "
+           "first at %p", lock->name, lock->acquired_at);
+#endif
+
+  ticket = fetch_and_increment (&lock->next);
+  while (lock->serving != ticket)
+    asm volatile ("pause" : : : "memory");
+
+#ifndef NDEBUG
+  lock->holder = cpu_current ();
+  lock->acquired_at = __builtin_return_address (0);
+#endif
+}
+
+/* Acquires LOCK if it is free, without waiting, and returns true
+   if successful, or false if another CPU holds it or is waiting
+   for it.  Interrupts must be off. */
+bool
+spin_trylock (struct spinlock *lock)
+{
+  uint16_t ticket;
+
+  ASSERT (lock != NULL);
+  ASSERT (intr_get_level () == INTR_OFF);
+#ifndef NDEBUG
+  if (lock->holder == cpu_current ())
+    PANIC ("spinlock %s acquired again on the CPU holding it, "
+           "first at %p", lock->name, lock->acquired_at);
+#endif
+
+  /* Take a ticket only if it would be served at once, that is,
+     only if NEXT still equals SERVING. */
+  ticket = lock->serving;
+  if (!compare_and_increment (&lock->next, ticket))
+    return false;
+
+#ifndef NDEBUG
+  lock->holder = cpu_current ();
+  lock->acquired_at = __builtin_return_address (0);
+#endif
+  return true;
+}
+
+/* Releases LOCK, which the current CPU must hold. */
+void
+spin_unlock (struct spinlock *lock)
+{
+  ASSERT (spin_lock_held (lock));
+
+#ifndef NDEBUG
+  lock->holder = NULL;
+  lock->acquired_at = NULL;
+#endif
+
+  /* Only the holder writes SERVING, and x86 does not reorder
+     stores with older loads or stores, so a compiler barrier is
+     enough to keep the critical section before the release. */
+  asm volatile ("" : : : "memory");
+  lock->serving++;
+}
+
+/* Disables interrupts, acquires LOCK, and returns the previous
+   interrupt level for spin_unlock_irqrestore(). */
+enum intr_level
+spin_lock_irqsave (struct spinlock *lock)
+{
+  enum intr_level old_level = intr_disable ();
+  spin_lock (lock);
+  return old_level;
+}
+
+/* Releases LOCK and restores interrupt level OLD_LEVEL. */
+void
+spin_unlock_irqrestore (struct spinlock *lock, enum intr_level old_level)
+{
+  spin_unlock (lock);
+  intr_set_level (old_level);
+}
+
+/* Returns true if the current CPU holds LOCK.  Without debugging
+   information, returns true if any CPU holds it.  Meant for
+   assertions. */
+bool
+spin_lock_held (const struct spinlock *lock)
+{
+  ASSERT (lock != NULL);
+
+#ifndef NDEBUG
+  return lock->holder == cpu_current ();
+#else
+  return lock->next != lock->serving;
+#endif
+}
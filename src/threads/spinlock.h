@@ -0,0 +1,45 @@
+#ifndef THREADS_SPINLOCK_H
+#define THREADS_SPINLOCK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "threads/interrupt.h"
+
+/* Ticket spinlock.
+
+   A spinlock excludes other processors, where disabling
+   interrupts excludes only other code on the same processor, so
+   it is the primitive for data that more than one CPU may touch.
+   A waiter takes the next ticket and spins until the lock is
+   serving it, so waiters get the lock in the order they arrived.
+
+   A spinlock is held with interrupts off, or an interrupt
+   handler that wanted the same lock could spin forever, and it
+   must not be held across anything that sleeps.  Use
+   spin_lock_irqsave(), which disables interrupts, unless they
+   are already off.
+
+   In kernels built without NDEBUG, each lock also records its
+   name, the CPU holding it and where it was acquired, so that
+   taking a lock twice on one CPU, the uniprocessor form of
+   deadlock, panics at once instead of spinning forever. */
+struct spinlock
+  {
+    volatile uint16_t next;     /* Next ticket to hand out. */
+    volatile uint16_t serving;  /* Ticket allowed to hold the lock. */
+#ifndef NDEBUG
+    const char *name;           /* Name, for debugging. */
+    struct cpu *holder;         /* CPU holding the lock, or null. */
+    void *acquired_at;          /* Where the holder acquired it. */
+#endif
+  };
+
+void spinlock_init (struct spinlock *, const char *name);
+void spin_lock (struct spinlock *);
+bool spin_trylock (struct spinlock *);
+void spin_unlock (struct spinlock *);
+enum intr_level spin_lock_irqsave (struct spinlock *);
+void spin_unlock_irqrestore (struct spinlock *, enum intr_level);
+bool spin_lock_held (const struct spinlock *);
+
+#endif /* threads/spinlock.h */
@@ -27,10 +27,33 @@
 */
 
 #include "threads/synch.h"
+#include <inttypes.h>
+#include <limits.h>
 #include <stdio.h>
 #include <string.h>
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#include "threads/trace.h"
+#include "devices/timer.h"
+
+static void donate_priority(struct lock *);
+static bool compare_waiters(const struct pheap_elem *, const struct pheap_elem *, void *);
+static unsigned take_wait_seq(void);
+static void sema_wake(struct semaphore *);
+static void record_acquire(struct sync_stats *, uint64_t wait_start);
+static void record_wait(struct sync_stats *, uint64_t wait_start);
+
+/* Arrival order of waiters, for fairness among equal priorities. */
+static unsigned next_wait_seq;
+
+/* Statistics for named semaphores and locks.  Only named ones
+   are tracked, so that the many anonymous locks (one per frame,
+   per cache block, per open inode, ...) cost nothing, and named
+   ones live as long as the kernel, so their statistics come from
+   this fixed array instead of the heap. */
+#define SYNC_STATS_MAX 64
+static struct sync_stats sync_stats[SYNC_STATS_MAX];
+static size_t sync_stats_cnt;
 
 /* Initializes semaphore SEMA to VALUE.  A semaphore is first_elem
    nonnegative integer along with two atomic operators for
@@ -46,7 +69,61 @@ void sema_init(struct semaphore *sema, unsigned value)
   ASSERT(sema != NULL);
 
   sema->value = value;
-  list_init(&sema->waiters);
+  pheap_init(&sema->waiters, compare_waiters, NULL);
+  sema->stats = NULL;
+}
+
+/* Names SEMA NAME, which must stay valid as long as SEMA, and starts
+   keeping contention statistics for it, which lock_print_stats()
+   prints.  Name only semaphores that are never destroyed.  Does
+   nothing once SYNC_STATS_MAX objects have been named. */
+void sema_set_name(struct semaphore *sema, const char *name)
+{
+  enum intr_level old_level;
+
+  ASSERT(sema != NULL);
+  ASSERT(name != NULL);
+
+  old_level = intr_disable();
+  if (sema->stats == NULL && sync_stats_cnt < SYNC_STATS_MAX)
+  {
+    sema->stats = &sync_stats[sync_stats_cnt++];
+    sema->stats->name = name;
+  }
+  intr_set_level(old_level);
+}
+
+/* Counts an acquisition in STATS, which may be null, that waited
+   since time-stamp counter value WAIT_START, or 0 if it did not
+   wait.  Must be called with interrupts off. */
+static void
+record_acquire(struct sync_stats *stats, uint64_t wait_start)
+{
+  if (stats == NULL)
+    return;
+
+  stats->acquire_cnt++;
+  record_wait(stats, wait_start);
+}
+
+/* Counts a wait in STATS, which may be null, since time-stamp
+   counter value WAIT_START, or nothing if WAIT_START is 0.  Must
+   be called with interrupts off. */
+static void
+record_wait(struct sync_stats *stats, uint64_t wait_start)
+{
+  if (stats != NULL && wait_start != 0)
+  {
+    uint64_t wait = timer_cycles() - wait_start;
+
+    stats->contend_cnt++;
+    stats->wait_cycles += wait;
+    if (wait > stats->max_wait_cycles)
+    {
+      stats->max_wait_cycles = wait;
+      stats->max_waiter = thread_current()->tid;
+    }
+  }
 }
 
 /* Down or "P" operation on first_elem semaphore.  Waits for SEMA's value
@@ -60,17 +137,25 @@ void sema_init(struct semaphore *sema, unsigned value)
 void sema_down(struct semaphore *sema)
 {
   enum intr_level old_level;
+  uint64_t wait_start;
 
   ASSERT(sema != NULL);
   ASSERT(!intr_context());
 
   old_level = intr_disable();
+  trace(TRACE_SEMA_DOWN, (uintptr_t)sema, sema->value);
+  wait_start = sema->stats != NULL && sema->value == 0 ? timer_cycles() : 0;
   while (sema->value == 0)
   {
-    list_push_front(&sema->waiters, &thread_current()->elem);
+    struct thread *cur = thread_current();
+    cur->wait_sema = sema;
+    cur->wait_priority = cur->priority;
+    cur->wait_seq = take_wait_seq();
+    pheap_insert(&sema->waiters, &cur->wait_elem);
     thread_block();
   }
   sema->value--;
+  record_acquire(sema->stats, wait_start);
   intr_set_level(old_level);
 }
 
@@ -90,6 +175,7 @@ bool sema_try_down(struct semaphore *sema)
   if (sema->value > 0)
   {
     sema->value--;
+    record_acquire(sema->stats, 0);
     success = true;
   }
   else
@@ -104,22 +190,72 @@ bool sema_try_down(struct semaphore *sema)
 
    This function may be called from an interrupt handler. */
 void sema_up(struct semaphore *sema)
+{
+  sema_up_many(sema, 1);
+}
+
+/* Performs CNT up operations on SEMA at once, waking up to CNT of
+   its waiters, highest priority first.  The waiters are all made
+   ready with interrupts turned off once, and only then is it
+   decided, once, whether to yield to one of them.
+
+   This function may be called from an interrupt handler. */
+void sema_up_many(struct semaphore *sema, unsigned cnt)
 {
   enum intr_level old_level;
 
   ASSERT(sema != NULL);
 
   old_level = intr_disable();
-  if (!list_empty(&sema->waiters))
+  while (cnt-- > 0)
+    sema_wake(sema);
+  intr_set_level(old_level);
+
+  check_thread_yield();
+}
+
+/* Up operation on SEMA that wakes its highest-priority waiter, if
+   any, without yielding to it.  Interrupts must be off. */
+static void sema_wake(struct semaphore *sema)
+{
+  ASSERT(intr_get_level() == INTR_OFF);
+
+  if (!pheap_empty(&sema->waiters))
   {
     struct thread *m = sema_get_max(sema);
-    list_remove(&m->elem);
+    pheap_remove(&sema->waiters, &m->wait_elem);
+    m->wait_sema = NULL;
     thread_unblock(m);
   }
   sema->value++;
-  intr_set_level(old_level);
+}
 
-  check_thread_yield();
+/* Moves blocked thread T to its place among the waiters of the
+   semaphore it is waiting on, if any, after its priority changed.
+   A raised priority, as from a donation, only needs T cut out of
+   the heap and melded back at the top; a lowered one needs T
+   reinserted.  Must be called with interrupts off. */
+void sema_requeue(struct thread *t)
+{
+  struct pheap *waiters;
+
+  ASSERT(intr_get_level() == INTR_OFF);
+
+  if (t->wait_sema == NULL || t->priority == t->wait_priority)
+    return;
+
+  waiters = &t->wait_sema->waiters;
+  if (t->priority > t->wait_priority)
+  {
+    t->wait_priority = t->priority;
+    pheap_raise(waiters, &t->wait_elem);
+  }
+  else
+  {
+    pheap_remove(waiters, &t->wait_elem);
+    t->wait_priority = t->priority;
+    pheap_insert(waiters, &t->wait_elem);
+  }
 }
 
 static void sema_test_helper(void *sema_);
@@ -180,7 +316,39 @@ void lock_init(struct lock *lock)
   lock->holder = NULL;
   sema_init(&lock->semaphore, 1);
 
-  lock->max_p = 0;
+  lock->max_p = PRI_MIN;
+  lock->ceiling = PRI_MIN;
+}
+
+/* Initializes LOCK, like lock_init(), for the immediate priority
+   ceiling protocol: whoever acquires LOCK runs at no less than
+   CEILING until it releases LOCK, which should be at least the
+   priority of every thread that ever acquires it.
+
+   The holder then already runs at least as high as any waiter,
+   so a waiter's donation stops at LOCK instead of walking the
+   chain of holders beyond it, which makes acquiring and
+   releasing LOCK O(1), and no thread at or below CEILING can
+   preempt the holder.  A waiter above CEILING still donates as
+   usual.  The ceiling has no effect under the MLFQS. */
+void lock_init_ceiling(struct lock *lock, int ceiling)
+{
+  ASSERT(ceiling >= PRI_MIN && ceiling <= PRI_MAX);
+
+  lock_init(lock);
+  lock->max_p = ceiling;
+  lock->ceiling = ceiling;
+}
+
+/* Names LOCK NAME, which must stay valid as long as LOCK, and starts
+   keeping contention and hold time statistics for it, which
+   lock_print_stats() prints.  Name only locks that are never
+   destroyed. */
+void lock_set_name(struct lock *lock, const char *name)
+{
+  ASSERT(lock != NULL);
+
+  sema_set_name(&lock->semaphore, name);
 }
 
 /* Acquires LOCK, sleeping until it becomes available if
@@ -190,63 +358,55 @@ void lock_init(struct lock *lock)
    This function may sleep, so it must not be called within an
    interrupt handler.  This function may be called with
    interrupts disabled, but interrupts will be turned back on if
-   we need to sleep. */
+   we need to sleep.
+
+   An uncontended acquire takes the lock without entering the
+   scheduler.  Acquiring a lock can only raise our priority, so
+   after a contended acquire we only yield if some ready thread
+   still outranks us. */
 void lock_acquire(struct lock *lock)
 {
+  enum intr_level old_level;
+
   ASSERT(lock != NULL);
   ASSERT(!intr_context());
   ASSERT(!lock_held_by_current_thread(lock));
 
-  if (lock->holder != NULL)
+  old_level = intr_disable();
+  if (lock_try_acquire(lock))
   {
-    enum intr_level old_level = intr_disable();
-    thread_current()->curr_lock = lock;
-    if (!thread_mlfqs)
-    {
-      int curr = thread_get_priority();
-      struct lock *temporary_lock = lock;
-      struct thread *temp_lock_holder = lock->holder;
-      while (temporary_lock->max_p < curr)
-      {
-        temporary_lock->max_p = curr;
-        update_thread(temp_lock_holder);
-        if (temp_lock_holder->status == THREAD_READY)
-        {
-          rearrange_ready_list(temp_lock_holder);
-        }
-
-        temporary_lock = temp_lock_holder->curr_lock;
-        if (temporary_lock == NULL)
-        {
-          break;
-        }
-        else
-        {
-          temp_lock_holder = temporary_lock->holder;
-        }
-        ASSERT(temp_lock_holder);
-      }
-    }
     intr_set_level(old_level);
+    return;
   }
 
-  sema_down(&lock->semaphore);
+  if (lock->holder != NULL)
+  {
+    trace(TRACE_LOCK, (uintptr_t)lock, lock->holder->tid);
+    donate_priority(lock);
+  }
 
-  enum intr_level old_level = intr_disable();
+  sema_down(&lock->semaphore);
 
   thread_current()->curr_lock = NULL;
 
-  list_push_back(&thread_current()->held_lock, &lock->elem);
+  /* LOCK's key in HELD_LOCK may only rise while it is there, so
+     it is settled before LOCK goes in. */
+  if (!thread_mlfqs)
+  {
+    lock_update(lock);
+  }
+  pheap_insert(&thread_current()->held_lock, &lock->elem);
 
   lock->holder = thread_current();
+  if (lock->semaphore.stats != NULL)
+    lock->semaphore.stats->hold_start = timer_cycles();
 
   intr_set_level(old_level);
 
   if (!thread_mlfqs)
   {
-    lock_update(lock);
     update_thread(thread_current());
-    thread_yield();
+    check_thread_yield();
   }
 }
 
@@ -258,14 +418,32 @@ void lock_acquire(struct lock *lock)
    interrupt handler. */
 bool lock_try_acquire(struct lock *lock)
 {
+  enum intr_level old_level;
   bool success;
 
   ASSERT(lock != NULL);
   ASSERT(!lock_held_by_current_thread(lock));
 
+  old_level = intr_disable();
   success = sema_try_down(&lock->semaphore);
   if (success)
+  {
+    /* lock_release() expects every held lock in HELD_LOCK. */
+    if (!thread_mlfqs)
+    {
+      lock->max_p = lock->ceiling;
+      lock_update(lock);
+    }
+    pheap_insert(&thread_current()->held_lock, &lock->elem);
     lock->holder = thread_current();
+    if (lock->semaphore.stats != NULL)
+      lock->semaphore.stats->hold_start = timer_cycles();
+    if (!thread_mlfqs)
+    {
+      update_thread(thread_current());
+    }
+  }
+  intr_set_level(old_level);
   return success;
 }
 
@@ -280,7 +458,9 @@ void lock_release(struct lock *lock)
   ASSERT(lock_held_by_current_thread(lock));
 
   enum intr_level old_level = intr_disable();
-  list_remove(&lock->elem);
+  pheap_remove(&lock->holder->held_lock, &lock->elem);
+  if (lock->semaphore.stats != NULL)
+    lock->semaphore.stats->hold_cycles += timer_cycles() - lock->semaphore.stats->hold_start;
   intr_set_level(old_level);
 
   if (!thread_mlfqs)
@@ -292,6 +472,28 @@ void lock_release(struct lock *lock)
   sema_up(&lock->semaphore);
 }
 
+/* Donates the current thread's priority to the holder of LOCK,
+   as waiting for LOCK would, but without waiting: for a thread
+   that is about to wait for something that LOCK's holder is
+   doing on its behalf.  The donation lasts until the holder
+   releases LOCK.  Does nothing if LOCK is free or held by the
+   current thread, or if the MLFQS is in use.  Does not sleep. */
+void lock_donate(struct lock *lock)
+{
+  enum intr_level old_level;
+
+  ASSERT(lock != NULL);
+  ASSERT(!intr_context());
+
+  old_level = intr_disable();
+  if (lock->holder != NULL && lock->holder != thread_current())
+  {
+    donate_priority(lock);
+    thread_current()->curr_lock = NULL;
+  }
+  intr_set_level(old_level);
+}
+
 /* Returns true if the current thread holds LOCK, false
    otherwise.  (Note that testing whether some other thread holds
    first_elem lock would be racy.) */
@@ -302,22 +504,326 @@ bool lock_held_by_current_thread(const struct lock *lock)
   return lock->holder == thread_current();
 }
 
+/* Prints the statistics of the TOP_CNT named semaphores and locks
+   that spent the most time waiting, most first. */
+void lock_print_stats(size_t top_cnt)
+{
+  struct sync_stats *sorted[SYNC_STATS_MAX];
+  enum intr_level old_level;
+  size_t cnt, i, j;
+
+  /* Insertion sort copies, in decreasing order of wait time. */
+  old_level = intr_disable();
+  cnt = sync_stats_cnt;
+  for (i = 0; i < cnt; i++)
+  {
+    for (j = i; j > 0 && sorted[j - 1]->wait_cycles < sync_stats[i].wait_cycles; j--)
+      sorted[j] = sorted[j - 1];
+    sorted[j] = &sync_stats[i];
+  }
+  intr_set_level(old_level);
+
+  printf("Lock statistics, by time spent waiting:\n");
+  printf("  %-16s %9s %9s %12s %10s %8s %12s\n", "name", "acquires",
+         "contended", "wait us", "max us", "waiter", "held us");
+  for (i = 0; i < cnt && i < top_cnt; i++)
+  {
+    const struct sync_stats *s = sorted[i];
+    printf("  %-16s %9u %9u %12" PRId64 " %10" PRId64 " %8d %12" PRId64 "\n",
+           s->name, s->acquire_cnt, s->contend_cnt,
+           timer_cycles_to_ns(s->wait_cycles) / 1000,
+           timer_cycles_to_ns(s->max_wait_cycles) / 1000,
+           s->max_wait_cycles != 0 ? s->max_waiter : -1,
+           timer_cycles_to_ns(s->hold_cycles) / 1000);
+  }
+}
+
+/* Initializes fast lock FL.  A fast lock behaves like a lock,
+   and shares its priority donation bookkeeping, but it is meant
+   for critical sections that are much shorter than a
+   block/unblock round trip, such as allocate_tid() and the page
+   allocator's pools. */
+void fastlock_init(struct fastlock *fl)
+{
+  ASSERT(fl != NULL);
+
+  lock_init(&fl->lock);
+  fl->spin_cnt = 0;
+  fl->block_cnt = 0;
+}
+
+/* Acquires FL.  An uncontended acquire only disables interrupts
+   for a test-and-set of the underlying lock.
+
+   If FL is held by a thread that was preempted inside its
+   critical section, we spin for up to FASTLOCK_SPIN_LIMIT rounds
+   instead of blocking.  Each round donates our priority to the
+   holder and yields, so the holder can finish its (short)
+   critical section and release FL while we are still on the run
+   queue.  This being a uniprocessor, spinning without yielding
+   could never make progress.  If the holder is itself blocked,
+   or FL is still held after the last round, we park on FL's
+   waiter list exactly like lock_acquire().
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void fastlock_acquire(struct fastlock *fl)
+{
+  enum intr_level old_level;
+  uint64_t spin_start = 0;
+  int spins;
+
+  ASSERT(fl != NULL);
+  ASSERT(!intr_context());
+  ASSERT(!fastlock_held_by_current_thread(fl));
+
+  for (spins = 0; spins < FASTLOCK_SPIN_LIMIT; spins++)
+  {
+    struct thread *holder;
+
+    old_level = intr_disable();
+    if (lock_try_acquire(&fl->lock))
+    {
+      if (spins > 0)
+      {
+        fl->spin_cnt++;
+        record_wait(fl->lock.semaphore.stats, spin_start);
+      }
+      intr_set_level(old_level);
+      return;
+    }
+    if (spins == 0 && fl->lock.semaphore.stats != NULL)
+      spin_start = timer_cycles();
+
+    /* Spinning only helps if the holder is able to run. */
+    holder = fl->lock.holder;
+    if (holder == NULL || holder->status != THREAD_READY)
+    {
+      intr_set_level(old_level);
+      break;
+    }
+
+    donate_priority(&fl->lock);
+    thread_yield();
+    thread_current()->curr_lock = NULL;
+    intr_set_level(old_level);
+  }
+
+  fl->block_cnt++;
+  lock_acquire(&fl->lock);
+}
+
+/* Tries to acquire FL without spinning or sleeping and returns
+   true if successful or false on failure. */
+bool fastlock_try_acquire(struct fastlock *fl)
+{
+  ASSERT(fl != NULL);
+
+  return lock_try_acquire(&fl->lock);
+}
+
+/* Releases FL, which must be owned by the current thread. */
+void fastlock_release(struct fastlock *fl)
+{
+  ASSERT(fl != NULL);
+
+  lock_release(&fl->lock);
+}
+
+/* Returns true if the current thread holds FL, false
+   otherwise. */
+bool fastlock_held_by_current_thread(const struct fastlock *fl)
+{
+  ASSERT(fl != NULL);
+
+  return lock_held_by_current_thread(&fl->lock);
+}
+
+/* Initializes reader-writer lock RW. */
+void rw_init(struct rwlock *rw)
+{
+  ASSERT(rw != NULL);
+
+  lock_init(&rw->lock);
+  rw->readers = 0;
+  rw->writer_waiting = false;
+  sema_init(&rw->readers_done, 0);
+}
+
+/* Acquires RW for reading, sleeping while a writer holds it or
+   is waiting for it.  Readers pass through RW's underlying lock
+   on the way in, so a reader blocked behind a writer donates its
+   priority to the writer through the usual lock_acquire()
+   machinery, and a reader arriving after a writer queues behind
+   it.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void rw_read_acquire(struct rwlock *rw)
+{
+  ASSERT(rw != NULL);
+  ASSERT(!intr_context());
+
+  lock_acquire(&rw->lock);
+  rw->readers++;
+  lock_release(&rw->lock);
+}
+
+/* Releases RW, which the current thread must hold for reading. */
+void rw_read_release(struct rwlock *rw)
+{
+  enum intr_level old_level;
+
+  ASSERT(rw != NULL);
+
+  /* The writer, if any, sleeps holding RW's lock, so the reader
+     count is guarded by disabling interrupts instead. */
+  old_level = intr_disable();
+  ASSERT(rw->readers > 0);
+  if (--rw->readers == 0 && rw->writer_waiting)
+    sema_up(&rw->readers_done);
+  intr_set_level(old_level);
+}
+
+/* Acquires RW for writing.  The writer first takes RW's lock,
+   which shuts out new readers and other writers (writer
+   preference) and makes them donate their priority to it, then
+   waits for the readers already inside to leave.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void rw_write_acquire(struct rwlock *rw)
+{
+  enum intr_level old_level;
+
+  ASSERT(rw != NULL);
+  ASSERT(!intr_context());
+
+  lock_acquire(&rw->lock);
+  old_level = intr_disable();
+  while (rw->readers > 0)
+  {
+    rw->writer_waiting = true;
+    sema_down(&rw->readers_done);
+  }
+  rw->writer_waiting = false;
+  intr_set_level(old_level);
+}
+
+/* Releases RW, which the current thread must hold for writing. */
+void rw_write_release(struct rwlock *rw)
+{
+  ASSERT(rw != NULL);
+  ASSERT(rw->readers == 0);
+
+  lock_release(&rw->lock);
+}
+
+/* Returns true if the current thread holds RW for writing, false
+   otherwise. */
+bool rw_write_held_by_current_thread(const struct rwlock *rw)
+{
+  ASSERT(rw != NULL);
+
+  return lock_held_by_current_thread(&rw->lock);
+}
+
+/* Initializes SL.
+
+   A reader copies the data SL guards between seqlock_read_begin()
+   and seqlock_read_retry(), over again for as long as the latter
+   returns true:
+
+     do
+     {
+       seq = seqlock_read_begin(&sl);
+       copy = data;
+     } while (seqlock_read_retry(&sl, seq));
+
+   A writer changes the data between seqlock_write_begin() and
+   seqlock_write_end(), with interrupts off throughout, so that no
+   reader on its CPU can spin waiting for it.  Writers on
+   different CPUs must be serialized by other means, for example
+   by all running in the same interrupt handler. */
+void seqlock_init(struct seqlock *sl)
+{
+  ASSERT(sl != NULL);
+
+  sl->seq = 0;
+}
+
+/* Begins a read of the data SL guards, waiting out a write in
+   progress on another CPU.  Returns the value to pass to
+   seqlock_read_retry(). */
+unsigned seqlock_read_begin(const struct seqlock *sl)
+{
+  unsigned seq;
+
+  ASSERT(sl != NULL);
+
+  while ((seq = *(volatile const unsigned *) &sl->seq) & 1)
+    asm volatile("pause" : : : "memory");
+  barrier();
+  return seq;
+}
+
+/* Ends a read of the data SL guards begun by the
+   seqlock_read_begin() that returned SEQ.  Returns true if a
+   write overlapped the read, in which case the data read may be
+   inconsistent and the read must be done again. */
+bool seqlock_read_retry(const struct seqlock *sl, unsigned seq)
+{
+  ASSERT(sl != NULL);
+
+  barrier();
+  return *(volatile const unsigned *) &sl->seq != seq;
+}
+
+/* Begins a write of the data SL guards.  Interrupts must be
+   off. */
+void seqlock_write_begin(struct seqlock *sl)
+{
+  ASSERT(sl != NULL);
+  ASSERT(intr_get_level() == INTR_OFF);
+  ASSERT((sl->seq & 1) == 0);
+
+  sl->seq++;
+  barrier();
+}
+
+/* Ends a write of the data SL guards. */
+void seqlock_write_end(struct seqlock *sl)
+{
+  ASSERT(sl != NULL);
+  ASSERT(intr_get_level() == INTR_OFF);
+  ASSERT(sl->seq & 1);
+
+  barrier();
+  sl->seq++;
+}
+
 /* One semaphore in first_elem list. */
 struct semaphore_elem
 {
-  struct list_elem elem;      /* List element. */
+  struct pheap_elem elem;     /* Heap element. */
   struct semaphore semaphore; /* This semaphore. */
   int priority;
+  unsigned seq;               /* Arrival order among equal priorities. */
 };
 
-bool compare_locks(const struct list_elem *first_elem, const struct list_elem *second_elem, void *aux UNUSED)
+bool compare_locks(const struct pheap_elem *first_elem, const struct pheap_elem *second_elem, void *aux UNUSED)
 {
-  return list_entry(first_elem, struct lock, elem)->max_p <= list_entry(second_elem, struct lock, elem)->max_p;
+  return pheap_entry(first_elem, struct lock, elem)->max_p < pheap_entry(second_elem, struct lock, elem)->max_p;
 }
 
-bool compare_sema_elem(const struct list_elem *first_elem, const struct list_elem *second_elem, void *aux UNUSED)
+bool compare_sema_elem(const struct pheap_elem *first_elem, const struct pheap_elem *second_elem, void *aux UNUSED)
 {
-  return list_entry(first_elem, struct semaphore_elem, elem)->priority <= list_entry(second_elem, struct semaphore_elem, elem)->priority;
+  const struct semaphore_elem *a = pheap_entry(first_elem, struct semaphore_elem, elem);
+  const struct semaphore_elem *b = pheap_entry(second_elem, struct semaphore_elem, elem);
+
+  if (a->priority != b->priority)
+    return a->priority < b->priority;
+  return (int)(a->seq - b->seq) > 0;
 }
 
 /* Initializes condition variable COND.  A condition variable
@@ -327,7 +833,7 @@ void cond_init(struct condition *cond)
 {
   ASSERT(cond != NULL);
 
-  list_init(&cond->waiters);
+  pheap_init(&cond->waiters, compare_sema_elem, NULL);
 }
 
 /* Atomically releases LOCK and waits for COND to be signaled by
@@ -362,7 +868,8 @@ void cond_wait(struct condition *cond, struct lock *lock)
   sema_init(&waiting_elem.semaphore, 0);
 
   waiting_elem.priority = thread_get_priority();
-  list_insert_ordered(&cond->waiters, &waiting_elem.elem, compare_sema_elem, NULL);
+  waiting_elem.seq = take_wait_seq();
+  pheap_insert(&cond->waiters, &waiting_elem.elem);
 
   lock_release(lock);
   sema_down(&waiting_elem.semaphore);
@@ -383,40 +890,280 @@ void cond_signal(struct condition *cond, struct lock *lock UNUSED)
   ASSERT(!intr_context());
   ASSERT(lock_held_by_current_thread(lock));
 
-  /* Pop the semaphore from the condtion's WAITERS orderly. */
-  if (!list_empty(&cond->waiters))
+  /* Pop the highest priority semaphore from the condition's WAITERS. */
+  if (!pheap_empty(&cond->waiters))
   {
-    sema_up(&list_entry(list_pop_back(&cond->waiters), struct semaphore_elem, elem)->semaphore);
+    sema_up(&pheap_entry(pheap_pop(&cond->waiters), struct semaphore_elem, elem)->semaphore);
   }
 }
 
 /* Wakes up all threads, if any, waiting on COND (protected by
    LOCK).  LOCK must be held before calling this function.
 
+   The waiters are all made ready with interrupts turned off
+   once, and only then is it decided, once, whether to yield to
+   one of them.
+
    An interrupt handler cannot acquire first_elem lock, so it does not
    make sense to try to signal first_elem condition variable within an
    interrupt handler. */
-void cond_broadcast(struct condition *cond, struct lock *lock)
+void cond_broadcast(struct condition *cond, struct lock *lock UNUSED)
 {
+  enum intr_level old_level;
+
   ASSERT(cond != NULL);
   ASSERT(lock != NULL);
+  ASSERT(!intr_context());
+  ASSERT(lock_held_by_current_thread(lock));
+
+  old_level = intr_disable();
+  while (!pheap_empty(&cond->waiters))
+    sema_wake(&pheap_entry(pheap_pop(&cond->waiters), struct semaphore_elem, elem)->semaphore);
+  intr_set_level(old_level);
+
+  check_thread_yield();
+}
+
+/* A thread waiting on a completion, barrier or latch. */
+struct group_waiter
+{
+  struct list_elem elem;      /* Element in the waiters list. */
+  struct semaphore semaphore; /* Up'd to wake the thread. */
+};
+
+/* Adds the current thread to WAITERS and waits to be woken by
+   group_wake_one() or group_wake_all().  Interrupts must be off;
+   they are off again on return. */
+static void group_wait(struct list *waiters)
+{
+  struct group_waiter w;
+
+  ASSERT(intr_get_level() == INTR_OFF);
+  ASSERT(!intr_context());
+
+  sema_init(&w.semaphore, 0);
+  list_push_back(waiters, &w.elem);
+  sema_down(&w.semaphore);
+}
+
+/* Wakes the first thread in WAITERS, which must not be empty,
+   without yielding to it.  Interrupts must be off. */
+static void group_wake_one(struct list *waiters)
+{
+  sema_wake(&list_entry(list_pop_front(waiters), struct group_waiter, elem)->semaphore);
+}
+
+/* Wakes every thread in WAITERS, without yielding to any.
+   Returns true if there were any.  Interrupts must be off. */
+static bool group_wake_all(struct list *waiters)
+{
+  bool woke = !list_empty(waiters);
+
+  while (!list_empty(waiters))
+    group_wake_one(waiters);
+  return woke;
+}
+
+/* If WOKE, yields to a thread just woken if it should run
+   instead of the current one. */
+static void group_yield(bool woke)
+{
+  if (woke)
+    check_thread_yield();
+}
+
+/* Initializes completion C, as not yet completed. */
+void completion_init(struct completion *c)
+{
+  ASSERT(c != NULL);
+
+  c->done = 0;
+  list_init(&c->waiters);
+}
+
+/* Waits for C to be completed for the current thread: returns at
+   once if completion_complete_all() was called, or uses up one
+   earlier completion_complete() if there is one left, and
+   otherwise waits for the next. */
+void completion_wait(struct completion *c)
+{
+  enum intr_level old_level;
+
+  ASSERT(c != NULL);
+  ASSERT(!intr_context());
+
+  old_level = intr_disable();
+  if (c->done == 0)
+    group_wait(&c->waiters);
+  else if (c->done != UINT_MAX)
+    c->done--;
+  intr_set_level(old_level);
+}
+
+/* Returns true if completion_wait(C) would return without
+   waiting, false otherwise. */
+bool completion_done(struct completion *c)
+{
+  ASSERT(c != NULL);
+
+  return c->done != 0;
+}
+
+/* Lets one thread waiting on C through or, if none is waiting,
+   the next one to wait. */
+void completion_complete(struct completion *c)
+{
+  enum intr_level old_level;
+  bool woke;
+
+  ASSERT(c != NULL);
+
+  old_level = intr_disable();
+  woke = !list_empty(&c->waiters);
+  if (woke)
+    group_wake_one(&c->waiters);
+  else if (c->done < UINT_MAX - 1)
+    c->done++;
+  intr_set_level(old_level);
+
+  group_yield(woke);
+}
+
+/* Lets every thread waiting on C through, now and until C is
+   initialized again. */
+void completion_complete_all(struct completion *c)
+{
+  enum intr_level old_level;
+  bool woke;
+
+  ASSERT(c != NULL);
+
+  old_level = intr_disable();
+  c->done = UINT_MAX;
+  woke = group_wake_all(&c->waiters);
+  intr_set_level(old_level);
+
+  group_yield(woke);
+}
+
+/* Initializes barrier B for PARTIES parties. */
+void barrier_init(struct barrier *b, unsigned parties)
+{
+  ASSERT(b != NULL);
+  ASSERT(parties > 0);
+
+  b->parties = parties;
+  b->arrived = 0;
+  list_init(&b->waiters);
+}
+
+/* Arrives at barrier B and waits until all of its parties have
+   arrived.  Returns true in exactly one of the parties of each
+   round, the last to arrive, which may then do any work that is
+   to be done once per round, and false in the others. */
+bool barrier_wait(struct barrier *b)
+{
+  enum intr_level old_level;
+  bool last;
+
+  ASSERT(b != NULL);
+  ASSERT(!intr_context());
+
+  old_level = intr_disable();
+  last = ++b->arrived == b->parties;
+  if (!last)
+    group_wait(&b->waiters);
+  else
+  {
+    b->arrived = 0;
+    group_wake_all(&b->waiters);
+  }
+  intr_set_level(old_level);
 
-  while (!list_empty(&cond->waiters))
-    cond_signal(cond, lock);
+  if (last)
+    check_thread_yield();
+  return last;
+}
+
+/* Initializes latch L with the given COUNT. */
+void latch_init(struct latch *l, unsigned count)
+{
+  ASSERT(l != NULL);
+
+  l->count = count;
+  list_init(&l->waiters);
+}
+
+/* Counts latch L down by one, waking its waiters if that brings
+   it to zero.  L must not already be at zero. */
+void latch_count_down(struct latch *l)
+{
+  enum intr_level old_level;
+  bool woke = false;
+
+  ASSERT(l != NULL);
+
+  old_level = intr_disable();
+  ASSERT(l->count > 0);
+  if (--l->count == 0)
+    woke = group_wake_all(&l->waiters);
+  intr_set_level(old_level);
+
+  group_yield(woke);
+}
+
+/* Waits until latch L has been counted down to zero. */
+void latch_wait(struct latch *l)
+{
+  enum intr_level old_level;
+
+  ASSERT(l != NULL);
+  ASSERT(!intr_context());
+
+  old_level = intr_disable();
+  if (l->count > 0)
+    group_wait(&l->waiters);
+  intr_set_level(old_level);
 }
 
 struct thread *sema_get_max(struct semaphore *sema)
 {
-  ASSERT(!list_empty(&sema->waiters));
-  return list_entry(list_max(&sema->waiters, compare_threads, NULL), struct thread, elem);
+  ASSERT(!pheap_empty(&sema->waiters));
+
+  /* MLFQS priorities of blocked threads are only updated lazily.
+     The waiters are taken out of the heap to be brought up to
+     date, then put back under their new priorities. */
+  if (thread_mlfqs)
+  {
+    enum intr_level old_level = intr_disable();
+    struct list caught_up;
+
+    list_init(&caught_up);
+    while (!pheap_empty(&sema->waiters))
+    {
+      struct thread *t = pheap_entry(pheap_pop(&sema->waiters), struct thread, wait_elem);
+      t->wait_sema = NULL;
+      thread_update_recent_cpu(t, NULL);
+      list_push_back(&caught_up, &t->elem);
+    }
+    while (!list_empty(&caught_up))
+    {
+      struct thread *t = list_entry(list_pop_front(&caught_up), struct thread, elem);
+      t->wait_sema = sema;
+      t->wait_priority = t->priority;
+      pheap_insert(&sema->waiters, &t->wait_elem);
+    }
+    intr_set_level(old_level);
+  }
+  return pheap_entry(pheap_top(&sema->waiters), struct thread, wait_elem);
 }
 
 void lock_update(struct lock *lock)
 {
   int max_priority;
-  if (list_empty(&(&lock->semaphore)->waiters))
+  if (pheap_empty(&lock->semaphore.waiters))
   {
-    max_priority = 0;
+    max_priority = lock->ceiling;
   }
   else
   {
@@ -431,4 +1178,71 @@ void lock_update(struct lock *lock)
     }
   }
   lock->max_p = max_priority;
-}
\ No newline at end of file
+}
+
+/* Records that the current thread is waiting for LOCK and, unless
+   the MLFQS is in use, donates its priority along the chain of
+   lock holders that it is (transitively) waiting on.  Must be
+   called with interrupts off and with LOCK held by another
+   thread. */
+static void
+donate_priority(struct lock *lock)
+{
+  ASSERT(intr_get_level() == INTR_OFF);
+  ASSERT(lock->holder != NULL);
+
+  thread_current()->curr_lock = lock;
+  if (!thread_mlfqs)
+  {
+    int curr = thread_get_priority();
+    struct lock *temporary_lock = lock;
+    struct thread *temp_lock_holder = lock->holder;
+    while (temporary_lock->max_p < curr)
+    {
+      temporary_lock->max_p = curr;
+      pheap_raise(&temp_lock_holder->held_lock, &temporary_lock->elem);
+      temp_lock_holder->stats.donations++;
+      update_thread(temp_lock_holder);
+      if (temp_lock_holder->status == THREAD_READY)
+      {
+        rearrange_ready_list(temp_lock_holder);
+      }
+
+      temporary_lock = temp_lock_holder->curr_lock;
+      if (temporary_lock == NULL)
+      {
+        break;
+      }
+      else
+      {
+        temp_lock_holder = temporary_lock->holder;
+      }
+      ASSERT(temp_lock_holder);
+    }
+  }
+}
+
+/* Orders threads waiting on a semaphore by the priority they are
+   queued under.  Of two threads with equal priority, the one that
+   started waiting later compares less, so that equal-priority
+   waiters are woken in the order they arrived. */
+static bool
+compare_waiters(const struct pheap_elem *a_, const struct pheap_elem *b_, void *aux UNUSED)
+{
+  const struct thread *a = pheap_entry(a_, struct thread, wait_elem);
+  const struct thread *b = pheap_entry(b_, struct thread, wait_elem);
+
+  if (a->wait_priority != b->wait_priority)
+    return a->wait_priority < b->wait_priority;
+  return (int)(a->wait_seq - b->wait_seq) > 0;
+}
+
+/* Returns the next number in the arrival order of waiters. */
+static unsigned
+take_wait_seq(void)
+{
+  enum intr_level old_level = intr_disable();
+  unsigned seq = next_wait_seq++;
+  intr_set_level(old_level);
+  return seq;
+}
@@ -2,19 +2,42 @@
 #define THREADS_SYNCH_H
 
 #include <list.h>
+#include <pheap.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct thread;
+
+/* Contention statistics for a named semaphore or lock.  See
+   sema_set_name(). */
+struct sync_stats
+{
+  const char *name;         /* Name. */
+  unsigned acquire_cnt;     /* # of downs, or of lock acquisitions. */
+  unsigned contend_cnt;     /* # of those that had to wait. */
+  uint64_t wait_cycles;     /* Total TSC cycles spent waiting. */
+  uint64_t max_wait_cycles; /* Longest single wait. */
+  int max_waiter;           /* Tid of the thread that waited longest. */
+  uint64_t hold_cycles;     /* Total cycles held (locks only). */
+  uint64_t hold_start;      /* When the holder acquired it (locks only). */
+};
 
 /* A counting semaphore. */
 struct semaphore
 {
-  unsigned value;      /* Current value. */
-  struct list waiters; /* List of waiting threads. */
+  unsigned value;           /* Current value. */
+  struct pheap waiters;     /* Waiting threads, highest priority on top. */
+  struct sync_stats *stats; /* Statistics, if named, otherwise null. */
 };
 
 void sema_init(struct semaphore *, unsigned value);
+void sema_set_name(struct semaphore *, const char *name);
 void sema_down(struct semaphore *);
 bool sema_try_down(struct semaphore *);
 void sema_up(struct semaphore *);
+void sema_up_many(struct semaphore *, unsigned cnt);
+void sema_requeue(struct thread *);
 void sema_self_test(void);
 
 /* Lock. */
@@ -22,20 +45,76 @@ struct lock
 {
   struct thread *holder;      /* Thread holding lock (for debugging). */
   struct semaphore semaphore; /* Binary semaphore controlling access. */
-  struct list_elem elem;      /* List of lock elem. */
+  struct pheap_elem elem;     /* Element in holder's HELD_LOCK. */
   int max_p;
+  int ceiling;                /* Priority ceiling, or PRI_MIN for none. */
 };
 
 void lock_init(struct lock *);
+void lock_init_ceiling(struct lock *, int ceiling);
+void lock_set_name(struct lock *, const char *name);
 void lock_acquire(struct lock *);
 bool lock_try_acquire(struct lock *);
 void lock_release(struct lock *);
+void lock_donate(struct lock *);
 bool lock_held_by_current_thread(const struct lock *);
+void lock_print_stats(size_t top_cnt);
+
+/* Fast lock: a lock with a test-and-set fast path that spins
+   briefly before blocking.  See fastlock_acquire(). */
+struct fastlock
+{
+  struct lock lock;   /* Underlying lock, used for donation. */
+  unsigned spin_cnt;  /* # of acquires that succeeded by spinning. */
+  unsigned block_cnt; /* # of acquires that had to block. */
+};
+
+/* Maximum number of yield rounds before blocking. */
+#define FASTLOCK_SPIN_LIMIT 8
+
+void fastlock_init(struct fastlock *);
+void fastlock_acquire(struct fastlock *);
+bool fastlock_try_acquire(struct fastlock *);
+void fastlock_release(struct fastlock *);
+bool fastlock_held_by_current_thread(const struct fastlock *);
+
+/* Reader-writer lock.  Any number of readers or one writer may
+   hold it at a time.  See rw_write_acquire(). */
+struct rwlock
+{
+  struct lock lock;               /* Held by the writer, if any. */
+  unsigned readers;               /* # of readers holding the lock. */
+  bool writer_waiting;            /* Is the writer draining readers? */
+  struct semaphore readers_done;  /* Up'd when the last reader leaves. */
+};
+
+void rw_init(struct rwlock *);
+void rw_read_acquire(struct rwlock *);
+void rw_read_release(struct rwlock *);
+void rw_write_acquire(struct rwlock *);
+void rw_write_release(struct rwlock *);
+bool rw_write_held_by_current_thread(const struct rwlock *);
+
+/* Sequence lock, for data read often and written rarely, and
+   only with interrupts off.  Readers never write to the lock or
+   disable interrupts; they retry if a write overlapped them. */
+struct seqlock
+{
+  unsigned seq;                   /* Odd while a write is underway. */
+};
+
+#define SEQLOCK_INITIALIZER {0}
+
+void seqlock_init(struct seqlock *);
+unsigned seqlock_read_begin(const struct seqlock *);
+bool seqlock_read_retry(const struct seqlock *, unsigned seq);
+void seqlock_write_begin(struct seqlock *);
+void seqlock_write_end(struct seqlock *);
 
 /* Condition variable. */
 struct condition
 {
-  struct list waiters; /* List of waiting threads. */
+  struct pheap waiters; /* Waiting semaphore_elems, highest priority on top. */
 };
 
 void cond_init(struct condition *);
@@ -43,6 +122,53 @@ void cond_wait(struct condition *, struct lock *);
 void cond_signal(struct condition *, struct lock *);
 void cond_broadcast(struct condition *, struct lock *);
 
+/* Primitives for fork/join among groups of threads.  Each wakes
+   all of its waiters with interrupts off once, and then decides
+   once whether to yield, rather than once per waiter.  The waking
+   functions may be called from an interrupt handler. */
+
+/* Completion: threads wait until some event has happened.  Each
+   completion_complete() lets one waiter, present or future,
+   through; completion_complete_all() lets through every waiter
+   from then on, until completion_init() is called again. */
+struct completion
+{
+  unsigned done;        /* Waiters to let through, or UINT_MAX. */
+  struct list waiters;  /* Waiting group_waiters. */
+};
+
+void completion_init(struct completion *);
+void completion_wait(struct completion *);
+bool completion_done(struct completion *);
+void completion_complete(struct completion *);
+void completion_complete_all(struct completion *);
+
+/* Barrier: each of a fixed number of parties arrives and waits
+   until all have arrived, and then all proceed.  The barrier is
+   ready for reuse at once. */
+struct barrier
+{
+  unsigned parties;     /* Number of parties. */
+  unsigned arrived;     /* Parties that have arrived this round. */
+  struct list waiters;  /* Waiting group_waiters. */
+};
+
+void barrier_init(struct barrier *, unsigned parties);
+bool barrier_wait(struct barrier *);
+
+/* Countdown latch: threads wait until a count, set at
+   initialization, has been counted down to zero.  Unlike a
+   barrier, counting down does not wait. */
+struct latch
+{
+  unsigned count;       /* Remaining count. */
+  struct list waiters;  /* Waiting group_waiters. */
+};
+
+void latch_init(struct latch *, unsigned count);
+void latch_count_down(struct latch *);
+void latch_wait(struct latch *);
+
 /* Optimization barrier.
 
    The compiler will not reorder operations across an
@@ -53,9 +179,9 @@ void cond_broadcast(struct condition *, struct lock *);
 /**
  * @brief Retrieves the highest priority thread waiting on a semaphore.
  *
- * This function checks the list of threads waiting on a given semaphore and
- * returns the thread with the highest priority. The function assumes that
- * the list of waiting threads is not empty.
+ * This function returns the thread at the top of the semaphore's waiter heap,
+ * first bringing the waiters' priorities up to date under the MLFQS. The
+ * function assumes that the semaphore has at least one waiter.
  *
  * @param sema The semaphore to check.
  * @return The highest priority thread waiting on the semaphore.
@@ -65,9 +191,10 @@ struct thread *sema_get_max(struct semaphore *);
 /**
  * @brief Updates the maximum priority of a lock.
  *
- * This function checks the list of threads waiting on the lock's semaphore and
+ * This function checks the threads waiting on the lock's semaphore and
  * updates the lock's maximum priority (`max_p`) to the highest priority of these threads.
- * If the list of waiting threads is empty, the maximum priority is set to 0.
+ * It is never set below the lock's ceiling, which is PRI_MIN (0) unless
+ * the lock was initialized with lock_init_ceiling().
  *
  * @param lock The lock whose maximum priority is to be updated.
  */
@@ -76,29 +203,30 @@ void lock_update(struct lock *);
 /**
  * @brief Compares the maximum priority of two lock elements.
  *
- * This function is used for ordering lock elements in a list based on their maximum priority.
- * It takes two list elements as parameters, retrieves the lock elements from them,
+ * This function orders the heap of locks a thread holds based on their maximum priority.
+ * It takes two heap elements as parameters, retrieves the lock elements from them,
  * and compares their maximum priority.
  *
- * @param first_elem The first list element to compare.
- * @param second_elem The second list element to compare.
+ * @param first_elem The first heap element to compare.
+ * @param second_elem The second heap element to compare.
  * @param aux Auxiliary data. This parameter is unused in this function.
- * @return True if the maximum priority of the first lock element is less than or equal to the maximum priority of the second lock element, false otherwise.
+ * @return True if the maximum priority of the first lock element is less than the maximum priority of the second lock element, false otherwise.
  */
-bool compare_locks(const struct list_elem *, const struct list_elem *, void *);
+bool compare_locks(const struct pheap_elem *, const struct pheap_elem *, void *);
 
 /**
  * @brief Compares the priority of two semaphore elements.
  *
- * This function is used for ordering semaphore elements in a list based on their priority.
- * It takes two list elements as parameters, retrieves the semaphore elements from them,
- * and compares their priority.
+ * This function orders a condition variable's heap of waiting semaphore elements
+ * based on their priority. Of two elements with equal priority, the one that
+ * started waiting later compares less, so waiters of equal priority are
+ * signaled in the order they arrived.
  *
- * @param first_elem The first list element to compare.
- * @param second_elem The second list element to compare.
+ * @param first_elem The first heap element to compare.
+ * @param second_elem The second heap element to compare.
  * @param aux Auxiliary data. This parameter is unused in this function.
- * @return True if the priority of the first semaphore element is less than or equal to the priority of the second semaphore element, false otherwise.
+ * @return True if the first semaphore element should be signaled after the second, false otherwise.
  */
-bool compare_sema_elem(const struct list_elem *, const struct list_elem *, void *);
+bool compare_sema_elem(const struct pheap_elem *, const struct pheap_elem *, void *);
 
 #endif /* threads/synch.h */
@@ -1,16 +1,24 @@
 #include "threads/thread.h"
+#include <bitmap.h>
 #include <debug.h>
 #include <stddef.h>
 #include <random.h>
+#include <round.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/cpu.h"
 #include "threads/flags.h"
 #include "threads/interrupt.h"
 #include "threads/intr-stubs.h"
+#include "threads/malloc.h"
 #include "threads/palloc.h"
+#include "threads/rcu.h"
+#include "threads/sched.h"
 #include "threads/switch.h"
 #include "threads/synch.h"
+#include "threads/trace.h"
 #include "threads/vaddr.h"
+#include "devices/timer.h"
 #ifdef USERPROG
 #include "userprog/process.h"
 #endif
@@ -20,24 +28,83 @@
    of thread.h for details. */
 #define THREAD_MAGIC 0xcd6abf4b
 
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
+/* Scheduling class, chosen by thread_init(), which keeps the
+   processes in THREAD_READY state, that is, processes that are
+   ready to run but not actually running, on a run queue for each
+   processor.  Each struct cpu counts the threads on its run
+   queues.  See sched.h. */
+static const struct sched_class *sched;
+
+/* Run queue of the priority and MLFQS scheduling classes, one per
+   processor.  There is one FIFO list per priority, and bit P of
+   BITMAP is set whenever QUEUES[P] is nonempty, so the
+   highest-priority ready thread is found with a bit scan.  The
+   bootstrap processor's is static and prio_init() allocates the
+   others'. */
+struct prio_rq
+{
+  struct list queues[PRI_MAX + 1];
+  uint64_t bitmap;
+};
+static struct prio_rq prio_boot_rq;
+static struct prio_rq *prio_rqs[CPU_MAX];
 
 /* List of all processes.  Processes are added to this list
    when they are first scheduled and removed when they exit. */
 static struct list all_list;
 
-/* Idle thread. */
-static struct thread *idle_thread;
+/* The threads on all_list, indexed by tid for thread_lookup().
+   It changes along with all_list, with interrupts off, so its
+   buckets are static and it never resizes, since hash.c may not
+   call malloc() then. */
+#define TID_BUCKETS 128
+static struct list tid_buckets[TID_BUCKETS];
+static struct hash tid_table;
 
 /* Initial thread, the thread running init.c:main(). */
 static struct thread *initial_thread;
 
 /* Lock used by allocate_tid(). */
-static struct lock tid_lock;
-
-static struct list sleeping_list;
+static struct fastlock tid_lock;
+
+/* Timer wheel of sleeping threads.  A thread that sleeps until
+   tick T sits in slot T % SLEEP_WHEEL_SLOTS, and each slot is kept
+   sorted by wake-up tick, so a timer tick only has to pop the
+   expired threads off the front of a single slot. */
+#define SLEEP_WHEEL_SLOTS 256
+static struct list sleep_wheel[SLEEP_WHEEL_SLOTS];
+
+/* Guarded kernel stacks.  Normally struct thread and the kernel
+   stack share one page, and a stack that overflows runs into
+   struct thread, which is noticed later, if at all, by the
+   `magic' check.  Instead, up to thread_kstack_cnt threads at a
+   time get a slot in a region reserved at boot: an unmapped
+   guard page followed by KSTACK_PAGES pages of stack, with struct
+   thread at the very top of the slot, above the stack.  Overflow
+   then faults on the guard page at once.  Threads created while
+   every slot is taken get an ordinary page. */
+#define KSTACK_PAGES 2
+#define KSTACK_SLOT_SIZE ((KSTACK_PAGES + 1) * PGSIZE)
+#define THREAD_SIZE ROUND_UP(sizeof(struct thread), 16)
+size_t thread_kstack_cnt;
+static uint8_t *kstack_base, *kstack_end; /* Reserved region. */
+static struct bitmap *kstack_map;         /* Slots in use. */
+
+/* Recently freed thread pages, kept for reuse so that creating a
+   thread usually needs neither palloc nor a 4 kB memset.  A
+   freed thread's `stack' member is left pointing to the lowest
+   nonzero word of its stack, so reusing its page (or guarded
+   slot) only has to zero the part of the stack that was used.
+   init_thread() zeroes struct thread itself. */
+#define THREAD_CACHE_SIZE 8
+static struct thread *thread_cache[THREAD_CACHE_SIZE];
+static size_t thread_cache_cnt;
+
+/* Deepest kernel stack use seen so far, the size of that stack,
+   and the name of its thread. */
+static size_t max_stack_used;
+static size_t max_stack_size;
+static char max_stack_name[16];
 
 /* Stack frame for kernel_thread(). */
 struct kernel_thread_frame
@@ -48,30 +115,156 @@ struct kernel_thread_frame
 };
 
 /* Statistics. */
-static long long idle_ticks;   /* # of timer ticks spent idle. */
-static long long kernel_ticks; /* # of timer ticks in kernel threads. */
-static long long user_ticks;   /* # of timer ticks in user programs. */
-
-static unsigned thread_ticks; /* # of timer ticks since last yield. */
+static PERCPU(long long, idle_ticks);   /* # of timer ticks spent idle. */
+static PERCPU(long long, kernel_ticks); /* # of timer ticks in kernel threads. */
+static PERCPU(long long, user_ticks);   /* # of timer ticks in user programs. */
+
+static long long switch_cnt;   /* # of context switches. */
+static long long expiry_cnt;   /* # of time slices used up. */
+static long long steal_cnt;    /* # of threads taken by idle CPUs. */
+static long long balance_cnt;  /* # of threads moved by rebalancing. */
+
+/* Timer ticks between passes of rebalance_cpus(). */
+#define REBALANCE_TICKS 4
+
+/* Time slice length in ticks for each band of SLICE_BAND_WIDTH
+   priorities, lowest band first, computed by thread_init() from
+   thread_slice.  SLICE_HALVES gives each band's slice in units
+   of half of thread_slice when thread_slice_scaled is set. */
+#define SLICE_BANDS 4
+#define SLICE_BAND_WIDTH ((PRI_MAX + 1) / SLICE_BANDS)
+static const unsigned slice_halves[SLICE_BANDS] = {8, 4, 2, 1};
+static unsigned slice_ticks[SLICE_BANDS];
+
+unsigned thread_slice = TIME_SLICE;
+bool thread_slice_scaled;
+
+/* Log2 histogram of ready-to-run latency, in timer ticks.
+   Bucket 0 counts zero-tick latencies, bucket B > 0 counts
+   latencies in [2**(B-1), 2**B), and the last bucket also
+   counts everything longer. */
+#define LATENCY_BUCKETS 12
+static unsigned latency_hist[LATENCY_BUCKETS];
 
 static fixed_point load_avg;
 
+/* load_avg = LOAD_AVG_DECAY * load_avg + LOAD_AVG_GAIN * ready,
+   i.e. (59/60) * load_avg + (1/60) * ready, as a multiply-add. */
+#define LOAD_AVG_DECAY fp_ratio(59, 60)
+#define LOAD_AVG_GAIN fp_ratio(1, 60)
+
+/* Lazy MLFQS bookkeeping.  Only running and ready threads have
+   their recent_cpu decayed every second.  A blocked thread
+   remembers the last second it was brought up to date
+   (recent_cpu_secs) and replays the missed decays from
+   decay_history when it is next examined.  Each entry is the
+   coefficient (2 * load_avg) / (2 * load_avg + 1) for that
+   second, computed once when the second ends, so replaying a
+   second costs one multiply and one add per thread.  To keep every gap
+   within the history window, each second also sweeps a slice of
+   all_list so that every thread is visited at least once per
+   MLFQS_HISTORY / 2 seconds. */
+#define MLFQS_HISTORY 64
+static fixed_point decay_history[MLFQS_HISTORY];
+static int64_t mlfqs_seconds;           /* # of load_avg updates so far. */
+static struct list_elem *mlfqs_cursor;  /* Next all_list sweep position. */
+static size_t all_cnt;                  /* # of threads on all_list. */
+
 /* If false (default), use round-robin scheduler.
    If true, use multi-level feedback queue scheduler.
    Controlled by kernel command-line option "-o mlfqs". */
 bool thread_mlfqs;
 
+/* If true, use the fair scheduling class in sched-cfs.c.
+   Controlled by kernel command-line option "-cfs". */
+bool thread_cfs;
+
+/* Wake-up boost.  A thread that blocked for N ticks gets N extra
+   priority levels, up to MLFQS_BOOST_MAX, when it wakes, so that
+   an interactive thread runs soon after its I/O completes or its
+   sleep ends even if its recent_cpu, which decays only once a
+   second, is higher than that of the CPU-bound threads.  The
+   boost halves every time its priority is recomputed while it
+   runs, so a thread that keeps the CPU soon loses it. */
+#define MLFQS_BOOST_MAX 16
+bool thread_mlfqs_boost;
+
 static void kernel_thread(thread_func *, void *aux);
 
 static void idle(void *aux UNUSED);
 static struct thread *running_thread(void);
-static struct thread *next_thread_to_run(void);
+static struct thread *next_thread_to_run(struct cpu *);
 static void init_thread(struct thread *, const char *name, int priority);
+static struct thread *alloc_thread(void);
+static void free_thread(struct thread *);
+static uint8_t *record_stack_use(struct thread *);
+static tid_t setup_thread(struct thread *, const char *name, int priority,
+                          thread_func *, void *aux);
 static bool is_thread(struct thread *) UNUSED;
 static void *alloc_frame(struct thread *, size_t size);
 static void schedule(void);
+static void yield_cpu(bool preempted);
+static void record_latency(struct thread *);
 void thread_schedule_tail(struct thread *prev);
 static tid_t allocate_tid(void);
+static hash_hash_func tid_hash;
+static hash_less_func tid_less;
+static void ready_queue_push(struct thread *);
+static void ready_queue_remove(struct thread *);
+static struct cpu *select_cpu(const struct thread *);
+static size_t cpu_load(const struct cpu *);
+static void move_thread(struct thread *, struct cpu *);
+static struct thread *take_migratable(struct cpu *from, struct cpu *to);
+static void rebalance_cpus(void);
+static void kick_cpu(struct cpu *);
+static const struct sched_class *class_of(const struct thread *);
+static bool class_tick(struct thread *, unsigned ticks_run);
+static bool class_yield_check(struct thread *);
+static int ready_queue_max_priority(const struct prio_rq *);
+static bool prio_init(struct cpu *);
+static void prio_enqueue(struct thread *);
+static void prio_dequeue(struct thread *);
+static struct thread *prio_pick_next(struct cpu *);
+static struct thread *prio_steal(struct cpu *);
+static bool prio_tick(struct thread *, unsigned ticks_run);
+static bool prio_yield_check(struct thread *);
+static void mlfqs_enqueue(struct thread *);
+static bool mlfqs_tick(struct thread *, unsigned ticks_run);
+
+/* Priority scheduling, round-robin within each priority. */
+static const struct sched_class sched_priority =
+{
+  "priority",
+  prio_init,
+  prio_enqueue,
+  prio_dequeue,
+  prio_pick_next,
+  prio_steal,
+  prio_tick,
+  prio_yield_check,
+  NULL
+};
+
+/* Multi-level feedback queue scheduling: priority scheduling
+   with priorities computed from nice and recent_cpu. */
+static const struct sched_class sched_mlfqs =
+{
+  "mlfqs",
+  prio_init,
+  mlfqs_enqueue,
+  prio_dequeue,
+  prio_pick_next,
+  prio_steal,
+  mlfqs_tick,
+  prio_yield_check,
+  NULL
+};
+static void mlfqs_catch_up(struct thread *);
+static int mlfqs_priority(const struct thread *);
+
+/* Orders sleeping threads by wake-up tick, earliest first.
+   Threads with equal wake-up ticks keep their insertion order. */
+LIST_DEFINE_ORDERED(sleeper, struct thread, sleeping_elements, wake_tick)
 
 /* Initializes the threading system by transforming the code
    that's currently running into a thread.  This can't work in
@@ -88,21 +281,102 @@ static tid_t allocate_tid(void);
    finishes. */
 void thread_init(void)
 {
+  struct thread *t;
+  size_t i;
+
   ASSERT(intr_get_level() == INTR_OFF);
 
-  lock_init(&tid_lock);
-  list_init(&ready_list);
+  fastlock_init(&tid_lock);
+  lock_set_name(&tid_lock.lock, "tid");
+  if (thread_cfs)
+  {
+    thread_mlfqs = false;
+    sched = &sched_cfs;
+  }
+  else
+    sched = thread_mlfqs ? &sched_mlfqs : &sched_priority;
+  /* The bootstrap processor's run queues are static, so this
+     cannot fail. */
+  sched->init(&cpus[0]);
+  sched_edf.init(&cpus[0]);
   list_init(&all_list);
-  list_init(&sleeping_list);
+  hash_init_fixed(&tid_table, tid_buckets, TID_BUCKETS, tid_hash, tid_less,
+                  NULL);
+  for (i = 0; i < SLEEP_WHEEL_SLOTS; i++)
+    list_init(&sleep_wheel[i]);
 
   /* Set the defualt load avg */
-  load_avg = 0;
+  load_avg = fp_from_int(0);
+  mlfqs_seconds = 0;
+  mlfqs_cursor = NULL;
+  all_cnt = 0;
+
+  if (thread_slice == 0)
+    thread_slice = 1;
+  for (i = 0; i < SLICE_BANDS; i++)
+  {
+    slice_ticks[i] = thread_slice;
+    if (thread_slice_scaled)
+      slice_ticks[i] = thread_slice * slice_halves[i] / 2;
+    if (slice_ticks[i] == 0)
+      slice_ticks[i] = 1;
+  }
 
-  /* Set up a thread structure for the running thread. */
-  initial_thread = running_thread();
-  init_thread(initial_thread, "main", PRI_DEFAULT);
-  initial_thread->status = THREAD_RUNNING;
-  initial_thread->tid = allocate_tid();
+  /* Set up a thread structure for the running thread.  Until
+     INITIAL_THREAD is set, cpu_current() does not look at it. */
+  t = running_thread();
+  init_thread(t, "main", PRI_DEFAULT);
+  t->status = THREAD_RUNNING;
+  cpus[0].current = t;
+  initial_thread = t;
+}
+
+/* Sets up application processor C, which cpu_start() is about to
+   start, to run threads: its run queues, and its idle thread,
+   which it starts out running.  Returns false if memory runs
+   out. */
+bool thread_cpu_init(struct cpu *c)
+{
+  struct thread *t;
+  char name[16];
+
+  ASSERT(!c->online);
+
+  if (!sched->init(c) || !sched_edf.init(c))
+    return false;
+  t = alloc_thread();
+  if (t == NULL)
+    return false;
+
+  snprintf(name, sizeof name, "idle/%zu", (size_t)(c - cpus));
+  init_thread(t, name, PRI_MIN);
+  t->status = THREAD_RUNNING;
+  t->cpu = c;
+  c->idle_thread = t;
+  c->current = t;
+  return true;
+}
+
+/* Runs the idle thread of the application processor that calls
+   it, which has just come online.  Called by cpu_ap_main() with
+   interrupts off and the kernel lock held. */
+void thread_start_ap(void)
+{
+  ASSERT(intr_get_level() == INTR_OFF);
+  ASSERT(running_thread() == cpu_current()->idle_thread);
+
+  idle(NULL);
+  NOT_REACHED();
+}
+
+/* Returns the processor that is running the caller, which is the
+   one that the running thread is on. */
+struct cpu *
+cpu_current(void)
+{
+  if (initial_thread == NULL)
+    return &cpus[0];
+  return running_thread()->cpu;
 }
 
 /* Starts preemptive thread scheduling by enabling interrupts.
@@ -126,58 +400,101 @@ void thread_start(void)
 void thread_tick(void)
 {
   struct thread *t = thread_current();
+  struct cpu *c = cpu_current();
 
   /* Update statistics. */
-  if (t == idle_thread)
-    idle_ticks++;
+  if (t == c->idle_thread)
+    this_cpu(idle_ticks)++;
 #ifdef USERPROG
   else if (t->pagedir != NULL)
-    user_ticks++;
+    this_cpu(user_ticks)++;
 #endif
   else
-    kernel_ticks++;
+    this_cpu(kernel_ticks)++;
 
-  /* Enforce preemption. */
-  if (++thread_ticks >= 4)
-    intr_yield_on_return();
+  if (c->bsp && cpu_online_cnt > 1 && timer_ticks() % REBALANCE_TICKS == 0)
+    rebalance_cpus();
 
-  if (thread_mlfqs)
+  /* Enforce preemption. */
+  ++c->thread_ticks;
+  if (t == c->idle_thread ? c->ready_cnt > 0 : class_tick(t, c->thread_ticks))
   {
-    t->recent_cpu = add_int_to_fixed_point_number(t->recent_cpu, 1);
-    if (thread_ticks % 4 == 0)
-    {
-      thread_update_priority_mlfqs(thread_current());
-    }
+    expiry_cnt++;
+    intr_yield_on_return();
   }
-  struct list_elem *elem = list_begin(&sleeping_list);
-  struct list_elem *temporary;
-
-  while (elem != list_end(&sleeping_list))
-  {
-    struct thread *t = list_entry(elem, struct thread, sleeping_elements);
-    temporary = elem;
-    elem = list_next(elem);
+  rcu_quiescent();
+}
 
-    // set the status to block
-    ASSERT(t->status == THREAD_BLOCKED);
+/* Prints thread statistics. */
+void thread_print_stats(void)
+{
+  struct list_elem *e;
+  long long idle = 0, kernel = 0, user = 0;
+  size_t id;
+  int i;
 
-    if (t->remaining_time > 0)
+  for (id = 0; id < cpu_cnt; id++)
+  {
+    idle += per_cpu(idle_ticks, id);
+    kernel += per_cpu(kernel_ticks, id);
+    user += per_cpu(user_ticks, id);
+  }
+  printf("Thread: %lld idle ticks, %lld kernel ticks, %lld user ticks\n",
+         idle, kernel, user);
+  printf("Thread: %lld context switches, %lld time slices used up\n",
+         switch_cnt, expiry_cnt);
+  if (steal_cnt > 0 || balance_cnt > 0)
+    printf("Thread: %lld threads stolen by idle CPUs, %lld moved by "
+           "rebalancing\n", steal_cnt, balance_cnt);
+  printf("Thread: %s scheduler, time slices", sched->name);
+  for (i = 0; i < SLICE_BANDS; i++)
+    printf(" %d-%d:%u", i * SLICE_BAND_WIDTH, (i + 1) * SLICE_BAND_WIDTH - 1,
+           slice_ticks[i]);
+  printf(" ticks\n");
+  sched_edf_print_stats();
+  printf("Thread: ready-to-run latency histogram (ticks):");
+  for (i = 0; i < LATENCY_BUCKETS; i++)
+    if (latency_hist[i] != 0)
     {
-      t->remaining_time--;
-      if (t->remaining_time <= 0)
-      {
-        thread_unblock(t);
-        list_remove(temporary);
-      }
+      if (i == 0)
+        printf(" 0:%u", latency_hist[i]);
+      else
+        printf(" %d+:%u", 1 << (i - 1), latency_hist[i]);
     }
-  }
+  printf("\n");
+
+  rcu_read_lock();
+  for (e = list_begin(&all_list); e != list_end(&all_list); e = list_next(e))
+    record_stack_use(list_entry(e, struct thread, all_threads));
+  rcu_read_unlock();
+  printf("Thread: struct thread is %zu bytes, deepest kernel stack "
+         "use %zu of %zu bytes (%s)\n",
+         sizeof(struct thread), max_stack_used, max_stack_size,
+         max_stack_name);
 }
 
-/* Prints thread statistics. */
-void thread_print_stats(void)
+/* Prints each thread's scheduler statistics.  Meant to be called
+   from kernel tests and debugging code, not from interrupt
+   context. */
+void thread_stats_dump(void)
 {
-  printf("Thread: %lld idle ticks, %lld kernel ticks, %lld user ticks\n",
-         idle_ticks, kernel_ticks, user_ticks);
+  struct list_elem *e;
+  enum intr_level old_level;
+
+  ASSERT(!intr_context());
+
+  old_level = intr_disable();
+  printf("%4s %-16s %3s %8s %8s %8s %8s %10s %8s\n", "tid", "name", "pri",
+         "switches", "vol", "invol", "donated", "ready", "max-lat");
+  for (e = list_begin(&all_list); e != list_end(&all_list); e = list_next(e))
+  {
+    struct thread *t = list_entry(e, struct thread, all_threads);
+    struct thread_sched_stats *st = &t->stats;
+    printf("%4d %-16s %3d %8u %8u %8u %8u %10lld %8lld\n", t->tid, t->name, t->priority,
+           st->switches, st->voluntary, st->involuntary, st->donations,
+           st->ready_ticks, st->max_latency);
+  }
+  intr_set_level(old_level);
 }
 
 /* Creates a new kernel thread named NAME with the given initial
@@ -199,21 +516,91 @@ tid_t thread_create(const char *name, int priority,
                     thread_func *function, void *aux)
 {
   struct thread *t;
-  struct kernel_thread_frame *kf;
-  struct switch_entry_frame *ef;
-  struct switch_threads_frame *sf;
   tid_t tid;
 
   ASSERT(function != NULL);
 
   /* Allocate thread. */
-  t = palloc_get_page(PAL_ZERO);
+  t = alloc_thread();
   if (t == NULL)
     return TID_ERROR;
 
+  tid = setup_thread(t, name, priority, function, aux);
+
+  /* Add to run queue. */
+  thread_unblock(t);
+  check_thread_yield();
+
+  return tid;
+}
+
+/* Creates CNT kernel threads named NAME/0, NAME/1, ..., each with
+   the given initial PRIORITY and executing FUNCTION with AUX as
+   the argument.  If TIDS is nonnull, stores each new thread's
+   identifier in TIDS[i].  Returns the number of threads created,
+   which is less than CNT only if memory ran out.
+
+   Unlike CNT calls to thread_create(), no new thread can run
+   until all of them have been created: they are made ready
+   together, with interrupts disabled once, and only then does
+   the caller yield to the highest-priority one. */
+size_t thread_create_batch(const char *name, int priority, thread_func *function,
+                           void *aux, size_t cnt, tid_t tids[])
+{
+  struct thread *first = NULL;
+  struct thread **link = &first;
+  enum intr_level old_level;
+  size_t created;
+
+  ASSERT(function != NULL);
+
+  /* Set up the threads, chaining them through their `elem'
+     members, which are unused until they become ready. */
+  for (created = 0; created < cnt; created++)
+  {
+    struct thread *t = alloc_thread();
+    char thread_name[sizeof t->name];
+    tid_t tid;
+
+    if (t == NULL)
+      break;
+    snprintf(thread_name, sizeof thread_name, "%s/%zu", name, created);
+    tid = setup_thread(t, thread_name, priority, function, aux);
+    if (tids != NULL)
+      tids[created] = tid;
+    *link = t;
+    link = (struct thread **)&t->elem.next;
+  }
+  *link = NULL;
+
+  old_level = intr_disable();
+  while (first != NULL)
+  {
+    struct thread *t = first;
+
+    first = (struct thread *)t->elem.next;
+    thread_unblock(t);
+  }
+  intr_set_level(old_level);
+  check_thread_yield();
+
+  return created;
+}
+
+/* Initializes the newly allocated thread T as a blocked thread
+   named NAME with the given PRIORITY, which will execute FUNCTION
+   with AUX as the argument once unblocked.  Returns its
+   identifier. */
+static tid_t
+setup_thread(struct thread *t, const char *name, int priority,
+             thread_func *function, void *aux)
+{
+  struct kernel_thread_frame *kf;
+  struct switch_entry_frame *ef;
+  struct switch_threads_frame *sf;
+
   /* Initialize thread. */
   init_thread(t, name, priority);
-  tid = t->tid = allocate_tid();
 
   /* Stack frame for kernel_thread(). */
   kf = alloc_frame(t, sizeof *kf);
@@ -230,11 +617,7 @@ tid_t thread_create(const char *name, int priority,
   sf->eip = switch_entry;
   sf->ebp = 0;
 
-  /* Add to run queue. */
-  thread_unblock(t);
-  check_thread_yield();
-
-  return tid;
+  return t->tid;
 }
 
 /* Puts the current thread to sleep.  It will not be scheduled
@@ -248,7 +631,11 @@ void thread_block(void)
   ASSERT(!intr_context());
   ASSERT(intr_get_level() == INTR_OFF);
 
+  thread_current()->stats.voluntary++;
   thread_current()->status = THREAD_BLOCKED;
+  if (thread_mlfqs_boost)
+    thread_current()->blocked_tick = timer_ticks();
+  trace(TRACE_BLOCK, thread_current()->tid, 0);
   schedule();
 }
 
@@ -268,8 +655,9 @@ void thread_unblock(struct thread *t)
 
   old_level = intr_disable();
   ASSERT(t->status == THREAD_BLOCKED);
-  list_insert_ordered(&ready_list, &t->elem, compare_threads, NULL);
+  ready_queue_push(t);
   t->status = THREAD_READY;
+  trace(TRACE_UNBLOCK, t->tid, 0);
   intr_set_level(old_level);
 }
 
@@ -314,12 +702,17 @@ void thread_exit(void)
 #ifdef USERPROG
   process_exit();
 #endif
+  thread_set_deadline(0, 0, 0);
 
   /* Remove thread from all threads list, set our status to dying,
      and schedule another process.  That process will destroy us
      when it calls thread_schedule_tail(). */
   intr_disable();
+  if (mlfqs_cursor == &thread_current()->all_threads)
+    mlfqs_cursor = list_next(mlfqs_cursor);
   list_remove(&thread_current()->all_threads);
+  hash_delete(&tid_table, &thread_current()->tid_elem);
+  all_cnt--;
   thread_current()->status = THREAD_DYING;
   schedule();
   NOT_REACHED();
@@ -328,6 +721,25 @@ void thread_exit(void)
 /* Yields the CPU.  The current thread is not put to sleep and
    may be scheduled again immediately at the scheduler's whim. */
 void thread_yield(void)
+{
+  yield_cpu(false);
+}
+
+/* Like thread_yield(), but for when the scheduler takes the CPU
+   away from the current thread, because its time slice expired
+   or a higher-priority thread became ready.  Only the scheduler
+   statistics tell the two apart.  A thread in an RCU read-side
+   critical section yields at the end of the section instead. */
+void thread_preempt(void)
+{
+  if (rcu_may_preempt())
+    yield_cpu(true);
+}
+
+/* Puts the current thread back on the run queue and schedules.
+   PREEMPTED says whether the switch is counted as involuntary. */
+static void
+yield_cpu(bool preempted)
 {
   struct thread *current = thread_current();
   enum intr_level old_level;
@@ -335,17 +747,50 @@ void thread_yield(void)
   ASSERT(!intr_context());
 
   old_level = intr_disable();
-  if (current != idle_thread)
+  if (preempted)
+    current->stats.involuntary++;
+  else
+    current->stats.voluntary++;
+  if (current != cpu_current()->idle_thread)
   {
-    list_insert_ordered(&ready_list, &current->elem, compare_threads, NULL);
+    ready_queue_push(current);
   }
   current->status = THREAD_READY;
   schedule();
   intr_set_level(old_level);
 }
 
+/* Charges the running thread's CPU time since it was last
+   charged to TO, then starts a new span. */
+static void
+charge_time(uint64_t *to)
+{
+  enum intr_level old_level = intr_disable();
+  uint64_t now = timer_cycles();
+  struct thread *t = thread_current();
+
+  *to += now - t->usage_since;
+  t->usage_since = now;
+  intr_set_level(old_level);
+}
+
+/* Charges the running thread's time since it was last charged to
+   user mode.  Called on entry to the kernel from user mode. */
+void thread_charge_user(void)
+{
+  charge_time(&thread_current()->usage.user_cycles);
+}
+
+/* Charges the running thread's time since it was last charged to
+   the kernel.  Called on the way back to user mode. */
+void thread_charge_kernel(void)
+{
+  charge_time(&thread_current()->usage.kernel_cycles);
+}
+
 /* Invoke function 'func' on all threads, passing along 'aux'.
-   This function must be called with interrupts off. */
+   This function must be called with interrupts off, or, if FUNC
+   only reads the threads, within rcu_read_lock(). */
 void thread_foreach(thread_action_func *func, void *aux)
 {
   struct list_elem *elem;
@@ -360,6 +805,21 @@ void thread_foreach(thread_action_func *func, void *aux)
   }
 }
 
+/* Returns the thread whose tid is TID, or a null pointer if no
+   such thread is alive.  Must be called with interrupts off, and
+   the thread may only be used until they are turned back on. */
+struct thread *thread_lookup(tid_t tid)
+{
+  struct thread key;
+  struct hash_elem *e;
+
+  ASSERT(intr_get_level() == INTR_OFF);
+
+  key.tid = tid;
+  e = hash_find(&tid_table, &key.tid_elem);
+  return e != NULL ? hash_entry(e, struct thread, tid_elem) : NULL;
+}
+
 /* Sets the current thread's priority to NEW_PRIORITY. */
 void thread_set_priority(int new_priority)
 {
@@ -376,14 +836,24 @@ int thread_get_priority(void)
   return thread_current()->priority;
 }
 
-// remove the UNUSED
+/* Sets the current thread's nice value to NICE, which must be
+   between NICE_MIN and NICE_MAX, and recomputes its priority
+   under the MLFQS. */
 void thread_set_nice(int nice)
 {
+  enum intr_level old_level;
+
+  ASSERT(nice >= NICE_MIN && nice <= NICE_MAX);
+
+  old_level = intr_disable();
   thread_current()->nice = nice;
-  thread_update_priority_mlfqs(thread_current());
+  if (thread_mlfqs)
+    thread_update_priority_mlfqs(thread_current());
+  intr_set_level(old_level);
   check_thread_yield();
 }
 
+/* Returns the current thread's nice value. */
 int thread_get_nice(void)
 {
   return thread_current()->nice;
@@ -391,35 +861,51 @@ int thread_get_nice(void)
 
 int thread_get_load_avg(void)
 {
-  return convert_fixed_point_to_int_round_to_nearest(multiply_fixed_point_numbers(load_avg, 100));
+  return fp_round(fp_mul_int(load_avg, 100));
+}
+
+/* Starts the load average over from 0, as at boot, for a test
+   that expects to see it rise from there. */
+void thread_reset_load_avg(void)
+{
+  enum intr_level old_level = intr_disable();
+  load_avg = fp_from_int(0);
+  intr_set_level(old_level);
 }
 
 int thread_get_recent_cpu(void)
 {
-  return convert_fixed_point_to_int_round_to_nearest(multiply_fixed_point_numbers(thread_current()->recent_cpu, 100));
+  return fp_round(fp_mul_int(thread_current()->recent_cpu, 100));
 }
 
 /* Idle thread.  Executes when no other thread is ready to run.
 
-   The idle thread is initially put on the ready list by
-   thread_start().  It will be scheduled once initially, at which
-   point it initializes idle_thread, "up"s the semaphore passed
-   to it to enable thread_start() to continue, and immediately
-   blocks.  After that, the idle thread never appears in the
-   ready list.  It is returned by next_thread_to_run() as a
-   special case when the ready list is empty. */
+   The bootstrap processor's idle thread is initially put on the
+   ready list by thread_start().  It will be scheduled once
+   initially, at which point it initializes idle_thread, "up"s the
+   semaphore passed to it to enable thread_start() to continue,
+   and immediately blocks.  After that, the idle thread never
+   appears in the ready list.  It is returned by
+   next_thread_to_run() as a special case when the ready list is
+   empty.  An application processor starts out running its idle
+   thread, which thread_start_ap() calls with a null IDLE_STARTED.
+
+   The processor does not hold the kernel lock while it halts. */
 static void
 idle(void *idle_started_ UNUSED)
 {
   struct semaphore *idle_started = idle_started_;
-  idle_thread = thread_current();
-  sema_up(idle_started);
+  cpu_current()->idle_thread = thread_current();
+  if (idle_started != NULL)
+    sema_up(idle_started);
 
   for (;;)
   {
     /* Let someone else run. */
     intr_disable();
     thread_block();
+    timer_idle_enter();
+    kernel_lock_exit();
 
     /* Re-enable interrupts and wait for the next one.
 
@@ -434,6 +920,8 @@ idle(void *idle_started_ UNUSED)
        See [IA32-v2a] "HLT", [IA32-v2b] "STI", and [IA32-v3a]
        7.11.1 "HLT Instruction". */
     asm volatile("sti; hlt" : : : "memory");
+    kernel_lock_enter();
+    timer_idle_exit();
   }
 }
 
@@ -459,6 +947,12 @@ running_thread(void)
      always at the beginning of a page and the stack pointer is
      somewhere in the middle, this locates the curent thread. */
   asm("mov %%esp, %0" : "=g"(esp));
+  if ((uint8_t *)esp >= kstack_base && (uint8_t *)esp < kstack_end)
+  {
+    /* A guarded stack: struct thread is at the top of the slot. */
+    size_t slot = ((uint8_t *)esp - kstack_base) / KSTACK_SLOT_SIZE;
+    return (struct thread *)(kstack_base + (slot + 1) * KSTACK_SLOT_SIZE - THREAD_SIZE);
+  }
   return pg_round_down(esp);
 }
 
@@ -470,7 +964,7 @@ is_thread(struct thread *t)
 }
 
 /* Does basic initialization of T as a blocked thread named
-   NAME. */
+   NAME, and gives it a tid. */
 static void
 init_thread(struct thread *t, const char *name, int priority)
 {
@@ -481,19 +975,41 @@ init_thread(struct thread *t, const char *name, int priority)
   ASSERT(name != NULL);
 
   memset(t, 0, sizeof *t);
+  t->cpu = &cpus[0];
   t->status = THREAD_BLOCKED;
   strlcpy(t->name, name, sizeof t->name);
-  t->stack = (uint8_t *)t + PGSIZE;
+  if ((uint8_t *)t >= kstack_base && (uint8_t *)t < kstack_end)
+  {
+    t->stack_base = (uint8_t *)t + THREAD_SIZE - KSTACK_PAGES * PGSIZE;
+    t->stack_top = (uint8_t *)t;
+  }
+  else
+  {
+    t->stack_base = (uint8_t *)(t + 1);
+    t->stack_top = (uint8_t *)t + PGSIZE;
+  }
+  t->stack = t->stack_top;
   t->priority = priority;
   t->magic = THREAD_MAGIC;
+  t->tid = allocate_tid();
 
-  t->remaining_time = 0;
+  t->wake_tick = 0;
   t->our_priority = priority;
   t->curr_lock = NULL;
-  list_init(&t->held_lock);
+  pheap_init(&t->held_lock, compare_locks, NULL);
+  t->wait_sema = NULL;
+#ifdef USERPROG
+  t->stack_slot = -1;
+  t->exit_code = -1;
+  t->syscall_frame = NULL;
+  list_init(&t->children);
+#endif
 
   old_level = intr_disable();
-  list_push_back(&all_list, &t->all_threads);
+  t->recent_cpu_secs = mlfqs_seconds;
+  rcu_list_push_back(&all_list, &t->all_threads);
+  hash_insert(&tid_table, &t->tid_elem);
+  all_cnt++;
   intr_set_level(old_level);
 }
 
@@ -510,20 +1026,168 @@ alloc_frame(struct thread *t, size_t size)
   return t->stack;
 }
 
-/* Chooses and returns the next thread to be scheduled.  Should
-   return a thread from the run queue, unless the run queue is
-   empty.  (If the running thread can continue running, then it
-   will be in the run queue.)  If the run queue is empty, return
-   idle_thread. */
+/* Reserves the region for thread_kstack_cnt guarded kernel
+   stacks, if that is nonzero.  Must be called after malloc_init()
+   and before paging_init(), which leaves the guard pages
+   unmapped. */
+void thread_kstacks_reserve(void)
+{
+  if (thread_kstack_cnt == 0)
+    return;
+
+  kstack_base = palloc_get_multiple(PAL_ZERO, thread_kstack_cnt * (KSTACK_PAGES + 1));
+  kstack_map = bitmap_create(thread_kstack_cnt);
+  if (kstack_base == NULL || kstack_map == NULL)
+  {
+    printf("Cannot reserve %zu guarded kernel stacks.\n", thread_kstack_cnt);
+    if (kstack_base != NULL)
+      palloc_free_multiple(kstack_base, thread_kstack_cnt * (KSTACK_PAGES + 1));
+    if (kstack_map != NULL)
+      bitmap_destroy(kstack_map);
+    kstack_base = NULL;
+    kstack_map = NULL;
+    thread_kstack_cnt = 0;
+    return;
+  }
+  kstack_end = kstack_base + thread_kstack_cnt * KSTACK_SLOT_SIZE;
+}
+
+/* Returns true if the guarded stack region overlaps the virtual
+   addresses [START, END). */
+bool thread_kstacks_overlap(const void *start, const void *end)
+{
+  return kstack_base != NULL && (const uint8_t *)start < kstack_end && (const uint8_t *)end > kstack_base;
+}
+
+/* Returns true if ADDR is in the guard page of a guarded stack. */
+bool thread_kstack_is_guard(const void *addr)
+{
+  const uint8_t *p = addr;
+
+  return p >= kstack_base && p < kstack_end && (p - kstack_base) % KSTACK_SLOT_SIZE < PGSIZE;
+}
+
+/* Allocates memory for a new thread, in a free guarded stack
+   slot if there is one, and otherwise in a page of its own,
+   preferably a recycled one.  The stack comes back zeroed.
+   Returns the address for its struct thread, or a null pointer if
+   memory is exhausted. */
 static struct thread *
-next_thread_to_run(void)
+alloc_thread(void)
+{
+  struct thread *t = NULL;
+  enum intr_level old_level;
+
+  old_level = intr_disable();
+  if (kstack_map != NULL)
+  {
+    size_t slot = bitmap_scan_and_flip(kstack_map, 0, 1, false);
+    if (slot != BITMAP_ERROR)
+      t = (struct thread *)(kstack_base + (slot + 1) * KSTACK_SLOT_SIZE - THREAD_SIZE);
+  }
+  if (t == NULL && thread_cache_cnt > 0)
+    t = thread_cache[--thread_cache_cnt];
+  intr_set_level(old_level);
+
+  if (t == NULL)
+    return palloc_get_page(PAL_ZERO);
+
+  /* A slot that has never been used is still zero from
+     thread_kstacks_reserve(), including its `stack' member. */
+  if (t->stack != NULL)
+    memset(t->stack, 0, t->stack_top - t->stack);
+  return t;
+}
+
+/* Frees the memory of dead thread T.  Must be called with
+   interrupts off. */
+static void
+free_thread(struct thread *t)
 {
-  if (list_empty(&ready_list))
-    return idle_thread;
+  ASSERT(intr_get_level() == INTR_OFF);
+
+  /* Remember how much of the stack alloc_thread() must zero. */
+  t->stack = record_stack_use(t);
+  if ((uint8_t *)t >= kstack_base && (uint8_t *)t < kstack_end)
+    bitmap_reset(kstack_map, ((uint8_t *)t - kstack_base) / KSTACK_SLOT_SIZE);
+  else if (thread_cache_cnt < THREAD_CACHE_SIZE)
+    thread_cache[thread_cache_cnt++] = t;
   else
+    palloc_free_page(t);
+}
+
+/* Frees the dead thread that contains HEAD, once no thread can
+   still be walking all_list through it. */
+static void
+free_dead_thread(struct rcu_head *head)
+{
+  enum intr_level old_level = intr_disable();
+  free_thread(rcu_entry(head, struct thread, free_rcu));
+  intr_set_level(old_level);
+}
+
+/* Folds T's kernel stack use into the high-water mark reported by
+   thread_print_stats().  A stack starts out zeroed, so its use
+   is measured from the top of the stack down to the lowest
+   nonzero word, which can only underestimate it.  Returns the
+   address of that word, or the top of the stack if it is unused.
+   The initial thread's stack was not zeroed, so it is skipped. */
+static uint8_t *
+record_stack_use(struct thread *t)
+{
+  const uint32_t *p;
+  size_t used;
+
+  if (t == initial_thread)
+    return t->stack_base;
+
+  for (p = (const uint32_t *)t->stack_base; p < (const uint32_t *)t->stack_top; p++)
+    if (*p != 0)
+      break;
+  used = t->stack_top - (const uint8_t *)p;
+  if (used > max_stack_used)
+  {
+    max_stack_used = used;
+    max_stack_size = t->stack_top - t->stack_base;
+    strlcpy(max_stack_name, t->name, sizeof max_stack_name);
+  }
+  return (uint8_t *)p;
+}
+
+/* Chooses and returns the next thread to be scheduled on
+   processor C.  Should return a thread from C's run queue, unless
+   the run queue is empty.  (If the running thread can continue
+   running, then it will be in the run queue.)  If the run queue
+   is empty, take a thread from the processor with the most ready
+   threads, if it has one that may move, or else return C's idle
+   thread. */
+static struct thread *
+next_thread_to_run(struct cpu *c)
+{
+  struct thread *t = sched_edf.pick_next(c);
+  struct cpu *busiest = NULL;
+  size_t id;
+
+  if (t == NULL)
+    t = sched->pick_next(c);
+  if (t != NULL)
   {
-    return list_entry(list_pop_back(&ready_list), struct thread, elem);
+    c->ready_cnt--;
+    return t;
   }
+
+  for (id = 0; id < cpu_cnt; id++)
+  {
+    struct cpu *other = &cpus[id];
+    if (other != c && other->online && other->ready_cnt > 0 && (busiest == NULL || other->ready_cnt > busiest->ready_cnt))
+      busiest = other;
+  }
+  if (busiest != NULL && (t = take_migratable(busiest, c)) != NULL)
+  {
+    steal_cnt++;
+    return t;
+  }
+  return c->idle_thread;
 }
 
 /* Completes a thread switch by activating the new thread's page
@@ -545,14 +1209,18 @@ next_thread_to_run(void)
 void thread_schedule_tail(struct thread *prev)
 {
   struct thread *current = running_thread();
+  struct cpu *c = current->cpu;
 
   ASSERT(intr_get_level() == INTR_OFF);
 
   /* Mark us as running. */
   current->status = THREAD_RUNNING;
+  c->current = current;
+  if (prev != NULL)
+    record_latency(current);
 
   /* Start new time slice. */
-  thread_ticks = 0;
+  c->thread_ticks = 0;
 
 #ifdef USERPROG
   /* Activate the new address space. */
@@ -561,14 +1229,16 @@ void thread_schedule_tail(struct thread *prev)
 
   /* If the thread we switched from is dying, destroy its struct
      thread.  This must happen late so that thread_exit() doesn't
-     pull out the rug under itself.  (We don't free
-     initial_thread because its memory was not obtained via
-     palloc().) */
+     pull out the rug under itself, and only after an RCU grace
+     period, since readers may still be walking all_list through
+     it.  (We don't free initial_thread because its memory was not
+     obtained via palloc().) */
   if (prev != NULL && prev->status == THREAD_DYING && prev != initial_thread)
   {
     ASSERT(prev != current);
-    palloc_free_page(prev);
+    call_rcu(&prev->free_rcu, free_dead_thread);
   }
+  rcu_quiescent();
 }
 
 /* Schedules a new process.  At entry, interrupts must be off and
@@ -582,15 +1252,26 @@ static void
 schedule(void)
 {
   struct thread *current = running_thread();
-  struct thread *next = next_thread_to_run();
+  struct thread *next = next_thread_to_run(current->cpu);
   struct thread *prev = NULL;
+  uint64_t now;
 
   ASSERT(intr_get_level() == INTR_OFF);
   ASSERT(current->status != THREAD_RUNNING);
+  ASSERT(current->rcu_depth == 0);
   ASSERT(is_thread(next));
 
+  /* schedule() always runs in the kernel. */
+  now = timer_cycles();
+  current->usage.kernel_cycles += now - current->usage_since;
+  next->usage_since = now;
+
   if (current != next)
+  {
+    switch_cnt++;
+    trace(TRACE_SCHEDULE, current->tid, next->tid);
     prev = switch_threads(current, next);
+  }
   thread_schedule_tail(prev);
 }
 
@@ -601,60 +1282,180 @@ allocate_tid(void)
   static tid_t next_tid = 1;
   tid_t tid;
 
-  lock_acquire(&tid_lock);
+  fastlock_acquire(&tid_lock);
   tid = next_tid++;
-  lock_release(&tid_lock);
+  fastlock_release(&tid_lock);
 
   return tid;
 }
 
+/* Returns a hash value for the thread containing E. */
+static unsigned
+tid_hash(const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int(hash_entry(e, struct thread, tid_elem)->tid);
+}
+
+/* Returns true if the thread containing A has a lower tid than
+   the one containing B. */
+static bool
+tid_less(const struct hash_elem *a, const struct hash_elem *b,
+         void *aux UNUSED)
+{
+  return (hash_entry(a, struct thread, tid_elem)->tid
+          < hash_entry(b, struct thread, tid_elem)->tid);
+}
+
 /* Offset of `stack' member within `struct thread'.
    Used by switch.S, which can't figure it out on its own. */
 uint32_t thread_stack_ofs = offsetof(struct thread, stack);
 
+/* Yields the CPU if a thread that has become ready, such as one
+   just woken, should run instead of the running thread.  In an
+   interrupt handler, which cannot yield, the yield happens as the
+   interrupt returns instead, so that a thread woken by a device's
+   interrupt runs at once rather than at the next tick. */
 void check_thread_yield(void)
 {
   enum intr_level old_level = intr_disable();
-  bool should_yield = !list_empty(&ready_list) && list_entry(list_back(&ready_list), struct thread, elem)->priority > thread_get_priority();
+  struct thread *t = thread_current();
+  struct cpu *c = cpu_current();
+  bool should_yield = t == c->idle_thread ? c->ready_cnt > 0 : class_yield_check(t);
   intr_set_level(old_level);
 
   if (should_yield)
   {
-    thread_yield();
+    if (intr_context())
+      intr_yield_on_return();
+    else
+      thread_preempt();
   }
 }
 
 void tick_every_second(void)
 {
   enum intr_level old_level = intr_disable();
-  int waiting_threads = (list_size(&ready_list)) + ((thread_current() != idle_thread) ? 1 : 0);
+  int waiting_threads = 0;
+  struct list ready;
+  size_t sweep_cnt;
+  fixed_point twice_load;
+  size_t id;
+
+  for (id = 0; id < cpu_cnt; id++)
+    if (cpus[id].online)
+      waiting_threads += cpu_load(&cpus[id]);
+  load_avg = fp_add(fp_mul(LOAD_AVG_DECAY, load_avg), fp_mul_int(LOAD_AVG_GAIN, waiting_threads));
+  twice_load = fp_mul_int(load_avg, 2);
+  mlfqs_seconds++;
+  decay_history[mlfqs_seconds % MLFQS_HISTORY] = fp_div(twice_load, fp_add_int(twice_load, 1));
+
+  /* The running threads and every ready thread are decayed now,
+     because their priorities drive the next scheduling decisions.
+     Ready threads are taken off the run queues first, then put
+     back under their new priorities in their original order, each
+     on its own processor's. */
+  list_init(&ready);
+  for (id = 0; id < cpu_cnt; id++)
+  {
+    struct prio_rq *rq = prio_rqs[id];
+    int priority;
 
-  load_avg = add_fixed_point_numbers(divide_fixed_point_numbers(multiply_fixed_point_numbers(load_avg, 59), 60), divide_fixed_point_numbers(convert_int_to_fixed_point(waiting_threads), 60));
-  thread_foreach(thread_update_recent_cpu, NULL);
+    if (!cpus[id].online)
+      continue;
+    thread_update_recent_cpu(cpus[id].current, NULL);
+    while ((priority = ready_queue_max_priority(rq)) >= PRI_MIN)
+    {
+      struct thread *t = list_entry(list_front(&rq->queues[priority]), struct thread, elem);
+      ready_queue_remove(t);
+      list_push_back(&ready, &t->elem);
+    }
+  }
+  while (!list_empty(&ready))
+  {
+    struct thread *t = list_entry(list_pop_front(&ready), struct thread, elem);
+    mlfqs_catch_up(t);
+    t->priority = mlfqs_priority(t);
+    ready_queue_push(t);
+  }
+
+  /* Blocked threads are caught up lazily, plus a slice of all_list
+     so that none of them falls out of the history window. */
+  for (sweep_cnt = all_cnt / (MLFQS_HISTORY / 2) + 1; sweep_cnt > 0; sweep_cnt--)
+  {
+    struct thread *t;
+
+    if (mlfqs_cursor == NULL || mlfqs_cursor == list_end(&all_list))
+      mlfqs_cursor = list_begin(&all_list);
+    t = list_entry(mlfqs_cursor, struct thread, all_threads);
+    mlfqs_cursor = list_next(mlfqs_cursor);
+    if (t->status == THREAD_BLOCKED)
+      thread_update_recent_cpu(t, NULL);
+  }
   intr_set_level(old_level);
 }
 
-void set_sleeping_thread(int64_t ticks)
+void set_sleeping_thread(int64_t wake_tick)
 {
   struct thread *current = thread_current();
-  current->remaining_time = ticks;
-  list_push_back(&sleeping_list, &current->sleeping_elements);
+
+  ASSERT(intr_get_level() == INTR_OFF);
+
+  current->wake_tick = wake_tick;
+  sleeper_insert_ordered(&sleep_wheel[wake_tick % SLEEP_WHEEL_SLOTS],
+                         current);
   thread_block();
 }
 
+void wake_sleeping_threads(int64_t now)
+{
+  struct list *slot = &sleep_wheel[now % SLEEP_WHEEL_SLOTS];
+
+  ASSERT(intr_get_level() == INTR_OFF);
+
+  while (!list_empty(slot))
+  {
+    struct thread *t = list_entry(list_front(slot), struct thread, sleeping_elements);
+    if (t->wake_tick > now)
+      break;
+
+    ASSERT(t->status == THREAD_BLOCKED);
+    list_pop_front(slot);
+    t->wake_tick = 0;
+    thread_unblock(t);
+  }
+}
+
+bool thread_wake_early(struct thread *t)
+{
+  ASSERT(intr_get_level() == INTR_OFF);
+
+  if (t->wake_tick == 0)
+    return false;
+
+  ASSERT(t->status == THREAD_BLOCKED);
+  list_remove(&t->sleeping_elements);
+  t->wake_tick = 0;
+  thread_unblock(t);
+  return true;
+}
+
 void update_thread(struct thread *t)
 {
   enum intr_level old_level = intr_disable();
   int our_priority = t->our_priority;
-  if (list_empty(&t->held_lock))
+  if (pheap_empty(&t->held_lock))
   {
     t->priority = our_priority;
   }
   else
   {
-    int priority = list_entry(list_max(&t->held_lock, compare_locks, NULL), struct lock, elem)->max_p;
+    int priority = pheap_entry(pheap_top(&t->held_lock), struct lock, elem)->max_p;
     t->priority = our_priority > priority ? our_priority : priority;
   }
+  if (t->status == THREAD_BLOCKED)
+  {
+    sema_requeue(t);
+  }
   intr_set_level(old_level);
 }
 
@@ -662,23 +1463,451 @@ void rearrange_ready_list(struct thread *t)
 {
   ASSERT(t->status == THREAD_READY);
   enum intr_level old_level = intr_disable();
-  list_remove(&t->elem);
-  list_insert_ordered(&ready_list, &t->elem, compare_threads, NULL);
+  if (t->ready_priority != t->priority)
+  {
+    ready_queue_remove(t);
+    ready_queue_push(t);
+  }
   intr_set_level(old_level);
 }
 
 void thread_update_recent_cpu(struct thread *t, void *aux UNUSED)
 {
-  t->recent_cpu = add_int_to_fixed_point_number(divide_integer_by_fixed_point(multiply_fixed_point_numbers_by_int(multiply_fixed_point_numbers(load_avg, 2), t->recent_cpu),
-                                                                              add_int_to_fixed_point_number(multiply_fixed_point_numbers(load_avg, 2), 1)),
-                                                t->nice);
+  mlfqs_catch_up(t);
   thread_update_priority_mlfqs(t);
 }
 
 void thread_update_priority_mlfqs(struct thread *t)
 {
-  int new_priority = (int)convert_fixed_point_to_int_round_to_nearest(subtract_fixed_point_numbers(convert_int_to_fixed_point((PRI_MAX - ((t->nice) * 2))),
-                                                                                                   divide_fixed_point_numbers(t->recent_cpu, 4)));
+  t->priority = mlfqs_priority(t);
+  if (t->status == THREAD_READY)
+  {
+    rearrange_ready_list(t);
+  }
+  else if (t->status == THREAD_BLOCKED)
+  {
+    sema_requeue(t);
+  }
+}
+
+int64_t get_next_wake_tick(int64_t now, int64_t limit)
+{
+  int64_t tick;
+
+  ASSERT(intr_get_level() == INTR_OFF);
+
+  /* Each slot is sorted and nothing in it is overdue, so a thread
+     waking at TICK must be at the front of TICK's slot. */
+  for (tick = now + 1; tick < limit; tick++)
+  {
+    struct list *slot = &sleep_wheel[tick % SLEEP_WHEEL_SLOTS];
+    if (!list_empty(slot) && list_entry(list_front(slot), struct thread, sleeping_elements)->wake_tick <= tick)
+      break;
+  }
+  return tick;
+}
+
+void thread_skip_ticks(int64_t cnt)
+{
+  this_cpu(idle_ticks) += cnt;
+}
+
+/* Gives ready thread T to the scheduling class, on the run queue
+   of the processor that select_cpu() chooses, and interrupts that
+   processor if T should run there right away.  Must be called
+   with interrupts off. */
+static void
+ready_queue_push(struct thread *t)
+{
+  struct cpu *c;
+
+  ASSERT(intr_get_level() == INTR_OFF);
+
+  c = select_cpu(t);
+  move_thread(t, c);
+  t->stats.ready_since = timer_ticks();
+  class_of(t)->enqueue(t);
+  c->ready_cnt++;
+  kick_cpu(c);
+}
+
+/* Takes ready thread T back from the scheduling class.  Must be
+   called with interrupts off. */
+static void
+ready_queue_remove(struct thread *t)
+{
+  ASSERT(intr_get_level() == INTR_OFF);
+
+  class_of(t)->dequeue(t);
+  t->cpu->ready_cnt--;
+}
+
+/* Returns the processor on whose run queue T should become ready.
+   A running thread stays where it is.  A waking thread of a user
+   process goes to the least loaded online processor, preferring
+   the one it last ran on, and one that is requeued while ready,
+   as when priority donation raises its priority, moves only to
+   an idle processor, and only if its own is busy.  Kernel
+   threads stay on the bootstrap processor; see
+   thread_migratable(). */
+static struct cpu *
+select_cpu(const struct thread *t)
+{
+  struct cpu *best = t->cpu;
+  size_t id;
+
+  if (t->status == THREAD_RUNNING || cpu_online_cnt == 1)
+    return best;
+  if (!thread_migratable(t))
+    return &cpus[0];
+  for (id = 0; id < cpu_cnt; id++)
+  {
+    struct cpu *c = &cpus[id];
+
+    if (!c->online)
+      continue;
+    if (t->status == THREAD_BLOCKED ? cpu_load(c) < cpu_load(best) : cpu_load(c) == 0 && cpu_load(best) > 0)
+      best = c;
+  }
+  return best;
+}
+
+/* Returns true if ready thread T may move to another processor,
+   which only a user process's thread may.  Kernel code, such as
+   the threads tests, counts on the orderings that a single
+   processor gives, for example that a thread of higher priority
+   runs before one of lower priority does, so kernel threads all
+   run on the bootstrap processor. */
+bool thread_migratable(const struct thread *t)
+{
+#ifdef USERPROG
+  return t->process != NULL;
+#else
+  (void)t;
+  return false;
+#endif
+}
+
+/* Moves thread T, which is on no run queue, to processor TO. */
+static void
+move_thread(struct thread *t, struct cpu *to)
+{
+  if (t->cpu == to)
+    return;
+
+  /* The best-effort class's state goes along even while T is an
+     EDF thread. */
+  if (sched->migrate != NULL)
+    sched->migrate(t, to);
+  if (sched_edf.migrate != NULL)
+    sched_edf.migrate(t, to);
+  t->cpu = to;
+}
+
+/* Takes the migratable ready thread that would run first off
+   FROM's run queue, moves it to processor TO and returns it, or
+   returns a null pointer if FROM has none.  The caller puts it on
+   TO's run queue or runs it.  EDF threads are never taken. */
+static struct thread *
+take_migratable(struct cpu *from, struct cpu *to)
+{
+  struct thread *t;
+
+  if (sched->steal == NULL || (t = sched->steal(from)) == NULL)
+    return NULL;
+  from->ready_cnt--;
+  move_thread(t, to);
+  return t;
+}
+
+/* Moves a ready thread from the most loaded online processor to
+   the least loaded one, if the move makes their loads more even.
+   Idle processors take work themselves only when they schedule,
+   and an idle processor halts until something interrupts it, so
+   the bootstrap processor calls this every REBALANCE_TICKS timer
+   ticks. */
+static void
+rebalance_cpus(void)
+{
+  struct cpu *busiest = NULL, *idlest = NULL;
+  struct thread *t;
+  size_t id;
+
+  ASSERT(intr_get_level() == INTR_OFF);
+
+  for (id = 0; id < cpu_cnt; id++)
+  {
+    struct cpu *c = &cpus[id];
+
+    if (!c->online)
+      continue;
+    if (busiest == NULL || cpu_load(c) > cpu_load(busiest))
+      busiest = c;
+    if (idlest == NULL || cpu_load(c) < cpu_load(idlest))
+      idlest = c;
+  }
+  if (busiest->ready_cnt == 0 || cpu_load(busiest) < cpu_load(idlest) + 2)
+    return;
+
+  t = take_migratable(busiest, idlest);
+  if (t == NULL)
+    return;
+  balance_cnt++;
+  class_of(t)->enqueue(t);
+  idlest->ready_cnt++;
+  kick_cpu(idlest);
+}
+
+/* Interrupts processor C, unless it is the running one, if a
+   thread just put on its run queue should run there right away. */
+static void
+kick_cpu(struct cpu *c)
+{
+  if (c != cpu_current() && (c->current == c->idle_thread || class_yield_check(c->current)))
+    cpu_resched(c);
+}
+
+/* Returns the number of threads that processor C is running or
+   has ready to run, other than its idle thread. */
+static size_t
+cpu_load(const struct cpu *c)
+{
+  return c->ready_cnt + (c->current != c->idle_thread);
+}
+
+/* Returns the scheduling class for T: the EDF class while T has
+   a deadline and budget left, otherwise the class selected at
+   boot.  A thread only changes classes while it is not ready. */
+static const struct sched_class *
+class_of(const struct thread *t)
+{
+  return sched_edf_member(t) ? &sched_edf : sched;
+}
+
+/* Calls the tick hook of running thread T's class and returns
+   true if T should be preempted.  Any ready EDF thread preempts a
+   best-effort thread. */
+static bool
+class_tick(struct thread *t, unsigned ticks_run)
+{
+  if (sched_edf_member(t))
+    return sched_edf.tick(t, ticks_run);
+  return sched->tick(t, ticks_run) || sched_edf_pending(t->cpu);
+}
+
+/* Returns true if running thread T should yield to a ready
+   thread, as class_tick() would preempt it. */
+static bool
+class_yield_check(struct thread *t)
+{
+  if (sched_edf_member(t))
+    return sched_edf.yield_check(t);
+  return sched_edf_pending(t->cpu) || sched->yield_check(t);
+}
+
+static bool
+prio_init(struct cpu *c)
+{
+  struct prio_rq *rq = c->bsp ? &prio_boot_rq : malloc(sizeof *rq);
+  int i;
+
+  if (rq == NULL)
+    return false;
+  for (i = PRI_MIN; i <= PRI_MAX; i++)
+    list_init(&rq->queues[i]);
+  rq->bitmap = 0;
+  prio_rqs[c - cpus] = rq;
+  return true;
+}
+
+/* Appends T to its processor's run queue for its current
+   priority. */
+static void
+prio_enqueue(struct thread *t)
+{
+  struct prio_rq *rq = prio_rqs[t->cpu - cpus];
+
+  ASSERT(PRI_MIN <= t->priority && t->priority <= PRI_MAX);
+
+  t->ready_priority = t->priority;
+  list_push_back(&rq->queues[t->priority], &t->elem);
+  rq->bitmap |= (uint64_t)1 << t->priority;
+}
+
+/* Removes T from the run queue it was pushed on. */
+static void
+prio_dequeue(struct thread *t)
+{
+  struct prio_rq *rq = prio_rqs[t->cpu - cpus];
+
+  list_remove(&t->elem);
+  if (list_empty(&rq->queues[t->ready_priority]))
+    rq->bitmap &= ~((uint64_t)1 << t->ready_priority);
+}
+
+/* Removes and returns the oldest thread of the highest priority
+   on C's run queue. */
+static struct thread *
+prio_pick_next(struct cpu *c)
+{
+  struct prio_rq *rq = prio_rqs[c - cpus];
+  int priority = ready_queue_max_priority(rq);
+  struct thread *t;
+
+  if (priority < PRI_MIN)
+    return NULL;
+
+  t = list_entry(list_front(&rq->queues[priority]), struct thread, elem);
+  prio_dequeue(t);
+  return t;
+}
+
+/* Removes and returns the oldest migratable thread of the highest
+   priority that has one on C's run queue.  Priorities include
+   donations, so a lock holder that a waiter has raised is taken
+   ahead of the threads that it keeps waiting. */
+static struct thread *
+prio_steal(struct cpu *c)
+{
+  struct prio_rq *rq = prio_rqs[c - cpus];
+  int priority;
+
+  for (priority = ready_queue_max_priority(rq); priority >= PRI_MIN; priority--)
+  {
+    struct list *queue = &rq->queues[priority];
+    struct list_elem *e;
+
+    for (e = list_begin(queue); e != list_end(queue); e = list_next(e))
+    {
+      struct thread *t = list_entry(e, struct thread, elem);
+      if (thread_migratable(t))
+      {
+        prio_dequeue(t);
+        return t;
+      }
+    }
+  }
+  return NULL;
+}
+
+/* Preempts T when its priority band's time slice is used up. */
+static bool
+prio_tick(struct thread *t, unsigned ticks_run)
+{
+  return ticks_run >= slice_ticks[t->priority / SLICE_BAND_WIDTH];
+}
+
+/* T yields to any ready thread of higher priority. */
+static bool
+prio_yield_check(struct thread *t)
+{
+  return ready_queue_max_priority(prio_rqs[t->cpu - cpus]) > t->priority;
+}
+
+/* Brings a waking T's priority up to date before queueing it. */
+static void
+mlfqs_enqueue(struct thread *t)
+{
+  if (t->status == THREAD_BLOCKED)
+  {
+    bool stale = t->recent_cpu_secs < mlfqs_seconds;
+
+    if (stale)
+      mlfqs_catch_up(t);
+    if (thread_mlfqs_boost)
+    {
+      int64_t slept = timer_ticks() - t->blocked_tick;
+      int boost = slept < MLFQS_BOOST_MAX ? slept : MLFQS_BOOST_MAX;
+      if (boost > t->wake_boost)
+      {
+        t->wake_boost = boost;
+        stale = true;
+      }
+    }
+    if (stale)
+      t->priority = mlfqs_priority(t);
+  }
+  prio_enqueue(t);
+}
+
+/* Charges T's recent_cpu for the tick and recomputes its priority
+   every fourth tick. */
+static bool
+mlfqs_tick(struct thread *t, unsigned ticks_run)
+{
+  t->recent_cpu = fp_add_int(t->recent_cpu, 1);
+  if (ticks_run % 4 == 0)
+  {
+    t->wake_boost /= 2;
+    thread_update_priority_mlfqs(t);
+  }
+  return prio_tick(t, ticks_run);
+}
+
+/* Returns the highest priority with a nonempty queue in RQ, or
+   PRI_MIN - 1 if no thread is ready there.  The bitmap is scanned
+   one 32-bit half at a time so that the scan compiles to a single
+   `bsr' without needing libgcc. */
+static int
+ready_queue_max_priority(const struct prio_rq *rq)
+{
+  uint32_t high = rq->bitmap >> 32;
+  uint32_t low = rq->bitmap;
+
+  if (high != 0)
+    return 63 - __builtin_clz(high);
+  else if (low != 0)
+    return 31 - __builtin_clz(low);
+  else
+    return PRI_MIN - 1;
+}
+
+/* Updates T's statistics for being switched onto the CPU after
+   waiting on the run queue since stats.ready_since. */
+static void
+record_latency(struct thread *t)
+{
+  int64_t latency = timer_ticks() - t->stats.ready_since;
+  int bucket = 0;
+
+  t->stats.switches++;
+  t->stats.ready_ticks += latency;
+  if (latency > t->stats.max_latency)
+    t->stats.max_latency = latency;
+
+  while (latency > 0 && bucket < LATENCY_BUCKETS - 1)
+  {
+    latency >>= 1;
+    bucket++;
+  }
+  latency_hist[bucket]++;
+}
+
+/* Applies to T's recent_cpu every once-per-second decay that it
+   has missed since it was last brought up to date, using the
+   decay coefficient recorded for each of those seconds.  Must be
+   called with interrupts off. */
+static void
+mlfqs_catch_up(struct thread *t)
+{
+  ASSERT(intr_get_level() == INTR_OFF);
+  ASSERT(mlfqs_seconds - t->recent_cpu_secs <= MLFQS_HISTORY);
+
+  while (t->recent_cpu_secs < mlfqs_seconds)
+  {
+    fixed_point decay = decay_history[++t->recent_cpu_secs % MLFQS_HISTORY];
+    t->recent_cpu = fp_add_int(fp_mul(decay, t->recent_cpu), t->nice);
+  }
+}
+
+/* Returns the MLFQS priority of T, computed from its nice value,
+   recent_cpu, and wake-up boost and clamped to [PRI_MIN,
+   PRI_MAX]. */
+static int
+mlfqs_priority(const struct thread *t)
+{
+  int new_priority = fp_round(fp_sub(fp_from_int(PRI_MAX - t->nice * 2), fp_div_int(t->recent_cpu, 4)));
+  new_priority += t->wake_boost;
   if (new_priority > PRI_MAX)
   {
     new_priority = PRI_MAX;
@@ -687,10 +1916,5 @@ void thread_update_priority_mlfqs(struct thread *t)
   {
     new_priority = PRI_MIN;
   }
-  t->priority = new_priority;
+  return new_priority;
 }
-
-bool compare_threads(const struct list_elem *a, const struct list_elem *b, void *aux UNUSED)
-{
-  return list_entry(a, struct thread, elem)->priority <= list_entry(b, struct thread, elem)->priority;
-}
\ No newline at end of file
@@ -3,8 +3,18 @@
 
 #include "fixed-point.h"
 #include <debug.h>
+#include <hash.h>
 #include <list.h>
+#include <pheap.h>
+#include <rbtree.h>
+#include <stddef.h>
 #include <stdint.h>
+#include "threads/rcu.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
+
+struct cpu;
 
 /* States in a thread's life cycle. */
 enum thread_status
@@ -24,6 +34,36 @@ typedef int tid_t;
 #define PRI_DEFAULT 31 /* Default priority. */
 #define PRI_MAX 63     /* Highest priority. */
 
+/* Thread nice values. */
+#define NICE_MIN -20   /* Most favored. */
+#define NICE_DEFAULT 0 /* Default nice value. */
+#define NICE_MAX 20    /* Least favored. */
+
+/* Per-thread scheduler statistics.  Latencies are measured in
+   timer ticks.  See thread_stats_dump(). */
+struct thread_sched_stats
+{
+   unsigned switches;    /* # of times scheduled onto the CPU. */
+   unsigned voluntary;   /* # of times it blocked or yielded. */
+   unsigned involuntary; /* # of times it was preempted. */
+   unsigned donations;   /* # of priority donations received. */
+   int64_t ready_since;  /* Tick at which it last became ready. */
+   int64_t ready_ticks;  /* Total ticks spent ready but not running. */
+   int64_t max_latency;  /* Longest ready-to-run latency. */
+};
+
+/* Resources used by a thread, or by all the threads of a process.
+   CPU time is charged in TSC cycles whenever a thread switches
+   out, enters the kernel from user mode, or returns to it. */
+struct thread_usage
+{
+   uint64_t user_cycles;     /* Cycles run in user mode. */
+   uint64_t kernel_cycles;   /* Cycles run in the kernel. */
+   unsigned faults;          /* # of page faults taken. */
+   unsigned sectors_read;    /* # of block sectors read. */
+   unsigned sectors_written; /* # of block sectors written. */
+};
+
 /* A kernel thread or user process.
 
    Each thread structure is stored in its own 4 kB page.  The
@@ -73,14 +113,32 @@ typedef int tid_t;
    an assertion failure in thread_current(), which checks that
    the `magic' member of the running thread's `struct thread' is
    set to THREAD_MAGIC.  Stack overflow will normally change this
-   value, triggering the assertion. */
-/* The `elem' member has a dual purpose.  It can be an element in
-   the run queue (thread.c), or it can be an element in a
-   semaphore wait list (synch.c).  It can be used these two ways
-   only because they are mutually exclusive: only a thread in the
-   ready state is on the run queue, whereas only a thread in the
-   blocked state is on a semaphore wait list. */
+   value, triggering the assertion.
+
+   The kernel command-line option "-kstacks=N" gives up to N
+   threads at a time a larger, guarded stack instead: two pages of
+   stack with an unmapped guard page below and `struct thread'
+   above, so that overflow faults immediately (see thread.c).
+   Use STACK_BASE and STACK_TOP rather than assuming either
+   layout. */
+/* The `elem' member is an element in the run queue (thread.c).
+   Only a thread in the ready state is on the run queue, so code
+   that has a blocked thread to itself may also borrow `elem' to
+   keep it on a private list.  A blocked thread waits on a
+   semaphore through `wait_elem' instead (synch.c). */
 extern bool thread_mlfqs;
+
+/* If true, use the fair scheduler in sched-cfs.c instead, which
+   ignores priorities and shares the CPU in proportion to weights
+   derived from nice values.  Controlled by kernel command-line
+   option "-cfs". */
+extern bool thread_cfs;
+
+/* If true, MLFQS gives a thread that wakes after blocking a
+   temporary priority boost, proportional to how long it was
+   blocked, that decays as it runs.  Controlled by kernel
+   command-line option "-mlfqs-boost". */
+extern bool thread_mlfqs_boost;
 struct thread
 {
    /* Owned by thread.c. */
@@ -88,26 +146,83 @@ struct thread
    enum thread_status status; /* Thread state. */
    char name[16];             /* Name (for debugging purposes). */
    uint8_t *stack;            /* Saved stack pointer. */
+   uint8_t *stack_base;       /* Lowest address of the kernel stack. */
+   uint8_t *stack_top;        /* Address just above the kernel stack. */
    int priority;              /* Priority. */
+   int ready_priority;        /* Run queue holding us while ready. */
+   struct cpu *cpu;           /* Processor we run on or are ready on. */
    struct list_elem all_threads;
+   struct hash_elem tid_elem; /* Element in thread.c's tid table. */
 
    /* Shared between thread.c and synch.c. */
    struct list_elem elem; /* List element. */
+   struct pheap_elem wait_elem;  /* Element in WAIT_SEMA's waiters. */
+   struct semaphore *wait_sema;  /* Semaphore we are waiting on, or null. */
+   int wait_priority;            /* Our key in WAIT_SEMA's waiters. */
+   unsigned wait_seq;            /* Arrival order among equal keys. */
 
 #ifdef USERPROG
    /* Owned by userprog/process.c. */
-   uint32_t *pagedir; /* Page directory. */
+   uint32_t *pagedir; /* Page directory, shared with PROCESS's threads. */
+   struct process *process; /* User process, or null. */
+   struct child *joinable; /* Status shared with joiners, or null. */
+   struct list children; /* Status of the processes we started. */
+   int stack_slot;    /* User stack slot, or -1 for the first thread. */
+   int exit_code;     /* Exit code if we are the last thread to exit. */
+
+   /* Owned by userprog/syscall.c. */
+   struct intr_frame *syscall_frame; /* Frame of int $0x30 call, or null. */
 #endif
 
+#ifdef VM
+   /* Owned by vm/page.c. */
+   struct page_table *pages; /* Supplemental page table, shared. */
+   void *user_esp;     /* User stack pointer on entry to the kernel. */
+
+   /* Owned by userprog/exception.c. */
+   unsigned fault_cnt[FAULT_TYPE_CNT]; /* Page faults by type. */
+#endif
+
+#ifdef FILESYS
+   /* Owned by filesys/journal.c. */
+   int journal_depth; /* Nesting depth of our journal handle. */
+   int journal_credits; /* Sectors it may still log. */
+#endif
+
+   /* Owned by threads/rcu.c. */
+   unsigned rcu_depth;        /* Nesting depth of rcu_read_lock(). */
+   bool rcu_preempt_pending;  /* Preemption put off until unlock? */
+
+   /* Owned by threads/sched-cfs.c. */
+   struct rb_node sched_node; /* Element in the fair run queue. */
+   int64_t vruntime;          /* CPU time received, weighted by nice. */
+
+   /* Owned by threads/sched-edf.c. */
+   int64_t edf_period;        /* Ticks between releases, 0 if not EDF. */
+   int64_t edf_rel_deadline;  /* Deadline, in ticks after a release. */
+   int64_t edf_budget;        /* CPU ticks per job. */
+   int64_t edf_release;       /* Release tick of the current job. */
+   int64_t edf_deadline;      /* Absolute deadline of the current job. */
+   int64_t edf_left;          /* Budget the current job has left. */
+   int edf_util;              /* Admitted density, in 1/1000ths. */
+   bool edf_throttled;        /* Out of budget, so best-effort? */
+
    /* Owned by thread.c. */
    unsigned magic; /* Detects stack overflow. */
    struct list_elem sleeping_elements;
-   struct list held_lock;
+   struct pheap held_lock;
    struct lock *curr_lock;
    int our_priority;
    int nice;
-   int64_t remaining_time;
+   int64_t wake_tick;
    fixed_point recent_cpu;
+   struct thread_sched_stats stats; /* Scheduler statistics. */
+   struct thread_usage usage; /* Resource usage. */
+   uint64_t usage_since;      /* TSC at which uncharged time began. */
+   int64_t recent_cpu_secs; /* Last second folded into recent_cpu. */
+   int64_t blocked_tick;    /* Tick at which it last blocked. */
+   int wake_boost;          /* MLFQS priority boost for waking. */
+   struct rcu_head free_rcu; /* Frees us once no reader can see us. */
 };
 
 /* If false (default), use round-robin scheduler.
@@ -116,12 +231,33 @@ struct thread
 
 void thread_init(void);
 void thread_start(void);
+bool thread_cpu_init(struct cpu *);
+void thread_start_ap(void) NO_RETURN;
+
+/* Time slices.  A running thread is preempted after THREAD_SLICE
+   timer ticks ("-slice=TICKS").  With THREAD_SLICE_SCALED
+   ("-slice-scaled"), the slice instead depends on the thread's
+   priority band, as in 4.4BSD: 4 times THREAD_SLICE for the
+   lowest 16 priorities, down to half of it for the highest 16. */
+#define TIME_SLICE 4
+extern unsigned thread_slice;
+extern bool thread_slice_scaled;
+
+/* Guarded kernel stacks.  Controlled by kernel command-line
+   option "-kstacks=N". */
+extern size_t thread_kstack_cnt;
+void thread_kstacks_reserve(void);
+bool thread_kstacks_overlap(const void *start, const void *end);
+bool thread_kstack_is_guard(const void *);
 
 void thread_tick(void);
 void thread_print_stats(void);
+void thread_stats_dump(void);
 
 typedef void thread_func(void *aux);
 tid_t thread_create(const char *name, int priority, thread_func *, void *);
+size_t thread_create_batch(const char *name, int priority, thread_func *,
+                           void *aux, size_t cnt, tid_t tids[]);
 
 void thread_block(void);
 void thread_unblock(struct thread *);
@@ -132,11 +268,19 @@ const char *thread_name(void);
 
 void thread_exit(void) NO_RETURN;
 void thread_yield(void);
+void thread_preempt(void);
+void thread_charge_user(void);
+void thread_charge_kernel(void);
 
 /* Performs some operation on thread t, given auxiliary data AUX. */
 typedef void thread_action_func(struct thread *t, void *aux);
 void thread_foreach(thread_action_func *, void *);
 
+/* Real-time scheduling; see sched-edf.c. */
+bool thread_set_deadline(int64_t period, int64_t budget, int64_t deadline);
+bool thread_wait_next_period(void);
+struct thread *thread_lookup(tid_t);
+
 int thread_get_priority(void);
 void thread_set_priority(int);
 
@@ -144,6 +288,7 @@ int thread_get_nice(void);
 void thread_set_nice(int);
 int thread_get_recent_cpu(void);
 int thread_get_load_avg(void);
+void thread_reset_load_avg(void);
 
 /**
  * @brief Checks if the current thread should yield the CPU.
@@ -154,13 +299,20 @@ int thread_get_load_avg(void);
  */
 void check_thread_yield(void);
 
+/* Returns true if ready thread T may move to another processor.
+   For the scheduling classes. */
+bool thread_migratable(const struct thread *);
+
 /**
- * @brief Updates the system load average and the recent CPU usage for each thread.
+ * @brief Updates the system load average and the recent CPU usage of active threads.
  *
  * This function is called once every second. It first calculates the number of threads
- * that are either running or ready to run (not including the idle thread). It then updates
- * the system load average based on this number. After that, it updates the recent CPU usage
- * for each thread in the system.
+ * that are either running or ready to run (not including the idle thread), using the
+ * scheduler's running count of ready threads. It then updates the system load average
+ * based on this number and records it in the load average history. After that, it
+ * updates the recent CPU usage and priority of the running thread and of every ready
+ * thread. Blocked threads replay the decays they missed when they are next examined,
+ * and a small slice of all threads is swept every second to bound that replay.
  *
  * The function disables interrupts before updating the load average and the recent CPU usage
  * to avoid race conditions, and then restores the original interrupt level.
@@ -168,16 +320,66 @@ void check_thread_yield(void);
 void tick_every_second(void);
 
 /**
- * @brief Sets the current thread to sleep for a specified number of ticks.
+ * @brief Sets the current thread to sleep until a given timer tick.
  *
- * This function retrieves the current thread and sets its remaining time to the
- * specified number of ticks. It then adds the thread to the sleeping list and
- * blocks the thread, causing it to sleep until it's unblocked.
+ * This function records the absolute tick at which the current thread should
+ * wake up, files the thread in the sleep timer wheel slot for that tick, and
+ * blocks the thread until wake_sleeping_threads() reaches that tick.
+ * Must be called with interrupts disabled, and the wake-up tick must be
+ * later than the current tick.
  *
- * @param ticks The number of ticks for which the current thread should sleep.
+ * @param wake_tick The timer tick at which the current thread should wake up.
  */
 void set_sleeping_thread(int64_t);
 
+/**
+ * @brief Wakes up every sleeping thread whose wake-up tick has been reached.
+ *
+ * This function is called by the timer once per tick, from the work that the
+ * timer interrupt defers until it has returned. It only
+ * looks at the timer wheel slot for the current tick and pops expired threads off
+ * its front, so its cost does not depend on the number of sleeping threads.
+ *
+ * @param now The current timer tick.
+ */
+void wake_sleeping_threads(int64_t);
+
+/**
+ * @brief Wakes up a sleeping thread before its wake-up tick.
+ *
+ * This function takes the given thread out of the sleep timer wheel and unblocks
+ * it, as if its wake-up tick had been reached. Must be called with interrupts
+ * disabled.
+ *
+ * @param t The thread to wake up.
+ * @return True if the thread was sleeping, false if it was not.
+ */
+bool thread_wake_early(struct thread *);
+
+/**
+ * @brief Returns the earliest sleeper wake-up tick within a window.
+ *
+ * This function looks at the timer wheel slots for the ticks after the given tick,
+ * up to and including the given limit, and returns the first tick at which some
+ * sleeping thread is due to wake up. Must be called with interrupts disabled.
+ *
+ * @param now The current timer tick.
+ * @param limit The last tick to consider.
+ * @return The earliest wake-up tick in (now, limit], or limit if there is none.
+ */
+int64_t get_next_wake_tick(int64_t, int64_t);
+
+/**
+ * @brief Accounts for timer ticks that passed without a timer interrupt.
+ *
+ * This function is called by the timer when it catches up after a tickless idle
+ * period. The idle thread was running for the whole period, so the ticks are
+ * added to the idle tick statistics.
+ *
+ * @param cnt The number of ticks that were skipped.
+ */
+void thread_skip_ticks(int64_t);
+
 /**
  * @brief Updates the priority of a given thread.
  *
@@ -190,22 +392,24 @@ void set_sleeping_thread(int64_t);
  */
 void update_thread(struct thread *);
 /**
- * @brief Rearranges the ready list based on thread priority.
+ * @brief Moves a ready thread to the run queue matching its priority.
  *
- * This function removes the given thread from the ready list and then inserts it back
- * in the correct position based on its priority. This ensures that the ready list is
- * always sorted in order of thread priority.
+ * This function is called after a ready thread's priority has been recomputed
+ * (by donation or by the MLFQS). If the thread's priority no longer matches the
+ * run queue it sits on, it is moved to the tail of the run queue for its new
+ * priority. Otherwise it keeps its place.
  *
  * @param t The thread that needs to be rearranged in the ready list.
  */
 void rearrange_ready_list(struct thread *);
 
 /**
- * @brief Updates the recent CPU usage of a thread.
+ * @brief Brings the recent CPU usage of a thread up to date.
  *
- * This function calculates the recent CPU usage of a given thread based on the system's
- * load average and the thread's nice value. It then updates the thread's priority based
- * on its recent CPU usage and nice value.
+ * This function applies every once-per-second decay of the given thread's recent CPU
+ * usage that has not been applied yet, using the load average recorded for each of those
+ * seconds and the thread's nice value. It then updates the thread's priority based
+ * on its recent CPU usage and nice value. Must be called with interrupts disabled.
  *
  * @param t The thread whose recent CPU usage is to be updated.
  * @param aux Auxiliary data. This parameter is unused in this function.
@@ -224,18 +428,4 @@ void thread_update_recent_cpu(struct thread *, void *);
  */
 void thread_update_priority_mlfqs(struct thread *);
 
-/**
- * @brief Compares the priority of two thread elements.
- *
- * This function is used for ordering thread elements in a list based on their priority.
- * It takes two list elements as parameters, retrieves the thread elements from them,
- * and compares their priority.
- *
- * @param a The first list element to compare.
- * @param b The second list element to compare.
- * @param aux Auxiliary data. This parameter is unused in this function.
- * @return True if the priority of the first thread element is less than or equal to the priority of the second thread element, false otherwise.
- */
-bool compare_threads(const struct list_elem *, const struct list_elem *, void *);
-
 #endif /* threads/thread.h */
@@ -0,0 +1,143 @@
+#include "threads/trace.h"
+#include <inttypes.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* Kernel trace ring.
+
+   Each tracepoint appends a fixed-size binary record to a ring
+   of TRACE_CNT records, overwriting the oldest record once the
+   ring is full.  Recording formats nothing and takes no locks,
+   so a tracepoint disturbs timing far less than a printf()
+   would.  Pintos runs on a single CPU, so one ring serves the
+   whole kernel; disabling interrupts makes recording atomic.
+   The ring comes from the page allocator, and only if tracing
+   is enabled, so that it costs nothing otherwise; events before
+   trace_init() are dropped.
+
+   trace_dump() prints the ring as text at shutdown, one record
+   per line.  utils/pintos-trace turns that into a timeline. */
+
+/* Number of records in the ring.  Must be a power of 2. */
+#define TRACE_CNT 4096
+
+/* A trace record. */
+struct trace_rec
+  {
+    uint64_t tsc;               /* Time-stamp counter. */
+    uint32_t event;             /* TRACE_* event. */
+    uint32_t arg0, arg1;        /* Event-specific arguments. */
+  };
+
+/* Pages in the ring. */
+#define RING_PAGES DIV_ROUND_UP (TRACE_CNT * sizeof (struct trace_rec), \
+                                 PGSIZE)
+
+/* The ring, or a null pointer before trace_init(). */
+static struct trace_rec *ring;
+
+/* Number of records ever written.  The next record goes into
+   ring[rec_cnt % TRACE_CNT]. */
+static uint32_t rec_cnt;
+
+uint32_t trace_mask;
+
+/* Event names, indexed by TRACE_*. */
+static const char *event_names[TRACE_EVENT_CNT] = 
+  {
+    "schedule", "block", "unblock", "lock", "sema_down",
+    "intr_enter", "intr_exit", "page_fault", "ide_read", "ide_write",
+  };
+
+/* Enables tracing of the comma-separated event names in EVENTS,
+   or of every event if EVENTS is "all".  Modifies EVENTS.
+   Returns false if EVENTS names an unknown event. */
+bool
+trace_configure (char *events) 
+{
+  char *name, *save_ptr;
+
+  for (name = strtok_r (events, ",", &save_ptr); name != NULL;
+       name = strtok_r (NULL, ",", &save_ptr))
+    {
+      int i;
+
+      if (!strcmp (name, "all"))
+        {
+          trace_mask = (1u << TRACE_EVENT_CNT) - 1;
+          continue;
+        }
+      for (i = 0; i < TRACE_EVENT_CNT; i++)
+        if (!strcmp (name, event_names[i]))
+          break;
+      if (i >= TRACE_EVENT_CNT)
+        return false;
+      trace_mask |= 1u << i;
+    }
+  return true;
+}
+
+/* Allocates the ring, if any event is enabled.  Must be called
+   after palloc_init(). */
+void
+trace_init (void) 
+{
+  if (trace_mask == 0)
+    return;
+  ring = palloc_get_multiple (PAL_ZERO, RING_PAGES);
+  if (ring == NULL)
+    {
+      printf ("Trace: no memory for %zu-page ring, tracing disabled.\n",
+              (size_t) RING_PAGES);
+      trace_mask = 0;
+    }
+}
+
+/* Appends a record of EVENT with arguments ARG0 and ARG1 to the
+   ring.  Use trace() instead, which checks trace_mask first.
+   May be called from an interrupt handler. */
+void
+trace_record (enum trace_event event, uint32_t arg0, uint32_t arg1) 
+{
+  enum intr_level old_level;
+  struct trace_rec *r;
+
+  if (ring == NULL)
+    return;
+
+  old_level = intr_disable ();
+  r = &ring[rec_cnt++ % TRACE_CNT];
+  r->tsc = timer_cycles ();
+  r->event = event;
+  r->arg0 = arg0;
+  r->arg1 = arg1;
+  intr_set_level (old_level);
+}
+
+/* Prints the records in the ring, oldest first, and disables
+   tracing so that printing them does not add more.  Prints
+   nothing if tracing was never enabled. */
+void
+trace_dump (void) 
+{
+  uint32_t first, i;
+
+  if (trace_mask == 0 && rec_cnt == 0)
+    return;
+  trace_mask = 0;
+
+  first = rec_cnt > TRACE_CNT ? rec_cnt - TRACE_CNT : 0;
+  printf ("Trace: %"PRIu32" records, %"PRIu32" overwritten\n",
+          rec_cnt - first, first);
+  for (i = first; i != rec_cnt; i++) 
+    {
+      const struct trace_rec *r = &ring[i % TRACE_CNT];
+      printf ("trace %"PRIu64" %s %#"PRIx32" %#"PRIx32"\n",
+              r->tsc, event_names[r->event], r->arg0, r->arg1);
+    }
+}
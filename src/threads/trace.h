@@ -0,0 +1,42 @@
+#ifndef THREADS_TRACE_H
+#define THREADS_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Kernel events that can be traced.  The names that
+   trace_configure() accepts and trace_dump() prints are in
+   trace.c. */
+enum trace_event
+  {
+    TRACE_SCHEDULE,             /* schedule(): from tid, to tid. */
+    TRACE_BLOCK,                /* thread_block(): tid. */
+    TRACE_UNBLOCK,              /* thread_unblock(): tid. */
+    TRACE_LOCK,                 /* Contended lock_acquire(): lock, holder tid. */
+    TRACE_SEMA_DOWN,            /* sema_down(): semaphore, value. */
+    TRACE_INTR_ENTER,           /* intr_handler() entry: vector. */
+    TRACE_INTR_EXIT,            /* intr_handler() exit: vector. */
+    TRACE_PAGE_FAULT,           /* page_fault(): address, error code. */
+    TRACE_IDE_READ,             /* IDE read: sector, sector count. */
+    TRACE_IDE_WRITE,            /* IDE write: sector, sector count. */
+    TRACE_EVENT_CNT
+  };
+
+/* Bit mask of enabled events, 1 << TRACE_* for each. */
+extern uint32_t trace_mask;
+
+bool trace_configure (char *events);
+void trace_init (void);
+void trace_record (enum trace_event, uint32_t arg0, uint32_t arg1);
+void trace_dump (void);
+
+/* Records EVENT with arguments ARG0 and ARG1 if EVENT is
+   enabled.  Costs only a test and a branch when it is not. */
+static inline void
+trace (enum trace_event event, uint32_t arg0, uint32_t arg1)
+{
+  if (trace_mask & (1u << event))
+    trace_record (event, arg0, arg1);
+}
+
+#endif /* threads/trace.h */
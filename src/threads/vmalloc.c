@@ -0,0 +1,174 @@
+#include "threads/vmalloc.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "threads/cpu.h"
+#include "threads/init.h"
+#include "threads/palloc.h"
+#include "threads/pte.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Virtually contiguous allocations.
+
+   palloc_get_multiple() needs physically contiguous pages, which
+   become hard to find as memory fragments, even with plenty of
+   it free.  vmalloc() instead takes single pages wherever they
+   are and maps them at consecutive addresses in a window of
+   kernel virtual memory above the direct mapping of RAM.
+
+   The window's page tables are created by vmalloc_init(), before
+   any process exists, so every page directory copies the
+   window's page directory entries from init_page_dir and shares
+   its page tables.  Mapping and unmapping pages then only
+   changes page table entries, which every address space sees at
+   once.
+
+   Each allocation is followed by an unmapped guard page, which
+   catches running off the end and tells vfree() where the
+   allocation ends.  Memory from vmalloc() is not at its
+   physical address plus PHYS_BASE, so vtop() does not work on
+   it. */
+
+/* The window: 16 MB below the local APIC's page. */
+#define WINDOW_BASE ((uint8_t *) 0xf0000000)
+#define WINDOW_PAGES (16 * 1024 * 1024 / PGSIZE)
+
+/* Pages of the window in use, guard pages included, and the
+   lock that protects it.  Null if the window is unavailable. */
+static struct bitmap *window_map;
+static struct lock window_lock;
+
+static uint32_t *window_pte (const void *);
+static size_t unmap_pages (uint8_t *);
+static void release_window (uint8_t *, size_t page_cnt);
+
+/* Creates the page tables for the vmalloc() window.  Must be
+   called after paging_init() and malloc_init(), and before any
+   process is created. */
+void
+vmalloc_init (void)
+{
+  uint8_t *va;
+
+  if ((uintptr_t) PHYS_BASE + init_ram_pages * PGSIZE
+      > (uintptr_t) WINDOW_BASE)
+    {
+      printf ("vmalloc: RAM overlaps the vmalloc window, disabled.\n");
+      return;
+    }
+
+  window_map = bitmap_create (WINDOW_PAGES);
+  if (window_map == NULL)
+    PANIC ("can't create vmalloc window map");
+  lock_init (&window_lock);
+
+  for (va = WINDOW_BASE; va < WINDOW_BASE + WINDOW_PAGES * PGSIZE;
+       va += PTSPAN)
+    {
+      uint32_t *pde = &init_page_dir[pd_no (va)];
+      ASSERT (*pde == 0);
+      *pde = pde_create (palloc_get_page (PAL_ASSERT | PAL_ZERO));
+    }
+}
+
+/* Obtains and returns SIZE bytes, rounded up to whole pages, of
+   virtually contiguous kernel memory.  Returns a null pointer if
+   memory or window space is not available. */
+void *
+vmalloc (size_t size) 
+{
+  size_t page_cnt = DIV_ROUND_UP (size, PGSIZE);
+  size_t idx, i;
+  uint8_t *va;
+
+  if (window_map == NULL || page_cnt == 0)
+    return NULL;
+
+  lock_acquire (&window_lock);
+  idx = bitmap_scan_and_flip (window_map, 0, page_cnt + 1, false);
+  lock_release (&window_lock);
+  if (idx == BITMAP_ERROR)
+    return NULL;
+
+  va = WINDOW_BASE + idx * PGSIZE;
+  for (i = 0; i < page_cnt; i++)
+    {
+      void *page = palloc_get_page (0);
+      if (page == NULL)
+        {
+          unmap_pages (va);
+          release_window (va, page_cnt);
+          return NULL;
+        }
+      *window_pte (va + i * PGSIZE) = pte_create_kernel (page, true);
+    }
+  return va;
+}
+
+/* Frees P, which must have been obtained from vmalloc().  Does
+   nothing if P is null. */
+void
+vfree (void *p) 
+{
+  if (p == NULL)
+    return;
+
+  ASSERT (is_vmalloc_addr (p));
+  ASSERT (pg_ofs (p) == 0);
+  release_window (p, unmap_pages (p));
+}
+
+/* Returns true if P is in the vmalloc() window. */
+bool
+is_vmalloc_addr (const void *p) 
+{
+  const uint8_t *va = p;
+  return va >= WINDOW_BASE && va < WINDOW_BASE + WINDOW_PAGES * PGSIZE;
+}
+
+/* Returns the page table entry for VA, in the window. */
+static uint32_t *
+window_pte (const void *va) 
+{
+  return &pde_get_pt (init_page_dir[pd_no (va)])[pt_no (va)];
+}
+
+/* Unmaps and frees the pages mapped from VA up to the next
+   unmapped page, and returns how many there were.  Other
+   processors drop the mappings before they next run kernel
+   code. */
+static size_t
+unmap_pages (uint8_t *va) 
+{
+  size_t cnt;
+
+  for (cnt = 0; ; cnt++, va += PGSIZE)
+    {
+      uint32_t *pte = window_pte (va);
+      void *page;
+
+      if (!(*pte & PTE_P))
+        break;
+      page = pte_get_page (*pte);
+      *pte = 0;
+      asm volatile ("invlpg (%0)" : : "r" (va) : "memory");
+      palloc_free_page (page);
+    }
+  if (cnt > 0)
+    cpu_flush_kernel_tlbs ();
+  return cnt;
+}
+
+/* Returns the window space of a PAGE_CNT-page allocation at VA,
+   and of its guard page, for reuse. */
+static void
+release_window (uint8_t *va, size_t page_cnt) 
+{
+  lock_acquire (&window_lock);
+  bitmap_set_multiple (window_map, (va - WINDOW_BASE) / PGSIZE,
+                       page_cnt + 1, false);
+  lock_release (&window_lock);
+}
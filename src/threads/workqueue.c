@@ -0,0 +1,271 @@
+#include "threads/workqueue.h"
+#include <debug.h>
+#include "devices/timer.h"
+#include "threads/interrupt.h"
+#include "threads/thread.h"
+
+/* Work queues.
+
+   A work queue runs short functions ("work") on behalf of other
+   kernel code in a small pool of worker threads, so that each
+   kind of background task does not need a thread, and a page of
+   stack, of its own.  Work is either ready, to be run as soon as
+   a worker is free, or delayed until a given timer tick.  Ready
+   work runs in the order it was queued.
+
+   Idle workers wait on WORK_READY.  Delayed work needs a worker
+   to sleep until the soonest item is due, but a worker sleeping
+   in the timer cannot also wait on a condition variable.  So at
+   most one worker at a time, the "timekeeper", sleeps on the
+   sleep wheel instead, until the front of DELAYED is due.  New
+   work that needs a worker when none is idle, or delayed work
+   that is due sooner than the timekeeper expects, wakes the
+   timekeeper early with thread_wake_early().
+
+   A piece of work is on at most one list at a time.  Queueing
+   work that is already queued does nothing, so code that merely
+   wants some work to happen "soon" may queue it freely. */
+
+static thread_func worker NO_RETURN;
+static void wake_worker (struct workqueue *, bool for_delayed);
+static void sleep_until_due (struct workqueue *);
+
+/* Orders work by due tick. */
+LIST_DEFINE_ORDERED (due, struct work, elem, due)
+
+/* Initializes WQ and starts WORKER_CNT worker threads with the
+   given PRIORITY, named after NAME. */
+void
+workqueue_init (struct workqueue *wq, const char *name,
+                int worker_cnt, int priority)
+{
+  ASSERT (worker_cnt > 0);
+
+  wq->name = name;
+  lock_init (&wq->lock);
+  cond_init (&wq->work_ready);
+  cond_init (&wq->drained);
+  list_init (&wq->ready);
+  list_init (&wq->delayed);
+  wq->idle_cnt = 0;
+  wq->busy_cnt = 0;
+  wq->timekeeper = NULL;
+  wq->timekeeper_kicked = false;
+
+  thread_create_batch (name, priority, worker, wq, worker_cnt, NULL);
+}
+
+/* Waits until WQ has no ready work and none is running.  Delayed
+   work that is not yet due is not waited for. */
+void
+workqueue_flush (struct workqueue *wq)
+{
+  lock_acquire (&wq->lock);
+  while (!list_empty (&wq->ready) || wq->busy_cnt > 0)
+    cond_wait (&wq->drained, &wq->lock);
+  lock_release (&wq->lock);
+}
+
+/* Initializes W to call FUNC with AUX in a worker thread. */
+void
+work_init (struct work *w, work_func *func, void *aux)
+{
+  w->func = func;
+  w->aux = aux;
+  w->due = 0;
+  w->queued = false;
+}
+
+/* Queues W to run in one of WQ's workers as soon as possible.
+   Returns true if successful, false if W was already queued. */
+bool
+work_queue (struct workqueue *wq, struct work *w)
+{
+  return work_queue_batch (wq, &w, 1) == 1;
+}
+
+/* Queues W to run in one of WQ's workers once TICKS timer ticks
+   have passed.  Returns true if successful, false if W was
+   already queued. */
+bool
+work_queue_delayed (struct workqueue *wq, struct work *w, int64_t ticks)
+{
+  if (ticks <= 0)
+    return work_queue (wq, w);
+  return work_queue_at (wq, w, timer_ticks () + ticks);
+}
+
+/* Queues W to run in one of WQ's workers at timer tick DUE, or
+   as soon as possible if DUE has passed.  Work that requeues
+   itself for a fixed period after its last DUE, rather than
+   after it ran, keeps an exact cadence.  Returns true if
+   successful, false if W was already queued. */
+bool
+work_queue_at (struct workqueue *wq, struct work *w, int64_t due)
+{
+  bool soonest;
+
+  if (due <= timer_ticks ())
+    return work_queue (wq, w);
+
+  lock_acquire (&wq->lock);
+  if (w->queued)
+    {
+      lock_release (&wq->lock);
+      return false;
+    }
+  w->queued = true;
+  w->due = due;
+  due_insert_ordered (&wq->delayed, w);
+  soonest = list_front (&wq->delayed) == &w->elem;
+  if (soonest)
+    wake_worker (wq, true);
+  lock_release (&wq->lock);
+  return true;
+}
+
+/* Queues the CNT pieces of work in WORKS to run in WQ's workers
+   as soon as possible, in order, taking WQ's lock once for the
+   whole batch.  Work that is already queued is skipped.  Returns
+   the number of pieces of work queued. */
+size_t
+work_queue_batch (struct workqueue *wq, struct work *works[], size_t cnt)
+{
+  size_t queued_cnt = 0;
+  size_t i;
+
+  lock_acquire (&wq->lock);
+  for (i = 0; i < cnt; i++)
+    {
+      struct work *w = works[i];
+
+      if (!w->queued)
+        {
+          w->queued = true;
+          list_push_back (&wq->ready, &w->elem);
+          wake_worker (wq, false);
+          queued_cnt++;
+        }
+    }
+  lock_release (&wq->lock);
+  return queued_cnt;
+}
+
+/* Removes W from WQ if it is queued there and has not started.
+   Returns true if W was removed, false if it was not queued.
+   Does not wait for W to finish if it is already running. */
+bool
+work_cancel (struct workqueue *wq, struct work *w)
+{
+  bool cancelled;
+
+  lock_acquire (&wq->lock);
+  cancelled = w->queued;
+  if (cancelled)
+    {
+      list_remove (&w->elem);
+      w->queued = false;
+      if (list_empty (&wq->ready) && wq->busy_cnt == 0)
+        cond_broadcast (&wq->drained, &wq->lock);
+    }
+  lock_release (&wq->lock);
+  return cancelled;
+}
+
+/* Worker thread for the work queue WQ_. */
+static void
+worker (void *wq_)
+{
+  struct workqueue *wq = wq_;
+
+  lock_acquire (&wq->lock);
+  for (;;)
+    {
+      int64_t now = timer_ticks ();
+
+      /* Move delayed work that has come due to the ready list. */
+      while (!list_empty (&wq->delayed)
+             && list_entry (list_front (&wq->delayed),
+                            struct work, elem)->due <= now)
+        list_push_back (&wq->ready, list_pop_front (&wq->delayed));
+
+      if (!list_empty (&wq->ready))
+        {
+          struct work *w = list_entry (list_pop_front (&wq->ready),
+                                       struct work, elem);
+          work_func *func = w->func;
+          void *aux = w->aux;
+
+          /* W belongs to its submitter again from here on. */
+          w->queued = false;
+          wq->busy_cnt++;
+          lock_release (&wq->lock);
+          func (aux);
+          lock_acquire (&wq->lock);
+          wq->busy_cnt--;
+
+          if (list_empty (&wq->ready) && wq->busy_cnt == 0)
+            cond_broadcast (&wq->drained, &wq->lock);
+        }
+      else if (!list_empty (&wq->delayed) && wq->timekeeper == NULL)
+        sleep_until_due (wq);
+      else
+        {
+          wq->idle_cnt++;
+          cond_wait (&wq->work_ready, &wq->lock);
+          wq->idle_cnt--;
+        }
+    }
+}
+
+/* Makes sure that some worker in WQ will look at its lists soon,
+   because ready work was queued or, if FOR_DELAYED, the front of
+   the delayed list changed.  WQ's lock must be held.
+
+   Ready work is best given to an idle worker, so that the
+   timekeeper keeps sleeping; a delayed item that is due sooner
+   than the timekeeper expects must go to the timekeeper, or to an
+   idle worker to become one.  Otherwise every worker is busy and
+   will look on its own when it finishes. */
+static void
+wake_worker (struct workqueue *wq, bool for_delayed)
+{
+  ASSERT (lock_held_by_current_thread (&wq->lock));
+
+  if (wq->idle_cnt > 0 && (!for_delayed || wq->timekeeper == NULL))
+    cond_signal (&wq->work_ready, &wq->lock);
+  else if (wq->timekeeper != NULL)
+    {
+      enum intr_level old_level = intr_disable ();
+      wq->timekeeper_kicked = true;
+      thread_wake_early (wq->timekeeper);
+      intr_set_level (old_level);
+    }
+}
+
+/* Makes the current worker WQ's timekeeper and sleeps until the
+   front of WQ's delayed list is due or wake_worker() wakes it.
+   WQ's lock must be held.  It is released while sleeping. */
+static void
+sleep_until_due (struct workqueue *wq)
+{
+  int64_t due = list_entry (list_front (&wq->delayed),
+                            struct work, elem)->due;
+  enum intr_level old_level;
+
+  wq->timekeeper = thread_current ();
+  wq->timekeeper_kicked = false;
+
+  /* Between releasing the lock and going to sleep, another
+     thread may try to wake us.  With interrupts off, it can run
+     only if releasing the lock yields to it, and then it sets
+     TIMEKEEPER_KICKED, which we check before sleeping. */
+  old_level = intr_disable ();
+  lock_release (&wq->lock);
+  if (!wq->timekeeper_kicked && due > timer_ticks ())
+    set_sleeping_thread (due);
+  intr_set_level (old_level);
+
+  lock_acquire (&wq->lock);
+  wq->timekeeper = NULL;
+}
@@ -0,0 +1,52 @@
+#ifndef THREADS_WORKQUEUE_H
+#define THREADS_WORKQUEUE_H
+
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "threads/synch.h"
+
+/* Function that a worker thread runs for a piece of work. */
+typedef void work_func (void *aux);
+
+/* A piece of work.  The submitter owns it and must keep it alive
+   while it is queued.  Once its function has started, the work
+   may be queued again or freed, even by the function itself. */
+struct work
+  {
+    struct list_elem elem;      /* Element in a ready or delayed list. */
+    work_func *func;            /* Function to run. */
+    void *aux;                  /* Argument to FUNC. */
+    int64_t due;                /* Delayed work: tick at which to run. */
+    bool queued;                /* On a work queue? */
+  };
+
+/* A queue of work served by a fixed pool of worker threads. */
+struct workqueue
+  {
+    const char *name;           /* Name, for debugging. */
+    struct lock lock;           /* Protects all the members below. */
+    struct condition work_ready; /* Signaled when work is ready. */
+    struct condition drained;   /* Broadcast when no work is left. */
+    struct list ready;          /* Work to run now, oldest first. */
+    struct list delayed;        /* Delayed work, soonest first. */
+    int idle_cnt;               /* Workers waiting on WORK_READY. */
+    int busy_cnt;               /* Workers running work. */
+    struct thread *timekeeper;  /* Worker sleeping until DELAYED is due. */
+    bool timekeeper_kicked;     /* TIMEKEEPER woken before its time? */
+  };
+
+void workqueue_init (struct workqueue *, const char *name,
+                     int worker_cnt, int priority);
+void workqueue_flush (struct workqueue *);
+
+void work_init (struct work *, work_func *, void *aux);
+bool work_queue (struct workqueue *, struct work *);
+bool work_queue_delayed (struct workqueue *, struct work *, int64_t ticks);
+bool work_queue_at (struct workqueue *, struct work *, int64_t due);
+size_t work_queue_batch (struct workqueue *, struct work *works[],
+                         size_t cnt);
+bool work_cancel (struct workqueue *, struct work *);
+
+#endif /* threads/workqueue.h */
@@ -2,12 +2,38 @@
 #include <inttypes.h>
 #include <stdio.h>
 #include "userprog/gdt.h"
+#include "devices/timer.h"
 #include "threads/interrupt.h"
+#include "threads/klog.h"
 #include "threads/thread.h"
+#include "threads/trace.h"
+#include "threads/vaddr.h"
+#include "userprog/process.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
 
 /* Number of page faults processed. */
 static long long page_fault_cnt;
 
+#ifdef VM
+/* Page faults serviced, by type, for all processes.  Each
+   process also keeps its own counts, in its FAULT_CNT member,
+   which it can read with the faultstat system call. */
+static long long fault_type_cnt[FAULT_TYPE_CNT];
+
+/* Histogram of the CPU cycles taken to service a page fault.
+   Bucket 0 counts faults serviced in fewer than
+   2**LATENCY_MIN_BITS cycles, each later bucket those taking up
+   to twice as long as the one before, and the last bucket all
+   slower faults. */
+#define LATENCY_MIN_BITS 10
+#define LATENCY_BUCKETS 16
+static long long latency_hist[LATENCY_BUCKETS];
+
+static void count_fault (enum fault_type, uint64_t start);
+#endif
+
 static void kill (struct intr_frame *);
 static void page_fault (struct intr_frame *);
 
@@ -54,6 +80,11 @@ exception_init (void)
   intr_register_int (19, 0, INTR_ON, kill,
                      "#XF SIMD Floating-Point Exception");
 
+  /* A double fault usually means that the kernel stack is gone,
+     so it gets a task of its own, with its own stack.  See
+     tss.c. */
+  intr_register_task (8, SEL_DF_TSS, "#DF Double Fault Exception");
+
   /* Most exceptions can be handled with interrupts turned on.
      We need to disable interrupts for page faults because the
      fault address is stored in CR2 and needs to be preserved. */
@@ -65,7 +96,47 @@ void
 exception_print_stats (void) 
 {
   printf ("Exception: %lld page faults\n", page_fault_cnt);
+#ifdef VM
+  {
+    int i;
+
+    printf ("Page faults: %lld minor, %lld file, %lld swap, "
+            "%lld stack, %lld copy-on-write\n",
+            fault_type_cnt[FAULT_MINOR], fault_type_cnt[FAULT_FILE],
+            fault_type_cnt[FAULT_SWAP], fault_type_cnt[FAULT_STACK],
+            fault_type_cnt[FAULT_COW]);
+    printf ("Page fault cycles:");
+    for (i = 0; i < LATENCY_BUCKETS; i++)
+      if (latency_hist[i] != 0)
+        printf (" %s2^%d: %lld", i < LATENCY_BUCKETS - 1 ? "<" : ">=",
+                LATENCY_MIN_BITS + (i < LATENCY_BUCKETS - 1 ? i : i - 1),
+                latency_hist[i]);
+    printf ("\n");
+    page_print_stats ();
+  }
+#endif
+}
+
+#ifdef VM
+/* Records a page fault of the given TYPE, serviced starting at
+   time-stamp counter value START, for the current process and
+   the whole system. */
+static void
+count_fault (enum fault_type type, uint64_t start)
+{
+  uint64_t cycles = timer_cycles () - start;
+  int bucket = 0;
+
+  while (bucket < LATENCY_BUCKETS - 1
+         && cycles >= (uint64_t) 1 << (LATENCY_MIN_BITS + bucket))
+    bucket++;
+
+  thread_current ()->fault_cnt[type]++;
+  page_count_fault (type);
+  fault_type_cnt[type]++;
+  latency_hist[bucket]++;
 }
+#endif
 
 /* Handler for an exception (probably) caused by a user process. */
 static void
@@ -89,7 +160,8 @@ kill (struct intr_frame *f)
       printf ("%s: dying due to interrupt %#04x (%s).\n",
               thread_name (), f->vec_no, intr_name (f->vec_no));
       intr_dump_frame (f);
-      thread_exit (); 
+      klog (KLOG_USER_FAULT, f->vec_no, (uintptr_t) f->eip);
+      process_terminate (-1); 
 
     case SEL_KCSEG:
       /* Kernel's code segment, which indicates a kernel bug.
@@ -126,6 +198,10 @@ page_fault (struct intr_frame *f)
   bool write;        /* True: access was write, false: access was read. */
   bool user;         /* True: access by user, false: access by kernel. */
   void *fault_addr;  /* Fault address. */
+#ifdef VM
+  uint64_t start = timer_cycles ();
+  enum fault_type type;
+#endif
 
   /* Obtain faulting address, the virtual address that was
      accessed to cause the fault.  It may point to code or to
@@ -142,12 +218,53 @@ page_fault (struct intr_frame *f)
 
   /* Count page faults. */
   page_fault_cnt++;
+  thread_current ()->usage.faults++;
+  trace (TRACE_PAGE_FAULT, (uintptr_t) fault_addr, f->error_code);
 
   /* Determine cause. */
   not_present = (f->error_code & PF_P) == 0;
   write = (f->error_code & PF_W) != 0;
   user = (f->error_code & PF_U) != 0;
 
+#ifdef VM
+  /* Stack growth needs the user stack pointer.  A fault from
+     user mode has it in F; for a fault by the kernel,
+     syscall_handler() saved it on entry. */
+  if (user)
+    thread_current ()->user_esp = f->esp;
+
+  /* Bring in the page, if the address belongs to one, or grow
+     the stack to cover it.  This also covers the kernel touching
+     user memory on behalf of a system call. */
+  if (not_present && page_in (fault_addr, write, &type))
+    {
+      count_fault (type, start);
+      return;
+    }
+
+  /* A write to a page mapped read-only may be the first write to
+     a page that shares its frame with other processes. */
+  if (!not_present && write && page_write_fault (fault_addr))
+    {
+      count_fault (FAULT_COW, start);
+      return;
+    }
+#endif
+
+  /* A fault by the kernel on a user address comes from
+     get_user() or put_user() in syscall.c, which left the address
+     to resume at in EAX.  Resume there with EAX set to -1 to
+     report the failure. */
+  if (!user && is_user_vaddr (fault_addr))
+    {
+      f->eip = (void (*) (void)) f->eax;
+      f->eax = 0xffffffff;
+      return;
+    }
+
+  if (!user && thread_kstack_is_guard (fault_addr))
+    PANIC ("kernel stack overflow in thread %s", thread_name ());
+
   /* To implement virtual memory, delete the rest of the function
      body, and replace it with code that brings in the page to
      which fault_addr refers. */
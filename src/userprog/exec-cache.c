@@ -0,0 +1,120 @@
+#include "userprog/exec-cache.h"
+#include <stdio.h>
+#include "filesys/inode.h"
+#include "threads/synch.h"
+
+/* Executable image cache.
+
+   Running a program means reading and checking its ELF header
+   and program headers before any of it can be mapped.  Programs
+   are run over and over, by the shell and by test drivers, and
+   with demand paging and shared text frames those headers are
+   most of the disk reads a warm exec makes.  So load() keeps
+   what it learns from them here, in a small table of the most
+   recently loaded executables.
+
+   An entry is keyed on the executable's inode number and on the
+   version of the inode it was parsed from (see
+   inode_get_version()), so writing the file, or replacing it
+   with another file that reuses its inode, makes a stale entry
+   miss.  Entries are replaced least recently used first. */
+
+/* Number of executables cached. */
+#define EXEC_CACHE_SIZE 8
+
+/* A cached executable. */
+struct exec_entry
+  {
+    bool in_use;                /* Is this entry valid? */
+    block_sector_t inumber;     /* Executable's inode number. */
+    unsigned version;           /* Its version when parsed. */
+    unsigned long long last_use; /* Value of USE_CLOCK when last used. */
+    struct exec_image image;    /* What load() needs. */
+  };
+
+static struct exec_entry entries[EXEC_CACHE_SIZE];
+static struct lock exec_cache_lock;     /* Protects everything here. */
+static unsigned long long use_clock;    /* Counts lookups and inserts. */
+
+/* Statistics. */
+static unsigned long long hit_cnt, miss_cnt;
+
+/* Initializes the executable image cache. */
+void
+exec_cache_init (void)
+{
+  lock_init (&exec_cache_lock);
+}
+
+/* Returns the entry for INUMBER and VERSION, or a null pointer
+   if there is none.  The cache must be locked. */
+static struct exec_entry *
+find_entry (block_sector_t inumber, unsigned version)
+{
+  size_t i;
+
+  for (i = 0; i < EXEC_CACHE_SIZE; i++)
+    if (entries[i].in_use && entries[i].inumber == inumber
+        && entries[i].version == version)
+      return &entries[i];
+  return NULL;
+}
+
+/* Looks for the current version of INODE in the cache.  If it is
+   there, copies its image into *IMAGE and returns true.
+   Otherwise, returns false. */
+bool
+exec_cache_lookup (struct inode *inode, struct exec_image *image)
+{
+  struct exec_entry *e;
+
+  lock_acquire (&exec_cache_lock);
+  e = find_entry (inode_get_inumber (inode), inode_get_version (inode));
+  if (e != NULL)
+    {
+      e->last_use = ++use_clock;
+      *image = e->image;
+      hit_cnt++;
+    }
+  else
+    miss_cnt++;
+  lock_release (&exec_cache_lock);
+  return e != NULL;
+}
+
+/* Adds IMAGE, parsed from INODE when it had the given VERSION, to
+   the cache, replacing the least recently used entry if the cache
+   is full.  If INODE has been written since, the entry is never
+   found, and soon replaced. */
+void
+exec_cache_insert (struct inode *inode, unsigned version,
+                   const struct exec_image *image)
+{
+  block_sector_t inumber = inode_get_inumber (inode);
+  struct exec_entry *e;
+  size_t i;
+
+  lock_acquire (&exec_cache_lock);
+  e = find_entry (inumber, version);
+  if (e == NULL)
+    {
+      /* Take a free entry, or else the least recently used. */
+      e = &entries[0];
+      for (i = 0; i < EXEC_CACHE_SIZE && e->in_use; i++)
+        if (!entries[i].in_use || entries[i].last_use < e->last_use)
+          e = &entries[i];
+      e->in_use = true;
+      e->inumber = inumber;
+      e->version = version;
+      e->image = *image;
+    }
+  e->last_use = ++use_clock;
+  lock_release (&exec_cache_lock);
+}
+
+/* Prints executable image cache statistics. */
+void
+exec_cache_print_stats (void)
+{
+  printf ("Exec cache: %llu hits, %llu misses\n", hit_cnt, miss_cnt);
+}
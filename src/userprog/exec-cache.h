@@ -0,0 +1,38 @@
+#ifndef USERPROG_EXEC_CACHE_H
+#define USERPROG_EXEC_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct inode;
+
+/* Most loadable segments an executable may have. */
+#define EXEC_SEGMENTS_MAX 8
+
+/* A loadable segment of an executable, extended to whole pages,
+   as load_segment() in userprog/process.c takes it. */
+struct exec_segment
+  {
+    uint32_t file_page;         /* File offset of the first page. */
+    uint32_t mem_page;          /* User address of the first page. */
+    uint32_t read_bytes;        /* Bytes to read from the file... */
+    uint32_t zero_bytes;        /* ...followed by this many zeros. */
+    bool writable;              /* May the process write it? */
+  };
+
+/* What load() learns from an executable's headers. */
+struct exec_image
+  {
+    uint32_t entry;             /* Entry point. */
+    size_t segment_cnt;         /* Number of loadable segments. */
+    struct exec_segment segments[EXEC_SEGMENTS_MAX];
+  };
+
+void exec_cache_init (void);
+bool exec_cache_lookup (struct inode *, struct exec_image *);
+void exec_cache_insert (struct inode *, unsigned version,
+                        const struct exec_image *);
+void exec_cache_print_stats (void);
+
+#endif /* userprog/exec-cache.h */
@@ -1,6 +1,8 @@
 #include "userprog/gdt.h"
 #include <debug.h>
 #include "userprog/tss.h"
+#include "threads/cpu.h"
+#include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/vaddr.h"
 
@@ -21,7 +23,11 @@
 
    For more information on the GDT as used here, refer to
    [IA32-v3a] 3.2 "Using Segments" through 3.5 "System Descriptor
-   Types". */
+   Types".
+
+   Each processor has a GDT of its own, pointed to by its struct
+   cpu, which differs from the others only in its TSS
+   descriptors.  The bootstrap processor's is static. */
 static uint64_t gdt[SEL_CNT];
 
 /* GDT helpers. */
@@ -30,29 +36,71 @@ static uint64_t make_data_desc (int dpl);
 static uint64_t make_tss_desc (void *laddr);
 static uint64_t make_gdtr_operand (uint16_t limit, void *base);
 
-/* Sets up a proper GDT.  The bootstrap loader's GDT didn't
-   include user-mode selectors or a TSS, but we need both now. */
-void
-gdt_init (void)
+/* Fills in GDT, of SEL_CNT entries, for processor C, whose TSSes
+   must already exist. */
+static void
+fill (uint64_t *gdt, struct cpu *c)
 {
-  uint64_t gdtr_operand;
-
-  /* Initialize GDT. */
   gdt[SEL_NULL / sizeof *gdt] = 0;
   gdt[SEL_KCSEG / sizeof *gdt] = make_code_desc (0);
   gdt[SEL_KDSEG / sizeof *gdt] = make_data_desc (0);
   gdt[SEL_UCSEG / sizeof *gdt] = make_code_desc (3);
   gdt[SEL_UDSEG / sizeof *gdt] = make_data_desc (3);
-  gdt[SEL_TSS / sizeof *gdt] = make_tss_desc (tss_get ());
+  gdt[SEL_TSS / sizeof *gdt] = make_tss_desc (c->tss);
+  gdt[SEL_DF_TSS / sizeof *gdt] = make_tss_desc (c->df_tss);
+  c->gdt = gdt;
+}
+
+/* Sets up a proper GDT.  The bootstrap loader's GDT didn't
+   include user-mode selectors or a TSS, but we need both now. */
+void
+gdt_init (void)
+{
+  fill (gdt, &cpus[0]);
+  gdt_load ();
+}
 
-  /* Load GDTR, TR.  See [IA32-v3a] 2.4.1 "Global Descriptor
-     Table Register (GDTR)", 2.4.4 "Task Register (TR)", and
-     6.2.4 "Task Register".  */
-  gdtr_operand = make_gdtr_operand (sizeof gdt - 1, gdt);
+/* Sets up application processor C's GDT, which cpu_ap_main()
+   loads with gdt_load().  Returns false if memory runs out. */
+bool
+gdt_init_ap (struct cpu *c)
+{
+  uint64_t *ap_gdt = malloc (SEL_CNT * sizeof *ap_gdt);
+
+  if (ap_gdt == NULL)
+    return false;
+  fill (ap_gdt, c);
+  return true;
+}
+
+/* Loads the running processor's GDT into GDTR and its TSS into
+   TR.  See [IA32-v3a] 2.4.1 "Global Descriptor Table Register
+   (GDTR)", 2.4.4 "Task Register (TR)", and 6.2.4 "Task
+   Register". */
+void
+gdt_load (void)
+{
+  uint64_t *gdt = cpu_current ()->gdt;
+  uint64_t gdtr_operand;
+
+  gdtr_operand = make_gdtr_operand (SEL_CNT * sizeof *gdt - 1, gdt);
   asm volatile ("lgdt %0" : : "m" (gdtr_operand));
   asm volatile ("ltr %w0" : : "q" (SEL_TSS));
 }
 
+/* Loads TR again after snapshot_restore(), which leaves it
+   caching the TSS of the kernel that did the restoring, and
+   with the TSS descriptor marked busy by the kernel that took
+   the snapshot, so that "ltr" would fault on it. */
+void
+gdt_reload_tss (void)
+{
+  struct cpu *c = cpu_current ();
+
+  c->gdt[SEL_TSS / sizeof *c->gdt] = make_tss_desc (c->tss);
+  asm volatile ("ltr %w0" : : "q" (SEL_TSS));
+}
+
 /* System segment or code/data segment? */
 enum seg_class
   {
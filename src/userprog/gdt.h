@@ -8,8 +8,17 @@
 #define SEL_UCSEG       0x1B    /* User code selector. */
 #define SEL_UDSEG       0x23    /* User data selector. */
 #define SEL_TSS         0x28    /* Task-state segment. */
-#define SEL_CNT         6       /* Number of segments. */
+#define SEL_DF_TSS      0x30    /* Double fault task-state segment. */
+#define SEL_CNT         7       /* Number of segments. */
 
+#ifndef __ASSEMBLER__
+#include <stdbool.h>
+
+struct cpu;
 void gdt_init (void);
+bool gdt_init_ap (struct cpu *);
+void gdt_load (void);
+void gdt_reload_tss (void);
+#endif
 
 #endif /* userprog/gdt.h */
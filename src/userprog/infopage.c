@@ -0,0 +1,107 @@
+#include "userprog/infopage.h"
+#include <debug.h>
+#include <stddef.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "userprog/sysenter.h"
+
+/* Info pages, for reading kernel state from user mode without a
+   system call.  See lib/infopage.h for their layout.
+
+   The kernel info page comes from the kernel pool and is never
+   freed.  It is mapped read-only into every process's page
+   directory, directly rather than through the supplemental page
+   table, so it never faults and is never evicted.  Each process
+   info page is allocated when its process is loaded and freed,
+   and both pages unmapped, just before its page directory is
+   destroyed. */
+
+/* The kernel info page, or null before infopage_init(). */
+static volatile struct kernel_info *kernel_info;
+
+/* Allocates the kernel info page. */
+void
+infopage_init (void)
+{
+  ASSERT (offsetof (struct kernel_info, sysenter) == KERNEL_INFO_SYSENTER);
+
+  kernel_info = palloc_get_page (PAL_ASSERT | PAL_ZERO);
+  kernel_info->sysenter = sysenter_enabled ();
+  kernel_info->timer_freq = TIMER_FREQ;
+  infopage_update (timer_ticks ());
+}
+
+/* Brings the kernel info page up to date with TICKS.  Called by
+   the timer interrupt handler, with interrupts off. */
+void
+infopage_update (int64_t ticks)
+{
+  volatile struct kernel_info *ki = kernel_info;
+
+  if (ki == NULL)
+    return;
+
+  ki->seq++;
+  barrier ();
+  ki->ticks = ticks;
+  ki->load_avg = thread_get_load_avg ();
+  barrier ();
+  ki->seq++;
+}
+
+/* Maps the info pages into page directory PD, for the process
+   whose id is PID.  Returns true if successful, false if memory
+   is exhausted. */
+bool
+infopage_map (uint32_t *pd, int pid)
+{
+  struct process_info *pi;
+
+  ASSERT (kernel_info != NULL);
+
+  pi = palloc_get_page (PAL_ZERO);
+  if (pi == NULL)
+    return false;
+  pi->pid = pid;
+  if (!pagedir_set_page (pd, PROCESS_INFO_PAGE_ADDR, pi, false))
+    {
+      palloc_free_page (pi);
+      return false;
+    }
+  if (!pagedir_set_page (pd, INFO_PAGE_ADDR, (void *) kernel_info, false))
+    {
+      infopage_unmap (pd);
+      return false;
+    }
+  return true;
+}
+
+/* Unmaps the info pages from PD, if they are mapped, and frees
+   the process info page.  Must be called before PD is destroyed,
+   since pagedir_destroy() would otherwise free the pages. */
+void
+infopage_unmap (uint32_t *pd)
+{
+  void *pi = pagedir_get_page (pd, PROCESS_INFO_PAGE_ADDR);
+
+  if (pi != NULL)
+    {
+      pagedir_clear_page (pd, PROCESS_INFO_PAGE_ADDR);
+      palloc_free_page (pi);
+    }
+  pagedir_clear_page (pd, INFO_PAGE_ADDR);
+}
+
+/* Returns true if user address ADDR is in one of the info
+   pages. */
+bool
+infopage_contains (const void *addr)
+{
+  void *page = pg_round_down (addr);
+  return page == INFO_PAGE_ADDR || page == PROCESS_INFO_PAGE_ADDR;
+}
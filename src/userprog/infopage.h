@@ -0,0 +1,14 @@
+#ifndef USERPROG_INFOPAGE_H
+#define USERPROG_INFOPAGE_H
+
+#include <infopage.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+void infopage_init (void);
+void infopage_update (int64_t ticks);
+bool infopage_map (uint32_t *pd, int pid);
+void infopage_unmap (uint32_t *pd);
+bool infopage_contains (const void *);
+
+#endif /* userprog/infopage.h */
@@ -2,12 +2,36 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <string.h>
+#include "threads/cpu.h"
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/pte.h"
 #include "threads/palloc.h"
 
+/* Page tables freed by pagedir_destroy(), already zeroed, kept
+   for reuse by lookup_page(), so that processes coming and going
+   do not allocate and clear a page table for every page
+   directory.  Accessed with interrupts off, because the critical
+   sections are a few instructions long. */
+#define PT_CACHE_MAX 32
+static uint32_t *pt_cache[PT_CACHE_MAX];
+static size_t pt_cache_cnt;
+
+/* A user page directory entry may map a 4 MB page, set up with
+   pagedir_set_large().  The functions below that only look at a
+   page's mapping, or set its accessed or dirty bit, look at the
+   4 MB page's entry as a whole.  Any other change to a page in
+   it first splits it into a page table of 4 kB pages with the
+   same frames, accessed bit, and dirty bit, so that callers see
+   4 kB pages throughout.  Splitting must not fail, so each 4 MB
+   page has a page table set aside for it: SPLIT_RESERVE, a stack
+   of zeroed page tables chained through their first entries.
+   Accessed with interrupts off, like PT_CACHE. */
+static uint32_t *split_reserve;
+
 static uint32_t *active_pd (void);
-static void invalidate_pagedir (uint32_t *);
+static void invalidate_page (uint32_t *, const void *);
+static uint32_t *large_pde (uint32_t *, const void *);
 
 /* Creates a new page directory that has mappings for kernel
    virtual addresses, but none for user virtual addresses.
@@ -22,8 +46,43 @@ pagedir_create (void)
   return pd;
 }
 
+/* Returns a zeroed page for use as a page table, or a null
+   pointer if memory is exhausted. */
+static uint32_t *
+alloc_pt (void) 
+{
+  uint32_t *pt = NULL;
+  enum intr_level old_level = intr_disable ();
+
+  if (pt_cache_cnt > 0)
+    pt = pt_cache[--pt_cache_cnt];
+  intr_set_level (old_level);
+
+  return pt != NULL ? pt : palloc_get_page (PAL_ZERO);
+}
+
+/* Frees page table PT, which must be all zeros, keeping it for
+   reuse if there is room. */
+static void
+free_pt (uint32_t *pt) 
+{
+  enum intr_level old_level = intr_disable ();
+
+  if (pt_cache_cnt < PT_CACHE_MAX)
+    {
+      pt_cache[pt_cache_cnt++] = pt;
+      pt = NULL;
+    }
+  intr_set_level (old_level);
+
+  if (pt != NULL)
+    palloc_free_page (pt);
+}
+
 /* Destroys page directory PD, freeing all the pages it
-   references. */
+   references.  With virtual memory, the frame table owns the
+   pages that user PTEs point to, so only the page tables
+   themselves are freed here (see page_table_destroy()). */
 void
 pagedir_destroy (uint32_t *pd) 
 {
@@ -34,25 +93,171 @@ pagedir_destroy (uint32_t *pd)
 
   ASSERT (pd != init_page_dir);
   for (pde = pd; pde < pd + pd_no (PHYS_BASE); pde++)
-    if (*pde & PTE_P) 
+    if (*pde & PDE_PS)
+      {
+        /* The frame table owns the frames of a 4 MB page, too.
+           Its reserved page table is no longer needed. */
+        enum intr_level old_level = intr_disable ();
+        uint32_t *pt = split_reserve;
+        split_reserve = (uint32_t *) pt[0];
+        intr_set_level (old_level);
+
+        pt[0] = 0;
+        free_pt (pt);
+      }
+    else if (*pde & PTE_P) 
       {
         uint32_t *pt = pde_get_pt (*pde);
+#ifndef VM
         uint32_t *pte;
         
         for (pte = pt; pte < pt + PGSIZE / sizeof *pte; pte++)
           if (*pte & PTE_P) 
             palloc_free_page (pte_get_page (*pte));
-        palloc_free_page (pt);
+#endif
+        memset (pt, 0, PGSIZE);
+        free_pt (pt);
       }
   palloc_free_page (pd);
 }
 
+#ifndef VM
+/* Copies each user page mapped in page directory SRC to a new
+   page from the user pool, mapped at the same address in DST
+   with the same permissions, except for pages that DST already
+   maps.  Returns true if successful, false if memory is
+   exhausted, in which case the pages copied so far stay mapped
+   in DST for pagedir_destroy() to free. */
+bool
+pagedir_copy (uint32_t *dst, uint32_t *src)
+{
+  uint32_t *pde;
+
+  for (pde = src; pde < src + pd_no (PHYS_BASE); pde++)
+    if (*pde & PTE_P)
+      {
+        uint32_t *pt = pde_get_pt (*pde);
+        uint32_t *pte;
+
+        for (pte = pt; pte < pt + PGSIZE / sizeof *pte; pte++)
+          if (*pte & PTE_P)
+            {
+              void *upage = (void *) (((pde - src) << PDSHIFT)
+                                      | ((pte - pt) << PTSHIFT));
+              uint8_t *kpage;
+
+              if (pagedir_get_page (dst, upage) != NULL)
+                continue;
+              kpage = palloc_get_page (PAL_USER);
+              if (kpage == NULL)
+                return false;
+              memcpy (kpage, pte_get_page (*pte), PGSIZE);
+              if (!pagedir_set_page (dst, upage, kpage,
+                                     (*pte & PTE_W) != 0))
+                {
+                  palloc_free_page (kpage);
+                  return false;
+                }
+            }
+      }
+  return true;
+}
+#endif
+
+/* Splits the 4 MB page that PDE, the entry for VADDR in page
+   directory PD, maps into 4 kB pages, using the page table set
+   aside for it by pagedir_set_large(). */
+static void
+split_large (uint32_t *pd, uint32_t *pde, const void *vaddr)
+{
+  enum intr_level old_level;
+  uint8_t *base = pde_get_large (*pde);
+  uint32_t bits = *pde & (PTE_A | PTE_D);
+  bool writable = (*pde & PTE_W) != 0;
+  uint32_t *pt;
+  size_t i;
+
+  old_level = intr_disable ();
+  pt = split_reserve;
+  split_reserve = (uint32_t *) pt[0];
+  intr_set_level (old_level);
+
+  for (i = 0; i < PGSIZE / sizeof *pt; i++)
+    pt[i] = pte_create_user (base + i * PGSIZE, writable) | bits;
+  *pde = pde_create (pt);
+
+  /* INVLPG of any address in a 4 MB page drops its TLB entry. */
+  invalidate_page (pd, vaddr);
+}
+
+/* Maps the PTSPAN bytes of user virtual memory at UPAGE in page
+   directory PD, both aligned on a PTSPAN boundary, to the
+   physically contiguous frames at kernel virtual address KPAGE,
+   with a single 4 MB page.  The CPU must support 4 MB pages (see
+   init_large_pages).  None of the pages in that span may be
+   mapped.  If WRITABLE is true, the pages are read/write;
+   otherwise they are read-only.  Returns true if successful,
+   false if memory allocation failed. */
+bool
+pagedir_set_large (uint32_t *pd, void *upage, void *kpage, bool writable)
+{
+  enum intr_level old_level;
+  uint32_t *pde = pd + pd_no (upage);
+  uint32_t *pt;
+
+  ASSERT (init_large_pages);
+  ASSERT (((uintptr_t) upage & (PTSPAN - 1)) == 0);
+  ASSERT (is_user_vaddr (upage));
+  ASSERT (pd != init_page_dir);
+
+  /* An existing page table becomes the reserve for splitting. */
+  if (*pde != 0)
+    {
+      size_t i;
+
+      pt = pde_get_pt (*pde);
+      for (i = 0; i < PGSIZE / sizeof *pt; i++)
+        ASSERT ((pt[i] & PTE_P) == 0);
+      memset (pt, 0, PGSIZE);
+    }
+  else
+    {
+      pt = alloc_pt ();
+      if (pt == NULL)
+        return false;
+    }
+
+  old_level = intr_disable ();
+  pt[0] = (uint32_t) split_reserve;
+  split_reserve = pt;
+  intr_set_level (old_level);
+
+  *pde = pde_create_user_large (kpage, writable);
+  invalidate_page (pd, upage);
+  return true;
+}
+
+/* Returns the address of the entry for virtual address VADDR in
+   page directory PD if it maps a 4 MB user page, otherwise a
+   null pointer. */
+static uint32_t *
+large_pde (uint32_t *pd, const void *vaddr)
+{
+  uint32_t *pde = pd + pd_no (vaddr);
+
+  if (!is_user_vaddr (vaddr)
+      || (*pde & (PTE_P | PDE_PS)) != (PTE_P | PDE_PS))
+    return NULL;
+  return pde;
+}
+
 /* Returns the address of the page table entry for virtual
    address VADDR in page directory PD.
    If PD does not have a page table for VADDR, behavior depends
    on CREATE.  If CREATE is true, then a new page table is
    created and a pointer into it is returned.  Otherwise, a null
-   pointer is returned. */
+   pointer is returned.  A 4 MB page that VADDR is in is split
+   first. */
 static uint32_t *
 lookup_page (uint32_t *pd, const void *vaddr, bool create)
 {
@@ -66,11 +271,13 @@ lookup_page (uint32_t *pd, const void *vaddr, bool create)
   /* Check for a page table for VADDR.
      If one is missing, create one if requested. */
   pde = pd + pd_no (vaddr);
+  if (large_pde (pd, vaddr) != NULL)
+    split_large (pd, pde, vaddr);
   if (*pde == 0) 
     {
       if (create)
         {
-          pt = palloc_get_page (PAL_ZERO);
+          pt = alloc_pt ();
           if (pt == NULL) 
             return NULL; 
       
@@ -128,7 +335,10 @@ pagedir_get_page (uint32_t *pd, const void *uaddr)
   uint32_t *pte;
 
   ASSERT (is_user_vaddr (uaddr));
-  
+
+  pte = large_pde (pd, uaddr);
+  if (pte != NULL)
+    return pde_get_large (*pte) + ((uintptr_t) uaddr & (PTSPAN - 1));
   pte = lookup_page (pd, uaddr, false);
   if (pte != NULL && (*pte & PTE_P) != 0)
     return pte_get_page (*pte) + pg_ofs (uaddr);
@@ -152,7 +362,7 @@ pagedir_clear_page (uint32_t *pd, void *upage)
   if (pte != NULL && (*pte & PTE_P) != 0)
     {
       *pte &= ~PTE_P;
-      invalidate_pagedir (pd);
+      invalidate_page (pd, upage);
     }
 }
 
@@ -163,16 +373,31 @@ pagedir_clear_page (uint32_t *pd, void *upage)
 bool
 pagedir_is_dirty (uint32_t *pd, const void *vpage) 
 {
-  uint32_t *pte = lookup_page (pd, vpage, false);
+  uint32_t *pte = large_pde (pd, vpage);
+  if (pte == NULL)
+    pte = lookup_page (pd, vpage, false);
   return pte != NULL && (*pte & PTE_D) != 0;
 }
 
+/* Returns true if virtual page VPAGE is mapped in PD and may be
+   written through the mapping. */
+bool
+pagedir_is_writable (uint32_t *pd, const void *vpage)
+{
+  uint32_t *pte = large_pde (pd, vpage);
+  if (pte == NULL)
+    pte = lookup_page (pd, vpage, false);
+  return pte != NULL && (*pte & (PTE_P | PTE_W)) == (PTE_P | PTE_W);
+}
+
 /* Set the dirty bit to DIRTY in the PTE for virtual page VPAGE
    in PD. */
 void
 pagedir_set_dirty (uint32_t *pd, const void *vpage, bool dirty) 
 {
-  uint32_t *pte = lookup_page (pd, vpage, false);
+  uint32_t *pte = dirty ? large_pde (pd, vpage) : NULL;
+  if (pte == NULL)
+    pte = lookup_page (pd, vpage, false);
   if (pte != NULL) 
     {
       if (dirty)
@@ -180,7 +405,7 @@ pagedir_set_dirty (uint32_t *pd, const void *vpage, bool dirty)
       else 
         {
           *pte &= ~(uint32_t) PTE_D;
-          invalidate_pagedir (pd);
+          invalidate_page (pd, vpage);
         }
     }
 }
@@ -192,7 +417,9 @@ pagedir_set_dirty (uint32_t *pd, const void *vpage, bool dirty)
 bool
 pagedir_is_accessed (uint32_t *pd, const void *vpage) 
 {
-  uint32_t *pte = lookup_page (pd, vpage, false);
+  uint32_t *pte = large_pde (pd, vpage);
+  if (pte == NULL)
+    pte = lookup_page (pd, vpage, false);
   return pte != NULL && (*pte & PTE_A) != 0;
 }
 
@@ -201,7 +428,9 @@ pagedir_is_accessed (uint32_t *pd, const void *vpage)
 void
 pagedir_set_accessed (uint32_t *pd, const void *vpage, bool accessed) 
 {
-  uint32_t *pte = lookup_page (pd, vpage, false);
+  uint32_t *pte = accessed ? large_pde (pd, vpage) : NULL;
+  if (pte == NULL)
+    pte = lookup_page (pd, vpage, false);
   if (pte != NULL) 
     {
       if (accessed)
@@ -209,18 +438,27 @@ pagedir_set_accessed (uint32_t *pd, const void *vpage, bool accessed)
       else 
         {
           *pte &= ~(uint32_t) PTE_A; 
-          invalidate_pagedir (pd);
+          invalidate_page (pd, vpage);
         }
     }
 }
 
 /* Loads page directory PD into the CPU's page directory base
-   register. */
+   register, unless it is already loaded.  Kernel mappings are
+   global (see paging_init()), so they stay in the TLB either
+   way.  The running processor's struct cpu records PD, for TLB
+   shootdowns. */
 void
 pagedir_activate (uint32_t *pd) 
 {
   if (pd == NULL)
     pd = init_page_dir;
+  cpu_current ()->pagedir = pd;
+
+  /* Switching between kernel threads, which all use
+     init_page_dir, needs no reload. */
+  if (active_pd () == pd)
+    return;
 
   /* Store the physical address of the page directory into CR3
      aka PDBR (page directory base register).  This activates our
@@ -245,19 +483,23 @@ active_pd (void)
 
 /* Seom page table changes can cause the CPU's translation
    lookaside buffer (TLB) to become out-of-sync with the page
-   table.  When this happens, we have to "invalidate" the TLB by
-   re-activating it.
+   table.  When this happens, we have to "invalidate" the TLB
+   entry for the page that changed.
 
-   This function invalidates the TLB if PD is the active page
-   directory.  (If PD is not active then its entries are not in
-   the TLB, so there is no need to invalidate anything.) */
+   This function invalidates the TLB entry for user virtual page
+   VPAGE if PD is the active page directory.  (If PD is not
+   active then its entries are not in the TLB, so there is no
+   need to invalidate anything.)  Other processors that have PD
+   active flush their TLBs. */
 static void
-invalidate_pagedir (uint32_t *pd) 
+invalidate_page (uint32_t *pd, const void *vpage) 
 {
   if (active_pd () == pd) 
     {
-      /* Re-activating PD clears the TLB.  See [IA32-v3a] 3.12
-         "Translation Lookaside Buffers (TLBs)". */
-      pagedir_activate (pd);
+      /* INVLPG drops just the one entry, leaving the rest of the
+         TLB, kernel entries included, alone.  See [IA32-v3a]
+         3.12 "Translation Lookaside Buffers (TLBs)". */
+      asm volatile ("invlpg (%0)" : : "r" (vpage) : "memory");
     } 
+  cpu_tlb_shootdown (pd);
 }
@@ -0,0 +1,226 @@
+#include "userprog/pipe.h"
+#include <debug.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/poll.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Pipes.
+
+   A pipe carries bytes from the descriptors open on its write
+   end to those open on its read end through a ring buffer of one
+   page, without touching the disk.  A reader waits while the
+   pipe is empty and a writer while it is full.  Once no
+   descriptor is open on the write end, a reader that finds the
+   pipe empty gets end of file; once none is open on the read
+   end, a write fails.
+
+   Each end counts the descriptors open on it, plus any system
+   call in progress on it, so that a thread blocked in
+   pipe_read() or pipe_write() keeps the pipe alive even if
+   another thread closes the descriptor meanwhile.  The pipe is
+   freed when both counts reach zero.
+
+   Every change that may let a reader or writer proceed wakes the
+   pollers on POLLERS as well as the threads waiting on READABLE
+   or WRITABLE. */
+
+/* Bytes a pipe can hold. */
+#define PIPE_SIZE PGSIZE
+
+/* A pipe. */
+struct pipe
+  {
+    struct lock lock;           /* Protects all the members below. */
+    struct condition readable;  /* Signaled when data or EOF arrives. */
+    struct condition writable;  /* Signaled when space frees up. */
+    struct poll_queue pollers;  /* Woken on every change. */
+    uint8_t *buf;               /* Ring buffer of PIPE_SIZE bytes. */
+    size_t head;                /* Offset of the oldest byte. */
+    size_t used;                /* Bytes in BUF. */
+    int reader_cnt;             /* References to the read end. */
+    int writer_cnt;             /* References to the write end. */
+  };
+
+/* Creates a pipe with one reference to each end.  Returns the
+   new pipe, or a null pointer if memory is exhausted. */
+struct pipe *
+pipe_create (void)
+{
+  struct pipe *p = malloc (sizeof *p);
+  if (p == NULL)
+    return NULL;
+  p->buf = palloc_get_page (0);
+  if (p->buf == NULL)
+    {
+      free (p);
+      return NULL;
+    }
+  lock_init (&p->lock);
+  cond_init (&p->readable);
+  cond_init (&p->writable);
+  poll_queue_init (&p->pollers);
+  p->head = 0;
+  p->used = 0;
+  p->reader_cnt = 1;
+  p->writer_cnt = 1;
+  return p;
+}
+
+/* Adds a reference to the write end of P if WRITE is true, or
+   to its read end otherwise.  The caller must already hold a
+   reference to that end. */
+void
+pipe_open (struct pipe *p, bool write)
+{
+  lock_acquire (&p->lock);
+  if (write)
+    {
+      ASSERT (p->writer_cnt > 0);
+      p->writer_cnt++;
+    }
+  else
+    {
+      ASSERT (p->reader_cnt > 0);
+      p->reader_cnt++;
+    }
+  lock_release (&p->lock);
+}
+
+/* Drops a reference to the write end of P if WRITE is true, or
+   to its read end otherwise, and frees P if that was the last
+   reference to either end. */
+void
+pipe_close (struct pipe *p, bool write)
+{
+  bool last;
+
+  lock_acquire (&p->lock);
+  if (write)
+    {
+      ASSERT (p->writer_cnt > 0);
+      if (--p->writer_cnt == 0)
+        {
+          cond_broadcast (&p->readable, &p->lock);
+          poll_queue_wake (&p->pollers);
+        }
+    }
+  else
+    {
+      ASSERT (p->reader_cnt > 0);
+      if (--p->reader_cnt == 0)
+        {
+          cond_broadcast (&p->writable, &p->lock);
+          poll_queue_wake (&p->pollers);
+        }
+    }
+  last = p->reader_cnt == 0 && p->writer_cnt == 0;
+  lock_release (&p->lock);
+
+  if (last)
+    {
+      palloc_free_page (p->buf);
+      free (p);
+    }
+}
+
+/* Reads up to SIZE bytes from P into BUF, waiting until at least
+   one byte is there or no writer is left.  Returns the number of
+   bytes read, which is 0 only at end of file or if SIZE is 0. */
+int
+pipe_read (struct pipe *p, void *buf_, size_t size)
+{
+  uint8_t *buf = buf_;
+  size_t done = 0;
+
+  lock_acquire (&p->lock);
+  while (p->used == 0 && p->writer_cnt > 0 && size > 0)
+    cond_wait (&p->readable, &p->lock);
+  while (done < size && p->used > 0)
+    {
+      /* Copy the run up to the end of the buffer or of the data. */
+      size_t chunk = PIPE_SIZE - p->head;
+      if (chunk > p->used)
+        chunk = p->used;
+      if (chunk > size - done)
+        chunk = size - done;
+      memcpy (buf + done, p->buf + p->head, chunk);
+      p->head = (p->head + chunk) % PIPE_SIZE;
+      p->used -= chunk;
+      done += chunk;
+    }
+  if (done > 0)
+    {
+      cond_broadcast (&p->writable, &p->lock);
+      poll_queue_wake (&p->pollers);
+    }
+  lock_release (&p->lock);
+  return done;
+}
+
+/* Writes the SIZE bytes in BUF to P, waiting for space as
+   needed.  Returns SIZE if successful.  If every reader goes
+   away first, stops and returns the number of bytes written, or
+   -1 if there were none. */
+int
+pipe_write (struct pipe *p, const void *buf_, size_t size)
+{
+  const uint8_t *buf = buf_;
+  size_t done = 0;
+
+  lock_acquire (&p->lock);
+  while (done < size && p->reader_cnt > 0)
+    {
+      size_t tail, chunk;
+
+      if (p->used == PIPE_SIZE)
+        {
+          cond_wait (&p->writable, &p->lock);
+          continue;
+        }
+
+      /* Copy the run up to the end of the buffer or of the free
+         space. */
+      tail = (p->head + p->used) % PIPE_SIZE;
+      chunk = tail >= p->head ? PIPE_SIZE - tail : p->head - tail;
+      if (chunk > size - done)
+        chunk = size - done;
+      memcpy (p->buf + tail, buf + done, chunk);
+      p->used += chunk;
+      done += chunk;
+      cond_broadcast (&p->readable, &p->lock);
+      poll_queue_wake (&p->pollers);
+    }
+  lock_release (&p->lock);
+  return done > 0 || size == 0 ? (int) done : -1;
+}
+
+/* Puts E on P's poll queue and returns the readiness of P's
+   write end if WRITE is true, or of its read end otherwise, as
+   POLL* bits.  The caller must hold a reference to that end. */
+unsigned
+pipe_poll (struct pipe *p, bool write, struct poll_entry *e)
+{
+  unsigned revents = 0;
+
+  lock_acquire (&p->lock);
+  poll_entry_add (e, &p->pollers);
+  if (write)
+    {
+      if (p->reader_cnt == 0)
+        revents |= POLLHUP;
+      else if (p->used < PIPE_SIZE)
+        revents |= POLLOUT;
+    }
+  else
+    {
+      if (p->used > 0)
+        revents |= POLLIN;
+      if (p->writer_cnt == 0)
+        revents |= POLLHUP;
+    }
+  lock_release (&p->lock);
+  return revents;
+}
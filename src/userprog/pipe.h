@@ -0,0 +1,17 @@
+#ifndef USERPROG_PIPE_H
+#define USERPROG_PIPE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct pipe;
+struct poll_entry;
+
+struct pipe *pipe_create (void);
+void pipe_open (struct pipe *, bool write);
+void pipe_close (struct pipe *, bool write);
+int pipe_read (struct pipe *, void *, size_t);
+int pipe_write (struct pipe *, const void *, size_t);
+unsigned pipe_poll (struct pipe *, bool write, struct poll_entry *);
+
+#endif /* userprog/pipe.h */
@@ -5,64 +5,300 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "userprog/exec-cache.h"
 #include "userprog/gdt.h"
+#include "userprog/infopage.h"
 #include "userprog/pagedir.h"
+#include "userprog/syscall.h"
 #include "userprog/tss.h"
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "filesys/inode.h"
+#include "devices/timer.h"
+#include "threads/cpu.h"
 #include "threads/flags.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
+#include "threads/klog.h"
+#include "threads/malloc.h"
 #include "threads/palloc.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
+#include "threads/workqueue.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
+
+/* Print each process's resource usage when it exits?  Set by
+   the "-rusage" kernel command-line option. */
+bool process_print_usage;
+
+/* Name of the program whose processes log their system calls
+   (see syscall.c), "all", or a null pointer.  Set by the
+   "-strace" kernel command-line option. */
+const char *process_strace;
+
+/* Status of a child process, shared by the child and the thread
+   that started it so that either may exit first.  The parent
+   finds it on its CHILDREN list, the child through its process's
+   CHILD member.  It is freed by whichever of the two lets go of
+   it last.
+
+   A user thread other than the first in its process has one
+   too, shared with whichever thread joins it.  It is on the
+   process's THREADS list and the thread's JOINABLE member. */
+struct child
+  {
+    struct list_elem elem;              /* Element in CHILDREN or THREADS. */
+    tid_t tid;                          /* Child's thread id. */
+    int exit_code;                      /* Valid once DEAD is up'd. */
+    struct semaphore dead;              /* Up'd when the child exits. */
+    struct lock lock;                   /* Protects REF_CNT. */
+    int ref_cnt;                        /* 2 = both alive, 1 = one left. */
+  };
+
+/* A program to load and the arguments to pass it.  If FILE_NAME
+   is null, ARGS is a command line whose words, separated by
+   spaces, are the arguments, the first of them naming the
+   program.  Otherwise, ARGS holds the arguments as ARGS_LEN
+   bytes of null-terminated strings, one after another, and may
+   name the program differently from FILE_NAME. */
+struct exec_args
+  {
+    const char *file_name;              /* Program, or null. */
+    const char *args;                   /* Arguments. */
+    size_t args_len;                    /* Bytes in ARGS, with nulls. */
+  };
+
+/* Passed from process_execute() or process_spawn() to
+   start_process() on the parent's stack.  The parent waits on
+   LOADED before returning, so it and the arguments and actions
+   it points to stay valid until start_process() is done with
+   them. */
+struct exec_info
+  {
+    struct exec_args args;              /* Program and arguments. */
+    const struct fd_action *actions;    /* Descriptor actions. */
+    size_t action_cnt;                  /* Number of ACTIONS. */
+    struct child *child;                /* Child's status record. */
+    struct process *parent;             /* Parent's process, or null. */
+    int nice;                           /* Parent thread's nice value. */
+    struct semaphore loaded;            /* Up'd when loading is done. */
+    bool success;                       /* Did the program load? */
+  };
+
+/* Passed from process_fork() to start_fork() on the parent's
+   stack, like struct exec_info. */
+struct fork_info
+  {
+    const struct intr_frame *frame;     /* Parent's user context. */
+    struct process *parent;             /* Parent's process. */
+    uint32_t *pagedir;                  /* Parent's page directory. */
+#ifdef VM
+    struct page_table *pages;           /* Parent's page table. */
+#endif
+    int stack_slot;                     /* Parent thread's stack slot. */
+    int nice;                           /* Parent thread's nice value. */
+    struct child *child;                /* Child's status record. */
+    struct semaphore done;              /* Up'd when copying is done. */
+    bool success;                       /* Was the process copied? */
+  };
+
+/* Passed from process_thread_create() to start_thread() on the
+   creator's stack, like struct exec_info. */
+struct thread_info
+  {
+    struct process *process;            /* Process to join. */
+    uint32_t *pagedir;                  /* Its page directory. */
+#ifdef VM
+    struct page_table *pages;           /* Its page table. */
+#endif
+    struct child *joinable;             /* New thread's status record. */
+    int stack_slot;                     /* Slot for the thread's stack. */
+    int nice;                           /* Creator's nice value. */
+    void (*entry) (void);               /* User entry point. */
+    void *func;                         /* First argument to ENTRY. */
+    void *aux;                          /* Second argument to ENTRY. */
+    struct semaphore started;           /* Up'd when the thread is set up. */
+    bool success;                       /* Is it running? */
+  };
+
+/* User threads.
+
+   Each thread of a process other than the first runs on a stack
+   of THREAD_STACK_PAGES pages in one of PROCESS_THREAD_MAX - 1
+   fixed slots below the first thread's stack, with an unmapped
+   guard page above each slot, so that a stack overflow faults.
+   With virtual memory, the pages of a thread's stack are entered
+   in the page table when it starts and brought in as it touches
+   them; without it, the slot's top page alone is mapped, as the
+   first thread gets a single page. */
+#define THREAD_STACK_PAGES 16
+
+/* The reaper.
+
+   Once the last thread of a process has reported its exit code,
+   it leaves the process's page table and page directory, which
+   may take a while to free, to the reaper: a worker thread at
+   PRI_MIN, so that a parent's wait does not include them.  The
+   exiting thread still closes descriptors and memory mappings
+   itself, because the parent may see their effects, such as
+   data written back to a mapped file or the end of a pipe.
+
+   Creating a process first calls process_reap() to free what
+   the reaper has not gotten to yet, so that dead processes never
+   keep memory from new ones.  The thread that frees processes
+   holds REAP_LOCK throughout, so process_reap() donates its
+   priority to a reaper that has fallen behind. */
+static struct workqueue reap_wq;
+static struct work reap_work;
+static struct lock reap_lock;
+static struct list reap_list;   /* Processes to free.  Interrupts off. */
 
 static thread_func start_process NO_RETURN;
-static bool load (const char *cmdline, void (**eip) (void), void **esp);
+static thread_func start_fork NO_RETURN;
+static thread_func start_thread NO_RETURN;
+static struct process *new_process (struct child *);
+static tid_t execute (struct exec_info *, const char *name);
+static bool load (const struct exec_args *,
+                  void (**eip) (void), void **esp);
+static struct child *new_child (void);
+static void release_child (struct child *);
+static bool setup_thread_stack (int slot, void **esp, void *func, void *aux);
+static void free_thread_stack (int slot);
+static void add_usage (struct thread_usage *, const struct thread_usage *);
+static void print_usage (const char *name, const struct thread_usage *);
+static void reap_later (struct process *);
+static void reap_run (void *);
 
-/* Starts a new thread running a user program loaded from
-   FILENAME.  The new thread may be scheduled (and may even exit)
-   before process_execute() returns.  Returns the new process's
-   thread id, or TID_ERROR if the thread cannot be created. */
+/* Starts a new thread running the user program named by the
+   first word of CMD_LINE, passing it the words of CMD_LINE as
+   arguments, and waits for it to finish loading.  Returns the
+   new process's thread id, or TID_ERROR if the thread cannot be
+   created or the program cannot be loaded. */
 tid_t
-process_execute (const char *file_name) 
+process_execute (const char *cmd_line) 
+{
+  struct exec_info exec;
+  char name[sizeof thread_current ()->name];
+  size_t name_len;
+
+  /* Name the thread after the program.  CMD_LINE itself needs no
+     copy, because execute() waits until load() is done with it. */
+  cmd_line += strspn (cmd_line, " ");
+  name_len = strcspn (cmd_line, " ");
+  strlcpy (name, cmd_line, name_len < sizeof name ? name_len + 1 : sizeof name);
+  exec.args.file_name = NULL;
+  exec.args.args = cmd_line;
+  exec.args.args_len = strlen (cmd_line) + 1;
+  exec.actions = NULL;
+  exec.action_cnt = 0;
+  return execute (&exec, name);
+}
+
+/* Starts a new thread running the user program FILE_NAME,
+   passing it the ARGS_LEN bytes of null-terminated strings in
+   ARGS as arguments, and carries out the ACTION_CNT ACTIONS on
+   its file descriptors before it loads.  Unlike
+   process_execute(), needs no command line to be split, so
+   arguments may contain spaces.  Waits for the program to
+   finish loading, and returns the new process's thread id, or
+   TID_ERROR if the thread cannot be created, an action fails,
+   or the program cannot be loaded. */
+tid_t
+process_spawn (const char *file_name, const char *args, size_t args_len,
+               const struct fd_action *actions, size_t action_cnt)
+{
+  struct exec_info exec;
+
+  exec.args.file_name = file_name;
+  exec.args.args = args;
+  exec.args.args_len = args_len;
+  exec.actions = actions;
+  exec.action_cnt = action_cnt;
+  return execute (&exec, file_name);
+}
+
+/* Starts a new thread named NAME to run the program described
+   by EXEC, whose ARGS and ACTIONS must be filled in, and waits
+   for it to finish loading.  Returns the new process's thread
+   id, or TID_ERROR on failure. */
+static tid_t
+execute (struct exec_info *exec, const char *name)
 {
-  char *fn_copy;
   tid_t tid;
 
-  /* Make a copy of FILE_NAME.
-     Otherwise there's a race between the caller and load(). */
-  fn_copy = palloc_get_page (0);
-  if (fn_copy == NULL)
+  exec->parent = thread_current ()->process;
+  exec->nice = thread_get_nice ();
+  process_reap ();
+
+  exec->child = new_child ();
+  if (exec->child == NULL)
     return TID_ERROR;
-  strlcpy (fn_copy, file_name, PGSIZE);
+  sema_init (&exec->loaded, 0);
 
-  /* Create a new thread to execute FILE_NAME. */
-  tid = thread_create (file_name, PRI_DEFAULT, start_process, fn_copy);
-  if (tid == TID_ERROR)
-    palloc_free_page (fn_copy); 
+  /* Create a new thread to run the program. */
+  tid = thread_create (name, PRI_DEFAULT, start_process, exec);
+  if (tid != TID_ERROR)
+    {
+      sema_down (&exec->loaded);
+      if (exec->success)
+        list_push_back (&thread_current ()->children, &exec->child->elem);
+      else
+        {
+          /* The child has exited or is exiting, and lets go of
+             its own reference in process_exit(). */
+          release_child (exec->child);
+          tid = TID_ERROR;
+        }
+    }
+  else
+    free (exec->child);
   return tid;
 }
 
 /* A thread function that loads a user process and starts it
    running. */
 static void
-start_process (void *file_name_)
+start_process (void *exec_)
 {
-  char *file_name = file_name_;
+  struct exec_info *exec = exec_;
+  struct thread *cur = thread_current ();
   struct intr_frame if_;
   bool success;
 
+  /* A process starts with the nice value of the thread that
+     started it, as under Unix, so that "nice" in the shell
+     works. */
+  thread_set_nice (exec->nice);
+  exec->child->tid = cur->tid;
+  cur->process = new_process (exec->child);
+  if (cur->process == NULL)
+    {
+      /* Let go of our reference to the status.  The parent lets
+         go of its own when it sees the failure. */
+      release_child (exec->child);
+      exec->success = false;
+      sema_up (&exec->loaded);
+      thread_exit ();
+    }
+
   /* Initialize interrupt frame and load executable. */
   memset (&if_, 0, sizeof if_);
   if_.gs = if_.fs = if_.es = if_.ds = if_.ss = SEL_UDSEG;
   if_.cs = SEL_UCSEG;
   if_.eflags = FLAG_IF | FLAG_MBS;
-  success = load (file_name, &if_.eip, &if_.esp);
+  success = (syscall_inherit_fds (exec->parent,
+                                  exec->actions, exec->action_cnt)
+             && load (&exec->args, &if_.eip, &if_.esp));
+
+  /* Tell the parent, which may free EXEC as soon as we do. */
+  exec->success = success;
+  sema_up (&exec->loaded);
 
   /* If load failed, quit. */
-  palloc_free_page (file_name);
   if (!success) 
     thread_exit ();
 
@@ -72,34 +308,333 @@ start_process (void *file_name_)
      arguments on the stack in the form of a `struct intr_frame',
      we just point the stack pointer (%esp) to our stack frame
      and jump to it. */
+  thread_charge_kernel ();
+  kernel_lock_exit ();
   asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
   NOT_REACHED ();
 }
 
+/* Returns a new process for the current thread, the only one in
+   it so far, whose status is shared with its parent through
+   CHILD, or a null pointer if memory is exhausted. */
+static struct process *
+new_process (struct child *child)
+{
+  struct process *proc = malloc (sizeof *proc);
+
+  if (proc == NULL)
+    return NULL;
+  lock_init (&proc->lock);
+  proc->thread_cnt = 1;
+  proc->stack_map = 0;
+  proc->exiting = false;
+  proc->exit_code = -1;
+  proc->child = child;
+  list_init (&proc->threads);
+  proc->executable = NULL;
+  memset (&proc->usage, 0, sizeof proc->usage);
+  proc->strace = (process_strace != NULL
+                  && (!strcmp (process_strace, "all")
+                      || !strcmp (process_strace, thread_name ())));
+  lock_init (&proc->fd_lock);
+  proc->fds = NULL;
+  proc->fd_cnt = 0;
+  proc->fd_map = NULL;
+  list_init (&proc->aios);
+  proc->next_aio_id = 0;
+#ifdef VM
+  list_init (&proc->mappings);
+  proc->next_mapid = 0;
+  proc->heap_start = proc->heap_break = proc->heap_limit = NULL;
+#endif
+  return proc;
+}
+
+/* Starts a new process that is a copy of the current one, which
+   must have no other threads, resuming from the user context in
+   F, the interrupt frame of the system call that asked for it,
+   except that it sees 0 as that call's return value.  With
+   virtual memory, the copy shares the current process's frames
+   until one of the two writes to them (see vm/page.c).  The new
+   process gets copies of all of the current one's file
+   descriptors, but none of its memory-mapped files.  Returns the
+   new process's thread id, or TID_ERROR on failure. */
+tid_t
+process_fork (const struct intr_frame *f)
+{
+  struct thread *cur = thread_current ();
+  struct process *proc = cur->process;
+  struct fork_info fork;
+  bool alone;
+  tid_t tid;
+
+  /* Other threads' stacks would be copied without the threads. */
+  lock_acquire (&proc->lock);
+  alone = proc->thread_cnt == 1 && !proc->exiting;
+  lock_release (&proc->lock);
+  if (!alone)
+    return TID_ERROR;
+
+  process_reap ();
+  fork.frame = f;
+  fork.parent = proc;
+  fork.pagedir = cur->pagedir;
+#ifdef VM
+  fork.pages = cur->pages;
+#endif
+  fork.stack_slot = cur->stack_slot;
+  fork.nice = thread_get_nice ();
+  fork.child = new_child ();
+  if (fork.child == NULL)
+    return TID_ERROR;
+  sema_init (&fork.done, 0);
+
+  tid = thread_create (cur->name, PRI_DEFAULT, start_fork, &fork);
+  if (tid != TID_ERROR)
+    {
+      sema_down (&fork.done);
+      if (fork.success)
+        list_push_back (&cur->children, &fork.child->elem);
+      else
+        {
+          /* As in process_execute(). */
+          release_child (fork.child);
+          tid = TID_ERROR;
+        }
+    }
+  else
+    free (fork.child);
+  return tid;
+}
+
+/* Copies the address space of the process in FORK into the
+   current thread's process, which has none yet.  Returns true
+   if successful. */
+static bool
+copy_address_space (struct fork_info *fork)
+{
+  struct thread *cur = thread_current ();
+  struct process *proc = cur->process;
+
+  cur->pagedir = pagedir_create ();
+  if (cur->pagedir == NULL)
+    return false;
+  process_activate ();
+  if (!infopage_map (cur->pagedir, cur->tid))
+    return false;
+
+  /* Keep the program file open, and unwritable, for as long as
+     we run it too. */
+  proc->executable = file_reopen (fork->parent->executable);
+  if (proc->executable == NULL)
+    return false;
+  file_deny_write (proc->executable);
+
+#ifdef VM
+  proc->heap_start = fork->parent->heap_start;
+  proc->heap_break = fork->parent->heap_break;
+  proc->heap_limit = fork->parent->heap_limit;
+  return (page_init ()
+          && page_fork (fork->pages, fork->parent->executable,
+                        proc->executable));
+#else
+  return pagedir_copy (cur->pagedir, fork->pagedir);
+#endif
+}
+
+/* A thread function that makes a copy of the process in FORK_
+   and starts it running. */
+static void
+start_fork (void *fork_)
+{
+  struct fork_info *fork = fork_;
+  struct thread *cur = thread_current ();
+  struct intr_frame if_;
+  bool success;
+
+  thread_set_nice (fork->nice);
+  fork->child->tid = cur->tid;
+  cur->process = new_process (fork->child);
+  if (cur->process == NULL)
+    {
+      /* As in start_process(). */
+      release_child (fork->child);
+      fork->success = false;
+      sema_up (&fork->done);
+      thread_exit ();
+    }
+
+  /* Run on the same stack as the thread that forked us. */
+  if (fork->stack_slot >= 0)
+    {
+      cur->stack_slot = fork->stack_slot;
+      cur->process->stack_map = 1u << fork->stack_slot;
+    }
+
+  if_ = *fork->frame;
+  if_.eax = 0;
+  success = (syscall_fork_fds (fork->parent)
+             && copy_address_space (fork));
+
+  /* Tell the parent, which may free FORK as soon as we do. */
+  fork->success = success;
+  sema_up (&fork->done);
+  if (!success)
+    thread_exit ();
+
+  /* Start running, as in start_process(). */
+  thread_charge_kernel ();
+  kernel_lock_exit ();
+  asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
+  NOT_REACHED ();
+}
+
+/* Returns a new status record with both references taken, or a
+   null pointer if memory is exhausted. */
+static struct child *
+new_child (void)
+{
+  struct child *c = malloc (sizeof *c);
+
+  if (c != NULL)
+    {
+      c->exit_code = -1;
+      sema_init (&c->dead, 0);
+      lock_init (&c->lock);
+      c->ref_cnt = 2;
+    }
+  return c;
+}
+
+/* Drops a reference to C, freeing it if it was the last. */
+static void
+release_child (struct child *c)
+{
+  int ref_cnt;
+
+  lock_acquire (&c->lock);
+  ref_cnt = --c->ref_cnt;
+  lock_release (&c->lock);
+
+  if (ref_cnt == 0)
+    free (c);
+}
+
 /* Waits for thread TID to die and returns its exit status.  If
    it was terminated by the kernel (i.e. killed due to an
    exception), returns -1.  If TID is invalid or if it was not a
    child of the calling process, or if process_wait() has already
    been successfully called for the given TID, returns -1
-   immediately, without waiting.
-
-   This function will be implemented in problem 2-2.  For now, it
-   does nothing. */
+   immediately, without waiting. */
 int
-process_wait (tid_t child_tid UNUSED) 
+process_wait (tid_t child_tid) 
 {
+  struct thread *cur = thread_current ();
+  struct list_elem *e;
+
+  for (e = list_begin (&cur->children); e != list_end (&cur->children);
+       e = list_next (e))
+    {
+      struct child *c = list_entry (e, struct child, elem);
+      if (c->tid == child_tid)
+        {
+          int exit_code;
+
+          list_remove (e);
+          sema_down (&c->dead);
+          exit_code = c->exit_code;
+          release_child (c);
+          return exit_code;
+        }
+    }
   return -1;
 }
 
-/* Free the current process's resources. */
+/* Frees the current thread's resources and, if it is the last
+   thread of its process, reports the process's exit code and
+   leaves the process to the reaper. */
 void
 process_exit (void)
 {
   struct thread *cur = thread_current ();
+  struct process *proc = cur->process;
   uint32_t *pd;
+  bool last;
+
+  /* Let go of our children's status, without waiting for them. */
+  while (!list_empty (&cur->children))
+    release_child (list_entry (list_pop_front (&cur->children),
+                               struct child, elem));
+  if (proc == NULL)
+    return;
+
+  /* A thread other than the first gives back its stack and tells
+     whoever joins it that it is done. */
+  if (cur->stack_slot >= 0)
+    {
+      free_thread_stack (cur->stack_slot);
+      cur->stack_slot = -1;
+    }
+  if (cur->joinable != NULL)
+    {
+      sema_up (&cur->joinable->dead);
+      release_child (cur->joinable);
+      cur->joinable = NULL;
+    }
+
+  thread_charge_kernel ();
+  lock_acquire (&proc->lock);
+  add_usage (&proc->usage, &cur->usage);
+  last = --proc->thread_cnt == 0;
+  lock_release (&proc->lock);
+  if (!last)
+    {
+      /* The address space lives on in the other threads. */
+      cur->process = NULL;
+#ifdef VM
+      cur->pages = NULL;
+#endif
+      cur->pagedir = NULL;
+      pagedir_activate (NULL);
+      return;
+    }
 
-  /* Destroy the current process's page directory and switch back
-     to the kernel-only page directory. */
+  /* Without a call to exit(), the process's exit code is that of
+     its last thread: 0 if it called thread_exit(), -1 if it was
+     killed. */
+  if (!proc->exiting)
+    proc->exit_code = cur->exit_code;
+
+  /* Report the exit code of user processes that got as far as
+     having an address space. */
+  if (cur->pagedir != NULL)
+    {
+      printf ("%s: exit(%d)\n", cur->name, proc->exit_code);
+      klog (KLOG_PROCESS_EXIT, proc->exit_code, 0);
+      if (process_print_usage)
+        print_usage (cur->name, &proc->usage);
+    }
+
+  syscall_exit ();
+
+  /* Report our exit code to our parent, and let go of the status
+     of the threads that were never joined. */
+  if (proc->child != NULL)
+    {
+      proc->child->exit_code = proc->exit_code;
+      sema_up (&proc->child->dead);
+      release_child (proc->child);
+    }
+  while (!list_empty (&proc->threads))
+    release_child (list_entry (list_pop_front (&proc->threads),
+                               struct child, elem));
+
+  /* Let the program file be written again. */
+  file_close (proc->executable);
+
+  /* Switch back to the kernel-only page directory and leave the
+     current process's page directory and page table to the
+     reaper. */
   pd = cur->pagedir;
   if (pd != NULL) 
     {
@@ -107,13 +642,320 @@ process_exit (void)
          cur->pagedir to NULL before switching page directories,
          so that a timer interrupt can't switch back to the
          process page directory.  We must activate the base page
-         directory before destroying the process's page
-         directory, or our active page directory will be one
+         directory before the process's page directory is
+         destroyed, or our active page directory will be one
          that's been freed (and cleared). */
       cur->pagedir = NULL;
       pagedir_activate (NULL);
-      pagedir_destroy (pd);
     }
+  proc->pagedir = pd;
+#ifdef VM
+  proc->pages = cur->pages;
+  cur->pages = NULL;
+#endif
+  cur->process = NULL;
+  reap_later (proc);
+}
+
+/* Starts the reaper.  Called once the scheduler has started. */
+void
+process_start (void)
+{
+  lock_init (&reap_lock);
+  list_init (&reap_list);
+  work_init (&reap_work, reap_run, NULL);
+  workqueue_init (&reap_wq, "reaper", 1, PRI_MIN);
+}
+
+/* Frees every process left to the reaper, in the current
+   thread. */
+void
+process_reap (void)
+{
+  lock_acquire (&reap_lock);
+  for (;;)
+    {
+      enum intr_level old_level = intr_disable ();
+      struct process *proc = NULL;
+
+      if (!list_empty (&reap_list))
+        proc = list_entry (list_pop_front (&reap_list),
+                           struct process, reap_elem);
+      intr_set_level (old_level);
+      if (proc == NULL)
+        break;
+
+#ifdef VM
+      if (proc->pages != NULL)
+        page_table_destroy (proc->pages);
+#endif
+      if (proc->pagedir != NULL)
+        {
+          infopage_unmap (proc->pagedir);
+          pagedir_destroy (proc->pagedir);
+        }
+      free (proc);
+    }
+  lock_release (&reap_lock);
+}
+
+/* Leaves PROC, whose threads have all exited, to the reaper. */
+static void
+reap_later (struct process *proc)
+{
+  enum intr_level old_level = intr_disable ();
+  list_push_back (&reap_list, &proc->reap_elem);
+  intr_set_level (old_level);
+  work_queue (&reap_wq, &reap_work);
+}
+
+/* Reaper work function. */
+static void
+reap_run (void *aux UNUSED)
+{
+  process_reap ();
+}
+
+/* Starts a new thread in the current process, running ENTRY in
+   user mode with FUNC and AUX as its arguments, on a stack of
+   its own.  Returns the new thread's id, or TID_ERROR if the
+   process has too many threads or is exiting, or if memory is
+   exhausted. */
+tid_t
+process_thread_create (void (*entry) (void), void *func, void *aux)
+{
+  struct thread *cur = thread_current ();
+  struct process *proc = cur->process;
+  struct thread_info info;
+  tid_t tid;
+
+  ASSERT (proc != NULL);
+
+  info.joinable = new_child ();
+  if (info.joinable == NULL)
+    return TID_ERROR;
+
+  /* Reserve a stack slot. */
+  lock_acquire (&proc->lock);
+  info.stack_slot = -1;
+  if (!proc->exiting && proc->thread_cnt < PROCESS_THREAD_MAX)
+    {
+      int slot;
+
+      for (slot = 0; slot < PROCESS_THREAD_MAX - 1; slot++)
+        if ((proc->stack_map & (1u << slot)) == 0)
+          {
+            proc->stack_map |= 1u << slot;
+            proc->thread_cnt++;
+            info.stack_slot = slot;
+            break;
+          }
+    }
+  lock_release (&proc->lock);
+  if (info.stack_slot < 0)
+    {
+      free (info.joinable);
+      return TID_ERROR;
+    }
+
+  info.process = proc;
+  info.pagedir = cur->pagedir;
+#ifdef VM
+  info.pages = cur->pages;
+#endif
+  info.nice = thread_get_nice ();
+  info.entry = entry;
+  info.func = func;
+  info.aux = aux;
+  sema_init (&info.started, 0);
+
+  tid = thread_create (cur->name, thread_get_priority (), start_thread,
+                       &info);
+  if (tid == TID_ERROR)
+    {
+      lock_acquire (&proc->lock);
+      proc->stack_map &= ~(1u << info.stack_slot);
+      proc->thread_cnt--;
+      lock_release (&proc->lock);
+      free (info.joinable);
+      return TID_ERROR;
+    }
+
+  sema_down (&info.started);
+  if (info.success)
+    {
+      lock_acquire (&proc->lock);
+      list_push_back (&proc->threads, &info.joinable->elem);
+      lock_release (&proc->lock);
+    }
+  else
+    {
+      /* The thread is exiting and lets go of its own reference in
+         process_exit(). */
+      release_child (info.joinable);
+      tid = TID_ERROR;
+    }
+  return tid;
+}
+
+/* A thread function that joins the process in INFO_ and starts
+   running it. */
+static void
+start_thread (void *info_)
+{
+  struct thread_info *info = info_;
+  struct thread *cur = thread_current ();
+  struct intr_frame if_;
+  bool success;
+
+  thread_set_nice (info->nice);
+  cur->process = info->process;
+  cur->pagedir = info->pagedir;
+#ifdef VM
+  cur->pages = info->pages;
+#endif
+  cur->joinable = info->joinable;
+  cur->joinable->tid = cur->tid;
+  process_activate ();
+
+  memset (&if_, 0, sizeof if_);
+  if_.gs = if_.fs = if_.es = if_.ds = if_.ss = SEL_UDSEG;
+  if_.cs = SEL_UCSEG;
+  if_.eflags = FLAG_IF | FLAG_MBS;
+  if_.eip = info->entry;
+  success = setup_thread_stack (info->stack_slot, &if_.esp,
+                                info->func, info->aux);
+  if (success)
+    cur->stack_slot = info->stack_slot;
+  else
+    {
+      lock_acquire (&cur->process->lock);
+      cur->process->stack_map &= ~(1u << info->stack_slot);
+      lock_release (&cur->process->lock);
+    }
+
+  /* Tell the creator, which may free INFO as soon as we do. */
+  info->success = success;
+  sema_up (&info->started);
+  if (!success)
+    thread_exit ();
+
+  /* Start running, as in start_process(). */
+  thread_charge_kernel ();
+  kernel_lock_exit ();
+  asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
+  NOT_REACHED ();
+}
+
+/* Waits for thread TID, which must be another thread of the
+   current process not yet joined, to exit.  Returns 0 if
+   successful, -1 if TID is not such a thread. */
+int
+process_thread_join (tid_t tid)
+{
+  struct process *proc = thread_current ()->process;
+  struct child *c = NULL;
+  struct list_elem *e;
+
+  /* A thread cannot join itself. */
+  if (tid == thread_tid ())
+    return -1;
+
+  lock_acquire (&proc->lock);
+  for (e = list_begin (&proc->threads); e != list_end (&proc->threads);
+       e = list_next (e))
+    if (list_entry (e, struct child, elem)->tid == tid)
+      {
+        c = list_entry (e, struct child, elem);
+        list_remove (e);
+        break;
+      }
+  lock_release (&proc->lock);
+
+  if (c == NULL)
+    return -1;
+  sema_down (&c->dead);
+  release_child (c);
+  return 0;
+}
+
+/* Terminates the current process with the given EXIT_CODE,
+   unless it is already exiting with another, and exits the
+   current thread.  Each other thread of the process exits the
+   next time it would return to user mode, including those asleep
+   on futexes, which are woken for the purpose.  A thread blocked
+   elsewhere in the kernel exits once it gets back. */
+void
+process_terminate (int exit_code)
+{
+  struct process *proc = thread_current ()->process;
+
+  ASSERT (proc != NULL);
+
+  lock_acquire (&proc->lock);
+  if (!proc->exiting)
+    {
+      proc->exiting = true;
+      proc->exit_code = exit_code;
+    }
+  lock_release (&proc->lock);
+
+  syscall_wake_futexes ();
+  thread_exit ();
+}
+
+/* Called on every return to user mode.  Exits the current thread
+   if its process is exiting. */
+void
+process_check_terminated (void)
+{
+  struct process *proc = thread_current ()->process;
+
+  if (proc != NULL && proc->exiting)
+    {
+      intr_enable ();
+      thread_exit ();
+    }
+}
+
+/* Stores in USAGE the resources used by the current process: by
+   its threads that have exited and by the calling thread.  Other
+   threads still running are counted once they exit. */
+void
+process_get_usage (struct thread_usage *usage)
+{
+  struct thread *cur = thread_current ();
+  struct process *proc = cur->process;
+
+  ASSERT (proc != NULL);
+
+  thread_charge_kernel ();
+  lock_acquire (&proc->lock);
+  *usage = proc->usage;
+  lock_release (&proc->lock);
+  add_usage (usage, &cur->usage);
+}
+
+/* Adds U into SUM. */
+static void
+add_usage (struct thread_usage *sum, const struct thread_usage *u)
+{
+  sum->user_cycles += u->user_cycles;
+  sum->kernel_cycles += u->kernel_cycles;
+  sum->faults += u->faults;
+  sum->sectors_read += u->sectors_read;
+  sum->sectors_written += u->sectors_written;
+}
+
+/* Prints USAGE, the resources used by process NAME. */
+static void
+print_usage (const char *name, const struct thread_usage *usage)
+{
+  printf ("%s: usage: %"PRId64" us user, %"PRId64" us kernel, "
+          "%u faults, %u sectors read, %u written\n", name,
+          timer_cycles_to_ns (usage->user_cycles) / 1000,
+          timer_cycles_to_ns (usage->kernel_cycles) / 1000,
+          usage->faults, usage->sectors_read, usage->sectors_written);
 }
 
 /* Sets up the CPU for running user code in the current
@@ -195,31 +1037,55 @@ struct Elf32_Phdr
 #define PF_W 2          /* Writable. */
 #define PF_R 4          /* Readable. */
 
-static bool setup_stack (void **esp);
+static bool parse_executable (struct file *, const char *file_name,
+                              struct exec_image *);
+static bool setup_stack (const struct exec_args *, void **esp);
 static bool validate_segment (const struct Elf32_Phdr *, struct file *);
 static bool load_segment (struct file *file, off_t ofs, uint8_t *upage,
                           uint32_t read_bytes, uint32_t zero_bytes,
                           bool writable);
+#ifdef VM
+static void setup_heap (const struct exec_image *);
+#endif
 
-/* Loads an ELF executable from FILE_NAME into the current thread.
-   Stores the executable's entry point into *EIP
-   and its initial stack pointer into *ESP.
+/* Loads the ELF executable described by ARGS into the current
+   thread, passing it ARGS's arguments.  Stores the executable's
+   entry point into *EIP and its initial stack pointer into *ESP.
    Returns true if successful, false otherwise. */
 bool
-load (const char *file_name, void (**eip) (void), void **esp) 
+load (const struct exec_args *args, void (**eip) (void), void **esp) 
 {
   struct thread *t = thread_current ();
-  struct Elf32_Ehdr ehdr;
+  char file_name[NAME_MAX + 2];
+  struct exec_image image;
   struct file *file = NULL;
-  off_t file_ofs;
+  struct inode *inode;
+  unsigned version;
   bool success = false;
-  int i;
+  size_t i;
+
+  /* Extract the program name.  A name too long for FILE_NAME is
+     too long to exist, so it is left truncated there, and the
+     open fails. */
+  if (args->file_name != NULL)
+    strlcpy (file_name, args->file_name, sizeof file_name);
+  else
+    {
+      strlcpy (file_name, args->args, sizeof file_name);
+      file_name[strcspn (file_name, " ")] = '\0';
+    }
 
   /* Allocate and activate page directory. */
   t->pagedir = pagedir_create ();
   if (t->pagedir == NULL) 
     goto done;
   process_activate ();
+#ifdef VM
+  if (!page_init ())
+    goto done;
+#endif
+  if (!infopage_map (t->pagedir, t->tid))
+    goto done;
 
   /* Open executable file. */
   file = filesys_open (file_name);
@@ -229,7 +1095,71 @@ load (const char *file_name, void (**eip) (void), void **esp)
       goto done; 
     }
 
+  /* Parse the headers, unless this version of the file has been
+     parsed before.  The version must be read first, in case the
+     file is written while we parse it. */
+  inode = file_get_inode (file);
+  version = inode_get_version (inode);
+  if (!exec_cache_lookup (inode, &image))
+    {
+      if (!parse_executable (file, file_name, &image))
+        goto done;
+      exec_cache_insert (inode, version, &image);
+    }
+
+  /* Map the segments. */
+  for (i = 0; i < image.segment_cnt; i++)
+    {
+      const struct exec_segment *s = &image.segments[i];
+      if (!load_segment (file, s->file_page, (void *) s->mem_page,
+                         s->read_bytes, s->zero_bytes, s->writable))
+        goto done;
+    }
+#ifdef VM
+  setup_heap (&image);
+#endif
+
+  /* Set up stack. */
+  if (!setup_stack (args, esp))
+    goto done;
+
+  /* Start address. */
+  *eip = (void (*) (void)) image.entry;
+
+  success = true;
+
+ done:
+  /* We arrive here whether the load is successful or not.  On
+     success, the file stays open until the process exits, so
+     that pages can be loaded from it on demand, and may not be
+     written in the meantime. */
+  if (success)
+    {
+      file_deny_write (file);
+      t->process->executable = file;
+    }
+  else
+    file_close (file);
+  return success;
+}
+
+/* load() helpers. */
+
+/* Reads and checks the ELF header and program headers of FILE,
+   named FILE_NAME, and stores the entry point and loadable
+   segments that they describe in *IMAGE.  Returns true if
+   successful, false if FILE is not an executable that can be
+   loaded. */
+static bool
+parse_executable (struct file *file, const char *file_name,
+                  struct exec_image *image)
+{
+  struct Elf32_Ehdr ehdr;
+  off_t file_ofs;
+  int i;
+
   /* Read and verify executable header. */
+  file_seek (file, 0);
   if (file_read (file, &ehdr, sizeof ehdr) != sizeof ehdr
       || memcmp (ehdr.e_ident, "\177ELF\1\1\1", 7)
       || ehdr.e_type != 2
@@ -239,21 +1169,25 @@ load (const char *file_name, void (**eip) (void), void **esp)
       || ehdr.e_phnum > 1024) 
     {
       printf ("load: %s: error loading executable\n", file_name);
-      goto done; 
+      return false;
     }
+  image->entry = ehdr.e_entry;
+  image->segment_cnt = 0;
 
   /* Read program headers. */
   file_ofs = ehdr.e_phoff;
   for (i = 0; i < ehdr.e_phnum; i++) 
     {
       struct Elf32_Phdr phdr;
+      struct exec_segment *s;
+      uint32_t page_offset;
 
       if (file_ofs < 0 || file_ofs > file_length (file))
-        goto done;
+        return false;
       file_seek (file, file_ofs);
 
       if (file_read (file, &phdr, sizeof phdr) != sizeof phdr)
-        goto done;
+        return false;
       file_ofs += sizeof phdr;
       switch (phdr.p_type) 
         {
@@ -267,58 +1201,40 @@ load (const char *file_name, void (**eip) (void), void **esp)
         case PT_DYNAMIC:
         case PT_INTERP:
         case PT_SHLIB:
-          goto done;
+          return false;
         case PT_LOAD:
-          if (validate_segment (&phdr, file)) 
+          if (!validate_segment (&phdr, file)
+              || image->segment_cnt >= EXEC_SEGMENTS_MAX)
+            return false;
+          s = &image->segments[image->segment_cnt++];
+          s->writable = (phdr.p_flags & PF_W) != 0;
+          s->file_page = phdr.p_offset & ~PGMASK;
+          s->mem_page = phdr.p_vaddr & ~PGMASK;
+          page_offset = phdr.p_vaddr & PGMASK;
+          if (phdr.p_filesz > 0)
+            {
+              /* Normal segment.
+                 Read initial part from disk and zero the rest. */
+              s->read_bytes = page_offset + phdr.p_filesz;
+              s->zero_bytes = (ROUND_UP (page_offset + phdr.p_memsz, PGSIZE)
+                               - s->read_bytes);
+            }
+          else 
             {
-              bool writable = (phdr.p_flags & PF_W) != 0;
-              uint32_t file_page = phdr.p_offset & ~PGMASK;
-              uint32_t mem_page = phdr.p_vaddr & ~PGMASK;
-              uint32_t page_offset = phdr.p_vaddr & PGMASK;
-              uint32_t read_bytes, zero_bytes;
-              if (phdr.p_filesz > 0)
-                {
-                  /* Normal segment.
-                     Read initial part from disk and zero the rest. */
-                  read_bytes = page_offset + phdr.p_filesz;
-                  zero_bytes = (ROUND_UP (page_offset + phdr.p_memsz, PGSIZE)
-                                - read_bytes);
-                }
-              else 
-                {
-                  /* Entirely zero.
-                     Don't read anything from disk. */
-                  read_bytes = 0;
-                  zero_bytes = ROUND_UP (page_offset + phdr.p_memsz, PGSIZE);
-                }
-              if (!load_segment (file, file_page, (void *) mem_page,
-                                 read_bytes, zero_bytes, writable))
-                goto done;
+              /* Entirely zero.
+                 Don't read anything from disk. */
+              s->read_bytes = 0;
+              s->zero_bytes = ROUND_UP (page_offset + phdr.p_memsz, PGSIZE);
             }
-          else
-            goto done;
           break;
         }
     }
-
-  /* Set up stack. */
-  if (!setup_stack (esp))
-    goto done;
-
-  /* Start address. */
-  *eip = (void (*) (void)) ehdr.e_entry;
-
-  success = true;
-
- done:
-  /* We arrive here whether the load is successful or not. */
-  file_close (file);
-  return success;
+  return true;
 }
-
-/* load() helpers. */
 
+#ifndef VM
 static bool install_page (void *upage, void *kpage, bool writable);
+#endif
 
 /* Checks whether PHDR describes a valid, loadable segment in
    FILE and returns true if so, false otherwise. */
@@ -387,7 +1303,9 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
   ASSERT (pg_ofs (upage) == 0);
   ASSERT (ofs % PGSIZE == 0);
 
+#ifndef VM
   file_seek (file, ofs);
+#endif
   while (read_bytes > 0 || zero_bytes > 0) 
     {
       /* Calculate how to fill this page.
@@ -396,6 +1314,21 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
       size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
       size_t page_zero_bytes = PGSIZE - page_read_bytes;
 
+#ifdef VM
+      /* Record where the page comes from.  It is read in when
+         the process first touches it. */
+      struct page *p = page_allocate (upage, writable);
+      if (p == NULL)
+        return false;
+      if (page_read_bytes > 0)
+        {
+          p->file = file;
+          p->file_offset = ofs;
+          p->file_bytes = page_read_bytes;
+        }
+      ofs += page_read_bytes;
+#else
+
       /* Get a page of memory. */
       uint8_t *kpage = palloc_get_page (PAL_USER);
       if (kpage == NULL)
@@ -415,6 +1348,7 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
           palloc_free_page (kpage);
           return false; 
         }
+#endif
 
       /* Advance. */
       read_bytes -= page_read_bytes;
@@ -424,26 +1358,112 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
   return true;
 }
 
+/* Lays out the initial stack of a process in KPAGE, the page
+   that will be mapped at the top of user virtual memory, in one
+   pass over the arguments in ARGS: the argument strings at the
+   top of the page, then the argv[] array that points to them,
+   then argv, argc, and a null return address.  Sets *ESP to the
+   user address of the return address.  Returns false if the
+   arguments do not fit in the page. */
+static bool
+push_args (uint8_t *kpage, const struct exec_args *args, void **esp)
+{
+  /* User address corresponding to kernel address K in KPAGE. */
+#define UADDR(K) ((uint8_t *) PHYS_BASE - PGSIZE + ((uint8_t *) (K) - kpage))
+  size_t len = args->args_len;
+  char *strings, *token, *save_ptr;
+  char **argv, **lo, **hi;
+  uint32_t *sp;
+  int argc = 0;
+
+  /* Copy the arguments to the top of the page, splitting a
+     command line in place.  Each argument's user address is
+     pushed below the strings as it is found, so argv[] comes out
+     in reverse. */
+  if (len + 4 * sizeof (char *) > PGSIZE)
+    return false;
+  strings = (char *) kpage + PGSIZE - len;
+  memcpy (strings, args->args, len);
+  argv = (char **) ROUND_DOWN ((uintptr_t) strings, sizeof (char *));
+  *--argv = NULL;
+  if (args->file_name == NULL)
+    token = strtok_r (strings, " ", &save_ptr);
+  else
+    token = len > 0 ? strings : NULL;
+  while (token != NULL)
+    {
+      /* Leave room for the words of argv, argc, and the return
+         address below argv[]. */
+      if ((uint8_t *) (argv - 4) < kpage)
+        return false;
+      *--argv = (char *) UADDR (token);
+      argc++;
+
+      if (args->file_name == NULL)
+        token = strtok_r (NULL, " ", &save_ptr);
+      else
+        {
+          token += strlen (token) + 1;
+          if (token >= strings + len)
+            token = NULL;
+        }
+    }
+
+  /* Put argv[] in order, without moving its null terminator. */
+  for (lo = argv, hi = argv + argc - 1; lo < hi; lo++, hi--)
+    {
+      char *tmp = *lo;
+      *lo = *hi;
+      *hi = tmp;
+    }
+
+  /* Push argv, argc, and a fake return address. */
+  sp = (uint32_t *) argv;
+  *--sp = (uint32_t) UADDR (argv);
+  *--sp = argc;
+  *--sp = 0;
+  *esp = UADDR (sp);
+  return true;
+#undef UADDR
+}
+
 /* Create a minimal stack by mapping a zeroed page at the top of
-   user virtual memory. */
+   user virtual memory, holding the arguments in ARGS. */
 static bool
-setup_stack (void **esp) 
+setup_stack (const struct exec_args *args, void **esp) 
 {
+#ifdef VM
+  uint8_t *upage = ((uint8_t *) PHYS_BASE) - PGSIZE;
+  bool success;
+
+  if (page_allocate (upage, true) == NULL || !page_lock (upage, true))
+    return false;
+
+  /* The arguments are written through the kernel's mapping of the
+     frame, so mark the page dirty by hand to keep them from being
+     discarded on eviction. */
+  success = push_args (page_frame_base (upage), args, esp);
+  pagedir_set_dirty (thread_current ()->pagedir, upage, true);
+  page_unlock (upage);
+  return success;
+#else
   uint8_t *kpage;
   bool success = false;
 
   kpage = palloc_get_page (PAL_USER | PAL_ZERO);
   if (kpage != NULL) 
     {
-      success = install_page (((uint8_t *) PHYS_BASE) - PGSIZE, kpage, true);
-      if (success)
-        *esp = PHYS_BASE;
-      else
+      success = (push_args (kpage, args, esp)
+                 && install_page (((uint8_t *) PHYS_BASE) - PGSIZE, kpage,
+                                  true));
+      if (!success)
         palloc_free_page (kpage);
     }
   return success;
+#endif
 }
 
+#ifndef VM
 /* Adds a mapping from user virtual address UPAGE to kernel
    virtual address KPAGE to the page table.
    If WRITABLE is true, the user process may modify the page;
@@ -463,3 +1483,145 @@ install_page (void *upage, void *kpage, bool writable)
   return (pagedir_get_page (t->pagedir, upage) == NULL
           && pagedir_set_page (t->pagedir, upage, kpage, writable));
 }
+#endif
+
+#ifdef VM
+/* Sets up the current process's heap, which sbrk() grows, to
+   start empty just past the highest of IMAGE's segments and to
+   stop below a guard page under the lowest thread stack slot. */
+static void
+setup_heap (const struct exec_image *image)
+{
+  struct process *proc = thread_current ()->process;
+  size_t user_pages = (uintptr_t) PHYS_BASE >> PGBITS;
+  size_t stack_pages = (stack_page_limit + 1 + (PROCESS_THREAD_MAX - 1)
+                        * (THREAD_STACK_PAGES + 1));
+  uintptr_t end = 0;
+  size_t i;
+
+  for (i = 0; i < image->segment_cnt; i++)
+    {
+      const struct exec_segment *s = &image->segments[i];
+      uintptr_t seg_end = s->mem_page + s->read_bytes + s->zero_bytes;
+      if (seg_end > end)
+        end = seg_end;
+    }
+  proc->heap_start = proc->heap_break = (uint8_t *) end;
+  proc->heap_limit = (stack_pages < user_pages
+                      ? (uint8_t *) PHYS_BASE - stack_pages * PGSIZE
+                      : NULL);
+  if (proc->heap_limit < proc->heap_start)
+    proc->heap_limit = proc->heap_start;
+}
+#endif
+
+/* Returns the user address just above the stack in SLOT, or a
+   null pointer if the slot would not fit in user memory. */
+static uint8_t *
+stack_slot_top (int slot)
+{
+#ifdef VM
+  size_t first_pages = stack_page_limit;
+#else
+  size_t first_pages = 1;
+#endif
+  size_t pages = first_pages + (slot + 1) * (THREAD_STACK_PAGES + 1);
+
+  if (pages >= ((uintptr_t) PHYS_BASE >> PGBITS) - 1)
+    return NULL;
+  return (uint8_t *) PHYS_BASE - (pages - THREAD_STACK_PAGES) * PGSIZE;
+}
+
+/* Sets up a stack for a new thread of the current process in
+   SLOT, pushing AUX, FUNC, and a null return address, and stores
+   the initial stack pointer in *ESP.  Returns true if successful,
+   false if memory is exhausted or some of the stack's pages are
+   already in use. */
+static bool
+setup_thread_stack (int slot, void **esp, void *func, void *aux)
+{
+  uint8_t *top = stack_slot_top (slot);
+  uint8_t *upage;
+  uint32_t *sp;
+
+  if (top == NULL)
+    return false;
+  upage = top - PGSIZE;
+
+#ifdef VM
+  {
+    size_t i;
+
+    for (i = 1; i <= THREAD_STACK_PAGES; i++)
+      if (page_allocate (top - i * PGSIZE, true) == NULL)
+        {
+          while (--i > 0)
+            page_deallocate (top - i * PGSIZE);
+          return false;
+        }
+    if (!page_lock (upage, true))
+      {
+        free_thread_stack (slot);
+        return false;
+      }
+    sp = (uint32_t *) ((uint8_t *) page_frame_base (upage) + PGSIZE);
+    *--sp = (uint32_t) aux;
+    *--sp = (uint32_t) func;
+    *--sp = 0;
+    pagedir_set_dirty (thread_current ()->pagedir, upage, true);
+    page_unlock (upage);
+  }
+#else
+  {
+    struct process *proc = thread_current ()->process;
+    uint8_t *kpage = palloc_get_page (PAL_USER | PAL_ZERO);
+    bool success;
+
+    if (kpage == NULL)
+      return false;
+    sp = (uint32_t *) (kpage + PGSIZE);
+    *--sp = (uint32_t) aux;
+    *--sp = (uint32_t) func;
+    *--sp = 0;
+
+    /* Every thread of the process maps pages into the same page
+       directory. */
+    lock_acquire (&proc->lock);
+    success = install_page (upage, kpage, true);
+    lock_release (&proc->lock);
+    if (!success)
+      {
+        palloc_free_page (kpage);
+        return false;
+      }
+  }
+#endif
+
+  *esp = top - 3 * sizeof (uint32_t);
+  return true;
+}
+
+/* Frees the stack in SLOT, set up by setup_thread_stack(). */
+static void
+free_thread_stack (int slot)
+{
+  struct process *proc = thread_current ()->process;
+  uint8_t *top = stack_slot_top (slot);
+
+#ifdef VM
+  size_t i;
+
+  for (i = 1; i <= THREAD_STACK_PAGES; i++)
+    page_deallocate (top - i * PGSIZE);
+#else
+  uint32_t *pd = thread_current ()->pagedir;
+  void *kpage = pagedir_get_page (pd, top - PGSIZE);
+
+  pagedir_clear_page (pd, top - PGSIZE);
+  palloc_free_page (kpage);
+#endif
+
+  lock_acquire (&proc->lock);
+  proc->stack_map &= ~(1u << slot);
+  lock_release (&proc->lock);
+}
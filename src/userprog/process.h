@@ -1,11 +1,81 @@
 #ifndef USERPROG_PROCESS_H
 #define USERPROG_PROCESS_H
 
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "threads/synch.h"
 #include "threads/thread.h"
 
+struct descriptor;
+struct fd_action;
+struct intr_frame;
+
+/* Most threads a user process may have, counting the first. */
+#define PROCESS_THREAD_MAX 32
+
+/* State shared by the threads of a user process.  The threads
+   also share a page directory and, with virtual memory, a
+   supplemental page table, each of which they point to directly.
+   The last of its threads to exit leaves the process, with its
+   address space, to the reaper (see process.c) to free. */
+struct process
+  {
+    /* Owned by userprog/process.c. */
+    struct lock lock;           /* Protects the members below. */
+    int thread_cnt;             /* Number of threads not yet exited. */
+    uint32_t stack_map;         /* User stack slots in use. */
+    bool exiting;               /* Has exit() been called? */
+    int exit_code;              /* Exit code, once EXITING. */
+    struct child *child;        /* Status shared with our parent, or null. */
+    struct list threads;        /* Status of our joinable threads. */
+    struct file *executable;    /* Program file, kept open while running. */
+    struct thread_usage usage;  /* Used by threads that have exited. */
+    bool strace;                /* Log system calls to the kernel log? */
+    struct list_elem reap_elem; /* Element in the reaper's list. */
+    uint32_t *pagedir;          /* Page directory left to the reaper. */
+#ifdef VM
+    struct page_table *pages;   /* Page table left to the reaper. */
+#endif
+
+    /* Owned by userprog/syscall.c. */
+    struct lock fd_lock;        /* Protects the members below. */
+    struct descriptor *fds;     /* Open descriptors, indexed by number. */
+    size_t fd_cnt;              /* Number of slots in FDS. */
+    struct bitmap *fd_map;      /* Descriptors in use. */
+    struct list aios;           /* Asynchronous transfers not reaped. */
+    int next_aio_id;            /* Id for the next transfer. */
+#ifdef VM
+    struct list mappings;       /* Memory-mapped files. */
+    int next_mapid;             /* Id for the next mapping. */
+    uint8_t *heap_start;        /* Start of the heap, page-aligned. */
+    uint8_t *heap_break;        /* End of the heap, moved by sbrk(). */
+    uint8_t *heap_limit;        /* Highest HEAP_BREAK may go. */
+#endif
+  };
+
+/* Print each process's resource usage when it exits? */
+extern bool process_print_usage;
+
+/* Name of the program whose processes log their system calls,
+   "all" for every program, or a null pointer. */
+extern const char *process_strace;
+
 tid_t process_execute (const char *file_name);
+tid_t process_spawn (const char *file_name, const char *args, size_t args_len,
+                     const struct fd_action *actions, size_t action_cnt);
+tid_t process_fork (const struct intr_frame *);
 int process_wait (tid_t);
 void process_exit (void);
 void process_activate (void);
+void process_start (void);
+void process_reap (void);
+
+tid_t process_thread_create (void (*entry) (void), void *func, void *aux);
+int process_thread_join (tid_t);
+void process_terminate (int exit_code) NO_RETURN;
+void process_check_terminated (void);
+void process_get_usage (struct thread_usage *);
 
 #endif /* userprog/process.h */
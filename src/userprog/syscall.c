@@ -1,20 +1,2873 @@
 #include "userprog/syscall.h"
+#include <bitmap.h>
+#include <hash.h>
+#include <limits.h>
+#include <round.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include <syscall-nr.h>
+#include "devices/input.h"
+#include "devices/shutdown.h"
+#include "devices/timer.h"
+#include "filesys/directory.h"
+#include "filesys/file.h"
+#include "filesys/filesys.h"
+#include "filesys/inode.h"
+#include "threads/cpu.h"
 #include "threads/interrupt.h"
+#include "threads/klog.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/poll.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "threads/workqueue.h"
+#include "userprog/pipe.h"
+#include "userprog/process.h"
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/page.h"
+#include "vm/shm.h"
+#endif
+
+/* A system call handler.  Each handler is declared with the
+   argument types it actually takes and called through this type
+   with up to four 32-bit arguments read from the user stack. */
+typedef int syscall_function (int, int, int, int);
+
+/* A system call. */
+struct syscall
+  {
+    size_t arg_cnt;             /* Number of arguments. */
+    syscall_function *func;     /* Implementation. */
+  };
+
+/* File descriptor table.
+
+   Each process's open descriptors are kept in an array indexed
+   by file descriptor, with a bitmap of the descriptors in use,
+   so that looking up a descriptor takes constant time and the
+   lowest free one is found by a bitmap scan.  A descriptor
+   refers to the console, an open file, or one end of a pipe.
+   Descriptors 0 and 1 start out as the console's input and
+   output, which a new process inherits from its parent, along
+   with any redirection the parent made with dup2().  The table
+   is created on the first open, or the first change to 0 or 1,
+   and doubles in size when full.
+
+   The table belongs to the process, so its threads share it.
+   The process's FD_LOCK is held from looking a descriptor up to
+   the end of the operation on it, so that another thread cannot
+   close the file in the meantime.  Reading the keyboard or a
+   pipe may block for as long as it takes another process to
+   act, so those release FD_LOCK first, holding a reference to a
+   pipe instead. */
+
+/* Initial number of slots in a file descriptor table. */
+#define FD_TABLE_MIN 16
+
+/* dup2() may create descriptors below this number. */
+#define FD_DUP_MAX 1024
+
+/* What a file descriptor refers to. */
+enum fd_type
+  {
+    FD_CONSOLE_IN,              /* Keyboard, for reading. */
+    FD_CONSOLE_OUT,             /* Console, for writing. */
+    FD_FILE,                    /* Open file. */
+    FD_PIPE_READ,               /* Read end of a pipe. */
+    FD_PIPE_WRITE,              /* Write end of a pipe. */
+    FD_DIR                      /* Open directory. */
+  };
+
+/* An open file descriptor. */
+struct descriptor
+  {
+    enum fd_type type;          /* Kind of descriptor. */
+    struct file *file;          /* FD_FILE: the file. */
+    struct pipe *pipe;          /* FD_PIPE_*: the pipe. */
+    struct dir *dir;            /* FD_DIR: the directory. */
+  };
+
+/* Descriptors 0 and 1 of a process without a table. */
+static struct descriptor console_in = {FD_CONSOLE_IN, NULL, NULL, NULL};
+static struct descriptor console_out = {FD_CONSOLE_OUT, NULL, NULL, NULL};
+
+#ifdef VM
+/* A memory-mapped file or an attached shared memory segment.  A
+   file mapping has its own handle on the file, so that closing
+   the descriptor it was made from leaves it in place. */
+struct mapping
+  {
+    struct list_elem elem;      /* Element in process's MAPPINGS. */
+    int handle;                 /* Mapping id. */
+    struct file *file;          /* File, or null for a segment. */
+    struct shm *shm;            /* Segment, or null for a file. */
+    uint8_t *base;              /* Start of memory mapping. */
+    size_t page_cnt;            /* Number of pages mapped. */
+  };
+
+static void unmap (struct mapping *);
+#endif
+
+/* Futexes.
+
+   A futex lets user threads sleep on an ordinary int in their
+   own memory, so that a user-space lock or condition needs the
+   kernel only when a thread must actually wait.  A futex exists
+   in the kernel only while some thread waits on it: it is
+   created by the first waiter and freed by the last one to
+   leave.  It is identified by the page directory and user
+   address of its word, and found through a fixed table of
+   hashed buckets, each with a lock.  Checking the word and
+   going to sleep both happen under the bucket's lock, which
+   every waker takes, so a wakeup cannot be lost in between.
+   Waiters are kept on a condition variable, so they are woken
+   highest priority first, with priority donation no different
+   from any other kernel wait. */
+
+/* Number of buckets in the futex table. */
+#define FUTEX_BUCKET_CNT 64
+
+/* A futex with waiters. */
+struct futex
+  {
+    struct list_elem elem;      /* Element in futex_bucket's FUTEXES. */
+    uint32_t *pagedir;          /* Address space of UADDR. */
+    const int *uaddr;           /* User address of the futex word. */
+    struct condition waiters;   /* Waiting threads. */
+    int waiter_cnt;             /* # of WAITERS not yet woken. */
+    int user_cnt;               /* # of threads in sys_futex_wait(). */
+  };
+
+/* A bucket of futexes whose keys hash alike. */
+struct futex_bucket
+  {
+    struct lock lock;           /* Protects FUTEXES and their members. */
+    struct list futexes;        /* Futexes with waiters. */
+  };
+
+static struct futex_bucket futex_buckets[FUTEX_BUCKET_CNT];
 
 static void syscall_handler (struct intr_frame *);
+static int syscall_dispatch (void *user_esp, const uint32_t *args);
+
+static int sys_halt (void) NO_RETURN;
+static int sys_exit (int status) NO_RETURN;
+static int sys_exec (const char *ucmd_line);
+static int sys_wait (tid_t child);
+static int sys_create (const char *ufile, unsigned initial_size);
+static int sys_remove (const char *ufile);
+static int sys_open (const char *ufile);
+static int sys_filesize (int handle);
+static int sys_read (int handle, void *udst, unsigned size);
+static int sys_write (int handle, const void *usrc, unsigned size);
+static int sys_seek (int handle, unsigned position);
+static int sys_tell (int handle);
+static int sys_close (int handle);
+static int sys_mmap (int handle, void *addr);
+static int sys_munmap (int mapping);
+static int sys_chdir (const char *udir);
+static int sys_mkdir (const char *udir);
+static int sys_readdir (int handle, char *uname);
+static int sys_isdir (int handle);
+static int sys_inumber (int handle);
+static int sys_readv (int handle, const void *uiov, int iov_cnt);
+static int sys_writev (int handle, const void *uiov, int iov_cnt);
+static int sys_batch (void *uops, int op_cnt);
+static int sys_faultstat (void *ustats);
+static int sys_clock (void *uns);
+static int sys_futex_wait (const int *uaddr, int expected);
+static int sys_futex_wake (const int *uaddr, int cnt);
+static int sys_thread_create (void (*entry) (void), void *func, void *aux);
+static int sys_thread_join (tid_t tid);
+static int sys_thread_exit (void) NO_RETURN;
+static int sys_pipe (int *ufds);
+static int sys_dup (int handle);
+static int sys_dup2 (int handle, int new_handle);
+static int sys_fork (void);
+static int sys_spawn (const char *ufile, char *const *uargv,
+                      const void *uactions);
+static int sys_copy (int src_handle, int dst_handle, unsigned size);
+static int sys_getdents (int handle, void *uents, int cnt);
+static int sys_stat (const char *ufile, void *ust);
+static int sys_pread (int handle, void *udst, unsigned size, unsigned ofs);
+static int sys_pwrite (int handle, const void *usrc, unsigned size,
+                       unsigned ofs);
+static int sys_fallocate (int handle, unsigned ofs, unsigned size);
+static int sys_fsync (int handle);
+static int sys_sync (void);
+static int sys_madvise (void *addr, unsigned size, int advice);
+static int sys_shm_create (const char *uname, unsigned size, void *addr);
+static int sys_shm_attach (const char *uname, void *addr);
+static void *sys_sbrk (int increment);
+static bool sys_setpriority (int priority);
+static int sys_getpriority (void);
+static int sys_nice (int increment);
+static int sys_getrusage (int who, void *uusage);
+static int sys_aio_submit (const void *ucb);
+static int sys_aio_wait (int id);
+static int sys_aio_poll (int id);
+static void aio_exit (void);
+static int sys_poll (void *ufds, unsigned nfds, int timeout);
+
+/* Entry for system call NUMBER in syscall_table, implemented by
+   FUNC with ARG_CNT arguments.  The cast through a function type
+   without a prototype tells the compiler that the differing
+   signatures are intended. */
+#define SYSCALL(NUMBER, ARG_CNT, FUNC) \
+  [NUMBER] = {ARG_CNT, (syscall_function *) (void (*) (void)) FUNC}
+
+/* System call table, indexed by system call number. */
+static const struct syscall syscall_table[] =
+  {
+    SYSCALL (SYS_HALT, 0, sys_halt),
+    SYSCALL (SYS_EXIT, 1, sys_exit),
+    SYSCALL (SYS_EXEC, 1, sys_exec),
+    SYSCALL (SYS_WAIT, 1, sys_wait),
+    SYSCALL (SYS_CREATE, 2, sys_create),
+    SYSCALL (SYS_REMOVE, 1, sys_remove),
+    SYSCALL (SYS_OPEN, 1, sys_open),
+    SYSCALL (SYS_FILESIZE, 1, sys_filesize),
+    SYSCALL (SYS_READ, 3, sys_read),
+    SYSCALL (SYS_WRITE, 3, sys_write),
+    SYSCALL (SYS_SEEK, 2, sys_seek),
+    SYSCALL (SYS_TELL, 1, sys_tell),
+    SYSCALL (SYS_CLOSE, 1, sys_close),
+    SYSCALL (SYS_MMAP, 2, sys_mmap),
+    SYSCALL (SYS_MUNMAP, 1, sys_munmap),
+    SYSCALL (SYS_CHDIR, 1, sys_chdir),
+    SYSCALL (SYS_MKDIR, 1, sys_mkdir),
+    SYSCALL (SYS_READDIR, 2, sys_readdir),
+    SYSCALL (SYS_ISDIR, 1, sys_isdir),
+    SYSCALL (SYS_INUMBER, 1, sys_inumber),
+    SYSCALL (SYS_READV, 3, sys_readv),
+    SYSCALL (SYS_WRITEV, 3, sys_writev),
+    SYSCALL (SYS_BATCH, 2, sys_batch),
+    SYSCALL (SYS_FAULTSTAT, 1, sys_faultstat),
+    SYSCALL (SYS_CLOCK, 1, sys_clock),
+    SYSCALL (SYS_FUTEX_WAIT, 2, sys_futex_wait),
+    SYSCALL (SYS_FUTEX_WAKE, 2, sys_futex_wake),
+    SYSCALL (SYS_THREAD_CREATE, 3, sys_thread_create),
+    SYSCALL (SYS_THREAD_JOIN, 1, sys_thread_join),
+    SYSCALL (SYS_THREAD_EXIT, 0, sys_thread_exit),
+    SYSCALL (SYS_PIPE, 1, sys_pipe),
+    SYSCALL (SYS_DUP, 1, sys_dup),
+    SYSCALL (SYS_DUP2, 2, sys_dup2),
+    SYSCALL (SYS_FORK, 0, sys_fork),
+    SYSCALL (SYS_SPAWN, 3, sys_spawn),
+    SYSCALL (SYS_COPY, 3, sys_copy),
+    SYSCALL (SYS_GETDENTS, 3, sys_getdents),
+    SYSCALL (SYS_STAT, 2, sys_stat),
+    SYSCALL (SYS_PREAD, 4, sys_pread),
+    SYSCALL (SYS_PWRITE, 4, sys_pwrite),
+    SYSCALL (SYS_FALLOCATE, 3, sys_fallocate),
+    SYSCALL (SYS_FSYNC, 1, sys_fsync),
+    SYSCALL (SYS_SYNC, 0, sys_sync),
+    SYSCALL (SYS_MADVISE, 3, sys_madvise),
+    SYSCALL (SYS_SHM_CREATE, 3, sys_shm_create),
+    SYSCALL (SYS_SHM_ATTACH, 2, sys_shm_attach),
+    SYSCALL (SYS_SHM_DETACH, 1, sys_munmap),
+    SYSCALL (SYS_SBRK, 1, sys_sbrk),
+    SYSCALL (SYS_SETPRIORITY, 1, sys_setpriority),
+    SYSCALL (SYS_GETPRIORITY, 0, sys_getpriority),
+    SYSCALL (SYS_NICE, 1, sys_nice),
+    SYSCALL (SYS_GETRUSAGE, 2, sys_getrusage),
+    SYSCALL (SYS_AIO_SUBMIT, 1, sys_aio_submit),
+    SYSCALL (SYS_AIO_WAIT, 1, sys_aio_wait),
+    SYSCALL (SYS_AIO_POLL, 1, sys_aio_poll),
+    SYSCALL (SYS_POLL, 3, sys_poll),
+  };
 
 void
-syscall_init (void) 
+syscall_init (void)
 {
+  size_t i;
+
+  for (i = 0; i < FUTEX_BUCKET_CNT; i++)
+    {
+      lock_init (&futex_buckets[i].lock);
+      list_init (&futex_buckets[i].futexes);
+    }
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
 }
 
+static bool grow_fd_table (size_t min_cnt);
+static bool dup_descriptor (struct descriptor *, const struct descriptor *);
+static void close_descriptor (struct descriptor *);
+static struct descriptor *find_fd (struct process *, int handle);
+static bool dup_to_fd (int handle, const struct descriptor *);
+
+/* Waits for the current process's asynchronous transfers,
+   unmaps every file it has mapped, closes every descriptor it
+   has open, and frees its file descriptor table.  Called by the
+   last thread of the process to exit. */
+void
+syscall_exit (void)
+{
+  struct process *proc = thread_current ()->process;
+  size_t fd;
+
+  aio_exit ();
+#ifdef VM
+  while (!list_empty (&proc->mappings))
+    unmap (list_entry (list_front (&proc->mappings),
+                       struct mapping, elem));
+#endif
+
+  if (proc->fds == NULL)
+    return;
+  for (fd = 0; fd < proc->fd_cnt; fd++)
+    if (bitmap_test (proc->fd_map, fd))
+      close_descriptor (&proc->fds[fd]);
+  free (proc->fds);
+  bitmap_destroy (proc->fd_map);
+  proc->fds = NULL;
+  proc->fd_map = NULL;
+  proc->fd_cnt = 0;
+}
+
+/* Gives the current process, which is starting up and has no
+   descriptors of its own yet, copies of PARENT's descriptors
+   below CNT.  Does nothing if PARENT has not changed its
+   descriptors from the defaults.  Returns true if successful,
+   false if memory is exhausted. */
+static bool
+copy_fds (struct process *parent, size_t cnt)
+{
+  struct process *cur = thread_current ()->process;
+  bool success = true;
+  size_t fd;
+
+  lock_acquire (&parent->fd_lock);
+  if (parent->fds != NULL)
+    {
+      if (cnt > parent->fd_cnt)
+        cnt = parent->fd_cnt;
+      lock_acquire (&cur->fd_lock);
+      success = grow_fd_table (cnt);
+      for (fd = 0; success && fd < cnt; fd++)
+        {
+          bitmap_reset (cur->fd_map, fd);
+          if (bitmap_test (parent->fd_map, fd))
+            {
+              success = dup_descriptor (&cur->fds[fd], &parent->fds[fd]);
+              bitmap_set (cur->fd_map, fd, success);
+            }
+        }
+      lock_release (&cur->fd_lock);
+    }
+  lock_release (&parent->fd_lock);
+  return success;
+}
+
+/* Carries out action A on the descriptors of the current
+   process, which is being started by PARENT.  Both processes'
+   descriptor tables must be locked.  Returns true if
+   successful, false if A names a descriptor that is not open or
+   memory is exhausted. */
+static bool
+do_fd_action (struct process *parent, const struct fd_action *a)
+{
+  struct process *cur = thread_current ()->process;
+  const struct descriptor *src;
+
+  if (!a->close)
+    {
+      src = find_fd (parent, a->fd);
+      return src != NULL && dup_to_fd (a->new_fd, src);
+    }
+  if (find_fd (cur, a->fd) == NULL
+      || (cur->fds == NULL && !grow_fd_table (0)))
+    return false;
+  close_descriptor (&cur->fds[a->fd]);
+  bitmap_reset (cur->fd_map, a->fd);
+  return true;
+}
+
+/* Gives the current process, which is starting up, copies of
+   descriptors 0 and 1 of PARENT, so that a parent may redirect
+   its child's input and output, and then carries out the
+   ACTION_CNT ACTIONS on its descriptors, in order.  Does only
+   the latter if PARENT is null, in which case there may be no
+   actions.  Returns true if successful, false if memory is
+   exhausted or an action fails. */
+bool
+syscall_inherit_fds (struct process *parent,
+                     const struct fd_action *actions, size_t action_cnt)
+{
+  struct process *cur = thread_current ()->process;
+  bool success = true;
+  size_t i;
+
+  ASSERT (parent != NULL || action_cnt == 0);
+
+  if (parent == NULL)
+    return true;
+  if (!copy_fds (parent, STDOUT_FILENO + 1))
+    return false;
+  if (action_cnt == 0)
+    return true;
+
+  lock_acquire (&parent->fd_lock);
+  lock_acquire (&cur->fd_lock);
+  for (i = 0; success && i < action_cnt; i++)
+    success = do_fd_action (parent, &actions[i]);
+  lock_release (&cur->fd_lock);
+  lock_release (&parent->fd_lock);
+  return success;
+}
+
+/* Gives the current process, which is starting up as a copy of
+   PARENT, copies of all of PARENT's descriptors.  Returns true if
+   successful, false if memory is exhausted. */
+bool
+syscall_fork_fds (struct process *parent)
+{
+  return copy_fds (parent, SIZE_MAX);
+}
+
+static void copy_in (void *, const void *, size_t);
+static int copy_in_string_to (char *, const char *, size_t);
+static int trace_syscall (unsigned call_nr, const struct syscall *,
+                          const int argv[]);
+
+/* System call handler for int $0x30. */
+static void
+syscall_handler (struct intr_frame *f)
+{
+  struct thread *cur = thread_current ();
+
+  cur->syscall_frame = f;
+  f->eax = syscall_dispatch (f->esp, f->esp);
+  cur->syscall_frame = NULL;
+}
+
+/* System call handler for SYSENTER, called by sysenter_entry
+   in sysenter-entry.S with interrupts on.  USER_ESP is the user
+   stack pointer, which points to a return address (see
+   lib/user/syscall-entry.S), above which lie the system call
+   number and arguments, as for int $0x30.  Returns the system
+   call's return value. */
+int
+syscall_sysenter (void *user_esp)
+{
+  bool locked;
+  int retval;
+
+  /* intr_handler() does the same for int $0x30, including on the
+     way out. */
+  locked = kernel_lock_enter ();
+  thread_charge_user ();
+  retval = syscall_dispatch (user_esp, (uint32_t *) user_esp + 1);
+  process_check_terminated ();
+  thread_charge_kernel ();
+  if (locked)
+    kernel_lock_exit ();
+  return retval;
+}
+
+/* Executes the system call whose number, followed by its
+   arguments, is at ARGS in user memory, for a user program whose
+   stack pointer is USER_ESP.  Returns the system call's return
+   value. */
+static int
+syscall_dispatch (void *user_esp, const uint32_t *args)
+{
+  const struct syscall *sc;
+  unsigned call_nr;
+  int argv[4];
+
+#ifdef VM
+  /* Save the user stack pointer, in case a user buffer lies in
+     stack that has yet to be grown. */
+  thread_current ()->user_esp = user_esp;
+#else
+  (void) user_esp;
+#endif
+
+  /* Get the system call. */
+  copy_in (&call_nr, args, sizeof call_nr);
+  if (call_nr >= sizeof syscall_table / sizeof *syscall_table
+      || syscall_table[call_nr].func == NULL)
+    sys_exit (-1);
+  sc = &syscall_table[call_nr];
+
+  /* Get the system call arguments. */
+  ASSERT (sc->arg_cnt <= sizeof argv / sizeof *argv);
+  memset (argv, 0, sizeof argv);
+  copy_in (argv, args + 1, sizeof *argv * sc->arg_cnt);
+
+  /* Execute the system call. */
+  if (thread_current ()->process->strace)
+    return trace_syscall (call_nr, sc, argv);
+  return sc->func (argv[0], argv[1], argv[2], argv[3]);
+}
+
+/* System call tracing.
+
+   Each system call of a process started with "-strace" naming
+   its program is logged to the kernel log (see threads/klog.c)
+   as a KLOG_SYSCALL record with its number and first argument,
+   a KLOG_SYSCALL_ARGS record with the next two, and another
+   with the fourth, if it takes four.  A call that takes a file
+   name adds its first NAME_TRACE_MAX - 1 bytes in
+   KLOG_SYSCALL_NAME records, 8 bytes each, up to and including
+   the null terminator.  A KLOG_SYSCALL_DONE record with the
+   return value and the time the call took ends the call.
+   "pintos-klog --syscalls" turns the records into a trace for
+   examples/replay to re-issue. */
+
+/* Longest file name logged, counting the null terminator. */
+#define NAME_TRACE_MAX 64
+
+/* Returns true if system call CALL_NR takes a file name as its
+   first argument. */
+static bool
+takes_name (unsigned call_nr)
+{
+  switch (call_nr)
+    {
+    case SYS_CREATE:
+    case SYS_REMOVE:
+    case SYS_OPEN:
+    case SYS_CHDIR:
+    case SYS_MKDIR:
+    case SYS_STAT:
+      return true;
+    default:
+      return false;
+    }
+}
+
+/* Logs user string US in KLOG_SYSCALL_NAME records, truncated
+   to NAME_TRACE_MAX - 1 bytes.  Logs an empty string if US is
+   not valid: the system call will find that out. */
+static void
+trace_name (const char *us)
+{
+  char name[NAME_TRACE_MAX];
+  size_t len, ofs;
+  int cnt;
+
+  cnt = copy_in_string_to (name, us, sizeof name);
+  if (cnt < 0)
+    name[0] = '\0';
+  else if (cnt == 0)
+    name[sizeof name - 1] = '\0';
+  len = strlen (name) + 1;
+  for (ofs = 0; ofs < len; ofs += 8)
+    {
+      uint32_t bytes[2] = {0, 0};
+
+      memcpy (bytes, name + ofs, len - ofs < 8 ? len - ofs : 8);
+      klog (KLOG_SYSCALL_NAME, bytes[0], bytes[1]);
+    }
+}
+
+/* Executes system call CALL_NR, which is SC, with arguments
+   ARGV, logging it as described above. */
+static int
+trace_syscall (unsigned call_nr, const struct syscall *sc, const int argv[])
+{
+  uint64_t start;
+  int retval;
+
+  klog (KLOG_SYSCALL, call_nr, argv[0]);
+  klog (KLOG_SYSCALL_ARGS, argv[1], argv[2]);
+  if (sc->arg_cnt > 3)
+    klog (KLOG_SYSCALL_ARGS, argv[3], 0);
+  if (takes_name (call_nr))
+    trace_name ((const char *) argv[0]);
+
+  start = timer_cycles ();
+  retval = sc->func (argv[0], argv[1], argv[2], argv[3]);
+  klog (KLOG_SYSCALL_DONE, retval,
+        timer_cycles_to_ns (timer_cycles () - start) / 1000);
+  return retval;
+}
+
+/* User memory access.
+
+   User pointers are not checked against the page directory.
+   Instead, get_user() and put_user() just try the access: a bad
+   address page faults, and page_fault() resumes execution at the
+   address that they leave in EAX, with EAX set to -1.  Valid
+   accesses, the common case, thus cost no more than the access
+   itself.  Each address must be checked to be below PHYS_BASE
+   first, because kernel addresses do not fault. */
+
+/* Reads a byte at user virtual address UADDR, which must be
+   below PHYS_BASE.  Returns the byte value if successful, -1 if
+   a page fault occurred. */
+static inline int
+get_user (const uint8_t *uaddr)
+{
+  int result;
+  asm ("movl $1f, %0; movzbl %1, %0; 1:"
+       : "=&a" (result) : "m" (*uaddr));
+  return result;
+}
+
+/* Reads the int at user virtual address UADDR, which must be
+   below PHYS_BASE and aligned, into *VALUE with a single load.
+   Returns true if successful, false if a page fault occurred. */
+static inline bool
+get_user_int (const int *uaddr, int *value)
+{
+  int error_code;
+  int v;
+  asm ("movl $1f, %0; movl %2, %1; 1:"
+       : "=&a" (error_code), "=&r" (v) : "m" (*uaddr));
+  *value = v;
+  return error_code != -1;
+}
+
+/* Writes BYTE to user address UDST, which must be below
+   PHYS_BASE.  Returns true if successful, false if a page fault
+   occurred. */
+static inline bool
+put_user (uint8_t *udst, uint8_t byte)
+{
+  int error_code;
+  asm ("movl $1f, %0; movb %b2, %1; 1:"
+       : "=&a" (error_code), "=m" (*udst) : "q" (byte));
+  return error_code != -1;
+}
+
+/* Copies SIZE bytes from user address USRC to kernel address
+   DST.  Terminates the process if any of the user accesses are
+   invalid. */
+static void
+copy_in (void *dst_, const void *usrc_, size_t size)
+{
+  uint8_t *dst = dst_;
+  const uint8_t *usrc = usrc_;
+
+  for (; size > 0; size--, dst++, usrc++)
+    {
+      int c;
+      if (!is_user_vaddr (usrc) || (c = get_user (usrc)) == -1)
+        sys_exit (-1);
+      *dst = c;
+    }
+}
+
+/* Copies SIZE bytes from kernel address SRC to user address
+   UDST.  Terminates the process if any of the user accesses are
+   invalid. */
+static void
+copy_out (void *udst_, const void *src_, size_t size)
+{
+  uint8_t *udst = udst_;
+  const uint8_t *src = src_;
+
+  for (; size > 0; size--, udst++, src++)
+    if (!is_user_vaddr (udst) || !put_user (udst, *src))
+      sys_exit (-1);
+}
+
+/* Copies user string US, with its null terminator, into the
+   SIZE bytes at kernel address DST.  Returns the number of bytes
+   copied, including the null terminator, 0 if the string does
+   not fit, or -1 if any of the user accesses are invalid. */
+static int
+copy_in_string_to (char *dst, const char *us, size_t size)
+{
+  size_t length;
+
+  for (length = 0; length < size; length++)
+    {
+      const uint8_t *p = (const uint8_t *) us + length;
+      int c;
+
+      if (!is_user_vaddr (p) || (c = get_user (p)) == -1)
+        return -1;
+      dst[length] = c;
+      if (c == '\0')
+        return length + 1;
+    }
+  return 0;
+}
+
+/* Creates a copy of user string US in kernel memory and returns
+   it as a page that must be freed with palloc_free_page().
+   Truncates the string at PGSIZE bytes in size.  Terminates the
+   process if any of the user accesses are invalid. */
+static char *
+copy_in_string (const char *us)
+{
+  char *ks;
+  int length;
+
+  ks = palloc_get_page (0);
+  if (ks == NULL)
+    sys_exit (-1);
+
+  length = copy_in_string_to (ks, us, PGSIZE);
+  if (length < 0)
+    {
+      palloc_free_page (ks);
+      sys_exit (-1);
+    }
+  if (length == 0)
+    ks[PGSIZE - 1] = '\0';
+  return ks;
+}
+
+/* Unlocks the SIZE bytes at user address UADDR, locked with
+   lock_user_range(). */
+static void
+unlock_user_range (const void *uaddr UNUSED, size_t size UNUSED)
+{
+#ifdef VM
+  const uint8_t *start = uaddr;
+  const uint8_t *p;
+
+  if (size > 0)
+    for (p = pg_round_down (start); p < start + size; p += PGSIZE)
+      page_unlock (p);
+#endif
+}
+
+/* Checks that the SIZE bytes at user address UADDR are mapped,
+   and writable as well if WRITABLE is true, so that the kernel
+   can then access them directly.  Touches one byte per page
+   rather than checking every byte.  With virtual memory, also
+   locks the pages into memory, so they must be released with
+   unlock_user_range() afterward.  Terminates the process if any
+   page is invalid. */
+static void
+lock_user_range (const void *uaddr, size_t size, bool writable)
+{
+  const uint8_t *start = uaddr;
+  const uint8_t *end = start + size;
+  const uint8_t *p;
+
+  if (size == 0)
+    return;
+  if (end < start || !is_user_vaddr (end - 1))
+    sys_exit (-1);
+  for (p = pg_round_down (start); p < end; p += PGSIZE)
+    {
+#ifdef VM
+      if (!page_lock (p, writable))
+        {
+          if (p > start)
+            unlock_user_range (start, p - start);
+          sys_exit (-1);
+        }
+#else
+      const uint8_t *q = p < start ? start : p;
+      int c = get_user (q);
+      if (c == -1 || (writable && !put_user ((uint8_t *) q, c)))
+        sys_exit (-1);
+#endif
+    }
+}
+
+/* Grows the current process's file descriptor table, creating
+   it if it does not exist, by doubling it until it has at least
+   MIN_CNT slots.  Returns true if successful, false if memory is
+   exhausted.  The table must be locked. */
+static bool
+grow_fd_table (size_t min_cnt)
+{
+  struct process *cur = thread_current ()->process;
+  size_t new_cnt = cur->fds == NULL ? FD_TABLE_MIN : cur->fd_cnt * 2;
+  struct descriptor *new_fds;
+  struct bitmap *new_map;
+  size_t fd;
+
+  while (new_cnt < min_cnt)
+    new_cnt *= 2;
+  new_fds = malloc (new_cnt * sizeof *new_fds);
+  new_map = bitmap_create (new_cnt);
+  if (new_fds == NULL || new_map == NULL)
+    {
+      free (new_fds);
+      bitmap_destroy (new_map);
+      return false;
+    }
+
+  if (cur->fds != NULL)
+    {
+      memcpy (new_fds, cur->fds, cur->fd_cnt * sizeof *new_fds);
+      for (fd = 0; fd < cur->fd_cnt; fd++)
+        bitmap_set (new_map, fd, bitmap_test (cur->fd_map, fd));
+      free (cur->fds);
+      bitmap_destroy (cur->fd_map);
+    }
+  else
+    {
+      new_fds[STDIN_FILENO] = console_in;
+      new_fds[STDOUT_FILENO] = console_out;
+      bitmap_set_multiple (new_map, STDIN_FILENO, STDOUT_FILENO + 1, true);
+    }
+
+  cur->fds = new_fds;
+  cur->fd_map = new_map;
+  cur->fd_cnt = new_cnt;
+  return true;
+}
+
+/* Installs D in the lowest free slot of the current process's
+   file descriptor table, which must be locked, and returns the
+   descriptor, or -1 if memory is exhausted. */
+static int
+install_fd_locked (const struct descriptor *d)
+{
+  struct process *cur = thread_current ()->process;
+  size_t fd;
+
+  fd = cur->fd_map != NULL
+       ? bitmap_scan_and_flip (cur->fd_map, 0, 1, false) : BITMAP_ERROR;
+  if (fd == BITMAP_ERROR)
+    {
+      if (!grow_fd_table (0))
+        return -1;
+      fd = bitmap_scan_and_flip (cur->fd_map, 0, 1, false);
+    }
+  cur->fds[fd] = *d;
+  return fd;
+}
+
+/* Installs FILE in the lowest free slot of the current process's
+   file descriptor table and returns the descriptor, or -1 if
+   memory is exhausted. */
+static int
+install_fd (struct file *file)
+{
+  struct process *cur = thread_current ()->process;
+  struct descriptor d = {FD_FILE, file, NULL, NULL};
+  int fd;
+
+  lock_acquire (&cur->fd_lock);
+  fd = install_fd_locked (&d);
+  lock_release (&cur->fd_lock);
+  return fd;
+}
+
+/* Returns PROC's descriptor with the given handle, or a null
+   pointer if HANDLE is not open.  PROC's descriptor table must
+   be locked. */
+static struct descriptor *
+find_fd (struct process *proc, int handle)
+{
+  if (proc->fds == NULL && handle == STDIN_FILENO)
+    return &console_in;
+  if (proc->fds == NULL && handle == STDOUT_FILENO)
+    return &console_out;
+  if (handle < 0 || (size_t) handle >= proc->fd_cnt
+      || !bitmap_test (proc->fd_map, handle))
+    return NULL;
+  return &proc->fds[handle];
+}
+
+/* Makes HANDLE a descriptor of the current process, whose table
+   must be locked, for whatever SRC refers to, closing HANDLE
+   first if it is open.  SRC may be in the same table.  Returns
+   true if successful, false if HANDLE is out of range or memory
+   is exhausted. */
+static bool
+dup_to_fd (int handle, const struct descriptor *src_)
+{
+  struct process *cur = thread_current ()->process;
+  struct descriptor src, d;
+
+  if (handle < 0 || handle >= FD_DUP_MAX)
+    return false;
+
+  /* Growing the table moves the descriptors, SRC_ among them. */
+  src = *src_;
+  if ((size_t) handle >= cur->fd_cnt || cur->fds == NULL)
+    if (!grow_fd_table (handle + 1))
+      return false;
+  if (!dup_descriptor (&d, &src))
+    return false;
+
+  if (bitmap_test (cur->fd_map, handle))
+    close_descriptor (&cur->fds[handle]);
+  cur->fds[handle] = d;
+  bitmap_mark (cur->fd_map, handle);
+  return true;
+}
+
+/* Locks the current process's file descriptor table and returns
+   the descriptor with the given handle.  The table stays locked
+   until release_fd() is called.  Terminates the process if
+   HANDLE is not an open descriptor. */
+static struct descriptor *
+lookup_fd (int handle)
+{
+  struct process *cur = thread_current ()->process;
+  struct descriptor *d;
+
+  lock_acquire (&cur->fd_lock);
+  d = find_fd (cur, handle);
+  if (d == NULL)
+    sys_exit (-1);
+  return d;
+}
+
+/* Like lookup_fd(), but returns the open file that HANDLE refers
+   to, or a null pointer if HANDLE is open on something else. */
+static struct file *
+lookup_file (int handle)
+{
+  struct descriptor *d = lookup_fd (handle);
+  return d->type == FD_FILE ? d->file : NULL;
+}
+
+/* Unlocks the current process's file descriptor table, locked by
+   lookup_fd(). */
 static void
-syscall_handler (struct intr_frame *f UNUSED) 
+release_fd (void)
+{
+  lock_release (&thread_current ()->process->fd_lock);
+}
+
+/* Halt system call. */
+static int
+sys_halt (void)
+{
+  shutdown_power_off ();
+}
+
+/* Exit system call.  Also called to kill the process when a
+   system call is passed a bad argument, which may be found with
+   the file descriptor table locked. */
+static int
+sys_exit (int exit_code)
+{
+  struct process *proc = thread_current ()->process;
+
+  if (lock_held_by_current_thread (&proc->fd_lock))
+    lock_release (&proc->fd_lock);
+  process_terminate (exit_code);
+}
+
+/* Exec system call. */
+static int
+sys_exec (const char *ucmd_line)
+{
+  char *kcmd_line = copy_in_string (ucmd_line);
+  tid_t tid = process_execute (kcmd_line);
+
+  palloc_free_page (kcmd_line);
+  return tid;
+}
+
+/* Fork system call.  Only int $0x30 saves the whole user
+   context for the child process to resume from, so fork() fails
+   through SYSENTER. */
+static int
+sys_fork (void)
+{
+  struct intr_frame *f = thread_current ()->syscall_frame;
+
+  return f != NULL ? process_fork (f) : TID_ERROR;
+}
+
+/* A file descriptor action for spawn().  Must match struct
+   spawn_action in lib/user/syscall.h. */
+struct user_spawn_action
+  {
+    int op;                     /* SPAWN_END, SPAWN_DUP2, SPAWN_CLOSE. */
+    int fd;                     /* Parent's descriptor, or child's. */
+    int new_fd;                 /* SPAWN_DUP2: child's descriptor. */
+  };
+
+/* Operation codes for spawn(), as in lib/user/syscall.h. */
+enum { SPAWN_END, SPAWN_DUP2, SPAWN_CLOSE };
+
+/* Most actions one spawn() may carry out. */
+#define SPAWN_ACTIONS_MAX 16
+
+/* Copies user string UFILE, and then the strings in the
+   null-terminated user array UARGV, or UFILE again if UARGV is
+   null, into PAGE, each with its null terminator.  Returns the
+   number of bytes used, 0 if they do not fit in a page, or -1
+   if any of the user accesses are invalid. */
+static int
+copy_in_spawn_args (char *page, const char *ufile, char *const *uargv)
+{
+  size_t used;
+  size_t i;
+  int len;
+
+  len = copy_in_string_to (page, ufile, PGSIZE);
+  if (len <= 0)
+    return len;
+  used = len;
+  if (uargv == NULL)
+    {
+      if (used + len > PGSIZE)
+        return 0;
+      memcpy (page + used, page, len);
+      return used + len;
+    }
+
+  for (i = 0; ; i++)
+    {
+      const int *p = (const int *) (uargv + i);
+      int uarg;
+
+      if (!is_user_vaddr (p + 1) || !get_user_int (p, &uarg))
+        return -1;
+      if (uarg == 0)
+        return used;
+      len = copy_in_string_to (page + used, (const char *) uarg,
+                               PGSIZE - used);
+      if (len <= 0)
+        return len;
+      used += len;
+    }
+}
+
+/* Spawn system call.  Starts the program UFILE in a new process,
+   passing it the strings in the null-terminated array UARGV as
+   arguments, or just UFILE if UARGV is null, after the new
+   process has inherited descriptors 0 and 1 and carried out the
+   descriptor actions in UACTIONS, which end with SPAWN_END, if
+   UACTIONS is not null.  Returns the new process's id, or -1 if
+   it cannot be started. */
+static int
+sys_spawn (const char *ufile, char *const *uargv, const void *uactions_)
+{
+  const struct user_spawn_action *uactions = uactions_;
+  struct fd_action actions[SPAWN_ACTIONS_MAX];
+  size_t action_cnt = 0;
+  size_t file_len;
+  char *page;
+  int used;
+  tid_t tid;
+
+  /* Copy in the actions first, while nothing is allocated that a
+     bad pointer would leak. */
+  if (uactions != NULL)
+    for (;;)
+      {
+        struct user_spawn_action a;
+
+        copy_in (&a, uactions + action_cnt, sizeof a);
+        if (a.op == SPAWN_END)
+          break;
+        if (action_cnt >= SPAWN_ACTIONS_MAX
+            || (a.op != SPAWN_DUP2 && a.op != SPAWN_CLOSE))
+          return -1;
+        actions[action_cnt].close = a.op == SPAWN_CLOSE;
+        actions[action_cnt].fd = a.fd;
+        actions[action_cnt].new_fd = a.new_fd;
+        action_cnt++;
+      }
+
+  page = palloc_get_page (0);
+  if (page == NULL)
+    return -1;
+  used = copy_in_spawn_args (page, ufile, uargv);
+  if (used < 0)
+    {
+      palloc_free_page (page);
+      sys_exit (-1);
+    }
+
+  tid = TID_ERROR;
+  if (used > 0)
+    {
+      file_len = strlen (page) + 1;
+      tid = process_spawn (page, page + file_len, used - file_len,
+                           actions, action_cnt);
+    }
+  palloc_free_page (page);
+  return tid;
+}
+
+/* Wait system call. */
+static int
+sys_wait (tid_t child)
+{
+  return process_wait (child);
+}
+
+/* Create system call. */
+static int
+sys_create (const char *ufile, unsigned initial_size)
+{
+  char *kfile = copy_in_string (ufile);
+  bool ok = filesys_create (kfile, initial_size);
+
+  palloc_free_page (kfile);
+  return ok;
+}
+
+/* Remove system call. */
+static int
+sys_remove (const char *ufile)
+{
+  char *kfile = copy_in_string (ufile);
+  bool ok = filesys_remove (kfile);
+
+  palloc_free_page (kfile);
+  return ok;
+}
+
+/* Open system call. */
+static int
+sys_open (const char *ufile)
+{
+  char *kfile = copy_in_string (ufile);
+  struct dir *dir;
+  struct file *file;
+  int handle = -1;
+
+  dir = filesys_open_dir (kfile);
+  if (dir != NULL)
+    {
+      struct process *cur = thread_current ()->process;
+      struct descriptor d = {FD_DIR, NULL, NULL, dir};
+
+      lock_acquire (&cur->fd_lock);
+      handle = install_fd_locked (&d);
+      lock_release (&cur->fd_lock);
+      if (handle < 0)
+        dir_close (dir);
+    }
+  else
+    {
+      file = filesys_open (kfile);
+      if (file != NULL)
+        {
+          handle = install_fd (file);
+          if (handle < 0)
+            file_close (file);
+        }
+    }
+  palloc_free_page (kfile);
+  return handle;
+}
+
+/* Filesize system call. */
+static int
+sys_filesize (int handle)
+{
+  struct file *file = lookup_file (handle);
+  int length = file != NULL ? file_length (file) : -1;
+
+  release_fd ();
+  return length;
+}
+
+#ifdef VM
+/* Reads SIZE bytes from FILE into kernel buffer KBUF, at offset
+   OFS in FILE or, if OFS is negative, at FILE's position, which is
+   then advanced.  Data that a shared frame holds, because some
+   process has it mapped, is copied from the frame (see
+   frame_read()) and the rest read from the file.  Returns the
+   number of bytes read. */
+static off_t
+read_file (struct file *file, uint8_t *kbuf, off_t size, off_t ofs)
+{
+  struct inode *inode = file_get_inode (file);
+  off_t pos = ofs < 0 ? file_tell (file) : ofs;
+  off_t done = 0;
+
+  while (done < size)
+    {
+      off_t cnt = frame_read (inode, pos + done, kbuf + done, size - done);
+      if (cnt == 0)
+        {
+          done += file_read_at (file, kbuf + done, size - done, pos + done);
+          break;
+        }
+      done += cnt;
+    }
+  if (ofs < 0)
+    file_seek (file, pos + done);
+  return done;
+}
+#endif
+
+/* Reads or writes, according to WRITE, SIZE bytes between FILE
+   and the user buffer UBUF, at offset OFS in FILE or, if OFS is
+   negative, at FILE's position, which is then advanced.  Returns
+   the number of bytes transferred, or -1 if the buffer is
+   invalid, in which case the caller should terminate the process
+   once it has cleaned up.
+
+   With virtual memory, the buffer is pinned PAGE_PIN_MAX pages
+   at a time, and the data moves between the file and the
+   buffer's frames through their kernel addresses.  So the file
+   system never faults on user memory with its locks held, and a
+   large transfer keeps no more than a few frames from being
+   evicted. */
+static int
+transfer_file (struct file *file, off_t ofs, void *ubuf_, unsigned size,
+               bool write)
+{
+  uint8_t *ubuf = ubuf_;
+#ifdef VM
+  struct frame *frames[PAGE_PIN_MAX];
+  int total = 0;
+
+  if (size > 0 && (ubuf + size < ubuf || !is_user_vaddr (ubuf + size - 1)))
+    return -1;
+  while (size > 0)
+    {
+      size_t chunk = PAGE_PIN_MAX * PGSIZE - pg_ofs (ubuf);
+      size_t cnt, i;
+
+      if (chunk > size)
+        chunk = size;
+      cnt = page_pin (ubuf, chunk, !write, frames);
+      if (cnt == 0)
+        return -1;
+      for (i = 0; i < cnt; i++)
+        {
+          size_t page_left = PGSIZE - pg_ofs (ubuf);
+          size_t n = page_left < size ? page_left : size;
+          uint8_t *kbuf = (uint8_t *) frames[i]->base + pg_ofs (ubuf);
+          off_t done;
+
+          if (!write)
+            {
+              done = read_file (file, kbuf, n, ofs);
+              if (ofs >= 0)
+                ofs += done;
+            }
+          else if (ofs < 0)
+            done = file_write (file, kbuf, n);
+          else
+            {
+              done = file_write_at (file, kbuf, n, ofs);
+              ofs += done;
+            }
+
+          total += done;
+          ubuf += done;
+          size -= done;
+          if ((size_t) done < n)
+            {
+              size = 0;
+              break;
+            }
+        }
+      page_unpin (frames, cnt);
+    }
+  return total;
+#else
+  const uint8_t *p;
+
+  /* Touch each page, as lock_user_range() does. */
+  if (size > 0 && (ubuf + size < ubuf || !is_user_vaddr (ubuf + size - 1)))
+    return -1;
+  for (p = ubuf; p < ubuf + size; p = pg_round_down (p) + PGSIZE)
+    {
+      int c = get_user (p);
+      if (c == -1 || (!write && !put_user ((uint8_t *) p, c)))
+        return -1;
+    }
+
+  if (ofs < 0)
+    return write ? file_write (file, ubuf, size) : file_read (file, ubuf, size);
+  return (write
+          ? file_write_at (file, ubuf, size, ofs)
+          : file_read_at (file, ubuf, size, ofs));
+#endif
+}
+
+/* Positional read and write.  Both run the I/O on a file of
+   their own for the descriptor's inode, so that the descriptor
+   table need not stay locked meanwhile: threads sharing a
+   descriptor can read and write it in parallel, and its position
+   is left alone. */
+
+/* Reads or writes, according to WRITE, SIZE bytes between the
+   file open as HANDLE and user buffer UBUF, at offset OFS in the
+   file.  Returns the number of bytes transferred, or -1 if
+   HANDLE is not a file or memory is exhausted. */
+static int
+transfer_at (int handle, void *ubuf, unsigned size, unsigned ofs,
+             bool write)
+{
+  struct file *file = lookup_file (handle);
+  int result;
+
+  if (file != NULL)
+    file = file_reopen (file);
+  release_fd ();
+  if (file == NULL || ofs > INT_MAX)
+    {
+      file_close (file);
+      return -1;
+    }
+
+  result = transfer_file (file, ofs, ubuf, size, write);
+  file_close (file);
+  if (result < 0)
+    sys_exit (-1);
+  return result;
+}
+
+/* Pread system call. */
+static int
+sys_pread (int handle, void *udst, unsigned size, unsigned ofs)
+{
+  return transfer_at (handle, udst, size, ofs, false);
+}
+
+/* Pwrite system call. */
+static int
+sys_pwrite (int handle, const void *usrc, unsigned size, unsigned ofs)
+{
+  return transfer_at (handle, (void *) usrc, size, ofs, true);
+}
+
+/* Fallocate system call.  Fails if HANDLE is not a file or the
+   range does not fit in a file offset. */
+static int
+sys_fallocate (int handle, unsigned ofs, unsigned size)
+{
+  struct file *file = lookup_file (handle);
+  bool success = (file != NULL && ofs <= INT_MAX && size <= INT_MAX - ofs
+                  && file_allocate (file, ofs, size));
+
+  release_fd ();
+  return success;
+}
+
+/* Fsync system call.  Fails if HANDLE is not a file. */
+static int
+sys_fsync (int handle)
+{
+  struct file *file = lookup_file (handle);
+
+  if (file != NULL)
+    file_sync (file);
+  release_fd ();
+  return file != NULL;
+}
+
+/* Sync system call. */
+static int
+sys_sync (void)
+{
+  filesys_sync ();
+  return 0;
+}
+
+/* Read system call. */
+static int
+sys_read (int handle, void *udst, unsigned size)
+{
+  struct descriptor *d = lookup_fd (handle);
+  int result;
+
+  if (d->type == FD_FILE)
+    {
+      result = transfer_file (d->file, -1, udst, size, false);
+      release_fd ();
+      if (result < 0)
+        sys_exit (-1);
+      return result;
+    }
+
+  lock_user_range (udst, size, true);
+  switch (d->type)
+    {
+    case FD_CONSOLE_IN:
+      release_fd ();
+      result = input_read (udst, size);
+      break;
+
+    case FD_PIPE_READ:
+      {
+        struct pipe *pipe = d->pipe;
+
+        pipe_open (pipe, false);
+        release_fd ();
+        result = pipe_read (pipe, udst, size);
+        pipe_close (pipe, false);
+      }
+      break;
+
+    default:
+      release_fd ();
+      result = -1;
+      break;
+    }
+  unlock_user_range (udst, size);
+  return result;
+}
+
+/* Write system call. */
+static int
+sys_write (int handle, const void *usrc, unsigned size)
+{
+  struct descriptor *d = lookup_fd (handle);
+  int result;
+
+  if (d->type == FD_FILE)
+    {
+      result = transfer_file (d->file, -1, (void *) usrc, size, true);
+      release_fd ();
+      if (result < 0)
+        sys_exit (-1);
+      return result;
+    }
+
+  lock_user_range (usrc, size, false);
+  switch (d->type)
+    {
+    case FD_CONSOLE_OUT:
+      release_fd ();
+      putbuf (usrc, size);
+      result = size;
+      break;
+
+    case FD_PIPE_WRITE:
+      {
+        struct pipe *pipe = d->pipe;
+
+        pipe_open (pipe, true);
+        release_fd ();
+        result = pipe_write (pipe, usrc, size);
+        pipe_close (pipe, true);
+      }
+      break;
+
+    default:
+      release_fd ();
+      result = -1;
+      break;
+    }
+  unlock_user_range (usrc, size);
+  return result;
+}
+
+/* Copy system call.  Copies up to SIZE bytes from the file open
+   as SRC_HANDLE to the file open as DST_HANDLE, at their current
+   positions, without passing them through user memory.  Returns
+   the number of bytes copied, or -1 if either descriptor is not
+   a file. */
+static int
+sys_copy (int src_handle, int dst_handle, unsigned size)
+{
+  struct file *src = lookup_file (src_handle);
+  struct descriptor *dst = find_fd (thread_current ()->process,
+                                    dst_handle);
+  int result;
+
+  if (dst == NULL)
+    sys_exit (-1);
+  if (src == NULL || dst->type != FD_FILE)
+    result = -1;
+  else
+    {
+      if (size > INT_MAX)
+        size = INT_MAX;
+      result = file_copy (dst->file, src, size);
+    }
+  release_fd ();
+  return result;
+}
+
+/* Seek system call.  Does nothing to a descriptor that is not
+   a file. */
+static int
+sys_seek (int handle, unsigned position)
+{
+  struct file *file = lookup_file (handle);
+
+  if (file != NULL)
+    file_seek (file, position);
+  release_fd ();
+  return 0;
+}
+
+/* Tell system call. */
+static int
+sys_tell (int handle)
+{
+  struct file *file = lookup_file (handle);
+  int position = file != NULL ? file_tell (file) : -1;
+
+  release_fd ();
+  return position;
+}
+
+/* Closes descriptor D, which must be open. */
+static void
+close_descriptor (struct descriptor *d)
+{
+  switch (d->type)
+    {
+    case FD_FILE:
+      file_close (d->file);
+      break;
+    case FD_PIPE_READ:
+    case FD_PIPE_WRITE:
+      pipe_close (d->pipe, d->type == FD_PIPE_WRITE);
+      break;
+    case FD_DIR:
+      dir_close (d->dir);
+      break;
+    default:
+      break;
+    }
+}
+
+/* Makes *DST a new descriptor for what SRC refers to.  A file
+   or directory is reopened, at the same position, so the two
+   descriptors do not share a position afterward.  Returns true if successful,
+   false if memory is exhausted. */
+static bool
+dup_descriptor (struct descriptor *dst, const struct descriptor *src)
+{
+  *dst = *src;
+  switch (src->type)
+    {
+    case FD_FILE:
+      dst->file = file_reopen (src->file);
+      if (dst->file == NULL)
+        return false;
+      file_seek (dst->file, file_tell (src->file));
+      break;
+    case FD_PIPE_READ:
+    case FD_PIPE_WRITE:
+      pipe_open (src->pipe, src->type == FD_PIPE_WRITE);
+      break;
+    case FD_DIR:
+      dst->dir = dir_reopen (src->dir);
+      if (dst->dir == NULL)
+        return false;
+      dir_seek (dst->dir, dir_tell (src->dir));
+      break;
+    default:
+      break;
+    }
+  return true;
+}
+
+/* Close system call. */
+static int
+sys_close (int handle)
+{
+  struct process *cur = thread_current ()->process;
+
+  lookup_fd (handle);
+  if (cur->fds == NULL && !grow_fd_table (0))
+    {
+      /* Descriptor 0 or 1 is the console, and the table that
+         would record it as closed cannot be had. */
+      release_fd ();
+      return 0;
+    }
+  close_descriptor (&cur->fds[handle]);
+  bitmap_reset (cur->fd_map, handle);
+  release_fd ();
+  return 0;
+}
+
+/* Pipe system call.  Stores descriptors for the read and write
+   ends of a new pipe in UFDS[0] and UFDS[1]. */
+static int
+sys_pipe (int *ufds)
+{
+  struct process *cur = thread_current ()->process;
+  struct descriptor rd, wr;
+  int fds[2];
+
+  rd.type = FD_PIPE_READ;
+  wr.type = FD_PIPE_WRITE;
+  rd.file = wr.file = NULL;
+  rd.dir = wr.dir = NULL;
+  rd.pipe = wr.pipe = pipe_create ();
+  if (rd.pipe == NULL)
+    return false;
+
+  lock_acquire (&cur->fd_lock);
+  fds[0] = install_fd_locked (&rd);
+  fds[1] = fds[0] != -1 ? install_fd_locked (&wr) : -1;
+  if (fds[1] == -1)
+    {
+      if (fds[0] != -1)
+        bitmap_reset (cur->fd_map, fds[0]);
+      lock_release (&cur->fd_lock);
+      pipe_close (rd.pipe, false);
+      pipe_close (wr.pipe, true);
+      return false;
+    }
+  lock_release (&cur->fd_lock);
+
+  copy_out (ufds, fds, sizeof fds);
+  return true;
+}
+
+/* Dup system call.  Returns a new descriptor, the lowest free
+   one, for whatever HANDLE refers to, or -1 on failure. */
+static int
+sys_dup (int handle)
+{
+  struct descriptor d;
+  int fd = -1;
+
+  if (dup_descriptor (&d, lookup_fd (handle)))
+    {
+      fd = install_fd_locked (&d);
+      if (fd == -1)
+        close_descriptor (&d);
+    }
+  release_fd ();
+  return fd;
+}
+
+/* Dup2 system call.  Makes NEW_HANDLE a descriptor for whatever
+   HANDLE refers to, closing it first if it is open.  Returns
+   NEW_HANDLE, or -1 on failure. */
+static int
+sys_dup2 (int handle, int new_handle)
+{
+  struct descriptor *old = lookup_fd (handle);
+  bool success = new_handle == handle || dup_to_fd (new_handle, old);
+
+  release_fd ();
+  return success ? new_handle : -1;
+}
+
+#ifdef VM
+/* Removes mapping M, writing its dirty pages back to its file or
+   detaching its segment, and frees it.  The file descriptor
+   table, which also protects the list of mappings and the heap,
+   must be locked, unless the process is exiting. */
+static void
+unmap (struct mapping *m)
+{
+  size_t i;
+
+  list_remove (&m->elem);
+  for (i = 0; i < m->page_cnt; i++)
+    page_deallocate (m->base + i * PGSIZE);
+  if (m->shm != NULL)
+    shm_close (m->shm);
+  else
+    file_close (m->file);
+  free (m);
+}
+
+/* Mmap system call.  The file's pages are entered in the page
+   table but read only when first touched, like an executable's
+   (see page_in()). */
+static int
+sys_mmap (int handle, void *addr)
+{
+  struct process *cur = thread_current ()->process;
+  struct file *file = lookup_file (handle);
+  struct mapping *m;
+  off_t length;
+  size_t page_cnt, i;
+
+  if (file == NULL || addr == NULL || pg_ofs (addr) != 0)
+    {
+      release_fd ();
+      return -1;
+    }
+
+  m = malloc (sizeof *m);
+  if (m == NULL)
+    {
+      release_fd ();
+      return -1;
+    }
+  m->shm = NULL;
+  m->file = file_reopen (file);
+  if (m->file == NULL)
+    {
+      free (m);
+      release_fd ();
+      return -1;
+    }
+  length = file_length (m->file);
+  page_cnt = DIV_ROUND_UP ((size_t) length, PGSIZE);
+  m->base = addr;
+  m->page_cnt = 0;
+  m->handle = cur->next_mapid++;
+  list_push_front (&cur->mappings, &m->elem);
+
+  /* Add the pages.  Failing partway, because a page would be
+     outside user memory or overlap an existing page or because
+     memory is exhausted, undoes the whole mapping. */
+  for (i = 0; i < page_cnt; i++)
+    {
+      off_t offset = i * PGSIZE;
+      struct page *p;
+
+      if (!is_user_vaddr (m->base + offset))
+        break;
+      p = page_allocate (m->base + offset, true);
+      if (p == NULL)
+        break;
+      p->private = false;
+      p->file = m->file;
+      p->file_offset = offset;
+      p->file_bytes = length - offset < PGSIZE ? length - offset : PGSIZE;
+      m->page_cnt++;
+    }
+  if (page_cnt == 0 || m->page_cnt < page_cnt)
+    {
+      unmap (m);
+      release_fd ();
+      return -1;
+    }
+  release_fd ();
+  return m->handle;
+}
+
+/* Munmap system call. */
+static int
+sys_munmap (int mapping)
+{
+  struct process *cur = thread_current ()->process;
+  struct list_elem *e;
+
+  lock_acquire (&cur->fd_lock);
+  for (e = list_begin (&cur->mappings); e != list_end (&cur->mappings);
+       e = list_next (e))
+    {
+      struct mapping *m = list_entry (e, struct mapping, elem);
+      if (m->handle == mapping)
+        {
+          unmap (m);
+          lock_release (&cur->fd_lock);
+          return 0;
+        }
+    }
+  sys_exit (-1);
+}
+
+/* Madvise system call.  Passes ADVICE, a page_advice, on for the
+   SIZE bytes at ADDR, which must be page-aligned and in user
+   memory.  Returns 0 if successful, -1 on failure. */
+static int
+sys_madvise (void *addr, unsigned size, int advice)
+{
+  if (pg_ofs (addr) != 0 || !is_user_vaddr (addr)
+      || advice < ADVICE_NORMAL || advice > ADVICE_DONTNEED
+      || (uintptr_t) PHYS_BASE - (uintptr_t) addr < size)
+    return -1;
+  return page_advise (addr, size, advice) ? 0 : -1;
+}
+
+/* Attaches segment S, which must be open, at ADDR in the current
+   process, and returns the new mapping's id, or -1 on failure,
+   closing S.  As with mmap(), every page must be free and inside
+   user memory.  A process may attach a segment only once (see
+   shm.c). */
+static int
+attach_shm (struct shm *s, void *addr)
+{
+  struct process *cur = thread_current ()->process;
+  struct mapping *m;
+  struct list_elem *e;
+  size_t page_cnt = shm_page_cnt (s);
+  size_t i;
+
+  if (addr == NULL || pg_ofs (addr) != 0
+      || (m = malloc (sizeof *m)) == NULL)
+    {
+      shm_close (s);
+      return -1;
+    }
+  m->file = NULL;
+  m->shm = s;
+  m->base = addr;
+  m->page_cnt = 0;
+  lock_acquire (&cur->fd_lock);
+  for (e = list_begin (&cur->mappings); e != list_end (&cur->mappings);
+       e = list_next (e))
+    if (list_entry (e, struct mapping, elem)->shm == s)
+      {
+        release_fd ();
+        free (m);
+        shm_close (s);
+        return -1;
+      }
+  m->handle = cur->next_mapid++;
+  list_push_front (&cur->mappings, &m->elem);
+
+  for (i = 0; i < page_cnt; i++)
+    {
+      uint8_t *upage = m->base + i * PGSIZE;
+      struct page *p;
+
+      if (!is_user_vaddr (upage))
+        break;
+      p = page_allocate (upage, true);
+      if (p == NULL)
+        break;
+      p->private = false;
+      p->shm = shm_page (s, i);
+      m->page_cnt++;
+    }
+  if (m->page_cnt < page_cnt)
+    {
+      unmap (m);
+      release_fd ();
+      return -1;
+    }
+  release_fd ();
+  return m->handle;
+}
+
+/* Copies user string UNAME, a segment name, into NAME.  Returns
+   false if it is too long.  Terminates the process if any of the
+   user accesses are invalid. */
+static bool
+copy_in_shm_name (char name[SHM_NAME_MAX + 1], const char *uname)
+{
+  int length = copy_in_string_to (name, uname, SHM_NAME_MAX + 1);
+
+  if (length < 0)
+    sys_exit (-1);
+  return length > 0;
+}
+
+/* Shm_create system call.  Creates a segment named UNAME of SIZE
+   bytes, all zeros, and attaches it at ADDR.  Fails if the name
+   is taken.  Returns the mapping id, for shm_detach(), or -1. */
+static int
+sys_shm_create (const char *uname, unsigned size, void *addr)
+{
+  char name[SHM_NAME_MAX + 1];
+  struct shm *s;
+
+  if (!copy_in_shm_name (name, uname))
+    return -1;
+  s = shm_create (name, DIV_ROUND_UP (size, PGSIZE));
+  return s != NULL ? attach_shm (s, addr) : -1;
+}
+
+/* Shm_attach system call.  Attaches the segment named UNAME at
+   ADDR.  Returns the mapping id, for shm_detach(), or -1.  The
+   shm_detach system call is munmap(): a segment is freed once
+   every process that attached it has detached it or exited. */
+static int
+sys_shm_attach (const char *uname, void *addr)
+{
+  char name[SHM_NAME_MAX + 1];
+  struct shm *s;
+
+  if (!copy_in_shm_name (name, uname))
+    return -1;
+  s = shm_open (name);
+  return s != NULL ? attach_shm (s, addr) : -1;
+}
+
+/* Sbrk system call.  Moves the end of the heap by INCREMENT
+   bytes and returns its old end, or (void *) -1 on failure.
+   Growing enters the new pages in the page table, to be zeroed
+   when first touched, like an executable's BSS; shrinking frees
+   the pages wholly past the new end.  The heap's pages must not
+   overlap any others, such as a mapping's. */
+static void *
+sys_sbrk (int increment)
+{
+  struct process *cur = thread_current ()->process;
+  uint8_t *old_break, *new_break, *old_top, *new_top, *upage;
+
+  lock_acquire (&cur->fd_lock);
+  old_break = cur->heap_break;
+  if (increment >= 0
+      ? (size_t) increment > (size_t) (cur->heap_limit - old_break)
+      : 0 - (size_t) increment > (size_t) (old_break - cur->heap_start))
+    {
+      lock_release (&cur->fd_lock);
+      return (void *) -1;
+    }
+  new_break = old_break + increment;
+  old_top = pg_round_up (old_break);
+  new_top = pg_round_up (new_break);
+
+  for (upage = old_top; upage < new_top; upage += PGSIZE)
+    if (page_allocate (upage, true) == NULL)
+      {
+        /* A page is in the way or memory is exhausted. */
+        while (upage > old_top)
+          {
+            upage -= PGSIZE;
+            page_deallocate (upage);
+          }
+        lock_release (&cur->fd_lock);
+        return (void *) -1;
+      }
+  for (upage = new_top; upage < old_top; upage += PGSIZE)
+    page_deallocate (upage);
+
+  cur->heap_break = new_break;
+  lock_release (&cur->fd_lock);
+  return old_break;
+}
+#else /* !VM */
+/* Mmap system call.  Memory-mapped files need the virtual memory
+   system, so without it this always fails. */
+static int
+sys_mmap (int handle UNUSED, void *addr UNUSED)
+{
+  return -1;
+}
+
+/* Munmap system call.  No mapping can exist; see sys_mmap(). */
+static int
+sys_munmap (int mapping UNUSED)
+{
+  return 0;
+}
+
+/* Madvise system call.  Without virtual memory every page is
+   always resident, so there is nothing to act on. */
+static int
+sys_madvise (void *addr UNUSED, unsigned size UNUSED, int advice UNUSED)
+{
+  return 0;
+}
+
+/* Shm_create system call.  Shared memory needs the virtual
+   memory system, so without it this always fails. */
+static int
+sys_shm_create (const char *uname UNUSED, unsigned size UNUSED,
+                void *addr UNUSED)
+{
+  return -1;
+}
+
+/* Shm_attach system call.  No segment can exist; see
+   sys_shm_create(). */
+static int
+sys_shm_attach (const char *uname UNUSED, void *addr UNUSED)
+{
+  return -1;
+}
+
+/* Sbrk system call.  The heap's pages are entered in the page
+   table by the virtual memory system, so without it the heap
+   cannot grow. */
+static void *
+sys_sbrk (int increment UNUSED)
+{
+  return (void *) -1;
+}
+#endif /* !VM */
+
+/* Chdir system call.  The file system has only a root
+   directory, so there is nowhere to change to. */
+static int
+sys_chdir (const char *udir)
+{
+  palloc_free_page (copy_in_string (udir));
+  return false;
+}
+
+/* Mkdir system call.  Subdirectories are not supported. */
+static int
+sys_mkdir (const char *udir)
+{
+  palloc_free_page (copy_in_string (udir));
+  return false;
+}
+
+/* Readdir system call.  Stores the name of the next entry in
+   the directory open as HANDLE in UNAME, which must have room
+   for READDIR_MAX_LEN + 1 bytes.  Returns false at the end of
+   the directory or if HANDLE is not a directory. */
+static int
+sys_readdir (int handle, char *uname)
+{
+  struct descriptor *d = lookup_fd (handle);
+  char name[NAME_MAX + 1];
+  bool success;
+
+  success = d->type == FD_DIR && dir_readdir (d->dir, name);
+  release_fd ();
+  if (success)
+    copy_out (uname, name, strlen (name) + 1);
+  return success;
+}
+
+/* Isdir system call. */
+static int
+sys_isdir (int handle)
+{
+  bool is_dir = lookup_fd (handle)->type == FD_DIR;
+
+  release_fd ();
+  return is_dir;
+}
+
+/* Inumber system call. */
+static int
+sys_inumber (int handle)
+{
+  struct descriptor *d = lookup_fd (handle);
+  int inumber = -1;
+
+  if (d->type == FD_FILE)
+    inumber = inode_get_inumber (file_get_inode (d->file));
+  else if (d->type == FD_DIR)
+    inumber = inode_get_inumber (dir_get_inode (d->dir));
+  release_fd ();
+  return inumber;
+}
+
+/* Directory listing and metadata.  The structures below must
+   match struct stat and struct dirent in lib/user/syscall.h. */
+
+/* What stat() reports about a file. */
+struct user_stat
+  {
+    int inumber;                /* Inode number. */
+    int type;                   /* FILE_REGULAR or FILE_DIRECTORY. */
+    unsigned size;              /* Length in bytes. */
+  };
+
+/* A directory entry reported by getdents(). */
+struct user_dirent
+  {
+    struct user_stat st;        /* The entry's metadata. */
+    char name[NAME_MAX + 1];    /* Null-terminated name. */
+  };
+
+/* File types, as in lib/user/syscall.h. */
+enum { FILE_REGULAR, FILE_DIRECTORY };
+
+/* Converts ST to the form user programs see. */
+static struct user_stat
+to_user_stat (const struct filesys_stat *st)
+{
+  struct user_stat ust;
+
+  ust.inumber = st->inumber;
+  ust.type = st->is_dir ? FILE_DIRECTORY : FILE_REGULAR;
+  ust.size = st->size;
+  return ust;
+}
+
+/* Getdents system call.  Stores up to CNT of the next entries of
+   the directory open as HANDLE, each with its metadata, in the
+   array UENTS, in one pass over the directory.  Returns the
+   number of entries stored, which is 0 at the end of the
+   directory, or -1 if HANDLE is not a directory. */
+static int
+sys_getdents (int handle, void *uents_, int cnt)
+{
+  struct user_dirent *uents = uents_;
+  struct descriptor *d = lookup_fd (handle);
+  int i;
+
+  if (d->type != FD_DIR)
+    {
+      release_fd ();
+      return -1;
+    }
+
+  /* An entry whose inode is being removed is skipped. */
+  for (i = 0; i < cnt; )
+    {
+      struct user_dirent ent;
+      struct filesys_stat st;
+      struct inode *inode;
+
+      if (!dir_readdir_inode (d->dir, ent.name, &inode))
+        break;
+      if (inode == NULL)
+        continue;
+      filesys_stat_inode (inode, &st);
+      inode_close (inode);
+      ent.st = to_user_stat (&st);
+      copy_out (uents + i++, &ent, sizeof ent);
+    }
+  release_fd ();
+  return i;
+}
+
+/* Stat system call.  Stores what there is to know about the file
+   named UFILE in UST, without opening it.  Returns true if
+   successful, false if there is no such file. */
+static int
+sys_stat (const char *ufile, void *ust)
+{
+  char *kfile = copy_in_string (ufile);
+  struct filesys_stat st;
+  bool found = filesys_stat (kfile, &st);
+
+  palloc_free_page (kfile);
+  if (found)
+    {
+      struct user_stat kst = to_user_stat (&st);
+      copy_out (ust, &kst, sizeof kst);
+    }
+  return found;
+}
+
+/* Batched I/O.
+
+   These calls let a process move data through several buffers,
+   or run several file operations, for the cost of one trap into
+   the kernel.  The structures below must match struct iovec and
+   struct batch_op in lib/user/syscall.h. */
+
+/* A buffer for readv() or writev(). */
+struct user_iovec
+  {
+    void *base;                 /* Start of buffer. */
+    size_t len;                 /* Length in bytes. */
+  };
+
+/* An operation for batch(). */
+struct user_batch_op
+  {
+    int op;                     /* BATCH_READ, BATCH_WRITE, BATCH_SEEK. */
+    int fd;                     /* File descriptor. */
+    void *buf;                  /* Buffer. */
+    unsigned len;               /* Length of BUF, or seek position. */
+    int result;                 /* Return value of the operation. */
+  };
+
+/* Operation codes for batch(), as in lib/user/syscall.h. */
+enum { BATCH_READ, BATCH_WRITE, BATCH_SEEK };
+
+/* Reads or writes, according to WRITE, the IOV_CNT buffers
+   described by the user array UIOV through HANDLE.  Stops early
+   after a short transfer or a failed one.  Returns the number of
+   bytes transferred, or -1 if the first transfer failed. */
+static int
+transfer_iov (int handle, const struct user_iovec *uiov, int iov_cnt,
+              bool write)
+{
+  int total = 0;
+  int i;
+
+  for (i = 0; i < iov_cnt; i++)
+    {
+      struct user_iovec iov;
+      int cnt;
+
+      copy_in (&iov, uiov + i, sizeof iov);
+      cnt = (write
+             ? sys_write (handle, iov.base, iov.len)
+             : sys_read (handle, iov.base, iov.len));
+      if (cnt < 0)
+        return total > 0 ? total : -1;
+      total += cnt;
+      if ((size_t) cnt < iov.len)
+        break;
+    }
+  return total;
+}
+
+/* Readv system call. */
+static int
+sys_readv (int handle, const void *uiov, int iov_cnt)
+{
+  return transfer_iov (handle, uiov, iov_cnt, false);
+}
+
+/* Writev system call. */
+static int
+sys_writev (int handle, const void *uiov, int iov_cnt)
+{
+  return transfer_iov (handle, uiov, iov_cnt, true);
+}
+
+/* Batch system call.  Runs the OP_CNT operations in the user
+   array UOPS in order, storing each one's return value in its
+   RESULT member.  Returns the number of operations run. */
+static int
+sys_batch (void *uops_, int op_cnt)
+{
+  struct user_batch_op *uops = uops_;
+  int i;
+
+  for (i = 0; i < op_cnt; i++)
+    {
+      struct user_batch_op op;
+      int result;
+
+      copy_in (&op, uops + i, sizeof op);
+      switch (op.op)
+        {
+        case BATCH_READ:
+          result = sys_read (op.fd, op.buf, op.len);
+          break;
+        case BATCH_WRITE:
+          result = sys_write (op.fd, op.buf, op.len);
+          break;
+        case BATCH_SEEK:
+          result = sys_seek (op.fd, op.len);
+          break;
+        default:
+          result = -1;
+          break;
+        }
+      copy_out (&uops[i].result, &result, sizeof result);
+    }
+  return op_cnt > 0 ? op_cnt : 0;
+}
+
+/* Faultstat system call.  Copies the current process's page
+   fault counts, which are kept in enum fault_type order, the
+   order of the members of struct fault_stats in
+   lib/user/syscall.h, to USTATS.  Without virtual memory there
+   are no counts to report, so it fails. */
+static int
+sys_faultstat (void *ustats UNUSED)
+{
+#ifdef VM
+  const unsigned *cnt = thread_current ()->fault_cnt;
+
+  copy_out (ustats, cnt, sizeof *cnt * FAULT_TYPE_CNT);
+  return true;
+#else
+  return false;
+#endif
+}
+
+/* Clock system call.  Stores the number of nanoseconds since
+   boot, as a 64-bit integer, to UNS.  The clock counts CPU
+   cycles, so it has much finer resolution than timer ticks. */
+static int
+sys_clock (void *uns)
+{
+  int64_t ns = timer_ns ();
+
+  copy_out (uns, &ns, sizeof ns);
+  return 0;
+}
+
+/* Setpriority system call.  Sets the calling thread's priority
+   to PRIORITY, which must be between PRI_MIN and PRI_MAX.  Under
+   the MLFQS, priorities follow from nice values and CPU usage
+   instead, so it fails. */
+static bool
+sys_setpriority (int priority)
+{
+  if (thread_mlfqs || priority < PRI_MIN || priority > PRI_MAX)
+    return false;
+  thread_set_priority (priority);
+  return true;
+}
+
+/* Getpriority system call.  Returns the calling thread's
+   priority, including any donated to it. */
+static int
+sys_getpriority (void)
+{
+  return thread_get_priority ();
+}
+
+/* Nice system call.  Adds INCREMENT to the calling thread's nice
+   value, limited to NICE_MIN...NICE_MAX, and returns the new
+   value.  The MLFQS and the fair scheduler both heed it; the
+   priority scheduler does not. */
+static int
+sys_nice (int increment)
+{
+  int nice = thread_get_nice ();
+
+  if (increment < NICE_MIN - nice)
+    nice = NICE_MIN;
+  else if (increment > NICE_MAX - nice)
+    nice = NICE_MAX;
+  else
+    nice += increment;
+  thread_set_nice (nice);
+  return nice;
+}
+
+/* What getrusage() reports.  Must match struct rusage in
+   lib/user/syscall.h. */
+struct user_rusage
+  {
+    int64_t user_ns;            /* CPU time in user mode. */
+    int64_t kernel_ns;          /* CPU time in the kernel. */
+    unsigned faults;            /* Page faults. */
+    unsigned sectors_read;      /* Block sectors read. */
+    unsigned sectors_written;   /* Block sectors written. */
+  };
+
+/* Whose usage, as in lib/user/syscall.h. */
+enum { RUSAGE_SELF, RUSAGE_THREAD };
+
+/* Getrusage system call.  Copies the resources used by the
+   calling process (RUSAGE_SELF) or thread (RUSAGE_THREAD) to
+   UUSAGE.  Fails for any other WHO. */
+static int
+sys_getrusage (int who, void *uusage)
+{
+  struct thread_usage u;
+  struct user_rusage ku;
+
+  if (who == RUSAGE_SELF)
+    process_get_usage (&u);
+  else if (who == RUSAGE_THREAD)
+    {
+      thread_charge_kernel ();
+      u = thread_current ()->usage;
+    }
+  else
+    return false;
+
+  ku.user_ns = timer_cycles_to_ns (u.user_cycles);
+  ku.kernel_ns = timer_cycles_to_ns (u.kernel_cycles);
+  ku.faults = u.faults;
+  ku.sectors_read = u.sectors_read;
+  ku.sectors_written = u.sectors_written;
+  copy_out (uusage, &ku, sizeof ku);
+  return true;
+}
+
+/* Asynchronous I/O.
+
+   aio_submit() hands a transfer to one of AIO_WORKER_CNT kernel
+   threads, which read or write the file through the buffer cache
+   and the elevator while the submitter goes on running.  The
+   worker transfers to and from a kernel bounce buffer, not the
+   user buffer: user pages cannot stay pinned in their frames
+   while the process runs, since the frame locks that pin them
+   belong to the submitting thread.  So data to write is copied
+   in at submission, and data read is copied out by the thread
+   that reaps the transfer with aio_wait() or aio_poll(). */
+
+/* Number of worker threads. */
+#define AIO_WORKER_CNT 4
+
+/* Most bytes one transfer moves; a longer one is cut short. */
+#define AIO_LENGTH_MAX (8 * PGSIZE)
+
+/* Most transfers a process may have not yet reaped. */
+#define AIO_MAX 4
+
+/* What aio_submit() takes.  Must match struct aiocb in
+   lib/user/syscall.h. */
+struct user_aiocb
+  {
+    int fd;                     /* File descriptor. */
+    void *buffer;               /* User buffer. */
+    unsigned length;            /* Bytes to transfer. */
+    unsigned offset;            /* Offset in the file. */
+    int op;                     /* AIO_READ or AIO_WRITE. */
+  };
+
+/* Transfers and results, as in lib/user/syscall.h. */
+enum { AIO_READ, AIO_WRITE };
+#define AIO_PENDING (-2)
+
+/* An asynchronous transfer. */
+struct aio
+  {
+    struct list_elem elem;      /* In the process's AIOS list. */
+    int id;                     /* Id returned by aio_submit(). */
+    bool reaping;               /* Claimed by a thread reaping it? */
+    struct work work;           /* Runs the transfer. */
+    struct file *file;          /* Our own opening of the file. */
+    off_t ofs;                  /* Offset in the file. */
+    uint8_t *ubuf;              /* User buffer. */
+    size_t length;              /* Bytes to transfer. */
+    bool write;                 /* Write, not read? */
+    uint8_t *buffer;            /* Bounce buffer, LENGTH bytes. */
+    int result;                 /* Bytes transferred, once done. */
+    struct completion done;     /* Completed when RESULT is set. */
+  };
+
+static struct workqueue aio_wq;
+
+/* Starts the threads that serve asynchronous I/O.  Called once
+   the scheduler has started. */
+void
+syscall_start (void)
+{
+  workqueue_init (&aio_wq, "aio", AIO_WORKER_CNT, PRI_DEFAULT);
+}
+
+/* Runs transfer AIO_ in a worker thread. */
+static void
+aio_run (void *aio_)
+{
+  struct aio *aio = aio_;
+
+  if (aio->write)
+    aio->result = file_write_at (aio->file, aio->buffer, aio->length,
+                                 aio->ofs);
+  else
+    aio->result = file_read_at (aio->file, aio->buffer, aio->length,
+                                aio->ofs);
+  completion_complete_all (&aio->done);
+}
+
+/* Frees AIO, which must not be queued or running. */
+static void
+aio_discard (struct aio *aio)
+{
+  file_close (aio->file);
+  if (aio->buffer != NULL)
+    palloc_free_multiple (aio->buffer, DIV_ROUND_UP (aio->length, PGSIZE));
+  free (aio);
+}
+
+/* Waits for AIO to finish and frees it.  It must already be off
+   its process's list. */
+static void
+aio_free (struct aio *aio)
+{
+  completion_wait (&aio->done);
+  aio_discard (aio);
+}
+
+/* Waits for, and frees, every transfer the current process has
+   not reaped.  Called by the last thread of the process to
+   exit. */
+static void
+aio_exit (void)
+{
+  struct process *proc = thread_current ()->process;
+
+  while (!list_empty (&proc->aios))
+    aio_free (list_entry (list_pop_front (&proc->aios), struct aio, elem));
+}
+
+/* Aio_submit system call.  Returns the new transfer's id, or -1
+   if the descriptor is not a file, the transfer is not valid, the
+   process has AIO_MAX transfers in flight, or memory is
+   exhausted. */
+static int
+sys_aio_submit (const void *ucb)
+{
+  struct process *proc = thread_current ()->process;
+  struct user_aiocb cb;
+  struct file *file;
+  struct aio *aio;
+  size_t i;
+
+  copy_in (&cb, ucb, sizeof cb);
+  if ((cb.op != AIO_READ && cb.op != AIO_WRITE) || cb.offset > INT_MAX)
+    return -1;
+  if (cb.length > AIO_LENGTH_MAX)
+    cb.length = AIO_LENGTH_MAX;
+
+  file = lookup_file (cb.fd);
+  if (file != NULL)
+    file = file_reopen (file);
+  release_fd ();
+  if (file == NULL)
+    return -1;
+
+  aio = malloc (sizeof *aio);
+  if (aio == NULL)
+    {
+      file_close (file);
+      return -1;
+    }
+  aio->reaping = false;
+  aio->file = file;
+  aio->ofs = cb.offset;
+  aio->ubuf = cb.buffer;
+  aio->length = cb.length;
+  aio->write = cb.op == AIO_WRITE;
+  aio->buffer = NULL;
+  completion_init (&aio->done);
+  work_init (&aio->work, aio_run, aio);
+  if (aio->length > 0)
+    {
+      aio->buffer = palloc_get_multiple (0, DIV_ROUND_UP (aio->length,
+                                                          PGSIZE));
+      if (aio->buffer == NULL)
+        {
+          aio->length = 0;
+          aio_discard (aio);
+          return -1;
+        }
+    }
+
+  /* Not copy_in(), which would leave AIO behind if it killed the
+     process. */
+  for (i = 0; aio->write && i < aio->length; i++)
+    {
+      const uint8_t *p = aio->ubuf + i;
+      int c;
+
+      if (!is_user_vaddr (p) || (c = get_user (p)) == -1)
+        {
+          aio_discard (aio);
+          sys_exit (-1);
+        }
+      aio->buffer[i] = c;
+    }
+
+  lock_acquire (&proc->fd_lock);
+  if (list_size (&proc->aios) >= AIO_MAX)
+    {
+      lock_release (&proc->fd_lock);
+      aio_discard (aio);
+      return -1;
+    }
+  aio->id = proc->next_aio_id++;
+  if (proc->next_aio_id < 0)
+    proc->next_aio_id = 0;
+  list_push_back (&proc->aios, &aio->elem);
+  lock_release (&proc->fd_lock);
+
+  work_queue (&aio_wq, &aio->work);
+  return aio->id;
+}
+
+/* Reaps transfer ID of the current process, first waiting for
+   it to finish if WAIT is true.  Returns the number of bytes
+   transferred, AIO_PENDING if WAIT is false and the transfer is
+   not done, or -1 if there is no such transfer. */
+static int
+aio_reap (int id, bool wait)
+{
+  struct process *proc = thread_current ()->process;
+  struct list_elem *e;
+  struct aio *aio = NULL;
+  int result = -1;
+
+  lock_acquire (&proc->fd_lock);
+  for (e = list_begin (&proc->aios); e != list_end (&proc->aios);
+       e = list_next (e))
+    {
+      struct aio *a = list_entry (e, struct aio, elem);
+      if (a->id == id && !a->reaping)
+        {
+          if (wait || completion_done (&a->done))
+            {
+              a->reaping = true;
+              aio = a;
+            }
+          else
+            result = AIO_PENDING;
+          break;
+        }
+    }
+  lock_release (&proc->fd_lock);
+  if (aio == NULL)
+    return result;
+
+  /* Stays on the list while the data is copied out, so that if
+     the copy kills the process, aio_exit() frees it. */
+  completion_wait (&aio->done);
+  result = aio->result;
+  if (!aio->write && result > 0)
+    copy_out (aio->ubuf, aio->buffer, result);
+
+  lock_acquire (&proc->fd_lock);
+  list_remove (&aio->elem);
+  lock_release (&proc->fd_lock);
+  aio_free (aio);
+  return result;
+}
+
+/* Aio_wait system call. */
+static int
+sys_aio_wait (int id)
+{
+  return aio_reap (id, true);
+}
+
+/* Aio_poll system call. */
+static int
+sys_aio_poll (int id)
+{
+  return aio_reap (id, false);
+}
+
+/* Most descriptors one poll() may wait for. */
+#define POLL_FD_MAX 32
+
+/* What poll() takes.  Must match struct pollfd in
+   lib/user/syscall.h. */
+struct user_pollfd
+  {
+    int fd;                     /* File descriptor. */
+    short events;               /* POLL* events to wait for. */
+    short revents;              /* POLL* events that happened. */
+  };
+
+/* A descriptor being polled. */
+struct poll_fd
+  {
+    bool valid;                 /* Open when poll() started? */
+    enum fd_type type;          /* Kind of descriptor, if VALID. */
+    struct pipe *pipe;          /* FD_PIPE_*: our reference to it. */
+    struct poll_entry entry;    /* On the object's poll queue. */
+  };
+
+/* Returns the readiness of PF, as POLL* bits, putting its entry
+   on the object's poll queue if it has one. */
+static unsigned
+poll_fd_check (struct poll_fd *pf)
+{
+  if (!pf->valid)
+    return POLLNVAL;
+  switch (pf->type)
+    {
+    case FD_CONSOLE_IN:
+      return input_poll (&pf->entry);
+    case FD_PIPE_READ:
+      return pipe_poll (pf->pipe, false, &pf->entry);
+    case FD_PIPE_WRITE:
+      return pipe_poll (pf->pipe, true, &pf->entry);
+    case FD_CONSOLE_OUT:
+      return POLLOUT;
+    case FD_DIR:
+      return POLLIN;
+    default:
+      return POLLIN | POLLOUT;
+    }
+}
+
+/* Poll system call.  Waits until one of the NFDS descriptors in
+   UFDS is ready for the events it asks for, or for TIMEOUT timer
+   ticks if TIMEOUT is nonnegative, and stores each descriptor's
+   events in its REVENTS.  Returns the number of descriptors with
+   events, 0 if the time ran out, or -1 if NFDS is too large or
+   memory is exhausted. */
+static int
+sys_poll (void *ufds, unsigned nfds, int timeout)
+{
+  struct process *proc = thread_current ()->process;
+  int64_t deadline = timeout < 0 ? -1 : timer_ticks () + timeout;
+  struct user_pollfd u[POLL_FD_MAX];
+  struct poll_fd *fds = NULL;
+  struct poller poller;
+  bool timed_out = false;
+  int ready_cnt;
+  unsigned i;
+
+  if (nfds > POLL_FD_MAX)
+    return -1;
+  copy_in (u, ufds, nfds * sizeof *u);
+  if (nfds > 0 && (fds = malloc (nfds * sizeof *fds)) == NULL)
+    return -1;
+
+  /* Pipes are referenced, so that another thread closing their
+     descriptors cannot free them while we wait. */
+  poller_init (&poller);
+  lock_acquire (&proc->fd_lock);
+  for (i = 0; i < nfds; i++)
+    {
+      struct poll_fd *pf = &fds[i];
+      struct descriptor *d = find_fd (proc, u[i].fd);
+
+      pf->valid = d != NULL;
+      pf->type = d != NULL ? d->type : FD_FILE;
+      pf->pipe = NULL;
+      if (d != NULL && (d->type == FD_PIPE_READ || d->type == FD_PIPE_WRITE))
+        {
+          pf->pipe = d->pipe;
+          pipe_open (pf->pipe, d->type == FD_PIPE_WRITE);
+        }
+      poll_entry_init (&pf->entry, &poller);
+    }
+  lock_release (&proc->fd_lock);
+
+  for (;;)
+    {
+      ready_cnt = 0;
+      for (i = 0; i < nfds; i++)
+        {
+          u[i].revents = (poll_fd_check (&fds[i])
+                          & (u[i].events | POLLHUP | POLLNVAL));
+          if (u[i].revents != 0)
+            ready_cnt++;
+        }
+      if (ready_cnt > 0 || timeout == 0 || timed_out)
+        break;
+      timed_out = !poller_wait (&poller, deadline);
+    }
+
+  for (i = 0; i < nfds; i++)
+    {
+      poll_entry_remove (&fds[i].entry);
+      if (fds[i].pipe != NULL)
+        pipe_close (fds[i].pipe, fds[i].type == FD_PIPE_WRITE);
+    }
+  free (fds);
+
+  copy_out (ufds, u, nfds * sizeof *u);
+  return ready_cnt;
+}
+
+/* Returns the futex bucket for the word at user address UADDR
+   in the current process. */
+static struct futex_bucket *
+futex_bucket (const int *uaddr)
+{
+  unsigned hash = (hash_ptr (uaddr)
+                   ^ hash_ptr (thread_current ()->pagedir));
+  return &futex_buckets[hash % FUTEX_BUCKET_CNT];
+}
+
+/* Returns the futex for the word at user address UADDR in the
+   current process, which must be in bucket B, or a null pointer
+   if no thread waits on it.  B's lock must be held. */
+static struct futex *
+futex_lookup (struct futex_bucket *b, const int *uaddr)
+{
+  uint32_t *pd = thread_current ()->pagedir;
+  struct list_elem *e;
+
+  ASSERT (lock_held_by_current_thread (&b->lock));
+
+  for (e = list_begin (&b->futexes); e != list_end (&b->futexes);
+       e = list_next (e))
+    {
+      struct futex *f = list_entry (e, struct futex, elem);
+      if (f->uaddr == uaddr && f->pagedir == pd)
+        return f;
+    }
+  return NULL;
+}
+
+/* Checks that UADDR is a valid, aligned user address for a futex
+   word.  Terminates the process if not. */
+static void
+check_futex_addr (const int *uaddr)
+{
+  if ((uintptr_t) uaddr % sizeof *uaddr != 0)
+    sys_exit (-1);
+  lock_user_range (uaddr, sizeof *uaddr, false);
+  unlock_user_range (uaddr, sizeof *uaddr);
+}
+
+/* Futex wait system call.  If the int at UADDR is EXPECTED,
+   sleeps until another thread wakes it with futex_wake() on the
+   same address and returns 0.  Otherwise returns -1 at once,
+   because the word has changed since the caller looked at it. */
+static int
+sys_futex_wait (const int *uaddr, int expected)
+{
+  struct futex_bucket *b;
+  struct futex *f;
+  int value;
+
+  check_futex_addr (uaddr);
+  b = futex_bucket (uaddr);
+  lock_acquire (&b->lock);
+
+  /* The page may have been evicted or unmapped since the check,
+     so the load may page fault. */
+  if (!get_user_int (uaddr, &value) || value != expected)
+    {
+      lock_release (&b->lock);
+      return -1;
+    }
+
+  f = futex_lookup (b, uaddr);
+  if (f == NULL)
+    {
+      f = malloc (sizeof *f);
+      if (f == NULL)
+        {
+          lock_release (&b->lock);
+          return -1;
+        }
+      f->pagedir = thread_current ()->pagedir;
+      f->uaddr = uaddr;
+      cond_init (&f->waiters);
+      f->waiter_cnt = 0;
+      f->user_cnt = 0;
+      list_push_back (&b->futexes, &f->elem);
+    }
+
+  f->waiter_cnt++;
+  f->user_cnt++;
+  cond_wait (&f->waiters, &b->lock);
+  if (--f->user_cnt == 0)
+    {
+      list_remove (&f->elem);
+      free (f);
+    }
+  lock_release (&b->lock);
+  return 0;
+}
+
+/* Futex wake system call.  Wakes up to CNT of the threads waiting
+   on the int at UADDR, highest priority first, and returns the
+   number woken. */
+static int
+sys_futex_wake (const int *uaddr, int cnt)
+{
+  struct futex_bucket *b;
+  struct futex *f;
+  int woken = 0;
+
+  check_futex_addr (uaddr);
+  b = futex_bucket (uaddr);
+  lock_acquire (&b->lock);
+  f = futex_lookup (b, uaddr);
+  if (f != NULL)
+    for (; woken < cnt && f->waiter_cnt > 0; woken++)
+      {
+        f->waiter_cnt--;
+        cond_signal (&f->waiters, &b->lock);
+      }
+  lock_release (&b->lock);
+  return woken;
+}
+
+/* Wakes every thread of the current process that is waiting on a
+   futex, so that it can exit along with the process. */
+void
+syscall_wake_futexes (void)
+{
+  uint32_t *pd = thread_current ()->pagedir;
+  size_t i;
+
+  for (i = 0; i < FUTEX_BUCKET_CNT; i++)
+    {
+      struct futex_bucket *b = &futex_buckets[i];
+      struct list_elem *e;
+
+      lock_acquire (&b->lock);
+      for (e = list_begin (&b->futexes); e != list_end (&b->futexes);
+           e = list_next (e))
+        {
+          struct futex *f = list_entry (e, struct futex, elem);
+          if (f->pagedir == pd)
+            {
+              f->waiter_cnt = 0;
+              cond_broadcast (&f->waiters, &b->lock);
+            }
+        }
+      lock_release (&b->lock);
+    }
+}
+
+/* Thread create system call.  Starts a new thread in the current
+   process that calls ENTRY (FUNC, AUX).  Returns its thread id,
+   or -1 on failure. */
+static int
+sys_thread_create (void (*entry) (void), void *func, void *aux)
+{
+  if (!is_user_vaddr (entry))
+    return TID_ERROR;
+  return process_thread_create (entry, func, aux);
+}
+
+/* Thread join system call. */
+static int
+sys_thread_join (tid_t tid)
+{
+  return process_thread_join (tid);
+}
+
+/* Thread exit system call.  Exits the current thread, or the
+   process with exit code 0 if no other thread is left. */
+static int
+sys_thread_exit (void)
 {
-  printf ("system call!\n");
+  thread_current ()->exit_code = 0;
   thread_exit ();
 }
@@ -1,6 +1,29 @@
 #ifndef USERPROG_SYSCALL_H
 #define USERPROG_SYSCALL_H
 
+#include <stdbool.h>
+#include <stddef.h>
+
+struct process;
+
+/* Something to do to the descriptors of a new process, which
+   has inherited descriptors 0 and 1 of its parent, before its
+   program is loaded: close its descriptor FD or, if not CLOSE,
+   make its descriptor NEW_FD a copy of its parent's FD. */
+struct fd_action
+  {
+    bool close;                 /* Close FD instead of copying it? */
+    int fd;                     /* Parent's descriptor, or child's. */
+    int new_fd;                 /* Child's descriptor to copy FD to. */
+  };
+
 void syscall_init (void);
+void syscall_start (void);
+void syscall_exit (void);
+bool syscall_inherit_fds (struct process *parent,
+                          const struct fd_action *, size_t action_cnt);
+bool syscall_fork_fds (struct process *parent);
+void syscall_wake_futexes (void);
+int syscall_sysenter (void *user_esp);
 
 #endif /* userprog/syscall.h */
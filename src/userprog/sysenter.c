@@ -0,0 +1,67 @@
+#include "userprog/sysenter.h"
+#include <stdint.h>
+#include "threads/loader.h"
+#include "userprog/tss.h"
+
+/* Fast system calls.
+
+   A system call by int $0x30 goes through the IDT, pushes and
+   pops a full `struct intr_frame', and returns by IRET, each of
+   which is slow.  SYSENTER and SYSEXIT switch between user and
+   kernel mode with fixed selectors and without touching memory,
+   leaving the kernel to save only what it needs.  User programs
+   use them when the kernel info page says so, and int $0x30
+   otherwise; the kernel accepts both.  See sysenter-entry.S. */
+
+/* SYSENTER model-specific registers. */
+#define MSR_SYSENTER_CS  0x174  /* Kernel code selector. */
+#define MSR_SYSENTER_ESP 0x175  /* Kernel stack pointer. */
+#define MSR_SYSENTER_EIP 0x176  /* Kernel entry point. */
+
+/* CPUID feature flag for SYSENTER and SYSEXIT. */
+#define CPUID_SEP (1 << 11)
+
+void sysenter_entry (void);
+
+/* True if SYSENTER has been set up. */
+static bool enabled;
+
+/* Writes VALUE to model-specific register MSR. */
+static inline void
+wrmsr (uint32_t msr, uint32_t value)
+{
+  asm volatile ("wrmsr" : : "c" (msr), "a" (value), "d" (0));
+}
+
+/* Sets up SYSENTER on the running processor, if it supports it.
+   Must be called on each processor, after tss_init() or
+   tss_init_ap() has given that processor its TSS, whose ring 0
+   stack pointer SYSENTER_ESP points to.
+
+   SYSENTER takes the kernel code selector from the SYSENTER_CS
+   MSR and the kernel stack selector from the next GDT entry, and
+   SYSEXIT takes the user code and stack selectors from the two
+   after that, which is just the order in which the GDT has
+   them. */
+void
+sysenter_init (void)
+{
+  uint32_t eax = 1, ebx, ecx, edx;
+
+  asm ("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+  if (!(edx & CPUID_SEP))
+    return;
+
+  wrmsr (MSR_SYSENTER_CS, SEL_KCSEG);
+  wrmsr (MSR_SYSENTER_ESP, (uint32_t) tss_esp0 ());
+  wrmsr (MSR_SYSENTER_EIP, (uint32_t) sysenter_entry);
+  enabled = true;
+}
+
+/* Returns true if user programs may enter the kernel by
+   SYSENTER. */
+bool
+sysenter_enabled (void)
+{
+  return enabled;
+}
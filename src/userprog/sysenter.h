@@ -0,0 +1,9 @@
+#ifndef USERPROG_SYSENTER_H
+#define USERPROG_SYSENTER_H
+
+#include <stdbool.h>
+
+void sysenter_init (void);
+bool sysenter_enabled (void);
+
+#endif /* userprog/sysenter.h */
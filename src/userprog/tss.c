@@ -2,6 +2,10 @@
 #include <debug.h>
 #include <stddef.h>
 #include "userprog/gdt.h"
+#include "threads/cpu.h"
+#include "threads/flags.h"
+#include "threads/init.h"
+#include "threads/pte.h"
 #include "threads/thread.h"
 #include "threads/palloc.h"
 #include "threads/vaddr.h"
@@ -72,35 +76,173 @@ struct tss
     uint16_t trace, bitmap;
   };
 
-/* Kernel TSS. */
-static struct tss *tss;
+/* Each processor has a kernel TSS of its own, and a double fault
+   TSS, both pointed to by its struct cpu. */
 
-/* Initializes the kernel TSS. */
-void
-tss_init (void) 
+/* Double faults.
+
+   When a kernel stack overflows into the guard page below a
+   guarded stack (see thread.c), the page fault cannot be
+   delivered, because the CPU pushes its interrupt frame onto the
+   same stack.  That makes it a double fault, and delivering the
+   double fault through an interrupt gate would fault a third
+   time and reset the machine.  So double faults go through a
+   task gate to a task of their own, described by DF_TSS, which
+   runs double_fault_task() on a stack of its own.
+
+   The task switch saves the faulting context in the kernel TSS.
+   For a stack overflow, double_fault_task() maps the guard page
+   and points the saved context at stack_overflow_panic(), with
+   the guard page as its stack, then returns to it, so that the
+   panic message and backtrace come from the thread that
+   overflowed.  The double fault task's stack is not a thread's,
+   so cpu_current() does not work on it; instead its processor is
+   passed to it as an argument. */
+static void double_fault_task (struct cpu *) NO_RETURN;
+static void stack_overflow_panic (void) NO_RETURN;
+static void double_fault_panic (void) NO_RETURN;
+
+/* Creates the kernel and double fault TSSes for processor C.
+   Returns false if memory runs out. */
+static bool
+create (struct cpu *c, enum palloc_flags flags)
 {
+  struct tss *tss, *df_tss;
+  uint8_t *df_stack;
+
+  tss = palloc_get_page (flags | PAL_ZERO);
+  df_tss = palloc_get_page (flags | PAL_ZERO);
+  df_stack = palloc_get_page (flags);
+  if (tss == NULL || df_tss == NULL || df_stack == NULL)
+    {
+      palloc_free_page (tss);
+      palloc_free_page (df_tss);
+      palloc_free_page (df_stack);
+      return false;
+    }
+
   /* Our TSS is never used in a call gate or task gate, so only a
      few fields of it are ever referenced, and those are the only
      ones we initialize. */
-  tss = palloc_get_page (PAL_ASSERT | PAL_ZERO);
   tss->ss0 = SEL_KDSEG;
   tss->bitmap = 0xdfff;
+
+  /* Pass C to double_fault_task() above a null return address. */
+  *(struct cpu **) (df_stack + PGSIZE - 4) = c;
+  df_tss->cr3 = vtop (init_page_dir);
+  df_tss->eip = (void (*) (void)) double_fault_task;
+  df_tss->eflags = 0x00000002;          /* Interrupts off. */
+  df_tss->esp = (uint32_t) (df_stack + PGSIZE - 8);
+  df_tss->cs = SEL_KCSEG;
+  df_tss->ss = df_tss->ds = df_tss->es = SEL_KDSEG;
+  df_tss->bitmap = 0xdfff;
+
+  c->tss = tss;
+  c->df_tss = df_tss;
+  return true;
+}
+
+/* Initializes the bootstrap processor's TSSes. */
+void
+tss_init (void) 
+{
+  create (&cpus[0], PAL_ASSERT);
   tss_update ();
 }
 
-/* Returns the kernel TSS. */
+/* Initializes application processor C's TSSes.  Returns false if
+   memory runs out. */
+bool
+tss_init_ap (struct cpu *c)
+{
+  if (!create (c, 0))
+    return false;
+  c->tss->esp0 = c->idle_thread->stack_top;
+  return true;
+}
+
+/* Returns the running processor's kernel TSS. */
 struct tss *
 tss_get (void) 
 {
+  struct tss *tss = cpu_current ()->tss;
+
   ASSERT (tss != NULL);
   return tss;
 }
 
-/* Sets the ring 0 stack pointer in the TSS to point to the end
-   of the thread stack. */
+/* Returns the running processor's double fault task's TSS. */
+struct tss *
+tss_get_double_fault (void) 
+{
+  struct tss *df_tss = cpu_current ()->df_tss;
+
+  ASSERT (df_tss != NULL);
+  return df_tss;
+}
+
+/* Sets the ring 0 stack pointer in the running processor's TSS
+   to point to the end of the thread stack. */
 void
 tss_update (void) 
 {
-  ASSERT (tss != NULL);
-  tss->esp0 = (uint8_t *) thread_current () + PGSIZE;
+  tss_get ()->esp0 = thread_current ()->stack_top;
+}
+
+/* Returns the address of the running processor's kernel TSS's
+   ring 0 stack pointer, which always points to the top of the
+   running thread's kernel stack. */
+void **
+tss_esp0 (void)
+{
+  return &tss_get ()->esp0;
+}
+
+/* Entry point of the double fault task of processor C.  Each
+   double fault switches here, or back into the loop after the
+   IRET, with interrupts off. */
+static void
+double_fault_task (struct cpu *c) 
+{
+  for (;;) 
+    {
+      struct tss *tss = c->tss;
+      uint8_t *fault_addr;
+
+      asm ("movl %%cr2, %0" : "=r" (fault_addr));
+      if (thread_kstack_is_guard (fault_addr)) 
+        {
+          uint8_t *guard = pg_round_down (fault_addr);
+          uint32_t *pt = pde_get_pt (init_page_dir[pd_no (guard)]);
+
+          pt[pt_no (guard)] = pte_create_kernel (guard, true);
+          tss->eip = stack_overflow_panic;
+          tss->esp = (uint32_t) (guard + PGSIZE);
+        }
+      else
+        tss->eip = double_fault_panic;
+
+      /* The CPU does not save CR3 when it leaves a task, so give
+         the faulting task the kernel's page directory. */
+      tss->cr3 = vtop (init_page_dir);
+      tss->eflags &= ~FLAG_IF;
+
+      /* Return to the faulting task. */
+      asm volatile ("iret" : : : "memory");
+    }
+}
+
+/* Runs in the thread whose kernel stack overflowed, on its guard
+   page. */
+static void
+stack_overflow_panic (void) 
+{
+  PANIC ("kernel stack overflow in thread %s", thread_name ());
+}
+
+/* Runs in the context of any other double fault. */
+static void
+double_fault_panic (void) 
+{
+  PANIC ("double fault in thread %s", thread_name ());
 }
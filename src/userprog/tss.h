@@ -1,11 +1,16 @@
 #ifndef USERPROG_TSS_H
 #define USERPROG_TSS_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
+struct cpu;
 struct tss;
 void tss_init (void);
+bool tss_init_ap (struct cpu *);
 struct tss *tss_get (void);
+struct tss *tss_get_double_fault (void);
 void tss_update (void);
+void **tss_esp0 (void);
 
 #endif /* userprog/tss.h */
@@ -0,0 +1,273 @@
+#include "vm/evict.h"
+#include <debug.h>
+#include <list.h>
+#include "vm/frame.h"
+
+/* Page-replacement policies.
+
+   None of them sees individual accesses: the hardware only sets
+   each page's accessed bit, which frame_accessed_recently() tests
+   and clears for all of a frame's pages at once.
+
+   "clock" is the second chance algorithm: one hand sweeps the
+   frame table, evicting the first frame not accessed since the
+   hand last passed it and clearing the bits of the rest.
+
+   "clock2" is the two-handed clock.  A front hand, a quarter of
+   the table ahead of the back hand, clears accessed bits, and
+   the back hand evicts the first frame whose bits are still
+   clear.  A frame then has only the time it takes the hands to
+   move a quarter of the table to be accessed again, not a whole
+   sweep, so a large memory is scanned less per eviction.
+
+   "2q" keeps two queues.  A frame starts at the back of the cold
+   queue, A1.  One that reaches the front of A1 without having
+   been accessed is evicted; one that was accessed moves to the
+   back of the hot queue, Am, which is itself run as a clock.  A
+   frame is thus evicted quickly if it was only ever used once,
+   as in a sequential scan, without pushing out data used again
+   and again.  Am is taken from only while A1 holds no more than
+   A1_SHARE of the frames.  This is the simplified 2Q, without
+   the ghost queue of recently evicted pages.
+
+   "aging" keeps an 8-bit counter per frame.  Each cleaner pass
+   shifts it right and sets its top bit if the frame was accessed
+   since the last pass, and the frame with the smallest counter,
+   used least in the recent passes, is evicted.  That is close to
+   LRU, at the cost of a scan of the table per eviction. */
+
+/* Returns the index of F in the frame table. */
+static size_t
+frame_index (struct frame *f)
+{
+  return f - frame_table_entry (0);
+}
+
+/* Second chance. */
+
+static size_t hand;
+
+static struct frame *
+clock_choose (bool over_only)
+{
+  size_t cnt = frame_table_size ();
+  size_t i;
+
+  /* Two full sweeps are enough to reach a page whose accessed
+     bit got cleared on the first one. */
+  for (i = 0; i < cnt * 2; i++)
+    {
+      struct frame *f = frame_table_entry (hand);
+      if (++hand >= cnt)
+        hand = 0;
+
+      if (frame_try_victim (f, over_only))
+        {
+          if (!frame_accessed_recently (f))
+            return f;
+          lock_release (&f->lock);
+        }
+    }
+  return NULL;
+}
+
+static struct frame *
+clock_cursor (void)
+{
+  return hand < frame_table_size () ? frame_table_entry (hand) : NULL;
+}
+
+const struct evict_policy evict_clock =
+  {
+    "clock", NULL, NULL, clock_choose, clock_cursor, NULL,
+  };
+
+/* Two-handed clock.  HAND is the back hand. */
+
+static struct frame *
+clock2_choose (bool over_only)
+{
+  size_t cnt = frame_table_size ();
+  size_t spread = cnt / 4;
+  size_t i;
+
+  for (i = 0; i < cnt * 2; i++)
+    {
+      struct frame *front = frame_table_entry ((hand + spread) % cnt);
+      struct frame *f = frame_table_entry (hand);
+      if (++hand >= cnt)
+        hand = 0;
+
+      if (front != f && frame_try_victim (front, false))
+        {
+          frame_accessed_recently (front);
+          lock_release (&front->lock);
+        }
+      if (frame_try_victim (f, over_only))
+        {
+          if (!frame_accessed_recently (f))
+            return f;
+          lock_release (&f->lock);
+        }
+    }
+  return NULL;
+}
+
+const struct evict_policy evict_clock2 =
+  {
+    "clock2", NULL, NULL, clock2_choose, clock_cursor, NULL,
+  };
+
+/* 2Q. */
+
+/* Am is taken from only while A1 holds no more than this share
+   of the frames, in percent. */
+#define A1_SHARE 25
+
+static struct clist a1 = CLIST_INITIALIZER (a1);
+static struct clist am = CLIST_INITIALIZER (am);
+
+static void
+twoq_remove (struct frame *f)
+{
+  clist_remove (f->hot ? &am : &a1, &f->evict_elem);
+  f->evict_elem.prev = NULL;
+}
+
+static void
+twoq_add (struct frame *f)
+{
+  if (f->evict_elem.prev != NULL)
+    twoq_remove (f);
+  f->hot = false;
+  clist_push_back (&a1, &f->evict_elem);
+}
+
+static struct frame *
+twoq_choose (bool over_only)
+{
+  size_t steps = (clist_size (&a1) + clist_size (&am)) * 2;
+  size_t i;
+
+  for (i = 0; i < steps; i++)
+    {
+      size_t a1_cnt = clist_size (&a1), am_cnt = clist_size (&am);
+      bool cold = (a1_cnt * 100 > (a1_cnt + am_cnt) * A1_SHARE
+                   || am_cnt == 0);
+      struct list *q = cold ? &a1.list : &am.list;
+      struct frame *f;
+
+      if (list_empty (q))
+        return NULL;
+      f = list_entry (list_front (q), struct frame, evict_elem);
+
+      if (!frame_try_victim (f, over_only))
+        {
+          /* Busy, or not a candidate this time: look past it. */
+          list_push_back (q, list_pop_front (q));
+          continue;
+        }
+      if (frame_accessed_recently (f))
+        {
+          twoq_remove (f);
+          f->hot = true;
+          clist_push_back (&am, &f->evict_elem);
+          lock_release (&f->lock);
+          continue;
+        }
+      return f;
+    }
+  return NULL;
+}
+
+static struct frame *
+twoq_cursor (void)
+{
+  if (!clist_empty (&a1))
+    return list_entry (list_front (&a1.list), struct frame, evict_elem);
+  return clock_cursor ();
+}
+
+const struct evict_policy evict_2q =
+  {
+    "2q", twoq_add, twoq_remove, twoq_choose, twoq_cursor, NULL,
+  };
+
+/* Aging. */
+
+/* A frame's counter starts out, or is reset to, this value, as
+   if it had just been accessed. */
+#define AGE_FRESH 0x80
+
+/* Most times aging_choose() finds a frame that was accessed since
+   the last pass and gives it credit before settling on another. */
+#define AGE_TRIES 8
+
+static void
+aging_add (struct frame *f)
+{
+  f->age = AGE_FRESH;
+}
+
+static struct frame *
+aging_choose (bool over_only)
+{
+  size_t cnt = frame_table_size ();
+  int try;
+
+  for (try = 0; try < AGE_TRIES; try++)
+    {
+      struct frame *best = NULL;
+      size_t i;
+
+      /* Start where the last scan ended, so that frames of equal
+         age are taken in turn. */
+      for (i = 0; i < cnt; i++)
+        {
+          struct frame *f = frame_table_entry ((hand + i) % cnt);
+
+          if ((best == NULL || f->age < best->age)
+              && frame_try_victim (f, over_only))
+            {
+              if (best != NULL)
+                lock_release (&best->lock);
+              best = f;
+              if (f->age == 0)
+                break;
+            }
+        }
+      if (best == NULL)
+        return NULL;
+      hand = (frame_index (best) + 1) % cnt;
+
+      if (!frame_accessed_recently (best))
+        return best;
+      best->age = (best->age >> 1) | AGE_FRESH;
+      lock_release (&best->lock);
+    }
+  return NULL;
+}
+
+static void
+aging_tick (void)
+{
+  size_t cnt = frame_table_size ();
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    {
+      struct frame *f = frame_table_entry (i);
+
+      if (frame_try_victim (f, false))
+        {
+          f->age = (f->age >> 1) | (frame_accessed_recently (f)
+                                    ? AGE_FRESH : 0);
+          lock_release (&f->lock);
+        }
+    }
+}
+
+const struct evict_policy evict_aging =
+  {
+    "aging", aging_add, NULL, aging_choose, clock_cursor, aging_tick,
+  };
@@ -0,0 +1,54 @@
+#ifndef VM_EVICT_H
+#define VM_EVICT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct frame;
+
+/* A page-replacement policy: the half of eviction that chooses
+   victims.
+
+   frame.c owns the mechanism (the frame table, locking, writing
+   pages out) and asks the policy selected at boot with "-evict"
+   which frame to evict when the page allocator has none to give.
+   Every hook runs with the frame table's scan lock held, so a
+   policy's own state needs no lock of its own. */
+struct evict_policy
+  {
+    const char *name;           /* Name, for "-evict" and statistics. */
+
+    /* Frame F, locked by the current thread, now holds data for
+       which no page has yet had a chance to be accessed: it is
+       new, or reused after evicting its old pages, or it was
+       chosen but could not be evicted.  May be null. */
+    void (*add) (struct frame *f);
+
+    /* Frame F, which has no pages, leaves use.  May be null. */
+    void (*remove) (struct frame *f);
+
+    /* Returns a frame to evict, locked by the current thread
+       with frame_try_victim(), or a null pointer if there is
+       none.  If OVER_ONLY is true, considers only frames of
+       processes over their resident allowance. */
+    struct frame *(*choose) (bool over_only);
+
+    /* Returns the frame that choose() would look at first, or a
+       null pointer, for the cleaner, which cleans frames from
+       there on. */
+    struct frame *(*cursor) (void);
+
+    /* Called every cleaner pass.  May be null. */
+    void (*tick) (void);
+  };
+
+extern const struct evict_policy evict_clock, evict_clock2, evict_2q,
+  evict_aging;
+
+/* For use by policies. */
+size_t frame_table_size (void);
+struct frame *frame_table_entry (size_t);
+bool frame_try_victim (struct frame *, bool over_only);
+bool frame_accessed_recently (struct frame *);
+
+#endif /* vm/evict.h */
@@ -0,0 +1,1032 @@
+#include "vm/frame.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/inode.h"
+#include "threads/init.h"
+#include "threads/loader.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+#include "threads/thread.h"
+#include "vm/evict.h"
+#include "vm/page.h"
+#include "vm/swap.h"
+
+/* Frame table.
+
+   A frame is a page from the user pool, taken when a process
+   page needs memory and given back to the pool as soon as no
+   page uses it, so that the page allocator can lend idle user
+   memory to the kernel, and lend the kernel's to us when the
+   user pool runs out.  FRAMES holds a slot for every page of
+   RAM; a slot that has no memory sits on EMPTY_FRAMES for reuse.
+   When the page allocator has no page for a new frame, a victim
+   is chosen by the replacement policy selected with "-evict"
+   (see evict.c), by default the clock (second chance) algorithm:
+   a hand sweeps FRAMES, giving each page whose accessed bit is
+   set another pass after clearing the bit, and evicts the first
+   one that has not been accessed since the hand last went by.
+   While some process has more resident pages than its allowance
+   (see page.c), the policy first considers only frames of such
+   processes.
+
+   SCAN_LOCK protects EMPTY_FRAMES, FRAME_CNT, and the policy's
+   state.  Each frame's own LOCK is held by whoever is filling, using, or
+   evicting the frame, and protects its other members.  Frames are
+   only ever try-locked while SCAN_LOCK is held, so that a frame
+   busy with I/O is skipped rather than waited for.
+
+   Evicting a dirty page means writing it to swap before the
+   frame can be reused, which doubles the cost of the fault that
+   needs the frame.  To avoid that, a low-priority cleaner thread
+   wakes up every CLEAN_INTERVAL milliseconds and, while free
+   frames are scarce, writes dirty pages just ahead of the clock
+   hand, or wherever the policy would look first, to swap, in
+   batches, or back to their files, leaving them
+   mapped.  By the time the hand reaches them they are usually
+   clean and can be dropped.
+
+   Processes running the same program, or mapping the same file,
+   would each read the same data into frames of their own.
+   Instead, a frame filled straight from a file is entered in
+   SHARE_TABLE, keyed on the inode, offset, and inode version (see
+   inode_get_version()) it came from, and a page wanting the same
+   data joins that frame's PAGES instead of reading it again.
+   Pages of a shared frame are mapped read-only, even writable
+   ones: the first write faults and gives the writer a private
+   copy (see frame_unshare()).  A shared frame is clean, so
+   evicting it just unmaps all its pages.  Writing the file
+   changes its version, so a frame holding data from before the
+   write is never found again, and it leaves the table once its
+   pages do.
+
+   With "-merge", a low-priority merger thread also looks for
+   private frames with the same data, such as buffers that
+   processes running the same program filled the same way.  Every
+   MERGE_INTERVAL milliseconds it hashes the next MERGE_WINDOW
+   frames.  A frame whose hash is the same as on the merger's
+   last visit, which suggests that it is not being written, is
+   looked up in MERGE_TABLE, which holds one such frame for each
+   hash.  If the frame found still holds the same data, once both
+   frames are write-protected, the new frame's pages join it, and
+   the new frame is freed.  The merged frame is shared
+   copy-on-write, like a forked one below.  Only the merger uses
+   MERGE_TABLE, so it needs no lock.  Its frames are try-locked
+   and checked again before use, because a frame may be evicted,
+   freed, or written while it is in the table.
+
+   The share table is thus a cache of file pages, and read()
+   copies from it too (see frame_read()): file data that some
+   process has mapped is not read again, and, since pages are
+   read around the buffer cache, is not cached there as well.
+
+   fork() shares frames the same way, except that a forked page's
+   data need not be in any file, so the frame does not go in
+   SHARE_TABLE: a frame with more than one page is shared
+   copy-on-write whether or not it is in the table, and the
+   length of its PAGES is its reference count.  Such a frame may
+   be dirty, and evicting it writes each of its pages to a swap
+   slot of its own.  A page's frame changes only when it is
+   evicted, when it gets a private copy, or when the merger moves
+   it, each with the old frame locked.  SHARE_LOCK protects
+   SHARE_TABLE.  No frame lock is ever waited for while holding
+   it. */
+
+static struct frame *frames;
+static size_t frame_cnt;
+
+static struct lock scan_lock;
+static struct list empty_frames;
+
+/* Replacement policy. */
+static const struct evict_policy *policy = &evict_clock;
+static const struct evict_policy *const policies[] =
+  {
+    &evict_clock, &evict_clock2, &evict_2q, &evict_aging,
+  };
+
+static struct hash share_table;
+static struct lock share_lock;
+
+static struct hash merge_table;
+static size_t merge_hand;
+
+/* Merge identical private pages in the background?  Set by the
+   "-merge" kernel command-line option. */
+bool frame_merge_pages;
+
+/* Milliseconds between page merger passes, and frames it hashes
+   per pass. */
+#define MERGE_INTERVAL 200
+#define MERGE_WINDOW 128
+
+/* A page of zeros that every untouched zero page maps read-only
+   (see page.c).  It is not a frame in FRAMES: it is never
+   evicted or freed. */
+static void *zero_base;
+
+/* Milliseconds between cleaner passes. */
+#define CLEAN_INTERVAL 100
+
+/* Frames ahead of the policy's cursor examined per cleaner
+   pass. */
+#define CLEAN_WINDOW 64
+
+/* The cleaner works only while fewer user pages than this are
+   available for new frames. */
+#define CLEAN_WATERMARK (frame_cnt / 16 + 1)
+
+/* Victims that could not be evicted, such as because swap is
+   full, before giving up. */
+#define EVICT_TRIES 4
+
+/* Statistics. */
+static unsigned long long evict_cnt, clean_cnt, share_cnt, cow_cnt;
+static unsigned long long over_evict_cnt;
+static unsigned long long read_cnt, read_bytes;
+static unsigned long long merge_cnt, merge_free_cnt;
+
+static thread_func cleaner NO_RETURN;
+static thread_func merger NO_RETURN;
+static hash_hash_func share_hash;
+static hash_less_func share_less;
+static hash_hash_func merge_hash;
+static hash_less_func merge_less;
+
+/* Selects the replacement policy named NAME.  Returns false if
+   there is no such policy.  Must be called before frame_init(). */
+bool
+frame_set_policy (const char *name) 
+{
+  size_t i;
+
+  for (i = 0; i < sizeof policies / sizeof *policies; i++)
+    if (!strcmp (name, policies[i]->name))
+      {
+        policy = policies[i];
+        return true;
+      }
+  return false;
+}
+
+/* Initializes the frame table. */
+void
+frame_init (void) 
+{
+  lock_init (&scan_lock);
+  lock_set_name (&scan_lock, "frame scan");
+  list_init (&empty_frames);
+  lock_init (&share_lock);
+  hash_init (&share_table, share_hash, share_less, NULL);
+
+  frames = malloc (sizeof *frames * init_ram_pages);
+  if (frames == NULL)
+    PANIC ("out of memory allocating page frames");
+  zero_base = palloc_get_page (PAL_USER | PAL_ZERO | PAL_ASSERT);
+
+  thread_create ("page-cleaner", PRI_MIN, cleaner, NULL);
+  if (frame_merge_pages)
+    {
+      hash_init (&merge_table, merge_hash, merge_less, NULL);
+      thread_create ("page-merger", PRI_MIN, merger, NULL);
+    }
+}
+
+/* Returns the kernel virtual address of the page of zeros that
+   untouched zero pages map read-only. */
+void *
+frame_zero (void)
+{
+  return zero_base;
+}
+
+/* Removes F, which must be locked by the current thread, from
+   the share table, if it is there. */
+static void
+remove_share (struct frame *f)
+{
+  ASSERT (lock_held_by_current_thread (&f->lock));
+
+  if (f->inode != NULL)
+    {
+      lock_acquire (&share_lock);
+      hash_delete (&share_table, &f->share_elem);
+      lock_release (&share_lock);
+      f->inode = NULL;
+    }
+}
+
+/* Returns true if any page in F, which must be locked by the
+   current thread, has been accessed since the last call, and
+   clears all their accessed bits. */
+bool
+frame_accessed_recently (struct frame *f)
+{
+  bool accessed = false;
+  struct list_elem *e;
+
+  for (e = list_begin (&f->pages); e != list_end (&f->pages);
+       e = list_next (e))
+    if (page_accessed_recently (list_entry (e, struct page, frame_elem)))
+      accessed = true;
+  return accessed;
+}
+
+/* Evicts every page from F, which must be locked by the current
+   thread.  Returns true if successful, false if a page could not
+   be written out. */
+static bool
+frame_evict (struct frame *f)
+{
+  while (!list_empty (&f->pages))
+    {
+      struct page *p = list_entry (list_front (&f->pages),
+                                   struct page, frame_elem);
+      if (!page_out (p))
+        return false;
+      list_pop_front (&f->pages);
+    }
+  remove_share (f);
+  return true;
+}
+
+/* Returns true if any page of F, which must be locked by the
+   current thread, belongs to a process over its resident
+   allowance. */
+static bool
+frame_over_allowance (struct frame *f)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&f->pages); e != list_end (&f->pages);
+       e = list_next (e))
+    if (page_over_allowance (list_entry (e, struct page, frame_elem)))
+      return true;
+  return false;
+}
+
+/* Returns the number of slots in the frame table, for
+   replacement policies.  SCAN_LOCK must be held. */
+size_t
+frame_table_size (void) 
+{
+  ASSERT (lock_held_by_current_thread (&scan_lock));
+  return frame_cnt;
+}
+
+/* Returns frame table slot IDX, for replacement policies. */
+struct frame *
+frame_table_entry (size_t idx) 
+{
+  return &frames[idx];
+}
+
+/* Tries to lock F to evict it, for replacement policies.  Returns
+   true if F is now locked by the current thread and has pages,
+   of a process over its allowance if OVER_ONLY is true.
+   Otherwise returns false, with F unlocked.  SCAN_LOCK must be
+   held. */
+bool
+frame_try_victim (struct frame *f, bool over_only) 
+{
+  /* A frame we hold ourselves, such as a pinned page's, is as
+     busy as any other. */
+  if (lock_held_by_current_thread (&f->lock)
+      || !lock_try_acquire (&f->lock))
+    return false;
+
+  /* Frames are freed only with SCAN_LOCK held, so all of them
+     are still in use, except for those waiting in a batch for
+     frame_free_batch(), which have no pages. */
+  if (list_empty (&f->pages)
+      || (over_only && !frame_over_allowance (f)))
+    {
+      lock_release (&f->lock);
+      return false;
+    }
+  return true;
+}
+
+/* Tells the replacement policy that F, locked by the current
+   thread, holds new data.  SCAN_LOCK must be held. */
+static void
+policy_add (struct frame *f)
+{
+  if (policy->add != NULL)
+    policy->add (f);
+}
+
+/* Makes a frame for PAGE out of BASE, a page from the user pool,
+   and returns it locked.  SCAN_LOCK must be held.  An empty
+   slot's lock is free, or about to be released by
+   frame_release_deferred(). */
+static struct frame *
+new_frame (struct page *page, void *base)
+{
+  struct frame *f;
+
+  if (!list_empty (&empty_frames))
+    f = list_entry (list_pop_front (&empty_frames),
+                    struct frame, free_elem);
+  else
+    {
+      /* The cleaner reads FRAME_CNT without SCAN_LOCK, so the
+         slot must be ready before it is counted. */
+      ASSERT (frame_cnt < init_ram_pages);
+      f = &frames[frame_cnt];
+      lock_init (&f->lock);
+      list_init (&f->pages);
+      f->inode = NULL;
+      f->evict_elem.prev = f->evict_elem.next = NULL;
+      f->age = 0;
+      f->hot = false;
+      f->merge_hash = 0;
+      f->merge_listed = false;
+      barrier ();
+      frame_cnt++;
+    }
+  f->base = base;
+  lock_acquire (&f->lock);
+  ASSERT (list_empty (&f->pages));
+  list_push_back (&f->pages, &page->frame_elem);
+  policy_add (f);
+  return f;
+}
+
+/* Makes a frame for PAGE out of BASE, a page that the caller took
+   from the user pool itself, and returns it locked. */
+struct frame *
+frame_adopt_and_lock (struct page *page, void *base)
+{
+  struct frame *f;
+
+  lock_acquire (&scan_lock);
+  f = new_frame (page, base);
+  lock_release (&scan_lock);
+  return f;
+}
+
+/* Tries to allocate and lock a frame for PAGE, filled with
+   zeros if ZERO is true.
+   Returns the frame if successful, false on failure. */
+static struct frame *
+try_frame_alloc_and_lock (struct page *page, bool zero) 
+{
+  bool over_only = page_any_over_allowance ();
+  void *base;
+  int fail_cnt = 0;
+
+  /* Make a new frame, if the page allocator has a page for it. */
+  base = palloc_get_page (PAL_USER | (zero ? PAL_ZERO : 0));
+  lock_acquire (&scan_lock);
+  if (base != NULL)
+    {
+      struct frame *f = new_frame (page, base);
+      lock_release (&scan_lock);
+      return f;
+    }
+
+  /* No free page.  Find a frame to evict.  While some process is
+     over its allowance, its frames are considered first. */
+  for (;;) 
+    {
+      struct frame *f = policy->choose (over_only);
+      if (f == NULL)
+        {
+          if (!over_only)
+            break;
+          over_only = false;
+          continue;
+        }
+
+      /* Evict this frame.  The frame lock keeps everyone else
+         away from it while its page is written out. */
+      lock_release (&scan_lock);
+      if (!frame_evict (f))
+        {
+          lock_acquire (&scan_lock);
+          policy_add (f);
+          lock_release (&f->lock);
+          if (++fail_cnt >= EVICT_TRIES)
+            break;
+          continue;
+        }
+
+      list_push_back (&f->pages, &page->frame_elem);
+      if (policy->add != NULL)
+        {
+          lock_acquire (&scan_lock);
+          policy_add (f);
+          lock_release (&scan_lock);
+        }
+      evict_cnt++;
+      if (over_only)
+        over_evict_cnt++;
+      if (zero)
+        memset (f->base, 0, PGSIZE);
+      return f;
+    }
+
+  lock_release (&scan_lock);
+  return NULL;
+}
+
+/* Tries really hard to allocate and lock a frame for PAGE.  If
+   ZERO is true, the frame is filled with zeros, usually by the
+   page allocator ahead of time.
+   Returns the frame if successful, false on failure. */
+struct frame *
+frame_alloc_and_lock (struct page *page, bool zero) 
+{
+  size_t try;
+
+  for (try = 0; try < 3; try++) 
+    {
+      struct frame *f = try_frame_alloc_and_lock (page, zero);
+      if (f != NULL) 
+        {
+          ASSERT (lock_held_by_current_thread (&f->lock));
+          return f; 
+        }
+
+      /* Every frame was busy; give their users time to finish. */
+      timer_msleep (100);
+    }
+
+  return NULL;
+}
+
+/* Locks P's frame into memory, if it has one.
+   Upon return, p->frame will not change until P is unlocked. */
+void
+frame_lock (struct page *p) 
+{
+  /* A frame can be asynchronously removed, or replaced by the
+     page merger, but never inserted. */
+  struct frame *f;
+
+  while ((f = p->frame) != NULL)
+    {
+      lock_acquire (&f->lock);
+      if (f == p->frame)
+        break;
+      lock_release (&f->lock);
+    }
+}
+
+/* Tries to lock P's frame into memory, as frame_lock() does, but
+   without waiting.  Returns a null pointer if P's frame is now
+   locked or P has no frame, otherwise the frame, which someone
+   else has locked.  The frame may no longer be P's by the time
+   its lock can be had. */
+struct frame *
+frame_try_lock (struct page *p)
+{
+  struct frame *f = p->frame;
+  if (f == NULL)
+    return NULL;
+  if (!lock_try_acquire (&f->lock))
+    return f;
+  if (f != p->frame)
+    {
+      /* P left F.  If it moved to another frame, the merger
+         holds that one: report F as busy, to be tried again. */
+      lock_release (&f->lock);
+      return p->frame != NULL ? f : NULL;
+    }
+  return NULL;
+}
+
+/* Looks for a shared frame holding the first BYTES bytes at
+   OFFSET in the current version of INODE, followed by zeros.  If
+   there is one, adds PAGE to it and returns it locked.
+   Otherwise, returns a null pointer. */
+struct frame *
+frame_share_and_lock (struct page *page, struct inode *inode,
+                      off_t offset, off_t bytes)
+{
+  struct frame key;
+
+  key.inode = inode;
+  key.offset = offset;
+  key.version = inode_get_version (inode);
+  for (;;)
+    {
+      struct hash_elem *e;
+      struct frame *f;
+
+      lock_acquire (&share_lock);
+      e = hash_find (&share_table, &key.share_elem);
+      f = e != NULL ? hash_entry (e, struct frame, share_elem) : NULL;
+      lock_release (&share_lock);
+      if (f == NULL)
+        return NULL;
+
+      /* The frame may be evicted before we get its lock, so check
+         that it still holds the data afterward. */
+      lock_acquire (&f->lock);
+      if (f->inode == inode && f->offset == offset
+          && f->version == key.version)
+        {
+          if (f->bytes != bytes)
+            {
+              lock_release (&f->lock);
+              return NULL;
+            }
+          list_push_back (&f->pages, &page->frame_elem);
+          share_cnt++;
+          return f;
+        }
+      lock_release (&f->lock);
+    }
+}
+
+/* Copies up to SIZE bytes at OFFSET in the current version of
+   INODE into BUFFER from a shared frame holding them, stopping at
+   the end of the frame's data.  Returns the number of bytes
+   copied, which is 0 if no frame holds the data or the frame is
+   busy.  Only try-locks frames, so the caller may hold frame
+   locks of its own. */
+off_t
+frame_read (struct inode *inode, off_t offset, void *buffer, off_t size)
+{
+  struct frame key;
+  struct hash_elem *e;
+  struct frame *f;
+  off_t ofs = offset % PGSIZE;
+  off_t cnt = 0;
+
+  key.inode = inode;
+  key.offset = offset - ofs;
+  key.version = inode_get_version (inode);
+  lock_acquire (&share_lock);
+  e = hash_find (&share_table, &key.share_elem);
+  f = e != NULL ? hash_entry (e, struct frame, share_elem) : NULL;
+  lock_release (&share_lock);
+  if (f == NULL || !lock_try_acquire (&f->lock))
+    return 0;
+
+  /* The frame may have been evicted before we got its lock. */
+  if (f->inode == inode && f->offset == key.offset
+      && f->version == key.version && ofs < f->bytes)
+    {
+      cnt = f->bytes - ofs < size ? f->bytes - ofs : size;
+      memcpy (buffer, (uint8_t *) f->base + ofs, cnt);
+      read_cnt++;
+      read_bytes += cnt;
+    }
+  lock_release (&f->lock);
+  return cnt;
+}
+
+/* Enters F, which must be locked by the current thread and hold
+   the first BYTES bytes at OFFSET in version VERSION of INODE
+   followed by zeros, in the share table.  Does nothing if another
+   frame already holds the same data. */
+void
+frame_share (struct frame *f, struct inode *inode, off_t offset,
+             off_t bytes, unsigned version)
+{
+  ASSERT (lock_held_by_current_thread (&f->lock));
+  ASSERT (f->inode == NULL);
+
+  f->inode = inode;
+  f->offset = offset;
+  f->bytes = bytes;
+  f->version = version;
+  lock_acquire (&share_lock);
+  if (hash_insert (&share_table, &f->share_elem) != NULL)
+    f->inode = NULL;
+  lock_release (&share_lock);
+}
+
+/* Adds P to F, which must be locked by the current thread and
+   hold another page's data, so that P shares F with F's other
+   pages until one of them is written.  Used by fork(), and by
+   shared memory, whose pages share a frame for good. */
+void
+frame_add_page (struct frame *f, struct page *p)
+{
+  ASSERT (lock_held_by_current_thread (&f->lock));
+  ASSERT (!list_empty (&f->pages));
+
+  list_push_back (&f->pages, &p->frame_elem);
+  share_cnt++;
+}
+
+/* Returns true if F is in the share table or has more than one
+   page, in which case its pages must be mapped read-only. */
+bool
+frame_is_shared (struct frame *f)
+{
+  return (f->inode != NULL
+          || (!list_empty (&f->pages)
+              && list_front (&f->pages) != list_back (&f->pages)));
+}
+
+/* Gives P, whose frame must be shared and locked by the current
+   thread, a frame of its own that it can write.  If P is the
+   frame's only page, the frame just leaves the share table;
+   otherwise, P moves to a new frame holding a copy of the data
+   and the old frame is unlocked.  Returns P's new frame, locked,
+   or a null pointer if no frame is available, in which case P
+   stays in its old frame. */
+struct frame *
+frame_unshare (struct page *p)
+{
+  struct frame *old = p->frame;
+  struct frame *new;
+
+  ASSERT (lock_held_by_current_thread (&old->lock));
+  ASSERT (frame_is_shared (old));
+
+  if (list_size (&old->pages) == 1)
+    {
+      remove_share (old);
+      return old;
+    }
+
+  list_remove (&p->frame_elem);
+  new = frame_alloc_and_lock (p, false);
+  if (new == NULL)
+    {
+      list_push_back (&old->pages, &p->frame_elem);
+      return NULL;
+    }
+  memcpy (new->base, old->base, PGSIZE);
+  lock_release (&old->lock);
+  cow_cnt++;
+  return new;
+}
+
+/* Removes P from its frame, which must be locked by the current
+   thread, and unlocks the frame.  Frees the frame for use by
+   another page if P was its last page, in which case any data in
+   it is lost. */
+void
+frame_release (struct page *p)
+{
+  struct list batch;
+
+  list_init (&batch);
+  frame_release_deferred (p, &batch);
+  frame_free_batch (&batch);
+}
+
+/* Evicts P alone from its frame, which must be locked by the
+   current thread, writing it out if it is dirty, and unlocks the
+   frame, freeing it if P was its last page.  Returns false if P
+   could not be written out, in which case it stays resident. */
+bool
+frame_drop (struct page *p)
+{
+  struct frame *f = p->frame;
+  struct list batch;
+  bool success;
+
+  ASSERT (lock_held_by_current_thread (&f->lock));
+
+  list_init (&batch);
+  success = page_out (p);
+  if (success)
+    {
+      list_remove (&p->frame_elem);
+      if (list_empty (&f->pages))
+        {
+          remove_share (f);
+          list_push_back (&batch, &f->free_elem);
+        }
+    }
+  lock_release (&f->lock);
+  frame_free_batch (&batch);
+  return success;
+}
+
+/* Like frame_release(), but a frame left without pages goes on
+   BATCH instead of being freed right away.  Until BATCH is passed
+   to frame_free_batch(), its frames are neither free nor in use,
+   and the clock and the cleaner pass over them.  This lets an
+   exiting process free all its frames with one acquisition of
+   SCAN_LOCK. */
+void
+frame_release_deferred (struct page *p, struct list *batch)
+{
+  struct frame *f = p->frame;
+
+  ASSERT (lock_held_by_current_thread (&f->lock));
+
+  list_remove (&p->frame_elem);
+  if (list_empty (&f->pages))
+    {
+      remove_share (f);
+      list_push_back (batch, &f->free_elem);
+    }
+  lock_release (&f->lock);
+}
+
+/* Frees the frames in BATCH, which frame_release_deferred()
+   filled, returning their memory to the page allocator. */
+void
+frame_free_batch (struct list *batch)
+{
+  struct list_elem *e;
+
+  if (list_empty (batch))
+    return;
+
+  for (e = list_begin (batch); e != list_end (batch); e = list_next (e))
+    {
+      struct frame *f = list_entry (e, struct frame, free_elem);
+      palloc_free_page (f->base);
+      f->base = NULL;
+    }
+
+  lock_acquire (&scan_lock);
+  if (policy->remove != NULL)
+    for (e = list_begin (batch); e != list_end (batch); e = list_next (e))
+      policy->remove (list_entry (e, struct frame, free_elem));
+  list_splice (list_end (&empty_frames), list_begin (batch),
+               list_end (batch));
+  lock_release (&scan_lock);
+}
+
+/* Unlocks frame F, allowing it to be evicted.
+   F must be locked for use by the current process. */
+void
+frame_unlock (struct frame *f) 
+{
+  ASSERT (lock_held_by_current_thread (&f->lock));
+  lock_release (&f->lock);
+}
+
+/* Writes the CNT pages in the frames in LOCKED, which the current
+   thread holds, to swap and unlocks them. */
+static void
+clean_batch (struct frame **locked, size_t cnt) 
+{
+  struct page *pages[SWAP_BATCH_MAX];
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    pages[i] = list_entry (list_front (&locked[i]->pages),
+                           struct page, frame_elem);
+  clean_cnt += page_clean (pages, cnt);
+  for (i = 0; i < cnt; i++)
+    lock_release (&locked[i]->lock);
+}
+
+/* Page cleaner thread.  See the comment at the top of the
+   file. */
+static void
+cleaner (void *aux UNUSED) 
+{
+  struct periodic_timer period;
+
+  periodic_timer_init (&period, CLEAN_INTERVAL * TIMER_FREQ / 1000);
+  for (;;) 
+    {
+      struct frame *locked[SWAP_BATCH_MAX];
+      struct frame *cursor;
+      size_t start, cnt, i;
+      bool scarce;
+
+      periodic_timer_wait (&period);
+      page_adjust_allowances ();
+
+      lock_acquire (&scan_lock);
+      if (policy->tick != NULL)
+        policy->tick ();
+      scarce = palloc_avail (PAL_USER) < CLEAN_WATERMARK;
+      cursor = policy->cursor ();
+      start = cursor != NULL ? (size_t) (cursor - frames) : 0;
+      lock_release (&scan_lock);
+      if (!scarce)
+        continue;
+
+      cnt = 0;
+      for (i = 0; i < CLEAN_WINDOW && i < frame_cnt; i++) 
+        {
+          struct frame *f = &frames[(start + i) % frame_cnt];
+
+          if (!lock_try_acquire (&f->lock))
+            continue;
+          /* Only an unshared frame can be dirty. */
+          if (list_size (&f->pages) != 1
+              || !page_needs_cleaning (list_entry (list_front (&f->pages),
+                                                   struct page,
+                                                   frame_elem)))
+            {
+              lock_release (&f->lock);
+              continue;
+            }
+
+          locked[cnt++] = f;
+          if (cnt == SWAP_BATCH_MAX)
+            {
+              clean_batch (locked, cnt);
+              cnt = 0;
+            }
+        }
+      if (cnt > 0)
+        clean_batch (locked, cnt);
+    }
+}
+
+/* Returns true if F, which must be locked by the current thread,
+   holds data of private pages only, so that the merger may share
+   it with other pages. */
+static bool
+is_mergeable (struct frame *f)
+{
+  struct list_elem *e;
+
+  if (f->base == NULL || f->inode != NULL || list_empty (&f->pages))
+    return false;
+  for (e = list_begin (&f->pages); e != list_end (&f->pages);
+       e = list_next (e))
+    if (!list_entry (e, struct page, frame_elem)->private)
+      return false;
+  return true;
+}
+
+/* Maps every page of F, which must be locked by the current
+   thread, read-only. */
+static void
+write_protect (struct frame *f)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&f->pages); e != list_end (&f->pages);
+       e = list_next (e))
+    page_remap (list_entry (e, struct page, frame_elem), true);
+}
+
+/* Merges F, which must be locked by the current thread, with a
+   frame holding the same data, if there is one, as described at
+   the top of the file, and unlocks it. */
+static void
+merge_frame (struct frame *f)
+{
+  struct hash_elem *e;
+  struct frame *g;
+  struct list batch;
+  unsigned hash;
+  bool same;
+
+  if (!is_mergeable (f))
+    {
+      lock_release (&f->lock);
+      return;
+    }
+
+  /* Wait for a frame's data to stay the same between visits. */
+  hash = hash_bytes (f->base, PGSIZE);
+  if (hash != f->merge_hash)
+    {
+      if (f->merge_listed)
+        hash_delete (&merge_table, &f->merge_elem);
+      f->merge_listed = false;
+      f->merge_hash = hash;
+      lock_release (&f->lock);
+      return;
+    }
+
+  e = hash_find (&merge_table, &f->merge_elem);
+  g = e != NULL ? hash_entry (e, struct frame, merge_elem) : NULL;
+  if (g == NULL || g == f)
+    {
+      if (g == NULL)
+        hash_insert (&merge_table, &f->merge_elem);
+      f->merge_listed = true;
+      lock_release (&f->lock);
+      return;
+    }
+  if (!lock_try_acquire (&g->lock))
+    {
+      lock_release (&f->lock);
+      return;
+    }
+
+  /* With both frames write-protected, their data cannot change
+     while they are compared. */
+  same = is_mergeable (g);
+  if (same)
+    {
+      write_protect (f);
+      write_protect (g);
+      same = !memcmp (f->base, g->base, PGSIZE);
+    }
+  if (!same)
+    {
+      /* G no longer holds that data: F takes its place. */
+      hash_replace (&merge_table, &f->merge_elem);
+      g->merge_listed = false;
+      f->merge_listed = true;
+      lock_release (&g->lock);
+      lock_release (&f->lock);
+      return;
+    }
+
+  while (!list_empty (&f->pages))
+    {
+      struct page *p = list_entry (list_pop_front (&f->pages),
+                                   struct page, frame_elem);
+      p->frame = g;
+      list_push_back (&g->pages, &p->frame_elem);
+      page_remap (p, true);
+      merge_cnt++;
+    }
+  lock_release (&g->lock);
+
+  list_init (&batch);
+  list_push_back (&batch, &f->free_elem);
+  lock_release (&f->lock);
+  frame_free_batch (&batch);
+  merge_free_cnt++;
+}
+
+/* Page merger thread.  See the comment at the top of the
+   file. */
+static void
+merger (void *aux UNUSED) 
+{
+  struct periodic_timer period;
+
+  periodic_timer_init (&period, MERGE_INTERVAL * TIMER_FREQ / 1000);
+  for (;;) 
+    {
+      size_t i;
+
+      periodic_timer_wait (&period);
+      for (i = 0; i < MERGE_WINDOW && i < frame_cnt; i++)
+        {
+          struct frame *f = &frames[merge_hand];
+          if (++merge_hand >= frame_cnt)
+            merge_hand = 0;
+
+          if (lock_try_acquire (&f->lock))
+            merge_frame (f);
+        }
+    }
+}
+
+/* Prints frame table statistics. */
+void
+frame_print_stats (void) 
+{
+  printf ("Frames: %zu frames, %llu evictions (%llu from processes "
+          "over their allowance), %llu pages cleaned\n",
+          frame_cnt, evict_cnt, over_evict_cnt, clean_cnt);
+  printf ("Frames: %s replacement\n", policy->name);
+  if (frame_merge_pages)
+    printf ("Frames: %llu pages merged, freeing %llu frames\n",
+            merge_cnt, merge_free_cnt);
+  printf ("Frames: %llu pages shared, %llu copied on write\n",
+          share_cnt, cow_cnt);
+  printf ("Frames: %llu reads from shared frames, %llu bytes\n",
+          read_cnt, read_bytes);
+}
+
+/* Returns a hash value for the merge table frame that E refers
+   to. */
+static unsigned
+merge_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_entry (e, struct frame, merge_elem)->merge_hash;
+}
+
+/* Returns true if merge table frame A precedes frame B. */
+static bool
+merge_less (const struct hash_elem *a_, const struct hash_elem *b_,
+            void *aux UNUSED)
+{
+  const struct frame *a = hash_entry (a_, struct frame, merge_elem);
+  const struct frame *b = hash_entry (b_, struct frame, merge_elem);
+
+  return a->merge_hash < b->merge_hash;
+}
+
+/* Returns a hash value for the shared frame that E refers to. */
+static unsigned
+share_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct frame *f = hash_entry (e, struct frame, share_elem);
+  return hash_ptr (f->inode) ^ hash_u32 (f->offset);
+}
+
+/* Returns true if shared frame A precedes shared frame B. */
+static bool
+share_less (const struct hash_elem *a_, const struct hash_elem *b_,
+            void *aux UNUSED)
+{
+  const struct frame *a = hash_entry (a_, struct frame, share_elem);
+  const struct frame *b = hash_entry (b_, struct frame, share_elem);
+
+  if (a->inode != b->inode)
+    return a->inode < b->inode;
+  if (a->offset != b->offset)
+    return a->offset < b->offset;
+  return a->version < b->version;
+}
@@ -0,0 +1,71 @@
+#ifndef VM_FRAME_H
+#define VM_FRAME_H
+
+#include <hash.h>
+#include <list.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "filesys/off_t.h"
+#include "threads/synch.h"
+
+struct inode;
+struct page;
+
+/* A physical frame of user memory. */
+struct frame
+  {
+    struct lock lock;           /* Held while the frame is in use. */
+    void *base;                 /* Kernel virtual base address, or null. */
+    struct list pages;          /* Mapped process pages. */
+    struct list_elem free_elem; /* Element in empty frame list. */
+
+    /* A frame holding data read straight from a file may be
+       shared by every page of that data.  See frame.c. */
+    struct inode *inode;        /* File, or null if not shareable. */
+    off_t offset;               /* Offset in INODE. */
+    off_t bytes;                /* Bytes read from INODE, rest zeros. */
+    unsigned version;           /* INODE's version when read. */
+    struct hash_elem share_elem; /* Element in share table. */
+
+    /* Replacement policy state, protected by the frame table's
+       scan lock.  See evict.c. */
+    struct list_elem evict_elem; /* Element in a 2Q queue. */
+    uint8_t age;                /* Aging counter. */
+    bool hot;                   /* In 2Q's hot queue? */
+
+    /* Page merger state, used only by the merger thread. */
+    struct hash_elem merge_elem; /* Element in merge table. */
+    unsigned merge_hash;        /* Hash of data when last scanned. */
+    bool merge_listed;          /* In merge table? */
+  };
+
+/* Merge identical private pages in the background? */
+extern bool frame_merge_pages;
+
+bool frame_set_policy (const char *name);
+void frame_init (void);
+void *frame_zero (void);
+
+struct frame *frame_alloc_and_lock (struct page *, bool zero);
+struct frame *frame_adopt_and_lock (struct page *, void *base);
+struct frame *frame_share_and_lock (struct page *, struct inode *,
+                                    off_t offset, off_t bytes);
+off_t frame_read (struct inode *, off_t offset, void *, off_t size);
+void frame_lock (struct page *);
+struct frame *frame_try_lock (struct page *);
+
+void frame_share (struct frame *, struct inode *, off_t offset,
+                  off_t bytes, unsigned version);
+void frame_add_page (struct frame *, struct page *);
+bool frame_is_shared (struct frame *);
+struct frame *frame_unshare (struct page *);
+
+void frame_release (struct page *);
+bool frame_drop (struct page *);
+void frame_release_deferred (struct page *, struct list *batch);
+void frame_free_batch (struct list *batch);
+void frame_unlock (struct frame *);
+
+void frame_print_stats (void);
+
+#endif /* vm/frame.h */
@@ -0,0 +1,1648 @@
+#include "vm/page.h"
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/file.h"
+#include "filesys/inode.h"
+#include "threads/init.h"
+#include "threads/interrupt.h"
+#include "threads/loader.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/pte.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/infopage.h"
+#include "userprog/pagedir.h"
+#include "vm/frame.h"
+#include "vm/shm.h"
+#include "vm/swap.h"
+
+/* Supplemental page table.
+
+   Each process keeps a hash table of the pages in its address
+   space, keyed on user virtual address.  Every page fault and
+   every system call buffer check looks a page up, so the table
+   is an open-addressing struct ohash, which usually finds a page
+   at the first slot it probes.  Pages are entered when
+   a segment is loaded or the stack is set up, but get a frame
+   only when the process first touches them and page_in()
+   handles the resulting page fault.
+
+   The threads of a process share its table, and any of them may
+   fault or lock pages at once, so the table has a lock.  It is
+   held across a lookup and whatever is done with the page found,
+   including bringing it in, so that two threads cannot bring in
+   the same page.  Other processes' threads do evict pages from
+   their frames too: a page's FRAME member may be read or changed
+   only with the frame locked (see frame_lock()).  A thread holding
+   a page locked with page_lock() may go on to lock more pages,
+   and so take the table lock while it holds a frame lock, so the
+   table lock is never held while waiting for a frame lock: see
+   lock_page().
+
+   The stack grows on demand.  An access to a missing page is
+   taken as a stack access if it is no more than STACK_SLOP bytes
+   below the user stack pointer, which is as far below as the
+   PUSHA instruction reaches, and within STACK_PAGE_LIMIT pages of
+   the top of user memory.  All the missing pages between the
+   access and the existing stack are added at once, and up to
+   STACK_PREFAULT_MAX of them are brought in right away, so that a
+   big object on the stack costs one fault instead of one per
+   page.
+
+   A page that starts out all zeros, such as a page of BSS or of
+   the heap, is not given a frame of its own until it is first
+   written.  Until then, reading it maps the zero frame (see
+   frame_zero()) read-only, with the page's FRAME still null, so
+   that memory use follows the pages a process touches rather
+   than the ones it declares.  The first write faults and brings
+   the page in as usual.
+
+   A fault on a page read from a file also brings in and maps the
+   file pages that follow it in the address space, since a scan
+   of a file mapping or of program text would otherwise fault on
+   every page.  Pages whose data a shared frame already holds
+   cost nothing to map, so up to FAULT_AROUND_MAX of them are
+   mapped on any such fault.  Pages that must be read are brought
+   in only within a window that, like read-ahead, starts at
+   nothing and doubles each time a fault lands just past the
+   previous window, so only sequential access pays for reads
+   ahead of the faults.
+
+   A single clock over all frames would let one process that
+   faults heavily take frames from every other.  So each process
+   has a resident allowance, set by page-fault-frequency control
+   in page_adjust_allowances(), which the page cleaner calls
+   every CLEAN_INTERVAL: a process that took at least PFF_HIGH
+   faults that read data since the last call has its allowance
+   raised, while the system has allowance left to give, and one
+   that took none has it lowered toward what it is using.  While
+   any process is over its allowance, the clock first looks only
+   at frames of such processes (see frame.c), so a process that
+   outgrows its share pays for its own evictions.
+
+   Evicting a dirty private page writes the dirty private pages
+   that follow it in its process's address space to swap along
+   with it, leaving them resident but clean, so that a run of
+   virtually adjacent pages gets adjacent swap slots (see
+   swap_out_batch()).  Bringing a page in from swap then also
+   brings in the following pages whose slots follow its slot,
+   with one read, while free frames are plentiful.
+
+   madvise() adjusts this per page (see page_advise()): a page
+   advised RANDOM faults alone, and one advised SEQUENTIAL always
+   reads the widest window.  WILLNEED brings a range in at once,
+   and DONTNEED evicts it, as if the clock had chosen it.
+
+   A big region of pages that start out all zeros, such as a
+   large BSS array, would take a page table and a TLB entry for
+   every 4 MB.  So, if the CPU supports 4 MB pages, the first write
+   to such a page whose whole 4 MB-aligned span of the address
+   space consists of private, writable pages still all zeros,
+   none resident, gives all of them physically contiguous frames
+   at once, mapped by one 4 MB page (see map_superpage()), while
+   the user pool has memory to spare.  The frames are frames like
+   any other, each evicted on its own: any change to the mapping
+   of one of the pages, such as eviction, unmapping, or fork()
+   making it copy-on-write, splits the 4 MB page back into 4 kB
+   pages (see pagedir.c).
+
+   A page of a memory-mapped file is not private: its data is
+   written back to the file, rather than to swap, when it is
+   evicted or unmapped, and only if it is dirty.
+
+   A page of a shared memory segment is not private either.  It
+   shares one frame with the same page of every other process
+   that has the segment attached, mapped writable by all of them,
+   and goes to the segment's own swap slot when the last of them
+   lets go of the frame (see shm.c).
+
+   A page read straight from a file, such as a page of an
+   executable or of a memory-mapped file, may share its frame with
+   other processes' pages of the same data (see frame.c).  A
+   writable page's frame is shared only until its first write,
+   which makes a private copy in page_write_fault().  A page of a
+   memory-mapped file that was written goes back to the file from
+   its private copy.
+
+   fork() copies a process's page table without copying any data.
+   Each page the child gets shares the parent page's frame, if it
+   has one, and both are mapped read-only, so the first write by
+   either process makes it a private copy in the same way.  A
+   page in swap is brought in first, since two pages cannot share
+   a swap slot.  A child page whose data differs from what its
+   file or zeros would give is marked dirty, so that it is not
+   dropped on eviction. */
+
+/* Maximum size of a stack, in pages.  Set by the "-stack" kernel
+   command-line option. */
+size_t stack_page_limit = STACK_PAGES_DEFAULT;
+
+/* How far below the stack pointer an access may be. */
+#define STACK_SLOP 32
+
+/* Maximum number of pages brought in by one stack growth. */
+#define STACK_PREFAULT_MAX 16
+
+/* Pages in a 4 MB superpage. */
+#define SUPERPAGE_PAGES (PTSPAN / PGSIZE)
+
+/* A superpage is made only while the user pool, and what the
+   kernel pool could lend it, would have at least this many pages
+   left. */
+#define SUPERPAGE_SLACK 1024
+
+/* Most neighbors of a faulting file page mapped with it, and the
+   first nonzero fault-around read window. */
+#define FAULT_AROUND_MAX 16
+#define FAULT_AROUND_MIN 2
+
+/* Evictions, by what was done with the page. */
+static unsigned long long evict_drop_cnt, evict_swap_cnt, evict_file_cnt;
+
+/* Read faults satisfied by mapping the zero frame. */
+static unsigned long long zero_map_cnt;
+
+/* 4 MB superpages made. */
+static unsigned long long superpage_cnt;
+
+/* Pages mapped by fault-around, shared and read. */
+static unsigned long long around_share_cnt, around_read_cnt;
+
+/* Pages written to swap alongside an evicted neighbor, and pages
+   read from swap alongside a faulting neighbor. */
+static unsigned long long cluster_out_cnt, cluster_in_cnt;
+
+/* Swap-around reads only while more than this many user pages
+   are free besides the ones it takes. */
+#define SWAP_AROUND_RESERVE 64
+
+/* Page-fault-frequency control.  A process gets PFF_INITIAL pages
+   of allowance to start with, and never fewer than PFF_MIN.  At
+   least PFF_HIGH faults per interval raise its allowance by a
+   quarter of its resident pages, or PFF_STEP pages if that is
+   more; none trims it to 7/8 of its resident pages. */
+#define PFF_INITIAL 64
+#define PFF_MIN 16
+#define PFF_STEP 16
+#define PFF_HIGH 4
+
+/* All page tables, for page_adjust_allowances(), and the lock
+   that protects the list. */
+static struct list tables;
+static struct lock tables_lock;
+
+/* The sum of all allowances and the most it may reach, about the
+   user pool's share of RAM.  Protected by TABLES_LOCK. */
+static size_t total_allowance, allowance_capacity;
+
+/* Whether any process was over its allowance at the last
+   adjustment. */
+static bool any_over;
+
+/* Allowance adjustments. */
+static unsigned long long allowance_grow_cnt, allowance_trim_cnt;
+
+/* A process's supplemental page table. */
+struct page_table
+  {
+    struct lock lock;           /* Protects the members below. */
+    struct ohash pages;         /* Pages, keyed on user address. */
+    uint8_t *next_fault;        /* Page just past the last fault-around. */
+    size_t around_window;       /* Pages fault-around may read. */
+    uint8_t *superpage_miss;    /* Span last found unfit for a
+                                   superpage. */
+
+    /* Page-fault-frequency control.  Updated with interrupts off,
+       since other processes evict our pages. */
+    struct list_elem elem;      /* Element in TABLES. */
+    size_t resident_cnt;        /* Pages with frames. */
+    size_t allowance;           /* Pages we should have at most. */
+    unsigned fault_cnt;         /* Faults since last adjustment. */
+  };
+
+static ohash_hash_func page_hash;
+static ohash_less_func page_less;
+
+/* Initializes the list of page tables. */
+void
+page_tables_init (void)
+{
+  list_init (&tables);
+  lock_init (&tables_lock);
+  allowance_capacity = init_ram_pages / 2;
+}
+
+/* Adds DELTA to the count of resident pages in P's process. */
+static void
+count_resident (struct page *p, int delta)
+{
+  enum intr_level old_level = intr_disable ();
+  p->table->resident_cnt += delta;
+  intr_set_level (old_level);
+}
+
+/* Creates the current process's page table.  Returns true if
+   successful, false if memory is exhausted. */
+bool
+page_init (void)
+{
+  struct thread *t = thread_current ();
+
+  ASSERT (t->pages == NULL);
+
+  t->pages = malloc (sizeof *t->pages);
+  if (t->pages == NULL)
+    return false;
+  if (!ohash_init (&t->pages->pages, page_hash, page_less, NULL))
+    {
+      free (t->pages);
+      t->pages = NULL;
+      return false;
+    }
+  lock_init (&t->pages->lock);
+  t->pages->next_fault = NULL;
+  t->pages->around_window = 0;
+  t->pages->superpage_miss = NULL;
+  t->pages->resident_cnt = 0;
+  t->pages->fault_cnt = 0;
+
+  lock_acquire (&tables_lock);
+  t->pages->allowance = PFF_INITIAL;
+  if (total_allowance + PFF_INITIAL > allowance_capacity)
+    t->pages->allowance = PFF_MIN;
+  total_allowance += t->pages->allowance;
+  list_push_back (&tables, &t->pages->elem);
+  lock_release (&tables_lock);
+  return true;
+}
+
+/* Writes page P, which must be a page of a memory-mapped file
+   with its frame locked by the current thread, back to its file.
+   Returns true if successful. */
+static bool
+write_back (struct page *p)
+{
+  ASSERT (!p->private);
+  ASSERT (lock_held_by_current_thread (&p->frame->lock));
+
+  return file_write_at (p->file, p->frame->base, p->file_bytes,
+                        p->file_offset) == p->file_bytes;
+}
+
+/* Frees page P and its frame, if it has one, first writing it
+   back to its file if it is a dirty page of a memory-mapped
+   file.  P must not be in its process's page table.
+
+   If BATCH is nonnull, P's process is exiting.  Then P stays
+   mapped, since pagedir_destroy() discards the whole page
+   directory anyway, and P's frame, if freed, goes on BATCH for
+   frame_free_batch(). */
+static void
+free_page (struct page *p, struct list *batch)
+{
+  uint32_t *pd = p->pagedir;
+
+  frame_lock (p);
+  if (p->frame != NULL)
+    {
+      if (p->shm != NULL)
+        shm_page_release (p, pagedir_is_dirty (pd, p->addr));
+      else if (!p->private && pagedir_is_dirty (pd, p->addr))
+        write_back (p);
+      count_resident (p, -1);
+
+      if (batch != NULL)
+        frame_release_deferred (p, batch);
+      else
+        {
+          pagedir_clear_page (pd, p->addr);
+          frame_release (p);
+        }
+    }
+  else if (batch == NULL)
+    {
+      /* It may map the zero frame. */
+      pagedir_clear_page (pd, p->addr);
+    }
+  swap_free (p);
+  free (p);
+}
+
+/* Frees the page that hash element P_ refers to, deferring
+   frame frees to BATCH. */
+static void
+destroy_page (struct ohash_elem *p_, void *batch)
+{
+  free_page (ohash_entry (p_, struct page, hash_elem), batch);
+}
+
+/* Destroys page table PT, which belongs to a process that has
+   exited, along with its pages and their frames.  PT's page
+   directory must still exist, but need not be active, so any
+   thread may call this. */
+void
+page_table_destroy (struct page_table *pt)
+{
+  struct list batch;
+
+  /* ohash_destroy() passes the table's auxiliary data to
+     destroy_page(). */
+  list_init (&batch);
+  pt->pages.aux = &batch;
+  ohash_destroy (&pt->pages, destroy_page);
+  frame_free_batch (&batch);
+
+  lock_acquire (&tables_lock);
+  list_remove (&pt->elem);
+  total_allowance -= pt->allowance;
+  lock_release (&tables_lock);
+  free (pt);
+}
+
+/* Returns the page at page-aligned user address ADDR in page
+   table PT, whose lock must be held, or a null pointer if there
+   is none. */
+static struct page *
+table_lookup (struct page_table *pt, void *addr)
+{
+  struct page p;
+  struct ohash_elem *e;
+
+  ASSERT (lock_held_by_current_thread (&pt->lock));
+  if (!is_user_vaddr (addr))
+    return NULL;
+  p.addr = addr;
+  e = ohash_find (&pt->pages, &p.hash_elem);
+  return e != NULL ? ohash_entry (e, struct page, hash_elem) : NULL;
+}
+
+/* Returns the page containing the given virtual ADDRESS in the
+   current process, or a null pointer if there is none.  Does
+   not grow the stack.  The page table's lock must be held. */
+static struct page *
+page_for_addr (const void *address)
+{
+  struct thread *t = thread_current ();
+  struct page p;
+  struct ohash_elem *e;
+
+  if (t->pages == NULL || !is_user_vaddr (address))
+    return NULL;
+  ASSERT (lock_held_by_current_thread (&t->pages->lock));
+
+  p.addr = pg_round_down (address);
+  e = ohash_find (&t->pages->pages, &p.hash_elem);
+  return e != NULL ? ohash_entry (e, struct page, hash_elem) : NULL;
+}
+
+/* Acquires the current process's page table lock.  Returns false,
+   without acquiring anything, if the thread has no page table. */
+static bool
+lock_table (void)
+{
+  struct thread *t = thread_current ();
+
+  if (t->pages == NULL)
+    return false;
+  lock_acquire (&t->pages->lock);
+  return true;
+}
+
+/* Releases the current process's page table lock. */
+static void
+unlock_table (void)
+{
+  lock_release (&thread_current ()->pages->lock);
+}
+
+/* Returns the page containing ADDRESS, as page_for_addr() does,
+   with its frame, if it has one, locked.  The page table's lock
+   must be held.  If the frame is busy, releases the table lock
+   while waiting for it, and then looks the page up again, since
+   another thread may have freed it meanwhile.  Frames themselves
+   are never freed, so waiting on one that has moved on is
+   harmless. */
+static struct page *
+lock_page (const void *address)
+{
+  for (;;)
+    {
+      struct page *p = page_for_addr (address);
+      struct frame *f;
+
+      if (p == NULL)
+        return NULL;
+      f = frame_try_lock (p);
+      if (f == NULL)
+        return p;
+
+      unlock_table ();
+      lock_acquire (&f->lock);
+      lock_release (&f->lock);
+      lock_table ();
+    }
+}
+
+/* Adds a page at VADDR, as page_allocate() does.  The page
+   table's lock must be held. */
+static struct page *
+allocate_page (void *vaddr, bool writable)
+{
+  struct thread *t = thread_current ();
+  struct page *p;
+
+  ASSERT (pg_ofs (vaddr) == 0);
+  ASSERT (lock_held_by_current_thread (&t->pages->lock));
+
+  /* The info pages are mapped outside the table. */
+  if (infopage_contains (vaddr))
+    return NULL;
+
+  p = malloc (sizeof *p);
+  if (p == NULL)
+    return NULL;
+
+  p->addr = vaddr;
+  p->writable = writable;
+  p->pagedir = t->pagedir;
+  p->table = t->pages;
+  p->frame = NULL;
+  p->sector = (block_sector_t) -1;
+  p->zdata = NULL;
+  p->zsize = 0;
+  p->file = NULL;
+  p->private = true;
+  p->file_offset = 0;
+  p->file_bytes = 0;
+  p->advice = ADVICE_NORMAL;
+  p->shm = NULL;
+
+  if (ohash_insert (&t->pages->pages, &p->hash_elem) != NULL)
+    {
+      free (p);
+      return NULL;
+    }
+  return p;
+}
+
+/* Adds a page at user virtual address VADDR, which must be page
+   aligned, to the current process's page table, initially all
+   zeros and without a frame.  The page may be written if
+   WRITABLE is true.  Returns the new page, or a null pointer if
+   memory is exhausted or VADDR is already mapped.  The caller
+   may fill in the page's backing store only while no other
+   thread of the process can touch VADDR. */
+struct page *
+page_allocate (void *vaddr, bool writable)
+{
+  struct page *p;
+
+  lock_table ();
+  p = allocate_page (vaddr, writable);
+  unlock_table ();
+  return p;
+}
+
+/* Removes the page at user virtual address VADDR, which must be
+   page aligned and mapped, from the current process's page
+   table and frees it. */
+void
+page_deallocate (void *vaddr)
+{
+  struct page *p;
+
+  /* Wait for any other thread using the page to unlock it before
+     taking it out of the table. */
+  lock_table ();
+  p = lock_page (vaddr);
+  ASSERT (p != NULL && p->addr == vaddr);
+  ohash_delete (&thread_current ()->pages->pages, &p->hash_elem);
+  unlock_table ();
+
+  if (p->frame != NULL)
+    frame_unlock (p->frame);
+  free_page (p, NULL);
+}
+
+static bool do_page_in (struct page *, enum fault_type *);
+
+/* Maps page P, whose frame must be locked by the current thread,
+   into its process's page directory.  A page of a shared frame is
+   mapped read-only, even if it is writable, so that the first
+   write faults.  Returns true if successful, false if memory is
+   exhausted. */
+static bool
+map_page (struct page *p)
+{
+  ASSERT (lock_held_by_current_thread (&p->frame->lock));
+
+  return pagedir_set_page (p->pagedir, p->addr, p->frame->base,
+                           p->writable && (p->shm != NULL
+                                           || !frame_is_shared (p->frame)));
+}
+
+/* Gives page P, which must not be resident, a frame and maps it,
+   leaving the frame unlocked.  Returns true if successful. */
+static bool
+prefault (struct page *p)
+{
+  bool success;
+
+  frame_lock (p);
+  if (p->frame != NULL)
+    {
+      frame_unlock (p->frame);
+      return true;
+    }
+  if (!do_page_in (p, NULL))
+    return false;
+  success = map_page (p);
+  frame_unlock (p->frame);
+  return success;
+}
+
+/* Grows the current process's stack down to ADDRESS, if ADDRESS
+   looks like a stack access (see the comment at the top of the
+   file).  Returns the page containing ADDRESS, or a null pointer
+   if ADDRESS is not a stack access or memory is exhausted.  The
+   page table's lock must be held. */
+static struct page *
+grow_stack (const void *address)
+{
+  struct thread *t = thread_current ();
+  uint8_t *addr = (uint8_t *) address;
+  uint8_t *fault_page = pg_round_down (address);
+  uint8_t *upage;
+  size_t page_cnt, i;
+
+  if (t->pages == NULL || !is_user_vaddr (address)
+      || addr + STACK_SLOP < (uint8_t *) t->user_esp
+      || (size_t) ((uint8_t *) PHYS_BASE - fault_page) / PGSIZE
+         > stack_page_limit)
+    return NULL;
+
+  /* Add the missing pages, from the faulting page up to the
+     lowest page already in the stack. */
+  page_cnt = 0;
+  for (upage = fault_page;
+       is_user_vaddr (upage) && page_for_addr (upage) == NULL;
+       upage += PGSIZE)
+    {
+      if (allocate_page (upage, true) == NULL)
+        break;
+      page_cnt++;
+    }
+  if (page_cnt == 0)
+    return NULL;
+
+  /* Bring in the ones just above the faulting page, which the
+     caller is about to bring in itself.  Running out of frames
+     here is harmless: the rest fault in later. */
+  for (i = 1; i < page_cnt && i <= STACK_PREFAULT_MAX; i++)
+    if (!prefault (page_for_addr (fault_page + i * PGSIZE)))
+      break;
+
+  return page_for_addr (address);
+}
+
+/* Returns true if page P, which must not have a frame, is all
+   zeros. */
+static bool
+is_zero (const struct page *p)
+{
+  return (p->sector == (block_sector_t) -1 && p->shm == NULL
+          && (p->file == NULL || p->file_bytes == 0));
+}
+
+/* Returns true if page P's data, if it is brought in, may be
+   shared with other pages of the same file data. */
+static bool
+is_shareable (const struct page *p)
+{
+  return (p->file != NULL && p->file_bytes > 0
+          && p->sector == (block_sector_t) -1);
+}
+
+/* Gets a frame for page P and fills it from P's backing store,
+   or joins a shared frame that already holds P's data.  On
+   success, returns true with P's frame locked, and stores in
+   *TYPE, if TYPE is nonnull, whether the data had to be read.  P
+   must not have a frame. */
+static bool
+do_page_in (struct page *p, enum fault_type *type)
+{
+  enum fault_type dummy;
+  uint8_t *kpage;
+  unsigned version = 0;
+  bool zero;
+
+  if (type == NULL)
+    type = &dummy;
+  *type = FAULT_MINOR;
+
+  /* A page without a frame may map the zero frame. */
+  pagedir_clear_page (p->pagedir, p->addr);
+
+  if (p->shm != NULL)
+    {
+      bool read;
+
+      if (!shm_page_in (p, &read))
+        return false;
+      if (read)
+        *type = FAULT_SWAP;
+      count_resident (p, 1);
+      return true;
+    }
+  if (is_shareable (p))
+    {
+      p->frame = frame_share_and_lock (p, file_get_inode (p->file),
+                                       p->file_offset, p->file_bytes);
+      if (p->frame != NULL)
+        {
+          count_resident (p, 1);
+          return true;
+        }
+    }
+
+  /* A page with nothing to read gets a frame zeroed ahead of
+     time. */
+  zero = is_zero (p);
+  p->frame = frame_alloc_and_lock (p, zero);
+  if (p->frame == NULL)
+    return false;
+
+  kpage = p->frame->base;
+  if (p->sector != (block_sector_t) -1)
+    {
+      swap_in (p);
+      *type = FAULT_SWAP;
+    }
+  else
+    {
+      /* Take the version before reading, so that a write that
+         races with the read leaves the frame unshareable. */
+      if (p->file != NULL)
+        {
+          *type = FAULT_FILE;
+          version = inode_get_version (file_get_inode (p->file));
+        }
+      if (p->file != NULL
+          && file_read_at (p->file, kpage, p->file_bytes,
+                           p->file_offset) != p->file_bytes)
+        {
+          frame_release (p);
+          p->frame = NULL;
+          return false;
+        }
+      if (!zero)
+        memset (kpage + p->file_bytes, 0, PGSIZE - p->file_bytes);
+      if (is_shareable (p))
+        frame_share (p->frame, file_get_inode (p->file),
+                     p->file_offset, p->file_bytes, version);
+    }
+  count_resident (p, 1);
+  return true;
+}
+
+/* Maps the pages of FILE that follow page P in the current
+   process's address space, as described at the top of the file,
+   after a fault on P.  The page table's lock must be held. */
+static void
+fault_around (struct page *p, struct file *file)
+{
+  struct page_table *pt = thread_current ()->pages;
+  uint8_t *next = (uint8_t *) p->addr + PGSIZE;
+  size_t i;
+
+  if (p->advice == ADVICE_RANDOM)
+    return;
+  if (p->advice == ADVICE_SEQUENTIAL)
+    pt->around_window = FAULT_AROUND_MAX;
+  else if ((uint8_t *) p->addr == pt->next_fault)
+    {
+      pt->around_window *= 2;
+      if (pt->around_window < FAULT_AROUND_MIN)
+        pt->around_window = FAULT_AROUND_MIN;
+      if (pt->around_window > FAULT_AROUND_MAX)
+        pt->around_window = FAULT_AROUND_MAX;
+    }
+  else
+    pt->around_window = 0;
+
+  for (i = 1; i <= FAULT_AROUND_MAX; i++)
+    {
+      uint8_t *addr = (uint8_t *) p->addr + i * PGSIZE;
+      struct page *q;
+      bool mapped;
+
+      q = is_user_vaddr (addr) ? page_for_addr (addr) : NULL;
+      if (q == NULL || q->file != file || !is_shareable (q))
+        break;
+
+      /* The table lock may not be held while waiting for a frame,
+         so a busy neighbor ends the run. */
+      if (frame_try_lock (q) != NULL)
+        break;
+      if (q->frame != NULL)
+        {
+          frame_unlock (q->frame);
+          next = addr + PGSIZE;
+          continue;
+        }
+
+      q->frame = frame_share_and_lock (q, file_get_inode (q->file),
+                                       q->file_offset, q->file_bytes);
+      if (q->frame != NULL)
+        {
+          count_resident (q, 1);
+          around_share_cnt++;
+        }
+      else if (i <= pt->around_window && do_page_in (q, NULL))
+        around_read_cnt++;
+      else
+        break;
+      mapped = map_page (q);
+      frame_unlock (q->frame);
+      if (!mapped)
+        break;
+      next = addr + PGSIZE;
+    }
+  pt->next_fault = next;
+}
+
+/* After page P came in from swap, brings in and maps the pages
+   that follow it in the current process whose swap slots follow
+   its slot, as described at the top of the file.  The page
+   table's lock must be held. */
+static void
+swap_around (struct page *p)
+{
+  struct page *run[SWAP_BATCH_MAX];
+  struct page *prev = p;
+  size_t cnt = 0, i;
+
+  for (i = 1; i < SWAP_BATCH_MAX; i++)
+    {
+      struct page *q = page_for_addr ((uint8_t *) p->addr + i * PGSIZE);
+
+      if (q == NULL || q->frame != NULL || !swap_follows (prev, q)
+          || palloc_avail (PAL_USER) <= cnt + SWAP_AROUND_RESERVE)
+        break;
+
+      /* Q may be on its way out: recheck once it cannot be. */
+      if (frame_try_lock (q) != NULL)
+        break;
+      if (q->frame != NULL || !swap_follows (prev, q))
+        {
+          if (q->frame != NULL)
+            frame_unlock (q->frame);
+          break;
+        }
+      q->frame = frame_alloc_and_lock (q, false);
+      if (q->frame == NULL)
+        break;
+      run[cnt++] = prev = q;
+    }
+  if (cnt == 0)
+    return;
+
+  swap_in_batch (run, cnt);
+  for (i = 0; i < cnt; i++)
+    {
+      count_resident (run[i], 1);
+      map_page (run[i]);
+      frame_unlock (run[i]->frame);
+    }
+  cluster_in_cnt += cnt;
+}
+
+/* Gives page P, whose frame must be locked by the current
+   thread, a frame of its own if its frame is shared, and maps it
+   writable.  Returns true if successful, false if no frame is
+   available.  Either way, P's frame is still locked afterward. */
+static bool
+make_private (struct page *p)
+{
+  struct frame *f;
+  bool dirty;
+
+  ASSERT (p->writable);
+  if (p->shm != NULL)
+    {
+      /* A shared memory page is written in place, and map_page()
+         always maps it writable. */
+      return true;
+    }
+  if (frame_is_shared (p->frame))
+    {
+      f = frame_unshare (p);
+      if (f == NULL)
+        return false;
+      p->frame = f;
+    }
+  else if (pagedir_is_writable (p->pagedir, p->addr))
+    return true;
+  /* Otherwise P was mapped read-only while it shared its frame,
+     and the frame's other pages have all left it since. */
+
+  /* A page of a forked process may be dirty already.  Remapping
+     it must not lose that. */
+  dirty = pagedir_is_dirty (p->pagedir, p->addr);
+  pagedir_clear_page (p->pagedir, p->addr);
+  if (!map_page (p))
+    return false;
+  pagedir_set_dirty (p->pagedir, p->addr, dirty);
+  return true;
+}
+
+/* Returns true if page P, of the current process, may be part of
+   a superpage: it is private, writable, not resident, and still
+   all zeros. */
+static bool
+superpage_fits (const struct page *p)
+{
+  return (p->private && p->writable && p->frame == NULL
+          && p->shm == NULL && is_zero (p));
+}
+
+/* Tries to map the 4 MB-aligned span of the current process's
+   address space that contains page P, which is about to be
+   written, with a single 4 MB page, as described at the top of
+   the file.  The page table's lock must be held.  Returns true
+   if successful, in which case P is resident and mapped, and
+   false if the span does not fit or memory is short. */
+static bool
+map_superpage (struct page *p)
+{
+  struct page_table *pt = p->table;
+  uint8_t *start = (uint8_t *) ((uintptr_t) p->addr & ~(PTSPAN - 1));
+  uint8_t *block, *run, *block_end;
+  size_t i;
+
+  if (!init_large_pages || start == pt->superpage_miss
+      || !superpage_fits (p))
+    return false;
+  for (i = 0; i < SUPERPAGE_PAGES; i++)
+    {
+      struct page *q = table_lookup (pt, start + i * PGSIZE);
+      if (q == NULL || !superpage_fits (q))
+        {
+          pt->superpage_miss = start;
+          return false;
+        }
+    }
+
+  /* Twice the pages always hold an aligned 4 MB run.  Give back
+     the pages on either side of it. */
+  if (palloc_avail (PAL_USER) < 2 * SUPERPAGE_PAGES + SUPERPAGE_SLACK)
+    return false;
+  block = palloc_get_multiple (PAL_USER, 2 * SUPERPAGE_PAGES);
+  if (block == NULL)
+    return false;
+  block_end = block + 2 * PTSPAN;
+  run = (uint8_t *) ROUND_UP ((uintptr_t) block, PTSPAN);
+  palloc_free_multiple (block, (run - block) / PGSIZE);
+  palloc_free_multiple (run + PTSPAN, (block_end - run - PTSPAN) / PGSIZE);
+  memset (run, 0, PTSPAN);
+
+  /* Pages that were read may map the zero frame. */
+  for (i = 0; i < SUPERPAGE_PAGES; i++)
+    pagedir_clear_page (p->pagedir, start + i * PGSIZE);
+  if (!pagedir_set_large (p->pagedir, start, run, true))
+    {
+      palloc_free_multiple (run, SUPERPAGE_PAGES);
+      return false;
+    }
+
+  /* Until the frames exist, nothing else can reach the memory
+     but this process, through the new mapping. */
+  for (i = 0; i < SUPERPAGE_PAGES; i++)
+    {
+      struct page *q = table_lookup (pt, start + i * PGSIZE);
+      q->frame = frame_adopt_and_lock (q, run + i * PGSIZE);
+      count_resident (q, 1);
+      frame_unlock (q->frame);
+    }
+  superpage_cnt++;
+  return true;
+}
+
+/* Brings in the page containing FAULT_ADDR, if it is not
+   resident, and maps it, growing the stack if FAULT_ADDR is a
+   stack access.  WRITE says whether the fault was a write; a
+   read of a page that is all zeros just maps the zero frame.
+   Returns true if successful, false if FAULT_ADDR is not in any
+   page or the page could not be brought in.  On success, stores
+   the kind of fault in *TYPE. */
+bool
+page_in (void *fault_addr, bool write, enum fault_type *type)
+{
+  struct page *p;
+  bool grew = false;
+  bool success;
+
+  if (!lock_table ())
+    return false;
+  p = lock_page (fault_addr);
+  if (p == NULL)
+    {
+      p = grow_stack (fault_addr);
+      grew = true;
+    }
+  if (p == NULL)
+    {
+      unlock_table ();
+      return false;
+    }
+
+  *type = FAULT_MINOR;
+  if (p->frame == NULL && !write && !grew && is_zero (p))
+    {
+      /* Another thread may have mapped it already. */
+      success = (pagedir_get_page (p->pagedir, p->addr) != NULL
+                 || pagedir_set_page (p->pagedir, p->addr, frame_zero (),
+                                      false));
+      if (success)
+        zero_map_cnt++;
+      unlock_table ();
+      return success;
+    }
+  if (p->frame == NULL && write && !grew && map_superpage (p))
+    {
+      unlock_table ();
+      return true;
+    }
+  if (p->frame == NULL && !do_page_in (p, type))
+    {
+      unlock_table ();
+      return false;
+    }
+  if (grew)
+    *type = FAULT_STACK;
+  ASSERT (lock_held_by_current_thread (&p->frame->lock));
+
+  /* Another thread may have mapped the page while we waited for
+     its frame. */
+  success = (pagedir_get_page (p->pagedir, p->addr) != NULL
+             || map_page (p));
+  frame_unlock (p->frame);
+  if (success && is_shareable (p))
+    fault_around (p, p->file);
+  else if (success && *type == FAULT_SWAP && p->shm == NULL)
+    swap_around (p);
+  unlock_table ();
+  return success;
+}
+
+/* Passed to fork_page() through the parent's page table. */
+struct fork_state
+  {
+    struct file *old_file;      /* The parent's executable... */
+    struct file *new_file;      /* ...and the child's. */
+    bool success;               /* All pages copied so far? */
+  };
+
+/* Adds a copy of the parent's page that hash element P_ refers
+   to to the current process's page table, sharing the parent
+   page's frame, if it has one.  Pages of memory-mapped files are
+   not copied.  On failure, sets the SUCCESS member of the struct
+   fork_state that STATE_ points to to false. */
+static void
+fork_page (struct ohash_elem *p_, void *state_)
+{
+  struct page *p = ohash_entry (p_, struct page, hash_elem);
+  struct fork_state *state = state_;
+  struct page *c;
+  bool dirty;
+
+  if (!state->success || !p->private)
+    return;
+
+  c = allocate_page (p->addr, p->writable);
+  if (c == NULL)
+    {
+      state->success = false;
+      return;
+    }
+  c->file = p->file == state->old_file ? state->new_file : p->file;
+  c->file_offset = p->file_offset;
+  c->file_bytes = p->file_bytes;
+  c->advice = p->advice;
+
+  frame_lock (p);
+  if (p->frame == NULL)
+    {
+      if (p->sector == (block_sector_t) -1)
+        return;
+      if (!do_page_in (p, NULL))
+        {
+          state->success = false;
+          return;
+        }
+    }
+
+  /* P's data is not what C would read for itself if P has been
+     written or came from swap. */
+  dirty = pagedir_is_dirty (p->pagedir, p->addr);
+  c->frame = p->frame;
+  frame_add_page (p->frame, c);
+  count_resident (c, 1);
+
+  /* The frame is shared now, so map P again, read-only. */
+  pagedir_clear_page (p->pagedir, p->addr);
+  if (map_page (p) && map_page (c))
+    {
+      pagedir_set_dirty (p->pagedir, p->addr, dirty);
+      pagedir_set_dirty (c->pagedir, c->addr,
+                         dirty || p->sector != (block_sector_t) -1);
+    }
+  else
+    state->success = false;
+  frame_unlock (p->frame);
+}
+
+/* Fills the current process's page table, which must be empty,
+   with copies of the pages in PARENT, sharing their frames with
+   them until one or the other is written.  Pages backed by
+   OLD_FILE, the parent's executable, are backed by NEW_FILE
+   instead.  The parent may have no other threads.  Returns true
+   if successful, false if memory is exhausted, in which case some
+   pages may have been copied and page_table_destroy() frees them. */
+bool
+page_fork (struct page_table *parent, struct file *old_file,
+           struct file *new_file)
+{
+  struct fork_state state;
+
+  state.old_file = old_file;
+  state.new_file = new_file;
+  state.success = true;
+
+  /* ohash_apply() passes the table's auxiliary data to
+     fork_page(). */
+  lock_acquire (&parent->lock);
+  lock_table ();
+  parent->pages.aux = &state;
+  ohash_apply (&parent->pages, fork_page);
+  parent->pages.aux = NULL;
+  unlock_table ();
+  lock_release (&parent->lock);
+  return state.success;
+}
+
+/* Handles a write to FAULT_ADDR that faulted because its page is
+   mapped read-only.  If the page is writable, its frame must be
+   shared, so gives it a private copy.  Returns true if the write
+   can be retried, false if the page may not be written or no
+   frame is available. */
+bool
+page_write_fault (void *fault_addr)
+{
+  struct page *p;
+  bool success;
+
+  if (!lock_table ())
+    return false;
+  p = lock_page (fault_addr);
+  if (p == NULL || !p->writable)
+    success = false;
+  else if (p->frame == NULL && map_superpage (p))
+    success = true;
+  else if (p->frame == NULL)
+    {
+      /* It maps the zero frame, or was evicted since the fault.
+         Either way, bring it in to be written. */
+      success = do_page_in (p, NULL);
+      if (success)
+        {
+          success = map_page (p);
+          frame_unlock (p->frame);
+        }
+    }
+  else
+    {
+      success = make_private (p);
+      frame_unlock (p->frame);
+    }
+  unlock_table ();
+  return success;
+}
+
+/* Writes private page P, which must be unmapped, with its frame
+   locked by the current thread, to swap, along with the dirty
+   private pages that follow it in its process's address space,
+   which stay resident but clean.  Only try-locks, since P may
+   belong to another process.  Returns true if P was written. */
+static bool
+swap_out_cluster (struct page *p)
+{
+  struct page_table *pt = p->table;
+  struct page *cluster[SWAP_BATCH_MAX];
+  bool own = lock_held_by_current_thread (&pt->lock);
+  size_t cnt = 1, i;
+
+  ASSERT (p->private);
+
+  cluster[0] = p;
+  if (list_size (&p->frame->pages) == 1
+      && (own || lock_try_acquire (&pt->lock)))
+    {
+      for (; cnt < SWAP_BATCH_MAX; cnt++)
+        {
+          struct page *q = table_lookup (pt, (uint8_t *) p->addr
+                                             + cnt * PGSIZE);
+          struct frame *f = q != NULL ? q->frame : NULL;
+
+          if (f == NULL || !q->private
+              || lock_held_by_current_thread (&f->lock)
+              || frame_try_lock (q) != NULL)
+            break;
+          if (q->frame == NULL)
+            break;
+          if (list_size (&q->frame->pages) != 1
+              || !pagedir_is_dirty (q->pagedir, q->addr))
+            {
+              frame_unlock (q->frame);
+              break;
+            }
+          cluster[cnt] = q;
+        }
+      if (!own)
+        lock_release (&pt->lock);
+    }
+
+  page_clean (cluster, cnt);
+  for (i = 1; i < cnt; i++)
+    frame_unlock (cluster[i]->frame);
+  cluster_out_cnt += cnt - 1;
+  return !pagedir_is_dirty (p->pagedir, p->addr);
+}
+
+/* Evicts page P from its frame, which must be locked by the
+   current thread.  Returns true if successful, in which case P no
+   longer has a frame, false on failure.
+
+   A page that has not been written since it was brought in is
+   simply dropped, because it can be brought back from the same
+   place: its swap slot, its file, or zeros.  A dirty page is
+   written to swap, or back to its file if it is not private. */
+bool
+page_out (struct page *p)
+{
+  uint32_t *pd = p->pagedir;
+
+  ASSERT (p->frame != NULL);
+  ASSERT (lock_held_by_current_thread (&p->frame->lock));
+
+  /* Unmap the page first, so that the process faults, and waits
+     for the frame lock, instead of writing the page while we
+     look at it.  The dirty bit survives the unmapping. */
+  pagedir_clear_page (pd, p->addr);
+  if (p->shm != NULL)
+    {
+      if (!shm_page_out (p, pagedir_is_dirty (pd, p->addr)))
+        goto fail;
+    }
+  else if (!pagedir_is_dirty (pd, p->addr))
+    evict_drop_cnt++;
+  else if (p->private ? swap_out_cluster (p) : write_back (p))
+    {
+      if (p->private)
+        evict_swap_cnt++;
+      else
+        evict_file_cnt++;
+    }
+  else
+    goto fail;
+
+  p->frame = NULL;
+  count_resident (p, -1);
+  return true;
+
+ fail:
+  /* Swap is full, or the write failed.  Map the page back, dirty
+     bit and all. */
+  if (map_page (p))
+    pagedir_set_dirty (pd, p->addr, true);
+  return false;
+}
+
+/* Counts a fault of the given TYPE by the current process for
+   page-fault-frequency control.  Only faults that read data
+   count: the others are cheap. */
+void
+page_count_fault (enum fault_type type)
+{
+  struct page_table *pt = thread_current ()->pages;
+
+  if (pt != NULL && (type == FAULT_FILE || type == FAULT_SWAP))
+    {
+      enum intr_level old_level = intr_disable ();
+      pt->fault_cnt++;
+      intr_set_level (old_level);
+    }
+}
+
+/* Adjusts each process's resident allowance according to how
+   often it faulted since the last call, as described at the top
+   of the file. */
+void
+page_adjust_allowances (void)
+{
+  struct list_elem *e;
+  bool over = false;
+
+  lock_acquire (&tables_lock);
+  for (e = list_begin (&tables); e != list_end (&tables); e = list_next (e))
+    {
+      struct page_table *pt = list_entry (e, struct page_table, elem);
+      enum intr_level old_level;
+      size_t resident, allowance;
+      unsigned faults;
+
+      old_level = intr_disable ();
+      resident = pt->resident_cnt;
+      faults = pt->fault_cnt;
+      pt->fault_cnt = 0;
+      intr_set_level (old_level);
+
+      allowance = pt->allowance;
+      if (faults >= PFF_HIGH && total_allowance < allowance_capacity)
+        {
+          size_t step = resident / 4 > PFF_STEP ? resident / 4 : PFF_STEP;
+          if (step > allowance_capacity - total_allowance)
+            step = allowance_capacity - total_allowance;
+          allowance += step;
+          allowance_grow_cnt++;
+        }
+      else if (faults == 0 && resident - resident / 8 < allowance)
+        {
+          allowance = resident - resident / 8;
+          if (allowance < PFF_MIN)
+            allowance = PFF_MIN;
+          if (allowance < pt->allowance)
+            allowance_trim_cnt++;
+        }
+      total_allowance = total_allowance - pt->allowance + allowance;
+      pt->allowance = allowance;
+      if (resident > allowance)
+        over = true;
+    }
+  any_over = over;
+  lock_release (&tables_lock);
+}
+
+/* Returns true if some process may be over its allowance, so that
+   eviction should look at such processes' frames first. */
+bool
+page_any_over_allowance (void)
+{
+  return any_over;
+}
+
+/* Returns true if the process that page P belongs to has more
+   resident pages than its allowance. */
+bool
+page_over_allowance (const struct page *p)
+{
+  return p->table->resident_cnt > p->table->allowance;
+}
+
+/* Returns true if page P's data has been accessed recently,
+   false otherwise, and clears the accessed bit so that the next
+   call reports only later accesses.  P must have a frame locked
+   into memory. */
+bool
+page_accessed_recently (struct page *p)
+{
+  bool was_accessed;
+
+  ASSERT (p->frame != NULL);
+  ASSERT (lock_held_by_current_thread (&p->frame->lock));
+
+  was_accessed = pagedir_is_accessed (p->pagedir, p->addr);
+  if (was_accessed)
+    pagedir_set_accessed (p->pagedir, p->addr, false);
+  return was_accessed;
+}
+
+/* Returns true if page P is worth cleaning ahead of eviction,
+   that is, it is dirty but has not been accessed since the clock
+   hand last passed it.  P must have a frame locked into memory. */
+bool
+page_needs_cleaning (struct page *p)
+{
+  uint32_t *pd = p->pagedir;
+
+  ASSERT (p->frame != NULL);
+  ASSERT (lock_held_by_current_thread (&p->frame->lock));
+
+  /* A shared memory page is written only once its last process
+     lets go of it. */
+  return (p->shm == NULL && pagedir_is_dirty (pd, p->addr)
+          && !pagedir_is_accessed (pd, p->addr));
+}
+
+/* Writes the CNT pages in PAGES, at most SWAP_BATCH_MAX, to swap
+   or back to their files, leaving them mapped, so that they can
+   later be evicted without writing them.  Private pages are
+   written to swap together.  Each page's frame must be locked by
+   the current thread.  Returns the number of pages written; a
+   page that could not be written stays dirty. */
+size_t
+page_clean (struct page **pages, size_t cnt)
+{
+  struct page *private[SWAP_BATCH_MAX];
+  size_t private_cnt = 0;
+  size_t clean_cnt = 0;
+  size_t i;
+
+  ASSERT (cnt <= SWAP_BATCH_MAX);
+
+  /* Clear the dirty bits first.  A write by the process after
+     this point sets its page's bit again, so no change can be
+     lost, even one that races with the copy. */
+  for (i = 0; i < cnt; i++)
+    {
+      struct page *p = pages[i];
+
+      pagedir_set_dirty (p->pagedir, p->addr, false);
+      if (p->private)
+        private[private_cnt++] = p;
+      else if (write_back (p))
+        clean_cnt++;
+      else
+        pagedir_set_dirty (p->pagedir, p->addr, true);
+    }
+
+  if (private_cnt > 0)
+    {
+      if (swap_out_batch (private, private_cnt))
+        clean_cnt += private_cnt;
+      else
+        for (i = 0; i < private_cnt; i++)
+          pagedir_set_dirty (private[i]->pagedir,
+                             private[i]->addr, true);
+    }
+  return clean_cnt;
+}
+
+/* Maps page P again at its frame, which must be locked by the
+   current thread, keeping its dirty bit: read-only if READ_ONLY
+   is true, otherwise as map_page() would.  Does nothing if P is
+   not mapped.  For the page merger (see frame.c), which may also
+   have moved P to a frame with the same data. */
+void
+page_remap (struct page *p, bool read_only)
+{
+  uint32_t *pd = p->pagedir;
+  bool writable = (!read_only && p->writable
+                   && !frame_is_shared (p->frame));
+  bool dirty;
+
+  ASSERT (lock_held_by_current_thread (&p->frame->lock));
+
+  if (pagedir_get_page (pd, p->addr) == NULL)
+    return;
+
+  /* Clearing the mapping keeps its page table, so mapping it
+     again cannot fail. */
+  dirty = pagedir_is_dirty (pd, p->addr);
+  pagedir_clear_page (pd, p->addr);
+  if (!pagedir_set_page (pd, p->addr, p->frame->base, writable))
+    NOT_REACHED ();
+  pagedir_set_dirty (pd, p->addr, dirty);
+}
+
+/* Acts on ADVICE for the pages of the current process that the
+   SIZE bytes at page-aligned ADDR touch, as described at the top
+   of the file.  Addresses without a page are skipped.  Returns
+   false if a page could not be brought in or written out, or if
+   the thread has no page table. */
+bool
+page_advise (void *addr, size_t size, enum page_advice advice)
+{
+  uint8_t *va = addr;
+  uint8_t *end = va + size;
+  bool success = true;
+
+  ASSERT (pg_ofs (addr) == 0);
+
+  if (!lock_table ())
+    return false;
+  for (; va < end; va += PGSIZE)
+    {
+      struct page *p = lock_page (va);
+
+      if (p == NULL)
+        continue;
+      switch (advice)
+        {
+        case ADVICE_WILLNEED:
+          if (p->frame == NULL)
+            {
+              if (do_page_in (p, NULL))
+                map_page (p);
+              else
+                success = false;
+            }
+          break;
+
+        case ADVICE_DONTNEED:
+          if (p->frame != NULL)
+            {
+              if (!frame_drop (p))
+                success = false;
+              continue;
+            }
+
+          /* It may map the zero frame. */
+          pagedir_clear_page (p->pagedir, p->addr);
+          break;
+
+        default:
+          p->advice = advice;
+          break;
+        }
+      if (p->frame != NULL)
+        frame_unlock (p->frame);
+    }
+  unlock_table ();
+  return success;
+}
+
+/* Makes the page containing ADDR resident and locks its frame,
+   which keeps it from being evicted, as page_lock() does.  The
+   page table's lock must be held.  Returns the locked frame, or
+   a null pointer on failure. */
+static struct frame *
+lock_resident (const void *addr, bool will_write)
+{
+  struct page *p;
+
+  p = lock_page (addr);
+  if (p == NULL)
+    p = grow_stack (addr);
+  if (p == NULL || (!p->writable && will_write))
+    goto fail;
+
+  if (p->frame == NULL)
+    {
+      if (!do_page_in (p, NULL))
+        goto fail;
+      if (!map_page (p))
+        goto fail;
+    }
+
+  /* The kernel may write the page through its user address
+     without faulting on a read-only mapping, so make it private
+     up front. */
+  if (will_write && !make_private (p))
+    goto fail;
+  return p->frame;
+
+ fail:
+  if (p != NULL && p->frame != NULL)
+    frame_unlock (p->frame);
+  return NULL;
+}
+
+/* Makes the page containing ADDR resident and locks it into its
+   frame, so that the kernel can access it without faulting.  If
+   WILL_WRITE is true, the page must be writable.  Returns true if
+   successful, false on failure.  The page must be unlocked with
+   page_unlock(). */
+bool
+page_lock (const void *addr, bool will_write)
+{
+  bool success;
+
+  if (!lock_table ())
+    return false;
+  success = lock_resident (addr, will_write) != NULL;
+  unlock_table ();
+  return success;
+}
+
+/* Makes each page that the SIZE bytes at user address UADDR
+   touch resident, writable as well if WILL_WRITE is true, and
+   locks it into its frame, storing the frames in order in
+   FRAMES.  The range may touch at most PAGE_PIN_MAX pages.  The
+   page table is looked up once for the whole range, and the
+   kernel may then access the data through each frame's BASE
+   without faulting while the file system's locks are held.
+   Returns the number of frames stored, or 0 on failure, in
+   which case nothing stays locked.  The frames must be unlocked
+   with page_unpin(). */
+size_t
+page_pin (const void *uaddr, size_t size, bool will_write,
+          struct frame *frames[])
+{
+  const uint8_t *start = pg_round_down (uaddr);
+  const uint8_t *end = (const uint8_t *) uaddr + size;
+  size_t cnt = 0;
+
+  ASSERT (size > 0);
+  ASSERT ((size_t) (end - start) <= PAGE_PIN_MAX * PGSIZE);
+
+  if (!lock_table ())
+    return 0;
+  for (; start < end; start += PGSIZE)
+    {
+      /* Pages are locked in address order, the same order as
+         other threads of this process, and the user pages in
+         hand stay put: eviction only try-locks frames. */
+      frames[cnt] = lock_resident (start, will_write);
+      if (frames[cnt] == NULL)
+        {
+          unlock_table ();
+          page_unpin (frames, cnt);
+          return 0;
+        }
+      cnt++;
+    }
+  unlock_table ();
+  return cnt;
+}
+
+/* Unlocks the CNT frames in FRAMES, locked by page_pin(). */
+void
+page_unpin (struct frame *frames[], size_t cnt)
+{
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    frame_unlock (frames[i]);
+}
+
+/* Returns the page containing ADDR, which must be locked with
+   page_lock(). */
+static struct page *
+locked_page (const void *addr)
+{
+  struct page *p;
+
+  lock_table ();
+  p = page_for_addr (addr);
+  unlock_table ();
+
+  ASSERT (p != NULL && p->frame != NULL);
+  ASSERT (lock_held_by_current_thread (&p->frame->lock));
+  return p;
+}
+
+/* Unlocks the page containing ADDR, which must have been locked
+   with page_lock(). */
+void
+page_unlock (const void *addr)
+{
+  frame_unlock (locked_page (addr)->frame);
+}
+
+/* Returns the kernel virtual address of the frame holding the
+   page containing ADDR, which must be locked with page_lock(). */
+void *
+page_frame_base (const void *addr)
+{
+  return locked_page (addr)->frame->base;
+}
+
+/* Prints eviction statistics. */
+void
+page_print_stats (void)
+{
+  printf ("Evictions: %llu dropped clean, %llu to swap, %llu to file\n",
+          evict_drop_cnt, evict_swap_cnt, evict_file_cnt);
+  printf ("Pages: %llu zero frame mappings, %llu 4 MB superpages\n",
+          zero_map_cnt, superpage_cnt);
+  printf ("Pages: fault-around mapped %llu shared pages, read %llu\n",
+          around_share_cnt, around_read_cnt);
+  printf ("Pages: %llu resident allowances raised, %llu trimmed\n",
+          allowance_grow_cnt, allowance_trim_cnt);
+  printf ("Pages: %llu pages swapped out with a neighbor, %llu in\n",
+          cluster_out_cnt, cluster_in_cnt);
+}
+
+/* Returns a hash value for the page that E refers to.  Pages
+   adjacent in memory get adjacent slots, so the pages of a
+   segment or of the stack rarely collide with each other. */
+static unsigned
+page_hash (const struct ohash_elem *e, void *aux UNUSED)
+{
+  const struct page *p = ohash_entry (e, struct page, hash_elem);
+  return ((uintptr_t) p->addr) >> PGBITS;
+}
+
+/* Returns true if page A precedes page B. */
+static bool
+page_less (const struct ohash_elem *a_, const struct ohash_elem *b_,
+           void *aux UNUSED)
+{
+  const struct page *a = ohash_entry (a_, struct page, hash_elem);
+  const struct page *b = ohash_entry (b_, struct page, hash_elem);
+  return a->addr < b->addr;
+}
@@ -0,0 +1,113 @@
+#ifndef VM_PAGE_H
+#define VM_PAGE_H
+
+#include <list.h>
+#include <ohash.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "devices/block.h"
+#include "filesys/off_t.h"
+
+/* A page of a process's virtual address space, as recorded in
+   its supplemental page table.  Describes where the page's
+   contents come from, so that it can be brought in when it is
+   first touched. */
+struct page
+  {
+    void *addr;                 /* User virtual address. */
+    bool writable;              /* May the process write the page? */
+    uint32_t *pagedir;          /* Owning process's page directory. */
+    struct page_table *table;   /* Owning process's page table. */
+    struct ohash_elem hash_elem; /* Element in process's page table. */
+
+    struct frame *frame;        /* Page frame, or null if not resident. */
+    struct list_elem frame_elem; /* Element in frame's PAGES. */
+    block_sector_t sector;      /* Swap slot's first sector, SWAP_MEMORY
+                                   if compressed in memory, or -1. */
+    void *zdata;                /* Compressed copy, if SWAP_MEMORY. */
+    size_t zsize;               /* Bytes in ZDATA. */
+
+    /* Backing file, if any.  The first FILE_BYTES bytes of the
+       page are read from FILE at FILE_OFFSET, and the rest are
+       zeroed.  With no file, the page starts out all zeros.  A
+       page in swap is read from its swap slot instead. */
+    struct file *file;          /* File. */
+    bool private;               /* False: dirty data goes back to FILE;
+                                   true: it goes to swap. */
+    off_t file_offset;          /* Offset in file. */
+    off_t file_bytes;           /* Bytes to read, 0...PGSIZE. */
+    uint8_t advice;             /* Access pattern, an ADVICE_* that
+                                   is below ADVICE_WILLNEED. */
+
+    /* Shared memory segment page whose frame the page shares with
+       other processes' pages, if any.  See shm.c. */
+    struct shm_page *shm;
+  };
+
+/* A process's supplemental page table. */
+struct page_table;
+struct page;
+
+/* Default limit on the size of a process's stack, in pages. */
+#define STACK_PAGES_DEFAULT 2048        /* 8 MB. */
+
+extern size_t stack_page_limit;
+
+/* How a process says it will use a range of pages, through
+   page_advise().  The values match the MADV_* of madvise(). */
+enum page_advice
+  {
+    ADVICE_NORMAL,              /* No particular pattern. */
+    ADVICE_RANDOM,              /* Random: no fault-around. */
+    ADVICE_SEQUENTIAL,          /* Sequential: widest fault-around. */
+    ADVICE_WILLNEED,            /* Bring the pages in now. */
+    ADVICE_DONTNEED             /* Evict the pages now. */
+  };
+
+/* Kinds of page fault, for statistics. */
+enum fault_type
+  {
+    FAULT_MINOR,                /* Page resident, shared, or zeroed. */
+    FAULT_FILE,                 /* Page read from its file. */
+    FAULT_SWAP,                 /* Page read from swap. */
+    FAULT_STACK,                /* Stack grown. */
+    FAULT_COW,                  /* Shared page made private on write. */
+    FAULT_TYPE_CNT
+  };
+
+void page_tables_init (void);
+bool page_init (void);
+void page_table_destroy (struct page_table *);
+struct page *page_allocate (void *, bool writable);
+void page_deallocate (void *);
+bool page_in (void *fault_addr, bool write, enum fault_type *);
+bool page_write_fault (void *fault_addr);
+bool page_fork (struct page_table *, struct file *old_file,
+                struct file *new_file);
+bool page_out (struct page *);
+bool page_accessed_recently (struct page *);
+bool page_needs_cleaning (struct page *);
+size_t page_clean (struct page **, size_t cnt);
+void page_remap (struct page *, bool read_only);
+bool page_advise (void *, size_t, enum page_advice);
+
+bool page_lock (const void *, bool will_write);
+void page_unlock (const void *);
+void *page_frame_base (const void *);
+
+/* Most pages page_pin() locks at once. */
+#define PAGE_PIN_MAX 16
+
+size_t page_pin (const void *uaddr, size_t size, bool will_write,
+                 struct frame *frames[]);
+void page_unpin (struct frame *frames[], size_t cnt);
+
+void page_count_fault (enum fault_type);
+void page_adjust_allowances (void);
+bool page_any_over_allowance (void);
+bool page_over_allowance (const struct page *);
+
+void page_print_stats (void);
+
+#endif /* vm/page.h */
@@ -0,0 +1,320 @@
+#include "vm/shm.h"
+#include <debug.h>
+#include <list.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "vm/frame.h"
+#include "vm/page.h"
+#include "vm/swap.h"
+
+/* Shared memory segments.
+
+   A segment is a named array of pages that any process may
+   attach to a range of its address space.  Each process gets a
+   page of its own in its page table for each page of the
+   segment, with SHM pointing to the segment's page, and all the
+   processes' pages of one segment page share a single frame
+   through the frame's list of pages, mapped writable, so that a
+   write by one process is seen by all the others without any
+   copying.
+
+   Such a frame is evicted like any other, one page after another
+   (see frame_evict()).  When the last page leaves it, the data
+   goes to a swap slot of the segment page, which is kept when the
+   data is brought back in, so that it needs writing again only
+   if some process changed it.  The segment page's STORE, a page
+   that is in no page table, holds the slot and, while the data is
+   resident, the frame, so that swap.c can be used unchanged.
+
+   A process may attach a segment only once.  As with file
+   mappings, a child made by fork() does not inherit attachments:
+   it attaches the segment by name.  A segment lives as long as
+   some process has it attached.  The last detach frees it, slots
+   and all, and makes its name available again. */
+
+/* A page of a segment. */
+struct shm_page
+  {
+    struct page store;          /* Frame and swap slot. */
+    struct shm *segment;        /* Segment it belongs to. */
+    bool dirty;                 /* Written since last saved? */
+  };
+
+/* A segment. */
+struct shm
+  {
+    struct list_elem elem;      /* Element in SEGMENTS. */
+    char name[SHM_NAME_MAX + 1]; /* Null-terminated name. */
+    int ref_cnt;                /* Number of attachments. */
+    size_t page_cnt;            /* Number of pages. */
+    struct shm_page *pages;     /* The pages. */
+  };
+
+/* All segments.  SHM_LOCK protects this list, each segment's
+   REF_CNT, and the STORE.FRAME of each segment page, which may be
+   read with either SHM_LOCK or its frame's lock held and is
+   changed only with both held.  The rest of a segment page is
+   protected by the lock of the frame its data is in, or, while
+   it is not resident, by that of the page table of the process
+   bringing it in.  SHM_LOCK is acquired last. */
+static struct list segments = LIST_INITIALIZER (segments);
+static struct lock shm_lock;
+
+/* Initializes shared memory. */
+void
+shm_init (void)
+{
+  lock_init (&shm_lock);
+  lock_set_name (&shm_lock, "shm");
+}
+
+/* Returns the segment named NAME, or a null pointer if there is
+   none.  SHM_LOCK must be held. */
+static struct shm *
+lookup (const char *name)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&segments); e != list_end (&segments);
+       e = list_next (e))
+    {
+      struct shm *s = list_entry (e, struct shm, elem);
+      if (!strcmp (s->name, name))
+        return s;
+    }
+  return NULL;
+}
+
+/* Creates a segment named NAME of PAGE_CNT pages, all zeros, and
+   returns it open.  Returns a null pointer if NAME is too long or
+   already in use or if memory is exhausted. */
+struct shm *
+shm_create (const char *name, size_t page_cnt)
+{
+  struct shm *s;
+  size_t i;
+
+  if (strlen (name) > SHM_NAME_MAX || page_cnt == 0)
+    return NULL;
+
+  s = malloc (sizeof *s);
+  if (s == NULL)
+    return NULL;
+  s->pages = calloc (page_cnt, sizeof *s->pages);
+  if (s->pages == NULL)
+    {
+      free (s);
+      return NULL;
+    }
+  strlcpy (s->name, name, sizeof s->name);
+  s->ref_cnt = 1;
+  s->page_cnt = page_cnt;
+  for (i = 0; i < page_cnt; i++)
+    {
+      s->pages[i].store.sector = (block_sector_t) -1;
+      s->pages[i].segment = s;
+    }
+
+  lock_acquire (&shm_lock);
+  if (lookup (name) != NULL)
+    {
+      lock_release (&shm_lock);
+      free (s->pages);
+      free (s);
+      return NULL;
+    }
+  list_push_back (&segments, &s->elem);
+  lock_release (&shm_lock);
+  return s;
+}
+
+/* Opens and returns the segment named NAME, or returns a null
+   pointer if there is none. */
+struct shm *
+shm_open (const char *name)
+{
+  struct shm *s;
+
+  lock_acquire (&shm_lock);
+  s = lookup (name);
+  if (s != NULL)
+    s->ref_cnt++;
+  lock_release (&shm_lock);
+  return s;
+}
+
+/* Closes segment S, freeing it if this was its last opening.
+   None of its pages may be in any page table by then. */
+void
+shm_close (struct shm *s)
+{
+  size_t i;
+
+  if (s == NULL)
+    return;
+
+  lock_acquire (&shm_lock);
+  if (--s->ref_cnt > 0)
+    {
+      lock_release (&shm_lock);
+      return;
+    }
+  list_remove (&s->elem);
+  lock_release (&shm_lock);
+
+  for (i = 0; i < s->page_cnt; i++)
+    {
+      ASSERT (s->pages[i].store.frame == NULL);
+      swap_free (&s->pages[i].store);
+    }
+  free (s->pages);
+  free (s);
+}
+
+/* Returns the number of pages in S. */
+size_t
+shm_page_cnt (const struct shm *s)
+{
+  return s->page_cnt;
+}
+
+/* Returns page IDX of S. */
+struct shm_page *
+shm_page (struct shm *s, size_t idx)
+{
+  ASSERT (idx < s->page_cnt);
+  return &s->pages[idx];
+}
+
+/* Gives page P, a page of a segment without a frame, the frame
+   that holds the segment page's data, reading the data in from
+   swap if no process has it resident.  The page table's lock
+   must be held.  On success, returns true with P's frame locked,
+   and sets *READ to whether the data had to be read. */
+bool
+shm_page_in (struct page *p, bool *read)
+{
+  struct shm_page *sp = p->shm;
+  struct frame *f;
+
+  ASSERT (p->frame == NULL);
+
+  *read = false;
+  for (;;)
+    {
+      lock_acquire (&shm_lock);
+      f = sp->store.frame;
+      lock_release (&shm_lock);
+
+      if (f != NULL)
+        {
+          bool same;
+
+          /* Join the frame, if it still holds the data once we
+             have it locked.  Waiting with the page table locked is
+             safe, because a process attaches a segment only once,
+             so F's other pages are all other processes'. */
+          lock_acquire (&f->lock);
+          lock_acquire (&shm_lock);
+          same = sp->store.frame == f;
+          lock_release (&shm_lock);
+          if (same)
+            {
+              frame_add_page (f, p);
+              p->frame = f;
+              return true;
+            }
+          lock_release (&f->lock);
+          continue;
+        }
+
+      /* Without SHM_LOCK, since getting a frame may evict another
+         segment page. */
+      f = frame_alloc_and_lock (p, sp->store.sector == (block_sector_t) -1);
+      if (f == NULL)
+        return false;
+      p->frame = f;
+
+      lock_acquire (&shm_lock);
+      if (sp->store.frame == NULL)
+        {
+          sp->store.frame = f;
+          lock_release (&shm_lock);
+          break;
+        }
+      lock_release (&shm_lock);
+
+      /* Another process brought the data in meanwhile. */
+      frame_release (p);
+      p->frame = NULL;
+    }
+
+  /* Other processes' pages now wait for F's lock. */
+  if (sp->store.sector != (block_sector_t) -1)
+    {
+      swap_in (&sp->store);
+      *read = true;
+    }
+  sp->dirty = false;
+  return true;
+}
+
+/* Notes that page P of a segment, whose frame is locked by the
+   current thread and which is now unmapped, leaves its frame.
+   DIRTY says whether P was written.  If P is the frame's last
+   page, saves the data to swap, if it changed, when KEEP is
+   true, and detaches the data from the frame.  Returns false if
+   swap is full, in which case nothing changes. */
+static bool
+leave_frame (struct page *p, bool dirty, bool keep)
+{
+  struct shm_page *sp = p->shm;
+  struct frame *f = p->frame;
+
+  ASSERT (lock_held_by_current_thread (&f->lock));
+  ASSERT (sp->store.frame == f);
+
+  sp->dirty = sp->dirty || dirty;
+  if (list_front (&f->pages) != list_back (&f->pages))
+    return true;
+
+  if (keep && sp->dirty)
+    {
+      if (!swap_out (&sp->store))
+        return false;
+      sp->dirty = false;
+    }
+  lock_acquire (&shm_lock);
+  sp->store.frame = NULL;
+  lock_release (&shm_lock);
+  return true;
+}
+
+/* Evicts page P of a segment, as page_out() does, which already
+   unmapped it.  DIRTY says whether P was written.  Returns false
+   if the data could not be written to swap. */
+bool
+shm_page_out (struct page *p, bool dirty)
+{
+  return leave_frame (p, dirty, true);
+}
+
+/* Notes that page P of a segment, whose frame is locked by the
+   current thread, is leaving its process's page table, as
+   free_page() is about to remove it from the frame.  DIRTY says
+   whether P was written.  The data is saved for the segment's
+   other attachments, if any.  If swap is full, the changes since
+   it was last saved are lost. */
+void
+shm_page_release (struct page *p, bool dirty)
+{
+  bool keep;
+
+  lock_acquire (&shm_lock);
+  keep = p->shm->segment->ref_cnt > 1;
+  lock_release (&shm_lock);
+
+  if (!leave_frame (p, dirty, keep))
+    leave_frame (p, false, false);
+}
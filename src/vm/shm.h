@@ -0,0 +1,23 @@
+#ifndef VM_SHM_H
+#define VM_SHM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct page;
+
+/* Longest name of a shared memory segment, in bytes. */
+#define SHM_NAME_MAX 14
+
+void shm_init (void);
+struct shm *shm_create (const char *name, size_t page_cnt);
+struct shm *shm_open (const char *name);
+void shm_close (struct shm *);
+size_t shm_page_cnt (const struct shm *);
+struct shm_page *shm_page (struct shm *, size_t idx);
+
+bool shm_page_in (struct page *, bool *read);
+bool shm_page_out (struct page *, bool dirty);
+void shm_page_release (struct page *, bool dirty);
+
+#endif /* vm/shm.h */
@@ -0,0 +1,468 @@
+#include "vm/swap.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <lz.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "threads/loader.h"
+#include "threads/palloc.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "vm/frame.h"
+#include "vm/page.h"
+
+/* Swap.
+
+   The swap device is divided into slots of PAGE_SECTORS sectors,
+   one page each, tracked by SWAP_BITMAP.  A page keeps its slot
+   after it is swapped back in, so that it can be evicted again
+   without writing it if it has not changed in the meantime; the
+   slot is released only when the page is destroyed.
+
+   Every page goes in or out in a single multi-sector request.
+   swap_out_batch() goes further and writes several pages with
+   one request, by giving them consecutive slots, in order of
+   process and virtual address, and gathering their contents in
+   STAGING first.  Virtually adjacent pages written together thus
+   land in adjacent slots, so that swap_in_batch() can later read
+   them back together too.
+
+   Ahead of the swap device sits a compressed tier in memory.  A
+   page going out is first compressed with lz_compress(), and if
+   it shrinks to at most half a page and the tier has room, its
+   compressed copy is kept in an object cache for the smallest
+   size class that holds it, instead of being written to disk.
+   Its SECTOR is then SWAP_MEMORY and swap_in() decompresses it.
+   An all-zero page takes no space at all.  Like a slot, the copy
+   stays after the page comes back in and is freed only when the
+   page is destroyed or swapped out again.  The tier holds at
+   most ZSWAP_FRACTION of RAM, counting the size classes' space,
+   so that it cannot starve the frames it is meant to save; once
+   it is full, pages go to the device as before. */
+
+/* The swap device. */
+static struct block *swap_device;
+
+/* Used swap slots. */
+static struct bitmap *swap_bitmap;
+
+/* Protects SWAP_BITMAP. */
+static struct lock swap_lock;
+
+/* Buffer for gathering the pages of a batch; its own lock. */
+static uint8_t *staging;
+static struct lock staging_lock;
+
+/* Number of sectors per page. */
+#define PAGE_SECTORS (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* The compressed tier may use 1/ZSWAP_FRACTION of RAM. */
+#define ZSWAP_FRACTION 8
+
+/* Size classes of the compressed tier, largest last, chosen so
+   that a slab holds 32, 16, 8, 6, 5, 4, 3, or 2 objects with
+   little left over. */
+static const size_t zclass_sizes[] =
+  {120, 248, 504, 672, 808, 1016, 1352, 2032};
+#define ZCLASS_CNT (sizeof zclass_sizes / sizeof *zclass_sizes)
+#define ZSIZE_MAX 2032
+
+/* Compressed tier: a cache for each size class, the bytes in use
+   and the most allowed, and a compression buffer and hash table.
+   ZSWAP_LOCK protects all but the caches, which lock
+   themselves. */
+static struct kmem_cache *zcaches[ZCLASS_CNT];
+static char zcache_names[ZCLASS_CNT][16];
+static size_t zswap_bytes, zswap_limit;
+static uint8_t *zbuf;
+static uint16_t ztable[LZ_TABLE_SIZE];
+static struct lock zswap_lock;
+
+/* Statistics. */
+static unsigned long long swap_in_cnt, swap_out_cnt, batched_write_cnt;
+static unsigned long long batched_read_cnt;
+static unsigned long long zswap_in_cnt, zswap_out_cnt, zswap_zero_cnt;
+static unsigned long long zswap_reject_cnt, zswap_full_cnt;
+
+static void zswap_init (void);
+static void zswap_free (struct page *);
+
+/* Sets up swap. */
+void
+swap_init (void) 
+{
+  swap_device = block_get_role (BLOCK_SWAP);
+  if (swap_device == NULL) 
+    {
+      printf ("no swap device--swap disabled\n");
+      swap_bitmap = bitmap_create (0);
+    }
+  else
+    swap_bitmap = bitmap_create (block_size (swap_device) / PAGE_SECTORS);
+  if (swap_bitmap == NULL)
+    PANIC ("couldn't create swap bitmap");
+  staging = palloc_get_multiple (PAL_ASSERT, SWAP_BATCH_MAX);
+  lock_init (&swap_lock);
+  lock_set_name (&swap_lock, "swap");
+  lock_init (&staging_lock);
+
+  zswap_init ();
+}
+
+/* Sets up the compressed tier. */
+static void
+zswap_init (void) 
+{
+  size_t i;
+
+  lock_init (&zswap_lock);
+  lock_set_name (&zswap_lock, "zswap");
+  zbuf = palloc_get_page (PAL_ASSERT);
+  for (i = 0; i < ZCLASS_CNT; i++)
+    {
+      snprintf (zcache_names[i], sizeof zcache_names[i], "zswap %zu",
+                zclass_sizes[i]);
+      zcaches[i] = kmem_cache_create (zcache_names[i], zclass_sizes[i],
+                                      NULL);
+      if (zcaches[i] == NULL)
+        PANIC ("couldn't create compressed swap caches");
+    }
+  zswap_limit = (size_t) init_ram_pages / ZSWAP_FRACTION * PGSIZE;
+}
+
+/* Returns true if the page at PAGE is all zeros. */
+static bool
+is_zeros (const void *page) 
+{
+  const uint32_t *p = page;
+  size_t i;
+
+  for (i = 0; i < PGSIZE / sizeof *p; i++)
+    if (p[i] != 0)
+      return false;
+  return true;
+}
+
+/* Returns the index of the smallest size class that holds SIZE
+   bytes, which must be 1...ZSIZE_MAX. */
+static size_t
+zclass_for (size_t size) 
+{
+  size_t i;
+
+  ASSERT (size > 0 && size <= ZSIZE_MAX);
+  for (i = 0; zclass_sizes[i] < size; i++)
+    continue;
+  return i;
+}
+
+/* Frees page P's compressed copy, if it has one, leaving it with
+   no swapped-out copy at all. */
+static void
+zswap_free (struct page *p) 
+{
+  if (p->sector != SWAP_MEMORY)
+    return;
+
+  if (p->zsize > 0)
+    {
+      size_t class = zclass_for (p->zsize);
+      kmem_cache_free (zcaches[class], p->zdata);
+      lock_acquire (&zswap_lock);
+      zswap_bytes -= zclass_sizes[class];
+      lock_release (&zswap_lock);
+    }
+  p->zdata = NULL;
+  p->zsize = 0;
+  p->sector = (block_sector_t) -1;
+}
+
+/* Releases page P's swap slot, if it has one. */
+static void
+free_slot (struct page *p) 
+{
+  if (p->sector != (block_sector_t) -1 && p->sector != SWAP_MEMORY)
+    {
+      lock_acquire (&swap_lock);
+      bitmap_reset (swap_bitmap, p->sector / PAGE_SECTORS);
+      lock_release (&swap_lock);
+      p->sector = (block_sector_t) -1;
+    }
+}
+
+/* Tries to keep a compressed copy of page P's frame, which must be
+   locked by the current thread, in the compressed tier, in place
+   of any copy it has in swap.  Returns true if successful, false
+   if the page does not compress well or the tier is full, in
+   which case P's swap copy is as before. */
+static bool
+zswap_out (struct page *p) 
+{
+  size_t size, class = 0;
+  void *data = NULL;
+
+  lock_acquire (&zswap_lock);
+  if (is_zeros (p->frame->base))
+    {
+      /* Keep no data at all for a page of zeros. */
+      size = 0;
+      zswap_zero_cnt++;
+    }
+  else
+    {
+      size = lz_compress (p->frame->base, PGSIZE, zbuf, ZSIZE_MAX, ztable);
+      if (size == 0)
+        {
+          zswap_reject_cnt++;
+          lock_release (&zswap_lock);
+          return false;
+        }
+      class = zclass_for (size);
+      if (zswap_bytes + zclass_sizes[class] > zswap_limit
+          || (data = kmem_cache_alloc (zcaches[class])) == NULL)
+        {
+          zswap_full_cnt++;
+          lock_release (&zswap_lock);
+          return false;
+        }
+      memcpy (data, zbuf, size);
+      zswap_bytes += zclass_sizes[class];
+    }
+  zswap_out_cnt++;
+  lock_release (&zswap_lock);
+
+  zswap_free (p);
+  free_slot (p);
+  p->sector = SWAP_MEMORY;
+  p->zdata = data;
+  p->zsize = size;
+  return true;
+}
+
+/* Reads page P, which must have a swap slot, into its frame,
+   which must be locked by the current thread.  P keeps its
+   slot. */
+void
+swap_in (struct page *p) 
+{
+  ASSERT (p->frame != NULL);
+  ASSERT (lock_held_by_current_thread (&p->frame->lock));
+  ASSERT (p->sector != (block_sector_t) -1);
+
+  if (p->sector == SWAP_MEMORY)
+    {
+      if (p->zsize == 0)
+        memset (p->frame->base, 0, PGSIZE);
+      else if (!lz_decompress (p->zdata, p->zsize, p->frame->base, PGSIZE))
+        PANIC ("corrupt compressed swap page");
+      zswap_in_cnt++;
+      return;
+    }
+  block_read_multiple (swap_device, p->sector, PAGE_SECTORS, p->frame->base);
+  swap_in_cnt++;
+}
+
+/* Reads the CNT pages in PAGES, at most SWAP_BATCH_MAX, which
+   must be in consecutive swap slots on the swap device, in order,
+   into their frames with a single request, as swap_in() does for
+   one page.  Each page's frame must be locked by the current
+   thread. */
+void
+swap_in_batch (struct page **pages, size_t cnt) 
+{
+  size_t i;
+
+  ASSERT (cnt > 0 && cnt <= SWAP_BATCH_MAX);
+
+  lock_acquire (&staging_lock);
+  block_read_multiple (swap_device, pages[0]->sector, cnt * PAGE_SECTORS,
+                       staging);
+  for (i = 0; i < cnt; i++)
+    {
+      ASSERT (lock_held_by_current_thread (&pages[i]->frame->lock));
+      ASSERT (pages[i]->sector == pages[0]->sector + i * PAGE_SECTORS);
+      memcpy (pages[i]->frame->base, staging + i * PGSIZE, PGSIZE);
+    }
+  lock_release (&staging_lock);
+  swap_in_cnt += cnt;
+  batched_read_cnt++;
+}
+
+/* Returns true if page B's slot on the swap device directly
+   follows page A's. */
+bool
+swap_follows (const struct page *a, const struct page *b) 
+{
+  return (a->sector != (block_sector_t) -1 && a->sector != SWAP_MEMORY
+          && b->sector == a->sector + PAGE_SECTORS);
+}
+
+/* Returns true if page A belongs before page B in a batch: by
+   process, then by virtual address. */
+static bool
+batch_less (const struct page *a, const struct page *b) 
+{
+  if (a->table != b->table)
+    return (uintptr_t) a->table < (uintptr_t) b->table;
+  return a->addr < b->addr;
+}
+
+/* Claims CNT consecutive free swap slots and returns the first
+   slot's starting sector, or -1 if there is no such run. */
+static block_sector_t
+alloc_slots (size_t cnt) 
+{
+  size_t slot;
+
+  lock_acquire (&swap_lock);
+  slot = bitmap_scan_and_flip (swap_bitmap, 0, cnt, false);
+  lock_release (&swap_lock);
+  return slot != BITMAP_ERROR ? slot * PAGE_SECTORS : (block_sector_t) -1;
+}
+
+/* Marks page P as swapped out: it now lives in its swap slot,
+   not in its file. */
+static void
+swapped_out (struct page *p) 
+{
+  p->file = NULL;
+  p->file_offset = 0;
+  p->file_bytes = 0;
+  swap_out_cnt++;
+}
+
+/* Writes page P's frame, which must be locked by the current
+   thread, to its swap slot, giving it a slot if it does not have
+   one.  Returns true if successful, false if swap is full. */
+static bool
+write_slot (struct page *p) 
+{
+  ASSERT (p->sector != SWAP_MEMORY);
+
+  if (p->sector == (block_sector_t) -1)
+    {
+      p->sector = alloc_slots (1);
+      if (p->sector == (block_sector_t) -1)
+        return false;
+    }
+  block_write_multiple (swap_device, p->sector, PAGE_SECTORS,
+                        p->frame->base);
+  swapped_out (p);
+  return true;
+}
+
+/* Writes page P's frame, which must be locked by the current
+   thread, to swap: to the compressed tier if possible, otherwise
+   to its swap slot, giving it a slot if it does not have one.
+   Returns true if successful, false if swap is full. */
+bool
+swap_out (struct page *p) 
+{
+  ASSERT (p->frame != NULL);
+  ASSERT (lock_held_by_current_thread (&p->frame->lock));
+
+  if (zswap_out (p))
+    {
+      swapped_out (p);
+      return true;
+    }
+  zswap_free (p);
+  return write_slot (p);
+}
+
+/* Writes the CNT pages in PAGES, at most SWAP_BATCH_MAX, to
+   swap, as swap_out() does for one page.  The pages that do not
+   go to the compressed tier get new, consecutive slots, if
+   possible, in order of process and address, and are written
+   together in a single request.  Each page's frame must be locked
+   by the current thread.  Returns true if every page was written,
+   false if swap filled up first. */
+bool
+swap_out_batch (struct page **pages, size_t cnt) 
+{
+  struct page *batch[SWAP_BATCH_MAX];
+  size_t n = 0;
+  block_sector_t sector;
+  size_t i;
+
+  ASSERT (cnt <= SWAP_BATCH_MAX);
+
+  /* Pages that compress well stay in memory.  The others give up
+     their old slots, so that the batch can get adjacent ones, and
+     are sorted into BATCH. */
+  for (i = 0; i < cnt; i++)
+    {
+      struct page *p = pages[i];
+
+      ASSERT (lock_held_by_current_thread (&p->frame->lock));
+      if (zswap_out (p))
+        swapped_out (p);
+      else
+        {
+          size_t j;
+
+          zswap_free (p);
+          free_slot (p);
+          for (j = n++; j > 0 && batch_less (p, batch[j - 1]); j--)
+            batch[j] = batch[j - 1];
+          batch[j] = p;
+        }
+    }
+
+  if (n == 0)
+    return true;
+  if (n == 1)
+    return write_slot (batch[0]);
+
+  /* Without a long enough run of free slots, fall back to one
+     page at a time. */
+  sector = alloc_slots (n);
+  if (sector == (block_sector_t) -1)
+    {
+      for (i = 0; i < n; i++)
+        if (!write_slot (batch[i]))
+          return false;
+      return true;
+    }
+
+  lock_acquire (&staging_lock);
+  for (i = 0; i < n; i++)
+    {
+      ASSERT (lock_held_by_current_thread (&batch[i]->frame->lock));
+      memcpy (staging + i * PGSIZE, batch[i]->frame->base, PGSIZE);
+      batch[i]->sector = sector + i * PAGE_SECTORS;
+      swapped_out (batch[i]);
+    }
+  block_write_multiple (swap_device, sector, n * PAGE_SECTORS,
+                        staging);
+  lock_release (&staging_lock);
+  batched_write_cnt++;
+  return true;
+}
+
+/* Releases page P's swap slot or compressed copy, if it has
+   one. */
+void
+swap_free (struct page *p) 
+{
+  zswap_free (p);
+  free_slot (p);
+}
+
+/* Prints swap statistics. */
+void
+swap_print_stats (void) 
+{
+  printf ("Swap: %llu pages in, %llu pages out, %llu batched writes, "
+          "%llu batched reads\n", swap_in_cnt, swap_out_cnt,
+          batched_write_cnt, batched_read_cnt);
+  printf ("Swap: compressed tier: %llu pages in, %llu pages out "
+          "(%llu all zeros), %zu of %zu bytes used\n",
+          zswap_in_cnt, zswap_out_cnt, zswap_zero_cnt,
+          zswap_bytes, zswap_limit);
+  printf ("Swap: compressed tier: %llu pages incompressible, "
+          "%llu turned away full\n", zswap_reject_cnt, zswap_full_cnt);
+}
@@ -0,0 +1,26 @@
+#ifndef VM_SWAP_H
+#define VM_SWAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/block.h"
+
+struct page;
+
+/* The SECTOR of a page whose swapped-out copy is compressed in
+   memory rather than on the swap device. */
+#define SWAP_MEMORY ((block_sector_t) -2)
+
+/* Most pages that swap_out_batch() writes at once. */
+#define SWAP_BATCH_MAX 8
+
+void swap_init (void);
+void swap_in (struct page *);
+void swap_in_batch (struct page **, size_t cnt);
+bool swap_follows (const struct page *, const struct page *);
+bool swap_out (struct page *);
+bool swap_out_batch (struct page **, size_t cnt);
+void swap_free (struct page *);
+void swap_print_stats (void);
+
+#endif /* vm/swap.h */